@@ -995,6 +995,10 @@ wb_usr.tree =
             {
               name= {en= "Picture"},
               link= "drv/picture.html"
+            },
+            {
+              name= {en= "Profile"},
+              link= "drv/profile.html"
             }
           }
         },
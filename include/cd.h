@@ -27,6 +27,7 @@ typedef struct _cdContext cdContext;
 typedef struct _cdCanvas cdCanvas;
 typedef struct _cdCanvas cdState;
 typedef struct _cdImage cdImage;
+typedef struct _cdPlayer cdPlayer;
 
 /* client images using bitmap structure */
 typedef struct _cdBitmap {
@@ -36,6 +37,15 @@ typedef struct _cdBitmap {
   void *data;
 } cdBitmap;
 
+/* memory output of the file based drivers, "-m%p" is used in place of the file name */
+typedef int (*cdWriteCB)(void* user_data, const unsigned char* data, int size);  /* must return size */
+typedef struct _cdMemoryOutput {
+  cdWriteCB write_cb;   /* if not NULL receives the data while it is written */
+  void* user_data;
+  unsigned char* data;  /* else returns all the data when the canvas is killed, release it with free */
+  long size;
+} cdMemoryOutput;
+
 
 /* library */
 char*         cdVersion(void);
@@ -74,6 +84,11 @@ char*    cdCanvasGetAttribute(cdCanvas* canvas, const char* name);
 
 /* interpretation */
 int  cdCanvasPlay(cdCanvas* canvas, cdContext *context, int xmin, int xmax, int ymin, int ymax, void *data);
+double cdCanvasPlayTolerance(cdCanvas* canvas, double tolerance);
+cdPlayer* cdCanvasPlayBegin(cdCanvas* canvas, cdContext *context, int xmin, int xmax, int ymin, int ymax, void *data);
+int       cdPlayerStep(cdPlayer* player, int count, double time);
+double    cdPlayerProgress(cdPlayer* player);
+int       cdPlayerEnd(cdPlayer* player);
 
 /* coordinate transformation */
 void cdCanvasGetSize(cdCanvas* canvas, int *width, int *height, double *width_mm, double *height_mm);
@@ -454,6 +469,7 @@ enum {
 typedef int(*cdSizeCB)(cdCanvas *canvas, int w, int h, double w_mm, double h_mm);
 #define CD_ABORT 1
 #define CD_CONTINUE 0
+#define CD_PLAYING 2       /* returned by cdPlayerStep while there is more to play */
 
 /* simulation flags */
 #define CD_SIM_NONE         0x0000
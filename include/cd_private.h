@@ -45,6 +45,12 @@ typedef struct _cdfRect
   double xmin, xmax, ymin, ymax; 
 } cdfRect; 
 
+typedef struct _cdSpan 
+{
+  int y, xmin, xmax;       /* horizontal interval, xmin and xmax are included */
+  unsigned char coverage;  /* 255 for interior spans, less for antialiased pixels */
+} cdSpan; 
+
 typedef struct _cdAttribute
 {
   const char *name;
@@ -77,6 +83,13 @@ struct _cdContext
   /* can be NULL */
   int   (*cxPlay)(cdCanvas* canvas, int xmin, int xmax, int ymin, int ymax, void *data); 
   int   (*cxRegisterCallback)(int cb, cdCallback func);
+
+  /* incremental play, can be NULL, cxPlay is used instead. 
+     cxPlayStep returns CD_PLAYING while there are primitives left. */
+  void*  (*cxPlayBegin)(cdCanvas* canvas, int xmin, int xmax, int ymin, int ymax, void *data);
+  int    (*cxPlayStep)(void* player, int count);
+  double (*cxPlayProgress)(void* player);
+  void   (*cxPlayEnd)(void* player);
 };
 
 struct _cdCanvas
@@ -154,6 +167,14 @@ struct _cdCanvas
   int    (*cxActivate)(cdCtxCanvas* ctxcanvas);
   void   (*cxDeactivate)(cdCtxCanvas* ctxcanvas);
 
+  /* spans of a filled primitive, drawn with the current interior style,
+     used by the simulation, when NULL each span is drawn using the simulation horizontal lines */
+  void   (*cxSpans)(cdCtxCanvas* ctxcanvas, const cdSpan* spans, int n);
+
+  /* composes the color using a coverage map (0-255, top down) placed like an image, 
+     used by the text simulation, when NULL the simulation uses cxPutImageRectRGBA */
+  void   (*cxPutMask)(cdCtxCanvas* ctxcanvas, int w, int h, const unsigned char* mask, int x, int y, long color);
+
   /* the driver must update these, when the canvas is created and
      whenever the canvas change its size or bpp. */
   int w,h;            /* size in pixels */              /****  pixel =   mm   * res  ****/
@@ -226,6 +247,10 @@ struct _cdCanvas
   /* simulation flags */
   int sim_mode;
 
+  /* play level of detail */
+  double play_tolerance;     /* polylines and polygons are simplified by this tolerance, in pixels, while playing */
+  int playing;               /* number of plays in progress in this canvas */
+
   /* WC */
   double s, sx, tx, sy, ty;   /* Transform Window -> Viewport (scale+translation)*/
   cdfRect window;             /* Window in WC */
@@ -287,8 +312,40 @@ void cdSetPaperSize(int size, double *w_pt, double *h_pt);
 int cdGetFontFileName(const char* type_face, char* filename);
 int cdGetFontFileNameDefault(const char *type_face, int style, char* filename);
 int cdGetFontFileNameSystem(const char *type_face, int style, char* filename);
+void cdFontLock(void);
+void cdFontUnlock(void);
 int cdStrTmpFileName(char* filename);
 
+/******************/
+/* output streams */
+/******************/
+
+/* Buffered output used by the file based drivers.
+   The sink can be a file, a memory block, a zlib compressed stream
+   written in another stream, or a callback. */
+typedef struct _cdStream cdStream;
+
+cdStream* cdStreamOpenOutput(const char* filename, int binary);  /* file or "-m%p", see cdMemoryOutput */
+cdStream* cdStreamOpenFile(const char* filename, int binary);
+cdStream* cdStreamOpenMem(void);
+cdStream* cdStreamOpenZip(cdStream* target, int gzip);  /* target is closed together */
+cdStream* cdStreamOpenSeekable(cdStream* target);  /* target or a memory stream that writes in target when closed */
+cdStream* cdStreamOpenCallback(cdWriteCB func, void* user_data);
+int cdStreamClose(cdStream* stream);  /* returns CD_ERROR if any write failed */
+void cdStreamFlush(cdStream* stream);
+int cdStreamError(cdStream* stream);
+long cdStreamTell(cdStream* stream);
+int cdStreamSeek(cdStream* stream, long pos);  /* only for file and memory */
+unsigned char* cdStreamGetData(cdStream* stream, long *size);  /* only for memory, valid until closed */
+void cdStreamWrite(cdStream* stream, const void* data, int size);
+void cdStreamPutChar(cdStream* stream, int c);
+void cdStreamPutString(cdStream* stream, const char* str);
+void cdStreamPutInt(cdStream* stream, long v);
+void cdStreamPutReal(cdStream* stream, double v);  /* same as "%g" */
+void cdStreamPutFixed(cdStream* stream, double v, int dec);  /* same as "%.*f" */
+void cdStreamPutDecimal(cdStream* stream, double v, int dec);  /* "%.*f" without the trailing zeros */
+void cdStreamPrintf(cdStream* stream, const char* format, ...);
+
 void cdCanvasPoly(cdCanvas* canvas, int mode, cdPoint* points, int n);
 void cdCanvasGetArcBox(int xc, int yc, int w, int h, double a1, double a2, int *xmin, int *xmax, int *ymin, int *ymax);
 int cdCanvasGetArcPathF(const cdPoint* poly, double *xc, double *yc, double *w, double *h, double *a1, double *a2);
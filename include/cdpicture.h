@@ -15,6 +15,11 @@ cdContext* cdContextPicture(void);
 
 #define CD_PICTURE cdContextPicture()
 
+unsigned char* cdPictureSaveData(cdCanvas* canvas, int *size);
+int cdPictureLoadData(cdCanvas* canvas, const unsigned char* data, int size);
+int cdPictureSaveFile(cdCanvas* canvas, const char* filename);
+int cdPictureLoadFile(cdCanvas* canvas, const char* filename);
+
 #ifdef __cplusplus
 }
 #endif
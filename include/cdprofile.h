@@ -0,0 +1,23 @@
+/** \file
+ * \brief CD Profile driver
+ *
+ * See Copyright Notice in cd.h
+ */
+
+#ifndef __CD_PROFILE_H
+#define __CD_PROFILE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+cdContext* cdContextProfile(void);
+
+#define CD_PROFILE cdContextProfile()
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ifndef __CD_PROFILE_H */
+
@@ -10,6 +10,12 @@
 #include <assert.h>
 #include <memory.h>
 #include <stdarg.h>
+#include <limits.h>
+#ifdef WIN32
+#include <time.h>
+#else
+#include <sys/time.h>
+#endif
 
 
 #include "cd.h"
@@ -594,6 +600,8 @@ char* cdCanvasGetAttribute(cdCanvas* canvas, const char* name)
 
 int cdCanvasPlay(cdCanvas* canvas, cdContext* context, int xmin, int xmax, int ymin, int ymax, void *data)
 {
+  int ret;
+
   assert(context);
   assert(canvas);
   if (!_cdCheckCanvas(canvas) || !context || !context->cxPlay) return CD_ERROR;
@@ -602,7 +610,159 @@ int cdCanvasPlay(cdCanvas* canvas, cdContext* context, int xmin, int xmax, int y
   if (xmin > xmax) _cdSwapInt(xmin, xmax);
   if (ymin > ymax) _cdSwapInt(ymin, ymax);
 
-  return context->cxPlay(canvas, xmin, xmax, ymin, ymax, data);
+  canvas->playing++;
+  ret = context->cxPlay(canvas, xmin, xmax, ymin, ymax, data);
+  canvas->playing--;
+
+  return ret;
+}
+
+double cdCanvasPlayTolerance(cdCanvas* canvas, double tolerance)
+{
+  double play_tolerance;
+
+  assert(canvas);
+  if (!_cdCheckCanvas(canvas)) return CD_ERROR;
+
+  play_tolerance = canvas->play_tolerance;
+
+  if (tolerance == CD_QUERY)
+    return play_tolerance;
+
+  canvas->play_tolerance = tolerance < 0? 0: tolerance;
+  return play_tolerance;
+}
+
+struct _cdPlayer
+{
+  cdCanvas* canvas;
+  cdContext* context;
+  void* player;        /* driver player, NULL if the driver has only cxPlay */
+  void* data;
+  int xmin, xmax, ymin, ymax;
+  int status;          /* CD_PLAYING until the play ends */
+};
+
+/* number of primitives played between checks of the time limit */
+#define CD_PLAYER_STEP 16
+
+static double cdPlayerTime(void)
+{
+#ifdef WIN32
+  return (clock()*1000.)/CLOCKS_PER_SEC;  /* in Windows clock is the elapsed time */
+#else
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec*1000. + tv.tv_usec/1000.;
+#endif
+}
+
+cdPlayer* cdCanvasPlayBegin(cdCanvas* canvas, cdContext* context, int xmin, int xmax, int ymin, int ymax, void *data)
+{
+  cdPlayer* player;
+  void* ctxplayer = NULL;
+
+  assert(context);
+  assert(canvas);
+  if (!_cdCheckCanvas(canvas) || !context || (!context->cxPlay && !context->cxPlayBegin)) return NULL;
+
+  /* the all can be 0 here, do not use cdCheckBoxSize */
+  if (xmin > xmax) _cdSwapInt(xmin, xmax);
+  if (ymin > ymax) _cdSwapInt(ymin, ymax);
+
+  if (context->cxPlayBegin)
+  {
+    ctxplayer = context->cxPlayBegin(canvas, xmin, xmax, ymin, ymax, data);
+    if (!ctxplayer)
+      return NULL;
+  }
+
+  player = (cdPlayer*)malloc(sizeof(cdPlayer));
+  player->canvas = canvas;
+  player->context = context;
+  player->player = ctxplayer;
+  player->data = data;
+  player->xmin = xmin;
+  player->xmax = xmax;
+  player->ymin = ymin;
+  player->ymax = ymax;
+  player->status = CD_PLAYING;
+  return player;
+}
+
+int cdPlayerStep(cdPlayer* player, int count, double time)
+{
+  double start = 0;
+  cdContext* context;
+
+  assert(player);
+  if (!player) return CD_ERROR;
+  if (player->status != CD_PLAYING) return player->status;
+
+  context = player->context;
+  if (!player->player)
+  {
+    /* no incremental play, everything is played at once */
+    player->canvas->playing++;
+    player->status = context->cxPlay(player->canvas, player->xmin, player->xmax, player->ymin, player->ymax, player->data);
+    player->canvas->playing--;
+    return player->status;
+  }
+
+  if (time > 0)
+    start = cdPlayerTime();
+
+  for (;;)
+  {
+    int n = (time > 0)? CD_PLAYER_STEP: INT_MAX;
+    if (count > 0 && count < n)
+      n = count;
+
+    player->canvas->playing++;
+    player->status = context->cxPlayStep(player->player, n);
+    player->canvas->playing--;
+    if (player->status != CD_PLAYING)
+      break;
+
+    if (count > 0)
+    {
+      count -= n;
+      if (count == 0)
+        break;
+    }
+
+    if (time > 0 && cdPlayerTime() - start >= time)
+      break;
+  }
+
+  return player->status;
+}
+
+double cdPlayerProgress(cdPlayer* player)
+{
+  assert(player);
+  if (!player) return 0;
+  if (player->status != CD_PLAYING) return 100;
+  if (!player->player || !player->context->cxPlayProgress) return 0;
+  return player->context->cxPlayProgress(player->player);
+}
+
+int cdPlayerEnd(cdPlayer* player)
+{
+  int status;
+
+  assert(player);
+  if (!player) return CD_ERROR;
+
+  if (player->player && player->context->cxPlayEnd)
+    player->context->cxPlayEnd(player->player);
+
+  status = player->status;
+  if (status == CD_PLAYING)
+    status = CD_ABORT;
+
+  free(player);
+  return status;
 }
 
 int cdContextRegisterCallback(cdContext *context, int cb, cdCallback func)
@@ -291,6 +291,166 @@ void cdCanvasPoly(cdCanvas* canvas, int mode, cdPoint* points, int n)
     canvas->cxPoly(canvas->ctxcanvas, mode, points, n);
 }
 
+#define sPolyX(_i) (poly? (double)poly[_i].x: fpoly[_i].x)
+#define sPolyY(_i) (poly? (double)poly[_i].y: fpoly[_i].y)
+
+static double sPolyDist2(cdPoint* poly, cdfPoint* fpoly, int i, int j)
+{
+  double dx = sPolyX(i) - sPolyX(j), 
+         dy = sPolyY(i) - sPolyY(j);
+  return dx*dx + dy*dy;
+}
+
+/* square of the distance from the vertex i to the segment [a,b] */
+static double sPolySegDist2(cdPoint* poly, cdfPoint* fpoly, int i, int a, int b)
+{
+  double ax = sPolyX(a), ay = sPolyY(a),
+         dx = sPolyX(b) - ax, dy = sPolyY(b) - ay,
+         px = sPolyX(i) - ax, py = sPolyY(i) - ay,
+         len2 = dx*dx + dy*dy, t;
+
+  if (len2 > 0)
+  {
+    t = (px*dx + py*dy)/len2;
+    if (t > 1) t = 1;
+    if (t > 0)
+    {
+      px -= t*dx;
+      py -= t*dy;
+    }
+  }
+
+  return px*px + py*py;
+}
+
+/* Simplifies a polyline or a polygon in place, 
+   vertices closer than tolerance to the previous kept vertex are removed,
+   then the Douglas-Peucker algorithm is applied. Returns the new number of vertices.
+   Closed polygons keep at least 3 vertices. */
+static int sSimplifyPoly(cdPoint* poly, cdfPoint* fpoly, int n, int closed, double tolerance)
+{
+  double d, dmax, tol2 = tolerance*tolerance;
+  int i, k, m, last, top, first, end, *index, *stack;
+  unsigned char* keep;
+
+  if (n < 3)
+    return n;
+
+  index = (int*)malloc((3*n+2)*sizeof(int) + n);
+  stack = index + n;
+  keep = (unsigned char*)(stack + 2*n+2);
+
+  /* vertices inside the same pixel */
+  index[0] = 0;
+  m = 1; last = 0;
+  for (i = 1; i < n-1; i++)
+  {
+    if (sPolyDist2(poly, fpoly, i, last) > tol2)
+    {
+      index[m++] = i;
+      last = i;
+    }
+  }
+  if (m > 1 && sPolyDist2(poly, fpoly, n-1, last) <= tol2)
+    m--;   /* the end vertex replaces the last kept */
+  index[m++] = n-1;
+
+  memset(keep, 0, m);
+  keep[0] = 1;
+  keep[m-1] = 1;
+  top = 0;
+
+  if (closed)
+  {
+    /* split at the vertex farthest from the first, so the polygon does not collapse */
+    dmax = 0; k = 0;
+    for (i = 1; i < m-1; i++)
+    {
+      d = sPolyDist2(poly, fpoly, index[i], index[0]);
+      if (d > dmax) { dmax = d; k = i; }
+    }
+
+    if (k)
+    {
+      keep[k] = 1;
+      stack[top++] = 0; stack[top++] = k;
+      stack[top++] = k; stack[top++] = m-1;
+    }
+  }
+  else
+  {
+    stack[top++] = 0; stack[top++] = m-1;
+  }
+
+  while (top)
+  {
+    end = stack[--top];
+    first = stack[--top];
+
+    dmax = tol2; k = 0;
+    for (i = first+1; i < end; i++)
+    {
+      d = sPolySegDist2(poly, fpoly, index[i], index[first], index[end]);
+      if (d > dmax) { dmax = d; k = i; }
+    }
+
+    if (k)
+    {
+      keep[k] = 1;
+      if (k - first > 1) { stack[top++] = first; stack[top++] = k; }
+      if (end - k > 1) { stack[top++] = k; stack[top++] = end; }
+    }
+  }
+
+  k = 0;
+  for (i = 0; i < m; i++)
+    if (keep[i]) k++;
+
+  if (closed && k < 3)
+  {
+    /* smaller than the tolerance, keep a minimal polygon */
+    index[0] = 0; index[1] = n/3; index[2] = (2*n)/3;
+    memset(keep, 1, 3);
+    m = 3;
+  }
+
+  k = 0;
+  for (i = 0; i < m; i++)
+  {
+    if (keep[i])
+    {
+      if (poly)
+        poly[k] = poly[index[i]];
+      else
+        fpoly[k] = fpoly[index[i]];
+      k++;
+    }
+  }
+
+  free(index);
+  return k;
+}
+
+static void sCanvasPolyLOD(cdCanvas* canvas)
+{
+  double tolerance = canvas->play_tolerance;
+  int closed = canvas->poly_mode != CD_OPEN_LINES;
+
+  if (canvas->use_matrix)
+  {
+    /* vertices are transformed by the driver, convert the tolerance to canvas coordinates */
+    double det = fabs(canvas->matrix[0]*canvas->matrix[3] - canvas->matrix[1]*canvas->matrix[2]);
+    if (det == 0)
+      return;
+    tolerance /= sqrt(det);
+  }
+
+  if (canvas->use_fpoly)
+    canvas->poly_n = sSimplifyPoly(NULL, canvas->fpoly, canvas->poly_n, closed, tolerance);
+  else
+    canvas->poly_n = sSimplifyPoly(canvas->poly, NULL, canvas->poly_n, closed, tolerance);
+}
+
 void cdCanvasEnd(cdCanvas* canvas)
 {
   assert(canvas);
@@ -330,6 +490,12 @@ void cdCanvasEnd(cdCanvas* canvas)
     return;
   }
 
+  if (canvas->playing && canvas->play_tolerance > 0 &&
+      (canvas->poly_mode == CD_OPEN_LINES ||
+       canvas->poly_mode == CD_CLOSED_LINES ||
+       canvas->poly_mode == CD_FILL))
+    sCanvasPolyLOD(canvas);
+
   if (canvas->use_fpoly)
     canvas->cxFPoly(canvas->ctxcanvas, canvas->poly_mode, canvas->fpoly, canvas->poly_n);
   else
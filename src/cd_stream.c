@@ -0,0 +1,646 @@
+/** \file
+ * \brief Buffered Output Streams
+ *
+ * See Copyright Notice in cd.h
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <math.h>
+
+#include "zlib.h"
+
+#include "cd.h"
+#include "cd_private.h"
+
+
+#define CD_STREAM_BUFFER_SIZE 65536
+
+enum {CD_STREAM_FILE, CD_STREAM_MEM, CD_STREAM_ZIP, CD_STREAM_CALLBACK};
+
+struct _cdStream
+{
+  int type;
+  int error;
+
+  unsigned char* buffer;   /* data not sent to the sink yet */
+  int buffer_used;
+  long pos;                /* sink position of the buffer start */
+
+  /* CD_STREAM_FILE */
+  FILE* file;
+
+  /* CD_STREAM_MEM */
+  unsigned char* mem;
+  long mem_size, mem_alloc;
+  cdMemoryOutput* output;  /* receives the data when closed */
+
+  /* CD_STREAM_ZIP, and CD_STREAM_MEM of cdStreamOpenSeekable */
+  cdStream* target;
+  z_stream zstream;
+
+  /* CD_STREAM_CALLBACK */
+  cdWriteCB func;
+  void* user_data;
+};
+
+static cdStream* sStreamCreate(int type)
+{
+  cdStream* stream = (cdStream*)calloc(1, sizeof(cdStream));
+  if (!stream)
+    return NULL;
+
+  stream->buffer = (unsigned char*)malloc(CD_STREAM_BUFFER_SIZE);
+  if (!stream->buffer)
+  {
+    free(stream);
+    return NULL;
+  }
+
+  stream->type = type;
+  return stream;
+}
+
+static void sStreamZipDeflate(cdStream* stream, int flush)
+{
+  unsigned char zbuffer[16384];
+  int ret;
+
+  do
+  {
+    stream->zstream.next_out = zbuffer;
+    stream->zstream.avail_out = sizeof(zbuffer);
+
+    ret = deflate(&stream->zstream, flush);
+    if (ret == Z_STREAM_ERROR)
+    {
+      stream->error = 1;
+      return;
+    }
+
+    cdStreamWrite(stream->target, zbuffer, sizeof(zbuffer) - stream->zstream.avail_out);
+  } while (stream->zstream.avail_out == 0 || (flush == Z_FINISH && ret == Z_OK));
+}
+
+static void sStreamSinkWrite(cdStream* stream, const unsigned char* data, int size)
+{
+  if (size <= 0)
+    return;
+
+  switch (stream->type)
+  {
+  case CD_STREAM_FILE:
+    if (fwrite(data, 1, size, stream->file) != (size_t)size)
+      stream->error = 1;
+    break;
+  case CD_STREAM_MEM:
+    if (stream->pos + size > stream->mem_alloc)
+    {
+      long mem_alloc = 2*stream->mem_alloc;
+      unsigned char* mem;
+
+      if (mem_alloc < stream->pos + size)
+        mem_alloc = stream->pos + size;
+
+      mem = (unsigned char*)realloc(stream->mem, mem_alloc);
+      if (!mem)
+      {
+        stream->error = 1;
+        return;
+      }
+
+      stream->mem = mem;
+      stream->mem_alloc = mem_alloc;
+    }
+
+    memcpy(stream->mem + stream->pos, data, size);
+    if (stream->pos + size > stream->mem_size)
+      stream->mem_size = stream->pos + size;
+    break;
+  case CD_STREAM_ZIP:
+    stream->zstream.next_in = (unsigned char*)data;
+    stream->zstream.avail_in = size;
+    sStreamZipDeflate(stream, Z_NO_FLUSH);
+    break;
+  case CD_STREAM_CALLBACK:
+    if (stream->func(stream->user_data, data, size) != size)
+      stream->error = 1;
+    break;
+  }
+
+  stream->pos += size;
+}
+
+static void sStreamWriteBuffer(cdStream* stream)
+{
+  sStreamSinkWrite(stream, stream->buffer, stream->buffer_used);
+  stream->buffer_used = 0;
+}
+
+cdStream* cdStreamOpenFile(const char* filename, int binary)
+{
+  cdStream* stream;
+  FILE* file = fopen(filename, binary? "wb": "w");
+  if (!file)
+    return NULL;
+
+  stream = sStreamCreate(CD_STREAM_FILE);
+  if (!stream)
+  {
+    fclose(file);
+    return NULL;
+  }
+
+  stream->file = file;
+  return stream;
+}
+
+cdStream* cdStreamOpenMem(void)
+{
+  return sStreamCreate(CD_STREAM_MEM);
+}
+
+cdStream* cdStreamOpenZip(cdStream* target, int gzip)
+{
+  cdStream* stream;
+
+  if (!target)
+    return NULL;
+
+  stream = sStreamCreate(CD_STREAM_ZIP);
+  if (!stream)
+  {
+    cdStreamClose(target);
+    return NULL;
+  }
+
+  /* 16 added to the window bits writes a gzip header instead of a zlib header */
+  if (deflateInit2(&stream->zstream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, gzip? 15+16: 15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+  {
+    free(stream->buffer);
+    free(stream);
+    cdStreamClose(target);
+    return NULL;
+  }
+
+  stream->target = target;
+  return stream;
+}
+
+cdStream* cdStreamOpenSeekable(cdStream* target)
+{
+  cdStream* stream;
+
+  if (!target)
+    return NULL;
+
+  if (target->type == CD_STREAM_FILE || target->type == CD_STREAM_MEM)
+    return target;
+
+  /* the data is kept in memory and written in the target when closed */
+  stream = cdStreamOpenMem();
+  if (!stream)
+  {
+    cdStreamClose(target);
+    return NULL;
+  }
+
+  stream->target = target;
+  return stream;
+}
+
+cdStream* cdStreamOpenCallback(cdWriteCB func, void* user_data)
+{
+  cdStream* stream;
+
+  if (!func)
+    return NULL;
+
+  stream = sStreamCreate(CD_STREAM_CALLBACK);
+  if (!stream)
+    return NULL;
+
+  stream->func = func;
+  stream->user_data = user_data;
+  return stream;
+}
+
+cdStream* cdStreamOpenOutput(const char* filename, int binary)
+{
+  cdMemoryOutput* output = NULL;
+  cdStream* stream;
+
+  if (filename[0] != '-' || filename[1] != 'm')
+    return cdStreamOpenFile(filename, binary);
+
+  sscanf(filename+2, "%p", (void**)&output);
+  if (!output)
+    return NULL;
+
+  if (output->write_cb)
+    return cdStreamOpenCallback(output->write_cb, output->user_data);
+
+  output->data = NULL;
+  output->size = 0;
+
+  stream = cdStreamOpenMem();
+  if (stream)
+    stream->output = output;
+  return stream;
+}
+
+int cdStreamClose(cdStream* stream)
+{
+  int error;
+
+  sStreamWriteBuffer(stream);
+
+  switch (stream->type)
+  {
+  case CD_STREAM_FILE:
+    if (fclose(stream->file) != 0)
+      stream->error = 1;
+    break;
+  case CD_STREAM_MEM:
+    if (stream->target)
+    {
+      long pos = 0;
+      while (pos < stream->mem_size)
+      {
+        int size = (stream->mem_size - pos > CD_STREAM_BUFFER_SIZE)? CD_STREAM_BUFFER_SIZE: (int)(stream->mem_size - pos);
+        cdStreamWrite(stream->target, stream->mem + pos, size);
+        pos += size;
+      }
+      if (cdStreamClose(stream->target) != CD_OK)
+        stream->error = 1;
+      if (stream->mem) free(stream->mem);
+    }
+    else if (stream->output && !stream->error)
+    {
+      /* the memory is owned by the application now */
+      stream->output->data = stream->mem;
+      stream->output->size = stream->mem_size;
+    }
+    else if (stream->mem)
+      free(stream->mem);
+    break;
+  case CD_STREAM_ZIP:
+    sStreamZipDeflate(stream, Z_FINISH);
+    deflateEnd(&stream->zstream);
+    if (cdStreamClose(stream->target) != CD_OK)
+      stream->error = 1;
+    break;
+  }
+
+  error = stream->error;
+  free(stream->buffer);
+  free(stream);
+
+  return error? CD_ERROR: CD_OK;
+}
+
+void cdStreamFlush(cdStream* stream)
+{
+  sStreamWriteBuffer(stream);
+
+  if (stream->type == CD_STREAM_FILE)
+    fflush(stream->file);
+  else if (stream->type == CD_STREAM_ZIP)
+  {
+    sStreamZipDeflate(stream, Z_SYNC_FLUSH);
+    cdStreamFlush(stream->target);
+  }
+}
+
+int cdStreamError(cdStream* stream)
+{
+  return stream->error;
+}
+
+long cdStreamTell(cdStream* stream)
+{
+  return stream->pos + stream->buffer_used;
+}
+
+int cdStreamSeek(cdStream* stream, long pos)
+{
+  if (stream->type != CD_STREAM_FILE && stream->type != CD_STREAM_MEM)
+    return CD_ERROR;
+
+  sStreamWriteBuffer(stream);
+
+  if (stream->type == CD_STREAM_FILE)
+  {
+    if (fseek(stream->file, pos, SEEK_SET) != 0)
+      return CD_ERROR;
+  }
+  else if (pos > stream->mem_size)
+    return CD_ERROR;
+
+  stream->pos = pos;
+  return CD_OK;
+}
+
+unsigned char* cdStreamGetData(cdStream* stream, long *size)
+{
+  if (stream->type != CD_STREAM_MEM)
+    return NULL;
+
+  sStreamWriteBuffer(stream);
+
+  *size = stream->mem_size;
+  return stream->mem;
+}
+
+void cdStreamWrite(cdStream* stream, const void* data, int size)
+{
+  if (stream->buffer_used + size > CD_STREAM_BUFFER_SIZE)
+  {
+    sStreamWriteBuffer(stream);
+
+    if (size >= CD_STREAM_BUFFER_SIZE)
+    {
+      sStreamSinkWrite(stream, (const unsigned char*)data, size);
+      return;
+    }
+  }
+
+  memcpy(stream->buffer + stream->buffer_used, data, size);
+  stream->buffer_used += size;
+}
+
+void cdStreamPutChar(cdStream* stream, int c)
+{
+  if (stream->buffer_used == CD_STREAM_BUFFER_SIZE)
+    sStreamWriteBuffer(stream);
+
+  stream->buffer[stream->buffer_used++] = (unsigned char)c;
+}
+
+void cdStreamPutString(cdStream* stream, const char* str)
+{
+  cdStreamWrite(stream, str, (int)strlen(str));
+}
+
+static int sFormatUInt(char* str, unsigned long v)
+{
+  char digits[32];
+  int n = 0, i;
+
+  do
+  {
+    digits[n++] = (char)('0' + v % 10);
+    v /= 10;
+  } while (v);
+
+  for (i = 0; i < n; i++)
+    str[i] = digits[n-1-i];
+
+  return n;
+}
+
+void cdStreamPutInt(cdStream* stream, long v)
+{
+  char str[32];
+  int n = 0;
+  unsigned long u = (unsigned long)v;
+
+  if (v < 0)
+  {
+    str[n++] = '-';
+    u = 0 - u;
+  }
+
+  n += sFormatUInt(str + n, u);
+  cdStreamWrite(stream, str, n);
+}
+
+void cdStreamPutReal(cdStream* stream, double v)
+{
+  /* the same text as "%g", without the locale and the parsing of printf */
+  static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9};
+  double a = fabs(v), scaled;
+  unsigned long n, div;
+  int exp, dec, len = 0;
+  char str[64];
+
+  if (v == (double)(long)v && a < 1e6)
+  {
+    /* negative zero is "-0", the sign is tested with 1/v because signbit is not C89 */
+    if (v == 0 && 1/v < 0)
+      cdStreamWrite(stream, "-", 1);
+    cdStreamPutInt(stream, (long)v);
+    return;
+  }
+
+  if (a < 1e-4 || a >= 1e6 || v != v)
+  {
+    sprintf(str, "%g", v);
+    cdStreamPutString(stream, str);
+    return;
+  }
+
+  /* 6 significant digits, dec is the number of decimals */
+  exp = (int)floor(log10(a));
+  dec = 5 - exp;
+  if (dec < 0) dec = 0;
+  if (dec > 9) dec = 9;
+
+  scaled = a * pow10[dec];
+  if (scaled < 99999.5 && dec < 9)
+  {
+    dec++;
+    scaled = a * pow10[dec];
+  }
+  else if (scaled >= 999999.5 && dec > 0)
+  {
+    dec--;
+    scaled = a * pow10[dec];
+  }
+
+  /* halfway cases depend on the exact binary value, printf is used */
+  if (fabs(scaled - floor(scaled) - 0.5) < 1e-6 || scaled >= 999999.5)
+  {
+    sprintf(str, "%g", v);
+    cdStreamPutString(stream, str);
+    return;
+  }
+
+  n = (unsigned long)(scaled + 0.5);
+
+  /* remove the trailing zeros */
+  while (dec > 0 && n % 10 == 0)
+  {
+    n /= 10;
+    dec--;
+  }
+
+  if (v < 0)
+    str[len++] = '-';
+
+  div = (unsigned long)pow10[dec];
+  len += sFormatUInt(str + len, n / div);
+
+  if (dec > 0)
+  {
+    char frac[16];
+    int flen = sFormatUInt(frac, n % div);
+
+    str[len++] = '.';
+    while (flen < dec)  /* leading zeros of the fraction */
+    {
+      str[len++] = '0';
+      dec--;
+    }
+    memcpy(str + len, frac, flen);
+    len += flen;
+  }
+
+  cdStreamWrite(stream, str, len);
+}
+
+static int sFormatFixed(char* str, double v, int dec)
+{
+  /* the same text as "%.*f", str must have room for any double */
+  static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9};
+  double a = fabs(v), scaled, ip, frac, p;
+  int len = 0;
+
+  if (dec < 0 || dec > 9 || v == 0 || a >= 1e9 || v != v)
+  {
+    sprintf(str, "%.*f", dec, v);
+    return (int)strlen(str);
+  }
+
+  p = pow10[dec];
+  scaled = a * p;
+
+  /* halfway cases depend on the exact binary value, printf is used */
+  if (fabs(scaled - floor(scaled) - 0.5) < 1e-6 + scaled*1e-15 || scaled >= 1e15)
+  {
+    sprintf(str, "%.*f", dec, v);
+    return (int)strlen(str);
+  }
+
+  /* integer part and rounded decimals, all exact in a double */
+  ip = floor(a);
+  frac = floor(scaled + 0.5) - ip*p;
+  if (frac >= p)
+  {
+    ip += 1;
+    frac -= p;
+  }
+
+  if (v < 0)
+    str[len++] = '-';
+
+  len += sFormatUInt(str + len, (unsigned long)ip);
+
+  if (dec > 0)
+  {
+    char digits[16];
+    int flen = sFormatUInt(digits, (unsigned long)frac);
+
+    str[len++] = '.';
+    while (flen < dec)  /* leading zeros of the fraction */
+    {
+      str[len++] = '0';
+      dec--;
+    }
+    memcpy(str + len, digits, flen);
+    len += flen;
+  }
+
+  return len;
+}
+
+void cdStreamPutFixed(cdStream* stream, double v, int dec)
+{
+  char str[400];
+  int len = sFormatFixed(str, v, dec);
+  cdStreamWrite(stream, str, len);
+}
+
+void cdStreamPutDecimal(cdStream* stream, double v, int dec)
+{
+  char str[400];
+  int len;
+
+  if (dec < 0) dec = 0;
+  if (dec > 9) dec = 9;
+
+  len = sFormatFixed(str, v, dec);
+
+  /* remove the trailing zeros and the decimal point */
+  if (dec > 0)
+  {
+    while (str[len-1] == '0')
+      len--;
+    if (str[len-1] == '.')
+      len--;
+  }
+
+  /* values rounded to zero are written without the sign */
+  if (len == 2 && str[0] == '-' && str[1] == '0')
+  {
+    str[0] = '0';
+    len = 1;
+  }
+
+  cdStreamWrite(stream, str, len);
+}
+
+void cdStreamPrintf(cdStream* stream, const char* format, ...)
+{
+  va_list arglist;
+  int size, n;
+  char* str;
+
+  size = CD_STREAM_BUFFER_SIZE - stream->buffer_used;
+  va_start(arglist, format);
+  n = vsnprintf((char*)stream->buffer + stream->buffer_used, size, format, arglist);
+  va_end(arglist);
+
+  if (n >= 0 && n < size)
+  {
+    stream->buffer_used += n;
+    return;
+  }
+
+  /* does not fit in the free space of the buffer */
+  sStreamWriteBuffer(stream);
+
+  size = CD_STREAM_BUFFER_SIZE;
+  va_start(arglist, format);
+  n = vsnprintf((char*)stream->buffer, size, format, arglist);
+  va_end(arglist);
+
+  if (n >= 0 && n < size)
+  {
+    stream->buffer_used = n;
+    return;
+  }
+
+  if (n < 0)
+  {
+    stream->error = 1;
+    return;
+  }
+
+  /* larger than the buffer */
+  str = (char*)malloc(n+1);
+  if (!str)
+  {
+    stream->error = 1;
+    return;
+  }
+
+  va_start(arglist, format);
+  vsnprintf(str, n+1, format, arglist);
+  va_end(arglist);
+
+  sStreamSinkWrite(stream, (const unsigned char*)str, n);
+  free(str);
+}
@@ -516,7 +516,7 @@ static char* winRegFindValue(HKEY hBaseKey, const char* key_name, const char* va
 	return NULL;
 }
 
-int cdGetFontFileNameSystem(const char *type_face, int style, char* filename)
+static int sGetFontFileNameSystem(const char *type_face, int style, char* filename)
 {
   char win_font_name[1024];
   char *font_dir, *font_title;
@@ -561,7 +561,7 @@ int cdGetFontFileNameSystem(const char *type_face, int style, char* filename)
 #ifndef NO_FONTCONFIG
 #include <fontconfig/fontconfig.h>
 
-int cdGetFontFileNameSystem(const char *type_face, int style, char* filename)
+static int sGetFontFileNameSystem(const char *type_face, int style, char* filename)
 {
   char styles[4][20];
   int style_size;
@@ -655,7 +655,7 @@ int cdGetFontFileNameSystem(const char *type_face, int style, char* filename)
   return found;
 }
 #else
-int cdGetFontFileNameSystem(const char *type_face, int style, char* filename)
+static int sGetFontFileNameSystem(const char *type_face, int style, char* filename)
 {
   (void)type_face;
   (void)style;
@@ -665,6 +665,98 @@ int cdGetFontFileNameSystem(const char *type_face, int style, char* filename)
 #endif
 #endif
 
+/* Process-wide lock for the font resources shared by all canvases: 
+   the font file names found in the system and the FreeType faces. */
+#ifdef WIN32
+static CRITICAL_SECTION font_lock;
+static volatile LONG font_lock_init = 0;  /* 0 - not initialized, 1 - initializing, 2 - ready */
+
+void cdFontLock(void)
+{
+  if (font_lock_init != 2)
+  {
+    if (InterlockedCompareExchange(&font_lock_init, 1, 0) == 0)
+    {
+      InitializeCriticalSection(&font_lock);
+      font_lock_init = 2;
+    }
+    else
+    {
+      while (font_lock_init != 2)
+        Sleep(0);
+    }
+  }
+
+  EnterCriticalSection(&font_lock);
+}
+
+void cdFontUnlock(void)
+{
+  LeaveCriticalSection(&font_lock);
+}
+#else
+#include <pthread.h>
+
+static pthread_mutex_t font_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void cdFontLock(void)
+{
+  pthread_mutex_lock(&font_lock);
+}
+
+void cdFontUnlock(void)
+{
+  pthread_mutex_unlock(&font_lock);
+}
+#endif
+
+/* The system search lists all the installed fonts, 
+   so the results are stored for the next calls, including not found fonts. */
+typedef struct _cdFontFileName
+{
+  char* type_face;
+  int style;
+  char* filename;   /* NULL if not found */
+  struct _cdFontFileName* next;
+} cdFontFileName;
+
+static cdFontFileName* font_file_names = NULL;
+
+int cdGetFontFileNameSystem(const char *type_face, int style, char* filename)
+{
+  cdFontFileName* font_file_name;
+  int found;
+
+  cdFontLock();
+
+  for (font_file_name = font_file_names; font_file_name; font_file_name = font_file_name->next)
+  {
+    if (font_file_name->style == style && strcmp(font_file_name->type_face, type_face) == 0)
+    {
+      found = font_file_name->filename != NULL;
+      if (found)
+        strcpy(filename, font_file_name->filename);
+      cdFontUnlock();
+      return found;
+    }
+  }
+
+  found = sGetFontFileNameSystem(type_face, style, filename);
+
+  font_file_name = (cdFontFileName*)malloc(sizeof(cdFontFileName));
+  if (font_file_name)
+  {
+    font_file_name->type_face = cdStrDup(type_face);
+    font_file_name->style = style;
+    font_file_name->filename = found? cdStrDup(filename): NULL;
+    font_file_name->next = font_file_names;
+    font_file_names = font_file_name;
+  }
+
+  cdFontUnlock();
+  return found;
+}
+
 int cdGetFontFileNameDefault(const char *type_face, int style, char* filename)
 {
   char font[10240];
@@ -57,17 +57,20 @@ SRCCAIRO = cdcairodbuf.c cdcairopdf.c cdcairosvg.c cdcairo.c \
            cdcairoimg.c cdcairoirgb.c cdcairops.c
 SRCCAIRO := $(addprefix cairo/, $(SRCCAIRO))
 
-SRCDRV = cddgn.c cdcgm.c cgm.c cddxf.c cdirgb.c cdmf.c cdps.c cdpicture.c cddebug.c
+SRCDRV = cddgn.c cdcgm.c cgm.c cddxf.c cdirgb.c cdmf.c cdps.c cdpicture.c cddebug.c cdprofile.c
 SRCDRV  := $(addprefix drv/, $(SRCDRV))
 
 SRCNULL = cd0prn.c cd0emf.c cd0wmf.c
 SRCNULL  := $(addprefix drv/, $(SRCNULL))
 
-SRCCOMM = cd.c wd.c wdhdcpy.c rgb2map.c cd_vectortext.c cd_active.c \
+SRCCOMM = cd.c wd.c wdhdcpy.c rgb2map.c cd_vectortext.c cd_active.c cd_stream.c \
           cd_attributes.c cd_bitmap.c cd_image.c cd_primitives.c cd_text.c cd_util.c
       
 SRC = $(SRCCOMM) $(SRCSVG) $(SRCINTCGM) $(SRCDRV) $(SRCSIM)
-INCLUDES = . drv x11 win32 intcgm freetype2 sim cairo ../include
+INCLUDES = . drv x11 win32 intcgm freetype2 sim cairo zlib ../include
+
+# zlib is used by the binary CD Metafile
+LINK_ZLIB = Yes
 
 ifdef USE_GDK
   USE_GTK = Yes
@@ -97,7 +100,7 @@ ifdef USE_GDK
         INCLUDES += $(GTK)/include/gtk-unix-print-2.0
       endif 
 #    endif
-    LIBS += freetype
+    LIBS += freetype pthread
     ifneq ($(findstring cygw, $(TEC_UNAME)), )
       LIBS += fontconfig
     endif
@@ -105,7 +108,7 @@ ifdef USE_GDK
 else
   ifdef USE_X11
     SRC += $(SRCX11) $(SRCNULL)
-    LIBS += freetype
+    LIBS += freetype pthread
     ifneq ($(findstring cygw, $(TEC_UNAME)), )
       LIBS += fontconfig
     endif
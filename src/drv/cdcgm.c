@@ -41,6 +41,10 @@ static double cve_white[] = { 1.0, 1.0, 1.0 };
 /* From INTCGM */
 int cdplayCGM(cdCanvas* canvas, int xmin, int xmax, int ymin, int ymax, void *data);
 int cdRegisterCallbackCGM(int cb, cdCallback func);
+void* cdplayBeginCGM(cdCanvas* canvas, int xmin, int xmax, int ymin, int ymax, void *data);
+int cdplayStepCGM(void* player, int count);
+double cdplayProgressCGM(void* player);
+void cdplayEndCGM(void* player);
 
 /* metafile descriptor elements */
 static void metafile_descriptor (cdCtxCanvas *ctxcanvas, const char* desc)
@@ -122,7 +126,7 @@ static void cdkillcanvas(cdCtxCanvas *ctxcanvas)
 
 static void cddeactivate(cdCtxCanvas *ctxcanvas)
 {
-  fflush(ctxcanvas->cgm->file);
+  cdStreamFlush(ctxcanvas->cgm->stream);
 }
 
 /*
@@ -131,7 +135,7 @@ static void cddeactivate(cdCtxCanvas *ctxcanvas)
 static void cdflush(cdCtxCanvas *ctxcanvas)
 {
   char str[20];
-  fflush(ctxcanvas->cgm->file);
+  cdStreamFlush(ctxcanvas->cgm->stream);
   
   cgm_end_picture        ( ctxcanvas->cgm );
 
@@ -994,6 +998,10 @@ static cdContext cdCGMContext =
   cdinittable,
   cdplayCGM,
   cdRegisterCallbackCGM,
+  cdplayBeginCGM,
+  cdplayStepCGM,
+  cdplayProgressCGM,
+  cdplayEndCGM
 };
 
 cdContext* cdContextCGM(void)
@@ -125,7 +125,7 @@ struct _cdCtxCanvas
 {
   cdCanvas* canvas;
 
-  FILE *file;                             /* arquivo dgn */
+  cdStream *stream;                       /* arquivo dgn */
   long int bytes;                            /* tamanho do arquivo */
   char level;
   
@@ -276,7 +276,7 @@ static long gettextwidth(cdCtxCanvas* ctxcanvas, const char *s, int len, int siz
 
 static void put_byte(cdCtxCanvas* ctxcanvas, unsigned char byte)
 {
-  fputc(byte, ctxcanvas->file);
+  cdStreamPutChar(ctxcanvas->stream, byte);
 }
 
 /************************************
@@ -285,11 +285,8 @@ static void put_byte(cdCtxCanvas* ctxcanvas, unsigned char byte)
 
 static void writec (cdCtxCanvas* ctxcanvas, const char *t, short tam )
 {
- short i;
-
  ctxcanvas->bytes += tam;
- for ( i = 0; i < tam; i++ )
-     fputc ( t[i], ctxcanvas->file );
+ cdStreamWrite(ctxcanvas->stream, t, tam);
 }
 
 /******************
@@ -298,13 +295,8 @@ static void writec (cdCtxCanvas* ctxcanvas, const char *t, short tam )
 
 static void put_word(cdCtxCanvas* ctxcanvas, unsigned short w)
 {
-  char c;
-
-  c = (char) (w & 0xff);
-  fputc (c, ctxcanvas->file);
-
-  c = (char) ((w >> 8) & 0xff);
-  fputc (c, ctxcanvas->file);
+  cdStreamPutChar(ctxcanvas->stream, w & 0xff);
+  cdStreamPutChar(ctxcanvas->stream, (w >> 8) & 0xff);
 
   ctxcanvas->bytes += 2;
 }
@@ -680,7 +672,7 @@ static void cdkillcanvas(cdCtxCanvas* ctxcanvas)
 {
   saveColorTable(ctxcanvas);
   complete_file(ctxcanvas);
-  fclose (ctxcanvas->file);
+  cdStreamClose(ctxcanvas->stream);
 
   memset(ctxcanvas, 0, sizeof(cdCtxCanvas));
   free(ctxcanvas);
@@ -688,12 +680,12 @@ static void cdkillcanvas(cdCtxCanvas* ctxcanvas)
 
 static void cddeactivate (cdCtxCanvas* ctxcanvas)
 {
-  fflush(ctxcanvas->file);
+  cdStreamFlush(ctxcanvas->stream);
 }
 
 static void cdflush (cdCtxCanvas* ctxcanvas)
 {
-  fflush(ctxcanvas->file);
+  cdStreamFlush(ctxcanvas->stream);
 }
 
 
@@ -1532,7 +1524,7 @@ static void cdcreatecanvas(cdCanvas* canvas, void *data)
   ctxcanvas = (cdCtxCanvas *) malloc(sizeof(cdCtxCanvas));
   memset(ctxcanvas, 0, sizeof(cdCtxCanvas));
 
-  if((ctxcanvas->file = fopen (filename, "wb"))==NULL)
+  if((ctxcanvas->stream = cdStreamOpenOutput(filename, 1))==NULL)
   {
     free(ctxcanvas);
     return;
@@ -31,7 +31,7 @@ struct _cdCtxCanvas
 {
   cdCanvas* canvas;
 
-  FILE *file;        /* pointer to file                        */
+  cdStream *stream;  /* output file                            */
   int layer;         /* layer                                  */
 
   int font_index;           
@@ -53,32 +53,36 @@ struct _cdCtxCanvas
 
 static void write_code(cdCtxCanvas *ctxcanvas, int code, const char* value)
 {
-  fprintf (ctxcanvas->file, "%d\n", code);
-  fprintf (ctxcanvas->file, "%s\n", value);
+  cdStreamPutInt(ctxcanvas->stream, code);
+  cdStreamPutChar(ctxcanvas->stream, '\n');
+  cdStreamPutString(ctxcanvas->stream, value);
+  cdStreamPutChar(ctxcanvas->stream, '\n');
 }
 
 static void write_code_int(cdCtxCanvas *ctxcanvas, int code, int value)
 {
-  fprintf (ctxcanvas->file, "%d\n", code);
-  fprintf (ctxcanvas->file, "%d\n", value);
+  cdStreamPutInt(ctxcanvas->stream, code);
+  cdStreamPutChar(ctxcanvas->stream, '\n');
+  cdStreamPutInt(ctxcanvas->stream, value);
+  cdStreamPutChar(ctxcanvas->stream, '\n');
 }
 
 static void write_code_hex(cdCtxCanvas *ctxcanvas, int code, int value)
 {
-  fprintf (ctxcanvas->file, "%d\n", code);
-  fprintf (ctxcanvas->file, "%0X\n", value);
+  cdStreamPrintf(ctxcanvas->stream, "%d\n%0X\n", code, value);
 }
 
 static void write_code_real(cdCtxCanvas *ctxcanvas, int code, double value)
 {
-  fprintf (ctxcanvas->file, "%d\n", code);
-  fprintf (ctxcanvas->file, "%f\n", value);
+  cdStreamPutInt(ctxcanvas->stream, code);
+  cdStreamPutChar(ctxcanvas->stream, '\n');
+  cdStreamPutFixed(ctxcanvas->stream, value, 6);
+  cdStreamPutChar(ctxcanvas->stream, '\n');
 }
 
 static void write_header_variable(cdCtxCanvas *ctxcanvas, const char* variable)
 {
-  fprintf (ctxcanvas->file, "9\n");
-  fprintf (ctxcanvas->file, "$%s\n", variable);
+  cdStreamPrintf(ctxcanvas->stream, "9\n$%s\n", variable);
 }
 
 static void begin_section(cdCtxCanvas *ctxcanvas, const char* section_name)
@@ -1101,7 +1105,7 @@ static void write_hatch_int(cdCtxCanvas *ctxcanvas, cdPoint *poly, int nv)
 
 static void cddeactivate (cdCtxCanvas *ctxcanvas)
 {
-  fflush (ctxcanvas->file);
+  cdStreamFlush(ctxcanvas->stream);
 }
 
 static void cdkillcanvas(cdCtxCanvas *ctxcanvas)
@@ -1117,8 +1121,7 @@ static void cdkillcanvas(cdCtxCanvas *ctxcanvas)
 
   write_code(ctxcanvas, 0, "EOF");  /* End the ASCII format */
 
-  fflush (ctxcanvas->file);
-  fclose (ctxcanvas->file);
+  cdStreamClose(ctxcanvas->stream);
 
   memset(ctxcanvas, 0, sizeof(cdCtxCanvas));
   free (ctxcanvas);
@@ -1126,7 +1129,7 @@ static void cdkillcanvas(cdCtxCanvas *ctxcanvas)
 
 static void cdflush (cdCtxCanvas *ctxcanvas)
 {
-  fflush (ctxcanvas->file);               /* flush file */
+  cdStreamFlush(ctxcanvas->stream);       /* flush file */
   ctxcanvas->layer++;
 }
 
@@ -1758,8 +1761,8 @@ static void cdcreatecanvas(cdCanvas* canvas, void *data)
   ctxcanvas = (cdCtxCanvas *) malloc (sizeof (cdCtxCanvas));
   memset(ctxcanvas, 0, sizeof(cdCtxCanvas));
 
-  ctxcanvas->file = fopen (filename, "w");
-  if (ctxcanvas->file == NULL)
+  ctxcanvas->stream = cdStreamOpenOutput(filename, 0);
+  if (ctxcanvas->stream == NULL)
   {
     free(ctxcanvas);
     return;
@@ -10,6 +10,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <limits.h>
 
 #include "cd.h"
 #include "cd_private.h"
@@ -28,6 +29,8 @@ struct _cdCtxImage
 };
 
 
+typedef struct _irgbRegion irgbRegion;
+
 struct _cdCtxCanvas 
 {
   cdCanvas* canvas;
@@ -38,9 +41,13 @@ struct _cdCtxCanvas
   unsigned char* green;   /* green color buffer */
   unsigned char* blue;    /* blue color buffer */
   unsigned char* alpha;   /* alpha color buffer */
-  unsigned char* clip;    /* clipping buffer */
+  irgbRegion* clip;       /* clipping runs */
+
+  unsigned char* packed;  /* packed pixels buffer, the color buffers point inside it */
+  int step;               /* distance between two pixels in the color buffers, 1 or 4 (packed) */
+  unsigned char* planes;  /* planar copy of the packed pixels, returned by the color buffer accessors */
 
-  unsigned char* clip_region;  /* clipping region used during NewRegion */
+  irgbRegion* clip_region;  /* clipping region used during NewRegion */
 
   double rotate_angle;
   int    rotate_center_x,
@@ -80,7 +87,7 @@ struct _cdCtxCanvas
   }                                                                                                       \
 }
 
-#define RGBA_COLOR_COMBINE(_ctxcanvas, _pdst_red, _pdst_green, _pdst_blue, _pdst_alpha, _src_red, _src_green, _src_blue, _src_alpha) \
+#define RGBA_COLOR_COMBINE(_write_mode, _pdst_red, _pdst_green, _pdst_blue, _pdst_alpha, _src_red, _src_green, _src_blue, _src_alpha) \
 {                                                                                                                        \
   unsigned char _tmp_red = 0, _tmp_green = 0, _tmp_blue = 0;                                                             \
                                                                                                                          \
@@ -142,8 +149,8 @@ struct _cdCtxCanvas
       _tmp_green = _src_green;                                                                                           \
       _tmp_blue = _src_blue;                                                                                             \
       *_pdst_alpha = (unsigned char)255;   /* set destiny as opaque */                                                   \
-      RGBA_WRITE_MODE(_ctxcanvas->canvas->write_mode, _pdst_red, _pdst_green, _pdst_blue,                                \
-                                                      _tmp_red, _tmp_green, _tmp_blue);                                  \
+      RGBA_WRITE_MODE(_write_mode, _pdst_red, _pdst_green, _pdst_blue,                                                   \
+                                   _tmp_red, _tmp_green, _tmp_blue);                                                     \
     }                                                                                                                    \
   }                                                                                                                      \
   else /* destiny does NOT have alpha */                                                                                 \
@@ -172,115 +179,1137 @@ struct _cdCtxCanvas
       _tmp_red = _src_red;                                                                                               \
       _tmp_green = _src_green;                                                                                           \
       _tmp_blue = _src_blue;                                                                                             \
-      RGBA_WRITE_MODE(_ctxcanvas->canvas->write_mode, _pdst_red, _pdst_green, _pdst_blue,                                \
-                                                      _tmp_red, _tmp_green, _tmp_blue);                                  \
+      RGBA_WRITE_MODE(_write_mode, _pdst_red, _pdst_green, _pdst_blue,                                                   \
+                                   _tmp_red, _tmp_green, _tmp_blue);                                                     \
     }                                                                                                                    \
   }                                                                                                                      \
 }
 
-static void sCombineRGBColor(cdCtxCanvas* ctxcanvas, int offset, long color)
+/*******************/
+/* Clipping region */
+/*******************/
+
+/* The clipping area and the region are stored as a list of horizontal 
+   runs for each line, sorted and disjoint, so changing the clipping 
+   costs the number of runs and not the number of pixels of the canvas. */
+
+typedef struct _irgbRegionLine
+{
+  int n, size;     /* number of runs, number of allocated runs */
+  int* x;          /* xmin,xmax of each run */
+} irgbRegionLine;
+
+struct _irgbRegion
+{
+  int w, h;
+  irgbRegionLine* lines;
+};
+
+static irgbRegion* irgbRegionCreate(int w, int h)
+{
+  irgbRegion* rgn = (irgbRegion*)malloc(sizeof(irgbRegion));
+  if (!rgn)
+    return NULL;
+
+  rgn->lines = (irgbRegionLine*)calloc(h, sizeof(irgbRegionLine));
+  if (!rgn->lines)
+  {
+    free(rgn);
+    return NULL;
+  }
+
+  rgn->w = w;
+  rgn->h = h;
+  return rgn;
+}
+
+static void irgbRegionKill(irgbRegion* rgn)
+{
+  int y;
+  for (y = 0; y < rgn->h; y++)
+  {
+    if (rgn->lines[y].x)
+      free(rgn->lines[y].x);
+  }
+  free(rgn->lines);
+  free(rgn);
+}
+
+static int irgbRegionLineReserve(irgbRegionLine* line, int n)
+{
+  if (n > line->size)
+  {
+    int new_size = line->size? 2*line->size: 4;
+    int* new_x;
+    while (new_size < n)
+      new_size *= 2;
+    new_x = (int*)realloc(line->x, 2*new_size*sizeof(int));
+    if (!new_x)
+      return 0;
+    line->x = new_x;
+    line->size = new_size;
+  }
+  return 1;
+}
+
+/* returns the first run that ends at or after x */
+static int irgbRegionLineFind(const irgbRegionLine* line, int x)
+{
+  int lo = 0, hi = line->n;
+  while (lo < hi)
+  {
+    int mid = (lo + hi) / 2;
+    if (line->x[2*mid+1] < x)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/* adds a run to the line, the result is the union */
+static void irgbRegionLineAddRun(irgbRegionLine* line, int xmin, int xmax)
+{
+  int i, j;
+
+  if (xmin > xmax)
+    return;
+
+  if (line->n && line->x[2*(line->n-1)+1] + 1 < xmin)
+    i = line->n;   /* usual case, append after the last run */
+  else
+    i = irgbRegionLineFind(line, xmin - 1);
+
+  /* runs from i to j-1 overlap or touch the new run */
+  for (j = i; j < line->n && line->x[2*j] <= xmax + 1; j++)
+  {
+    if (line->x[2*j] < xmin) xmin = line->x[2*j];
+    if (line->x[2*j+1] > xmax) xmax = line->x[2*j+1];
+  }
+
+  if (j == i)
+  {
+    if (!irgbRegionLineReserve(line, line->n + 1))
+      return;
+    memmove(line->x + 2*(i+1), line->x + 2*i, 2*(line->n - i)*sizeof(int));
+    line->n++;
+  }
+  else if (j > i+1)
+  {
+    memmove(line->x + 2*(i+1), line->x + 2*j, 2*(line->n - j)*sizeof(int));
+    line->n -= j - (i+1);
+  }
+
+  line->x[2*i] = xmin;
+  line->x[2*i+1] = xmax;
+}
+
+static void irgbRegionSetEmpty(irgbRegion* rgn)
+{
+  int y;
+  for (y = 0; y < rgn->h; y++)
+    rgn->lines[y].n = 0;
+}
+
+static void irgbRegionSetBox(irgbRegion* rgn, int xmin, int xmax, int ymin, int ymax)
+{
+  int y;
+
+  irgbRegionSetEmpty(rgn);
+
+  if (xmin < 0) xmin = 0;
+  if (xmax > rgn->w-1) xmax = rgn->w-1;
+  if (ymin < 0) ymin = 0;
+  if (ymax > rgn->h-1) ymax = rgn->h-1;
+
+  for (y = ymin; y <= ymax; y++)
+    irgbRegionLineAddRun(rgn->lines + y, xmin, xmax);
+}
+
+static void irgbRegionCopy(irgbRegion* dst, const irgbRegion* src)
+{
+  int y;
+  for (y = 0; y < dst->h; y++)
+  {
+    const irgbRegionLine* src_line = src->lines + y;
+    irgbRegionLine* dst_line = dst->lines + y;
+    if (!irgbRegionLineReserve(dst_line, src_line->n))
+      continue;
+    if (src_line->n)
+      memcpy(dst_line->x, src_line->x, 2*src_line->n*sizeof(int));
+    dst_line->n = src_line->n;
+  }
+}
+
+static int irgbRegionCombineOp(int inside_dst, int inside_src, int combine_mode)
+{
+  switch (combine_mode)
+  {
+  case CD_INTERSECT:
+    return inside_dst && inside_src;
+  case CD_DIFFERENCE:
+    return inside_dst && !inside_src;
+  case CD_NOTINTERSECT: /* XOR */
+    return inside_dst != inside_src;
+  default: /* CD_UNION */
+    return inside_dst || inside_src;
+  }
+}
+
+/* dst = dst <combine_mode> src */
+static void irgbRegionCombine(irgbRegion* dst, const irgbRegion* src, int combine_mode)
+{
+  int* x = NULL;
+  int x_size = 0, y;
+
+  for (y = 0; y < dst->h; y++)
+  {
+    irgbRegionLine* dst_line = dst->lines + y;
+    const irgbRegionLine* src_line = src->lines + y;
+    int i = 0, j = 0, n = 0, inside = 0, pos;
+
+    if (combine_mode == CD_UNION || combine_mode == CD_NOTINTERSECT)
+    {
+      if (!src_line->n)
+        continue;
+    }
+    else if (!dst_line->n)
+      continue;
+
+    if (2*(dst_line->n + src_line->n) > x_size)
+    {
+      int* new_x;
+      x_size = 2*(dst_line->n + src_line->n);
+      new_x = (int*)realloc(x, x_size*sizeof(int));
+      if (!new_x)
+        break;
+      x = new_x;
+    }
+
+    /* sweep the run limits of both lines, as half open intervals */
+    while (i < 2*dst_line->n || j < 2*src_line->n)
+    {
+      int dst_pos = i < 2*dst_line->n? dst_line->x[i] + (i & 1): INT_MAX;
+      int src_pos = j < 2*src_line->n? src_line->x[j] + (j & 1): INT_MAX;
+      int new_inside;
+
+      pos = dst_pos < src_pos? dst_pos: src_pos;
+      if (dst_pos == pos) i++;
+      if (src_pos == pos) j++;
+
+      new_inside = irgbRegionCombineOp(i & 1, j & 1, combine_mode);
+      if (new_inside != inside)
+      {
+        if (new_inside)
+          x[n] = pos;
+        else
+          x[n] = pos - 1;
+        n++;
+        inside = new_inside;
+      }
+    }
+
+    if (!irgbRegionLineReserve(dst_line, n/2))
+      continue;
+    if (n)
+      memcpy(dst_line->x, x, n*sizeof(int));
+    dst_line->n = n/2;
+  }
+
+  if (x)
+    free(x);
+}
+
+static void irgbRegionOffset(irgbRegion* rgn, int dx, int dy)
+{
+  int y, i, n;
+
+  if (dy > 0)
+  {
+    for (y = rgn->h-1; y >= 0; y--)
+    {
+      irgbRegionLine tmp = rgn->lines[y];
+      if (y - dy >= 0)
+      {
+        rgn->lines[y] = rgn->lines[y - dy];
+        rgn->lines[y - dy] = tmp;
+      }
+      else
+        rgn->lines[y].n = 0;
+    }
+  }
+  else if (dy < 0)
+  {
+    for (y = 0; y < rgn->h; y++)
+    {
+      irgbRegionLine tmp = rgn->lines[y];
+      if (y - dy < rgn->h)
+      {
+        rgn->lines[y] = rgn->lines[y - dy];
+        rgn->lines[y - dy] = tmp;
+      }
+      else
+        rgn->lines[y].n = 0;
+    }
+  }
+
+  if (dx == 0)
+    return;
+
+  for (y = 0; y < rgn->h; y++)
+  {
+    irgbRegionLine* line = rgn->lines + y;
+
+    for (i = 0, n = 0; i < line->n; i++)
+    {
+      int xmin = line->x[2*i] + dx;
+      int xmax = line->x[2*i+1] + dx;
+
+      if (xmax < 0 || xmin > rgn->w-1)
+        continue;
+
+      if (xmin < 0) xmin = 0;
+      if (xmax > rgn->w-1) xmax = rgn->w-1;
+
+      line->x[2*n] = xmin;
+      line->x[2*n+1] = xmax;
+      n++;
+    }
+
+    line->n = n;
+  }
+}
+
+static int irgbRegionIsPointIn(const irgbRegion* rgn, int x, int y)
+{
+  const irgbRegionLine* line = rgn->lines + y;
+  int i = irgbRegionLineFind(line, x);
+  return i < line->n && line->x[2*i] <= x;
+}
+
+/****************/
+/* Span kernels */
+/****************/
+
+/* Each kernel processes a run of pixels of a single plane, 
+   already clipped. The SIMD loops process 16 or 32 bytes at a time, 
+   the scalar loop processes the remaining pixels, 
+   or all of them when there is no SIMD support. 
+   Results are identical to the RGBA_COLOR_COMBINE macro. 
+   In x86 the SIMD loops are selected at run time with CPUID, 
+   AVX2 when available, else SSE2, else only the scalar loop is used. */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define IRGB_X86
+#define IRGB_TARGET(_t) __attribute__((target(_t)))
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(_MSC_VER) && _MSC_VER >= 1800 && (defined(_M_X64) || defined(_M_IX86))
+#define IRGB_X86
+#define IRGB_TARGET(_t)
+#include <intrin.h>
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define IRGB_NEON
+#include <arm_neon.h>
+#endif
+
+#ifdef IRGB_X86
+/* The SIMD loops return the number of pixels processed. */
+typedef struct _irgbSimdKernels
+{
+  int (*span_xor)(unsigned char* dst, int n, unsigned char v);
+  int (*span_blend)(unsigned char* dst, int n, unsigned char v, unsigned char alpha);
+  int (*span_blend_alpha)(unsigned char* dst, const unsigned char* src, const unsigned char* alpha, int n);
+  int (*packed_fill)(unsigned char* dst, int n, const unsigned char* pixel, const unsigned char* mask);
+  int (*packed_xor)(unsigned char* dst, int n, const unsigned char* pixel, const unsigned char* mask);
+  int (*packed_blend)(unsigned char* dst, int n, const unsigned char* pixel, const unsigned char* mask, unsigned char alpha);
+} irgbSimdKernels;
+
+static int irgbSpanXor_None(unsigned char* dst, int n, unsigned char v)
+{
+  (void)dst; (void)n; (void)v;
+  return 0;
+}
+
+static int irgbSpanBlend_None(unsigned char* dst, int n, unsigned char v, unsigned char alpha)
+{
+  (void)dst; (void)n; (void)v; (void)alpha;
+  return 0;
+}
+
+static int irgbSpanBlendAlpha_None(unsigned char* dst, const unsigned char* src, const unsigned char* alpha, int n)
+{
+  (void)dst; (void)src; (void)alpha; (void)n;
+  return 0;
+}
+
+static int irgbPackedFill_None(unsigned char* dst, int n, const unsigned char* pixel, const unsigned char* mask)
+{
+  (void)dst; (void)n; (void)pixel; (void)mask;
+  return 0;
+}
+
+static int irgbPackedBlend_None(unsigned char* dst, int n, const unsigned char* pixel, const unsigned char* mask, unsigned char alpha)
+{
+  (void)dst; (void)n; (void)pixel; (void)mask; (void)alpha;
+  return 0;
+}
+
+/* x/255 for 0<=x<=255*255 */
+IRGB_TARGET("sse2")
+static __m128i irgbDiv255_SSE2(__m128i x)
+{
+  x = _mm_add_epi16(x, _mm_add_epi16(_mm_set1_epi16(1), _mm_srli_epi16(x, 8)));
+  return _mm_srli_epi16(x, 8);
+}
+
+IRGB_TARGET("sse2")
+static __m128i irgbPackedPattern_SSE2(const unsigned char* p)
+{
+  int c;
+  memcpy(&c, p, 4);
+  return _mm_set1_epi32(c);
+}
+
+IRGB_TARGET("sse2")
+static __m128i irgbSelect_SSE2(__m128i sel, __m128i src, __m128i dst)
+{
+  return _mm_or_si128(_mm_and_si128(sel, src), _mm_andnot_si128(sel, dst));
+}
+
+IRGB_TARGET("sse2")
+static int irgbSpanXor_SSE2(unsigned char* dst, int n, unsigned char v)
+{
+  int i = 0;
+  __m128i sv = _mm_set1_epi8((char)v);
+  for (; i+16 <= n; i += 16)
+  {
+    __m128i d = _mm_loadu_si128((const __m128i*)(dst+i));
+    _mm_storeu_si128((__m128i*)(dst+i), _mm_xor_si128(d, sv));
+  }
+  return i;
+}
+
+IRGB_TARGET("sse2")
+static int irgbSpanBlend_SSE2(unsigned char* dst, int n, unsigned char v, unsigned char alpha)
+{
+  int i = 0;
+  __m128i zero = _mm_setzero_si128();
+  __m128i sv = _mm_set1_epi16((short)(v * alpha));
+  __m128i ia = _mm_set1_epi16((short)(255 - alpha));
+  for (; i+16 <= n; i += 16)
+  {
+    __m128i d = _mm_loadu_si128((const __m128i*)(dst+i));
+    __m128i lo = _mm_add_epi16(sv, _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), ia));
+    __m128i hi = _mm_add_epi16(sv, _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), ia));
+    _mm_storeu_si128((__m128i*)(dst+i), _mm_packus_epi16(irgbDiv255_SSE2(lo), irgbDiv255_SSE2(hi)));
+  }
+  return i;
+}
+
+IRGB_TARGET("sse2")
+static int irgbSpanBlendAlpha_SSE2(unsigned char* dst, const unsigned char* src, const unsigned char* alpha, int n)
+{
+  int i = 0;
+  __m128i zero = _mm_setzero_si128();
+  __m128i full = _mm_set1_epi16(255);
+  for (; i+16 <= n; i += 16)
+  {
+    __m128i d = _mm_loadu_si128((const __m128i*)(dst+i));
+    __m128i s = _mm_loadu_si128((const __m128i*)(src+i));
+    __m128i a = _mm_loadu_si128((const __m128i*)(alpha+i));
+    __m128i a_lo = _mm_unpacklo_epi8(a, zero);
+    __m128i a_hi = _mm_unpackhi_epi8(a, zero);
+    __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), a_lo), 
+                               _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_sub_epi16(full, a_lo)));
+    __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), a_hi), 
+                               _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_sub_epi16(full, a_hi)));
+    _mm_storeu_si128((__m128i*)(dst+i), _mm_packus_epi16(irgbDiv255_SSE2(lo), irgbDiv255_SSE2(hi)));
+  }
+  return i;
+}
+
+IRGB_TARGET("sse2")
+static int irgbPackedFill_SSE2(unsigned char* dst, int n, const unsigned char* pixel, const unsigned char* mask)
+{
+  int i = 0;
+  __m128i sv = irgbPackedPattern_SSE2(pixel);
+  __m128i sm = irgbPackedPattern_SSE2(mask);
+  for (; i+4 <= n; i += 4)
+  {
+    __m128i d = _mm_loadu_si128((const __m128i*)(dst+4*i));
+    _mm_storeu_si128((__m128i*)(dst+4*i), irgbSelect_SSE2(sm, sv, d));
+  }
+  return i;
+}
+
+IRGB_TARGET("sse2")
+static int irgbPackedXor_SSE2(unsigned char* dst, int n, const unsigned char* pixel, const unsigned char* mask)
+{
+  int i = 0;
+  __m128i sv = _mm_and_si128(irgbPackedPattern_SSE2(pixel), irgbPackedPattern_SSE2(mask));
+  for (; i+4 <= n; i += 4)
+  {
+    __m128i d = _mm_loadu_si128((const __m128i*)(dst+4*i));
+    _mm_storeu_si128((__m128i*)(dst+4*i), _mm_xor_si128(d, sv));
+  }
+  return i;
+}
+
+IRGB_TARGET("sse2")
+static int irgbPackedBlend_SSE2(unsigned char* dst, int n, const unsigned char* pixel, const unsigned char* mask, unsigned char alpha)
+{
+  int i = 0;
+  __m128i zero = _mm_setzero_si128();
+  __m128i sv = _mm_set_epi16((short)(pixel[3]*alpha), (short)(pixel[2]*alpha), (short)(pixel[1]*alpha), (short)(pixel[0]*alpha),
+                             (short)(pixel[3]*alpha), (short)(pixel[2]*alpha), (short)(pixel[1]*alpha), (short)(pixel[0]*alpha));
+  __m128i ia = _mm_set1_epi16((short)(255 - alpha));
+  __m128i sm = irgbPackedPattern_SSE2(mask);
+  for (; i+4 <= n; i += 4)
+  {
+    __m128i d = _mm_loadu_si128((const __m128i*)(dst+4*i));
+    __m128i lo = _mm_add_epi16(sv, _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), ia));
+    __m128i hi = _mm_add_epi16(sv, _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), ia));
+    __m128i r = _mm_packus_epi16(irgbDiv255_SSE2(lo), irgbDiv255_SSE2(hi));
+    _mm_storeu_si128((__m128i*)(dst+4*i), irgbSelect_SSE2(sm, r, d));
+  }
+  return i;
+}
+
+/* The AVX2 loops are the SSE2 loops with 256 bits registers. 
+   unpack and pack work inside each 128 bits lane, so they still match. */
+
+IRGB_TARGET("avx2")
+static __m256i irgbDiv255_AVX2(__m256i x)
+{
+  x = _mm256_add_epi16(x, _mm256_add_epi16(_mm256_set1_epi16(1), _mm256_srli_epi16(x, 8)));
+  return _mm256_srli_epi16(x, 8);
+}
+
+IRGB_TARGET("avx2")
+static __m256i irgbPackedPattern_AVX2(const unsigned char* p)
+{
+  int c;
+  memcpy(&c, p, 4);
+  return _mm256_set1_epi32(c);
+}
+
+IRGB_TARGET("avx2")
+static __m256i irgbSelect_AVX2(__m256i sel, __m256i src, __m256i dst)
+{
+  return _mm256_or_si256(_mm256_and_si256(sel, src), _mm256_andnot_si256(sel, dst));
+}
+
+IRGB_TARGET("avx2")
+static int irgbSpanXor_AVX2(unsigned char* dst, int n, unsigned char v)
+{
+  int i = 0;
+  __m256i sv = _mm256_set1_epi8((char)v);
+  for (; i+32 <= n; i += 32)
+  {
+    __m256i d = _mm256_loadu_si256((const __m256i*)(dst+i));
+    _mm256_storeu_si256((__m256i*)(dst+i), _mm256_xor_si256(d, sv));
+  }
+  return i;
+}
+
+IRGB_TARGET("avx2")
+static int irgbSpanBlend_AVX2(unsigned char* dst, int n, unsigned char v, unsigned char alpha)
+{
+  int i = 0;
+  __m256i zero = _mm256_setzero_si256();
+  __m256i sv = _mm256_set1_epi16((short)(v * alpha));
+  __m256i ia = _mm256_set1_epi16((short)(255 - alpha));
+  for (; i+32 <= n; i += 32)
+  {
+    __m256i d = _mm256_loadu_si256((const __m256i*)(dst+i));
+    __m256i lo = _mm256_add_epi16(sv, _mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), ia));
+    __m256i hi = _mm256_add_epi16(sv, _mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), ia));
+    _mm256_storeu_si256((__m256i*)(dst+i), _mm256_packus_epi16(irgbDiv255_AVX2(lo), irgbDiv255_AVX2(hi)));
+  }
+  return i;
+}
+
+IRGB_TARGET("avx2")
+static int irgbSpanBlendAlpha_AVX2(unsigned char* dst, const unsigned char* src, const unsigned char* alpha, int n)
+{
+  int i = 0;
+  __m256i zero = _mm256_setzero_si256();
+  __m256i full = _mm256_set1_epi16(255);
+  for (; i+32 <= n; i += 32)
+  {
+    __m256i d = _mm256_loadu_si256((const __m256i*)(dst+i));
+    __m256i s = _mm256_loadu_si256((const __m256i*)(src+i));
+    __m256i a = _mm256_loadu_si256((const __m256i*)(alpha+i));
+    __m256i a_lo = _mm256_unpacklo_epi8(a, zero);
+    __m256i a_hi = _mm256_unpackhi_epi8(a, zero);
+    __m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(s, zero), a_lo), 
+                                  _mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), _mm256_sub_epi16(full, a_lo)));
+    __m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(s, zero), a_hi), 
+                                  _mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), _mm256_sub_epi16(full, a_hi)));
+    _mm256_storeu_si256((__m256i*)(dst+i), _mm256_packus_epi16(irgbDiv255_AVX2(lo), irgbDiv255_AVX2(hi)));
+  }
+  return i;
+}
+
+IRGB_TARGET("avx2")
+static int irgbPackedFill_AVX2(unsigned char* dst, int n, const unsigned char* pixel, const unsigned char* mask)
+{
+  int i = 0;
+  __m256i sv = irgbPackedPattern_AVX2(pixel);
+  __m256i sm = irgbPackedPattern_AVX2(mask);
+  for (; i+8 <= n; i += 8)
+  {
+    __m256i d = _mm256_loadu_si256((const __m256i*)(dst+4*i));
+    _mm256_storeu_si256((__m256i*)(dst+4*i), irgbSelect_AVX2(sm, sv, d));
+  }
+  return i;
+}
+
+IRGB_TARGET("avx2")
+static int irgbPackedXor_AVX2(unsigned char* dst, int n, const unsigned char* pixel, const unsigned char* mask)
+{
+  int i = 0;
+  __m256i sv = _mm256_and_si256(irgbPackedPattern_AVX2(pixel), irgbPackedPattern_AVX2(mask));
+  for (; i+8 <= n; i += 8)
+  {
+    __m256i d = _mm256_loadu_si256((const __m256i*)(dst+4*i));
+    _mm256_storeu_si256((__m256i*)(dst+4*i), _mm256_xor_si256(d, sv));
+  }
+  return i;
+}
+
+IRGB_TARGET("avx2")
+static int irgbPackedBlend_AVX2(unsigned char* dst, int n, const unsigned char* pixel, const unsigned char* mask, unsigned char alpha)
+{
+  int i = 0;
+  __m256i zero = _mm256_setzero_si256();
+  __m256i sv = _mm256_set_epi16((short)(pixel[3]*alpha), (short)(pixel[2]*alpha), (short)(pixel[1]*alpha), (short)(pixel[0]*alpha),
+                                (short)(pixel[3]*alpha), (short)(pixel[2]*alpha), (short)(pixel[1]*alpha), (short)(pixel[0]*alpha),
+                                (short)(pixel[3]*alpha), (short)(pixel[2]*alpha), (short)(pixel[1]*alpha), (short)(pixel[0]*alpha),
+                                (short)(pixel[3]*alpha), (short)(pixel[2]*alpha), (short)(pixel[1]*alpha), (short)(pixel[0]*alpha));
+  __m256i ia = _mm256_set1_epi16((short)(255 - alpha));
+  __m256i sm = irgbPackedPattern_AVX2(mask);
+  for (; i+8 <= n; i += 8)
+  {
+    __m256i d = _mm256_loadu_si256((const __m256i*)(dst+4*i));
+    __m256i lo = _mm256_add_epi16(sv, _mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), ia));
+    __m256i hi = _mm256_add_epi16(sv, _mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), ia));
+    __m256i r = _mm256_packus_epi16(irgbDiv255_AVX2(lo), irgbDiv255_AVX2(hi));
+    _mm256_storeu_si256((__m256i*)(dst+4*i), irgbSelect_AVX2(sm, r, d));
+  }
+  return i;
+}
+
+static const irgbSimdKernels irgbKernels_None = {
+  irgbSpanXor_None, irgbSpanBlend_None, irgbSpanBlendAlpha_None,
+  irgbPackedFill_None, irgbPackedFill_None, irgbPackedBlend_None
+};
+
+static const irgbSimdKernels irgbKernels_SSE2 = {
+  irgbSpanXor_SSE2, irgbSpanBlend_SSE2, irgbSpanBlendAlpha_SSE2,
+  irgbPackedFill_SSE2, irgbPackedXor_SSE2, irgbPackedBlend_SSE2
+};
+
+static const irgbSimdKernels irgbKernels_AVX2 = {
+  irgbSpanXor_AVX2, irgbSpanBlend_AVX2, irgbSpanBlendAlpha_AVX2,
+  irgbPackedFill_AVX2, irgbPackedXor_AVX2, irgbPackedBlend_AVX2
+};
+
+/* selected by irgbSimdInit, the scalar loops are used until then */
+static const irgbSimdKernels* irgb_simd = &irgbKernels_None;
+
+static void irgbCpuid(int leaf, int subleaf, unsigned int regs[4])
+{
+#ifdef _MSC_VER
+  __cpuidex((int*)regs, leaf, subleaf);
+#else
+  __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static unsigned int irgbXgetbv(void)
+{
+#ifdef _MSC_VER
+  return (unsigned int)_xgetbv(0);
+#else
+  unsigned int eax, edx;
+  __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return eax;
+#endif
+}
+
+static void irgbSimdInit(void)
+{
+  static int init = 0;
+  unsigned int regs[4];  /* eax, ebx, ecx, edx */
+  int sse2, avx2 = 0;
+
+  if (init)
+    return;
+
+  irgbCpuid(0, 0, regs);
+  if (regs[0] < 1)
+    sse2 = 0;
+  else
+  {
+    int max_leaf = (int)regs[0];
+
+    irgbCpuid(1, 0, regs);
+    sse2 = (regs[3] & (1u << 26)) != 0;
+
+    /* AVX2 also needs the OS to save the YMM registers (OSXSAVE and XCR0) */
+    if (max_leaf >= 7 && (regs[2] & (1u << 27)) && (regs[2] & (1u << 28)) && 
+        (irgbXgetbv() & 6) == 6)
+    {
+      irgbCpuid(7, 0, regs);
+      avx2 = (regs[1] & (1u << 5)) != 0;
+    }
+  }
+
+  if (avx2)
+    irgb_simd = &irgbKernels_AVX2;
+  else if (sse2)
+    irgb_simd = &irgbKernels_SSE2;
+  else
+    irgb_simd = &irgbKernels_None;
+
+  init = 1;
+}
+#else
+static void irgbSimdInit(void)
+{
+}
+#endif
+
+#ifdef IRGB_NEON
+/* x/255 for 0<=x<=255*255 */
+static uint8x8_t irgbDiv255_NEON(uint16x8_t x)
+{
+  x = vaddq_u16(x, vaddq_u16(vdupq_n_u16(1), vshrq_n_u16(x, 8)));
+  return vshrn_n_u16(x, 8);
+}
+#endif
+
+/* CD_XOR or CD_NOT_XOR */
+static void irgbSpanXor(unsigned char* dst, int n, unsigned char v, int not_xor)
+{
+  int i = 0;
+  if (not_xor)
+    v = (unsigned char)~v;   /* ~(v ^ d) = ~v ^ d */
+#if defined(IRGB_X86)
+  i = irgb_simd->span_xor(dst, n, v);
+#elif defined(IRGB_NEON)
+  {
+    uint8x16_t sv = vdupq_n_u8(v);
+    for (; i+16 <= n; i += 16)
+      vst1q_u8(dst+i, veorq_u8(vld1q_u8(dst+i), sv));
+  }
+#endif
+  for (; i < n; i++)
+    dst[i] ^= v;
+}
+
+/* constant color and alpha over an opaque destination */
+static void irgbSpanBlend(unsigned char* dst, int n, unsigned char v, unsigned char alpha)
+{
+  int i = 0;
+#if defined(IRGB_X86)
+  i = irgb_simd->span_blend(dst, n, v, alpha);
+#elif defined(IRGB_NEON)
+  uint16x8_t sv = vdupq_n_u16((uint16_t)(v * alpha));
+  uint8x8_t ia = vdup_n_u8((uint8_t)(255 - alpha));
+  for (; i+16 <= n; i += 16)
+  {
+    uint8x16_t d = vld1q_u8(dst+i);
+    uint8x8_t lo = irgbDiv255_NEON(vmlal_u8(sv, vget_low_u8(d), ia));
+    uint8x8_t hi = irgbDiv255_NEON(vmlal_u8(sv, vget_high_u8(d), ia));
+    vst1q_u8(dst+i, vcombine_u8(lo, hi));
+  }
+#endif
+  for (; i < n; i++)
+    dst[i] = CD_ALPHA_BLEND(v, dst[i], alpha);
+}
+
+/* per pixel alpha over an opaque destination */
+static void irgbSpanBlendAlpha(unsigned char* dst, const unsigned char* src, const unsigned char* alpha, int n)
+{
+  int i = 0;
+#if defined(IRGB_X86)
+  i = irgb_simd->span_blend_alpha(dst, src, alpha, n);
+#elif defined(IRGB_NEON)
+  for (; i+16 <= n; i += 16)
+  {
+    uint8x16_t d = vld1q_u8(dst+i);
+    uint8x16_t s = vld1q_u8(src+i);
+    uint8x16_t a = vld1q_u8(alpha+i);
+    uint8x16_t ia = vmvnq_u8(a);
+    uint8x8_t lo = irgbDiv255_NEON(vmlal_u8(vmull_u8(vget_low_u8(s), vget_low_u8(a)), vget_low_u8(d), vget_low_u8(ia)));
+    uint8x8_t hi = irgbDiv255_NEON(vmlal_u8(vmull_u8(vget_high_u8(s), vget_high_u8(a)), vget_high_u8(d), vget_high_u8(ia)));
+    vst1q_u8(dst+i, vcombine_u8(lo, hi));
+  }
+#endif
+  for (; i < n; i++)
+    dst[i] = CD_ALPHA_BLEND(src[i], dst[i], alpha[i]);
+}
+
+/* Packed pixels kernels. Pixels have 4 bytes, the mask selects the bytes 
+   of each pixel that can be changed. The alpha is always the last byte. */
+
+static void irgbPackedFill(unsigned char* dst, int n, const unsigned char* pixel, const unsigned char* mask)
+{
+  int i = 0, c;
+#if defined(IRGB_X86)
+  i = irgb_simd->packed_fill(dst, n, pixel, mask);
+#elif defined(IRGB_NEON)
+  for (; i+16 <= n; i += 16)
+  {
+    uint8x16x4_t d = vld4q_u8(dst+4*i);
+    for (c = 0; c < 4; c++)
+    {
+      if (mask[c])
+        d.val[c] = vdupq_n_u8(pixel[c]);
+    }
+    vst4q_u8(dst+4*i, d);
+  }
+#endif
+  for (; i < n; i++)
+  {
+    for (c = 0; c < 4; c++)
+    {
+      if (mask[c])
+        dst[4*i+c] = pixel[c];
+    }
+  }
+}
+
+static void irgbPackedXor(unsigned char* dst, int n, const unsigned char* pixel, const unsigned char* mask)
+{
+  int i = 0, c;
+#if defined(IRGB_X86)
+  i = irgb_simd->packed_xor(dst, n, pixel, mask);
+#elif defined(IRGB_NEON)
+  for (; i+16 <= n; i += 16)
+  {
+    uint8x16x4_t d = vld4q_u8(dst+4*i);
+    for (c = 0; c < 4; c++)
+    {
+      if (mask[c])
+        d.val[c] = veorq_u8(d.val[c], vdupq_n_u8(pixel[c]));
+    }
+    vst4q_u8(dst+4*i, d);
+  }
+#endif
+  for (; i < n; i++)
+  {
+    for (c = 0; c < 4; c++)
+    {
+      if (mask[c])
+        dst[4*i+c] ^= pixel[c];
+    }
+  }
+}
+
+/* constant color and alpha over an opaque destination */
+static void irgbPackedBlend(unsigned char* dst, int n, const unsigned char* pixel, const unsigned char* mask, unsigned char alpha)
+{
+  int i = 0, c;
+#if defined(IRGB_X86)
+  i = irgb_simd->packed_blend(dst, n, pixel, mask, alpha);
+#elif defined(IRGB_NEON)
+  uint8x8_t ia = vdup_n_u8((uint8_t)(255 - alpha));
+  for (; i+16 <= n; i += 16)
+  {
+    uint8x16x4_t d = vld4q_u8(dst+4*i);
+    for (c = 0; c < 4; c++)
+    {
+      if (mask[c])
+      {
+        uint16x8_t sv = vdupq_n_u16((uint16_t)(pixel[c] * alpha));
+        uint8x8_t lo = irgbDiv255_NEON(vmlal_u8(sv, vget_low_u8(d.val[c]), ia));
+        uint8x8_t hi = irgbDiv255_NEON(vmlal_u8(sv, vget_high_u8(d.val[c]), ia));
+        d.val[c] = vcombine_u8(lo, hi);
+      }
+    }
+    vst4q_u8(dst+4*i, d);
+  }
+#endif
+  for (; i < n; i++)
+  {
+    for (c = 0; c < 4; c++)
+    {
+      if (mask[c])
+        dst[4*i+c] = CD_ALPHA_BLEND(pixel[c], dst[4*i+c], alpha);
+    }
+  }
+}
+
+/* same as irgbCombineColorRun for packed pixels */
+static void irgbCombineColorRunPacked(cdCtxCanvas* ctxcanvas, int offset, int n, long color, int write_mode)
+{
+  unsigned char pixel[4], mask[4] = {0xFF, 0xFF, 0xFF, 0};
+  unsigned char sa = cdAlpha(color);
+  unsigned char *dst = ctxcanvas->packed + 4*offset;
+
+  if (sa == 0)  /* source full transparent */
+    return;
+
+  pixel[ctxcanvas->red - ctxcanvas->packed] = cdRed(color);
+  pixel[ctxcanvas->green - ctxcanvas->packed] = cdGreen(color);
+  pixel[ctxcanvas->blue - ctxcanvas->packed] = cdBlue(color);
+  pixel[3] = 255;
+
+  if (sa == 255)  /* source opaque */
+  {
+    switch (write_mode)
+    {
+    case CD_REPLACE:
+      irgbPackedFill(dst, n, pixel, mask);
+      break;
+    case CD_XOR:
+    case CD_NOT_XOR:
+      if (write_mode == CD_NOT_XOR)
+      {
+        /* ~(s ^ d) = ~s ^ d */
+        pixel[0] = (unsigned char)~pixel[0];
+        pixel[1] = (unsigned char)~pixel[1];
+        pixel[2] = (unsigned char)~pixel[2];
+      }
+      irgbPackedXor(dst, n, pixel, mask);
+      break;
+    }
+
+    if (ctxcanvas->alpha)
+    {
+      unsigned char alpha_mask[4] = {0, 0, 0, 0xFF};
+      irgbPackedFill(dst, n, pixel, alpha_mask);
+    }
+  }
+  else if (!ctxcanvas->alpha)
+    irgbPackedBlend(dst, n, pixel, mask, sa);
+  else
+  {
+    /* the result depends on the destination alpha of each pixel */
+    unsigned char *dr = ctxcanvas->red + 4*offset;
+    unsigned char *dg = ctxcanvas->green + 4*offset;
+    unsigned char *db = ctxcanvas->blue + 4*offset;
+    unsigned char *da = ctxcanvas->alpha + 4*offset;
+    unsigned char sr = cdRed(color);
+    unsigned char sg = cdGreen(color);
+    unsigned char sb = cdBlue(color); 
+    int x;
+
+    for (x = 0; x < n; x++)
+    {
+      RGBA_COLOR_COMBINE(write_mode, dr, dg, db, da, sr, sg, sb, sa);
+      dr += 4; dg += 4; db += 4; da += 4;
+    }
+  }
+}
+
+/* composes the color in n pixels starting at offset, already clipped */
+static void irgbCombineColorRun(cdCtxCanvas* ctxcanvas, int offset, int n, long color, int write_mode)
+{
+  unsigned char sr = cdRed(color);
+  unsigned char sg = cdGreen(color);
+  unsigned char sb = cdBlue(color); 
+  unsigned char sa = cdAlpha(color);
+
+  if (ctxcanvas->packed)
+  {
+    irgbCombineColorRunPacked(ctxcanvas, offset, n, color, write_mode);
+    return;
+  }
+
+  if (sa == 0)  /* source full transparent */
+    return;
+
+  if (sa == 255)  /* source opaque */
+  {
+    switch (write_mode)
+    {
+    case CD_REPLACE:
+      memset(ctxcanvas->red + offset, sr, n);
+      memset(ctxcanvas->green + offset, sg, n);
+      memset(ctxcanvas->blue + offset, sb, n);
+      break;
+    case CD_XOR:
+    case CD_NOT_XOR:
+      irgbSpanXor(ctxcanvas->red + offset, n, sr, write_mode == CD_NOT_XOR);
+      irgbSpanXor(ctxcanvas->green + offset, n, sg, write_mode == CD_NOT_XOR);
+      irgbSpanXor(ctxcanvas->blue + offset, n, sb, write_mode == CD_NOT_XOR);
+      break;
+    }
+
+    if (ctxcanvas->alpha)
+      memset(ctxcanvas->alpha + offset, 255, n);
+  }
+  else if (!ctxcanvas->alpha)
+  {
+    irgbSpanBlend(ctxcanvas->red + offset, n, sr, sa);
+    irgbSpanBlend(ctxcanvas->green + offset, n, sg, sa);
+    irgbSpanBlend(ctxcanvas->blue + offset, n, sb, sa);
+  }
+  else
+  {
+    /* the result depends on the destination alpha of each pixel */
+    unsigned char *dr = ctxcanvas->red + offset;
+    unsigned char *dg = ctxcanvas->green + offset;
+    unsigned char *db = ctxcanvas->blue + offset;
+    unsigned char *da = ctxcanvas->alpha + offset;
+    int x;
+
+    for (x = 0; x < n; x++)
+    {
+      RGBA_COLOR_COMBINE(write_mode, dr, dg, db, da, sr, sg, sb, sa);
+      dr++; dg++; db++; da++;
+    }
+  }
+}
+
+/* composes the color in the pixels xmin-xmax of line y, 
+   only inside the clipping runs */
+static void irgbCombineColorSpan(cdCtxCanvas* ctxcanvas, int xmin, int xmax, int y, long color, int write_mode)
+{
+  irgbRegionLine* line = ctxcanvas->clip->lines + y;
+  int i, offset = y * ctxcanvas->canvas->w;
+
+  for (i = irgbRegionLineFind(line, xmin); i < line->n && line->x[2*i] <= xmax; i++)
+  {
+    int x1 = line->x[2*i] < xmin? xmin: line->x[2*i];
+    int x2 = line->x[2*i+1] > xmax? xmax: line->x[2*i+1];
+    irgbCombineColorRun(ctxcanvas, offset + x1, x2 - x1 + 1, color, write_mode);
+  }
+}
+
+/* the clipping must be checked by the caller */
+static void irgbCombineColorPixel(cdCtxCanvas* ctxcanvas, int offset, long color)
 {
-  unsigned char *dr = ctxcanvas->red + offset;
-  unsigned char *dg = ctxcanvas->green + offset;
-  unsigned char *db = ctxcanvas->blue + offset;
-  unsigned char *da = ctxcanvas->alpha? ctxcanvas->alpha + offset: NULL;
-  unsigned char *clip = ctxcanvas->clip + offset;
+  int pos = offset * ctxcanvas->step;
+  unsigned char *dr = ctxcanvas->red + pos;
+  unsigned char *dg = ctxcanvas->green + pos;
+  unsigned char *db = ctxcanvas->blue + pos;
+  unsigned char *da = ctxcanvas->alpha? ctxcanvas->alpha + pos: NULL;
 
   unsigned char sr = cdRed(color);
   unsigned char sg = cdGreen(color);
   unsigned char sb = cdBlue(color); 
   unsigned char sa = cdAlpha(color);
 
-  if (*clip)
-    RGBA_COLOR_COMBINE(ctxcanvas, dr, dg, db, da, sr, sg, sb, sa);
+  RGBA_COLOR_COMBINE(ctxcanvas->canvas->write_mode, dr, dg, db, da, sr, sg, sb, sa);
 }
 
+/* the clipping must be checked by the caller */
 static void sCombineRGB(cdCtxCanvas* ctxcanvas, int offset, unsigned char sr, unsigned char sg, unsigned char sb, unsigned char sa)
 {
-  unsigned char *dr = ctxcanvas->red + offset;
-  unsigned char *dg = ctxcanvas->green + offset;
-  unsigned char *db = ctxcanvas->blue + offset;
-  unsigned char *da = ctxcanvas->alpha? ctxcanvas->alpha + offset: NULL;
-  unsigned char *clip = ctxcanvas->clip + offset;
+  int pos = offset * ctxcanvas->step;
+  unsigned char *dr = ctxcanvas->red + pos;
+  unsigned char *dg = ctxcanvas->green + pos;
+  unsigned char *db = ctxcanvas->blue + pos;
+  unsigned char *da = ctxcanvas->alpha? ctxcanvas->alpha + pos: NULL;
 
-  if (*clip)
-    RGBA_COLOR_COMBINE(ctxcanvas, dr, dg, db, da, sr, sg, sb, sa);
+  RGBA_COLOR_COMBINE(ctxcanvas->canvas->write_mode, dr, dg, db, da, sr, sg, sb, sa);
 }
 
-static void sCombineRGBLine(cdCtxCanvas* ctxcanvas, int offset, const unsigned char *sr, const unsigned char *sg, const unsigned char *sb, int size)
+/* composes size pixels, already clipped, backwards if size is negative. 
+   sa can be NULL for opaque pixels. */
+static void irgbCombineRGBARun(cdCtxCanvas* ctxcanvas, int offset, const unsigned char *sr, const unsigned char *sg, const unsigned char *sb, const unsigned char *sa, int size)
 {
-  int c;
-  unsigned char *dr = ctxcanvas->red + offset;
-  unsigned char *dg = ctxcanvas->green + offset;
-  unsigned char *db = ctxcanvas->blue + offset;
-  unsigned char *da = ctxcanvas->alpha? ctxcanvas->alpha + offset: NULL;
-  unsigned char *clip = ctxcanvas->clip + offset;
+  int c, step = ctxcanvas->step, inc = 1;
+  unsigned char *dr = ctxcanvas->red + offset*step;
+  unsigned char *dg = ctxcanvas->green + offset*step;
+  unsigned char *db = ctxcanvas->blue + offset*step;
+  unsigned char *da = ctxcanvas->alpha? ctxcanvas->alpha + offset*step: NULL;
   unsigned char src_a = 255;
 
-  if (size > 0)
+  if (size > 0 && step == 1 && ctxcanvas->canvas->write_mode == CD_REPLACE)
   {
-    for (c = 0; c < size; c++)
+    if (!sa)
+    {
+      /* source and destination can be the same buffer when scrolling */
+      memmove(dr, sr, size);
+      memmove(dg, sg, size);
+      memmove(db, sb, size);
+      if (da)
+        memset(da, 255, size);
+      return;
+    }
+    else if (!da)
     {
-      if (*clip)
-        RGBA_COLOR_COMBINE(ctxcanvas, dr, dg, db, da, *sr, *sg, *sb, src_a);
-      dr++; dg++; db++; clip++;
-      sr++; sg++; sb++;
-      if (da) da++;
+      irgbSpanBlendAlpha(dr, sr, sa, size);
+      irgbSpanBlendAlpha(dg, sg, sa, size);
+      irgbSpanBlendAlpha(db, sb, sa, size);
+      return;
     }
   }
-  else
+
+  if (size < 0)
   {
     size *= -1;
-    for (c = 0; c < size; c++)
+    inc = -1;
+  }
+
+  for (c = 0; c < size; c++)
+  {
+    if (sa)
     {
-      if (*clip)
-        RGBA_COLOR_COMBINE(ctxcanvas, dr, dg, db, da, *sr, *sg, *sb, src_a);
-      dr--; dg--; db--; clip--;
-      sr--; sg--; sb--;
-      if (da) da--;
+      src_a = *sa;
+      sa += inc;
     }
+    RGBA_COLOR_COMBINE(ctxcanvas->canvas->write_mode, dr, dg, db, da, *sr, *sg, *sb, src_a);
+    dr += inc*step; dg += inc*step; db += inc*step;
+    sr += inc; sg += inc; sb += inc;
+    if (da) da += inc*step;
   }
 }
 
-static void sCombineRGBALine(cdCtxCanvas* ctxcanvas, int offset, const unsigned char *sr, const unsigned char *sg, const unsigned char *sb, const unsigned char *sa, int size)
+/* composes size pixels starting at x,y, only inside the clipping runs, 
+   backwards if size is negative. sa can be NULL for opaque pixels. */
+static void sCombineRGBALine(cdCtxCanvas* ctxcanvas, int x, int y, const unsigned char *sr, const unsigned char *sg, const unsigned char *sb, const unsigned char *sa, int size)
 {
-  int c;
-  unsigned char *dr = ctxcanvas->red + offset;
-  unsigned char *dg = ctxcanvas->green + offset;
-  unsigned char *db = ctxcanvas->blue + offset;
-  unsigned char *da = ctxcanvas->alpha? ctxcanvas->alpha + offset: NULL;
-  unsigned char *clip = ctxcanvas->clip + offset;
+  int offset = y * ctxcanvas->canvas->w + x, i;
+  irgbRegionLine* line = ctxcanvas->clip->lines + y;
 
   if (size > 0)
   {
-    for (c = 0; c < size; c++)
+    int xmax = x + size - 1;
+
+    for (i = irgbRegionLineFind(line, x); i < line->n && line->x[2*i] <= xmax; i++)
     {
-      if (*clip)
-        RGBA_COLOR_COMBINE(ctxcanvas, dr, dg, db, da, *sr, *sg, *sb, *sa);
-      dr++; dg++; db++; clip++;
-      sr++; sg++; sb++; sa++; 
-      if (da) da++;
+      int x1 = line->x[2*i] < x? x: line->x[2*i];
+      int x2 = line->x[2*i+1] > xmax? xmax: line->x[2*i+1];
+      int d = x1 - x;
+      irgbCombineRGBARun(ctxcanvas, offset + d, sr + d, sg + d, sb + d, sa? sa + d: NULL, x2 - x1 + 1);
     }
   }
   else
   {
-    size *= -1;
-    for (c = 0; c < size; c++)
+    int xmin = x + size + 1;
+
+    /* from right to left, because source and destination can overlap */
+    i = irgbRegionLineFind(line, x);
+    if (i == line->n || line->x[2*i] > x)
+      i--;
+
+    for (; i >= 0 && line->x[2*i+1] >= xmin; i--)
     {
-      if (*clip)
-        RGBA_COLOR_COMBINE(ctxcanvas, dr, dg, db, da, *sr, *sg, *sb, *sa);
-      dr--; dg--; db--; clip--;
-      sr--; sg--; sb--; sa--; 
-      if (da) da--;
+      int x1 = line->x[2*i] < xmin? xmin: line->x[2*i];
+      int x2 = line->x[2*i+1] > x? x: line->x[2*i+1];
+      int d = x - x2;
+      irgbCombineRGBARun(ctxcanvas, offset - d, sr - d, sg - d, sb - d, sa? sa - d: NULL, -(x2 - x1 + 1));
     }
   }
 }
 
-static void irgbSolidLine(cdCanvas* canvas, int xmin, int y, int xmax, long color)
+static void sCombineRGBLine(cdCtxCanvas* ctxcanvas, int x, int y, const unsigned char *sr, const unsigned char *sg, const unsigned char *sb, int size)
 {
-  int x;
-  unsigned long offset = y * canvas->w;
+  sCombineRGBALine(ctxcanvas, x, y, sr, sg, sb, NULL, size);
+}
 
+static void irgbSolidLine(cdCanvas* canvas, int xmin, int y, int xmax, long color)
+{
   if (y < 0)
     return;
 
@@ -292,13 +1321,16 @@ static void irgbSolidLine(cdCanvas* canvas, int xmin, int y, int xmax, long colo
   if (xmax > (canvas->w-1))
     xmax = (canvas->w-1);
 
-  for (x = xmin; x <= xmax; x++)
-    sCombineRGBColor(canvas->ctxcanvas, offset + x, color);
+  if (xmin > xmax)
+    return;
+
+  irgbCombineColorSpan(canvas->ctxcanvas, xmin, xmax, y, color, canvas->write_mode);
 }
 
 static void irgbPatternLine(cdCanvas* canvas, int xmin, int xmax, int y, int pw, const long *pattern)
 {
-  int x, i;
+  int x, i, r;
+  irgbRegionLine* line;
   unsigned long offset = y * canvas->w;
 
   if (y < 0 || y > (canvas->h-1))
@@ -309,20 +1341,29 @@ static void irgbPatternLine(cdCanvas* canvas, int xmin, int xmax, int y, int pw,
   if (xmax > (canvas->w-1))
     xmax = (canvas->w-1);
 
-  i = xmin % pw;
+  line = canvas->ctxcanvas->clip->lines + y;
 
-  for (x = xmin; x <= xmax; x++,i++)
+  for (r = irgbRegionLineFind(line, xmin); r < line->n && line->x[2*r] <= xmax; r++)
   {
-    if (i == pw) 
-      i = 0;
+    int x1 = line->x[2*r] < xmin? xmin: line->x[2*r];
+    int x2 = line->x[2*r+1] > xmax? xmax: line->x[2*r+1];
+
+    i = x1 % pw;
+
+    for (x = x1; x <= x2; x++,i++)
+    {
+      if (i == pw) 
+        i = 0;
 
-    sCombineRGBColor(canvas->ctxcanvas, offset + x, pattern[i]);
+      irgbCombineColorPixel(canvas->ctxcanvas, offset + x, pattern[i]);
+    }
   }
 }
 
 static void irgbStippleLine(cdCanvas* canvas, int xmin, int xmax, int y, int pw, const unsigned char *stipple)
 {
-  int x,i;
+  int x, i, r;
+  irgbRegionLine* line;
   unsigned long offset = y * canvas->w;
 
   if (y < 0 || y > (canvas->h-1))
@@ -333,24 +1374,33 @@ static void irgbStippleLine(cdCanvas* canvas, int xmin, int xmax, int y, int pw,
   if (xmax > (canvas->w-1))
     xmax = (canvas->w-1);
 
-  i = xmin % pw;
+  line = canvas->ctxcanvas->clip->lines + y;
 
-  for (x = xmin; x <= xmax; x++,i++)
+  for (r = irgbRegionLineFind(line, xmin); r < line->n && line->x[2*r] <= xmax; r++)
   {
-    if (i == pw) 
-      i = 0;
-    if(stipple[i])
-      sCombineRGBColor(canvas->ctxcanvas, offset + x, canvas->foreground);
-    else if (canvas->back_opacity == CD_OPAQUE)
-      sCombineRGBColor(canvas->ctxcanvas, offset + x, canvas->background);
+    int x1 = line->x[2*r] < xmin? xmin: line->x[2*r];
+    int x2 = line->x[2*r+1] > xmax? xmax: line->x[2*r+1];
+
+    i = x1 % pw;
+
+    for (x = x1; x <= x2; x++,i++)
+    {
+      if (i == pw) 
+        i = 0;
+      if(stipple[i])
+        irgbCombineColorPixel(canvas->ctxcanvas, offset + x, canvas->foreground);
+      else if (canvas->back_opacity == CD_OPAQUE)
+        irgbCombineColorPixel(canvas->ctxcanvas, offset + x, canvas->background);
+    }
   }
 }
 
 static void irgbHatchLine(cdCanvas* canvas, int xmin, int xmax, int y, unsigned char hatch)
 {
-  int x;
+  int x, r;
   unsigned long offset = y * canvas->w;
   unsigned char n;
+  irgbRegionLine* line;
   
   if (y < 0 || y > (canvas->h-1))
     return;
@@ -360,17 +1410,105 @@ static void irgbHatchLine(cdCanvas* canvas, int xmin, int xmax, int y, unsigned
   if (xmax > (canvas->w-1))
     xmax = (canvas->w-1);
 
-  n = (unsigned char)(xmin&7);
-  simRotateHatchN(hatch, n);
+  line = canvas->ctxcanvas->clip->lines + y;
+
+  for (r = irgbRegionLineFind(line, xmin); r < line->n && line->x[2*r] <= xmax; r++)
+  {
+    int x1 = line->x[2*r] < xmin? xmin: line->x[2*r];
+    int x2 = line->x[2*r+1] > xmax? xmax: line->x[2*r+1];
+    unsigned char h = hatch;
+
+    n = (unsigned char)(x1&7);
+    simRotateHatchN(h, n);
+
+    for (x = x1; x <= x2; x++)
+    {
+      if (h & 0x80)
+        irgbCombineColorPixel(canvas->ctxcanvas, offset + x, canvas->foreground);
+      else if (canvas->back_opacity == CD_OPAQUE)
+        irgbCombineColorPixel(canvas->ctxcanvas, offset + x, canvas->background);
+
+      _cdRotateHatch(h);
+    }
+  }
+}
+
+static void irgbSpans(cdCtxCanvas* ctxcanvas, const cdSpan* spans, int n)
+{
+  cdCanvas* canvas = ctxcanvas->canvas;
+  long color, span_color;
+  unsigned char alpha;
+  int i, xmin, xmax;
+
+  if (canvas->interior_style != CD_SOLID)
+  {
+    simFillSpans(canvas->simulation, spans, n);
+    return;
+  }
+
+  /* the solid color is decoded once for all spans */
+  color = canvas->foreground;
+  alpha = cdAlpha(color);
+
+  for (i = 0; i < n; i++, spans++)
+  {
+    if (spans->y < 0 || spans->y > (canvas->h-1) || spans->coverage == 0)
+      continue;
+
+    xmin = spans->xmin < 0? 0: spans->xmin;
+    xmax = spans->xmax > (canvas->w-1)? (canvas->w-1): spans->xmax;
+
+    if (spans->coverage == 255)
+      span_color = color;
+    else
+      span_color = cdEncodeAlpha(color, (unsigned char)((spans->coverage * alpha) / 255));
+
+    if (xmin > xmax)
+      continue;
+
+    irgbCombineColorSpan(ctxcanvas, xmin, xmax, spans->y, span_color, canvas->write_mode);
+  }
+}
+
+/* used by the text simulation, each run of pixels with the same coverage 
+   is composed as a span of the foreground color */
+static void irgbPutMask(cdCtxCanvas* ctxcanvas, int w, int h, const unsigned char* mask, int x, int y, long color)
+{
+  cdCanvas* canvas = ctxcanvas->canvas;
+  unsigned char fg_alpha = cdAlpha(color);
+  const unsigned char* mask_line;
+  int i, j, start, xmin, xmax, line_y;
 
-  for (x = xmin; x <= xmax; x++)
+  for (i = 0; i < h; i++)
   {
-    if (hatch & 0x80)
-      sCombineRGBColor(canvas->ctxcanvas, offset + x, canvas->foreground);
-    else if (canvas->back_opacity == CD_OPAQUE)
-      sCombineRGBColor(canvas->ctxcanvas, offset + x, canvas->background);
+    line_y = y + i;
+    if (line_y < 0 || line_y > (canvas->h-1))
+      continue;
+
+    mask_line = mask + (h-1 - i)*w;  /* mask is top down */
+
+    j = 0;
+    while (j < w)
+    {
+      unsigned char coverage = mask_line[j];
+
+      start = j;
+      while (j < w && mask_line[j] == coverage)
+        j++;
+
+      if (coverage == 0)
+        continue;
+
+      xmin = x + start < 0? 0: x + start;
+      xmax = x + j-1 > (canvas->w-1)? (canvas->w-1): x + j-1;
+      if (xmin > xmax)
+        continue;
 
-    _cdRotateHatch(hatch);
+      if (fg_alpha != 255)
+        coverage = (unsigned char)((fg_alpha*coverage)/255);
+
+      irgbCombineColorSpan(ctxcanvas, xmin, xmax, line_y, cdEncodeAlpha(color, coverage), canvas->write_mode);
+    }
   }
 }
 
@@ -381,23 +1519,58 @@ static void irgbHatchLine(cdCanvas* canvas, int xmin, int xmax, int y, unsigned
 static void cdkillcanvas(cdCtxCanvas* ctxcanvas)
 {
   if (!ctxcanvas->user_image)
-    free(ctxcanvas->red);
+    free(ctxcanvas->packed? ctxcanvas->packed: ctxcanvas->red);
+
+  if (ctxcanvas->planes)
+    free(ctxcanvas->planes);
 
   if (ctxcanvas->clip_region)
-    free(ctxcanvas->clip_region);
+    irgbRegionKill(ctxcanvas->clip_region);
 
-  free(ctxcanvas->clip);
+  irgbRegionKill(ctxcanvas->clip);
 
   memset(ctxcanvas, 0, sizeof(cdCtxCanvas));
   free(ctxcanvas);
 }
 
+static void irgbCopyChannel(unsigned char* dst, const unsigned char* src, int n, int step)
+{
+  if (step == 1)
+    memcpy(dst, src, n);
+  else
+  {
+    int i;
+    for (i = 0; i < n; i++, src += step)
+      dst[i] = *src;
+  }
+}
+
+/* returns the color buffer as a plane, 
+   packed pixels are copied to a separate buffer at each call */
+static unsigned char* irgbGetPlane(cdCtxCanvas* ctxcanvas, unsigned char* channel, int index)
+{
+  int size = ctxcanvas->canvas->w * ctxcanvas->canvas->h;
+
+  if (!channel || ctxcanvas->step == 1)
+    return channel;
+
+  if (!ctxcanvas->planes)
+  {
+    ctxcanvas->planes = (unsigned char*)malloc(4*size);
+    if (!ctxcanvas->planes)
+      return NULL;
+  }
+
+  irgbCopyChannel(ctxcanvas->planes + index*size, channel, size, ctxcanvas->step);
+  return ctxcanvas->planes + index*size;
+}
+
 unsigned char* cdAlphaImage(cdCanvas* canvas)
 {
   cdCtxCanvas* ctxcanvas;
   assert(canvas);
   ctxcanvas = (cdCtxCanvas*)canvas->ctxcanvas;
-  return ctxcanvas->alpha;
+  return irgbGetPlane(ctxcanvas, ctxcanvas->alpha, 3);
 }
 
 unsigned char* cdRedImage(cdCanvas* canvas)
@@ -405,7 +1578,7 @@ unsigned char* cdRedImage(cdCanvas* canvas)
   cdCtxCanvas* ctxcanvas;
   assert(canvas);
   ctxcanvas = (cdCtxCanvas*)canvas->ctxcanvas;
-  return ctxcanvas->red;
+  return irgbGetPlane(ctxcanvas, ctxcanvas->red, 0);
 }
 
 unsigned char* cdGreenImage(cdCanvas* canvas)
@@ -413,7 +1586,7 @@ unsigned char* cdGreenImage(cdCanvas* canvas)
   cdCtxCanvas* ctxcanvas;
   assert(canvas);
   ctxcanvas = (cdCtxCanvas*)canvas->ctxcanvas;
-  return ctxcanvas->green;
+  return irgbGetPlane(ctxcanvas, ctxcanvas->green, 1);
 }
 
 unsigned char* cdBlueImage(cdCanvas* canvas)
@@ -421,64 +1594,48 @@ unsigned char* cdBlueImage(cdCanvas* canvas)
   cdCtxCanvas* ctxcanvas;
   assert(canvas);
   ctxcanvas = (cdCtxCanvas*)canvas->ctxcanvas;
-  return ctxcanvas->blue;
+  return irgbGetPlane(ctxcanvas, ctxcanvas->blue, 2);
 }
 
 static void cdclear(cdCtxCanvas* ctxcanvas)
 {
   int size = ctxcanvas->canvas->w * ctxcanvas->canvas->h; 
-  memset(ctxcanvas->red, cdRed(ctxcanvas->canvas->background), size);
-  memset(ctxcanvas->green, cdGreen(ctxcanvas->canvas->background), size);
-  memset(ctxcanvas->blue, cdBlue(ctxcanvas->canvas->background), size);
-  if (ctxcanvas->alpha) 
-    memset(ctxcanvas->alpha, cdAlpha(ctxcanvas->canvas->background), size);  /* here is the normal alpha coding */
-}
 
-static void irgPostProcessIntersect(unsigned char* clip, int size)
-{
-  int i;
-  for(i = 0; i < size; i++)
+  if (ctxcanvas->step == 1)
   {
-    if (*clip == 2)
-      *clip = 1;
-    else
-      *clip = 0;
-
-    clip++;
-  }
-}
-
-#define _irgSetClipPixel(_clip, _combine_mode)             \
-{                                                          \
-  switch (_combine_mode)                                   \
-  {                                                        \
-  case CD_INTERSECT:                                       \
-    if (_clip)                                             \
-      _clip = 2;  /* fills the intersection                \
-                   with a value to be post-processed */    \
-    break;                                                 \
-  case CD_DIFFERENCE:                                      \
-    if (_clip)                                             \
-      _clip = 0;  /* clears the intersection */            \
-    break;                                                 \
-  case CD_NOTINTERSECT: /* XOR */                          \
-    if (_clip)                                             \
-      _clip = 0;  /* clears the intersection */            \
-    else                                                   \
-      _clip = 1;  /* fills the region */                   \
-    break;                                                 \
-  default: /* CD_UNION */                                  \
-    _clip = 1;    /* fills the region */                   \
-    break;                                                 \
-  }                                                        \
-}
-
-static void irgbClipTextBitmap(FT_Bitmap* bitmap, int x, int y, int w, unsigned char* clip, int combine_mode)
+    memset(ctxcanvas->red, cdRed(ctxcanvas->canvas->background), size);
+    memset(ctxcanvas->green, cdGreen(ctxcanvas->canvas->background), size);
+    memset(ctxcanvas->blue, cdBlue(ctxcanvas->canvas->background), size);
+    if (ctxcanvas->alpha) 
+      memset(ctxcanvas->alpha, cdAlpha(ctxcanvas->canvas->background), size);  /* here is the normal alpha coding */
+  }
+  else
+  {
+    unsigned char pixel[4], *dst = ctxcanvas->packed;
+    int i;
+
+    pixel[ctxcanvas->red - ctxcanvas->packed] = cdRed(ctxcanvas->canvas->background);
+    pixel[ctxcanvas->green - ctxcanvas->packed] = cdGreen(ctxcanvas->canvas->background);
+    pixel[ctxcanvas->blue - ctxcanvas->packed] = cdBlue(ctxcanvas->canvas->background);
+    pixel[3] = cdAlpha(ctxcanvas->canvas->background);  /* here is the normal alpha coding */
+
+    for (i = 0; i < size; i++, dst += 4)
+    {
+      dst[0] = pixel[0];
+      dst[1] = pixel[1];
+      dst[2] = pixel[2];
+      if (ctxcanvas->alpha) 
+        dst[3] = pixel[3];
+    }
+  }
+}
+
+static void irgbClipTextBitmap(const FT_Bitmap* bitmap, int x, int y, irgbRegion* shape)
 {
   unsigned char *bitmap_data;
   int width = bitmap->width;
   int height = bitmap->rows;
-  int i, j;
+  int i, j, start;
 
   /* avoid spaces */
   if (width == 0 || height == 0)
@@ -486,17 +1643,29 @@ static void irgbClipTextBitmap(FT_Bitmap* bitmap, int x, int y, int w, unsigned
 
   bitmap_data = bitmap->buffer + (height-1)*width;  /* bitmap is top down. */
 
-  clip += y * w + x;
-
-  for (i = 0; i < height; i++)
+  for (i = 0; i < height; i++, bitmap_data -= width)
   {
-    for (j = 0; j < width; j++)
+    if (y + i < 0 || y + i >= shape->h)
+      continue;
+
+    start = -1;
+    for (j = 0; j <= width; j++)
     {
-      if (bitmap_data[j] == 255)
-        _irgSetClipPixel(clip[j], combine_mode);
+      if (j < width && bitmap_data[j] == 255)
+      {
+        if (start < 0)
+          start = j;
+      }
+      else if (start >= 0)
+      {
+        int xmin = x + start, xmax = x + j - 1;
+        if (xmin < 0) xmin = 0;
+        if (xmax > shape->w-1) xmax = shape->w-1;
+        if (xmin <= xmax)
+          irgbRegionLineAddRun(shape->lines + y + i, xmin, xmax);
+        start = -1;
+      }
     }
-    clip += w;
-    bitmap_data -= width;
   }
 }
 
@@ -504,67 +1673,63 @@ static void irgbClipText(cdCtxCanvas *ctxcanvas, int x, int y, const char *s, in
 {
   cdCanvas* canvas = ctxcanvas->canvas;
   cdSimulation* simulation = canvas->simulation;
-  FT_Face       face;
-  FT_GlyphSlot  slot;
   FT_Matrix     matrix;                 /* transformation matrix */
   FT_Vector     pen;                    /* untransformed origin  */
-  FT_Error      error;
+  const cdTT_Glyph* glyph;
+  irgbRegion*   shape;
   int i = 0;
 
   if (!simulation->tt_text->face)
     return;
 
-  face = simulation->tt_text->face;
-  slot = face->glyph;
+  shape = irgbRegionCreate(canvas->w, canvas->h);
+  if (!shape)
+    return;
 
   /* move the reference point to the baseline-left */
   simGetPenPos(simulation->canvas, x, y, s, len, &matrix, &pen);
 
   while(i<len)
   {
-    /* set transformation */
-    FT_Set_Transform(face, &matrix, &pen);
-
-    /* load glyph image into the slot (erase previous one) */
-    error = FT_Load_Char(face, (unsigned char)s[i], FT_LOAD_RENDER);
-    if (error) {i++; continue;}  /* ignore errors */
+    /* rendered glyph, from the cache if possible */
+    glyph = cdTT_getGlyph(simulation->tt_text, (unsigned char)s[i], &matrix, &pen, 1);
+    if (!glyph) {i++; continue;}  /* ignore errors */
 
-    x = slot->bitmap_left;
-    y = slot->bitmap_top-slot->bitmap.rows; /* CD image reference point is at bottom-left */
+    x = CDTT_PIXEL(pen.x) + glyph->left;
+    y = CDTT_PIXEL(pen.y) + glyph->top - glyph->bitmap.rows; /* CD image reference point is at bottom-left */
 
     /* now, draw to our target surface (convert position) */
-    irgbClipTextBitmap(&slot->bitmap, x, y, canvas->w, ctxcanvas->clip_region, canvas->combine_mode);
+    irgbClipTextBitmap(&glyph->bitmap, x, y, shape);
 
     /* increment pen position */
-    pen.x += slot->advance.x;
-    pen.y += slot->advance.y;
+    pen.x += glyph->advance.x;
+    pen.y += glyph->advance.y;
 
     i++;
   }
 
-  if (canvas->combine_mode == CD_INTERSECT)
-    irgPostProcessIntersect(ctxcanvas->clip_region, ctxcanvas->canvas->w * ctxcanvas->canvas->h);
+  irgbRegionCombine(ctxcanvas->clip_region, shape, canvas->combine_mode);
+  irgbRegionKill(shape);
 }
 
-static void irgbClipFillLine(unsigned char* clip_line, int combine_mode, int x1, int x2, int width)
+static void irgbClipFillLine(irgbRegionLine* line, int x1, int x2, int width)
 {
-  int x;
   if (x1 < 0) x1 = 0;
   if (x2 > width-1) x2 = width-1;
-  for (x = x1; x <= x2; x++)
-  {
-    _irgSetClipPixel(clip_line[x], combine_mode);
-  }
+  if (x1 <= x2)
+    irgbRegionLineAddRun(line, x1, x2);
 }
 
-static void irgbClipPoly(cdCtxCanvas* ctxcanvas, unsigned char* clip_region, cdPoint* poly, int n, int combine_mode) 
+static void irgbClipPoly(cdCtxCanvas* ctxcanvas, irgbRegion* rgn, cdPoint* poly, int n, int combine_mode) 
 {
   /***********IMPORTANT: the reference for this function is simPolyFill in "sim_linepolyfill.c",
      if a change is made here, must be reflected there, and vice-versa */
   cdCanvas* canvas = ctxcanvas->canvas;
-  unsigned char* clip_line;
+  irgbRegion* shape;
+  irgbRegionLine* clip_line;
   cdPoint* t_poly = NULL;
-  int y_max, y_min, i, y, fill_mode, num_lines, 
+  simEdgeTable edge_table;
+  int y_max, y_min, i, y, fill_mode, 
       xx_count, width, height, *xx, *hh, max_hh, n_seg;
   
   /* alloc maximum number of segments */
@@ -589,60 +1754,66 @@ static void irgbClipPoly(cdCtxCanvas* ctxcanvas, unsigned char* clip_region, cdP
   if (y_min > height-1 || y_max < 0)
   {
     free(segments);
+    if (t_poly) free(t_poly);
+
+    /* the shape is empty, but it still affects the intersection */
+    if (combine_mode == CD_INTERSECT)
+      irgbRegionSetEmpty(rgn);
     return;
   }
   
   if (y_min < 0) 
     y_min = 0;
 
-  /* number of horizontal lines */
-  if (y_max > height-1)
-    num_lines = height-y_min;
-  else
-    num_lines = y_max-y_min+1;
+  /* the polygon interior is built first, then combined with the region */
+  shape = irgbRegionCreate(width, height);
 
   /* buffer to store the current horizontal intervals during the fill of an horizontal line */
   xx = (int*)malloc((n+1)*sizeof(int));    /* allocated to the maximum number of possible intervals in one line */
   hh = (int*)malloc((2*max_hh)*sizeof(int));
 
+  simEdgeTableInit(&edge_table, segments, n_seg);
+
   /* for all horizontal lines between y_max and y_min */
-  for(y = y_max; y >= y_min; y--)
+  for(y = y_max; shape && y >= y_min; y--)
   {
-    xx_count = simPolyFindHorizontalIntervals(segments, n_seg, xx, hh, y, height);
+    xx_count = simEdgeTableFindHorizontalIntervals(&edge_table, xx, hh, y, height);
     if (xx_count < 2)
       continue;
     
-    clip_line = clip_region + y*width;
+    clip_line = shape->lines + y;
 
     /* for all intervals, fill the interval */
     for(i = 0; i < xx_count; i += 2)  /* process only pairs */
     {
       /* fills only pairs of intervals, */          
-      irgbClipFillLine(clip_line, combine_mode, xx[i], xx[i+1], width);
+      irgbClipFillLine(clip_line, xx[i], xx[i+1], width);
 
       if ((fill_mode == CD_WINDING) &&                     /* NOT EVENODD */
           ((i+2 < xx_count) && (xx[i+1] < xx[i+2])) && /* avoid point intervals */
-           simIsPointInPolyWind(poly, n, (xx[i+1]+xx[i+2])/2, y)) /* the next interval is inside the polygon */
+           simEdgeTableIsPointInPolyWind(&edge_table, (xx[i+1]+xx[i+2])/2, y)) /* the next interval is inside the polygon */
       {
-        irgbClipFillLine(clip_line, combine_mode, xx[i+1], xx[i+2], width);
+        irgbClipFillLine(clip_line, xx[i+1], xx[i+2], width);
       }
     }
   }
 
+  simEdgeTableFree(&edge_table);
   if (t_poly) free(t_poly);
   free(xx);
   free(hh);
   free(segments);
 
-  if (combine_mode == CD_INTERSECT)
-    irgPostProcessIntersect(ctxcanvas->clip_region, ctxcanvas->canvas->w * ctxcanvas->canvas->h);
+  if (shape)
+  {
+    irgbRegionCombine(rgn, shape, combine_mode);
+    irgbRegionKill(shape);
+  }
 }
 
 static void irgbClipBox(cdCtxCanvas *ctxcanvas, int xmin, int xmax, int ymin, int ymax)
 {
-  int combine_mode = ctxcanvas->canvas->combine_mode;
-  unsigned char* clip_line;
-  int x, y, width;
+  irgbRegion* shape;
 
   if (ctxcanvas->canvas->use_matrix)
   {
@@ -655,30 +1826,18 @@ static void irgbClipBox(cdCtxCanvas *ctxcanvas, int xmin, int xmax, int ymin, in
     return;
   }
 
-  xmin = _sNormX(ctxcanvas, xmin);
-  ymin = _sNormY(ctxcanvas, ymin);
-  xmax = _sNormX(ctxcanvas, xmax);
-  ymax = _sNormY(ctxcanvas, ymax);
-  width = ctxcanvas->canvas->w;
-
-  for(y = ymin; y <= ymax; y++)
-  {
-    clip_line = ctxcanvas->clip_region + y*width;
-    for(x = xmin; x <= xmax; x++)
-    {
-      _irgSetClipPixel(clip_line[x], combine_mode);
-    }
-  }
+  shape = irgbRegionCreate(ctxcanvas->canvas->w, ctxcanvas->canvas->h);
+  if (!shape)
+    return;
 
-  if (combine_mode == CD_INTERSECT)
-    irgPostProcessIntersect(ctxcanvas->clip_region, ctxcanvas->canvas->w * ctxcanvas->canvas->h);
+  irgbRegionSetBox(shape, _sNormX(ctxcanvas, xmin), _sNormX(ctxcanvas, xmax), 
+                          _sNormY(ctxcanvas, ymin), _sNormY(ctxcanvas, ymax));
+  irgbRegionCombine(ctxcanvas->clip_region, shape, ctxcanvas->canvas->combine_mode);
+  irgbRegionKill(shape);
 }
 
 static void irgbClipArea(cdCtxCanvas* ctxcanvas, int xmin, int xmax, int ymin, int ymax)
 {
-  unsigned char* clip_line = ctxcanvas->clip; /* set directly to clip */
-  int y, xsize, ysize, height, width, xrigth;
-
   if (ctxcanvas->canvas->use_matrix)
   {
     cdPoint poly[4];
@@ -686,45 +1845,14 @@ static void irgbClipArea(cdCtxCanvas* ctxcanvas, int xmin, int xmax, int ymin, i
     poly[1].x = xmin; poly[1].y = ymax;
     poly[2].x = xmax; poly[2].y = ymax;
     poly[3].x = xmax; poly[3].y = ymin;
-    memset(ctxcanvas->clip, 0, ctxcanvas->canvas->w * ctxcanvas->canvas->h);
+    irgbRegionSetEmpty(ctxcanvas->clip);
     irgbClipPoly(ctxcanvas, ctxcanvas->clip, poly, 4, CD_UNION);
     return;
   }
 
-  xmin = _sNormX(ctxcanvas, xmin);
-  ymin = _sNormY(ctxcanvas, ymin);
-  xmax = _sNormX(ctxcanvas, xmax);
-  ymax = _sNormY(ctxcanvas, ymax);
-  xsize = xmax-xmin+1;
-  ysize = ymax-ymin+1;
-  height = ctxcanvas->canvas->h;
-  width = ctxcanvas->canvas->w;
-  xrigth = width-(xmax+1);
-
-  for(y = 0; y < ymin; y++)
-  {
-    memset(clip_line, 0, width);
-    clip_line += width;
-  }
-
-  for(y = ymin; y <= ymax; y++)
-  {
-    if (xmin)
-      memset(clip_line, 0, xmin);
-
-    memset(clip_line+xmin, 1, xsize);
-
-    if (xrigth)
-      memset(clip_line+xmax+1, 0, xrigth);
-
-    clip_line += width;
-  }
-
-  for(y = ymax+1; y < height; y++)
-  {
-    memset(clip_line, 0, width);
-    clip_line += width;
-  }
+  /* set directly to clip */
+  irgbRegionSetBox(ctxcanvas->clip, _sNormX(ctxcanvas, xmin), _sNormX(ctxcanvas, xmax), 
+                                    _sNormY(ctxcanvas, ymin), _sNormY(ctxcanvas, ymax));
 }
 
 static int cdclip(cdCtxCanvas* ctxcanvas, int mode)
@@ -738,15 +1866,15 @@ static int cdclip(cdCtxCanvas* ctxcanvas, int mode)
                             ctxcanvas->canvas->clip_rect.ymax);
     break;
   case CD_CLIPPOLYGON:
-    memset(ctxcanvas->clip, 0, ctxcanvas->canvas->w * ctxcanvas->canvas->h);
+    irgbRegionSetEmpty(ctxcanvas->clip);
     irgbClipPoly(ctxcanvas, ctxcanvas->clip, ctxcanvas->canvas->clip_poly, ctxcanvas->canvas->clip_poly_n, CD_UNION);
     break;
   case CD_CLIPREGION:
     if (ctxcanvas->clip_region)
-      memcpy(ctxcanvas->clip, ctxcanvas->clip_region, ctxcanvas->canvas->w * ctxcanvas->canvas->h);
+      irgbRegionCopy(ctxcanvas->clip, ctxcanvas->clip_region);
     break;
   default:
-    memset(ctxcanvas->clip, 1, ctxcanvas->canvas->w * ctxcanvas->canvas->h);  /* CD_CLIPOFF */
+    irgbRegionSetBox(ctxcanvas->clip, 0, ctxcanvas->canvas->w-1, 0, ctxcanvas->canvas->h-1);  /* CD_CLIPOFF */
     break;
   }
 
@@ -761,10 +1889,10 @@ static void cdcliparea(cdCtxCanvas* ctxcanvas, int xmin, int xmax, int ymin, int
 
 static void cdnewregion(cdCtxCanvas* ctxcanvas)
 {
-  if (ctxcanvas->clip_region)
-    free(ctxcanvas->clip_region);
-  ctxcanvas->clip_region = malloc(ctxcanvas->canvas->w * ctxcanvas->canvas->h);
-  memset(ctxcanvas->clip_region, 0, ctxcanvas->canvas->w * ctxcanvas->canvas->h);
+  if (!ctxcanvas->clip_region)
+    ctxcanvas->clip_region = irgbRegionCreate(ctxcanvas->canvas->w, ctxcanvas->canvas->h);
+  else
+    irgbRegionSetEmpty(ctxcanvas->clip_region);
 }
 
 static int cdispointinregion(cdCtxCanvas* ctxcanvas, int x, int y)
@@ -773,52 +1901,23 @@ static int cdispointinregion(cdCtxCanvas* ctxcanvas, int x, int y)
     return 0;
 
   if (x >= 0  && y >= 0 && x < ctxcanvas->canvas->w && y < ctxcanvas->canvas->h)
-  {
-    if (ctxcanvas->clip_region[y*ctxcanvas->canvas->w + x])
-      return 1;
-  }
+    return irgbRegionIsPointIn(ctxcanvas->clip_region, x, y);
 
   return 0;
 }
 
 static void cdoffsetregion(cdCtxCanvas* ctxcanvas, int dx, int dy)
 {
-  unsigned char* clip_region = ctxcanvas->clip_region;
-  int x, y, X, Y, old_X, old_Y, width, height;
-
   if (!ctxcanvas->clip_region)
     return;
 
-  height = ctxcanvas->canvas->h;
-  width = ctxcanvas->canvas->w;
-
-  for (y = 0; y < height; y++)
-  {
-    if (dy > 0)
-      Y = height-1 - y;
-    else
-      Y = y;
-    old_Y = Y - dy;
-    for(x = 0; x < width; x++)
-    {
-      if (dx > 0)
-        X = width-1 - x;
-      else
-        X = x;
-      old_X = X - dx;
-
-      if (old_X >= 0  && old_Y >= 0 && old_Y < height && old_X < width)
-        clip_region[Y*width + X] = clip_region[old_Y*width + old_X];
-      else
-        clip_region[Y*width + X] = 0;
-    }
-  }
+  irgbRegionOffset(ctxcanvas->clip_region, dx, dy);
 }
 
 static void cdgetregionbox(cdCtxCanvas* ctxcanvas, int *xmin, int *xmax, int *ymin, int *ymax)
 {
-  unsigned char* clip_line = ctxcanvas->clip_region;
-  int x, y, width, height;
+  irgbRegionLine* line;
+  int y;
 
   if (!ctxcanvas->clip_region)
     return;
@@ -827,27 +1926,22 @@ static void cdgetregionbox(cdCtxCanvas* ctxcanvas, int *xmin, int *xmax, int *ym
   *xmax = 0;
   *ymin = ctxcanvas->canvas->h-1;
   *ymax = 0;
-  height = ctxcanvas->canvas->h;
-  width = ctxcanvas->canvas->w;
 
-  for (y = 0; y < height; y++)
+  line = ctxcanvas->clip_region->lines;
+  for (y = 0; y < ctxcanvas->canvas->h; y++, line++)
   {
-    for(x = 0; x < width; x++)
-    {
-      if (*clip_line)
-      {
-        if (x < *xmin)
-          *xmin = x;
-        if (y < *ymin)
-          *ymin = y;
-        if (x > *xmax)
-          *xmax = x;
-        if (y > *ymax)
-          *ymax = y;
-      }
+    if (line->n == 0)
+      continue;
 
-      clip_line++;
-    }
+    /* runs are sorted */
+    if (line->x[0] < *xmin)
+      *xmin = line->x[0];
+    if (line->x[2*line->n-1] > *xmax)
+      *xmax = line->x[2*line->n-1];
+    if (y < *ymin)
+      *ymin = y;
+    if (y > *ymax)
+      *ymax = y;
   }
 }
 
@@ -901,7 +1995,7 @@ static void cdpoly(cdCtxCanvas* ctxcanvas, int mode, cdPoint* poly, int n)
     /* set directly to clip */
 
     /* CD_CLIPOFF */
-    memset(ctxcanvas->clip, 1, ctxcanvas->canvas->w * ctxcanvas->canvas->h);  
+    irgbRegionSetBox(ctxcanvas->clip, 0, ctxcanvas->canvas->w-1, 0, ctxcanvas->canvas->h-1);
 
     /* matrix transformation is done inside irgbClip* if necessary */
     irgbClipPoly(ctxcanvas, ctxcanvas->clip, poly, n, CD_UNION);
@@ -927,13 +2021,13 @@ static void cdgetimagergb(cdCtxCanvas* ctxcanvas, unsigned char *r, unsigned cha
   ysize = h < (ctxcanvas->canvas->h - ypos)? h: ctxcanvas->canvas->h - ypos;
 
   /* ajusta posicao inicial em source */
-  src_offset = xpos + ypos * ctxcanvas->canvas->w;
+  src_offset = (xpos + ypos * ctxcanvas->canvas->w) * ctxcanvas->step;
   src_red = ctxcanvas->red + src_offset;
   src_green = ctxcanvas->green + src_offset;
   src_blue = ctxcanvas->blue + src_offset;
 
   /* offset para source */
-  src_offset = ctxcanvas->canvas->w;
+  src_offset = ctxcanvas->canvas->w * ctxcanvas->step;
 
   /* ajusta posicao inicial em destine */
   dst_offset = (xpos - x) + (ypos - y) * w;
@@ -943,9 +2037,9 @@ static void cdgetimagergb(cdCtxCanvas* ctxcanvas, unsigned char *r, unsigned cha
 
   for (l = 0; l < ysize; l++)
   {
-    memcpy(r, src_red, xsize);
-    memcpy(g, src_green, xsize);
-    memcpy(b, src_blue, xsize);
+    irgbCopyChannel(r, src_red, xsize, ctxcanvas->step);
+    irgbCopyChannel(g, src_green, xsize, ctxcanvas->step);
+    irgbCopyChannel(b, src_blue, xsize, ctxcanvas->step);
 
     src_red += src_offset;
     src_green += src_offset;
@@ -971,8 +2065,9 @@ static void sFixImageY(int *topdown, int *y, int *h)
 
 static void cdputimagerectrgba_matrix(cdCtxCanvas* ctxcanvas, int iw, int ih, const unsigned char *r, const unsigned char *g, const unsigned char *b, const unsigned char *a, int x, int y, int w, int h, int xmin, int xmax, int ymin, int ymax)
 {
-  int t_xmin, t_xmax, t_ymin, t_ymax, 
-      t_x, t_y, topdown, dst_offset;
+  int t_xmin = 0, t_xmax = -1, t_ymin = 0, t_ymax = -1, 
+      t_x, t_y, topdown, dst_offset, i;
+  irgbRegionLine* line;
   double i_x, i_y, xfactor, yfactor;
   unsigned char sr, sg, sb, sa = 255;
   double inv_matrix[6];
@@ -985,32 +2080,39 @@ static void cdputimagerectrgba_matrix(cdCtxCanvas* ctxcanvas, int iw, int ih, co
   /* Setup inverse transform */
   cdImageRGBInitInverseTransform(w, h, xmin, xmax, ymin, ymax, &xfactor, &yfactor, ctxcanvas->canvas->matrix, inv_matrix);
 
-  /* for all pixels in the destiny area */
+  /* for all pixels in the destiny area, inside the clipping runs */
   for(t_y = t_ymin; t_y <= t_ymax; t_y++)
   {
     dst_offset = t_y * ctxcanvas->canvas->w;
+    line = ctxcanvas->clip->lines + t_y;
 
-    for(t_x = t_xmin; t_x <= t_xmax; t_x++)
+    for (i = irgbRegionLineFind(line, t_xmin); i < line->n && line->x[2*i] <= t_xmax; i++)
     {
-      cdImageRGBInverseTransform(t_x, t_y, &i_x, &i_y, xfactor, yfactor, xmin, ymin, x, y, inv_matrix);
+      int x1 = line->x[2*i] < t_xmin? t_xmin: line->x[2*i];
+      int x2 = line->x[2*i+1] > t_xmax? t_xmax: line->x[2*i+1];
 
-      if (i_x > xmin && i_y > ymin && i_x < xmax+1 && i_y < ymax+1)
+      for(t_x = x1; t_x <= x2; t_x++)
       {
-        if (topdown)  /* image is top-bottom */
-          i_y = ih-1 - i_y;
+        cdImageRGBInverseTransform(t_x, t_y, &i_x, &i_y, xfactor, yfactor, xmin, ymin, x, y, inv_matrix);
 
-        if (t_x == 350 && t_y == 383)
-          t_x = 350;
+        if (i_x > xmin && i_y > ymin && i_x < xmax+1 && i_y < ymax+1)
+        {
+          if (topdown)  /* image is top-bottom */
+            i_y = ih-1 - i_y;
 
-        sr = cdBilinearInterpolation(iw, ih, r, i_x, i_y);
-        sg = cdBilinearInterpolation(iw, ih, g, i_x, i_y);
-        sb = cdBilinearInterpolation(iw, ih, b, i_x, i_y);
-        if (a) sa = cdBilinearInterpolation(iw, ih, a, i_x, i_y);
+          if (t_x == 350 && t_y == 383)
+            t_x = 350;
 
-        if (sr > 210 && sg > 210 && sb > 210)
-          sr = sr;
+          sr = cdBilinearInterpolation(iw, ih, r, i_x, i_y);
+          sg = cdBilinearInterpolation(iw, ih, g, i_x, i_y);
+          sb = cdBilinearInterpolation(iw, ih, b, i_x, i_y);
+          if (a) sa = cdBilinearInterpolation(iw, ih, a, i_x, i_y);
 
-        sCombineRGB(ctxcanvas, t_x + dst_offset, sr, sg, sb, sa);
+          if (sr > 210 && sg > 210 && sb > 210)
+            sr = sr;
+
+          sCombineRGB(ctxcanvas, t_x + dst_offset, sr, sg, sb, sa);
+        }
       }
     }
   }
@@ -1018,8 +2120,9 @@ static void cdputimagerectrgba_matrix(cdCtxCanvas* ctxcanvas, int iw, int ih, co
 
 static void cdputimagerectmap_matrix(cdCtxCanvas* ctxcanvas, int iw, int ih, const unsigned char *index, const long int *colors, int x, int y, int w, int h, int xmin, int xmax, int ymin, int ymax)
 {
-  int t_xmin, t_xmax, t_ymin, t_ymax, 
-      t_x, t_y, topdown, dst_offset;
+  int t_xmin = 0, t_xmax = -1, t_ymin = 0, t_ymax = -1, 
+      t_x, t_y, topdown, dst_offset, i;
+  irgbRegionLine* line;
   double i_x, i_y, xfactor, yfactor;
   unsigned char si;
   double inv_matrix[6];
@@ -1032,22 +2135,29 @@ static void cdputimagerectmap_matrix(cdCtxCanvas* ctxcanvas, int iw, int ih, con
   /* Setup inverse transform */
   cdImageRGBInitInverseTransform(w, h, xmin, xmax, ymin, ymax, &xfactor, &yfactor, ctxcanvas->canvas->matrix, inv_matrix);
 
-  /* for all pixels in the destiny area */
+  /* for all pixels in the destiny area, inside the clipping runs */
   for(t_y = t_ymin; t_y <= t_ymax; t_y++)
   {
     dst_offset = t_y * ctxcanvas->canvas->w;
+    line = ctxcanvas->clip->lines + t_y;
 
-    for(t_x = t_xmin; t_x <= t_xmax; t_x++)
+    for (i = irgbRegionLineFind(line, t_xmin); i < line->n && line->x[2*i] <= t_xmax; i++)
     {
-      cdImageRGBInverseTransform(t_x, t_y, &i_x, &i_y, xfactor, yfactor, xmin, ymin, x, y, inv_matrix);
+      int x1 = line->x[2*i] < t_xmin? t_xmin: line->x[2*i];
+      int x2 = line->x[2*i+1] > t_xmax? t_xmax: line->x[2*i+1];
 
-      if (i_x > xmin && i_y > ymin && i_x < xmax+1 && i_y < ymax+1)
+      for(t_x = x1; t_x <= x2; t_x++)
       {
-        if (topdown)  /* image is top-bottom */
-          i_y = ih-1 - i_y;
+        cdImageRGBInverseTransform(t_x, t_y, &i_x, &i_y, xfactor, yfactor, xmin, ymin, x, y, inv_matrix);
+
+        if (i_x > xmin && i_y > ymin && i_x < xmax+1 && i_y < ymax+1)
+        {
+          if (topdown)  /* image is top-bottom */
+            i_y = ih-1 - i_y;
 
-        si = cdZeroOrderInterpolation(iw, ih, index, i_x, i_y);
-        sCombineRGBColor(ctxcanvas, t_x + dst_offset, colors[si]);
+          si = cdZeroOrderInterpolation(iw, ih, index, i_x, i_y);
+          irgbCombineColorPixel(ctxcanvas, t_x + dst_offset, colors[si]);
+        }
       }
     }
   }
@@ -1055,8 +2165,9 @@ static void cdputimagerectmap_matrix(cdCtxCanvas* ctxcanvas, int iw, int ih, con
 
 static void cdputimagerectrgb(cdCtxCanvas* ctxcanvas, int iw, int ih, const unsigned char *r, const unsigned char *g, const unsigned char *b, int x, int y, int w, int h, int xmin, int xmax, int ymin, int ymax)
 {
-  int l, c, xsize, ysize, xpos, ypos, src_offset, dst_offset, rh, rw, topdown;
+  int l, c, i, xsize, ysize, xpos, ypos, src_offset, dst_offset, rh, rw, topdown;
   const unsigned char *src_red, *src_green, *src_blue;
+  irgbRegionLine* line;
 
   if (ctxcanvas->canvas->use_matrix)
   {
@@ -1101,10 +2212,18 @@ static void cdputimagerectrgb(cdCtxCanvas* ctxcanvas, int iw, int ih, const unsi
       src_green = g + src_offset;
       src_blue = b + src_offset;
 
-      for(c = 0; c < xsize; c++)
+      line = ctxcanvas->clip->lines + ypos + l;
+
+      for (i = irgbRegionLineFind(line, xpos); i < line->n && line->x[2*i] < xpos + xsize; i++)
       {
-        src_offset = XTab[c + (xpos - x)];
-        sCombineRGB(ctxcanvas, c + dst_offset, src_red[src_offset], src_green[src_offset], src_blue[src_offset], 255);
+        int c1 = (line->x[2*i] < xpos? xpos: line->x[2*i]) - xpos;
+        int c2 = (line->x[2*i+1] > xpos + xsize-1? xpos + xsize-1: line->x[2*i+1]) - xpos;
+
+        for(c = c1; c <= c2; c++)
+        {
+          src_offset = XTab[c + (xpos - x)];
+          sCombineRGB(ctxcanvas, c + dst_offset, src_red[src_offset], src_green[src_offset], src_blue[src_offset], 255);
+        }
       }
 
       dst_offset += ctxcanvas->canvas->w;
@@ -1115,9 +2234,6 @@ static void cdputimagerectrgb(cdCtxCanvas* ctxcanvas, int iw, int ih, const unsi
   }
   else
   {
-    /* ajusta posicao inicial em destine */
-    dst_offset = xpos + ypos * ctxcanvas->canvas->w;
-
     /* ajusta posicao inicial em source */
     if (topdown)
       src_offset = (xpos - x + xmin) + ((ih - 1) - (ypos - y + ymin)) * iw;
@@ -1130,9 +2246,7 @@ static void cdputimagerectrgb(cdCtxCanvas* ctxcanvas, int iw, int ih, const unsi
 
     for (l = 0; l < ysize; l++)
     {
-      sCombineRGBLine(ctxcanvas, dst_offset, r, g, b, xsize);
-
-      dst_offset += ctxcanvas->canvas->w;
+      sCombineRGBLine(ctxcanvas, xpos, ypos + l, r, g, b, xsize);
 
       if (topdown)
       {
@@ -1152,8 +2266,9 @@ static void cdputimagerectrgb(cdCtxCanvas* ctxcanvas, int iw, int ih, const unsi
 
 static void cdputimagerectrgba(cdCtxCanvas* ctxcanvas, int iw, int ih, const unsigned char *r, const unsigned char *g, const unsigned char *b, const unsigned char *a, int x, int y, int w, int h, int xmin, int xmax, int ymin, int ymax)
 {
-  int l, c, xsize, ysize, xpos, ypos, src_offset, dst_offset, rw, rh, topdown;
+  int l, c, i, xsize, ysize, xpos, ypos, src_offset, dst_offset, rw, rh, topdown;
   const unsigned char *src_red, *src_green, *src_blue, *src_alpha;
+  irgbRegionLine* line;
 
   if (ctxcanvas->canvas->use_matrix)
   {
@@ -1199,10 +2314,18 @@ static void cdputimagerectrgba(cdCtxCanvas* ctxcanvas, int iw, int ih, const uns
       src_blue = b + src_offset;
       src_alpha = a + src_offset;
 
-      for(c = 0; c < xsize; c++)
+      line = ctxcanvas->clip->lines + ypos + l;
+
+      for (i = irgbRegionLineFind(line, xpos); i < line->n && line->x[2*i] < xpos + xsize; i++)
       {
-        src_offset = XTab[c + (xpos - x)];
-        sCombineRGB(ctxcanvas, c + dst_offset, src_red[src_offset], src_green[src_offset], src_blue[src_offset], src_alpha[src_offset]);
+        int c1 = (line->x[2*i] < xpos? xpos: line->x[2*i]) - xpos;
+        int c2 = (line->x[2*i+1] > xpos + xsize-1? xpos + xsize-1: line->x[2*i+1]) - xpos;
+
+        for(c = c1; c <= c2; c++)
+        {
+          src_offset = XTab[c + (xpos - x)];
+          sCombineRGB(ctxcanvas, c + dst_offset, src_red[src_offset], src_green[src_offset], src_blue[src_offset], src_alpha[src_offset]);
+        }
       }
 
       dst_offset += ctxcanvas->canvas->w;
@@ -1213,9 +2336,6 @@ static void cdputimagerectrgba(cdCtxCanvas* ctxcanvas, int iw, int ih, const uns
   }
   else
   {
-    /* ajusta posicao inicial em destine */
-    dst_offset = xpos + ypos * ctxcanvas->canvas->w;
-
     /* ajusta posicao inicial em source */
     if (topdown)
       src_offset = (xpos - x + xmin) + ((ih - 1) - (ypos - y + ymin)) * iw;
@@ -1229,9 +2349,7 @@ static void cdputimagerectrgba(cdCtxCanvas* ctxcanvas, int iw, int ih, const uns
 
     for (l = 0; l < ysize; l++)
     {
-      sCombineRGBALine(ctxcanvas, dst_offset, r, g, b, a, xsize);
-
-      dst_offset += ctxcanvas->canvas->w;
+      sCombineRGBALine(ctxcanvas, xpos, ypos + l, r, g, b, a, xsize);
 
       if (topdown)
       {
@@ -1253,8 +2371,9 @@ static void cdputimagerectrgba(cdCtxCanvas* ctxcanvas, int iw, int ih, const uns
 
 static void cdputimagerectmap(cdCtxCanvas* ctxcanvas, int iw, int ih, const unsigned char *index, const long int *colors, int x, int y, int w, int h, int xmin, int xmax, int ymin, int ymax)
 {
-  int l, c, xsize, ysize, xpos, ypos, src_offset, dst_offset, rw, rh, idx, topdown;
+  int l, c, i, xsize, ysize, xpos, ypos, src_offset, dst_offset, rw, rh, idx, topdown;
   const unsigned char *src_index;
+  irgbRegionLine* line;
 
   if (ctxcanvas->canvas->use_matrix)
   {
@@ -1297,11 +2416,19 @@ static void cdputimagerectmap(cdCtxCanvas* ctxcanvas, int iw, int ih, const unsi
 
       src_index = index + src_offset;
 
-      for(c = 0; c < xsize; c++)
+      line = ctxcanvas->clip->lines + ypos + l;
+
+      for (i = irgbRegionLineFind(line, xpos); i < line->n && line->x[2*i] < xpos + xsize; i++)
       {
-        src_offset = XTab[c + (xpos - x)];
-        idx = src_index[src_offset];
-        sCombineRGBColor(ctxcanvas, c + dst_offset, colors[idx]);
+        int c1 = (line->x[2*i] < xpos? xpos: line->x[2*i]) - xpos;
+        int c2 = (line->x[2*i+1] > xpos + xsize-1? xpos + xsize-1: line->x[2*i+1]) - xpos;
+
+        for(c = c1; c <= c2; c++)
+        {
+          src_offset = XTab[c + (xpos - x)];
+          idx = src_index[src_offset];
+          irgbCombineColorPixel(ctxcanvas, c + dst_offset, colors[idx]);
+        }
       }
 
       dst_offset += ctxcanvas->canvas->w;
@@ -1325,10 +2452,18 @@ static void cdputimagerectmap(cdCtxCanvas* ctxcanvas, int iw, int ih, const unsi
 
     for (l = 0; l < ysize; l++)
     {
-      for(c = 0; c < xsize; c++)
+      line = ctxcanvas->clip->lines + ypos + l;
+
+      for (i = irgbRegionLineFind(line, xpos); i < line->n && line->x[2*i] < xpos + xsize; i++)
       {
-        idx = index[c];
-        sCombineRGBColor(ctxcanvas, c + dst_offset, colors[idx]);
+        int c1 = (line->x[2*i] < xpos? xpos: line->x[2*i]) - xpos;
+        int c2 = (line->x[2*i+1] > xpos + xsize-1? xpos + xsize-1: line->x[2*i+1]) - xpos;
+
+        for(c = c1; c <= c2; c++)
+        {
+          idx = index[c];
+          irgbCombineColorPixel(ctxcanvas, c + dst_offset, colors[idx]);
+        }
       }
 
       dst_offset += ctxcanvas->canvas->w;
@@ -1343,13 +2478,9 @@ static void cdputimagerectmap(cdCtxCanvas* ctxcanvas, int iw, int ih, const unsi
 
 static void cdpixel(cdCtxCanvas* ctxcanvas, int x, int y, long int color)
 {
-  int offset;
-
   if (ctxcanvas->canvas->use_matrix)
     cdMatrixTransformPoint(ctxcanvas->canvas->matrix, x, y, &x, &y);
 
-  offset = ctxcanvas->canvas->w * y + x;
-
   /* verifica se esta dentro da area de desenho */
   if (x < 0 ||
       x > (ctxcanvas->canvas->w-1) ||
@@ -1357,7 +2488,10 @@ static void cdpixel(cdCtxCanvas* ctxcanvas, int x, int y, long int color)
       y > (ctxcanvas->canvas->h-1))
   return;
 
-  sCombineRGBColor(ctxcanvas, offset, color);
+  if (!irgbRegionIsPointIn(ctxcanvas->clip, x, y))
+    return;
+
+  irgbCombineColorPixel(ctxcanvas, ctxcanvas->canvas->w * y + x, color);
 }
 
 static cdCtxImage* cdcreateimage(cdCtxCanvas* ctxcanvas, int w, int h)
@@ -1419,14 +2553,14 @@ static void cdgetimage(cdCtxCanvas* ctxcanvas, cdCtxImage* ctximage, int x, int
   ysize = h < (ctxcanvas->canvas->h - ypos)? h: ctxcanvas->canvas->h - ypos;
 
   /* ajusta posicao inicial em source */
-  src_offset = xpos + ypos * ctxcanvas->canvas->w;
+  src_offset = (xpos + ypos * ctxcanvas->canvas->w) * ctxcanvas->step;
   src_red = ctxcanvas->red + src_offset;
   src_green = ctxcanvas->green + src_offset;
   src_blue = ctxcanvas->blue + src_offset;
   if (do_alpha) src_alpha = ctxcanvas->alpha + src_offset;
 
   /* offset para source */
-  src_offset = ctxcanvas->canvas->w;
+  src_offset = ctxcanvas->canvas->w * ctxcanvas->step;
 
   /* ajusta posicao inicial em destine */
   dst_offset = (xpos - x) + (ypos - y) * w;
@@ -1437,10 +2571,10 @@ static void cdgetimage(cdCtxCanvas* ctxcanvas, cdCtxImage* ctximage, int x, int
 
   for (l = 0; l < ysize; l++)
   {
-    memcpy(r, src_red, xsize);
-    memcpy(g, src_green, xsize);
-    memcpy(b, src_blue, xsize);
-    if (do_alpha) memcpy(a, src_alpha, xsize);
+    irgbCopyChannel(r, src_red, xsize, ctxcanvas->step);
+    irgbCopyChannel(g, src_green, xsize, ctxcanvas->step);
+    irgbCopyChannel(b, src_blue, xsize, ctxcanvas->step);
+    if (do_alpha) irgbCopyChannel(a, src_alpha, xsize, ctxcanvas->step);
 
     src_red += src_offset;
     src_green += src_offset;
@@ -1458,7 +2592,7 @@ static void cdputimagerect(cdCtxCanvas* ctxcanvas, cdCtxImage* ctximage, int x,
 {
   int iw, ih, w, h;
   unsigned char *r, *g, *b, *a;
-  int l, xsize, ysize, xpos, ypos, src_offset, dst_offset;
+  int l, xsize, ysize, xpos, ypos, src_offset;
 
   iw = ctximage->w;
   ih = ctximage->h;
@@ -1485,9 +2619,6 @@ static void cdputimagerect(cdCtxCanvas* ctxcanvas, cdCtxImage* ctximage, int x,
   xsize = w < ((ctxcanvas->canvas->w-1)+1 - xpos)? w: ((ctxcanvas->canvas->w-1)+1 - xpos);
   ysize = h < ((ctxcanvas->canvas->h-1)+1 - ypos)? h: ((ctxcanvas->canvas->h-1)+1 - ypos);
 
-  /* ajusta posicao inicial em destine */
-  dst_offset = xpos + ypos * ctxcanvas->canvas->w;
-
   /* ajusta posicao inicial em source */
   src_offset = ((xpos - x) + xmin) + ((ypos - y) + ymin) * iw;
   r += src_offset;
@@ -1498,11 +2629,9 @@ static void cdputimagerect(cdCtxCanvas* ctxcanvas, cdCtxImage* ctximage, int x,
   for (l = 0; l < ysize; l++)
   {
     if (a)
-      sCombineRGBALine(ctxcanvas, dst_offset, r, g, b, a, xsize);
+      sCombineRGBALine(ctxcanvas, xpos, ypos + l, r, g, b, a, xsize);
     else
-      sCombineRGBLine(ctxcanvas, dst_offset, r, g, b, xsize);
-
-    dst_offset += ctxcanvas->canvas->w;
+      sCombineRGBLine(ctxcanvas, xpos, ypos + l, r, g, b, xsize);
 
     r += iw;
     g += iw;
@@ -1520,10 +2649,11 @@ static void cdkillimage(cdCtxImage* ctximage)
 
 static void cdscrollarea(cdCtxCanvas* ctxcanvas, int xmin, int xmax, int ymin, int ymax, int dx, int dy)
 {
-  int l;
-  long src_offset, dst_offset;
+  int l, dst_x, dst_y, dst_incy;
+  long src_offset;
   int incx,incy, xsize, ysize;
   int dst_xmin, dst_xmax, dst_ymin, dst_ymax;
+  unsigned char* line = NULL;
 
   /* corrige valores de entrada */
 
@@ -1563,13 +2693,13 @@ static void cdscrollarea(cdCtxCanvas* ctxcanvas, int xmin, int xmax, int ymin, i
   if (dx < 0)
   {
     incx = 1;
-    dst_offset = dst_xmin;
+    dst_x = dst_xmin;
     src_offset = xmin;
   }
   else
   {
     incx = -1;
-    dst_offset = dst_xmax;
+    dst_x = dst_xmax;
     src_offset = xmax;
   }
 
@@ -1577,29 +2707,54 @@ static void cdscrollarea(cdCtxCanvas* ctxcanvas, int xmin, int xmax, int ymin, i
   if (dy < 0)
   {
     incy = ctxcanvas->canvas->w;
-    dst_offset += dst_ymin * ctxcanvas->canvas->w;
+    dst_incy = 1;
+    dst_y = dst_ymin;
     src_offset += ymin * ctxcanvas->canvas->w;
   }
   else
   {
     incy = -(ctxcanvas->canvas->w);
-    dst_offset += dst_ymax * ctxcanvas->canvas->w;
+    dst_incy = -1;
+    dst_y = dst_ymax;
     src_offset += ymax * ctxcanvas->canvas->w;
   }
 
+  if (ctxcanvas->step != 1)
+  {
+    /* packed pixels are copied to planes and then composed as an image line */
+    line = (unsigned char*)malloc(3*xsize);
+    if (!line)
+      return;
+  }
+
   xsize *= incx;
 
   for (l = 0; l < ysize; l++)
   {
-    sCombineRGBLine(ctxcanvas, dst_offset, ctxcanvas->red + src_offset, ctxcanvas->green + src_offset, ctxcanvas->blue + src_offset, xsize);
-    dst_offset += incy;
+    if (line)
+    {
+      int n = xsize < 0? -xsize: xsize;
+      long first = xsize < 0? src_offset - (n-1): src_offset;
+      int last = xsize < 0? n-1: 0;
+
+      irgbCopyChannel(line, ctxcanvas->red + first*ctxcanvas->step, n, ctxcanvas->step);
+      irgbCopyChannel(line + n, ctxcanvas->green + first*ctxcanvas->step, n, ctxcanvas->step);
+      irgbCopyChannel(line + 2*n, ctxcanvas->blue + first*ctxcanvas->step, n, ctxcanvas->step);
+      sCombineRGBLine(ctxcanvas, dst_x, dst_y, line + last, line + n + last, line + 2*n + last, xsize);
+    }
+    else
+      sCombineRGBLine(ctxcanvas, dst_x, dst_y, ctxcanvas->red + src_offset, ctxcanvas->green + src_offset, ctxcanvas->blue + src_offset, xsize);
+    dst_y += dst_incy;
     src_offset += incy;
   }
+
+  if (line)
+    free(line);
 }
 
 static char* get_green_attrib(cdCtxCanvas* ctxcanvas)
 {
-  return (char*)ctxcanvas->green;
+  return (char*)irgbGetPlane(ctxcanvas, ctxcanvas->green, 1);
 }
 
 static cdAttribute green_attrib =
@@ -1611,7 +2766,7 @@ static cdAttribute green_attrib =
 
 static char* get_blue_attrib(cdCtxCanvas* ctxcanvas)
 {
-  return (char*)ctxcanvas->blue;
+  return (char*)irgbGetPlane(ctxcanvas, ctxcanvas->blue, 2);
 }
 
 static cdAttribute blue_attrib =
@@ -1623,7 +2778,7 @@ static cdAttribute blue_attrib =
 
 static char* get_red_attrib(cdCtxCanvas* ctxcanvas)
 {
-  return (char*)ctxcanvas->red;
+  return (char*)irgbGetPlane(ctxcanvas, ctxcanvas->red, 0);
 }
 
 static cdAttribute red_attrib =
@@ -1635,7 +2790,7 @@ static cdAttribute red_attrib =
 
 static char* get_alpha_attrib(cdCtxCanvas* ctxcanvas)
 {
-  return (char*)ctxcanvas->alpha;
+  return (char*)irgbGetPlane(ctxcanvas, ctxcanvas->alpha, 3);
 }
 
 static cdAttribute alpha_attrib =
@@ -1645,6 +2800,18 @@ static cdAttribute alpha_attrib =
   get_alpha_attrib
 }; 
 
+static char* get_packed_attrib(cdCtxCanvas* ctxcanvas)
+{
+  return (char*)ctxcanvas->packed;
+}
+
+static cdAttribute packed_attrib =
+{
+  "PACKEDIMAGE",
+  NULL,
+  get_packed_attrib
+}; 
+
 static void set_aa_attrib(cdCtxCanvas* ctxcanvas, char* data)
 {
   if (!data || data[0] == '0')
@@ -1738,11 +2905,14 @@ static cdAttribute rotate_attrib =
 static void cdcreatecanvas(cdCanvas* canvas, void *data)
 {
   cdCtxCanvas* ctxcanvas;
-  int w = 0, h = 0, use_alpha = 0;
+  int w = 0, h = 0, use_alpha = 0, use_bgra = 0;
   double res = 3.78;
-  unsigned char *r = NULL, *g = NULL, *b = NULL, *a = NULL;
+  unsigned char *r = NULL, *g = NULL, *b = NULL, *a = NULL, *p = NULL;
   char* str_data = (char*)data;
   char* res_ptr = NULL;
+  char* packed_ptr = NULL;
+
+  irgbSimdInit();
 
   if (strstr(str_data, "-a"))
     use_alpha = 1;
@@ -1751,14 +2921,32 @@ static void cdcreatecanvas(cdCanvas* canvas, void *data)
   if (res_ptr)
     sscanf(res_ptr+2, "%lg", &res);
 
+  packed_ptr = strstr(str_data, "-packed");
+  if (packed_ptr && strstr(packed_ptr, "BGRA"))
+    use_bgra = 1;
+
   /* size and rgb */
+  if (packed_ptr)
+  {
+    /* the buffer is optional, options start with '-' */
+    char* ptr_str = strchr(str_data, ' ');
+    sscanf(str_data, "%dx%d", &w, &h);
+    while (ptr_str && *ptr_str == ' ')
+      ptr_str++;
+    if (ptr_str && *ptr_str != '-')
 #ifdef SunOS_OLD
-  if (use_alpha)
+      sscanf(ptr_str, "%d", &p);
+#else
+      sscanf(ptr_str, "%p", &p);
+#endif
+  }
+#ifdef SunOS_OLD
+  else if (use_alpha)
     sscanf(str_data, "%dx%d %d %d %d %d", &w, &h, &r, &g, &b, &a);
   else
     sscanf(str_data, "%dx%d %d %d %d", &w, &h, &r, &g, &b);
 #else
-  if (use_alpha)
+  else if (use_alpha)
     sscanf(str_data, "%dx%d %p %p %p %p", &w, &h, &r, &g, &b, &a);
   else
     sscanf(str_data, "%dx%d %p %p %p", &w, &h, &r, &g, &b);
@@ -1781,7 +2969,46 @@ static void cdcreatecanvas(cdCanvas* canvas, void *data)
   else
     canvas->bpp = 24;
 
-  if (r && g && b)
+  if (packed_ptr)
+  {
+    int size = w * h;
+
+    if (p)
+    {
+      ctxcanvas->user_image = 1;
+      ctxcanvas->packed = p;
+    }
+    else
+    {
+      int i;
+
+      ctxcanvas->user_image = 0;
+
+      ctxcanvas->packed = (unsigned char*)malloc(4*size);
+      if (!ctxcanvas->packed)
+      {
+        free(ctxcanvas);
+        return;
+      }
+
+      memset(ctxcanvas->packed, 0xFF, 4*size);  /* white and opaque */
+      if (use_alpha)
+      {
+        for (i = 0; i < size; i++)
+          ctxcanvas->packed[4*i+3] = 0;  /* transparent, this is the normal alpha coding */
+      }
+    }
+
+    /* the alpha is always the last byte, 
+       it is not changed if the canvas has no alpha */
+    ctxcanvas->step = 4;
+    ctxcanvas->red = ctxcanvas->packed + (use_bgra? 2: 0);
+    ctxcanvas->green = ctxcanvas->packed + 1;
+    ctxcanvas->blue = ctxcanvas->packed + (use_bgra? 0: 2);
+    if (use_alpha) 
+      ctxcanvas->alpha = ctxcanvas->packed + 3;
+  }
+  else if (r && g && b)
   {
     ctxcanvas->user_image = 1;
 
@@ -1813,8 +3040,11 @@ static void cdcreatecanvas(cdCanvas* canvas, void *data)
     if (ctxcanvas->alpha) memset(ctxcanvas->alpha, 0, size);  /* transparent, this is the normal alpha coding */
   }
 
-  ctxcanvas->clip = (unsigned char*)malloc(w*h);
-  memset(ctxcanvas->clip, 1, w*h);  /* CD_CLIPOFF */
+  if (!packed_ptr)
+    ctxcanvas->step = 1;
+
+  ctxcanvas->clip = irgbRegionCreate(w, h);
+  irgbRegionSetBox(ctxcanvas->clip, 0, w-1, 0, h-1);  /* CD_CLIPOFF */
 
   canvas->ctxcanvas = ctxcanvas;
   ctxcanvas->canvas = canvas;
@@ -1830,6 +3060,7 @@ static void cdcreatecanvas(cdCanvas* canvas, void *data)
   cdRegisterAttribute(canvas, &green_attrib);
   cdRegisterAttribute(canvas, &blue_attrib);
   cdRegisterAttribute(canvas, &alpha_attrib);
+  cdRegisterAttribute(canvas, &packed_attrib);
   cdRegisterAttribute(canvas, &aa_attrib);
   cdRegisterAttribute(canvas, &txtaa_attrib);
   cdRegisterAttribute(canvas, &rotate_attrib);
@@ -1879,6 +3110,8 @@ static void cdinittable(cdCanvas* canvas)
   canvas->cxFPoly = cdfSimPoly;
 
   canvas->cxKillCanvas = cdkillcanvas;
+  canvas->cxSpans = irgbSpans;
+  canvas->cxPutMask = irgbPutMask;
 
   /* use simulation */
   canvas->cxFont = cdSimFontFT;
@@ -1895,7 +3128,7 @@ static void cdinittable(cdCanvas* canvas)
 
 static cdContext cdImageRGBContext =
 {
-  CD_CAP_ALL & ~(CD_CAP_FLUSH | CD_CAP_PLAY | 
+  CD_CAP_ALL & ~(CD_CAP_PLAY | 
                  CD_CAP_LINECAP | CD_CAP_LINEJOIN | 
                  CD_CAP_PALETTE ),
   CD_CTX_IMAGE,
@@ -8,6 +8,18 @@
 #include <stdlib.h> 
 #include <string.h> 
 #include <limits.h> 
+#include <stdarg.h> 
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "zlib.h"
 
 #include "cd.h"
 #include "wd.h"
@@ -97,8 +109,22 @@ enum
   CDMF_FCLIPAREA,                /* 73 */
   CDMF_FONT,                     /* 74 */
   CDMF_RESETMATRIX,              /* 75 */
-  CDMF_PATHSET                   /* 76 */
-};                                  
+  CDMF_PATHSET,                  /* 76 */
+  CDMF_POLY,                     /* 77 - binary only, replaces BEGIN, PATHSET, VERTEX and END */
+  CDMF_FPOLY                     /* 78 - binary only, replaces BEGIN, PATHSET, FVERTEX and END */
+};
+
+/* Binary metafile ("-b" or "-z" options):
+     header: "CDMFB", flags (1 byte, CDMFB_ZLIB), width and height (int32)
+     records: function code (1 byte) followed by its parameters, 
+              int32, IEEE double, colors as uint32, all little-endian.
+              Strings and arrays are prefixed by their length (int32).
+   When compressed, records are grouped in blocks: 
+     raw size and compressed size (int32), followed by the zlib data.
+   A record is never split between blocks. */
+#define CDMFB_HEADER_SIZE 14
+#define CDMFB_ZLIB 1
+#define CDMFB_BLOCK_SIZE (256*1024)                                  
                                     
 struct _cdCtxCanvas 
 {
@@ -110,124 +136,375 @@ struct _cdCtxCanvas
   /* private */
   int last_line_style;
   int last_fill_mode;
-  FILE* file;
+  cdStream* stream;
+
+  /* binary format */
+  int binary, compress;
+  unsigned char* buffer;
+  int buffer_size, buffer_used;
+  unsigned char* zbuffer;
+  unsigned long zbuffer_size;
 };
 
+static void mfBinPutInt(unsigned char* b, int v)
+{
+  unsigned int u = (unsigned int)v;
+  b[0] = (unsigned char)(u & 0xFF);
+  b[1] = (unsigned char)((u >> 8) & 0xFF);
+  b[2] = (unsigned char)((u >> 16) & 0xFF);
+  b[3] = (unsigned char)((u >> 24) & 0xFF);
+}
+
+static int mfBinBigEndian(void)
+{
+  int test = 1;
+  return (*(unsigned char*)&test) == 0;
+}
+
+static void mfBinPutDouble(unsigned char* b, double v)
+{
+  unsigned char d[8];
+  int i, big_endian = mfBinBigEndian();
+  memcpy(d, &v, 8);
+  for (i = 0; i < 8; i++)
+    b[i] = big_endian? d[7-i]: d[i];
+}
+
+static void mfBinWriteBuffer(cdCtxCanvas *ctxcanvas)
+{
+  if (ctxcanvas->buffer_used == 0)
+    return;
+
+  if (ctxcanvas->compress)
+  {
+    unsigned char sizes[8];
+    unsigned long zsize = compressBound(ctxcanvas->buffer_used);
+    if (zsize > ctxcanvas->zbuffer_size)
+    {
+      ctxcanvas->zbuffer_size = zsize;
+      ctxcanvas->zbuffer = (unsigned char*)realloc(ctxcanvas->zbuffer, zsize);
+    }
+
+    compress2(ctxcanvas->zbuffer, &zsize, ctxcanvas->buffer, ctxcanvas->buffer_used, Z_DEFAULT_COMPRESSION);
+
+    mfBinPutInt(sizes, ctxcanvas->buffer_used);
+    mfBinPutInt(sizes+4, (int)zsize);
+    cdStreamWrite(ctxcanvas->stream, sizes, 8);
+    cdStreamWrite(ctxcanvas->stream, ctxcanvas->zbuffer, (int)zsize);
+  }
+  else
+    cdStreamWrite(ctxcanvas->stream, ctxcanvas->buffer, ctxcanvas->buffer_used);
+
+  ctxcanvas->buffer_used = 0;
+}
+
+/* returns space for size bytes at the end of the current record */
+static unsigned char* mfBinReserve(cdCtxCanvas *ctxcanvas, int size)
+{
+  unsigned char* b;
+
+  if (ctxcanvas->buffer_used + size > ctxcanvas->buffer_size)
+  {
+    ctxcanvas->buffer_size = ctxcanvas->buffer_used + size + CDMFB_BLOCK_SIZE;
+    ctxcanvas->buffer = (unsigned char*)realloc(ctxcanvas->buffer, ctxcanvas->buffer_size);
+  }
+
+  b = ctxcanvas->buffer + ctxcanvas->buffer_used;
+  ctxcanvas->buffer_used += size;
+  return b;
+}
+
+static void mfBinInt(cdCtxCanvas *ctxcanvas, int v)
+{
+  mfBinPutInt(mfBinReserve(ctxcanvas, 4), v);
+}
+
+static void mfBinData(cdCtxCanvas *ctxcanvas, const void* data, int size)
+{
+  memcpy(mfBinReserve(ctxcanvas, size), data, size);
+}
+
+/* Starts a new record with its fixed parameters:
+     'i' - int, 'd' - double, 'c' - long color, 's' - string and its length (const char*, int).
+   Arrays can be appended after it. */
+static void mfBinRecord(cdCtxCanvas *ctxcanvas, int func, const char* format, ...)
+{
+  va_list arglist;
+
+  /* the previous record is complete */
+  if (ctxcanvas->buffer_used >= CDMFB_BLOCK_SIZE)
+    mfBinWriteBuffer(ctxcanvas);
+
+  *mfBinReserve(ctxcanvas, 1) = (unsigned char)func;
+
+  va_start(arglist, format);
+  while (*format)
+  {
+    switch (*format)
+    {
+    case 'i':
+      mfBinInt(ctxcanvas, va_arg(arglist, int));
+      break;
+    case 'd':
+      mfBinPutDouble(mfBinReserve(ctxcanvas, 8), va_arg(arglist, double));
+      break;
+    case 'c':
+      mfBinInt(ctxcanvas, (int)(unsigned int)va_arg(arglist, long));
+      break;
+    case 's':
+      {
+        const char* str = va_arg(arglist, const char*);
+        int len = va_arg(arglist, int);
+        mfBinInt(ctxcanvas, len);
+        mfBinData(ctxcanvas, str, len);
+      }
+      break;
+    }
+    format++;
+  }
+  va_end(arglist);
+}
+
+/* stores the rectangle of a plane, line by line */
+static void mfBinPlane(cdCtxCanvas *ctxcanvas, const unsigned char* plane, int iw, int xmin, int xmax, int ymin, int ymax)
+{
+  int l, w = xmax-xmin+1;
+  unsigned char* b = mfBinReserve(ctxcanvas, w*(ymax-ymin+1));
+
+  plane += ymin*iw + xmin;
+  for (l = ymin; l <= ymax; l++)
+  {
+    memcpy(b, plane, w);
+    b += w;
+    plane += iw;
+  }
+}
+
+/* text format, the hot paths avoid printf */
+static void mfWriteByte(cdStream* stream, unsigned char v)
+{
+  cdStreamPutInt(stream, v);
+  cdStreamPutChar(stream, ' ');
+}
+
+static void mfWriteVertex(cdStream* stream, int x, int y)
+{
+  cdStreamPutInt(stream, CDMF_VERTEX);
+  cdStreamPutChar(stream, ' ');
+  cdStreamPutInt(stream, x);
+  cdStreamPutChar(stream, ' ');
+  cdStreamPutInt(stream, y);
+  cdStreamPutChar(stream, '\n');
+}
+
+static void mfWriteFVertex(cdStream* stream, double x, double y)
+{
+  cdStreamPutInt(stream, CDMF_FVERTEX);
+  cdStreamPutChar(stream, ' ');
+  cdStreamPutReal(stream, x);
+  cdStreamPutChar(stream, ' ');
+  cdStreamPutReal(stream, y);
+  cdStreamPutChar(stream, '\n');
+}
+
 void cdkillcanvasMF(cdCanvasMF *mfcanvas)
 {
   cdCtxCanvas *ctxcanvas = (cdCtxCanvas*)mfcanvas;
+  if (ctxcanvas->binary)
+  {
+    mfBinWriteBuffer(ctxcanvas);
+    free(ctxcanvas->buffer);
+    if (ctxcanvas->zbuffer) free(ctxcanvas->zbuffer);
+  }
   free(ctxcanvas->filename);
-  fclose(ctxcanvas->file);
+  cdStreamClose(ctxcanvas->stream);
   memset(ctxcanvas, 0, sizeof(cdCtxCanvas));
   free(ctxcanvas);
 }
 
 static void cdflush(cdCtxCanvas *ctxcanvas)
 {
-  fflush(ctxcanvas->file);
-  fprintf(ctxcanvas->file, "%d\n", CDMF_FLUSH);
+  if (ctxcanvas->binary)
+  {
+    mfBinRecord(ctxcanvas, CDMF_FLUSH, "");
+    mfBinWriteBuffer(ctxcanvas);
+    cdStreamFlush(ctxcanvas->stream);
+    return;
+  }
+
+  cdStreamFlush(ctxcanvas->stream);
+  cdStreamPrintf(ctxcanvas->stream, "%d\n", CDMF_FLUSH);
 }
 
 static void cdclear(cdCtxCanvas *ctxcanvas)
 {
-  fprintf(ctxcanvas->file, "%d\n", CDMF_CLEAR);
+  if (ctxcanvas->binary)
+    mfBinRecord(ctxcanvas, CDMF_CLEAR, "");
+  else
+    cdStreamPrintf(ctxcanvas->stream, "%d\n", CDMF_CLEAR);
 }
 
 static int cdclip(cdCtxCanvas *ctxcanvas, int mode)
 {
-  fprintf(ctxcanvas->file, "%d %d\n", CDMF_CLIP, mode);
+  if (ctxcanvas->binary)
+    mfBinRecord(ctxcanvas, CDMF_CLIP, "i", mode);
+  else
+    cdStreamPrintf(ctxcanvas->stream, "%d %d\n", CDMF_CLIP, mode);
   return mode;
 }
 
 static void cdcliparea(cdCtxCanvas *ctxcanvas, int xmin, int xmax, int ymin, int ymax)
 {
-  fprintf(ctxcanvas->file, "%d %d %d %d %d\n", CDMF_CLIPAREA, xmin, xmax, ymin, ymax);
+  if (ctxcanvas->binary)
+    mfBinRecord(ctxcanvas, CDMF_CLIPAREA, "iiii", xmin, xmax, ymin, ymax);
+  else
+    cdStreamPrintf(ctxcanvas->stream, "%d %d %d %d %d\n", CDMF_CLIPAREA, xmin, xmax, ymin, ymax);
 }
 
 static void cdfcliparea(cdCtxCanvas *ctxcanvas, double xmin, double xmax, double ymin, double ymax)
 {
-  fprintf(ctxcanvas->file, "%d %g %g %g %g\n", CDMF_FCLIPAREA, xmin, xmax, ymin, ymax);
+  if (ctxcanvas->binary)
+    mfBinRecord(ctxcanvas, CDMF_FCLIPAREA, "dddd", xmin, xmax, ymin, ymax);
+  else
+    cdStreamPrintf(ctxcanvas->stream, "%d %g %g %g %g\n", CDMF_FCLIPAREA, xmin, xmax, ymin, ymax);
 }
 
 static void cdtransform(cdCtxCanvas *ctxcanvas, const double* matrix)
 {
+  if (ctxcanvas->binary)
+  {
+    if (matrix)
+      mfBinRecord(ctxcanvas, CDMF_MATRIX, "dddddd", matrix[0], matrix[1], matrix[2], matrix[3], matrix[4], matrix[5]);
+    else
+      mfBinRecord(ctxcanvas, CDMF_RESETMATRIX, "");
+    return;
+  }
+
   if (matrix)
-    fprintf(ctxcanvas->file, "%d %g %g %g %g %g %g\n", CDMF_MATRIX, matrix[0], matrix[1], matrix[2], matrix[3], matrix[4], matrix[5]);
+    cdStreamPrintf(ctxcanvas->stream, "%d %g %g %g %g %g %g\n", CDMF_MATRIX, matrix[0], matrix[1], matrix[2], matrix[3], matrix[4], matrix[5]);
   else
-    fprintf(ctxcanvas->file, "%d\n", CDMF_RESETMATRIX);
+    cdStreamPrintf(ctxcanvas->stream, "%d\n", CDMF_RESETMATRIX);
 }
 
 static void cdline(cdCtxCanvas *ctxcanvas, int x1, int y1, int x2, int y2)
 {
-  fprintf(ctxcanvas->file, "%d %d %d %d %d\n", CDMF_LINE, x1, y1, x2, y2);
+  if (ctxcanvas->binary)
+    mfBinRecord(ctxcanvas, CDMF_LINE, "iiii", x1, y1, x2, y2);
+  else
+    cdStreamPrintf(ctxcanvas->stream, "%d %d %d %d %d\n", CDMF_LINE, x1, y1, x2, y2);
 }
 
 static void cdfline(cdCtxCanvas *ctxcanvas, double x1, double y1, double x2, double y2)
 {
-  fprintf(ctxcanvas->file, "%d %g %g %g %g\n", CDMF_FLINE, x1, y1, x2, y2);
+  if (ctxcanvas->binary)
+    mfBinRecord(ctxcanvas, CDMF_FLINE, "dddd", x1, y1, x2, y2);
+  else
+    cdStreamPrintf(ctxcanvas->stream, "%d %g %g %g %g\n", CDMF_FLINE, x1, y1, x2, y2);
 }
 
 static void cdrect(cdCtxCanvas *ctxcanvas, int xmin, int xmax, int ymin, int ymax)
 {
-  fprintf(ctxcanvas->file, "%d %d %d %d %d\n", CDMF_RECT, xmin, xmax, ymin, ymax);
+  if (ctxcanvas->binary)
+    mfBinRecord(ctxcanvas, CDMF_RECT, "iiii", xmin, xmax, ymin, ymax);
+  else
+    cdStreamPrintf(ctxcanvas->stream, "%d %d %d %d %d\n", CDMF_RECT, xmin, xmax, ymin, ymax);
 }
 
 static void cdfrect(cdCtxCanvas *ctxcanvas, double xmin, double xmax, double ymin, double ymax)
 {
-  fprintf(ctxcanvas->file, "%d %g %g %g %g\n", CDMF_FRECT, xmin, xmax, ymin, ymax);
+  if (ctxcanvas->binary)
+    mfBinRecord(ctxcanvas, CDMF_FRECT, "dddd", xmin, xmax, ymin, ymax);
+  else
+    cdStreamPrintf(ctxcanvas->stream, "%d %g %g %g %g\n", CDMF_FRECT, xmin, xmax, ymin, ymax);
 }
 
 static void cdbox(cdCtxCanvas *ctxcanvas, int xmin, int xmax, int ymin, int ymax)
 {
-  fprintf(ctxcanvas->file, "%d %d %d %d %d\n", CDMF_BOX, xmin, xmax, ymin, ymax);
+  if (ctxcanvas->binary)
+    mfBinRecord(ctxcanvas, CDMF_BOX, "iiii", xmin, xmax, ymin, ymax);
+  else
+    cdStreamPrintf(ctxcanvas->stream, "%d %d %d %d %d\n", CDMF_BOX, xmin, xmax, ymin, ymax);
 }
 
 static void cdfbox(cdCtxCanvas *ctxcanvas, double xmin, double xmax, double ymin, double ymax)
 {
-  fprintf(ctxcanvas->file, "%d %g %g %g %g\n", CDMF_FBOX, xmin, xmax, ymin, ymax);
+  if (ctxcanvas->binary)
+    mfBinRecord(ctxcanvas, CDMF_FBOX, "dddd", xmin, xmax, ymin, ymax);
+  else
+    cdStreamPrintf(ctxcanvas->stream, "%d %g %g %g %g\n", CDMF_FBOX, xmin, xmax, ymin, ymax);
 }
 
 static void cdarc(cdCtxCanvas *ctxcanvas, int xc, int yc, int w, int h, double a1, double a2)
 {
-  fprintf(ctxcanvas->file, "%d %d %d %d %d %g %g\n", CDMF_ARC, xc, yc, w, h, a1, a2);
+  if (ctxcanvas->binary)
+    mfBinRecord(ctxcanvas, CDMF_ARC, "iiiidd", xc, yc, w, h, a1, a2);
+  else
+    cdStreamPrintf(ctxcanvas->stream, "%d %d %d %d %d %g %g\n", CDMF_ARC, xc, yc, w, h, a1, a2);
 }
 
 static void cdfarc(cdCtxCanvas *ctxcanvas, double xc, double yc, double w, double h, double a1, double a2)
 {
-  fprintf(ctxcanvas->file, "%d %g %g %g %g %g %g\n", CDMF_FARC, xc, yc, w, h, a1, a2);
+  if (ctxcanvas->binary)
+    mfBinRecord(ctxcanvas, CDMF_FARC, "dddddd", xc, yc, w, h, a1, a2);
+  else
+    cdStreamPrintf(ctxcanvas->stream, "%d %g %g %g %g %g %g\n", CDMF_FARC, xc, yc, w, h, a1, a2);
 }
 
 static void cdsector(cdCtxCanvas *ctxcanvas, int xc, int yc, int w, int h, double a1, double a2)
 {
-  fprintf(ctxcanvas->file, "%d %d %d %d %d %g %g\n", CDMF_SECTOR, xc, yc, w, h, a1, a2);
+  if (ctxcanvas->binary)
+    mfBinRecord(ctxcanvas, CDMF_SECTOR, "iiiidd", xc, yc, w, h, a1, a2);
+  else
+    cdStreamPrintf(ctxcanvas->stream, "%d %d %d %d %d %g %g\n", CDMF_SECTOR, xc, yc, w, h, a1, a2);
 }
 
 static void cdfsector(cdCtxCanvas *ctxcanvas, double xc, double yc, double w, double h, double a1, double a2)
 {
-  fprintf(ctxcanvas->file, "%d %g %g %g %g %g %g\n", CDMF_FSECTOR, xc, yc, w, h, a1, a2);
+  if (ctxcanvas->binary)
+    mfBinRecord(ctxcanvas, CDMF_FSECTOR, "dddddd", xc, yc, w, h, a1, a2);
+  else
+    cdStreamPrintf(ctxcanvas->stream, "%d %g %g %g %g %g %g\n", CDMF_FSECTOR, xc, yc, w, h, a1, a2);
 }
 
 static void cdchord(cdCtxCanvas *ctxcanvas, int xc, int yc, int w, int h, double a1, double a2)
 {
-  fprintf(ctxcanvas->file, "%d %d %d %d %d %g %g\n", CDMF_CHORD, xc, yc, w, h, a1, a2);
+  if (ctxcanvas->binary)
+    mfBinRecord(ctxcanvas, CDMF_CHORD, "iiiidd", xc, yc, w, h, a1, a2);
+  else
+    cdStreamPrintf(ctxcanvas->stream, "%d %d %d %d %d %g %g\n", CDMF_CHORD, xc, yc, w, h, a1, a2);
 }
 
 static void cdfchord(cdCtxCanvas *ctxcanvas, double xc, double yc, double w, double h, double a1, double a2)
 {
-  fprintf(ctxcanvas->file, "%d %g %g %g %g %g %g\n", CDMF_FCHORD, xc, yc, w, h, a1, a2);
+  if (ctxcanvas->binary)
+    mfBinRecord(ctxcanvas, CDMF_FCHORD, "dddddd", xc, yc, w, h, a1, a2);
+  else
+    cdStreamPrintf(ctxcanvas->stream, "%d %g %g %g %g %g %g\n", CDMF_FCHORD, xc, yc, w, h, a1, a2);
 }
 
 static void cdtext(cdCtxCanvas *ctxcanvas, int x, int y, const char *text, int len)
 {
+  if (ctxcanvas->binary)
+  {
+    mfBinRecord(ctxcanvas, CDMF_TEXT, "iis", x, y, text, len);
+    return;
+  }
+
   text = cdStrDupN(text, len);
-  fprintf(ctxcanvas->file, "%d %d %d %s\n", CDMF_TEXT, x, y, text);
+  cdStreamPrintf(ctxcanvas->stream, "%d %d %d %s\n", CDMF_TEXT, x, y, text);
   free((char*)text);
 }
 
 static void cdftext(cdCtxCanvas *ctxcanvas, double x, double y, const char *text, int len)
 {
+  if (ctxcanvas->binary)
+  {
+    mfBinRecord(ctxcanvas, CDMF_FTEXT, "dds", x, y, text, len);
+    return;
+  }
+
   text = cdStrDupN(text, len);
-  fprintf(ctxcanvas->file, "%d %g %g %s\n", CDMF_FTEXT, x, y, text);
+  cdStreamPrintf(ctxcanvas->stream, "%d %g %g %s\n", CDMF_FTEXT, x, y, text);
   free((char*)text);
 }
 
@@ -237,11 +514,33 @@ static void cdpoly(cdCtxCanvas *ctxcanvas, int mode, cdPoint* poly, int n)
 
   if (mode == CD_FILL && ctxcanvas->canvas->fill_mode != ctxcanvas->last_fill_mode)
   {
-    fprintf(ctxcanvas->file, "%d %d\n", CDMF_FILLMODE, ctxcanvas->canvas->fill_mode);
+    if (ctxcanvas->binary)
+      mfBinRecord(ctxcanvas, CDMF_FILLMODE, "i", ctxcanvas->canvas->fill_mode);
+    else
+      cdStreamPrintf(ctxcanvas->stream, "%d %d\n", CDMF_FILLMODE, ctxcanvas->canvas->fill_mode);
     ctxcanvas->last_fill_mode = ctxcanvas->canvas->fill_mode;
   }
 
-  fprintf(ctxcanvas->file, "%d %d\n", CDMF_BEGIN, mode);
+  if (ctxcanvas->binary)
+  {
+    /* the path is checked during playback */
+    mfBinRecord(ctxcanvas, CDMF_POLY, "ii", mode, n);
+    for (i = 0; i < n; i++)
+    {
+      mfBinInt(ctxcanvas, poly[i].x);
+      mfBinInt(ctxcanvas, poly[i].y);
+    }
+
+    if (mode == CD_PATH)
+    {
+      mfBinInt(ctxcanvas, ctxcanvas->canvas->path_n);
+      for (i = 0; i < ctxcanvas->canvas->path_n; i++)
+        mfBinInt(ctxcanvas, ctxcanvas->canvas->path[i]);
+    }
+    return;
+  }
+
+  cdStreamPrintf(ctxcanvas->stream, "%d %d\n", CDMF_BEGIN, mode);
 
   if (mode == CD_PATH)
   {
@@ -250,7 +549,7 @@ static void cdpoly(cdCtxCanvas *ctxcanvas, int mode, cdPoint* poly, int n)
     i = 0;
     for (p=0; p<ctxcanvas->canvas->path_n; p++)
     {
-      fprintf(ctxcanvas->file, "%d %d\n", CDMF_PATHSET, ctxcanvas->canvas->path[p]);
+      cdStreamPrintf(ctxcanvas->stream, "%d %d\n", CDMF_PATHSET, ctxcanvas->canvas->path[p]);
 
       switch(ctxcanvas->canvas->path[p])
       {
@@ -258,10 +557,10 @@ static void cdpoly(cdCtxCanvas *ctxcanvas, int mode, cdPoint* poly, int n)
       case CD_PATH_LINETO:
         if (i+1 > n) 
         {
-          fprintf(ctxcanvas->file, "ERROR: not enough points in path\n");
+          cdStreamPrintf(ctxcanvas->stream, "ERROR: not enough points in path\n");
           return;
         }
-        fprintf(ctxcanvas->file, "%d %d %d\n", CDMF_VERTEX, poly[i].x, poly[i].y);
+        mfWriteVertex(ctxcanvas->stream, poly[i].x, poly[i].y);
         i++;
         break;
       case CD_PATH_CURVETO:
@@ -269,12 +568,12 @@ static void cdpoly(cdCtxCanvas *ctxcanvas, int mode, cdPoint* poly, int n)
         {
           if (i+3 > n)
           {
-            fprintf(ctxcanvas->file, "ERROR: not enough points in path\n");
+            cdStreamPrintf(ctxcanvas->stream, "ERROR: not enough points in path\n");
             return;
           }
-          fprintf(ctxcanvas->file, "%d %d %d\n", CDMF_VERTEX, poly[i].x, poly[i].y);
-          fprintf(ctxcanvas->file, "%d %d %d\n", CDMF_VERTEX, poly[i+1].x, poly[i+1].y);
-          fprintf(ctxcanvas->file, "%d %d %d\n", CDMF_VERTEX, poly[i+2].x, poly[i+2].y);
+          mfWriteVertex(ctxcanvas->stream, poly[i].x, poly[i].y);
+          mfWriteVertex(ctxcanvas->stream, poly[i+1].x, poly[i+1].y);
+          mfWriteVertex(ctxcanvas->stream, poly[i+2].x, poly[i+2].y);
           i += 3;
         }
         break;
@@ -284,10 +583,10 @@ static void cdpoly(cdCtxCanvas *ctxcanvas, int mode, cdPoint* poly, int n)
   else
   {
     for(i = 0; i<n; i++)
-      fprintf(ctxcanvas->file, "%d %d %d\n", CDMF_VERTEX, poly[i].x, poly[i].y);
+      mfWriteVertex(ctxcanvas->stream, poly[i].x, poly[i].y);
   }
 
-  fprintf(ctxcanvas->file, "%d\n", CDMF_END);
+  cdStreamPrintf(ctxcanvas->stream, "%d\n", CDMF_END);
 }
 
 static void cdfpoly(cdCtxCanvas *ctxcanvas, int mode, cdfPoint* poly, int n)
@@ -296,11 +595,33 @@ static void cdfpoly(cdCtxCanvas *ctxcanvas, int mode, cdfPoint* poly, int n)
 
   if (mode == CD_FILL && ctxcanvas->canvas->fill_mode != ctxcanvas->last_fill_mode)
   {
-    fprintf(ctxcanvas->file, "%d %d\n", CDMF_FILLMODE, ctxcanvas->canvas->fill_mode);
+    if (ctxcanvas->binary)
+      mfBinRecord(ctxcanvas, CDMF_FILLMODE, "i", ctxcanvas->canvas->fill_mode);
+    else
+      cdStreamPrintf(ctxcanvas->stream, "%d %d\n", CDMF_FILLMODE, ctxcanvas->canvas->fill_mode);
     ctxcanvas->last_fill_mode = ctxcanvas->canvas->fill_mode;
   }
 
-  fprintf(ctxcanvas->file, "%d %d\n", CDMF_BEGIN, mode);
+  if (ctxcanvas->binary)
+  {
+    /* the path is checked during playback */
+    mfBinRecord(ctxcanvas, CDMF_FPOLY, "ii", mode, n);
+    for (i = 0; i < n; i++)
+    {
+      mfBinPutDouble(mfBinReserve(ctxcanvas, 8), poly[i].x);
+      mfBinPutDouble(mfBinReserve(ctxcanvas, 8), poly[i].y);
+    }
+
+    if (mode == CD_PATH)
+    {
+      mfBinInt(ctxcanvas, ctxcanvas->canvas->path_n);
+      for (i = 0; i < ctxcanvas->canvas->path_n; i++)
+        mfBinInt(ctxcanvas, ctxcanvas->canvas->path[i]);
+    }
+    return;
+  }
+
+  cdStreamPrintf(ctxcanvas->stream, "%d %d\n", CDMF_BEGIN, mode);
 
   if (mode == CD_PATH)
   {
@@ -309,7 +630,7 @@ static void cdfpoly(cdCtxCanvas *ctxcanvas, int mode, cdfPoint* poly, int n)
     i = 0;
     for (p=0; p<ctxcanvas->canvas->path_n; p++)
     {
-      fprintf(ctxcanvas->file, "%d %d\n", CDMF_PATHSET, ctxcanvas->canvas->path[p]);
+      cdStreamPrintf(ctxcanvas->stream, "%d %d\n", CDMF_PATHSET, ctxcanvas->canvas->path[p]);
 
       switch(ctxcanvas->canvas->path[p])
       {
@@ -317,10 +638,10 @@ static void cdfpoly(cdCtxCanvas *ctxcanvas, int mode, cdfPoint* poly, int n)
       case CD_PATH_LINETO:
         if (i+1 > n) 
         {
-          fprintf(ctxcanvas->file, "ERROR: not enough points in path\n");
+          cdStreamPrintf(ctxcanvas->stream, "ERROR: not enough points in path\n");
           return;
         }
-        fprintf(ctxcanvas->file, "%d %g %g\n", CDMF_FVERTEX, poly[i].x, poly[i].y);
+        mfWriteFVertex(ctxcanvas->stream, poly[i].x, poly[i].y);
         i++;
         break;
       case CD_PATH_CURVETO:
@@ -328,12 +649,12 @@ static void cdfpoly(cdCtxCanvas *ctxcanvas, int mode, cdfPoint* poly, int n)
         {
           if (i+3 > n)
           {
-            fprintf(ctxcanvas->file, "ERROR: not enough points in path\n");
+            cdStreamPrintf(ctxcanvas->stream, "ERROR: not enough points in path\n");
             return;
           }
-          fprintf(ctxcanvas->file, "%d %g %g\n", CDMF_FVERTEX, poly[i].x, poly[i].y);
-          fprintf(ctxcanvas->file, "%d %g %g\n", CDMF_FVERTEX, poly[i+1].x, poly[i+1].y);
-          fprintf(ctxcanvas->file, "%d %g %g\n", CDMF_FVERTEX, poly[i+2].x, poly[i+2].y);
+          mfWriteFVertex(ctxcanvas->stream, poly[i].x, poly[i].y);
+          mfWriteFVertex(ctxcanvas->stream, poly[i+1].x, poly[i+1].y);
+          mfWriteFVertex(ctxcanvas->stream, poly[i+2].x, poly[i+2].y);
           i += 3;
         }
         break;
@@ -343,67 +664,103 @@ static void cdfpoly(cdCtxCanvas *ctxcanvas, int mode, cdfPoint* poly, int n)
   else
   {
     for(i = 0; i<n; i++)
-      fprintf(ctxcanvas->file, "%d %g %g\n", CDMF_FVERTEX, poly[i].x, poly[i].y);
+      mfWriteFVertex(ctxcanvas->stream, poly[i].x, poly[i].y);
   }
 
-  fprintf(ctxcanvas->file, "%d\n", CDMF_END);
+  cdStreamPrintf(ctxcanvas->stream, "%d\n", CDMF_END);
 }
 
 static int cdbackopacity(cdCtxCanvas *ctxcanvas, int opacity)
 {
-  fprintf(ctxcanvas->file, "%d %d\n", CDMF_BACKOPACITY, opacity);
+  if (ctxcanvas->binary)
+    mfBinRecord(ctxcanvas, CDMF_BACKOPACITY, "i", opacity);
+  else
+    cdStreamPrintf(ctxcanvas->stream, "%d %d\n", CDMF_BACKOPACITY, opacity);
   return opacity;
 }
 
 static int cdwritemode(cdCtxCanvas *ctxcanvas, int mode)
 {
-  fprintf(ctxcanvas->file, "%d %d\n", CDMF_WRITEMODE, mode);
+  if (ctxcanvas->binary)
+    mfBinRecord(ctxcanvas, CDMF_WRITEMODE, "i", mode);
+  else
+    cdStreamPrintf(ctxcanvas->stream, "%d %d\n", CDMF_WRITEMODE, mode);
   return mode;
 }
 
 static int cdlinestyle(cdCtxCanvas *ctxcanvas, int style)
 {
+  if (ctxcanvas->binary)
+  {
+    if (style == CD_CUSTOM && ctxcanvas->canvas->line_style != ctxcanvas->last_line_style)
+    {
+      int i;
+      mfBinRecord(ctxcanvas, CDMF_LINESTYLEDASHES, "i", ctxcanvas->canvas->line_dashes_count);
+      for (i = 0; i < ctxcanvas->canvas->line_dashes_count; i++)
+        mfBinInt(ctxcanvas, ctxcanvas->canvas->line_dashes[i]);
+      ctxcanvas->last_line_style = ctxcanvas->canvas->line_style;
+    }
+
+    mfBinRecord(ctxcanvas, CDMF_LINESTYLE, "i", style);
+    return style;
+  }
+
   if (style == CD_CUSTOM && ctxcanvas->canvas->line_style != ctxcanvas->last_line_style)
   {
     int i;
-    fprintf(ctxcanvas->file, "%d %d", CDMF_LINESTYLEDASHES, ctxcanvas->canvas->line_dashes_count);
+    cdStreamPrintf(ctxcanvas->stream, "%d %d", CDMF_LINESTYLEDASHES, ctxcanvas->canvas->line_dashes_count);
     for (i = 0; i < ctxcanvas->canvas->line_dashes_count; i++)
-      fprintf(ctxcanvas->file, " %d", ctxcanvas->canvas->line_dashes[i]);
-    fprintf(ctxcanvas->file, "\n");
+      cdStreamPrintf(ctxcanvas->stream, " %d", ctxcanvas->canvas->line_dashes[i]);
+    cdStreamPrintf(ctxcanvas->stream, "\n");
     ctxcanvas->last_line_style = ctxcanvas->canvas->line_style;
   }
 
-  fprintf(ctxcanvas->file, "%d %d\n", CDMF_LINESTYLE, style);
+  cdStreamPrintf(ctxcanvas->stream, "%d %d\n", CDMF_LINESTYLE, style);
   return style;
 }
 
 static int cdlinewidth(cdCtxCanvas *ctxcanvas, int width)
 {
-  fprintf(ctxcanvas->file, "%d %d\n", CDMF_LINEWIDTH, width);
+  if (ctxcanvas->binary)
+    mfBinRecord(ctxcanvas, CDMF_LINEWIDTH, "i", width);
+  else
+    cdStreamPrintf(ctxcanvas->stream, "%d %d\n", CDMF_LINEWIDTH, width);
   return width;
 }
 
 static int cdlinecap(cdCtxCanvas *ctxcanvas, int cap)
 {
-  fprintf(ctxcanvas->file, "%d %d\n", CDMF_LINECAP, cap);
+  if (ctxcanvas->binary)
+    mfBinRecord(ctxcanvas, CDMF_LINECAP, "i", cap);
+  else
+    cdStreamPrintf(ctxcanvas->stream, "%d %d\n", CDMF_LINECAP, cap);
   return cap;
 }
 
 static int cdlinejoin(cdCtxCanvas *ctxcanvas, int join)
 {
-  fprintf(ctxcanvas->file, "%d %d\n", CDMF_LINEJOIN, join);
+  if (ctxcanvas->binary)
+    mfBinRecord(ctxcanvas, CDMF_LINEJOIN, "i", join);
+  else
+    cdStreamPrintf(ctxcanvas->stream, "%d %d\n", CDMF_LINEJOIN, join);
   return join;
 }
 
 static int cdinteriorstyle(cdCtxCanvas *ctxcanvas, int style)
 {
-  fprintf(ctxcanvas->file, "%d %d\n", CDMF_INTERIORSTYLE, style);
+  if (ctxcanvas->binary)
+    mfBinRecord(ctxcanvas, CDMF_INTERIORSTYLE, "i", style);
+  else
+    cdStreamPrintf(ctxcanvas->stream, "%d %d\n", CDMF_INTERIORSTYLE, style);
   return style;
 }
 
 static int cdhatch(cdCtxCanvas *ctxcanvas, int style)
 {
-  fprintf(ctxcanvas->file, "%d %d\n", CDMF_HATCH, style);
+  if (ctxcanvas->binary)
+    mfBinRecord(ctxcanvas, CDMF_HATCH, "i", style);
+  else
+    cdStreamPrintf(ctxcanvas->stream, "%d %d\n", CDMF_HATCH, style);
   return style;
 }
 
@@ -411,15 +768,22 @@ static void cdstipple(cdCtxCanvas *ctxcanvas, int w, int h, const unsigned char
 {
   int c, t;
 
-  fprintf(ctxcanvas->file, "%d %d %d\n", CDMF_STIPPLE, w, h);
+  if (ctxcanvas->binary)
+  {
+    mfBinRecord(ctxcanvas, CDMF_STIPPLE, "ii", w, h);
+    mfBinData(ctxcanvas, stipple, w*h);
+    return;
+  }
+
+  cdStreamPrintf(ctxcanvas->stream, "%d %d %d\n", CDMF_STIPPLE, w, h);
 
   t = w * h;
 
   for (c = 0; c < t; c++)
   {
-    fprintf(ctxcanvas->file, "%d ", (int)*stipple++);
+    mfWriteByte(ctxcanvas->stream, *stipple++);
     if ((c + 1) % w == 0)
-      fprintf(ctxcanvas->file, "\n");
+      cdStreamPrintf(ctxcanvas->stream, "\n");
   }
 }
 
@@ -428,7 +792,16 @@ static void cdpattern(cdCtxCanvas *ctxcanvas, int w, int h, const long int *patt
   int c, t;
   unsigned char r, g, b;
 
-  fprintf(ctxcanvas->file, "%d %d %d\n", CDMF_PATTERN, w, h);
+  if (ctxcanvas->binary)
+  {
+    t = w * h;
+    mfBinRecord(ctxcanvas, CDMF_PATTERN, "ii", w, h);
+    for (c = 0; c < t; c++)
+      mfBinInt(ctxcanvas, (int)(unsigned int)pattern[c]);
+    return;
+  }
+
+  cdStreamPrintf(ctxcanvas->stream, "%d %d %d\n", CDMF_PATTERN, w, h);
 
   t = w * h;
 
@@ -436,33 +809,45 @@ static void cdpattern(cdCtxCanvas *ctxcanvas, int w, int h, const long int *patt
   for (c = 0; c < t; c++)
   {
     cdDecodeColor(*pattern++, &r, &g, &b);
-    fprintf(ctxcanvas->file, "%d %d %d ", (int)r, (int)g, (int)b);
+    cdStreamPrintf(ctxcanvas->stream, "%d %d %d ", (int)r, (int)g, (int)b);
     if ((c + 1) % w == 0)
-      fprintf(ctxcanvas->file, "\n");
+      cdStreamPrintf(ctxcanvas->stream, "\n");
   }
 }
 
 static int cdfont(cdCtxCanvas *ctxcanvas, const char* type_face, int style, int size)
 {
-  fprintf(ctxcanvas->file, "%d %d %d %s\n", CDMF_FONT, style, size, type_face);
+  if (ctxcanvas->binary)
+    mfBinRecord(ctxcanvas, CDMF_FONT, "iis", style, size, type_face, (int)strlen(type_face));
+  else
+    cdStreamPrintf(ctxcanvas->stream, "%d %d %d %s\n", CDMF_FONT, style, size, type_face);
   return 1;
 }
 
 static int cdnativefont(cdCtxCanvas *ctxcanvas, const char* font)
 {
-  fprintf(ctxcanvas->file, "%d %s\n", CDMF_NATIVEFONT, font);
+  if (ctxcanvas->binary)
+    mfBinRecord(ctxcanvas, CDMF_NATIVEFONT, "s", font, (int)strlen(font));
+  else
+    cdStreamPrintf(ctxcanvas->stream, "%d %s\n", CDMF_NATIVEFONT, font);
   return 1;
 }
 
 static int cdtextalignment(cdCtxCanvas *ctxcanvas, int alignment)
 {
-  fprintf(ctxcanvas->file, "%d %d\n", CDMF_TEXTALIGNMENT, alignment);
+  if (ctxcanvas->binary)
+    mfBinRecord(ctxcanvas, CDMF_TEXTALIGNMENT, "i", alignment);
+  else
+    cdStreamPrintf(ctxcanvas->stream, "%d %d\n", CDMF_TEXTALIGNMENT, alignment);
   return alignment;
 }
 
 static double cdtextorientation(cdCtxCanvas *ctxcanvas, double angle)
 {
-  fprintf(ctxcanvas->file, "%d %g\n", CDMF_TEXTORIENTATION, angle);
+  if (ctxcanvas->binary)
+    mfBinRecord(ctxcanvas, CDMF_TEXTORIENTATION, "d", angle);
+  else
+    cdStreamPrintf(ctxcanvas->stream, "%d %g\n", CDMF_TEXTORIENTATION, angle);
   return angle;
 }
 
@@ -471,28 +856,50 @@ static void cdpalette(cdCtxCanvas *ctxcanvas, int n, const long int *palette, in
   int c;
   unsigned char r, g, b;
 
-  fprintf(ctxcanvas->file, "%d %d %d\n", CDMF_PALETTE, n, mode);
+  if (ctxcanvas->binary)
+  {
+    mfBinRecord(ctxcanvas, CDMF_PALETTE, "ii", n, mode);
+    for (c = 0; c < n; c++)
+      mfBinInt(ctxcanvas, (int)(unsigned int)palette[c]);
+    return;
+  }
+
+  cdStreamPrintf(ctxcanvas->stream, "%d %d %d\n", CDMF_PALETTE, n, mode);
 
   for (c = 0; c < n; c++)
   {
     cdDecodeColor(*palette++, &r, &g, &b);
-    fprintf(ctxcanvas->file, "%d %d %d\n", (int)r, (int)g, (int)b);
+    cdStreamPrintf(ctxcanvas->stream, "%d %d %d\n", (int)r, (int)g, (int)b);
   }
 }
 
 static long cdbackground(cdCtxCanvas *ctxcanvas, long int color)
 {
   unsigned char r, g, b;
+
+  if (ctxcanvas->binary)
+  {
+    mfBinRecord(ctxcanvas, CDMF_BACKGROUND, "c", color);
+    return color;
+  }
+
   cdDecodeColor(color, &r, &g, &b);
-  fprintf(ctxcanvas->file, "%d %d %d %d\n", CDMF_BACKGROUND, (int)r, (int)g, (int)b);
+  cdStreamPrintf(ctxcanvas->stream, "%d %d %d %d\n", CDMF_BACKGROUND, (int)r, (int)g, (int)b);
   return color;
 }
 
 static long cdforeground(cdCtxCanvas *ctxcanvas, long int color)
 {
   unsigned char r, g, b;
+
+  if (ctxcanvas->binary)
+  {
+    mfBinRecord(ctxcanvas, CDMF_FOREGROUND, "c", color);
+    return color;
+  }
+
   cdDecodeColor(color, &r, &g, &b);
-	fprintf(ctxcanvas->file, "%d %d %d %d\n", CDMF_FOREGROUND, (int)r, (int)g, (int)b);
+	cdStreamPrintf(ctxcanvas->stream, "%d %d %d %d\n", CDMF_FOREGROUND, (int)r, (int)g, (int)b);
   return color;
 }
 
@@ -500,7 +907,16 @@ static void cdputimagerectrgb(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsi
 {
   int c, l, offset;
 
-  fprintf(ctxcanvas->file, "%d %d %d %d %d %d %d\n", CDMF_PUTIMAGERGB, iw, ih, x, y, w, h);
+  if (ctxcanvas->binary)
+  {
+    mfBinRecord(ctxcanvas, CDMF_PUTIMAGERGB, "iiiiii", xmax-xmin+1, ymax-ymin+1, x, y, w, h);
+    mfBinPlane(ctxcanvas, r, iw, xmin, xmax, ymin, ymax);
+    mfBinPlane(ctxcanvas, g, iw, xmin, xmax, ymin, ymax);
+    mfBinPlane(ctxcanvas, b, iw, xmin, xmax, ymin, ymax);
+    return;
+  }
+
+  cdStreamPrintf(ctxcanvas->stream, "%d %d %d %d %d %d %d\n", CDMF_PUTIMAGERGB, iw, ih, x, y, w, h);
 
   offset = ymin*iw + xmin;
   r += offset;
@@ -513,14 +929,16 @@ static void cdputimagerectrgb(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsi
   {
     for (c = xmin; c <= xmax; c++)
     {
-      fprintf(ctxcanvas->file, "%d %d %d ", (int)*r++, (int)*g++, (int)*b++);
+      mfWriteByte(ctxcanvas->stream, *r++);
+      mfWriteByte(ctxcanvas->stream, *g++);
+      mfWriteByte(ctxcanvas->stream, *b++);
     }
 
     r += offset;
     g += offset;
     b += offset;
 
-    fprintf(ctxcanvas->file, "\n");
+    cdStreamPrintf(ctxcanvas->stream, "\n");
   }
 }
 
@@ -528,7 +946,17 @@ static void cdputimagerectrgba(cdCtxCanvas *ctxcanvas, int iw, int ih, const uns
 {
   int c, l, offset;
 
-  fprintf(ctxcanvas->file, "%d %d %d %d %d %d %d\n", CDMF_PUTIMAGERGBA, iw, ih, x, y, w, h);
+  if (ctxcanvas->binary)
+  {
+    mfBinRecord(ctxcanvas, CDMF_PUTIMAGERGBA, "iiiiii", xmax-xmin+1, ymax-ymin+1, x, y, w, h);
+    mfBinPlane(ctxcanvas, r, iw, xmin, xmax, ymin, ymax);
+    mfBinPlane(ctxcanvas, g, iw, xmin, xmax, ymin, ymax);
+    mfBinPlane(ctxcanvas, b, iw, xmin, xmax, ymin, ymax);
+    mfBinPlane(ctxcanvas, a, iw, xmin, xmax, ymin, ymax);
+    return;
+  }
+
+  cdStreamPrintf(ctxcanvas->stream, "%d %d %d %d %d %d %d\n", CDMF_PUTIMAGERGBA, iw, ih, x, y, w, h);
 
   offset = ymin*iw + xmin;
   r += offset;
@@ -542,7 +970,10 @@ static void cdputimagerectrgba(cdCtxCanvas *ctxcanvas, int iw, int ih, const uns
   {
     for (c = xmin; c <= xmax; c++)
     {
-      fprintf(ctxcanvas->file, "%d %d %d %d ", (int)*r++, (int)*g++, (int)*b++, (int)*a++);
+      mfWriteByte(ctxcanvas->stream, *r++);
+      mfWriteByte(ctxcanvas->stream, *g++);
+      mfWriteByte(ctxcanvas->stream, *b++);
+      mfWriteByte(ctxcanvas->stream, *a++);
     }
 
     r += offset;
@@ -550,7 +981,7 @@ static void cdputimagerectrgba(cdCtxCanvas *ctxcanvas, int iw, int ih, const uns
     b += offset;
     a += offset;
 
-    fprintf(ctxcanvas->file, "\n");
+    cdStreamPrintf(ctxcanvas->stream, "\n");
   }
 }
 
@@ -559,7 +990,30 @@ static void cdputimagerectmap(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsi
   int c, l, n = 0, offset;
   unsigned char r, g, b;
 
-  fprintf(ctxcanvas->file, "%d %d %d %d %d %d %d\n", CDMF_PUTIMAGEMAP, iw, ih, x, y, w, h);
+  if (ctxcanvas->binary)
+  {
+    const unsigned char* idx = index + ymin*iw + xmin;
+
+    for (l = ymin; l <= ymax; l++)
+    {
+      for (c = 0; c < xmax-xmin+1; c++)
+      {
+        if (idx[c] > n)
+          n = idx[c];
+      }
+      idx += iw;
+    }
+    n++;
+
+    mfBinRecord(ctxcanvas, CDMF_PUTIMAGEMAP, "iiiiii", xmax-xmin+1, ymax-ymin+1, x, y, w, h);
+    mfBinPlane(ctxcanvas, index, iw, xmin, xmax, ymin, ymax);
+    mfBinInt(ctxcanvas, n);
+    for (c = 0; c < n; c++)
+      mfBinInt(ctxcanvas, (int)(unsigned int)colors[c]);
+    return;
+  }
+
+  cdStreamPrintf(ctxcanvas->stream, "%d %d %d %d %d %d %d\n", CDMF_PUTIMAGEMAP, iw, ih, x, y, w, h);
 
   index += ymin*iw + xmin;
   offset = iw - (xmax-xmin+1);
@@ -571,12 +1025,12 @@ static void cdputimagerectmap(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsi
       if (*index > n)
         n = *index;
 
-      fprintf(ctxcanvas->file, "%d ", (int)*index++);
+      mfWriteByte(ctxcanvas->stream, *index++);
     }
 
     index += offset;
 
-    fprintf(ctxcanvas->file, "\n");
+    cdStreamPrintf(ctxcanvas->stream, "\n");
   }
 
   n++;
@@ -584,20 +1038,30 @@ static void cdputimagerectmap(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsi
   for (c = 0; c < n; c++)
   {
     cdDecodeColor(*colors++, &r, &g, &b);
-    fprintf(ctxcanvas->file, "%d %d %d\n", (int)r, (int)g, (int)b);
+    cdStreamPrintf(ctxcanvas->stream, "%d %d %d\n", (int)r, (int)g, (int)b);
   }
 }
 
 static void cdpixel(cdCtxCanvas *ctxcanvas, int x, int y, long int color)
 {
   unsigned char r, g, b;
+
+  if (ctxcanvas->binary)
+  {
+    mfBinRecord(ctxcanvas, CDMF_PIXEL, "iic", x, y, color);
+    return;
+  }
+
   cdDecodeColor(color, &r, &g, &b);
-  fprintf(ctxcanvas->file, "%d %d %d %d %d %d\n", CDMF_PIXEL, x, y, (int)r, (int)g, (int)b);
+  cdStreamPrintf(ctxcanvas->stream, "%d %d %d %d %d %d\n", CDMF_PIXEL, x, y, (int)r, (int)g, (int)b);
 }
 
 static void cdscrollarea(cdCtxCanvas *ctxcanvas, int xmin,int xmax, int ymin,int ymax, int dx,int dy)
 {
-  fprintf(ctxcanvas->file, "%d %d %d %d %d %d %d\n", CDMF_SCROLLAREA, xmin, xmax, ymin, ymax, dx, dy);
+  if (ctxcanvas->binary)
+    mfBinRecord(ctxcanvas, CDMF_SCROLLAREA, "iiiiii", xmin, xmax, ymin, ymax, dx, dy);
+  else
+    cdStreamPrintf(ctxcanvas->stream, "%d %d %d %d %d %d %d\n", CDMF_SCROLLAREA, xmin, xmax, ymin, ymax, dx, dy);
 }
 
 
@@ -633,71 +1097,216 @@ static int cdregistercallback(int cb, cdCallback func)
   return CD_ERROR;
 }
 
-static int cdplay(cdCanvas* canvas, int xmin, int xmax, int ymin, int ymax, void *data)
+/* memory mapped file, read only */
+static unsigned char* mfMapFile(const char* filename, size_t *size, void** handle)
 {
-  char* filename = (char*)data;
-  FILE* file;
-  char TextBuffer[512];
-  int iparam1, iparam2, iparam3, iparam4, iparam5, iparam6, iparam7, iparam8, iparam9, iparam10;
-  int c, t, n, w, h, func, scale = 0;
-  double dparam1, dparam2, dparam3, dparam4, dparam5, dparam6;
-  unsigned char* stipple, * _stipple, *red, *green, *blue, *_red, *_green, *_blue, *index, *_index, *_alpha, *alpha;
-  long int *pattern, *palette, *_pattern, *_palette, *colors, *_colors;
-  int* dashes;
-  double matrix[6], factorX, factorY;
-  const char * font_family[] = 
+#ifdef WIN32
+  HANDLE hFile, hMap;
+  unsigned char* data;
+
+  hFile = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (hFile == INVALID_HANDLE_VALUE)
+    return NULL;
+
+  *size = (size_t)GetFileSize(hFile, NULL);
+  if (*size == 0 || *size == (size_t)INVALID_FILE_SIZE)
   {
-    "System",       /* CD_SYSTEM */
-    "Courier",      /* CD_COURIER */
-    "Times",        /* CD_TIMES_ROMAN */
-    "Helvetica"     /* CD_HELVETICA */
-  };
-  
-  file = fopen(filename, "r");
-  if (!file)
-    return CD_ERROR;
+    CloseHandle(hFile);
+    return NULL;
+  }
 
-  func = -1;
-  w = 0;
-  h = 0;
+  hMap = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(hFile);
+  if (!hMap)
+    return NULL;
 
-  factorX = 1;
-  factorY = 1;
+  data = (unsigned char*)MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+  if (!data)
+  {
+    CloseHandle(hMap);
+    return NULL;
+  }
 
-  fscanf(file, "%s %d %d", TextBuffer, &w, &h);
+  *handle = hMap;
+  return data;
+#else
+  struct stat st;
+  void* data;
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return NULL;
 
-  if (strcmp(TextBuffer, "CDMF") != 0)
+  if (fstat(fd, &st) != 0 || st.st_size == 0)
   {
-    fclose(file);
-    return CD_ERROR;
+    close(fd);
+    return NULL;
   }
 
-  if (w>1 && 
-      h>1 && 
-      (xmax-xmin+1)>1 && 
-      (ymax-ymin+1)>1)
+  *size = (size_t)st.st_size;
+  data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return NULL;
+
+  *handle = NULL;
+  return (unsigned char*)data;
+#endif
+}
+
+static void mfUnmapFile(unsigned char* data, size_t size, void* handle)
+{
+#ifdef WIN32
+  UnmapViewOfFile(data);
+  CloseHandle((HANDLE)handle);
+  (void)size;
+#else
+  munmap(data, size);
+  (void)handle;
+#endif
+}
+
+typedef struct _tMFBinReader
+{
+  const unsigned char *data, *end;
+  int error;
+
+  char* str;            /* buffer for strings */
+  int str_size;
+} tMFBinReader;
+
+static const unsigned char* mfBinGetData(tMFBinReader* reader, int size)
+{
+  const unsigned char* data = reader->data;
+  if (size < 0 || reader->end - reader->data < size)
   {
-    scale = 1;
-    factorX = ((double)(xmax-xmin+1)) / ((double)w);
-    factorY = ((double)(ymax-ymin+1)) / ((double)h);
+    reader->error = 1;
+    reader->data = reader->end;
+    return NULL;
   }
+  reader->data += size;
+  return data;
+}
 
-  if (cdsizecb)
+static int mfBinGetInt(tMFBinReader* reader)
+{
+  const unsigned char* b = mfBinGetData(reader, 4);
+  if (!b)
+    return 0;
+  return (int)((unsigned int)b[0] | ((unsigned int)b[1] << 8) | ((unsigned int)b[2] << 16) | ((unsigned int)b[3] << 24));
+}
+
+static long mfBinGetColor(tMFBinReader* reader)
+{
+  return (long)(unsigned int)mfBinGetInt(reader);
+}
+
+static double mfBinGetDouble(tMFBinReader* reader)
+{
+  unsigned char d[8];
+  double v = 0;
+  int i, big_endian = mfBinBigEndian();
+  const unsigned char* b = mfBinGetData(reader, 8);
+  if (!b)
+    return 0;
+  for (i = 0; i < 8; i++)
+    d[i] = big_endian? b[7-i]: b[i];
+  memcpy(&v, d, 8);
+  return v;
+}
+
+static const char* mfBinGetString(tMFBinReader* reader)
+{
+  int len = mfBinGetInt(reader);
+  const unsigned char* str = mfBinGetData(reader, len);
+  if (!str)
+    return "";
+
+  if (len+1 > reader->str_size)
   {
-    int err;
-    err = cdsizecb(canvas, w, h, w, h);
-    if (err)
+    reader->str_size = len+1;
+    reader->str = (char*)realloc(reader->str, reader->str_size);
+  }
+
+  memcpy(reader->str, str, len);
+  reader->str[len] = 0;
+  return reader->str;
+}
+
+/* size of a plane with w*h bytes, -1 if invalid */
+#define mfBinPlaneSize(_w, _h) (((_w) > 0 && (_h) > 0 && (_w) <= INT_MAX/(_h))? (_w)*(_h): -1)
+
+static int mfBinCheckCount(tMFBinReader* reader, int count, int elem_size)
+{
+  if (count < 0 || count > (reader->end - reader->data)/elem_size)
+  {
+    reader->error = 1;
+    return 0;
+  }
+  return 1;
+}
+
+static int mfBinPlayPath(cdCanvas* canvas, tMFBinReader* reader, int n, int is_float, int scale, double factorX, double factorY, int xmin, int ymin)
+{
+  const unsigned char* points = reader->data;
+  int p, i, c, path_n, point_size = is_float? 16: 8;
+
+  mfBinGetData(reader, n*point_size);
+  path_n = mfBinGetInt(reader);
+  if (reader->error || !mfBinCheckCount(reader, path_n, 4))
+    return 0;
+
+  i = 0;
+  for (p = 0; p < path_n; p++)
+  {
+    int path = mfBinGetInt(reader);
+    int count = (path == CD_PATH_CURVETO || path == CD_PATH_ARC)? 3: (path == CD_PATH_MOVETO || path == CD_PATH_LINETO)? 1: 0;
+
+    cdCanvasPathSet(canvas, path);
+
+    if (i + count > n)
+    {
+      reader->error = 1;
+      return 0;
+    }
+
+    for (c = 0; c < count; c++, i++)
     {
-      fclose(file);
-      return CD_ERROR;
+      tMFBinReader vertex;
+      vertex.data = points + i*point_size;
+      vertex.end = vertex.data + point_size;
+      vertex.error = 0;
+      if (is_float)
+      {
+        double x = mfBinGetDouble(&vertex);
+        double y = mfBinGetDouble(&vertex);
+        cdfCanvasVertex(canvas, sfScaleX(x), sfScaleY(y));
+      }
+      else
+      {
+        int x = mfBinGetInt(&vertex);
+        int y = mfBinGetInt(&vertex);
+        cdCanvasVertex(canvas, sScaleX(x), sScaleY(y));
+      }
     }
   }
 
-  while (!feof(file))
+  return 1;
+}
+
+/* plays up to count records, returns the number of records played or -1 if failed */
+static int mfBinPlayRecords(cdCanvas* canvas, tMFBinReader* reader, int count, int scale, double factorX, double factorY, int xmin, int ymin)
+{
+  int iparam1, iparam2, iparam3, iparam4, iparam5, iparam6;
+  int c, t, n, func, played = 0;
+  double dparam1, dparam2, dparam3, dparam4, dparam5, dparam6;
+  double matrix[6];
+  const unsigned char *red, *green, *blue, *alpha, *index;
+  const char* str;
+
+  while (played < count && reader->data < reader->end)
   {
-    fscanf(file, "%d", &func);
-    if (feof(file))
-      break;
+    func = *reader->data++;
+    played++;
 
     switch (func)
     {
@@ -708,226 +1317,175 @@ static int cdplay(cdCanvas* canvas, int xmin, int xmax, int ymin, int ymax, void
       cdCanvasClear(canvas);
       break;
     case CDMF_CLIP:
-      fscanf(file, "%d", &iparam1);
-      cdCanvasClip(canvas, iparam1);
+      cdCanvasClip(canvas, mfBinGetInt(reader));
       break;
     case CDMF_CLIPAREA:
-      fscanf(file, "%d %d %d %d", &iparam1, &iparam2, &iparam3, &iparam4);
+      iparam1 = mfBinGetInt(reader); iparam2 = mfBinGetInt(reader); iparam3 = mfBinGetInt(reader); iparam4 = mfBinGetInt(reader);
       cdCanvasClipArea(canvas, sScaleX(iparam1), sScaleX(iparam2), sScaleY(iparam3), sScaleY(iparam4));
       break;
     case CDMF_FCLIPAREA:
-      fscanf(file, "%lg %lg %lg %lg", &dparam1, &dparam2, &dparam3, &dparam4);
+      dparam1 = mfBinGetDouble(reader); dparam2 = mfBinGetDouble(reader); dparam3 = mfBinGetDouble(reader); dparam4 = mfBinGetDouble(reader);
       cdfCanvasClipArea(canvas, sfScaleX(dparam1), sfScaleX(dparam2), sfScaleY(dparam3), sfScaleY(dparam4));
       break;
     case CDMF_MATRIX:
-      fscanf(file, "%lg %lg %lg %lg %lg %lg", &matrix[0], &matrix[1], &matrix[2], &matrix[3], &matrix[4], &matrix[5]);
+      for (c = 0; c < 6; c++)
+        matrix[c] = mfBinGetDouble(reader);
       cdCanvasTransform(canvas, matrix);
       break;
     case CDMF_RESETMATRIX:
       cdCanvasTransform(canvas, NULL);
       break;
-    case CDMF_WCLIPAREA:
-      fscanf(file, "%lg %lg %lg %lg", &dparam1, &dparam2, &dparam3, &dparam4);
-      wdCanvasClipArea(canvas, dparam1, dparam2, dparam3, dparam4);
-      break;
     case CDMF_LINE:
-      fscanf(file, "%d %d %d %d", &iparam1, &iparam2, &iparam3, &iparam4);
+      iparam1 = mfBinGetInt(reader); iparam2 = mfBinGetInt(reader); iparam3 = mfBinGetInt(reader); iparam4 = mfBinGetInt(reader);
       cdCanvasLine(canvas, sScaleX(iparam1), sScaleY(iparam2), sScaleX(iparam3), sScaleY(iparam4));
       break;
     case CDMF_FLINE:
-      fscanf(file, "%lg %lg %lg %lg", &dparam1, &dparam2, &dparam3, &dparam4);
+      dparam1 = mfBinGetDouble(reader); dparam2 = mfBinGetDouble(reader); dparam3 = mfBinGetDouble(reader); dparam4 = mfBinGetDouble(reader);
       cdfCanvasLine(canvas, sfScaleX(dparam1), sfScaleY(dparam2), sfScaleX(dparam3), sfScaleY(dparam4));
       break;
-    case CDMF_WLINE:
-      fscanf(file, "%lg %lg %lg %lg", &dparam1, &dparam2, &dparam3, &dparam4);
-      wdCanvasLine(canvas, dparam1, dparam2, dparam3, dparam4);
-      break;
     case CDMF_RECT:
-      fscanf(file, "%d %d %d %d", &iparam1, &iparam2, &iparam3, &iparam4);
+      iparam1 = mfBinGetInt(reader); iparam2 = mfBinGetInt(reader); iparam3 = mfBinGetInt(reader); iparam4 = mfBinGetInt(reader);
       cdCanvasRect(canvas, sScaleX(iparam1), sScaleX(iparam2), sScaleY(iparam3), sScaleY(iparam4));
       break;
     case CDMF_FRECT:
-      fscanf(file, "%lg %lg %lg %lg", &dparam1, &dparam2, &dparam3, &dparam4);
+      dparam1 = mfBinGetDouble(reader); dparam2 = mfBinGetDouble(reader); dparam3 = mfBinGetDouble(reader); dparam4 = mfBinGetDouble(reader);
       cdfCanvasRect(canvas, sfScaleX(dparam1), sfScaleX(dparam2), sfScaleY(dparam3), sfScaleY(dparam4));
       break;
-    case CDMF_WRECT:
-      fscanf(file, "%lg %lg %lg %lg", &dparam1, &dparam2, &dparam3, &dparam4);
-      wdCanvasRect(canvas, dparam1, dparam2, dparam3, dparam4);
-      break;
     case CDMF_BOX:
-      fscanf(file, "%d %d %d %d", &iparam1, &iparam2, &iparam3, &iparam4);
+      iparam1 = mfBinGetInt(reader); iparam2 = mfBinGetInt(reader); iparam3 = mfBinGetInt(reader); iparam4 = mfBinGetInt(reader);
       cdCanvasBox(canvas, sScaleX(iparam1), sScaleX(iparam2), sScaleY(iparam3), sScaleY(iparam4));
       break;
-    case CDMF_WBOX:
-      fscanf(file, "%lg %lg %lg %lg", &dparam1, &dparam2, &dparam3, &dparam4);
-      wdCanvasBox(canvas, dparam1, dparam2, dparam3, dparam4);
-      break;
     case CDMF_FBOX:
-      fscanf(file, "%lg %lg %lg %lg", &dparam1, &dparam2, &dparam3, &dparam4);
+      dparam1 = mfBinGetDouble(reader); dparam2 = mfBinGetDouble(reader); dparam3 = mfBinGetDouble(reader); dparam4 = mfBinGetDouble(reader);
       cdfCanvasBox(canvas, sfScaleX(dparam1), sfScaleX(dparam2), sfScaleY(dparam3), sfScaleY(dparam4));
       break;
     case CDMF_ARC:
-      fscanf(file, "%d %d %d %d %lg %lg", &iparam1, &iparam2, &iparam3, &iparam4, &dparam1, &dparam2);
-      cdCanvasArc(canvas, sScaleX(iparam1), sScaleY(iparam2), sScaleW(iparam3), sScaleH(iparam4), dparam1, dparam2);
-      break;
-    case CDMF_FARC:
-      fscanf(file, "%lg %lg %lg %lg %lg %lg", &dparam1, &dparam2, &dparam3, &dparam4, &dparam5, &dparam6);
-      cdfCanvasArc(canvas, sfScaleX(dparam1), sfScaleY(dparam2), sfScaleW(dparam3), sfScaleH(dparam4), dparam5, dparam6);
-      break;
-    case CDMF_WARC:
-      fscanf(file, "%lg %lg %lg %lg %lg %lg", &dparam1, &dparam2, &dparam3, &dparam4, &dparam5, &dparam6);
-      wdCanvasArc(canvas, dparam1, dparam2, dparam3, dparam4, dparam5, dparam6);
-      break;
     case CDMF_SECTOR:
-      fscanf(file, "%d %d %d %d %lg %lg", &iparam1, &iparam2, &iparam3, &iparam4, &dparam1, &dparam2);
-      cdCanvasSector(canvas, sScaleX(iparam1), sScaleY(iparam2), sScaleW(iparam3), sScaleH(iparam4), dparam1, dparam2);
-      break;
-    case CDMF_FSECTOR:
-      fscanf(file, "%lg %lg %lg %lg %lg %lg", &dparam1, &dparam2, &dparam3, &dparam4, &dparam5, &dparam6);
-      cdfCanvasSector(canvas, sfScaleX(dparam1), sfScaleY(dparam2), sfScaleW(dparam3), sfScaleH(dparam4), dparam5, dparam6);
-      break;
-    case CDMF_WSECTOR:
-      fscanf(file, "%lg %lg %lg %lg %lg %lg", &dparam1, &dparam2, &dparam3, &dparam4, &dparam5, &dparam6);
-      wdCanvasSector(canvas, dparam1, dparam2, dparam3, dparam4, dparam5, dparam6);
-      break;
     case CDMF_CHORD:
-      fscanf(file, "%d %d %d %d %lg %lg", &iparam1, &iparam2, &iparam3, &iparam4, &dparam1, &dparam2);
-      cdCanvasChord(canvas, sScaleX(iparam1), sScaleY(iparam2), sScaleW(iparam3), sScaleH(iparam4), dparam1, dparam2);
+      iparam1 = mfBinGetInt(reader); iparam2 = mfBinGetInt(reader); iparam3 = mfBinGetInt(reader); iparam4 = mfBinGetInt(reader);
+      dparam1 = mfBinGetDouble(reader); dparam2 = mfBinGetDouble(reader);
+      if (func == CDMF_ARC)
+        cdCanvasArc(canvas, sScaleX(iparam1), sScaleY(iparam2), sScaleW(iparam3), sScaleH(iparam4), dparam1, dparam2);
+      else if (func == CDMF_SECTOR)
+        cdCanvasSector(canvas, sScaleX(iparam1), sScaleY(iparam2), sScaleW(iparam3), sScaleH(iparam4), dparam1, dparam2);
+      else
+        cdCanvasChord(canvas, sScaleX(iparam1), sScaleY(iparam2), sScaleW(iparam3), sScaleH(iparam4), dparam1, dparam2);
       break;
+    case CDMF_FARC:
+    case CDMF_FSECTOR:
     case CDMF_FCHORD:
-      fscanf(file, "%lg %lg %lg %lg %lg %lg", &dparam1, &dparam2, &dparam3, &dparam4, &dparam5, &dparam6);
-      cdfCanvasChord(canvas, sfScaleX(dparam1), sfScaleY(dparam2), sfScaleW(dparam3), sfScaleH(dparam4), dparam5, dparam6);
-      break;
-    case CDMF_WCHORD:
-      fscanf(file, "%lg %lg %lg %lg %lg %lg", &dparam1, &dparam2, &dparam3, &dparam4, &dparam5, &dparam6);
-      wdCanvasChord(canvas, dparam1, dparam2, dparam3, dparam4, dparam5, dparam6);
+      dparam1 = mfBinGetDouble(reader); dparam2 = mfBinGetDouble(reader); dparam3 = mfBinGetDouble(reader); 
+      dparam4 = mfBinGetDouble(reader); dparam5 = mfBinGetDouble(reader); dparam6 = mfBinGetDouble(reader);
+      if (func == CDMF_FARC)
+        cdfCanvasArc(canvas, sfScaleX(dparam1), sfScaleY(dparam2), sfScaleW(dparam3), sfScaleH(dparam4), dparam5, dparam6);
+      else if (func == CDMF_FSECTOR)
+        cdfCanvasSector(canvas, sfScaleX(dparam1), sfScaleY(dparam2), sfScaleW(dparam3), sfScaleH(dparam4), dparam5, dparam6);
+      else
+        cdfCanvasChord(canvas, sfScaleX(dparam1), sfScaleY(dparam2), sfScaleW(dparam3), sfScaleH(dparam4), dparam5, dparam6);
       break;
     case CDMF_TEXT:
-      fscanf(file, "%d %d %[^\n\r]", &iparam1, &iparam2, TextBuffer);
-      cdCanvasText(canvas, sScaleX(iparam1), sScaleY(iparam2), TextBuffer);
+      iparam1 = mfBinGetInt(reader); iparam2 = mfBinGetInt(reader);
+      str = mfBinGetString(reader);
+      cdCanvasText(canvas, sScaleX(iparam1), sScaleY(iparam2), str);
       break;
     case CDMF_FTEXT:
-      fscanf(file, "%lg %lg %[^\n\r]", &dparam1, &dparam2, TextBuffer);
-      cdfCanvasText(canvas, sfScaleX(dparam1), sfScaleY(dparam2), TextBuffer);
-      break;
-    case CDMF_WTEXT:
-      fscanf(file, "%lg %lg %[^\n\r]", &dparam1, &dparam2, TextBuffer);
-      wdCanvasText(canvas, dparam1, dparam2, TextBuffer);
-      break;
-    case CDMF_BEGIN:
-      fscanf(file, "%d", &iparam1);
+      dparam1 = mfBinGetDouble(reader); dparam2 = mfBinGetDouble(reader);
+      str = mfBinGetString(reader);
+      cdfCanvasText(canvas, sfScaleX(dparam1), sfScaleY(dparam2), str);
+      break;
+    case CDMF_POLY:
+    case CDMF_FPOLY:
+      iparam1 = mfBinGetInt(reader);  /* mode */
+      n = mfBinGetInt(reader);
+      t = (func == CDMF_FPOLY)? 16: 8;
+      if (reader->error || !mfBinCheckCount(reader, n, t))
+        break;
       cdCanvasBegin(canvas, iparam1);
-      break;
-    case CDMF_VERTEX:
-      fscanf(file, "%d %d", &iparam1, &iparam2);
-      cdCanvasVertex(canvas, sScaleX(iparam1), sScaleY(iparam2));
-      break;
-    case CDMF_FVERTEX:
-      fscanf(file, "%lg %lg", &dparam1, &dparam2);
-      cdfCanvasVertex(canvas, sfScaleX(dparam1), sfScaleY(dparam2));
-      break;
-    case CDMF_WVERTEX:
-      fscanf(file, "%lg %lg", &dparam1, &dparam2);
-      wdCanvasVertex(canvas, dparam1, dparam2);
-      break;
-    case CDMF_END:
+      if (iparam1 == CD_PATH)
+      {
+        if (!mfBinPlayPath(canvas, reader, n, func == CDMF_FPOLY, scale, factorX, factorY, xmin, ymin))
+          break;
+      }
+      else if (func == CDMF_FPOLY)
+      {
+        for (c = 0; c < n; c++)
+        {
+          dparam1 = mfBinGetDouble(reader); dparam2 = mfBinGetDouble(reader);
+          cdfCanvasVertex(canvas, sfScaleX(dparam1), sfScaleY(dparam2));
+        }
+      }
+      else
+      {
+        for (c = 0; c < n; c++)
+        {
+          iparam2 = mfBinGetInt(reader); iparam3 = mfBinGetInt(reader);
+          cdCanvasVertex(canvas, sScaleX(iparam2), sScaleY(iparam3));
+        }
+      }
       cdCanvasEnd(canvas);
       break;
-    case CDMF_MARK:
-      fscanf(file, "%d %d", &iparam1, &iparam2);
-      cdCanvasMark(canvas, sScaleX(iparam1), sScaleY(iparam2));
-      break;
-    case CDMF_WMARK:
-      fscanf(file, "%lg %lg", &dparam1, &dparam2);
-      wdCanvasMark(canvas, dparam1, dparam2);
-      break;
     case CDMF_BACKOPACITY:
-      fscanf(file, "%d", &iparam1);
-      cdCanvasBackOpacity(canvas, iparam1);
+      cdCanvasBackOpacity(canvas, mfBinGetInt(reader));
       break;
     case CDMF_WRITEMODE:
-      fscanf(file, "%d", &iparam1);
-      cdCanvasWriteMode(canvas, iparam1);
+      cdCanvasWriteMode(canvas, mfBinGetInt(reader));
       break;
     case CDMF_LINESTYLE:
-      fscanf(file, "%d", &iparam1);
-      cdCanvasLineStyle(canvas, iparam1);
+      cdCanvasLineStyle(canvas, mfBinGetInt(reader));
       break;
     case CDMF_LINEWIDTH:
-      fscanf(file, "%d", &iparam1);
+      iparam1 = mfBinGetInt(reader);
       cdCanvasLineWidth(canvas, sMin1(iparam1));
       break;
     case CDMF_LINECAP:
-      fscanf(file, "%d", &iparam1);
-      cdCanvasLineCap(canvas, iparam1);
+      cdCanvasLineCap(canvas, mfBinGetInt(reader));
       break;
     case CDMF_LINEJOIN:
-      fscanf(file, "%d", &iparam1);
-      cdCanvasLineJoin(canvas, iparam1);
+      cdCanvasLineJoin(canvas, mfBinGetInt(reader));
       break;
     case CDMF_LINESTYLEDASHES:
-      fscanf(file, "%d", &iparam1);
-      dashes = (int*)malloc(iparam1*sizeof(int));
-      for (c = 0; c < iparam1; c++)
-        fscanf(file, "%d", &dashes[c]);
-      cdCanvasLineStyleDashes(canvas, dashes, iparam1);
-      free(dashes);
+      iparam1 = mfBinGetInt(reader);
+      if (reader->error || !mfBinCheckCount(reader, iparam1, 4))
+        break;
+      {
+        int* dashes = (int*)malloc(iparam1*sizeof(int) + 1);
+        for (c = 0; c < iparam1; c++)
+          dashes[c] = mfBinGetInt(reader);
+        cdCanvasLineStyleDashes(canvas, dashes, iparam1);
+        free(dashes);
+      }
       break;
     case CDMF_FILLMODE:
-      fscanf(file, "%d", &iparam1);
-      cdCanvasFillMode(canvas, iparam1);
+      cdCanvasFillMode(canvas, mfBinGetInt(reader));
       break;
     case CDMF_INTERIORSTYLE:
-      fscanf(file, "%d", &iparam1);
-      cdCanvasInteriorStyle(canvas, iparam1);
+      cdCanvasInteriorStyle(canvas, mfBinGetInt(reader));
       break;
     case CDMF_HATCH:
-      fscanf(file, "%d", &iparam1);
-      cdCanvasHatch(canvas, iparam1);
+      cdCanvasHatch(canvas, mfBinGetInt(reader));
       break;
     case CDMF_STIPPLE:
-      fscanf(file, "%d %d", &iparam1, &iparam2);
-      t = iparam1 * iparam2;
-      stipple = (unsigned char*)malloc(t);
-      _stipple = stipple;
-      for (c = 0; c < t; c++)
-      {
-        fscanf(file, "%d", &iparam3);
-        *_stipple++ = (unsigned char)iparam3;
-      }
-      cdCanvasStipple(canvas, iparam1, iparam2, stipple);
-      free(stipple);
+      iparam1 = mfBinGetInt(reader); iparam2 = mfBinGetInt(reader);
+      index = mfBinGetData(reader, mfBinPlaneSize(iparam1, iparam2));
+      if (index)
+        cdCanvasStipple(canvas, iparam1, iparam2, index);
       break;
     case CDMF_PATTERN:
-      fscanf(file, "%d %d", &iparam1, &iparam2);
-      t = iparam1 * iparam2;
-      pattern = (long int*)malloc(t * sizeof(long));
-      _pattern = pattern;
-      for (c = 0; c < t; c++)
-      {
-        fscanf(file, "%d %d %d", &iparam3, &iparam4, &iparam5);
-        *_pattern++ = cdEncodeColor((unsigned char)iparam3, (unsigned char)iparam4, (unsigned char)iparam5);
-      }
-      cdCanvasPattern(canvas, iparam1, iparam2, pattern);
-      free(pattern);
-      break;
-    case CDMF_OLDFONT:
-      fscanf(file, "%d %d %d", &iparam1, &iparam2, &iparam3);
-      if (iparam1 < 0 || iparam1 > 3) break;
-      if (iparam3 < 0)
-      {
-        iparam3 = -sScaleH(abs(iparam3));
-        if (iparam3 > -5) iparam3 = -5;
-      }
-      else
+      iparam1 = mfBinGetInt(reader); iparam2 = mfBinGetInt(reader);
+      t = mfBinPlaneSize(iparam1, iparam2);
+      if (reader->error || !mfBinCheckCount(reader, t, 4))
+        break;
       {
-        iparam3 = sScaleH(abs(iparam3));
-        if (iparam3 < 5) iparam3 = 5;
+        long* pattern = (long*)malloc(t*sizeof(long));
+        for (c = 0; c < t; c++)
+          pattern[c] = mfBinGetColor(reader);
+        cdCanvasPattern(canvas, iparam1, iparam2, pattern);
+        free(pattern);
       }
-      cdCanvasFont(canvas, font_family[iparam1], iparam2, iparam3);
       break;
     case CDMF_FONT:
-      fscanf(file, "%d %d %[^\n\r]", &iparam2, &iparam3, TextBuffer);
+      iparam2 = mfBinGetInt(reader); iparam3 = mfBinGetInt(reader);
+      str = mfBinGetString(reader);
       if (iparam3 < 0)
       {
         iparam3 = -sScaleH(abs(iparam3));
@@ -938,176 +1496,758 @@ static int cdplay(cdCanvas* canvas, int xmin, int xmax, int ymin, int ymax, void
         iparam3 = sScaleH(abs(iparam3));
         if (iparam3 < 5) iparam3 = 5;
       }
-      cdCanvasFont(canvas, TextBuffer, iparam2, iparam3);
+      cdCanvasFont(canvas, str, iparam2, iparam3);
       break;
     case CDMF_NATIVEFONT:
-      fscanf(file, "%[^\n\r]", TextBuffer);
-      cdCanvasNativeFont(canvas, TextBuffer);
+      cdCanvasNativeFont(canvas, mfBinGetString(reader));
       break;
     case CDMF_TEXTALIGNMENT:
-      fscanf(file, "%d", &iparam1);
-      cdCanvasTextAlignment(canvas, iparam1);
+      cdCanvasTextAlignment(canvas, mfBinGetInt(reader));
       break;
     case CDMF_TEXTORIENTATION:
-      fscanf(file, "%lg", &dparam1);
-      cdCanvasTextOrientation(canvas, dparam1);
-      break;
-    case CDMF_MARKTYPE:
-      fscanf(file, "%d", &iparam1);
-      cdCanvasMarkType(canvas, iparam1);
-      break;
-    case CDMF_MARKSIZE:
-      fscanf(file, "%d", &iparam1);
-      cdCanvasMarkSize(canvas, sScaleW(iparam1));
+      cdCanvasTextOrientation(canvas, mfBinGetDouble(reader));
       break;
     case CDMF_PALETTE:
-      fscanf(file, "%d %d", &iparam1, &iparam2);
-      _palette = palette = (long int*)malloc(iparam1);
-      for (c = 0; c < iparam1; c++)
+      iparam1 = mfBinGetInt(reader); iparam2 = mfBinGetInt(reader);
+      if (reader->error || !mfBinCheckCount(reader, iparam1, 4))
+        break;
       {
-        fscanf(file, "%d %d %d", &iparam3, &iparam4, &iparam5);
-        *_palette++ = cdEncodeColor((unsigned char)iparam3, (unsigned char)iparam4, (unsigned char)iparam5);
+        long* palette = (long*)malloc(iparam1*sizeof(long) + 1);
+        for (c = 0; c < iparam1; c++)
+          palette[c] = mfBinGetColor(reader);
+        cdCanvasPalette(canvas, iparam1, palette, iparam2);
+        free(palette);
       }
-      cdCanvasPalette(canvas, iparam1, palette, iparam2);
-      free(palette);
       break;
     case CDMF_BACKGROUND:
-      fscanf(file, "%d %d %d", &iparam1, &iparam2, &iparam3);
-      cdCanvasSetBackground(canvas, cdEncodeColor((unsigned char)iparam1, (unsigned char)iparam2, (unsigned char)iparam3));
+      cdCanvasSetBackground(canvas, mfBinGetColor(reader));
       break;
     case CDMF_FOREGROUND:
-      fscanf(file, "%d %d %d", &iparam1, &iparam2, &iparam3);
-      cdCanvasSetForeground(canvas, cdEncodeColor((unsigned char)iparam1, (unsigned char)iparam2, (unsigned char)iparam3));
+      cdCanvasSetForeground(canvas, mfBinGetColor(reader));
       break;
     case CDMF_PUTIMAGERGB:
-      fscanf(file, "%d %d %d %d %d %d", &iparam1, &iparam2, &iparam3, &iparam4, &iparam5, &iparam6);
-      t = iparam1 * iparam2;
-      _red = red = (unsigned char*) malloc(t);
-      _green = green = (unsigned char*) malloc(t);
-      _blue = blue = (unsigned char*) malloc(t);
-      for (c = 0; c < t; c++)
-      {
-        fscanf(file, "%d %d %d", &iparam7, &iparam8, &iparam9);
-        *_red++ = (unsigned char)iparam7;
-        *_green++ = (unsigned char)iparam8;
-        *_blue++ = (unsigned char)iparam9;
-      }
-      cdCanvasPutImageRectRGB(canvas, iparam1, iparam2, red, green, blue, sScaleX(iparam3), sScaleY(iparam4), sScaleW(iparam5), sScaleH(iparam6), 0, 0, 0, 0);
-      free(red);
-      free(green);
-      free(blue);
-      break;
     case CDMF_PUTIMAGERGBA:
-      fscanf(file, "%d %d %d %d %d %d", &iparam1, &iparam2, &iparam3, &iparam4, &iparam5, &iparam6);
-      t = iparam1 * iparam2;
-      _red = red = (unsigned char*) malloc(t);
-      _green = green = (unsigned char*) malloc(t);
-      _blue = blue = (unsigned char*) malloc(t);
-      _alpha = alpha = (unsigned char*) malloc(t);
-      for (c = 0; c < t; c++)
+      iparam1 = mfBinGetInt(reader); iparam2 = mfBinGetInt(reader); iparam3 = mfBinGetInt(reader); 
+      iparam4 = mfBinGetInt(reader); iparam5 = mfBinGetInt(reader); iparam6 = mfBinGetInt(reader);
+      t = mfBinPlaneSize(iparam1, iparam2);
+      red = mfBinGetData(reader, t);
+      green = mfBinGetData(reader, t);
+      blue = mfBinGetData(reader, t);
+      if (func == CDMF_PUTIMAGERGBA)
       {
-        fscanf(file, "%d %d %d %d", &iparam7, &iparam8, &iparam9, &iparam10);
-        *_red++ = (unsigned char)iparam7;
-        *_green++ = (unsigned char)iparam8;
-        *_blue++ = (unsigned char)iparam9;
-        *_alpha++ = (unsigned char)iparam10;
+        alpha = mfBinGetData(reader, t);
+        if (alpha)
+          cdCanvasPutImageRectRGBA(canvas, iparam1, iparam2, red, green, blue, alpha, sScaleX(iparam3), sScaleY(iparam4), sScaleW(iparam5), sScaleH(iparam6), 0, 0, 0, 0);
       }
-      cdCanvasPutImageRectRGBA(canvas, iparam1, iparam2, red, green, blue, alpha, sScaleX(iparam3), sScaleY(iparam4), sScaleW(iparam5), sScaleH(iparam6), 0, 0, 0, 0);
-      free(red);
-      free(green);
-      free(blue);
-      free(alpha);
+      else if (blue)
+        cdCanvasPutImageRectRGB(canvas, iparam1, iparam2, red, green, blue, sScaleX(iparam3), sScaleY(iparam4), sScaleW(iparam5), sScaleH(iparam6), 0, 0, 0, 0);
       break;
     case CDMF_PUTIMAGEMAP:
-      fscanf(file, "%d %d %d %d %d %d", &iparam1, &iparam2, &iparam3, &iparam4, &iparam5, &iparam6);
-      t = iparam1 * iparam2;
-      n = 0;
-      _index = index = (unsigned char*) malloc(t);
-      for (c = 0; c < t; c++)
+      iparam1 = mfBinGetInt(reader); iparam2 = mfBinGetInt(reader); iparam3 = mfBinGetInt(reader); 
+      iparam4 = mfBinGetInt(reader); iparam5 = mfBinGetInt(reader); iparam6 = mfBinGetInt(reader);
+      index = mfBinGetData(reader, mfBinPlaneSize(iparam1, iparam2));
+      n = mfBinGetInt(reader);
+      if (reader->error || n > 256 || !mfBinCheckCount(reader, n, 4))
       {
-        fscanf(file, "%d", &iparam7);
-        *_index++ = (unsigned char)iparam7;
-        if (iparam7 > n)
-          n = iparam7;
+        reader->error = 1;
+        break;
       }
-      _colors = colors = (long int*)malloc(n);
-      for (c = 0; c < n; c++)
       {
-        fscanf(file, "%d %d %d", &iparam7, &iparam8, &iparam9);
-        *_colors++ = cdEncodeColor((unsigned char)iparam7, (unsigned char)iparam8, (unsigned char)iparam9);
+        long colors[256];
+        memset(colors, 0, sizeof(colors));
+        for (c = 0; c < n; c++)
+          colors[c] = mfBinGetColor(reader);
+        cdCanvasPutImageRectMap(canvas, iparam1, iparam2, index, colors, sScaleX(iparam3), sScaleY(iparam4), sScaleW(iparam5), sScaleH(iparam6), 0, 0, 0, 0);
       }
-      cdCanvasPutImageRectMap(canvas, iparam1, iparam2, index, colors, sScaleX(iparam3), sScaleY(iparam4), sScaleW(iparam5), sScaleH(iparam6), 0, 0, 0, 0);
-      free(index);
-      free(colors);
       break;
     case CDMF_PIXEL:
-      fscanf(file, "%d %d %d %d %d", &iparam1, &iparam2, &iparam3, &iparam4, &iparam5);
-      cdCanvasPixel(canvas, sScaleX(iparam1), sScaleY(iparam2), cdEncodeColor((unsigned char)iparam3, (unsigned char)iparam4, (unsigned char)iparam5));
+      iparam1 = mfBinGetInt(reader); iparam2 = mfBinGetInt(reader);
+      cdCanvasPixel(canvas, sScaleX(iparam1), sScaleY(iparam2), mfBinGetColor(reader));
       break;
     case CDMF_SCROLLAREA:
-      fscanf(file, "%d %d %d %d %d %d", &iparam1, &iparam2, &iparam3, &iparam4, &iparam5, &iparam6);
+      iparam1 = mfBinGetInt(reader); iparam2 = mfBinGetInt(reader); iparam3 = mfBinGetInt(reader); 
+      iparam4 = mfBinGetInt(reader); iparam5 = mfBinGetInt(reader); iparam6 = mfBinGetInt(reader);
       cdCanvasScrollArea(canvas, sScaleX(iparam1), sScaleX(iparam2), sScaleY(iparam3), sScaleY(iparam4), sScaleX(iparam5), sScaleY(iparam6));
       break;
-    case CDMF_WVECTORTEXT:
-      fscanf(file, "%lg %lg %[^\n\r]", &dparam1, &dparam2, TextBuffer);
-      wdCanvasVectorText(canvas, dparam1, dparam2, TextBuffer);
-      break;
-    case CDMF_WMULTILINEVECTORTEXT:
-      fscanf(file, "%lg %lg %[^\n\r]", &dparam1, &dparam2, TextBuffer);
-      wdCanvasVectorText(canvas, dparam1, dparam2, TextBuffer);
-      break;
-    case CDMF_VECTORTEXT:
-      fscanf(file, "%d %d %[^\n\r]", &iparam1, &iparam2, TextBuffer);
-      cdCanvasVectorText(canvas, iparam1, iparam2, TextBuffer);
-      break;
-    case CDMF_MULTILINEVECTORTEXT:
-      fscanf(file, "%d %d %[^\n\r]", &iparam1, &iparam2, TextBuffer);
-      cdCanvasVectorText(canvas, iparam1, iparam2, TextBuffer);
-      break;
-    case CDMF_WVECTORCHARSIZE:
-      fscanf(file, "%lg", &dparam1);
-      wdCanvasVectorCharSize(canvas, dparam1);
-      break;
-    case CDMF_WVECTORTEXTSIZE:
-      fscanf(file, "%lg %lg %[^\n\r]", &dparam1, &dparam2, TextBuffer);
-      wdCanvasVectorTextSize(canvas, dparam1, dparam2, TextBuffer);
-      break;
-    case CDMF_WVECTORTEXTDIRECTION:
-      fscanf(file, "%lg %lg %lg %lg", &dparam1, &dparam2, &dparam3, &dparam4);
-      wdCanvasVectorTextDirection(canvas, dparam1, dparam2, dparam3, dparam4);
-      break;
-    case CDMF_VECTORCHARSIZE:
-      fscanf(file, "%d", &iparam1);
-      cdCanvasVectorCharSize(canvas, iparam1);
-      break;
-    case CDMF_VECTORTEXTSIZE:
-      fscanf(file, "%d %d %[^\n\r]", &iparam1, &iparam2, TextBuffer);
-      cdCanvasVectorTextSize(canvas, iparam1, iparam2, TextBuffer);
-      break;
-    case CDMF_VECTORTEXTDIRECTION:
-      fscanf(file, "%d %d %d %d", &iparam1, &iparam2, &iparam3, &iparam4);
-      cdCanvasVectorTextDirection(canvas, iparam1, iparam2, iparam3, iparam4);
-      break;
-    case CDMF_VECTORFONT:
-      fscanf(file, "%[^\n\r]", TextBuffer);
-      cdCanvasVectorFont(canvas, TextBuffer);
-      break;
-    case CDMF_VECTORTEXTTRANSFORM:
-      fscanf(file, "%lg %lg %lg %lg %lg %lg", &matrix[0], &matrix[1], &matrix[2], &matrix[3], &matrix[4], &matrix[5]);
-      cdCanvasVectorTextTransform(canvas, matrix);
-      break;
-    case CDMF_WINDOW:
-      fscanf(file, "%lg %lg %lg %lg", &dparam1, &dparam2, &dparam3, &dparam4);
-      wdCanvasWindow(canvas, dparam1, dparam2, dparam3, dparam4);
-      break;
     default:
-      fclose(file);
-      return CD_ERROR;
+      reader->error = 1;
+      break;
     }
+
+    if (reader->error)
+      return -1;
   }
 
-  fclose(file);
-  return CD_OK;
+  return played;
+}
+
+/* plays one record of the text format, returns 0 if the record is unknown */
+static int mfPlayTextRecord(cdCanvas* canvas, FILE* file, int func, int scale, double factorX, double factorY, int xmin, int ymin)
+{
+  char TextBuffer[512];
+  int iparam1, iparam2, iparam3, iparam4, iparam5, iparam6, iparam7, iparam8, iparam9, iparam10;
+  int c, t, n;
+  double dparam1, dparam2, dparam3, dparam4, dparam5, dparam6;
+  unsigned char* stipple, * _stipple, *red, *green, *blue, *_red, *_green, *_blue, *index, *_index, *_alpha, *alpha;
+  long int *pattern, *palette, *_pattern, *_palette, *colors, *_colors;
+  int* dashes;
+  double matrix[6];
+  const char * font_family[] = 
+  {
+    "System",       /* CD_SYSTEM */
+    "Courier",      /* CD_COURIER */
+    "Times",        /* CD_TIMES_ROMAN */
+    "Helvetica"     /* CD_HELVETICA */
+  };
+
+  switch (func)
+  {
+  case CDMF_FLUSH:
+    cdCanvasFlush(canvas);
+    break;
+  case CDMF_CLEAR:
+    cdCanvasClear(canvas);
+    break;
+  case CDMF_CLIP:
+    fscanf(file, "%d", &iparam1);
+    cdCanvasClip(canvas, iparam1);
+    break;
+  case CDMF_CLIPAREA:
+    fscanf(file, "%d %d %d %d", &iparam1, &iparam2, &iparam3, &iparam4);
+    cdCanvasClipArea(canvas, sScaleX(iparam1), sScaleX(iparam2), sScaleY(iparam3), sScaleY(iparam4));
+    break;
+  case CDMF_FCLIPAREA:
+    fscanf(file, "%lg %lg %lg %lg", &dparam1, &dparam2, &dparam3, &dparam4);
+    cdfCanvasClipArea(canvas, sfScaleX(dparam1), sfScaleX(dparam2), sfScaleY(dparam3), sfScaleY(dparam4));
+    break;
+  case CDMF_MATRIX:
+    fscanf(file, "%lg %lg %lg %lg %lg %lg", &matrix[0], &matrix[1], &matrix[2], &matrix[3], &matrix[4], &matrix[5]);
+    cdCanvasTransform(canvas, matrix);
+    break;
+  case CDMF_RESETMATRIX:
+    cdCanvasTransform(canvas, NULL);
+    break;
+  case CDMF_WCLIPAREA:
+    fscanf(file, "%lg %lg %lg %lg", &dparam1, &dparam2, &dparam3, &dparam4);
+    wdCanvasClipArea(canvas, dparam1, dparam2, dparam3, dparam4);
+    break;
+  case CDMF_LINE:
+    fscanf(file, "%d %d %d %d", &iparam1, &iparam2, &iparam3, &iparam4);
+    cdCanvasLine(canvas, sScaleX(iparam1), sScaleY(iparam2), sScaleX(iparam3), sScaleY(iparam4));
+    break;
+  case CDMF_FLINE:
+    fscanf(file, "%lg %lg %lg %lg", &dparam1, &dparam2, &dparam3, &dparam4);
+    cdfCanvasLine(canvas, sfScaleX(dparam1), sfScaleY(dparam2), sfScaleX(dparam3), sfScaleY(dparam4));
+    break;
+  case CDMF_WLINE:
+    fscanf(file, "%lg %lg %lg %lg", &dparam1, &dparam2, &dparam3, &dparam4);
+    wdCanvasLine(canvas, dparam1, dparam2, dparam3, dparam4);
+    break;
+  case CDMF_RECT:
+    fscanf(file, "%d %d %d %d", &iparam1, &iparam2, &iparam3, &iparam4);
+    cdCanvasRect(canvas, sScaleX(iparam1), sScaleX(iparam2), sScaleY(iparam3), sScaleY(iparam4));
+    break;
+  case CDMF_FRECT:
+    fscanf(file, "%lg %lg %lg %lg", &dparam1, &dparam2, &dparam3, &dparam4);
+    cdfCanvasRect(canvas, sfScaleX(dparam1), sfScaleX(dparam2), sfScaleY(dparam3), sfScaleY(dparam4));
+    break;
+  case CDMF_WRECT:
+    fscanf(file, "%lg %lg %lg %lg", &dparam1, &dparam2, &dparam3, &dparam4);
+    wdCanvasRect(canvas, dparam1, dparam2, dparam3, dparam4);
+    break;
+  case CDMF_BOX:
+    fscanf(file, "%d %d %d %d", &iparam1, &iparam2, &iparam3, &iparam4);
+    cdCanvasBox(canvas, sScaleX(iparam1), sScaleX(iparam2), sScaleY(iparam3), sScaleY(iparam4));
+    break;
+  case CDMF_WBOX:
+    fscanf(file, "%lg %lg %lg %lg", &dparam1, &dparam2, &dparam3, &dparam4);
+    wdCanvasBox(canvas, dparam1, dparam2, dparam3, dparam4);
+    break;
+  case CDMF_FBOX:
+    fscanf(file, "%lg %lg %lg %lg", &dparam1, &dparam2, &dparam3, &dparam4);
+    cdfCanvasBox(canvas, sfScaleX(dparam1), sfScaleX(dparam2), sfScaleY(dparam3), sfScaleY(dparam4));
+    break;
+  case CDMF_ARC:
+    fscanf(file, "%d %d %d %d %lg %lg", &iparam1, &iparam2, &iparam3, &iparam4, &dparam1, &dparam2);
+    cdCanvasArc(canvas, sScaleX(iparam1), sScaleY(iparam2), sScaleW(iparam3), sScaleH(iparam4), dparam1, dparam2);
+    break;
+  case CDMF_FARC:
+    fscanf(file, "%lg %lg %lg %lg %lg %lg", &dparam1, &dparam2, &dparam3, &dparam4, &dparam5, &dparam6);
+    cdfCanvasArc(canvas, sfScaleX(dparam1), sfScaleY(dparam2), sfScaleW(dparam3), sfScaleH(dparam4), dparam5, dparam6);
+    break;
+  case CDMF_WARC:
+    fscanf(file, "%lg %lg %lg %lg %lg %lg", &dparam1, &dparam2, &dparam3, &dparam4, &dparam5, &dparam6);
+    wdCanvasArc(canvas, dparam1, dparam2, dparam3, dparam4, dparam5, dparam6);
+    break;
+  case CDMF_SECTOR:
+    fscanf(file, "%d %d %d %d %lg %lg", &iparam1, &iparam2, &iparam3, &iparam4, &dparam1, &dparam2);
+    cdCanvasSector(canvas, sScaleX(iparam1), sScaleY(iparam2), sScaleW(iparam3), sScaleH(iparam4), dparam1, dparam2);
+    break;
+  case CDMF_FSECTOR:
+    fscanf(file, "%lg %lg %lg %lg %lg %lg", &dparam1, &dparam2, &dparam3, &dparam4, &dparam5, &dparam6);
+    cdfCanvasSector(canvas, sfScaleX(dparam1), sfScaleY(dparam2), sfScaleW(dparam3), sfScaleH(dparam4), dparam5, dparam6);
+    break;
+  case CDMF_WSECTOR:
+    fscanf(file, "%lg %lg %lg %lg %lg %lg", &dparam1, &dparam2, &dparam3, &dparam4, &dparam5, &dparam6);
+    wdCanvasSector(canvas, dparam1, dparam2, dparam3, dparam4, dparam5, dparam6);
+    break;
+  case CDMF_CHORD:
+    fscanf(file, "%d %d %d %d %lg %lg", &iparam1, &iparam2, &iparam3, &iparam4, &dparam1, &dparam2);
+    cdCanvasChord(canvas, sScaleX(iparam1), sScaleY(iparam2), sScaleW(iparam3), sScaleH(iparam4), dparam1, dparam2);
+    break;
+  case CDMF_FCHORD:
+    fscanf(file, "%lg %lg %lg %lg %lg %lg", &dparam1, &dparam2, &dparam3, &dparam4, &dparam5, &dparam6);
+    cdfCanvasChord(canvas, sfScaleX(dparam1), sfScaleY(dparam2), sfScaleW(dparam3), sfScaleH(dparam4), dparam5, dparam6);
+    break;
+  case CDMF_WCHORD:
+    fscanf(file, "%lg %lg %lg %lg %lg %lg", &dparam1, &dparam2, &dparam3, &dparam4, &dparam5, &dparam6);
+    wdCanvasChord(canvas, dparam1, dparam2, dparam3, dparam4, dparam5, dparam6);
+    break;
+  case CDMF_TEXT:
+    fscanf(file, "%d %d %[^\n\r]", &iparam1, &iparam2, TextBuffer);
+    cdCanvasText(canvas, sScaleX(iparam1), sScaleY(iparam2), TextBuffer);
+    break;
+  case CDMF_FTEXT:
+    fscanf(file, "%lg %lg %[^\n\r]", &dparam1, &dparam2, TextBuffer);
+    cdfCanvasText(canvas, sfScaleX(dparam1), sfScaleY(dparam2), TextBuffer);
+    break;
+  case CDMF_WTEXT:
+    fscanf(file, "%lg %lg %[^\n\r]", &dparam1, &dparam2, TextBuffer);
+    wdCanvasText(canvas, dparam1, dparam2, TextBuffer);
+    break;
+  case CDMF_BEGIN:
+    fscanf(file, "%d", &iparam1);
+    cdCanvasBegin(canvas, iparam1);
+    break;
+  case CDMF_VERTEX:
+    fscanf(file, "%d %d", &iparam1, &iparam2);
+    cdCanvasVertex(canvas, sScaleX(iparam1), sScaleY(iparam2));
+    break;
+  case CDMF_FVERTEX:
+    fscanf(file, "%lg %lg", &dparam1, &dparam2);
+    cdfCanvasVertex(canvas, sfScaleX(dparam1), sfScaleY(dparam2));
+    break;
+  case CDMF_WVERTEX:
+    fscanf(file, "%lg %lg", &dparam1, &dparam2);
+    wdCanvasVertex(canvas, dparam1, dparam2);
+    break;
+  case CDMF_END:
+    cdCanvasEnd(canvas);
+    break;
+  case CDMF_MARK:
+    fscanf(file, "%d %d", &iparam1, &iparam2);
+    cdCanvasMark(canvas, sScaleX(iparam1), sScaleY(iparam2));
+    break;
+  case CDMF_WMARK:
+    fscanf(file, "%lg %lg", &dparam1, &dparam2);
+    wdCanvasMark(canvas, dparam1, dparam2);
+    break;
+  case CDMF_BACKOPACITY:
+    fscanf(file, "%d", &iparam1);
+    cdCanvasBackOpacity(canvas, iparam1);
+    break;
+  case CDMF_WRITEMODE:
+    fscanf(file, "%d", &iparam1);
+    cdCanvasWriteMode(canvas, iparam1);
+    break;
+  case CDMF_LINESTYLE:
+    fscanf(file, "%d", &iparam1);
+    cdCanvasLineStyle(canvas, iparam1);
+    break;
+  case CDMF_LINEWIDTH:
+    fscanf(file, "%d", &iparam1);
+    cdCanvasLineWidth(canvas, sMin1(iparam1));
+    break;
+  case CDMF_LINECAP:
+    fscanf(file, "%d", &iparam1);
+    cdCanvasLineCap(canvas, iparam1);
+    break;
+  case CDMF_LINEJOIN:
+    fscanf(file, "%d", &iparam1);
+    cdCanvasLineJoin(canvas, iparam1);
+    break;
+  case CDMF_LINESTYLEDASHES:
+    fscanf(file, "%d", &iparam1);
+    dashes = (int*)malloc(iparam1*sizeof(int));
+    for (c = 0; c < iparam1; c++)
+      fscanf(file, "%d", &dashes[c]);
+    cdCanvasLineStyleDashes(canvas, dashes, iparam1);
+    free(dashes);
+    break;
+  case CDMF_FILLMODE:
+    fscanf(file, "%d", &iparam1);
+    cdCanvasFillMode(canvas, iparam1);
+    break;
+  case CDMF_INTERIORSTYLE:
+    fscanf(file, "%d", &iparam1);
+    cdCanvasInteriorStyle(canvas, iparam1);
+    break;
+  case CDMF_HATCH:
+    fscanf(file, "%d", &iparam1);
+    cdCanvasHatch(canvas, iparam1);
+    break;
+  case CDMF_STIPPLE:
+    fscanf(file, "%d %d", &iparam1, &iparam2);
+    t = iparam1 * iparam2;
+    stipple = (unsigned char*)malloc(t);
+    _stipple = stipple;
+    for (c = 0; c < t; c++)
+    {
+      fscanf(file, "%d", &iparam3);
+      *_stipple++ = (unsigned char)iparam3;
+    }
+    cdCanvasStipple(canvas, iparam1, iparam2, stipple);
+    free(stipple);
+    break;
+  case CDMF_PATTERN:
+    fscanf(file, "%d %d", &iparam1, &iparam2);
+    t = iparam1 * iparam2;
+    pattern = (long int*)malloc(t * sizeof(long));
+    _pattern = pattern;
+    for (c = 0; c < t; c++)
+    {
+      fscanf(file, "%d %d %d", &iparam3, &iparam4, &iparam5);
+      *_pattern++ = cdEncodeColor((unsigned char)iparam3, (unsigned char)iparam4, (unsigned char)iparam5);
+    }
+    cdCanvasPattern(canvas, iparam1, iparam2, pattern);
+    free(pattern);
+    break;
+  case CDMF_OLDFONT:
+    fscanf(file, "%d %d %d", &iparam1, &iparam2, &iparam3);
+    if (iparam1 < 0 || iparam1 > 3) break;
+    if (iparam3 < 0)
+    {
+      iparam3 = -sScaleH(abs(iparam3));
+      if (iparam3 > -5) iparam3 = -5;
+    }
+    else
+    {
+      iparam3 = sScaleH(abs(iparam3));
+      if (iparam3 < 5) iparam3 = 5;
+    }
+    cdCanvasFont(canvas, font_family[iparam1], iparam2, iparam3);
+    break;
+  case CDMF_FONT:
+    fscanf(file, "%d %d %[^\n\r]", &iparam2, &iparam3, TextBuffer);
+    if (iparam3 < 0)
+    {
+      iparam3 = -sScaleH(abs(iparam3));
+      if (iparam3 > -5) iparam3 = -5;
+    }
+    else
+    {
+      iparam3 = sScaleH(abs(iparam3));
+      if (iparam3 < 5) iparam3 = 5;
+    }
+    cdCanvasFont(canvas, TextBuffer, iparam2, iparam3);
+    break;
+  case CDMF_NATIVEFONT:
+    fscanf(file, "%[^\n\r]", TextBuffer);
+    cdCanvasNativeFont(canvas, TextBuffer);
+    break;
+  case CDMF_TEXTALIGNMENT:
+    fscanf(file, "%d", &iparam1);
+    cdCanvasTextAlignment(canvas, iparam1);
+    break;
+  case CDMF_TEXTORIENTATION:
+    fscanf(file, "%lg", &dparam1);
+    cdCanvasTextOrientation(canvas, dparam1);
+    break;
+  case CDMF_MARKTYPE:
+    fscanf(file, "%d", &iparam1);
+    cdCanvasMarkType(canvas, iparam1);
+    break;
+  case CDMF_MARKSIZE:
+    fscanf(file, "%d", &iparam1);
+    cdCanvasMarkSize(canvas, sScaleW(iparam1));
+    break;
+  case CDMF_PALETTE:
+    fscanf(file, "%d %d", &iparam1, &iparam2);
+    _palette = palette = (long int*)malloc(iparam1);
+    for (c = 0; c < iparam1; c++)
+    {
+      fscanf(file, "%d %d %d", &iparam3, &iparam4, &iparam5);
+      *_palette++ = cdEncodeColor((unsigned char)iparam3, (unsigned char)iparam4, (unsigned char)iparam5);
+    }
+    cdCanvasPalette(canvas, iparam1, palette, iparam2);
+    free(palette);
+    break;
+  case CDMF_BACKGROUND:
+    fscanf(file, "%d %d %d", &iparam1, &iparam2, &iparam3);
+    cdCanvasSetBackground(canvas, cdEncodeColor((unsigned char)iparam1, (unsigned char)iparam2, (unsigned char)iparam3));
+    break;
+  case CDMF_FOREGROUND:
+    fscanf(file, "%d %d %d", &iparam1, &iparam2, &iparam3);
+    cdCanvasSetForeground(canvas, cdEncodeColor((unsigned char)iparam1, (unsigned char)iparam2, (unsigned char)iparam3));
+    break;
+  case CDMF_PUTIMAGERGB:
+    fscanf(file, "%d %d %d %d %d %d", &iparam1, &iparam2, &iparam3, &iparam4, &iparam5, &iparam6);
+    t = iparam1 * iparam2;
+    _red = red = (unsigned char*) malloc(t);
+    _green = green = (unsigned char*) malloc(t);
+    _blue = blue = (unsigned char*) malloc(t);
+    for (c = 0; c < t; c++)
+    {
+      fscanf(file, "%d %d %d", &iparam7, &iparam8, &iparam9);
+      *_red++ = (unsigned char)iparam7;
+      *_green++ = (unsigned char)iparam8;
+      *_blue++ = (unsigned char)iparam9;
+    }
+    cdCanvasPutImageRectRGB(canvas, iparam1, iparam2, red, green, blue, sScaleX(iparam3), sScaleY(iparam4), sScaleW(iparam5), sScaleH(iparam6), 0, 0, 0, 0);
+    free(red);
+    free(green);
+    free(blue);
+    break;
+  case CDMF_PUTIMAGERGBA:
+    fscanf(file, "%d %d %d %d %d %d", &iparam1, &iparam2, &iparam3, &iparam4, &iparam5, &iparam6);
+    t = iparam1 * iparam2;
+    _red = red = (unsigned char*) malloc(t);
+    _green = green = (unsigned char*) malloc(t);
+    _blue = blue = (unsigned char*) malloc(t);
+    _alpha = alpha = (unsigned char*) malloc(t);
+    for (c = 0; c < t; c++)
+    {
+      fscanf(file, "%d %d %d %d", &iparam7, &iparam8, &iparam9, &iparam10);
+      *_red++ = (unsigned char)iparam7;
+      *_green++ = (unsigned char)iparam8;
+      *_blue++ = (unsigned char)iparam9;
+      *_alpha++ = (unsigned char)iparam10;
+    }
+    cdCanvasPutImageRectRGBA(canvas, iparam1, iparam2, red, green, blue, alpha, sScaleX(iparam3), sScaleY(iparam4), sScaleW(iparam5), sScaleH(iparam6), 0, 0, 0, 0);
+    free(red);
+    free(green);
+    free(blue);
+    free(alpha);
+    break;
+  case CDMF_PUTIMAGEMAP:
+    fscanf(file, "%d %d %d %d %d %d", &iparam1, &iparam2, &iparam3, &iparam4, &iparam5, &iparam6);
+    t = iparam1 * iparam2;
+    n = 0;
+    _index = index = (unsigned char*) malloc(t);
+    for (c = 0; c < t; c++)
+    {
+      fscanf(file, "%d", &iparam7);
+      *_index++ = (unsigned char)iparam7;
+      if (iparam7 > n)
+        n = iparam7;
+    }
+    _colors = colors = (long int*)malloc(n);
+    for (c = 0; c < n; c++)
+    {
+      fscanf(file, "%d %d %d", &iparam7, &iparam8, &iparam9);
+      *_colors++ = cdEncodeColor((unsigned char)iparam7, (unsigned char)iparam8, (unsigned char)iparam9);
+    }
+    cdCanvasPutImageRectMap(canvas, iparam1, iparam2, index, colors, sScaleX(iparam3), sScaleY(iparam4), sScaleW(iparam5), sScaleH(iparam6), 0, 0, 0, 0);
+    free(index);
+    free(colors);
+    break;
+  case CDMF_PIXEL:
+    fscanf(file, "%d %d %d %d %d", &iparam1, &iparam2, &iparam3, &iparam4, &iparam5);
+    cdCanvasPixel(canvas, sScaleX(iparam1), sScaleY(iparam2), cdEncodeColor((unsigned char)iparam3, (unsigned char)iparam4, (unsigned char)iparam5));
+    break;
+  case CDMF_SCROLLAREA:
+    fscanf(file, "%d %d %d %d %d %d", &iparam1, &iparam2, &iparam3, &iparam4, &iparam5, &iparam6);
+    cdCanvasScrollArea(canvas, sScaleX(iparam1), sScaleX(iparam2), sScaleY(iparam3), sScaleY(iparam4), sScaleX(iparam5), sScaleY(iparam6));
+    break;
+  case CDMF_WVECTORTEXT:
+    fscanf(file, "%lg %lg %[^\n\r]", &dparam1, &dparam2, TextBuffer);
+    wdCanvasVectorText(canvas, dparam1, dparam2, TextBuffer);
+    break;
+  case CDMF_WMULTILINEVECTORTEXT:
+    fscanf(file, "%lg %lg %[^\n\r]", &dparam1, &dparam2, TextBuffer);
+    wdCanvasVectorText(canvas, dparam1, dparam2, TextBuffer);
+    break;
+  case CDMF_VECTORTEXT:
+    fscanf(file, "%d %d %[^\n\r]", &iparam1, &iparam2, TextBuffer);
+    cdCanvasVectorText(canvas, iparam1, iparam2, TextBuffer);
+    break;
+  case CDMF_MULTILINEVECTORTEXT:
+    fscanf(file, "%d %d %[^\n\r]", &iparam1, &iparam2, TextBuffer);
+    cdCanvasVectorText(canvas, iparam1, iparam2, TextBuffer);
+    break;
+  case CDMF_WVECTORCHARSIZE:
+    fscanf(file, "%lg", &dparam1);
+    wdCanvasVectorCharSize(canvas, dparam1);
+    break;
+  case CDMF_WVECTORTEXTSIZE:
+    fscanf(file, "%lg %lg %[^\n\r]", &dparam1, &dparam2, TextBuffer);
+    wdCanvasVectorTextSize(canvas, dparam1, dparam2, TextBuffer);
+    break;
+  case CDMF_WVECTORTEXTDIRECTION:
+    fscanf(file, "%lg %lg %lg %lg", &dparam1, &dparam2, &dparam3, &dparam4);
+    wdCanvasVectorTextDirection(canvas, dparam1, dparam2, dparam3, dparam4);
+    break;
+  case CDMF_VECTORCHARSIZE:
+    fscanf(file, "%d", &iparam1);
+    cdCanvasVectorCharSize(canvas, iparam1);
+    break;
+  case CDMF_VECTORTEXTSIZE:
+    fscanf(file, "%d %d %[^\n\r]", &iparam1, &iparam2, TextBuffer);
+    cdCanvasVectorTextSize(canvas, iparam1, iparam2, TextBuffer);
+    break;
+  case CDMF_VECTORTEXTDIRECTION:
+    fscanf(file, "%d %d %d %d", &iparam1, &iparam2, &iparam3, &iparam4);
+    cdCanvasVectorTextDirection(canvas, iparam1, iparam2, iparam3, iparam4);
+    break;
+  case CDMF_VECTORFONT:
+    fscanf(file, "%[^\n\r]", TextBuffer);
+    cdCanvasVectorFont(canvas, TextBuffer);
+    break;
+  case CDMF_VECTORTEXTTRANSFORM:
+    fscanf(file, "%lg %lg %lg %lg %lg %lg", &matrix[0], &matrix[1], &matrix[2], &matrix[3], &matrix[4], &matrix[5]);
+    cdCanvasVectorTextTransform(canvas, matrix);
+    break;
+  case CDMF_WINDOW:
+    fscanf(file, "%lg %lg %lg %lg", &dparam1, &dparam2, &dparam3, &dparam4);
+    wdCanvasWindow(canvas, dparam1, dparam2, dparam3, dparam4);
+    break;
+  default:
+    return 0;
+  }
+
+  return 1;
+}
+
+typedef struct _tMFPlayer
+{
+  cdCanvas* canvas;
+  int scale, xmin, ymin;
+  double factorX, factorY;
+
+  /* text format */
+  FILE* file;
+  long file_size;
+  int func;
+
+  /* binary format */
+  unsigned char* map_data;
+  size_t map_size;
+  void* map_handle;
+  tMFBinReader reader;
+  int zlib;
+  const unsigned char *zdata, *zend;  /* compressed blocks not played yet */
+  const unsigned char *zblock;        /* compressed block being played */
+  unsigned char* buffer;
+  unsigned long buffer_size;
+} tMFPlayer;
+
+static void cdplayend(void* data)
+{
+  tMFPlayer* player = (tMFPlayer*)data;
+  if (player->file) fclose(player->file);
+  if (player->map_data) mfUnmapFile(player->map_data, player->map_size, player->map_handle);
+  if (player->buffer) free(player->buffer);
+  if (player->reader.str) free(player->reader.str);
+  free(player);
+}
+
+static void* cdplaybegin(cdCanvas* canvas, int xmin, int xmax, int ymin, int ymax, void *data)
+{
+  char* filename = (char*)data;
+  tMFPlayer* player = (tMFPlayer*)calloc(1, sizeof(tMFPlayer));
+  int w = 0, h = 0;
+
+  player->canvas = canvas;
+  player->xmin = xmin;
+  player->ymin = ymin;
+  player->factorX = 1;
+  player->factorY = 1;
+  player->func = -1;
+
+  player->map_data = mfMapFile(filename, &player->map_size, &player->map_handle);
+  if (player->map_data && player->map_size >= CDMFB_HEADER_SIZE && memcmp(player->map_data, "CDMFB", 5) == 0)
+  {
+    int flags;
+    tMFBinReader* reader = &player->reader;
+
+    reader->data = player->map_data + 5;
+    reader->end = player->map_data + player->map_size;
+
+    flags = *mfBinGetData(reader, 1);
+    w = mfBinGetInt(reader);
+    h = mfBinGetInt(reader);
+
+    if (flags & CDMFB_ZLIB)
+    {
+      /* blocks are uncompressed one at a time during play */
+      player->zlib = 1;
+      player->zdata = reader->data;
+      player->zend = reader->end;
+      reader->data = reader->end = NULL;
+    }
+  }
+  else
+  {
+    char TextBuffer[512];
+
+    if (player->map_data)
+    {
+      mfUnmapFile(player->map_data, player->map_size, player->map_handle);
+      player->map_data = NULL;
+    }
+
+    player->file = fopen(filename, "r");
+    if (!player->file)
+    {
+      cdplayend(player);
+      return NULL;
+    }
+
+    fseek(player->file, 0, SEEK_END);
+    player->file_size = ftell(player->file);
+    fseek(player->file, 0, SEEK_SET);
+
+    TextBuffer[0] = 0;
+    fscanf(player->file, "%s %d %d", TextBuffer, &w, &h);
+
+    if (strcmp(TextBuffer, "CDMF") != 0)
+    {
+      cdplayend(player);
+      return NULL;
+    }
+  }
+
+  if (w>1 && 
+      h>1 && 
+      (xmax-xmin+1)>1 && 
+      (ymax-ymin+1)>1)
+  {
+    player->scale = 1;
+    player->factorX = ((double)(xmax-xmin+1)) / ((double)w);
+    player->factorY = ((double)(ymax-ymin+1)) / ((double)h);
+  }
+
+  if (cdsizecb)
+  {
+    int err;
+    err = cdsizecb(canvas, w, h, w, h);
+    if (err)
+    {
+      cdplayend(player);
+      return NULL;
+    }
+  }
+
+  return player;
+}
+
+static int mfBinInflateBlock(tMFPlayer* player)
+{
+  tMFBinReader block;
+  unsigned long raw_size, zsize;
+
+  player->zblock = player->zdata;
+  block.data = player->zdata;
+  block.end = player->zend;
+  block.error = 0;
+  raw_size = (unsigned long)(unsigned int)mfBinGetInt(&block);
+  zsize = (unsigned long)(unsigned int)mfBinGetInt(&block);
+  if (block.error || zsize > (unsigned long)(player->zend - block.data))
+    return 0;
+
+  if (raw_size > player->buffer_size)
+  {
+    player->buffer_size = raw_size;
+    player->buffer = (unsigned char*)realloc(player->buffer, player->buffer_size);
+  }
+
+  if (uncompress(player->buffer, &raw_size, block.data, zsize) != Z_OK)
+    return 0;
+  player->zdata = block.data + zsize;
+
+  player->reader.data = player->buffer;
+  player->reader.end = player->buffer + raw_size;
+  return 1;
+}
+
+static int cdplaystep(void* data, int count)
+{
+  tMFPlayer* player = (tMFPlayer*)data;
+
+  if (player->file)
+  {
+    while (count > 0)
+    {
+      fscanf(player->file, "%d", &player->func);
+      if (feof(player->file))
+        return CD_OK;
+
+      if (!mfPlayTextRecord(player->canvas, player->file, player->func, player->scale, player->factorX, player->factorY, player->xmin, player->ymin))
+        return CD_ERROR;
+
+      count--;
+    }
+  }
+  else
+  {
+    while (count > 0)
+    {
+      int n;
+
+      if (player->reader.data >= player->reader.end)
+      {
+        if (!player->zlib || player->zdata >= player->zend)
+          return CD_OK;
+
+        if (!mfBinInflateBlock(player))
+          return CD_ERROR;
+
+        continue;
+      }
+
+      n = mfBinPlayRecords(player->canvas, &player->reader, count, player->scale, player->factorX, player->factorY, player->xmin, player->ymin);
+      if (n < 0)
+        return CD_ERROR;
+
+      count -= n;
+    }
+  }
+
+  return CD_PLAYING;
+}
+
+static double cdplayprogress(void* data)
+{
+  tMFPlayer* player = (tMFPlayer*)data;
+  double pos, size;
+
+  if (player->file)
+  {
+    pos = (double)ftell(player->file);
+    size = (double)player->file_size;
+  }
+  else if (player->zlib)
+  {
+    pos = (double)(player->zdata - player->map_data);
+    if (player->zblock && player->reader.end > player->buffer)  /* inside the current block */
+      pos -= (double)(player->zdata - player->zblock) * (player->reader.end - player->reader.data) / (player->reader.end - player->buffer);
+    size = (double)player->map_size;
+  }
+  else
+  {
+    pos = (double)(player->reader.data - player->map_data);
+    size = (double)player->map_size;
+  }
+
+  if (size <= 0)
+    return 100;
+  return (pos * 100.) / size;
+}
+
+static int cdplay(cdCanvas* canvas, int xmin, int xmax, int ymin, int ymax, void *data)
+{
+  int ret;
+  void* player = cdplaybegin(canvas, xmin, xmax, ymin, ymax, data);
+  if (!player)
+    return CD_ERROR;
+
+  do
+  {
+    ret = cdplaystep(player, INT_MAX);
+  } while (ret == CD_PLAYING);
+
+  cdplayend(player);
+  return ret;
 }
 
 /*******************/
@@ -1131,8 +2271,16 @@ void cdcreatecanvasMF(cdCanvas *canvas, void *data)
   ctxcanvas = (cdCtxCanvas *)malloc(sizeof(cdCtxCanvas));
   memset(ctxcanvas, 0, sizeof(cdCtxCanvas));
 
-  ctxcanvas->file = fopen(filename, "w");
-  if (!ctxcanvas->file)
+  if (strstr(strdata, "-z")!=NULL)
+  {
+    ctxcanvas->binary = 1;
+    ctxcanvas->compress = 1;
+  }
+  else if (strstr(strdata, "-b")!=NULL)
+    ctxcanvas->binary = 1;
+
+  ctxcanvas->stream = cdStreamOpenOutput(filename, ctxcanvas->binary);
+  if (!ctxcanvas->stream)
   {
     free(ctxcanvas);
     return;
@@ -1162,7 +2310,17 @@ void cdcreatecanvasMF(cdCanvas *canvas, void *data)
   ctxcanvas->last_fill_mode = -1;
 
   /* header */
-  fprintf(ctxcanvas->file, "CDMF %d %d\n", canvas->w, canvas->h);
+  if (ctxcanvas->binary)
+  {
+    unsigned char header[CDMFB_HEADER_SIZE];
+    memcpy(header, "CDMFB", 5);
+    header[5] = (unsigned char)(ctxcanvas->compress? CDMFB_ZLIB: 0);
+    mfBinPutInt(header+6, canvas->w);
+    mfBinPutInt(header+10, canvas->h);
+    cdStreamWrite(ctxcanvas->stream, header, CDMFB_HEADER_SIZE);
+  }
+  else
+    cdStreamPrintf(ctxcanvas->stream, "CDMF %d %d\n", canvas->w, canvas->h);
 }
 
 void cdinittableMF(cdCanvas* canvas)
@@ -1224,6 +2382,10 @@ static cdContext cdMetafileContext =
   cdinittableMF,
   cdplay,
   cdregistercallback,
+  cdplaybegin,
+  cdplaystep,
+  cdplayprogress,
+  cdplayend
 };
 
 cdContext* cdContextMetafile(void)
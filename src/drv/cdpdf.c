@@ -29,6 +29,7 @@ struct _cdCtxCanvas
   cdCanvas* canvas;
 
   PDF *pdf;              /* Arquivo PDF */
+  cdStream* stream;      /* memory output, PDFlib creates the document in memory */
   int res;               /* Resolucao - DPI */
   int pages;             /* Numero total de paginas */
   double width_pt;       /* Largura do papel (points) */ 
@@ -130,6 +131,16 @@ static void cdkillcanvas(cdCtxCanvas *ctxcanvas)
   PDF_restore(ctxcanvas->pdf);  /* restore to match the save of the initial configuration. */
   PDF_end_page_ext(ctxcanvas->pdf, "");
   PDF_end_document(ctxcanvas->pdf, "");
+
+  if (ctxcanvas->stream)
+  {
+    long size;
+    const char* buffer = PDF_get_buffer(ctxcanvas->pdf, &size);
+    if (buffer)
+      cdStreamWrite(ctxcanvas->stream, buffer, (int)size);
+    cdStreamClose(ctxcanvas->stream);
+  }
+
   PDF_delete(ctxcanvas->pdf);
 
   memset(ctxcanvas, 0, sizeof(cdCtxCanvas));
@@ -1603,8 +1614,22 @@ static void cdcreatecanvas(cdCanvas* canvas, void *data)
     return;
   }
 
+  if (filename[0] == '-' && filename[1] == 'm')
+  {
+    ctxcanvas->stream = cdStreamOpenOutput(filename, 1);
+    if (!ctxcanvas->stream)
+    {
+      PDF_delete(ctxcanvas->pdf);
+      free(ctxcanvas);
+      return;
+    }
+
+    filename[0] = 0;  /* empty name creates the document in memory */
+  }
+
   if (PDF_begin_document(ctxcanvas->pdf, filename, 0, "") == -1)
   {
+    if (ctxcanvas->stream) cdStreamClose(ctxcanvas->stream);
     PDF_delete(ctxcanvas->pdf);
     free(ctxcanvas);
     return;
@@ -9,6 +9,7 @@
 #include <string.h> 
 #include <limits.h> 
 #include <math.h> 
+#include <stddef.h> 
 
 #include "cd.h"
 #include "cd_private.h"
@@ -54,6 +55,8 @@ typedef struct _tFillAttrib
   long* pattern;
   int stipple_w, stipple_h;
   unsigned char* stipple;
+  unsigned int hash;
+  int next;
 } tFillAttrib;
 
 typedef struct _tLineAttrib
@@ -64,6 +67,8 @@ typedef struct _tLineAttrib
   int line_cap, line_join;
   int* line_dashes;
   int line_dashes_count;
+  unsigned int hash;
+  int next;
 } tLineAttrib;
 
 typedef struct _tTextAttrib
@@ -74,6 +79,8 @@ typedef struct _tTextAttrib
   int text_alignment;
   double text_orientation;
   char* native_font;
+  unsigned int hash;
+  int next;
 } tTextAttrib;
 
 typedef struct _tLBR
@@ -169,7 +176,10 @@ typedef struct _tImageRGBA
 typedef struct _tPrimNode 
 {
   tPrim type;
-  void* param_buffer; /* dinamically allocated memory for the parameter */
+  int attrib;       /* index in the line, fill or text attributes table */
+  struct _tPrimNode *next;
+  int xmin, xmax,   /* primitive bounds, without the line width */
+      ymin, ymax;
   union {
     tLBR lineboxrect;
     tfLBR lineboxrectf;
@@ -184,16 +194,42 @@ typedef struct _tPrimNode
     tPixel pixel;
     tImageMap imagemap;
     tImageRGBA imagergba;
-  } param;
-  void* attrib_buffer; /* dinamically allocated memory for the attributes */
-  union {
-    tLineAttrib line;
-    tFillAttrib fill;
-    tTextAttrib text;
-  } attrib;
-  struct _tPrimNode *next;
+  } param;   /* must be the last member, records are allocated only up to the size of the used parameter */
 } tPrimNode;
 
+/* Primitives and their variable length data (points, strings, images, dashes, patterns) 
+   are stored in draw order in fixed size chunks, using a bump allocator.
+   Allocations larger than a fraction of the chunk are stored in separate blocks. 
+   Chunks are kept when the picture is cleared, so they can be reused. */
+typedef struct _tPicChunk
+{
+  struct _tPicChunk *next;
+  size_t size, used;
+} tPicChunk;
+
+#define PIC_ALIGN(_s) (((_s) + 7) & ~((size_t)7))
+#define PIC_CHUNK_HEADER PIC_ALIGN(sizeof(tPicChunk))
+#define PIC_CHUNK_DATA(_chunk) ((unsigned char*)(_chunk) + PIC_CHUNK_HEADER)
+#define PIC_CHUNK_SIZE (64*1024)
+#define PIC_PRIM_SIZE(_param) (offsetof(tPrimNode, param) + sizeof(_param))
+
+/* Consecutive primitives are grouped in blocks with the union of their bounds,
+   so playback can skip a whole block outside the visible area keeping the draw order. 
+   Primitives that can not be bounded in picture coordinates (text) are never skipped. */
+typedef struct _tPicBlock
+{
+  tPrimNode *first;
+  int n, unbounded;
+  int xmin, xmax,
+      ymin, ymax;
+} tPicBlock;
+
+#define PIC_BLOCK_SIZE 256
+
+/* Attribute sets are shared by all the primitives that use them. 
+   Each table is searched using a hash of the attribute values, chained by index. */
+#define PIC_ATTRIB_HASH 256
+
 struct _cdCtxCanvas 
 {
   cdCanvas* canvas;
@@ -203,11 +239,119 @@ struct _cdCtxCanvas
             *prim_last;
   int prim_n;
 
+  /* memory arena */
+  tPicChunk *chunk_first,
+            *chunk_current,
+            *large_first;
+
+  /* spatial index */
+  tPicBlock *blocks;
+  int block_n, block_max;
+  int max_ew;          /* largest line width used */
+
+  /* attribute tables */
+  tLineAttrib *line_attribs;
+  int line_attrib_n, line_attrib_max;
+  int line_hash[PIC_ATTRIB_HASH];
+  tFillAttrib *fill_attribs;
+  int fill_attrib_n, fill_attrib_max;
+  int fill_hash[PIC_ATTRIB_HASH];
+  tTextAttrib *text_attribs;
+  int text_attrib_n, text_attrib_max;
+  int text_hash[PIC_ATTRIB_HASH];
+
   /* bounding box */
   int xmin, xmax,
       ymin, ymax;
 };
 
+static tPicChunk* picChunkCreate(size_t size)
+{
+  tPicChunk* chunk = (tPicChunk*)malloc(PIC_CHUNK_HEADER + size);
+  chunk->next = NULL;
+  chunk->size = size;
+  chunk->used = 0;
+  return chunk;
+}
+
+static void picChunkFreeList(tPicChunk* chunk)
+{
+  while (chunk)
+  {
+    tPicChunk* next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+}
+
+static void* picAlloc(cdCtxCanvas *ctxcanvas, size_t size)
+{
+  tPicChunk* chunk;
+  void* ptr;
+
+  size = PIC_ALIGN(size);
+
+  if (size > PIC_CHUNK_SIZE/4)
+  {
+    chunk = picChunkCreate(size);
+    chunk->used = size;
+    chunk->next = ctxcanvas->large_first;
+    ctxcanvas->large_first = chunk;
+    return PIC_CHUNK_DATA(chunk);
+  }
+
+  chunk = ctxcanvas->chunk_current;
+  if (!chunk)
+  {
+    chunk = picChunkCreate(PIC_CHUNK_SIZE);
+    ctxcanvas->chunk_first = chunk;
+    ctxcanvas->chunk_current = chunk;
+  }
+  else if (chunk->used + size > chunk->size)
+  {
+    if (chunk->next)  /* reuse chunks kept by the last clear */
+    {
+      chunk = chunk->next;
+      chunk->used = 0;
+    }
+    else
+    {
+      chunk->next = picChunkCreate(PIC_CHUNK_SIZE);
+      chunk = chunk->next;
+    }
+    ctxcanvas->chunk_current = chunk;
+  }
+
+  ptr = PIC_CHUNK_DATA(chunk) + chunk->used;
+  chunk->used += size;
+  return ptr;
+}
+
+static void* picAllocCopy(cdCtxCanvas *ctxcanvas, const void* data, size_t size)
+{
+  void* ptr = picAlloc(ctxcanvas, size);
+  memcpy(ptr, data, size);
+  return ptr;
+}
+
+static char* picAllocStr(cdCtxCanvas *ctxcanvas, const char* str, int len)
+{
+  char* ptr = (char*)picAlloc(ctxcanvas, len+1);
+  memcpy(ptr, str, len);
+  ptr[len] = 0;
+  return ptr;
+}
+
+static void picClearArena(cdCtxCanvas *ctxcanvas)
+{
+  picChunkFreeList(ctxcanvas->large_first);
+  ctxcanvas->large_first = NULL;
+
+  ctxcanvas->chunk_current = ctxcanvas->chunk_first;
+  if (ctxcanvas->chunk_current)
+    ctxcanvas->chunk_current->used = 0;
+}
+
 static void picUpdateSize(cdCtxCanvas *ctxcanvas)
 {
   ctxcanvas->canvas->w = ctxcanvas->xmax-ctxcanvas->xmin+1;
@@ -216,6 +360,29 @@ static void picUpdateSize(cdCtxCanvas *ctxcanvas)
   ctxcanvas->canvas->h_mm = ((double)ctxcanvas->canvas->h) / ctxcanvas->canvas->yres;
 }
 
+static void picUpdatePrimBBox(cdCtxCanvas *ctxcanvas, int xmin, int xmax, int ymin, int ymax, int ew)
+{
+  tPrimNode *prim = ctxcanvas->prim_last;
+  tPicBlock *block;
+
+  if (ctxcanvas->prim_n == 0)
+    return;
+
+  if (ew > ctxcanvas->max_ew)
+    ctxcanvas->max_ew = ew;
+
+  if (xmin < prim->xmin) prim->xmin = xmin;
+  if (xmax > prim->xmax) prim->xmax = xmax;
+  if (ymin < prim->ymin) prim->ymin = ymin;
+  if (ymax > prim->ymax) prim->ymax = ymax;
+
+  block = ctxcanvas->blocks + ctxcanvas->block_n-1;
+  if (xmin < block->xmin) block->xmin = xmin;
+  if (xmax > block->xmax) block->xmax = xmax;
+  if (ymin < block->ymin) block->ymin = ymin;
+  if (ymax > block->ymax) block->ymax = ymax;
+}
+
 static void picUpdateBBox(cdCtxCanvas *ctxcanvas, int x, int y, int ew)
 {
   if (x+ew > ctxcanvas->xmax)
@@ -228,6 +395,7 @@ static void picUpdateBBox(cdCtxCanvas *ctxcanvas, int x, int y, int ew)
     ctxcanvas->ymin = y-ew;
 
   picUpdateSize(ctxcanvas);
+  picUpdatePrimBBox(ctxcanvas, x, x, y, y, ew);
 }
 
 static void picUpdateBBoxF(cdCtxCanvas *ctxcanvas, double x, double y, int ew)
@@ -242,145 +410,424 @@ static void picUpdateBBoxF(cdCtxCanvas *ctxcanvas, double x, double y, int ew)
     ctxcanvas->ymin = (int)floor(y-ew);
 
   picUpdateSize(ctxcanvas);
+  picUpdatePrimBBox(ctxcanvas, (int)floor(x), (int)ceil(x), (int)floor(y), (int)ceil(y), ew);
 }
 
 static void picAddPrim(cdCtxCanvas *ctxcanvas, tPrimNode *prim)
 {
+  tPicBlock *block;
+
   if (ctxcanvas->prim_n == 0)
     ctxcanvas->prim_first = prim;
   else
     ctxcanvas->prim_last->next = prim;
 
+  if (ctxcanvas->prim_n % PIC_BLOCK_SIZE == 0)
+  {
+    if (ctxcanvas->block_n == ctxcanvas->block_max)
+    {
+      ctxcanvas->block_max += 64;
+      ctxcanvas->blocks = (tPicBlock*)realloc(ctxcanvas->blocks, ctxcanvas->block_max*sizeof(tPicBlock));
+    }
+
+    block = ctxcanvas->blocks + ctxcanvas->block_n;
+    ctxcanvas->block_n++;
+
+    block->first = prim;
+    block->n = 0;
+    block->unbounded = 0;
+    block->xmin = INT_MAX; block->xmax = INT_MIN;
+    block->ymin = INT_MAX; block->ymax = INT_MIN;
+  }
+  else
+    block = ctxcanvas->blocks + ctxcanvas->block_n-1;
+
+  block->n++;
+
+  prim->xmin = INT_MAX; prim->xmax = INT_MIN;
+  prim->ymin = INT_MAX; prim->ymax = INT_MIN;
+
   ctxcanvas->prim_last = prim;
   ctxcanvas->prim_n++;
 }
 
-static tPrimNode* primCreate(tPrim type)
+static void picAddPrimUnbounded(cdCtxCanvas *ctxcanvas, tPrimNode *prim)
+{
+  picAddPrim(ctxcanvas, prim);
+
+  prim->xmin = INT_MIN; prim->xmax = INT_MAX;
+  prim->ymin = INT_MIN; prim->ymax = INT_MAX;
+  ctxcanvas->blocks[ctxcanvas->block_n-1].unbounded = 1;
+}
+
+static int picPathHasArc(cdCanvas *canvas)
+{
+  int p;
+  for (p=0; p<canvas->path_n; p++)
+  {
+    if (canvas->path[p] == CD_PATH_ARC)
+      return 1;
+  }
+  return 0;
+}
+
+static tPrimNode* primCreate(cdCtxCanvas *ctxcanvas, tPrim type, size_t size)
 {
-  tPrimNode *prim = malloc(sizeof(tPrimNode));
-  memset(prim, 0, sizeof(tPrimNode));
+  tPrimNode *prim = (tPrimNode*)picAlloc(ctxcanvas, size);
+  memset(prim, 0, size);
   prim->type = type;
   return prim;
 }
 
-static void primDestroy(tPrimNode *prim)
+#define sHash(_h, _v) ((_h)*31 + (unsigned int)(_v))
+
+static unsigned int picHashData(unsigned int hash, const unsigned char* data, int size)
 {
-  if (prim->param_buffer)
-    free(prim->param_buffer);
-  if (prim->attrib_buffer)
-    free(prim->attrib_buffer);
-  free(prim);
+  int i;
+  for (i = 0; i < size; i++)
+    hash = sHash(hash, data[i]);
+  return hash;
 }
 
-static void primAddAttrib_Line(tPrimNode *prim, cdCanvas *canvas)
+#define sAttribGrow(_table, _n, _max, _type)                        \
+  if (_n == _max)                                                   \
+  {                                                                 \
+    _max += 64;                                                     \
+    _table = (_type*)realloc(_table, _max*sizeof(_type));           \
+  }
+
+static unsigned int picLineHash(long foreground, long background, int back_opacity, int line_style, int line_width, 
+                                int line_cap, int line_join, const int* dashes, int dashes_count)
 {
-  prim->attrib.line.foreground = canvas->foreground; 
-  prim->attrib.line.background = canvas->background;
-  prim->attrib.line.back_opacity = canvas->back_opacity;
-  prim->attrib.line.line_style = canvas->line_style; 
-  prim->attrib.line.line_width = canvas->line_width;
-  prim->attrib.line.line_cap = canvas->line_cap; 
-  prim->attrib.line.line_join = canvas->line_join;
+  unsigned int hash = 0;
+  hash = sHash(hash, foreground);
+  hash = sHash(hash, background);
+  hash = sHash(hash, back_opacity);
+  hash = sHash(hash, line_style);
+  hash = sHash(hash, line_width);
+  hash = sHash(hash, line_cap);
+  hash = sHash(hash, line_join);
+  if (dashes_count)
+    hash = picHashData(hash, (const unsigned char*)dashes, dashes_count*sizeof(int));
+  return hash;
+}
 
-  if (canvas->line_style==CD_CUSTOM && canvas->line_dashes)
-  {
-    prim->attrib.line.line_dashes_count = canvas->line_dashes_count;
-    prim->attrib_buffer = malloc(canvas->line_dashes_count*sizeof(int));
-    prim->attrib.line.line_dashes = prim->attrib_buffer;
-    memcpy(prim->attrib.line.line_dashes, canvas->line_dashes, canvas->line_dashes_count*sizeof(int));
-  }
+static unsigned int picFillHash(long foreground, long background, int back_opacity, int interior_style, int hatch_style, int fill_mode,
+                                int pattern_w, int pattern_h, const long* pattern, int pattern_size,
+                                int stipple_w, int stipple_h, const unsigned char* stipple, int stipple_size)
+{
+  unsigned int hash = 0;
+  hash = sHash(hash, foreground);
+  hash = sHash(hash, background);
+  hash = sHash(hash, back_opacity);
+  hash = sHash(hash, interior_style);
+  hash = sHash(hash, hatch_style);
+  hash = sHash(hash, fill_mode);
+  hash = sHash(hash, pattern_w);
+  hash = sHash(hash, pattern_h);
+  hash = sHash(hash, stipple_w);
+  hash = sHash(hash, stipple_h);
+  if (pattern_size)
+    hash = picHashData(hash, (const unsigned char*)pattern, pattern_size*sizeof(long));
+  if (stipple_size)
+    hash = picHashData(hash, stipple, stipple_size);
+  return hash;
 }
 
-static void primAddAttrib_Fill(tPrimNode *prim, cdCanvas *canvas)
+static unsigned int picTextHash(long foreground, int font_style, int font_size, int text_alignment, int native, 
+                                double text_orientation, const char* font, int font_len)
 {
-  prim->attrib.fill.foreground = canvas->foreground; 
-  prim->attrib.fill.background = canvas->background;
-  prim->attrib.fill.back_opacity = canvas->back_opacity;
-  prim->attrib.fill.interior_style = canvas->interior_style; 
-  prim->attrib.fill.hatch_style = canvas->hatch_style;
-  prim->attrib.fill.fill_mode = canvas->fill_mode; 
-  prim->attrib.fill.pattern_w = canvas->pattern_w;
-  prim->attrib.fill.pattern_h = canvas->pattern_h;
-  prim->attrib.fill.stipple_w = canvas->stipple_w;
-  prim->attrib.fill.stipple_h = canvas->stipple_h;
+  unsigned int hash = 0;
+  hash = sHash(hash, foreground);
+  hash = sHash(hash, font_style);
+  hash = sHash(hash, font_size);
+  hash = sHash(hash, text_alignment);
+  hash = sHash(hash, native);
+  hash = picHashData(hash, (const unsigned char*)&text_orientation, sizeof(double));
+  hash = picHashData(hash, (const unsigned char*)font, font_len);
+  return hash;
+}
 
-  if (canvas->interior_style==CD_PATTERN && canvas->pattern)
+static void primAddAttrib_Line(cdCtxCanvas *ctxcanvas, tPrimNode *prim)
+{
+  cdCanvas *canvas = ctxcanvas->canvas;
+  tLineAttrib *attrib;
+  int i, dashes_count = 0;
+  unsigned int hash;
+
+  if (canvas->line_style==CD_CUSTOM && canvas->line_dashes)
+    dashes_count = canvas->line_dashes_count;
+
+  hash = picLineHash(canvas->foreground, canvas->background, canvas->back_opacity, canvas->line_style, canvas->line_width, 
+                     canvas->line_cap, canvas->line_join, canvas->line_dashes, dashes_count);
+
+  for (i = ctxcanvas->line_hash[hash % PIC_ATTRIB_HASH]; i; i = attrib->next)
   {
-    prim->attrib_buffer = malloc(canvas->pattern_size*sizeof(long));
-    prim->attrib.fill.pattern = prim->attrib_buffer;
-    memcpy(prim->attrib.fill.pattern, canvas->pattern, canvas->pattern_size*sizeof(long));
+    attrib = ctxcanvas->line_attribs + i-1;
+    if (attrib->hash == hash &&
+        attrib->foreground == canvas->foreground &&
+        attrib->background == canvas->background &&
+        attrib->back_opacity == canvas->back_opacity &&
+        attrib->line_style == canvas->line_style &&
+        attrib->line_width == canvas->line_width &&
+        attrib->line_cap == canvas->line_cap &&
+        attrib->line_join == canvas->line_join &&
+        attrib->line_dashes_count == dashes_count &&
+        (!dashes_count || memcmp(attrib->line_dashes, canvas->line_dashes, dashes_count*sizeof(int))==0))
+    {
+      prim->attrib = i-1;
+      return;
+    }
   }
 
-  if (canvas->interior_style==CD_STIPPLE && canvas->stipple)
+  sAttribGrow(ctxcanvas->line_attribs, ctxcanvas->line_attrib_n, ctxcanvas->line_attrib_max, tLineAttrib);
+  attrib = ctxcanvas->line_attribs + ctxcanvas->line_attrib_n;
+  memset(attrib, 0, sizeof(tLineAttrib));
+
+  attrib->foreground = canvas->foreground; 
+  attrib->background = canvas->background;
+  attrib->back_opacity = canvas->back_opacity;
+  attrib->line_style = canvas->line_style; 
+  attrib->line_width = canvas->line_width;
+  attrib->line_cap = canvas->line_cap; 
+  attrib->line_join = canvas->line_join;
+
+  if (dashes_count)
   {
-    prim->attrib_buffer = malloc(canvas->stipple_size*sizeof(long));
-    prim->attrib.fill.stipple = prim->attrib_buffer;
-    memcpy(prim->attrib.fill.stipple, canvas->stipple, canvas->stipple_size*sizeof(long));
+    attrib->line_dashes_count = dashes_count;
+    attrib->line_dashes = picAllocCopy(ctxcanvas, canvas->line_dashes, dashes_count*sizeof(int));
   }
+
+  attrib->hash = hash;
+  attrib->next = ctxcanvas->line_hash[hash % PIC_ATTRIB_HASH];
+  ctxcanvas->line_attrib_n++;
+  ctxcanvas->line_hash[hash % PIC_ATTRIB_HASH] = ctxcanvas->line_attrib_n;
+
+  prim->attrib = ctxcanvas->line_attrib_n-1;
 }
 
-static void primAddAttrib_Text(tPrimNode *prim, cdCanvas *canvas)
+static void primAddAttrib_Fill(cdCtxCanvas *ctxcanvas, tPrimNode *prim)
 {
-  prim->attrib.text.foreground = canvas->foreground; 
+  cdCanvas *canvas = ctxcanvas->canvas;
+  tFillAttrib *attrib;
+  int i, pattern_size = 0, stipple_size = 0;
+  unsigned int hash;
 
-  prim->attrib.text.font_style = canvas->font_style;
-  prim->attrib.text.font_size = canvas->font_size;
-  prim->attrib.text.text_alignment = canvas->text_alignment; 
-  prim->attrib.text.text_orientation = canvas->text_orientation;
+  if (canvas->interior_style==CD_PATTERN && canvas->pattern)
+    pattern_size = canvas->pattern_w*canvas->pattern_h;
+  if (canvas->interior_style==CD_STIPPLE && canvas->stipple)
+    stipple_size = canvas->stipple_w*canvas->stipple_h;
+
+  hash = picFillHash(canvas->foreground, canvas->background, canvas->back_opacity, canvas->interior_style, canvas->hatch_style, canvas->fill_mode,
+                     canvas->pattern_w, canvas->pattern_h, canvas->pattern, pattern_size,
+                     canvas->stipple_w, canvas->stipple_h, canvas->stipple, stipple_size);
 
-  if (canvas->native_font[0])
+  for (i = ctxcanvas->fill_hash[hash % PIC_ATTRIB_HASH]; i; i = attrib->next)
   {
-    prim->attrib_buffer = cdStrDup(canvas->native_font);
-    prim->attrib.text.native_font = prim->attrib_buffer;
+    attrib = ctxcanvas->fill_attribs + i-1;
+    if (attrib->hash == hash &&
+        attrib->foreground == canvas->foreground &&
+        attrib->background == canvas->background &&
+        attrib->back_opacity == canvas->back_opacity &&
+        attrib->interior_style == canvas->interior_style &&
+        attrib->hatch_style == canvas->hatch_style &&
+        attrib->fill_mode == canvas->fill_mode &&
+        attrib->pattern_w == canvas->pattern_w &&
+        attrib->pattern_h == canvas->pattern_h &&
+        attrib->stipple_w == canvas->stipple_w &&
+        attrib->stipple_h == canvas->stipple_h &&
+        (attrib->pattern != NULL) == (pattern_size != 0) &&
+        (attrib->stipple != NULL) == (stipple_size != 0) &&
+        (!pattern_size || memcmp(attrib->pattern, canvas->pattern, pattern_size*sizeof(long))==0) &&
+        (!stipple_size || memcmp(attrib->stipple, canvas->stipple, stipple_size)==0))
+    {
+      prim->attrib = i-1;
+      return;
+    }
   }
-  else
+
+  sAttribGrow(ctxcanvas->fill_attribs, ctxcanvas->fill_attrib_n, ctxcanvas->fill_attrib_max, tFillAttrib);
+  attrib = ctxcanvas->fill_attribs + ctxcanvas->fill_attrib_n;
+  memset(attrib, 0, sizeof(tFillAttrib));
+
+  attrib->foreground = canvas->foreground; 
+  attrib->background = canvas->background;
+  attrib->back_opacity = canvas->back_opacity;
+  attrib->interior_style = canvas->interior_style; 
+  attrib->hatch_style = canvas->hatch_style;
+  attrib->fill_mode = canvas->fill_mode; 
+  attrib->pattern_w = canvas->pattern_w;
+  attrib->pattern_h = canvas->pattern_h;
+  attrib->stipple_w = canvas->stipple_w;
+  attrib->stipple_h = canvas->stipple_h;
+
+  if (pattern_size)
+    attrib->pattern = picAllocCopy(ctxcanvas, canvas->pattern, pattern_size*sizeof(long));
+
+  if (stipple_size)
+    attrib->stipple = picAllocCopy(ctxcanvas, canvas->stipple, stipple_size);
+
+  attrib->hash = hash;
+  attrib->next = ctxcanvas->fill_hash[hash % PIC_ATTRIB_HASH];
+  ctxcanvas->fill_attrib_n++;
+  ctxcanvas->fill_hash[hash % PIC_ATTRIB_HASH] = ctxcanvas->fill_attrib_n;
+
+  prim->attrib = ctxcanvas->fill_attrib_n-1;
+}
+
+static void primAddAttrib_Text(cdCtxCanvas *ctxcanvas, tPrimNode *prim)
+{
+  cdCanvas *canvas = ctxcanvas->canvas;
+  tTextAttrib *attrib;
+  const char* font = canvas->native_font[0]? canvas->native_font: canvas->font_type_face;
+  int i, native = canvas->native_font[0]? 1: 0;
+  int font_len = (int)strlen(font);
+  unsigned int hash = picTextHash(canvas->foreground, canvas->font_style, canvas->font_size, canvas->text_alignment, native, 
+                                  canvas->text_orientation, font, font_len);
+
+  for (i = ctxcanvas->text_hash[hash % PIC_ATTRIB_HASH]; i; i = attrib->next)
   {
-    prim->attrib_buffer = cdStrDup(canvas->font_type_face);
-    prim->attrib.text.font_type_face = prim->attrib_buffer;
+    attrib = ctxcanvas->text_attribs + i-1;
+    if (attrib->hash == hash &&
+        attrib->foreground == canvas->foreground &&
+        attrib->font_style == canvas->font_style &&
+        attrib->font_size == canvas->font_size &&
+        attrib->text_alignment == canvas->text_alignment &&
+        attrib->text_orientation == canvas->text_orientation &&
+        (native? (attrib->native_font && strcmp(attrib->native_font, font)==0):
+                 (attrib->font_type_face && strcmp(attrib->font_type_face, font)==0)))
+    {
+      prim->attrib = i-1;
+      return;
+    }
   }
+
+  sAttribGrow(ctxcanvas->text_attribs, ctxcanvas->text_attrib_n, ctxcanvas->text_attrib_max, tTextAttrib);
+  attrib = ctxcanvas->text_attribs + ctxcanvas->text_attrib_n;
+  memset(attrib, 0, sizeof(tTextAttrib));
+
+  attrib->foreground = canvas->foreground; 
+
+  attrib->font_style = canvas->font_style;
+  attrib->font_size = canvas->font_size;
+  attrib->text_alignment = canvas->text_alignment; 
+  attrib->text_orientation = canvas->text_orientation;
+
+  if (native)
+    attrib->native_font = picAllocStr(ctxcanvas, font, font_len);
+  else
+    attrib->font_type_face = picAllocStr(ctxcanvas, font, font_len);
+
+  attrib->hash = hash;
+  attrib->next = ctxcanvas->text_hash[hash % PIC_ATTRIB_HASH];
+  ctxcanvas->text_attrib_n++;
+  ctxcanvas->text_hash[hash % PIC_ATTRIB_HASH] = ctxcanvas->text_attrib_n;
+
+  prim->attrib = ctxcanvas->text_attrib_n-1;
 }
 
-static void primUpdateAttrib_Line(tPrimNode *prim, cdCanvas *canvas)
+/* attributes already set in the destination canvas during playback, 
+   only the ones that change from one primitive to the next are set again. */
+typedef struct _tPicPlayState
+{
+  int colors;         /* colors below are valid */
+  long foreground, background;
+  int back_opacity;
+  int line, fill, text;  /* last attribute set of each kind, -1 if none */
+} tPicPlayState;
+
+static void picPlayStateInit(tPicPlayState *state)
 {
-  cdCanvasSetBackground(canvas, prim->attrib.line.background);
-  cdCanvasSetForeground(canvas, prim->attrib.line.foreground);
-  cdCanvasBackOpacity(canvas, prim->attrib.line.back_opacity);
-  cdCanvasLineStyle(canvas, prim->attrib.line.line_style); 
-  cdCanvasLineWidth(canvas, sMin1(prim->attrib.line.line_width));
-  cdCanvasLineCap(canvas, prim->attrib.line.line_cap);
-  cdCanvasLineJoin(canvas, prim->attrib.line.line_join);
+  state->colors = 0;
+  state->line = -1;
+  state->fill = -1;
+  state->text = -1;
+}
+
+static void primUpdateColors(tPicPlayState *state, cdCanvas *canvas, long foreground, long background, int back_opacity)
+{
+  if (!state->colors || state->background != background)
+    cdCanvasSetBackground(canvas, background);
+  if (!state->colors || state->foreground != foreground)
+    cdCanvasSetForeground(canvas, foreground);
+  if (!state->colors || state->back_opacity != back_opacity)
+    cdCanvasBackOpacity(canvas, back_opacity);
+
+  state->colors = 1;
+  state->foreground = foreground;
+  state->background = background;
+  state->back_opacity = back_opacity;
+}
+
+static void primUpdateAttrib_Line(cdCtxCanvas *ctxcanvas, tPicPlayState *state, tPrimNode *prim, cdCanvas *canvas)
+{
+  tLineAttrib *attrib = ctxcanvas->line_attribs + prim->attrib;
+
+  primUpdateColors(state, canvas, attrib->foreground, attrib->background, attrib->back_opacity);
+
+  if (state->line == prim->attrib)
+    return;
+  state->line = prim->attrib;
 
-  if (prim->attrib.line.line_style==CD_CUSTOM && prim->attrib.line.line_dashes)
-    cdCanvasLineStyleDashes(canvas, prim->attrib.line.line_dashes, prim->attrib.line.line_dashes_count);
+  cdCanvasLineStyle(canvas, attrib->line_style); 
+  cdCanvasLineWidth(canvas, sMin1(attrib->line_width));
+  cdCanvasLineCap(canvas, attrib->line_cap);
+  cdCanvasLineJoin(canvas, attrib->line_join);
+
+  if (attrib->line_style==CD_CUSTOM && attrib->line_dashes)
+    cdCanvasLineStyleDashes(canvas, attrib->line_dashes, attrib->line_dashes_count);
 }
 
-void primUpdateAttrib_Fill(tPrimNode *prim, cdCanvas *canvas)
+static void primUpdateAttrib_Fill(cdCtxCanvas *ctxcanvas, tPicPlayState *state, tPrimNode *prim, cdCanvas *canvas)
 {
-  cdCanvasSetBackground(canvas, prim->attrib.fill.background);
-  cdCanvasSetForeground(canvas, prim->attrib.fill.foreground);
-  cdCanvasBackOpacity(canvas, prim->attrib.fill.back_opacity);
-  cdCanvasFillMode(canvas, prim->attrib.fill.fill_mode);
+  tFillAttrib *attrib = ctxcanvas->fill_attribs + prim->attrib;
+
+  primUpdateColors(state, canvas, attrib->foreground, attrib->background, attrib->back_opacity);
+
+  if (state->fill == prim->attrib)
+    return;
+  state->fill = prim->attrib;
 
-  if (prim->attrib.fill.interior_style==CD_HATCH)
-    cdCanvasHatch(canvas, prim->attrib.fill.hatch_style);
-  else if (prim->attrib.fill.interior_style==CD_PATTERN && prim->attrib.fill.pattern)
-    cdCanvasPattern(canvas, prim->attrib.fill.pattern_w, prim->attrib.fill.pattern_h, prim->attrib.fill.pattern);
-  else if (prim->attrib.fill.interior_style==CD_STIPPLE && prim->attrib.fill.stipple)
-    cdCanvasStipple(canvas, prim->attrib.fill.stipple_w, prim->attrib.fill.stipple_h, prim->attrib.fill.stipple);
+  cdCanvasFillMode(canvas, attrib->fill_mode);
 
-  cdCanvasInteriorStyle(canvas, prim->attrib.fill.interior_style);
+  if (attrib->interior_style==CD_HATCH)
+    cdCanvasHatch(canvas, attrib->hatch_style);
+  else if (attrib->interior_style==CD_PATTERN && attrib->pattern)
+    cdCanvasPattern(canvas, attrib->pattern_w, attrib->pattern_h, attrib->pattern);
+  else if (attrib->interior_style==CD_STIPPLE && attrib->stipple)
+    cdCanvasStipple(canvas, attrib->stipple_w, attrib->stipple_h, attrib->stipple);
+
+  cdCanvasInteriorStyle(canvas, attrib->interior_style);
 }
 
-void primUpdateAttrib_Text(tPrimNode *prim, cdCanvas *canvas)
+static void primUpdateAttrib_Text(cdCtxCanvas *ctxcanvas, tPicPlayState *state, tPrimNode *prim, cdCanvas *canvas)
 {
-  cdCanvasSetForeground(canvas, prim->attrib.text.foreground);
-  cdCanvasTextAlignment(canvas, prim->attrib.text.text_alignment);
-  cdCanvasTextOrientation(canvas, prim->attrib.text.text_orientation);
+  tTextAttrib *attrib = ctxcanvas->text_attribs + prim->attrib;
 
-  if (canvas->native_font[0])
-    cdCanvasNativeFont(canvas, prim->attrib.text.native_font);
+  if (!state->colors || state->foreground != attrib->foreground)
+  {
+    cdCanvasSetForeground(canvas, attrib->foreground);
+    state->foreground = attrib->foreground;
+    if (!state->colors)
+    {
+      /* background and opacity are unknown */
+      state->background = cdCanvasBackground(canvas, CD_QUERY);
+      state->back_opacity = cdCanvasBackOpacity(canvas, CD_QUERY);
+      state->colors = 1;
+    }
+  }
+
+  if (state->text == prim->attrib)
+    return;
+  state->text = prim->attrib;
+
+  cdCanvasTextAlignment(canvas, attrib->text_alignment);
+  cdCanvasTextOrientation(canvas, attrib->text_orientation);
+
+  if (attrib->native_font)
+    cdCanvasNativeFont(canvas, attrib->native_font);
   else
-    cdCanvasFont(canvas, prim->attrib.text.font_type_face, prim->attrib.text.font_style, prim->attrib.text.font_size);
+    cdCanvasFont(canvas, attrib->font_type_face, attrib->font_style, attrib->font_size);
 }
 
 static int cdfont(cdCtxCanvas *ctxcanvas, const char *type_face, int style, int size)
@@ -394,24 +841,26 @@ static int cdfont(cdCtxCanvas *ctxcanvas, const char *type_face, int style, int
 
 static void cdclear(cdCtxCanvas *ctxcanvas)
 {
-  tPrimNode *prim;
-  int i;
-  for (i = 0; i < ctxcanvas->prim_n; i++)
-  {
-    prim = ctxcanvas->prim_first;
-    ctxcanvas->prim_first = prim->next;
-
-    primDestroy(prim);
-  }
+  picClearArena(ctxcanvas);
 
   ctxcanvas->prim_n = 0;
   ctxcanvas->prim_first = NULL;
   ctxcanvas->prim_last = NULL;
+
+  ctxcanvas->block_n = 0;
+  ctxcanvas->max_ew = 0;
+
+  ctxcanvas->line_attrib_n = 0;
+  ctxcanvas->fill_attrib_n = 0;
+  ctxcanvas->text_attrib_n = 0;
+  memset(ctxcanvas->line_hash, 0, sizeof(ctxcanvas->line_hash));
+  memset(ctxcanvas->fill_hash, 0, sizeof(ctxcanvas->fill_hash));
+  memset(ctxcanvas->text_hash, 0, sizeof(ctxcanvas->text_hash));
 }
 
 static void cdpixel(cdCtxCanvas *ctxcanvas, int x, int y, long int color)
 {
-  tPrimNode *prim = primCreate(CDPIC_PIXEL);
+  tPrimNode *prim = primCreate(ctxcanvas, CDPIC_PIXEL, PIC_PRIM_SIZE(tPixel));
   prim->param.pixel.x = x;
   prim->param.pixel.y = y;
   prim->param.pixel.color = color;
@@ -421,8 +870,8 @@ static void cdpixel(cdCtxCanvas *ctxcanvas, int x, int y, long int color)
 
 static void cdline(cdCtxCanvas *ctxcanvas, int x1, int y1, int x2, int y2)
 {
-  tPrimNode *prim = primCreate(CDPIC_LINE);
-  primAddAttrib_Line(prim, ctxcanvas->canvas);
+  tPrimNode *prim = primCreate(ctxcanvas, CDPIC_LINE, PIC_PRIM_SIZE(tLBR));
+  primAddAttrib_Line(ctxcanvas, prim);
   prim->param.lineboxrect.x1 = x1;
   prim->param.lineboxrect.y1 = y1;
   prim->param.lineboxrect.x2 = x2;
@@ -434,8 +883,8 @@ static void cdline(cdCtxCanvas *ctxcanvas, int x1, int y1, int x2, int y2)
 
 static void cdfline(cdCtxCanvas *ctxcanvas, double x1, double y1, double x2, double y2)
 {
-  tPrimNode *prim = primCreate(CDPIC_FLINE);
-  primAddAttrib_Line(prim, ctxcanvas->canvas);
+  tPrimNode *prim = primCreate(ctxcanvas, CDPIC_FLINE, PIC_PRIM_SIZE(tfLBR));
+  primAddAttrib_Line(ctxcanvas, prim);
   prim->param.lineboxrectf.x1 = x1;
   prim->param.lineboxrectf.y1 = y1;
   prim->param.lineboxrectf.x2 = x2;
@@ -447,8 +896,8 @@ static void cdfline(cdCtxCanvas *ctxcanvas, double x1, double y1, double x2, dou
 
 static void cdrect(cdCtxCanvas *ctxcanvas, int xmin, int xmax, int ymin, int ymax)
 {
-  tPrimNode *prim = primCreate(CDPIC_RECT);
-  primAddAttrib_Line(prim, ctxcanvas->canvas);
+  tPrimNode *prim = primCreate(ctxcanvas, CDPIC_RECT, PIC_PRIM_SIZE(tLBR));
+  primAddAttrib_Line(ctxcanvas, prim);
   prim->param.lineboxrect.x1 = xmin;
   prim->param.lineboxrect.y1 = ymin;
   prim->param.lineboxrect.x2 = xmax;
@@ -460,8 +909,8 @@ static void cdrect(cdCtxCanvas *ctxcanvas, int xmin, int xmax, int ymin, int yma
 
 static void cdfrect(cdCtxCanvas *ctxcanvas, double xmin, double xmax, double ymin, double ymax)
 {
-  tPrimNode *prim = primCreate(CDPIC_FRECT);
-  primAddAttrib_Line(prim, ctxcanvas->canvas);
+  tPrimNode *prim = primCreate(ctxcanvas, CDPIC_FRECT, PIC_PRIM_SIZE(tfLBR));
+  primAddAttrib_Line(ctxcanvas, prim);
   prim->param.lineboxrectf.x1 = xmin;
   prim->param.lineboxrectf.y1 = ymin;
   prim->param.lineboxrectf.x2 = xmax;
@@ -473,8 +922,8 @@ static void cdfrect(cdCtxCanvas *ctxcanvas, double xmin, double xmax, double ymi
 
 static void cdbox(cdCtxCanvas *ctxcanvas, int xmin, int xmax, int ymin, int ymax)
 {
-  tPrimNode *prim = primCreate(CDPIC_BOX);
-  primAddAttrib_Fill(prim, ctxcanvas->canvas);
+  tPrimNode *prim = primCreate(ctxcanvas, CDPIC_BOX, PIC_PRIM_SIZE(tLBR));
+  primAddAttrib_Fill(ctxcanvas, prim);
   prim->param.lineboxrect.x1 = xmin;
   prim->param.lineboxrect.y1 = ymin;
   prim->param.lineboxrect.x2 = xmax;
@@ -486,8 +935,8 @@ static void cdbox(cdCtxCanvas *ctxcanvas, int xmin, int xmax, int ymin, int ymax
 
 static void cdfbox(cdCtxCanvas *ctxcanvas, double xmin, double xmax, double ymin, double ymax)
 {
-  tPrimNode *prim = primCreate(CDPIC_FBOX);
-  primAddAttrib_Fill(prim, ctxcanvas->canvas);
+  tPrimNode *prim = primCreate(ctxcanvas, CDPIC_FBOX, PIC_PRIM_SIZE(tfLBR));
+  primAddAttrib_Fill(ctxcanvas, prim);
   prim->param.lineboxrectf.x1 = xmin;
   prim->param.lineboxrectf.y1 = ymin;
   prim->param.lineboxrectf.x2 = xmax;
@@ -497,11 +946,34 @@ static void cdfbox(cdCtxCanvas *ctxcanvas, double xmin, double xmax, double ymin
   picUpdateBBoxF(ctxcanvas, xmax, ymax, 0);
 }
 
+/* The angles arrive normalized by sNormAngles, angle1 can be negative and 
+   angle2 up to 720, but cdCanvasGetArcBox expects angles in [0,360) 
+   and detects the crossing of 0 by angle1>angle2. */
+static void picGetArcBox(int xc, int yc, int w, int h, double a1, double a2, int *xmin, int *xmax, int *ymin, int *ymax)
+{
+  if (a2 - a1 >= 360)
+  {
+    /* full ellipse */
+    *xmin = xc - (w+1)/2;
+    *xmax = xc + (w+1)/2;
+    *ymin = yc - (h+1)/2;
+    *ymax = yc + (h+1)/2;
+    return;
+  }
+
+  a1 = fmod(a1, 360);
+  if (a1 < 0) a1 += 360;
+  a2 = fmod(a2, 360);
+  if (a2 < 0) a2 += 360;
+
+  cdCanvasGetArcBox(xc, yc, w, h, a1, a2, xmin, xmax, ymin, ymax);
+}
+
 static void cdarc(cdCtxCanvas *ctxcanvas, int xc, int yc, int w, int h, double a1, double a2)
 {
   int xmin, xmax, ymin, ymax;
-  tPrimNode *prim = primCreate(CDPIC_ARC);
-  primAddAttrib_Line(prim, ctxcanvas->canvas);
+  tPrimNode *prim = primCreate(ctxcanvas, CDPIC_ARC, PIC_PRIM_SIZE(tASC));
+  primAddAttrib_Line(ctxcanvas, prim);
   prim->param.arcsectorchord.xc = xc;
   prim->param.arcsectorchord.yc = yc;
   prim->param.arcsectorchord.w = w;
@@ -509,7 +981,7 @@ static void cdarc(cdCtxCanvas *ctxcanvas, int xc, int yc, int w, int h, double a
   prim->param.arcsectorchord.angle1 = a1;
   prim->param.arcsectorchord.angle2 = a2;
   picAddPrim(ctxcanvas, prim);
-  cdCanvasGetArcBox(xc, yc, w, h, a1, a2, &xmin, &xmax, &ymin, &ymax);
+  picGetArcBox(xc, yc, w, h, a1, a2, &xmin, &xmax, &ymin, &ymax);
   picUpdateBBox(ctxcanvas, xmin, ymin, ctxcanvas->canvas->line_width);
   picUpdateBBox(ctxcanvas, xmax, ymax, ctxcanvas->canvas->line_width);
 }
@@ -517,8 +989,8 @@ static void cdarc(cdCtxCanvas *ctxcanvas, int xc, int yc, int w, int h, double a
 static void cdfarc(cdCtxCanvas *ctxcanvas, double xc, double yc, double w, double h, double a1, double a2)
 {
   int xmin, xmax, ymin, ymax;
-  tPrimNode *prim = primCreate(CDPIC_FARC);
-  primAddAttrib_Line(prim, ctxcanvas->canvas);
+  tPrimNode *prim = primCreate(ctxcanvas, CDPIC_FARC, PIC_PRIM_SIZE(tfASC));
+  primAddAttrib_Line(ctxcanvas, prim);
   prim->param.arcsectorchordf.xc = xc;
   prim->param.arcsectorchordf.yc = yc;
   prim->param.arcsectorchordf.w = w;
@@ -526,7 +998,7 @@ static void cdfarc(cdCtxCanvas *ctxcanvas, double xc, double yc, double w, doubl
   prim->param.arcsectorchordf.angle1 = a1;
   prim->param.arcsectorchordf.angle2 = a2;
   picAddPrim(ctxcanvas, prim);
-  cdCanvasGetArcBox(_cdRound(xc), _cdRound(yc), _cdRound(w), _cdRound(h), a1, a2, &xmin, &xmax, &ymin, &ymax);
+  picGetArcBox(_cdRound(xc), _cdRound(yc), _cdRound(w), _cdRound(h), a1, a2, &xmin, &xmax, &ymin, &ymax);
   picUpdateBBox(ctxcanvas, xmin, ymin, ctxcanvas->canvas->line_width);
   picUpdateBBox(ctxcanvas, xmax, ymax, ctxcanvas->canvas->line_width);
 }
@@ -534,8 +1006,8 @@ static void cdfarc(cdCtxCanvas *ctxcanvas, double xc, double yc, double w, doubl
 static void cdsector(cdCtxCanvas *ctxcanvas, int xc, int yc, int w, int h, double a1, double a2)
 {
   int xmin, xmax, ymin, ymax;
-  tPrimNode *prim = primCreate(CDPIC_SECTOR);
-  primAddAttrib_Fill(prim, ctxcanvas->canvas);
+  tPrimNode *prim = primCreate(ctxcanvas, CDPIC_SECTOR, PIC_PRIM_SIZE(tASC));
+  primAddAttrib_Fill(ctxcanvas, prim);
   prim->param.arcsectorchord.xc = xc;
   prim->param.arcsectorchord.yc = yc;
   prim->param.arcsectorchord.w = w;
@@ -543,7 +1015,7 @@ static void cdsector(cdCtxCanvas *ctxcanvas, int xc, int yc, int w, int h, doubl
   prim->param.arcsectorchord.angle1 = a1;
   prim->param.arcsectorchord.angle2 = a2;
   picAddPrim(ctxcanvas, prim);
-  cdCanvasGetArcBox(xc, yc, w, h, a1, a2, &xmin, &xmax, &ymin, &ymax);
+  picGetArcBox(xc, yc, w, h, a1, a2, &xmin, &xmax, &ymin, &ymax);
   picUpdateBBox(ctxcanvas, xmin, ymin, 0);
   picUpdateBBox(ctxcanvas, xmax, ymax, 0);
   picUpdateBBox(ctxcanvas, xc, yc, 0);
@@ -552,8 +1024,8 @@ static void cdsector(cdCtxCanvas *ctxcanvas, int xc, int yc, int w, int h, doubl
 static void cdfsector(cdCtxCanvas *ctxcanvas, double xc, double yc, double w, double h, double a1, double a2)
 {
   int xmin, xmax, ymin, ymax;
-  tPrimNode *prim = primCreate(CDPIC_FSECTOR);
-  primAddAttrib_Fill(prim, ctxcanvas->canvas);
+  tPrimNode *prim = primCreate(ctxcanvas, CDPIC_FSECTOR, PIC_PRIM_SIZE(tfASC));
+  primAddAttrib_Fill(ctxcanvas, prim);
   prim->param.arcsectorchordf.xc = xc;
   prim->param.arcsectorchordf.yc = yc;
   prim->param.arcsectorchordf.w = w;
@@ -561,7 +1033,7 @@ static void cdfsector(cdCtxCanvas *ctxcanvas, double xc, double yc, double w, do
   prim->param.arcsectorchordf.angle1 = a1;
   prim->param.arcsectorchordf.angle2 = a2;
   picAddPrim(ctxcanvas, prim);
-  cdCanvasGetArcBox(_cdRound(xc), _cdRound(yc), _cdRound(w), _cdRound(h), a1, a2, &xmin, &xmax, &ymin, &ymax);
+  picGetArcBox(_cdRound(xc), _cdRound(yc), _cdRound(w), _cdRound(h), a1, a2, &xmin, &xmax, &ymin, &ymax);
   picUpdateBBox(ctxcanvas, xmin, ymin, 0);
   picUpdateBBox(ctxcanvas, xmax, ymax, 0);
   picUpdateBBox(ctxcanvas, _cdRound(xc), _cdRound(yc), 0);
@@ -570,8 +1042,8 @@ static void cdfsector(cdCtxCanvas *ctxcanvas, double xc, double yc, double w, do
 static void cdchord(cdCtxCanvas *ctxcanvas, int xc, int yc, int w, int h, double a1, double a2)
 {
   int xmin, xmax, ymin, ymax;
-  tPrimNode *prim = primCreate(CDPIC_CHORD);
-  primAddAttrib_Fill(prim, ctxcanvas->canvas);
+  tPrimNode *prim = primCreate(ctxcanvas, CDPIC_CHORD, PIC_PRIM_SIZE(tASC));
+  primAddAttrib_Fill(ctxcanvas, prim);
   prim->param.arcsectorchord.xc = xc;
   prim->param.arcsectorchord.yc = yc;
   prim->param.arcsectorchord.w = w;
@@ -579,7 +1051,7 @@ static void cdchord(cdCtxCanvas *ctxcanvas, int xc, int yc, int w, int h, double
   prim->param.arcsectorchord.angle1 = a1;
   prim->param.arcsectorchord.angle2 = a2;
   picAddPrim(ctxcanvas, prim);
-  cdCanvasGetArcBox(xc, yc, w, h, a1, a2, &xmin, &xmax, &ymin, &ymax);
+  picGetArcBox(xc, yc, w, h, a1, a2, &xmin, &xmax, &ymin, &ymax);
   picUpdateBBox(ctxcanvas, xmin, ymin, 0);
   picUpdateBBox(ctxcanvas, xmax, ymax, 0);
 }
@@ -587,8 +1059,8 @@ static void cdchord(cdCtxCanvas *ctxcanvas, int xc, int yc, int w, int h, double
 static void cdfchord(cdCtxCanvas *ctxcanvas, double xc, double yc, double w, double h, double a1, double a2)
 {
   int xmin, xmax, ymin, ymax;
-  tPrimNode *prim = primCreate(CDPIC_FCHORD);
-  primAddAttrib_Fill(prim, ctxcanvas->canvas);
+  tPrimNode *prim = primCreate(ctxcanvas, CDPIC_FCHORD, PIC_PRIM_SIZE(tfASC));
+  primAddAttrib_Fill(ctxcanvas, prim);
   prim->param.arcsectorchordf.xc = xc;
   prim->param.arcsectorchordf.yc = yc;
   prim->param.arcsectorchordf.w = w;
@@ -596,7 +1068,7 @@ static void cdfchord(cdCtxCanvas *ctxcanvas, double xc, double yc, double w, dou
   prim->param.arcsectorchordf.angle1 = a1;
   prim->param.arcsectorchordf.angle2 = a2;
   picAddPrim(ctxcanvas, prim);
-  cdCanvasGetArcBox(_cdRound(xc), _cdRound(yc), _cdRound(w), _cdRound(h), a1, a2, &xmin, &xmax, &ymin, &ymax);
+  picGetArcBox(_cdRound(xc), _cdRound(yc), _cdRound(w), _cdRound(h), a1, a2, &xmin, &xmax, &ymin, &ymax);
   picUpdateBBox(ctxcanvas, xmin, ymin, 0);
   picUpdateBBox(ctxcanvas, xmax, ymax, 0);
 }
@@ -604,13 +1076,12 @@ static void cdfchord(cdCtxCanvas *ctxcanvas, double xc, double yc, double w, dou
 static void cdtext(cdCtxCanvas *ctxcanvas, int x, int y, const char *text, int len)
 {
   int xmin, xmax, ymin, ymax;
-  tPrimNode *prim = primCreate(CDPIC_TEXT);
-  primAddAttrib_Text(prim, ctxcanvas->canvas);
+  tPrimNode *prim = primCreate(ctxcanvas, CDPIC_TEXT, PIC_PRIM_SIZE(tText));
+  primAddAttrib_Text(ctxcanvas, prim);
   prim->param.text.x = x;
   prim->param.text.y = y;
-  prim->param.text.s = cdStrDupN(text, len);
-  prim->param_buffer = prim->param.text.s;
-  picAddPrim(ctxcanvas, prim);
+  prim->param.text.s = picAllocStr(ctxcanvas, text, len);
+  picAddPrimUnbounded(ctxcanvas, prim);
   cdCanvasGetTextBox(ctxcanvas->canvas, x, y, prim->param.text.s, &xmin, &xmax, &ymin, &ymax);
   picUpdateBBox(ctxcanvas, xmin, ymin, 0);
   picUpdateBBox(ctxcanvas, xmax, ymax, 0);
@@ -619,14 +1090,13 @@ static void cdtext(cdCtxCanvas *ctxcanvas, int x, int y, const char *text, int l
 static void cdftext(cdCtxCanvas *ctxcanvas, double x, double y, const char *text, int len)
 {
   int xmin, xmax, ymin, ymax;
-  tPrimNode *prim = primCreate(CDPIC_FTEXT);
-  primAddAttrib_Text(prim, ctxcanvas->canvas);
+  tPrimNode *prim = primCreate(ctxcanvas, CDPIC_FTEXT, PIC_PRIM_SIZE(tfText));
+  primAddAttrib_Text(ctxcanvas, prim);
   prim->param.textf.x = x;
   prim->param.textf.y = y;
-  prim->param.textf.s = cdStrDupN(text, len);
-  prim->param_buffer = prim->param.textf.s;
-  picAddPrim(ctxcanvas, prim);
-  cdCanvasGetTextBox(ctxcanvas->canvas, _cdRound(x), _cdRound(y), prim->param.text.s, &xmin, &xmax, &ymin, &ymax);
+  prim->param.textf.s = picAllocStr(ctxcanvas, text, len);
+  picAddPrimUnbounded(ctxcanvas, prim);
+  cdCanvasGetTextBox(ctxcanvas->canvas, _cdRound(x), _cdRound(y), prim->param.textf.s, &xmin, &xmax, &ymin, &ymax);
   picUpdateBBox(ctxcanvas, xmin, ymin, 0);
   picUpdateBBox(ctxcanvas, xmax, ymax, 0);
 }
@@ -656,24 +1126,23 @@ static void cdpath(cdCtxCanvas *ctxcanvas, cdPoint* poly, int n)
   if (fill == -1)
     return;
 
-  prim = primCreate(CDPIC_PATH);
+  prim = primCreate(ctxcanvas, CDPIC_PATH, PIC_PRIM_SIZE(tPath));
   prim->param.path.fill = fill;
 
   if (fill)
-    primAddAttrib_Fill(prim, ctxcanvas->canvas);
+    primAddAttrib_Fill(ctxcanvas, prim);
   else
-    primAddAttrib_Line(prim, ctxcanvas->canvas);
-
-  prim->param_buffer = malloc(n * sizeof(cdPoint) + ctxcanvas->canvas->path_n * sizeof(int));
+    primAddAttrib_Line(ctxcanvas, prim);
 
   prim->param.path.n = n;
-  prim->param.path.points = (cdPoint*)prim->param_buffer;
-  memcpy(prim->param.path.points, poly, n * sizeof(cdPoint));
-  prim->param.path.path = (int*)((unsigned char*)prim->param_buffer + n * sizeof(cdPoint));
-  memcpy(prim->param.path.path, ctxcanvas->canvas->path, ctxcanvas->canvas->path_n * sizeof(int));
+  prim->param.path.points = picAllocCopy(ctxcanvas, poly, n * sizeof(cdPoint));
+  prim->param.path.path = picAllocCopy(ctxcanvas, ctxcanvas->canvas->path, ctxcanvas->canvas->path_n * sizeof(int));
   prim->param.path.path_n = ctxcanvas->canvas->path_n;
   
-  picAddPrim(ctxcanvas, prim);
+  if (picPathHasArc(ctxcanvas->canvas))  /* arc points are not coordinates */
+    picAddPrimUnbounded(ctxcanvas, prim);
+  else
+    picAddPrim(ctxcanvas, prim);
 
   for (i = 0; i < n; i++)
   {
@@ -691,16 +1160,14 @@ static void cdpoly(cdCtxCanvas *ctxcanvas, int mode, cdPoint* poly, int n)
     cdpath(ctxcanvas, poly, n);
     return;
   }
-  prim = primCreate(CDPIC_POLY);
+  prim = primCreate(ctxcanvas, CDPIC_POLY, PIC_PRIM_SIZE(tPoly));
   if (mode == CD_FILL)
-    primAddAttrib_Fill(prim, ctxcanvas->canvas);
+    primAddAttrib_Fill(ctxcanvas, prim);
   else
-    primAddAttrib_Line(prim, ctxcanvas->canvas);
+    primAddAttrib_Line(ctxcanvas, prim);
   prim->param.poly.mode = mode;
   prim->param.poly.n = n;
-  prim->param.poly.points = malloc(n * sizeof(cdPoint));
-  memcpy(prim->param.poly.points, poly, n * sizeof(cdPoint));
-  prim->param_buffer = prim->param.poly.points;
+  prim->param.poly.points = picAllocCopy(ctxcanvas, poly, n * sizeof(cdPoint));
   picAddPrim(ctxcanvas, prim);
 
   for (i = 0; i < n; i++)
@@ -737,24 +1204,23 @@ static void cdfpath(cdCtxCanvas *ctxcanvas, cdfPoint* poly, int n)
   if (fill == -1)
     return;
 
-  prim = primCreate(CDPIC_FPATH);
+  prim = primCreate(ctxcanvas, CDPIC_FPATH, PIC_PRIM_SIZE(tfPath));
   prim->param.pathf.fill = fill;
 
   if (fill)
-    primAddAttrib_Fill(prim, ctxcanvas->canvas);
+    primAddAttrib_Fill(ctxcanvas, prim);
   else
-    primAddAttrib_Line(prim, ctxcanvas->canvas);
-
-  prim->param_buffer = malloc(n * sizeof(cdfPoint) + ctxcanvas->canvas->path_n * sizeof(int));
+    primAddAttrib_Line(ctxcanvas, prim);
 
   prim->param.pathf.n = n;
-  prim->param.pathf.points = (cdfPoint*)prim->param_buffer;
-  memcpy(prim->param.pathf.points, poly, n * sizeof(cdfPoint));
-  prim->param.pathf.path = (int*)((unsigned char*)prim->param_buffer + n * sizeof(cdfPoint));
-  memcpy(prim->param.pathf.path, ctxcanvas->canvas->path, ctxcanvas->canvas->path_n * sizeof(int));
+  prim->param.pathf.points = picAllocCopy(ctxcanvas, poly, n * sizeof(cdfPoint));
+  prim->param.pathf.path = picAllocCopy(ctxcanvas, ctxcanvas->canvas->path, ctxcanvas->canvas->path_n * sizeof(int));
   prim->param.pathf.path_n = ctxcanvas->canvas->path_n;
   
-  picAddPrim(ctxcanvas, prim);
+  if (picPathHasArc(ctxcanvas->canvas))  /* arc points are not coordinates */
+    picAddPrimUnbounded(ctxcanvas, prim);
+  else
+    picAddPrim(ctxcanvas, prim);
 
   for (i = 0; i < n; i++)
   {
@@ -772,16 +1238,14 @@ static void cdfpoly(cdCtxCanvas *ctxcanvas, int mode, cdfPoint* poly, int n)
     cdfpath(ctxcanvas, poly, n);
     return;
   }
-  prim = primCreate(CDPIC_FPOLY);
+  prim = primCreate(ctxcanvas, CDPIC_FPOLY, PIC_PRIM_SIZE(tfPoly));
   if (mode == CD_FILL)
-    primAddAttrib_Fill(prim, ctxcanvas->canvas);
+    primAddAttrib_Fill(ctxcanvas, prim);
   else
-    primAddAttrib_Line(prim, ctxcanvas->canvas);
+    primAddAttrib_Line(ctxcanvas, prim);
   prim->param.polyf.mode = mode;
   prim->param.polyf.n = n;
-  prim->param.polyf.points = malloc(n * sizeof(cdfPoint));
-  memcpy(prim->param.polyf.points, poly, n * sizeof(cdfPoint));
-  prim->param_buffer = prim->param.polyf.points;
+  prim->param.polyf.points = picAllocCopy(ctxcanvas, poly, n * sizeof(cdfPoint));
   picAddPrim(ctxcanvas, prim);
 
   for (i = 0; i < n; i++)
@@ -798,7 +1262,7 @@ static void cdputimagerectrgb(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsi
   int l, offset, size;
   unsigned char *dr, *dg, *db;
 
-  tPrimNode *prim = primCreate(CDPIC_IMAGERGB);
+  tPrimNode *prim = primCreate(ctxcanvas, CDPIC_IMAGERGB, PIC_PRIM_SIZE(tImageRGBA));
   prim->param.imagergba.iw = xmax-xmin+1;
   prim->param.imagergba.ih = ymax-ymin+1;
   prim->param.imagergba.x = x;
@@ -807,8 +1271,7 @@ static void cdputimagerectrgb(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsi
   prim->param.imagergba.h = h;
 
   size = prim->param.imagergba.iw*prim->param.imagergba.ih;
-  prim->param_buffer = malloc(3*size);
-  prim->param.imagergba.r = prim->param_buffer;
+  prim->param.imagergba.r = picAlloc(ctxcanvas, 3*size);
   prim->param.imagergba.g = prim->param.imagergba.r + size;
   prim->param.imagergba.b = prim->param.imagergba.g + size;
 
@@ -836,8 +1299,9 @@ static void cdputimagerectrgb(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsi
     db += offset;
   }
 
+  picAddPrim(ctxcanvas, prim);
   picUpdateBBox(ctxcanvas, x, y, 0);
-  picUpdateBBox(ctxcanvas, x+prim->param.imagergba.iw-1, y+prim->param.imagergba.ih-1, 0);
+  picUpdateBBox(ctxcanvas, x+w-1, y+h-1, 0);
 
   (void)ih;
 }
@@ -847,7 +1311,7 @@ static void cdputimagerectrgba(cdCtxCanvas *ctxcanvas, int iw, int ih, const uns
   int l, offset, size;
   unsigned char *dr, *dg, *db, *da;
 
-  tPrimNode *prim = primCreate(CDPIC_IMAGERGBA);
+  tPrimNode *prim = primCreate(ctxcanvas, CDPIC_IMAGERGBA, PIC_PRIM_SIZE(tImageRGBA));
   prim->param.imagergba.iw = xmax-xmin+1;
   prim->param.imagergba.ih = ymax-ymin+1;
   prim->param.imagergba.x = x;
@@ -856,8 +1320,7 @@ static void cdputimagerectrgba(cdCtxCanvas *ctxcanvas, int iw, int ih, const uns
   prim->param.imagergba.h = h;
 
   size = prim->param.imagergba.iw*prim->param.imagergba.ih;
-  prim->param_buffer = malloc(4*size);
-  prim->param.imagergba.r = prim->param_buffer;
+  prim->param.imagergba.r = picAlloc(ctxcanvas, 4*size);
   prim->param.imagergba.g = prim->param.imagergba.r + size;
   prim->param.imagergba.b = prim->param.imagergba.g + size;
   prim->param.imagergba.a = prim->param.imagergba.b + size;
@@ -891,8 +1354,9 @@ static void cdputimagerectrgba(cdCtxCanvas *ctxcanvas, int iw, int ih, const uns
     da += offset;
   }
 
+  picAddPrim(ctxcanvas, prim);
   picUpdateBBox(ctxcanvas, x, y, 0);
-  picUpdateBBox(ctxcanvas, x+prim->param.imagergba.iw-1, y+prim->param.imagergba.ih-1, 0);
+  picUpdateBBox(ctxcanvas, x+w-1, y+h-1, 0);
 
   (void)ih;
 }
@@ -903,7 +1367,7 @@ static void cdputimagerectmap(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsi
   unsigned char *dindex;
   long *dcolors;
 
-  tPrimNode *prim = primCreate(CDPIC_IMAGEMAP);
+  tPrimNode *prim = primCreate(ctxcanvas, CDPIC_IMAGEMAP, PIC_PRIM_SIZE(tImageMap));
   prim->param.imagemap.iw = xmax-xmin+1;
   prim->param.imagemap.ih = ymax-ymin+1;
   prim->param.imagemap.x = x;
@@ -912,9 +1376,8 @@ static void cdputimagerectmap(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsi
   prim->param.imagemap.h = h;
 
   size = prim->param.imagemap.iw*prim->param.imagemap.ih;
-  prim->param_buffer = malloc(size + 256);
-  prim->param.imagemap.index = prim->param_buffer;
-  prim->param.imagemap.colors = (long*)(prim->param.imagemap.index + size);
+  prim->param.imagemap.index = picAlloc(ctxcanvas, size);
+  prim->param.imagemap.colors = picAlloc(ctxcanvas, 256*sizeof(long));
 
   offset = ymin*iw + xmin;
   index += offset;
@@ -941,8 +1404,9 @@ static void cdputimagerectmap(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsi
   for (c = 0; c < n; c++)
     dcolors[c] = colors[c];
 
+  picAddPrim(ctxcanvas, prim);
   picUpdateBBox(ctxcanvas, x, y, 0);
-  picUpdateBBox(ctxcanvas, x+prim->param.imagemap.iw-1, y+prim->param.imagemap.ih-1, 0);
+  picUpdateBBox(ctxcanvas, x+w-1, y+h-1, 0);
 
   (void)ih;
 }
@@ -978,14 +1442,257 @@ static int cdregistercallback(int cb, cdCallback func)
 #define sfScaleH(_h) (scale? (_h) * factorY: (_h))
 
 
-static int cdplay(cdCanvas* canvas, int xmin, int xmax, int ymin, int ymax, void *data)
+/* visible area of the destination canvas in picture coordinates */
+typedef struct _tPicView
+{
+  double xmin, xmax,
+         ymin, ymax;
+} tPicView;
+
+static int picGetView(cdCanvas* canvas, cdCtxCanvas* ctxcanvas, int scale, int xmin, int ymin, int pic_xmin, int pic_ymin, double factorX, double factorY, tPicView *view)
+{
+  int nxmin = 0, nxmax = canvas->w-1,
+      nymin = 0, nymax = canvas->h-1;
+  double ux1, ux2, uy1, uy2, mx, my;
+
+  /* drivers without a size (e.g. another picture) or with a transformation receive everything */
+  if (canvas->w <= 0 || canvas->h <= 0 || canvas->use_matrix)
+    return 0;
+
+  if (canvas->clip_mode == CD_CLIPAREA)
+  {
+    if (canvas->clip_rect.xmin > nxmin) nxmin = canvas->clip_rect.xmin;
+    if (canvas->clip_rect.xmax < nxmax) nxmax = canvas->clip_rect.xmax;
+    if (canvas->clip_rect.ymin > nymin) nymin = canvas->clip_rect.ymin;
+    if (canvas->clip_rect.ymax < nymax) nymax = canvas->clip_rect.ymax;
+  }
+
+  /* from native to user coordinates, as received by the cdCanvas* functions */
+  ux1 = nxmin; ux2 = nxmax;
+  if (canvas->invert_yaxis)
+  {
+    uy1 = _cdInvertYAxis(canvas, nymax);
+    uy2 = _cdInvertYAxis(canvas, nymin);
+  }
+  else
+  {
+    uy1 = nymin; uy2 = nymax;
+  }
+
+  if (canvas->use_origin)
+  {
+    ux1 -= canvas->origin.x; ux2 -= canvas->origin.x;
+    uy1 -= canvas->origin.y; uy2 -= canvas->origin.y;
+  }
+
+  /* line widths are not scaled during playback, 
+     so the margin is the largest line width in destination pixels, plus rounding */
+  mx = my = ctxcanvas->max_ew + 2;
+
+  if (scale)
+  {
+    ux1 = (ux1 - xmin) / factorX + pic_xmin;
+    ux2 = (ux2 - xmin) / factorX + pic_xmin;
+    uy1 = (uy1 - ymin) / factorY + pic_ymin;
+    uy2 = (uy2 - ymin) / factorY + pic_ymin;
+    mx /= factorX;
+    my /= factorY;
+  }
+
+  view->xmin = ux1 - mx;
+  view->xmax = ux2 + mx;
+  view->ymin = uy1 - my;
+  view->ymax = uy2 + my;
+  return 1;
+}
+
+#define sOutsideView(_b) ((_b)->xmax < view.xmin || (_b)->xmin > view.xmax || (_b)->ymax < view.ymin || (_b)->ymin > view.ymax)
+
+typedef struct _tPicPlayer
 {
+  cdCanvas* canvas;
+  cdCtxCanvas* ctxcanvas;
+  tPicPlayState state;
+  tPicView view;
+  int cull, scale, xmin, ymin, pic_xmin, pic_ymin;
+  double factorX, factorY;
+
+  int b, i;             /* next primitive */
   tPrimNode *prim;
+  int prim_n, prim_count;  /* for progress */
+} tPicPlayer;
+
+static void picPlayPrim(tPicPlayer* player, tPrimNode *prim)
+{
+  cdCanvas* canvas = player->canvas;
+  cdCtxCanvas* ctxcanvas = player->ctxcanvas;
+  tPicPlayState* state = &player->state;
+  int p, n, scale = player->scale, 
+      xmin = player->xmin, ymin = player->ymin,
+      pic_xmin = player->pic_xmin, pic_ymin = player->pic_ymin;
+  double factorX = player->factorX, factorY = player->factorY;
+
+  switch (prim->type)
+  {
+  case CDPIC_LINE:
+    primUpdateAttrib_Line(ctxcanvas, state, prim, canvas);
+    cdCanvasLine(canvas, sScaleX(prim->param.lineboxrect.x1), sScaleY(prim->param.lineboxrect.y1), sScaleX(prim->param.lineboxrect.x2), sScaleY(prim->param.lineboxrect.y2));
+    break;
+  case CDPIC_FLINE:
+    primUpdateAttrib_Line(ctxcanvas, state, prim, canvas);
+    cdfCanvasLine(canvas, sfScaleX(prim->param.lineboxrectf.x1), sfScaleY(prim->param.lineboxrectf.y1), sfScaleX(prim->param.lineboxrectf.x2), sfScaleY(prim->param.lineboxrectf.y2));
+    break;
+  case CDPIC_RECT:
+    primUpdateAttrib_Line(ctxcanvas, state, prim, canvas);
+    cdCanvasRect(canvas, sScaleX(prim->param.lineboxrect.x1), sScaleX(prim->param.lineboxrect.x2), sScaleY(prim->param.lineboxrect.y1), sScaleY(prim->param.lineboxrect.y2));
+    break;
+  case CDPIC_FRECT:
+    primUpdateAttrib_Line(ctxcanvas, state, prim, canvas);
+    cdfCanvasRect(canvas, sfScaleX(prim->param.lineboxrectf.x1), sfScaleX(prim->param.lineboxrectf.x2), sfScaleY(prim->param.lineboxrectf.y1), sfScaleY(prim->param.lineboxrectf.y2));
+    break;
+  case CDPIC_BOX:
+    primUpdateAttrib_Fill(ctxcanvas, state, prim, canvas);
+    cdCanvasBox(canvas, sScaleX(prim->param.lineboxrect.x1), sScaleX(prim->param.lineboxrect.x2), sScaleY(prim->param.lineboxrect.y1), sScaleY(prim->param.lineboxrect.y2));
+    break;
+  case CDPIC_FBOX:
+    primUpdateAttrib_Fill(ctxcanvas, state, prim, canvas);
+    cdfCanvasBox(canvas, sfScaleX(prim->param.lineboxrectf.x1), sfScaleX(prim->param.lineboxrectf.x2), sfScaleY(prim->param.lineboxrectf.y1), sfScaleY(prim->param.lineboxrectf.y2));
+    break;
+  case CDPIC_ARC:
+    primUpdateAttrib_Line(ctxcanvas, state, prim, canvas);
+    cdCanvasArc(canvas, sScaleX(prim->param.arcsectorchord.xc), sScaleY(prim->param.arcsectorchord.yc), sScaleW(prim->param.arcsectorchord.w), sScaleH(prim->param.arcsectorchord.h), prim->param.arcsectorchord.angle1, prim->param.arcsectorchord.angle2);
+    break;
+  case CDPIC_FARC:
+    primUpdateAttrib_Line(ctxcanvas, state, prim, canvas);
+    cdfCanvasArc(canvas, sfScaleX(prim->param.arcsectorchordf.xc), sfScaleY(prim->param.arcsectorchordf.yc), sfScaleW(prim->param.arcsectorchordf.w), sfScaleH(prim->param.arcsectorchordf.h), prim->param.arcsectorchordf.angle1, prim->param.arcsectorchordf.angle2);
+    break;
+  case CDPIC_SECTOR:
+    primUpdateAttrib_Fill(ctxcanvas, state, prim, canvas);
+    cdCanvasSector(canvas, sScaleX(prim->param.arcsectorchord.xc), sScaleY(prim->param.arcsectorchord.yc), sScaleW(prim->param.arcsectorchord.w), sScaleH(prim->param.arcsectorchord.h), prim->param.arcsectorchord.angle1, prim->param.arcsectorchord.angle2);
+    break;
+  case CDPIC_FSECTOR:
+    primUpdateAttrib_Fill(ctxcanvas, state, prim, canvas);
+    cdfCanvasSector(canvas, sfScaleX(prim->param.arcsectorchordf.xc), sfScaleY(prim->param.arcsectorchordf.yc), sfScaleW(prim->param.arcsectorchordf.w), sfScaleH(prim->param.arcsectorchordf.h), prim->param.arcsectorchordf.angle1, prim->param.arcsectorchordf.angle2);
+    break;
+  case CDPIC_CHORD:
+    primUpdateAttrib_Fill(ctxcanvas, state, prim, canvas);
+    cdCanvasChord(canvas, sScaleX(prim->param.arcsectorchord.xc), sScaleY(prim->param.arcsectorchord.yc), sScaleW(prim->param.arcsectorchord.w), sScaleH(prim->param.arcsectorchord.h), prim->param.arcsectorchord.angle1, prim->param.arcsectorchord.angle2);
+    break;
+  case CDPIC_FCHORD:
+    primUpdateAttrib_Fill(ctxcanvas, state, prim, canvas);
+    cdfCanvasChord(canvas, sfScaleX(prim->param.arcsectorchordf.xc), sfScaleY(prim->param.arcsectorchordf.yc), sfScaleW(prim->param.arcsectorchordf.w), sfScaleH(prim->param.arcsectorchordf.h), prim->param.arcsectorchordf.angle1, prim->param.arcsectorchordf.angle2);
+    break;
+  case CDPIC_TEXT:
+    primUpdateAttrib_Text(ctxcanvas, state, prim, canvas);
+    cdCanvasText(canvas, sScaleX(prim->param.text.x), sScaleY(prim->param.text.y), prim->param.text.s);
+    break;
+  case CDPIC_FTEXT:
+    primUpdateAttrib_Text(ctxcanvas, state, prim, canvas);
+    cdfCanvasText(canvas, sfScaleX(prim->param.textf.x), sfScaleY(prim->param.textf.y), prim->param.textf.s);
+    break;
+  case CDPIC_POLY:
+    if (prim->param.poly.mode == CD_FILL)
+      primUpdateAttrib_Fill(ctxcanvas, state, prim, canvas);
+    else
+      primUpdateAttrib_Line(ctxcanvas, state, prim, canvas);
+    cdCanvasBegin(canvas, prim->param.poly.mode);
+    for (p = 0; p < prim->param.poly.n; p++)
+      cdCanvasVertex(canvas, sScaleX(prim->param.poly.points[p].x), sScaleY(prim->param.poly.points[p].y));
+    cdCanvasEnd(canvas);
+    break;
+  case CDPIC_FPOLY:
+    if (prim->param.poly.mode == CD_FILL)
+      primUpdateAttrib_Fill(ctxcanvas, state, prim, canvas);
+    else
+      primUpdateAttrib_Line(ctxcanvas, state, prim, canvas);
+    cdCanvasBegin(canvas, prim->param.polyf.mode);
+    for (p = 0; p < prim->param.polyf.n; p++)
+      cdfCanvasVertex(canvas, sfScaleX(prim->param.polyf.points[p].x), sfScaleY(prim->param.polyf.points[p].y));
+    cdCanvasEnd(canvas);
+    break;
+  case CDPIC_PATH:
+    if (prim->param.path.fill)
+      primUpdateAttrib_Fill(ctxcanvas, state, prim, canvas);
+    else
+      primUpdateAttrib_Line(ctxcanvas, state, prim, canvas);
+    cdCanvasBegin(canvas, CD_PATH);
+    n = 0;
+    for (p=0; p<prim->param.path.path_n; p++)
+    {
+      cdCanvasPathSet(canvas, prim->param.path.path[p]);
+
+      switch(prim->param.path.path[p])
+      {
+      case CD_PATH_MOVETO:
+      case CD_PATH_LINETO:
+        cdCanvasVertex(canvas, sScaleX(prim->param.path.points[n].x), sScaleY(prim->param.path.points[n].y));
+        n++;
+        break;
+      case CD_PATH_CURVETO:
+      case CD_PATH_ARC:
+        {
+          cdCanvasVertex(canvas, sScaleX(prim->param.path.points[n].x), sScaleY(prim->param.path.points[n].y));
+          cdCanvasVertex(canvas, sScaleX(prim->param.path.points[n+1].x), sScaleY(prim->param.path.points[n+1].y));
+          cdCanvasVertex(canvas, sScaleX(prim->param.path.points[n+2].x), sScaleY(prim->param.path.points[n+2].y));
+          n += 3;
+        }
+        break;
+      }
+    }
+    cdCanvasEnd(canvas);
+    break;
+  case CDPIC_FPATH:
+    if (prim->param.path.fill)
+      primUpdateAttrib_Fill(ctxcanvas, state, prim, canvas);
+    else
+      primUpdateAttrib_Line(ctxcanvas, state, prim, canvas);
+    cdCanvasBegin(canvas, CD_PATH);
+    n = 0;
+    for (p=0; p<prim->param.pathf.path_n; p++)
+    {
+      cdCanvasPathSet(canvas, prim->param.pathf.path[p]);
+
+      switch(prim->param.pathf.path[p])
+      {
+      case CD_PATH_MOVETO:
+      case CD_PATH_LINETO:
+        cdfCanvasVertex(canvas, sfScaleX(prim->param.pathf.points[n].x), sfScaleY(prim->param.pathf.points[n].y));
+        n++;
+        break;
+      case CD_PATH_CURVETO:
+      case CD_PATH_ARC:
+        {
+          cdfCanvasVertex(canvas, sfScaleX(prim->param.pathf.points[n].x), sfScaleY(prim->param.pathf.points[n].y));
+          cdfCanvasVertex(canvas, sfScaleX(prim->param.pathf.points[n+1].x), sfScaleY(prim->param.pathf.points[n+1].y));
+          cdfCanvasVertex(canvas, sfScaleX(prim->param.pathf.points[n+2].x), sfScaleY(prim->param.pathf.points[n+2].y));
+          n += 3;
+        }
+        break;
+      }
+    }
+    cdCanvasEnd(canvas);
+    break;
+  case CDPIC_IMAGERGB:
+    cdCanvasPutImageRectRGB(canvas, prim->param.imagergba.iw, prim->param.imagergba.ih, prim->param.imagergba.r, prim->param.imagergba.g, prim->param.imagergba.b, sScaleX(prim->param.imagergba.x), sScaleY(prim->param.imagergba.y), sScaleW(prim->param.imagergba.w), sScaleH(prim->param.imagergba.h), 0, 0, 0, 0);
+    break;
+  case CDPIC_IMAGERGBA:
+    cdCanvasPutImageRectRGBA(canvas, prim->param.imagergba.iw, prim->param.imagergba.ih, prim->param.imagergba.r, prim->param.imagergba.g, prim->param.imagergba.b, prim->param.imagergba.a, sScaleX(prim->param.imagergba.x), sScaleY(prim->param.imagergba.y), sScaleW(prim->param.imagergba.w), sScaleH(prim->param.imagergba.h), 0, 0, 0, 0);
+    break;
+  case CDPIC_IMAGEMAP:
+    cdCanvasPutImageRectMap(canvas, prim->param.imagemap.iw, prim->param.imagemap.ih, prim->param.imagemap.index, prim->param.imagemap.colors, sScaleX(prim->param.imagemap.x), sScaleY(prim->param.imagemap.y), sScaleW(prim->param.imagemap.w), sScaleH(prim->param.imagemap.h), 0, 0, 0, 0);
+    break;
+  case CDPIC_PIXEL:
+    cdCanvasPixel(canvas, sScaleX(prim->param.pixel.x), sScaleY(prim->param.pixel.y), prim->param.pixel.color);
+    break;
+  }
+}
+
+static void* cdplaybegin(cdCanvas* canvas, int xmin, int xmax, int ymin, int ymax, void *data)
+{
+  tPicPlayer* player;
   cdCanvas* pic_canvas = (cdCanvas*)data;
   cdCtxCanvas* ctxcanvas = pic_canvas->ctxcanvas;
-  int p, i, n, scale = 0, 
-      pic_xmin = ctxcanvas->xmin,
-      pic_ymin = ctxcanvas->ymin;
+  int b, scale = 0;
   double factorX = 1, factorY = 1;
   
   if (pic_canvas->w>1 && 
@@ -1003,179 +1710,954 @@ static int cdplay(cdCanvas* canvas, int xmin, int xmax, int ymin, int ymax, void
     int err;
     err = cdsizecb(canvas, pic_canvas->w, pic_canvas->h, pic_canvas->w_mm, pic_canvas->h_mm);
     if (err)
-      return CD_ERROR;
+      return NULL;
   }
 
-  prim = ctxcanvas->prim_first;
-  for (i = 0; i < ctxcanvas->prim_n; i++)
-  { 
-    switch (prim->type)
-    {
-    case CDPIC_LINE:
-      primUpdateAttrib_Line(prim, canvas);
-      cdCanvasLine(canvas, sScaleX(prim->param.lineboxrect.x1), sScaleY(prim->param.lineboxrect.y1), sScaleX(prim->param.lineboxrect.x2), sScaleY(prim->param.lineboxrect.y2));
-      break;
-    case CDPIC_FLINE:
-      primUpdateAttrib_Line(prim, canvas);
-      cdfCanvasLine(canvas, sfScaleX(prim->param.lineboxrectf.x1), sfScaleY(prim->param.lineboxrectf.y1), sfScaleX(prim->param.lineboxrectf.x2), sfScaleY(prim->param.lineboxrectf.y2));
-      break;
-    case CDPIC_RECT:
-      primUpdateAttrib_Line(prim, canvas);
-      cdCanvasRect(canvas, sScaleX(prim->param.lineboxrect.x1), sScaleX(prim->param.lineboxrect.x2), sScaleY(prim->param.lineboxrect.y1), sScaleY(prim->param.lineboxrect.y2));
-      break;
-    case CDPIC_FRECT:
-      primUpdateAttrib_Line(prim, canvas);
-      cdfCanvasRect(canvas, sfScaleX(prim->param.lineboxrectf.x1), sfScaleX(prim->param.lineboxrectf.x2), sfScaleY(prim->param.lineboxrectf.y1), sfScaleY(prim->param.lineboxrectf.y2));
-      break;
-    case CDPIC_BOX:
-      primUpdateAttrib_Fill(prim, canvas);
-      cdCanvasBox(canvas, sScaleX(prim->param.lineboxrect.x1), sScaleX(prim->param.lineboxrect.x2), sScaleY(prim->param.lineboxrect.y1), sScaleY(prim->param.lineboxrect.y2));
-      break;
-    case CDPIC_FBOX:
-      primUpdateAttrib_Fill(prim, canvas);
-      cdfCanvasBox(canvas, sfScaleX(prim->param.lineboxrectf.x1), sfScaleX(prim->param.lineboxrectf.x2), sfScaleY(prim->param.lineboxrectf.y1), sfScaleY(prim->param.lineboxrectf.y2));
-      break;
-    case CDPIC_ARC:
-      primUpdateAttrib_Line(prim, canvas);
-      cdCanvasArc(canvas, sScaleX(prim->param.arcsectorchord.xc), sScaleY(prim->param.arcsectorchord.yc), sScaleW(prim->param.arcsectorchord.w), sScaleH(prim->param.arcsectorchord.h), prim->param.arcsectorchord.angle1, prim->param.arcsectorchord.angle2);
-      break;
-    case CDPIC_FARC:
-      primUpdateAttrib_Line(prim, canvas);
-      cdfCanvasArc(canvas, sfScaleX(prim->param.arcsectorchordf.xc), sfScaleY(prim->param.arcsectorchordf.yc), sfScaleW(prim->param.arcsectorchordf.w), sfScaleH(prim->param.arcsectorchordf.h), prim->param.arcsectorchord.angle1, prim->param.arcsectorchord.angle2);
-      break;
-    case CDPIC_SECTOR:
-      primUpdateAttrib_Fill(prim, canvas);
-      cdCanvasSector(canvas, sScaleX(prim->param.arcsectorchord.xc), sScaleY(prim->param.arcsectorchord.yc), sScaleW(prim->param.arcsectorchord.w), sScaleH(prim->param.arcsectorchord.h), prim->param.arcsectorchord.angle1, prim->param.arcsectorchord.angle2);
-      break;
-    case CDPIC_FSECTOR:
-      primUpdateAttrib_Fill(prim, canvas);
-      cdfCanvasSector(canvas, sfScaleX(prim->param.arcsectorchordf.xc), sfScaleY(prim->param.arcsectorchordf.yc), sfScaleW(prim->param.arcsectorchordf.w), sfScaleH(prim->param.arcsectorchordf.h), prim->param.arcsectorchord.angle1, prim->param.arcsectorchord.angle2);
-      break;
-    case CDPIC_CHORD:
-      primUpdateAttrib_Fill(prim, canvas);
-      cdCanvasChord(canvas, sScaleX(prim->param.arcsectorchord.xc), sScaleY(prim->param.arcsectorchord.yc), sScaleW(prim->param.arcsectorchord.w), sScaleH(prim->param.arcsectorchord.h), prim->param.arcsectorchord.angle1, prim->param.arcsectorchord.angle2);
-      break;
-    case CDPIC_FCHORD:
-      primUpdateAttrib_Fill(prim, canvas);
-      cdfCanvasChord(canvas, sfScaleX(prim->param.arcsectorchordf.xc), sfScaleY(prim->param.arcsectorchordf.yc), sfScaleW(prim->param.arcsectorchordf.w), sfScaleH(prim->param.arcsectorchordf.h), prim->param.arcsectorchord.angle1, prim->param.arcsectorchord.angle2);
-      break;
-    case CDPIC_TEXT:
-      primUpdateAttrib_Text(prim, canvas);
-      cdCanvasText(canvas, sScaleX(prim->param.text.x), sScaleY(prim->param.text.y), prim->param.text.s);
-      break;
-    case CDPIC_FTEXT:
-      primUpdateAttrib_Text(prim, canvas);
-      cdfCanvasText(canvas, sfScaleX(prim->param.textf.x), sfScaleY(prim->param.textf.y), prim->param.text.s);
-      break;
-    case CDPIC_POLY:
-      if (prim->param.poly.mode == CD_FILL)
-        primUpdateAttrib_Fill(prim, canvas);
-      else
-        primUpdateAttrib_Line(prim, canvas);
-      cdCanvasBegin(canvas, prim->param.poly.mode);
-      for (p = 0; p < prim->param.poly.n; p++)
-        cdCanvasVertex(canvas, sScaleX(prim->param.poly.points[p].x), sScaleY(prim->param.poly.points[p].y));
-      cdCanvasEnd(canvas);
-      break;
-    case CDPIC_FPOLY:
-      if (prim->param.poly.mode == CD_FILL)
-        primUpdateAttrib_Fill(prim, canvas);
-      else
-        primUpdateAttrib_Line(prim, canvas);
-      cdCanvasBegin(canvas, prim->param.polyf.mode);
-      for (p = 0; p < prim->param.polyf.n; p++)
-        cdfCanvasVertex(canvas, sfScaleX(prim->param.polyf.points[p].x), sfScaleY(prim->param.polyf.points[p].y));
-      cdCanvasEnd(canvas);
-      break;
-    case CDPIC_PATH:
-      if (prim->param.path.fill)
-        primUpdateAttrib_Fill(prim, canvas);
-      else
-        primUpdateAttrib_Line(prim, canvas);
-      cdCanvasBegin(canvas, CD_PATH);
-      n = 0;
-      for (p=0; p<prim->param.path.path_n; p++)
-      {
-        cdCanvasPathSet(canvas, prim->param.path.path[p]);
+  player = (tPicPlayer*)malloc(sizeof(tPicPlayer));
+  player->canvas = canvas;
+  player->ctxcanvas = ctxcanvas;
+  player->scale = scale;
+  player->xmin = xmin;
+  player->ymin = ymin;
+  player->pic_xmin = ctxcanvas->xmin;
+  player->pic_ymin = ctxcanvas->ymin;
+  player->factorX = factorX;
+  player->factorY = factorY;
+
+  player->view.xmin = player->view.xmax = player->view.ymin = player->view.ymax = 0;
+  player->cull = picGetView(canvas, ctxcanvas, scale, xmin, ymin, player->pic_xmin, player->pic_ymin, factorX, factorY, &player->view);
+
+  player->b = 0;
+  player->i = 0;
+  player->prim = ctxcanvas->block_n? ctxcanvas->blocks[0].first: NULL;
+  player->prim_count = 0;
+  player->prim_n = 0;
+  for (b = 0; b < ctxcanvas->block_n; b++)
+    player->prim_n += ctxcanvas->blocks[b].n;
+
+  return player;
+}
 
-        switch(prim->param.path.path[p])
-        {
-        case CD_PATH_MOVETO:
-        case CD_PATH_LINETO:
-          cdCanvasVertex(canvas, sScaleX(prim->param.path.points[n].x), sScaleY(prim->param.path.points[n].y));
-          n++;
-          break;
-        case CD_PATH_CURVETO:
-        case CD_PATH_ARC:
-          {
-            cdCanvasVertex(canvas, sScaleX(prim->param.path.points[n].x), sScaleY(prim->param.path.points[n].y));
-            cdCanvasVertex(canvas, sScaleX(prim->param.path.points[n+1].x), sScaleY(prim->param.path.points[n+1].y));
-            cdCanvasVertex(canvas, sScaleX(prim->param.path.points[n+2].x), sScaleY(prim->param.path.points[n+2].y));
-            n += 3;
-          }
-          break;
-        }
-      }
-      cdCanvasEnd(canvas);
-      break;
-    case CDPIC_FPATH:
-      if (prim->param.path.fill)
-        primUpdateAttrib_Fill(prim, canvas);
-      else
-        primUpdateAttrib_Line(prim, canvas);
-      cdCanvasBegin(canvas, CD_PATH);
-      n = 0;
-      for (p=0; p<prim->param.pathf.path_n; p++)
-      {
-        cdCanvasPathSet(canvas, prim->param.pathf.path[p]);
+static int cdplaystep(void* data, int count)
+{
+  tPicPlayer* player = (tPicPlayer*)data;
+  cdCtxCanvas* ctxcanvas = player->ctxcanvas;
+  tPicView view = player->view;
+  int cull = player->cull;
 
-        switch(prim->param.pathf.path[p])
-        {
-        case CD_PATH_MOVETO:
-        case CD_PATH_LINETO:
-          cdfCanvasVertex(canvas, sfScaleX(prim->param.pathf.points[n].x), sfScaleY(prim->param.pathf.points[n].y));
-          n++;
-          break;
-        case CD_PATH_CURVETO:
-        case CD_PATH_ARC:
-          {
-            cdfCanvasVertex(canvas, sfScaleX(prim->param.pathf.points[n].x), sfScaleY(prim->param.pathf.points[n].y));
-            cdfCanvasVertex(canvas, sfScaleX(prim->param.pathf.points[n+1].x), sfScaleY(prim->param.pathf.points[n+1].y));
-            cdfCanvasVertex(canvas, sfScaleX(prim->param.pathf.points[n+2].x), sfScaleY(prim->param.pathf.points[n+2].y));
-            n += 3;
-          }
-          break;
-        }
-      }
-      cdCanvasEnd(canvas);
-      break;
-    case CDPIC_IMAGERGB:
-      cdCanvasPutImageRectRGB(canvas, prim->param.imagergba.iw, prim->param.imagergba.ih, prim->param.imagergba.r, prim->param.imagergba.g, prim->param.imagergba.b, sScaleX(prim->param.imagergba.x), sScaleY(prim->param.imagergba.y), sScaleW(prim->param.imagergba.w), sScaleH(prim->param.imagergba.h), 0, 0, 0, 0);
-      break;
-    case CDPIC_IMAGERGBA:
-      cdCanvasPutImageRectRGBA(canvas, prim->param.imagergba.iw, prim->param.imagergba.ih, prim->param.imagergba.r, prim->param.imagergba.g, prim->param.imagergba.b, prim->param.imagergba.a, sScaleX(prim->param.imagergba.x), sScaleY(prim->param.imagergba.y), sScaleW(prim->param.imagergba.w), sScaleH(prim->param.imagergba.h), 0, 0, 0, 0);
-      break;
-    case CDPIC_IMAGEMAP:
-      cdCanvasPutImageRectMap(canvas, prim->param.imagemap.iw, prim->param.imagemap.ih, prim->param.imagemap.index, prim->param.imagemap.colors, sScaleX(prim->param.imagemap.x), sScaleY(prim->param.imagemap.y), sScaleW(prim->param.imagemap.w), sScaleH(prim->param.imagemap.h), 0, 0, 0, 0);
-      break;
-    case CDPIC_PIXEL:
-      cdCanvasPixel(canvas, sScaleX(prim->param.pixel.x), sScaleY(prim->param.pixel.y), prim->param.pixel.color);
-      break;
+  /* the application can change the attributes of the canvas between steps, 
+     so the attributes set in the previous step are set again when used */
+  picPlayStateInit(&player->state);
+
+  while (player->b < ctxcanvas->block_n)
+  {
+    tPicBlock *block = ctxcanvas->blocks + player->b;
+
+    if (player->i == 0 && cull && !block->unbounded && sOutsideView(block))
+      player->i = block->n;  /* skip the whole block */
+
+    for (; player->i < block->n; player->i++, player->prim = player->prim->next)
+    { 
+      if (count == 0)
+        return CD_PLAYING;
+
+      if (cull && sOutsideView(player->prim))
+        continue;
+
+      picPlayPrim(player, player->prim);
+      count--;
     }
 
-    prim = prim->next;
+    player->prim_count += block->n;
+    player->b++;
+    player->i = 0;
+    if (player->b < ctxcanvas->block_n)
+      player->prim = ctxcanvas->blocks[player->b].first;
   }
 
   return CD_OK;
 }
 
+static double cdplayprogress(void* data)
+{
+  tPicPlayer* player = (tPicPlayer*)data;
+  if (player->prim_n == 0)
+    return 100;
+  return ((player->prim_count + player->i) * 100.) / player->prim_n;
+}
+
+static void cdplayend(void* data)
+{
+  free(data);
+}
+
+static int cdplay(cdCanvas* canvas, int xmin, int xmax, int ymin, int ymax, void *data)
+{
+  int ret;
+  void* player = cdplaybegin(canvas, xmin, xmax, ymin, ymax, data);
+  if (!player)
+    return CD_ERROR;
+
+  ret = cdplaystep(player, INT_MAX);
+  cdplayend(player);
+  return ret;
+}
+
 static void cdkillcanvas(cdCtxCanvas *ctxcanvas)
 {
   cdclear(ctxcanvas);
+  picChunkFreeList(ctxcanvas->chunk_first);
+  if (ctxcanvas->blocks) free(ctxcanvas->blocks);
+  if (ctxcanvas->line_attribs) free(ctxcanvas->line_attribs);
+  if (ctxcanvas->fill_attribs) free(ctxcanvas->fill_attribs);
+  if (ctxcanvas->text_attribs) free(ctxcanvas->text_attribs);
   memset(ctxcanvas, 0, sizeof(cdCtxCanvas));
   free(ctxcanvas);
 }
 
+/*****************/
+/* Serialization */
+/*****************/
+
+/* Binary blob, all values are little endian:
+     header: "CDPIC", version (1 byte), 2 reserved bytes
+     bounding box (4 int32), largest line width (int32), resolution (double)
+     number of line, fill and text attributes and of primitives (4 int32)
+     line, fill and text attribute tables
+     primitives: type, attribute index, bounds (6 int32), then the parameters */
+#define PIC_BLOB_VERSION 1
+#define PIC_BLOB_HEADER_SIZE 8
+
+typedef struct _tPicWriter
+{
+  unsigned char* data;
+  int size, used;
+} tPicWriter;
+
+static unsigned char* picPutReserve(tPicWriter* writer, int size)
+{
+  unsigned char* ptr;
+  if (writer->used + size > writer->size)
+  {
+    writer->size = 2*writer->size + size;
+    writer->data = (unsigned char*)realloc(writer->data, writer->size);
+  }
+  ptr = writer->data + writer->used;
+  writer->used += size;
+  return ptr;
+}
+
+static void picPutInt(tPicWriter* writer, int v)
+{
+  unsigned char* b = picPutReserve(writer, 4);
+  unsigned int u = (unsigned int)v;
+  b[0] = (unsigned char)(u & 0xFF);
+  b[1] = (unsigned char)((u >> 8) & 0xFF);
+  b[2] = (unsigned char)((u >> 16) & 0xFF);
+  b[3] = (unsigned char)((u >> 24) & 0xFF);
+}
+
+static void picPutColor(tPicWriter* writer, long color)
+{
+  picPutInt(writer, (int)(unsigned int)color);
+}
+
+static int picBigEndian(void)
+{
+  int test = 1;
+  return (*(unsigned char*)&test) == 0;
+}
+
+static void picPutDouble(tPicWriter* writer, double v)
+{
+  unsigned char d[8];
+  unsigned char* b = picPutReserve(writer, 8);
+  int i, big_endian = picBigEndian();
+  memcpy(d, &v, 8);
+  for (i = 0; i < 8; i++)
+    b[i] = big_endian? d[7-i]: d[i];
+}
+
+static void picPutData(tPicWriter* writer, const void* data, int size)
+{
+  if (size > 0)
+    memcpy(picPutReserve(writer, size), data, size);
+}
+
+static void picPutString(tPicWriter* writer, const char* str)
+{
+  int len = str? (int)strlen(str): -1;
+  picPutInt(writer, len);
+  picPutData(writer, str, len);
+}
+
+static void picPutPoints(tPicWriter* writer, const cdPoint* points, int n)
+{
+  int i;
+  for (i = 0; i < n; i++)
+  {
+    picPutInt(writer, points[i].x);
+    picPutInt(writer, points[i].y);
+  }
+}
+
+static void picPutfPoints(tPicWriter* writer, const cdfPoint* points, int n)
+{
+  int i;
+  for (i = 0; i < n; i++)
+  {
+    picPutDouble(writer, points[i].x);
+    picPutDouble(writer, points[i].y);
+  }
+}
+
+static void picPutPrim(tPicWriter* writer, tPrimNode *prim)
+{
+  int i, size, n;
+
+  picPutInt(writer, prim->type);
+  picPutInt(writer, prim->attrib);
+  picPutInt(writer, prim->xmin);
+  picPutInt(writer, prim->xmax);
+  picPutInt(writer, prim->ymin);
+  picPutInt(writer, prim->ymax);
+
+  switch (prim->type)
+  {
+  case CDPIC_LINE:
+  case CDPIC_RECT:
+  case CDPIC_BOX:
+    picPutInt(writer, prim->param.lineboxrect.x1);
+    picPutInt(writer, prim->param.lineboxrect.y1);
+    picPutInt(writer, prim->param.lineboxrect.x2);
+    picPutInt(writer, prim->param.lineboxrect.y2);
+    break;
+  case CDPIC_FLINE:
+  case CDPIC_FRECT:
+  case CDPIC_FBOX:
+    picPutDouble(writer, prim->param.lineboxrectf.x1);
+    picPutDouble(writer, prim->param.lineboxrectf.y1);
+    picPutDouble(writer, prim->param.lineboxrectf.x2);
+    picPutDouble(writer, prim->param.lineboxrectf.y2);
+    break;
+  case CDPIC_ARC:
+  case CDPIC_SECTOR:
+  case CDPIC_CHORD:
+    picPutInt(writer, prim->param.arcsectorchord.xc);
+    picPutInt(writer, prim->param.arcsectorchord.yc);
+    picPutInt(writer, prim->param.arcsectorchord.w);
+    picPutInt(writer, prim->param.arcsectorchord.h);
+    picPutDouble(writer, prim->param.arcsectorchord.angle1);
+    picPutDouble(writer, prim->param.arcsectorchord.angle2);
+    break;
+  case CDPIC_FARC:
+  case CDPIC_FSECTOR:
+  case CDPIC_FCHORD:
+    picPutDouble(writer, prim->param.arcsectorchordf.xc);
+    picPutDouble(writer, prim->param.arcsectorchordf.yc);
+    picPutDouble(writer, prim->param.arcsectorchordf.w);
+    picPutDouble(writer, prim->param.arcsectorchordf.h);
+    picPutDouble(writer, prim->param.arcsectorchordf.angle1);
+    picPutDouble(writer, prim->param.arcsectorchordf.angle2);
+    break;
+  case CDPIC_TEXT:
+    picPutInt(writer, prim->param.text.x);
+    picPutInt(writer, prim->param.text.y);
+    picPutString(writer, prim->param.text.s);
+    break;
+  case CDPIC_FTEXT:
+    picPutDouble(writer, prim->param.textf.x);
+    picPutDouble(writer, prim->param.textf.y);
+    picPutString(writer, prim->param.textf.s);
+    break;
+  case CDPIC_POLY:
+    picPutInt(writer, prim->param.poly.mode);
+    picPutInt(writer, prim->param.poly.n);
+    picPutPoints(writer, prim->param.poly.points, prim->param.poly.n);
+    break;
+  case CDPIC_FPOLY:
+    picPutInt(writer, prim->param.polyf.mode);
+    picPutInt(writer, prim->param.polyf.n);
+    picPutfPoints(writer, prim->param.polyf.points, prim->param.polyf.n);
+    break;
+  case CDPIC_PATH:
+    picPutInt(writer, prim->param.path.fill);
+    picPutInt(writer, prim->param.path.n);
+    picPutPoints(writer, prim->param.path.points, prim->param.path.n);
+    picPutInt(writer, prim->param.path.path_n);
+    for (i = 0; i < prim->param.path.path_n; i++)
+      picPutInt(writer, prim->param.path.path[i]);
+    break;
+  case CDPIC_FPATH:
+    picPutInt(writer, prim->param.pathf.fill);
+    picPutInt(writer, prim->param.pathf.n);
+    picPutfPoints(writer, prim->param.pathf.points, prim->param.pathf.n);
+    picPutInt(writer, prim->param.pathf.path_n);
+    for (i = 0; i < prim->param.pathf.path_n; i++)
+      picPutInt(writer, prim->param.pathf.path[i]);
+    break;
+  case CDPIC_PIXEL:
+    picPutInt(writer, prim->param.pixel.x);
+    picPutInt(writer, prim->param.pixel.y);
+    picPutColor(writer, prim->param.pixel.color);
+    break;
+  case CDPIC_IMAGEMAP:
+    picPutInt(writer, prim->param.imagemap.iw);
+    picPutInt(writer, prim->param.imagemap.ih);
+    picPutInt(writer, prim->param.imagemap.x);
+    picPutInt(writer, prim->param.imagemap.y);
+    picPutInt(writer, prim->param.imagemap.w);
+    picPutInt(writer, prim->param.imagemap.h);
+    size = prim->param.imagemap.iw*prim->param.imagemap.ih;
+    picPutData(writer, prim->param.imagemap.index, size);
+    n = 0;  /* only the used colors are initialized */
+    for (i = 0; i < size; i++)
+    {
+      if (prim->param.imagemap.index[i] >= n)
+        n = prim->param.imagemap.index[i]+1;
+    }
+    picPutInt(writer, n);
+    for (i = 0; i < n; i++)
+      picPutColor(writer, prim->param.imagemap.colors[i]);
+    break;
+  case CDPIC_IMAGERGB:
+  case CDPIC_IMAGERGBA:
+    picPutInt(writer, prim->param.imagergba.iw);
+    picPutInt(writer, prim->param.imagergba.ih);
+    picPutInt(writer, prim->param.imagergba.x);
+    picPutInt(writer, prim->param.imagergba.y);
+    picPutInt(writer, prim->param.imagergba.w);
+    picPutInt(writer, prim->param.imagergba.h);
+    size = prim->param.imagergba.iw*prim->param.imagergba.ih;
+    /* planes are contiguous */
+    picPutData(writer, prim->param.imagergba.r, (prim->type == CDPIC_IMAGERGBA? 4: 3)*size);
+    break;
+  }
+}
+
+unsigned char* cdPictureSaveData(cdCanvas* canvas, int *size)
+{
+  cdCtxCanvas *ctxcanvas;
+  tPicWriter writer;
+  tPrimNode *prim;
+  int i;
+
+  if (!canvas || cdCanvasGetContext(canvas) != CD_PICTURE)
+    return NULL;
+
+  ctxcanvas = canvas->ctxcanvas;
+
+  writer.size = PIC_CHUNK_SIZE;
+  writer.used = 0;
+  writer.data = (unsigned char*)malloc(writer.size);
+
+  picPutData(&writer, "CDPIC", 5);
+  *picPutReserve(&writer, 1) = PIC_BLOB_VERSION;
+  memset(picPutReserve(&writer, 2), 0, 2);
+
+  picPutInt(&writer, ctxcanvas->xmin);
+  picPutInt(&writer, ctxcanvas->xmax);
+  picPutInt(&writer, ctxcanvas->ymin);
+  picPutInt(&writer, ctxcanvas->ymax);
+  picPutInt(&writer, ctxcanvas->max_ew);
+  picPutDouble(&writer, canvas->xres);
+
+  picPutInt(&writer, ctxcanvas->line_attrib_n);
+  picPutInt(&writer, ctxcanvas->fill_attrib_n);
+  picPutInt(&writer, ctxcanvas->text_attrib_n);
+  picPutInt(&writer, ctxcanvas->prim_n);
+
+  for (i = 0; i < ctxcanvas->line_attrib_n; i++)
+  {
+    tLineAttrib *attrib = ctxcanvas->line_attribs + i;
+    int d;
+    picPutColor(&writer, attrib->foreground);
+    picPutColor(&writer, attrib->background);
+    picPutInt(&writer, attrib->back_opacity);
+    picPutInt(&writer, attrib->line_style);
+    picPutInt(&writer, attrib->line_width);
+    picPutInt(&writer, attrib->line_cap);
+    picPutInt(&writer, attrib->line_join);
+    picPutInt(&writer, attrib->line_dashes_count);
+    for (d = 0; d < attrib->line_dashes_count; d++)
+      picPutInt(&writer, attrib->line_dashes[d]);
+  }
+
+  for (i = 0; i < ctxcanvas->fill_attrib_n; i++)
+  {
+    tFillAttrib *attrib = ctxcanvas->fill_attribs + i;
+    int p, pattern_size = attrib->pattern? attrib->pattern_w*attrib->pattern_h: 0,
+           stipple_size = attrib->stipple? attrib->stipple_w*attrib->stipple_h: 0;
+    picPutColor(&writer, attrib->foreground);
+    picPutColor(&writer, attrib->background);
+    picPutInt(&writer, attrib->back_opacity);
+    picPutInt(&writer, attrib->interior_style);
+    picPutInt(&writer, attrib->hatch_style);
+    picPutInt(&writer, attrib->fill_mode);
+    picPutInt(&writer, attrib->pattern_w);
+    picPutInt(&writer, attrib->pattern_h);
+    picPutInt(&writer, pattern_size);
+    for (p = 0; p < pattern_size; p++)
+      picPutColor(&writer, attrib->pattern[p]);
+    picPutInt(&writer, attrib->stipple_w);
+    picPutInt(&writer, attrib->stipple_h);
+    picPutInt(&writer, stipple_size);
+    picPutData(&writer, attrib->stipple, stipple_size);
+  }
+
+  for (i = 0; i < ctxcanvas->text_attrib_n; i++)
+  {
+    tTextAttrib *attrib = ctxcanvas->text_attribs + i;
+    picPutColor(&writer, attrib->foreground);
+    picPutInt(&writer, attrib->font_style);
+    picPutInt(&writer, attrib->font_size);
+    picPutInt(&writer, attrib->text_alignment);
+    picPutDouble(&writer, attrib->text_orientation);
+    picPutString(&writer, attrib->font_type_face);
+    picPutString(&writer, attrib->native_font);
+  }
+
+  for (prim = ctxcanvas->prim_first; prim; prim = prim->next)
+    picPutPrim(&writer, prim);
+
+  *size = writer.used;
+  return writer.data;
+}
+
+typedef struct _tPicReader
+{
+  const unsigned char *data, *end;
+  int error;
+} tPicReader;
+
+static const unsigned char* picGetData(tPicReader* reader, int size)
+{
+  const unsigned char* data = reader->data;
+  if (size < 0 || reader->end - reader->data < size)
+  {
+    reader->error = 1;
+    reader->data = reader->end;
+    return NULL;
+  }
+  reader->data += size;
+  return data;
+}
+
+static int picGetInt(tPicReader* reader)
+{
+  const unsigned char* b = picGetData(reader, 4);
+  if (!b)
+    return 0;
+  return (int)((unsigned int)b[0] | ((unsigned int)b[1] << 8) | ((unsigned int)b[2] << 16) | ((unsigned int)b[3] << 24));
+}
+
+static long picGetColor(tPicReader* reader)
+{
+  return (long)(unsigned int)picGetInt(reader);
+}
+
+static double picGetDouble(tPicReader* reader)
+{
+  unsigned char d[8];
+  double v = 0;
+  int i, big_endian = picBigEndian();
+  const unsigned char* b = picGetData(reader, 8);
+  if (!b)
+    return 0;
+  for (i = 0; i < 8; i++)
+    d[i] = big_endian? b[7-i]: b[i];
+  memcpy(&v, d, 8);
+  return v;
+}
+
+/* returns 0 if there is not enough data for count elements */
+static int picGetCount(tPicReader* reader, int count, int elem_size)
+{
+  if (count < 0 || count > (reader->end - reader->data)/elem_size)
+  {
+    reader->error = 1;
+    return 0;
+  }
+  return 1;
+}
+
+static char* picGetString(cdCtxCanvas *ctxcanvas, tPicReader* reader)
+{
+  int len = picGetInt(reader);
+  const unsigned char* str;
+  if (len < 0)
+    return NULL;
+  str = picGetData(reader, len);
+  if (!str)
+    return NULL;
+  return picAllocStr(ctxcanvas, (const char*)str, len);
+}
+
+static cdPoint* picGetPoints(cdCtxCanvas *ctxcanvas, tPicReader* reader, int n)
+{
+  int i;
+  cdPoint* points;
+  if (!picGetCount(reader, n, 8))
+    return NULL;
+  points = (cdPoint*)picAlloc(ctxcanvas, n*sizeof(cdPoint));
+  for (i = 0; i < n; i++)
+  {
+    points[i].x = picGetInt(reader);
+    points[i].y = picGetInt(reader);
+  }
+  return points;
+}
+
+static cdfPoint* picGetfPoints(cdCtxCanvas *ctxcanvas, tPicReader* reader, int n)
+{
+  int i;
+  cdfPoint* points;
+  if (!picGetCount(reader, n, 16))
+    return NULL;
+  points = (cdfPoint*)picAlloc(ctxcanvas, n*sizeof(cdfPoint));
+  for (i = 0; i < n; i++)
+  {
+    points[i].x = picGetDouble(reader);
+    points[i].y = picGetDouble(reader);
+  }
+  return points;
+}
+
+static int* picGetInts(cdCtxCanvas *ctxcanvas, tPicReader* reader, int n)
+{
+  int i, *values;
+  if (!picGetCount(reader, n, 4))
+    return NULL;
+  values = (int*)picAlloc(ctxcanvas, n*sizeof(int));
+  for (i = 0; i < n; i++)
+    values[i] = picGetInt(reader);
+  return values;
+}
+
+/* size of an image with w*h pixels, -1 if invalid */
+#define picImageSize(_w, _h) (((_w) > 0 && (_h) > 0 && (_w) <= INT_MAX/4/(_h))? (_w)*(_h): -1)
+
+/* the path actions must use exactly the n points, as picPlayPrim expects */
+static int picCheckPath(const int* path, int path_n, int n)
+{
+  int p, count = 0;
+  for (p = 0; p < path_n; p++)
+  {
+    switch(path[p])
+    {
+    case CD_PATH_MOVETO:
+    case CD_PATH_LINETO:
+      count++;
+      break;
+    case CD_PATH_CURVETO:
+    case CD_PATH_ARC:
+      count += 3;
+      break;
+    }
+
+    if (count > n)
+      return 0;
+  }
+  return count == n;
+}
+
+static int picGetPrimParam(cdCtxCanvas *ctxcanvas, tPicReader* reader, tPrimNode *prim)
+{
+  int i, size;
+
+  switch (prim->type)
+  {
+  case CDPIC_LINE:
+  case CDPIC_RECT:
+  case CDPIC_BOX:
+    prim->param.lineboxrect.x1 = picGetInt(reader);
+    prim->param.lineboxrect.y1 = picGetInt(reader);
+    prim->param.lineboxrect.x2 = picGetInt(reader);
+    prim->param.lineboxrect.y2 = picGetInt(reader);
+    return prim->type == CDPIC_BOX? ctxcanvas->fill_attrib_n: ctxcanvas->line_attrib_n;
+  case CDPIC_FLINE:
+  case CDPIC_FRECT:
+  case CDPIC_FBOX:
+    prim->param.lineboxrectf.x1 = picGetDouble(reader);
+    prim->param.lineboxrectf.y1 = picGetDouble(reader);
+    prim->param.lineboxrectf.x2 = picGetDouble(reader);
+    prim->param.lineboxrectf.y2 = picGetDouble(reader);
+    return prim->type == CDPIC_FBOX? ctxcanvas->fill_attrib_n: ctxcanvas->line_attrib_n;
+  case CDPIC_ARC:
+  case CDPIC_SECTOR:
+  case CDPIC_CHORD:
+    prim->param.arcsectorchord.xc = picGetInt(reader);
+    prim->param.arcsectorchord.yc = picGetInt(reader);
+    prim->param.arcsectorchord.w = picGetInt(reader);
+    prim->param.arcsectorchord.h = picGetInt(reader);
+    prim->param.arcsectorchord.angle1 = picGetDouble(reader);
+    prim->param.arcsectorchord.angle2 = picGetDouble(reader);
+    return prim->type == CDPIC_ARC? ctxcanvas->line_attrib_n: ctxcanvas->fill_attrib_n;
+  case CDPIC_FARC:
+  case CDPIC_FSECTOR:
+  case CDPIC_FCHORD:
+    prim->param.arcsectorchordf.xc = picGetDouble(reader);
+    prim->param.arcsectorchordf.yc = picGetDouble(reader);
+    prim->param.arcsectorchordf.w = picGetDouble(reader);
+    prim->param.arcsectorchordf.h = picGetDouble(reader);
+    prim->param.arcsectorchordf.angle1 = picGetDouble(reader);
+    prim->param.arcsectorchordf.angle2 = picGetDouble(reader);
+    return prim->type == CDPIC_FARC? ctxcanvas->line_attrib_n: ctxcanvas->fill_attrib_n;
+  case CDPIC_TEXT:
+    prim->param.text.x = picGetInt(reader);
+    prim->param.text.y = picGetInt(reader);
+    prim->param.text.s = picGetString(ctxcanvas, reader);
+    if (!prim->param.text.s) return -1;
+    return ctxcanvas->text_attrib_n;
+  case CDPIC_FTEXT:
+    prim->param.textf.x = picGetDouble(reader);
+    prim->param.textf.y = picGetDouble(reader);
+    prim->param.textf.s = picGetString(ctxcanvas, reader);
+    if (!prim->param.textf.s) return -1;
+    return ctxcanvas->text_attrib_n;
+  case CDPIC_POLY:
+    prim->param.poly.mode = picGetInt(reader);
+    prim->param.poly.n = picGetInt(reader);
+    prim->param.poly.points = picGetPoints(ctxcanvas, reader, prim->param.poly.n);
+    if (!prim->param.poly.points) return -1;
+    return prim->param.poly.mode == CD_FILL? ctxcanvas->fill_attrib_n: ctxcanvas->line_attrib_n;
+  case CDPIC_FPOLY:
+    prim->param.polyf.mode = picGetInt(reader);
+    prim->param.polyf.n = picGetInt(reader);
+    prim->param.polyf.points = picGetfPoints(ctxcanvas, reader, prim->param.polyf.n);
+    if (!prim->param.polyf.points) return -1;
+    return prim->param.polyf.mode == CD_FILL? ctxcanvas->fill_attrib_n: ctxcanvas->line_attrib_n;
+  case CDPIC_PATH:
+    prim->param.path.fill = picGetInt(reader);
+    prim->param.path.n = picGetInt(reader);
+    prim->param.path.points = picGetPoints(ctxcanvas, reader, prim->param.path.n);
+    if (!prim->param.path.points) return -1;
+    prim->param.path.path_n = picGetInt(reader);
+    prim->param.path.path = picGetInts(ctxcanvas, reader, prim->param.path.path_n);
+    if (!prim->param.path.path) return -1;
+    if (!picCheckPath(prim->param.path.path, prim->param.path.path_n, prim->param.path.n)) return -1;
+    return prim->param.path.fill? ctxcanvas->fill_attrib_n: ctxcanvas->line_attrib_n;
+  case CDPIC_FPATH:
+    prim->param.pathf.fill = picGetInt(reader);
+    prim->param.pathf.n = picGetInt(reader);
+    prim->param.pathf.points = picGetfPoints(ctxcanvas, reader, prim->param.pathf.n);
+    if (!prim->param.pathf.points) return -1;
+    prim->param.pathf.path_n = picGetInt(reader);
+    prim->param.pathf.path = picGetInts(ctxcanvas, reader, prim->param.pathf.path_n);
+    if (!prim->param.pathf.path) return -1;
+    if (!picCheckPath(prim->param.pathf.path, prim->param.pathf.path_n, prim->param.pathf.n)) return -1;
+    return prim->param.pathf.fill? ctxcanvas->fill_attrib_n: ctxcanvas->line_attrib_n;
+  case CDPIC_PIXEL:
+    prim->param.pixel.x = picGetInt(reader);
+    prim->param.pixel.y = picGetInt(reader);
+    prim->param.pixel.color = picGetColor(reader);
+    return INT_MAX;
+  case CDPIC_IMAGEMAP:
+    prim->param.imagemap.iw = picGetInt(reader);
+    prim->param.imagemap.ih = picGetInt(reader);
+    prim->param.imagemap.x = picGetInt(reader);
+    prim->param.imagemap.y = picGetInt(reader);
+    prim->param.imagemap.w = picGetInt(reader);
+    prim->param.imagemap.h = picGetInt(reader);
+    size = picImageSize(prim->param.imagemap.iw, prim->param.imagemap.ih);
+    if (size < 0 || !picGetCount(reader, size, 1)) return -1;
+    prim->param.imagemap.index = picAllocCopy(ctxcanvas, picGetData(reader, size), size);
+    size = picGetInt(reader);
+    if (size < 0 || size > 256 || !picGetCount(reader, size, 4)) return -1;
+    prim->param.imagemap.colors = picAlloc(ctxcanvas, 256*sizeof(long));
+    memset(prim->param.imagemap.colors, 0, 256*sizeof(long));
+    for (i = 0; i < size; i++)
+      prim->param.imagemap.colors[i] = picGetColor(reader);
+    return INT_MAX;
+  case CDPIC_IMAGERGB:
+  case CDPIC_IMAGERGBA:
+    prim->param.imagergba.iw = picGetInt(reader);
+    prim->param.imagergba.ih = picGetInt(reader);
+    prim->param.imagergba.x = picGetInt(reader);
+    prim->param.imagergba.y = picGetInt(reader);
+    prim->param.imagergba.w = picGetInt(reader);
+    prim->param.imagergba.h = picGetInt(reader);
+    size = picImageSize(prim->param.imagergba.iw, prim->param.imagergba.ih);
+    if (size < 0 || !picGetCount(reader, size, prim->type == CDPIC_IMAGERGBA? 4: 3)) return -1;
+    prim->param.imagergba.r = picAllocCopy(ctxcanvas, picGetData(reader, (prim->type == CDPIC_IMAGERGBA? 4: 3)*size), (prim->type == CDPIC_IMAGERGBA? 4: 3)*size);
+    prim->param.imagergba.g = prim->param.imagergba.r + size;
+    prim->param.imagergba.b = prim->param.imagergba.g + size;
+    if (prim->type == CDPIC_IMAGERGBA)
+      prim->param.imagergba.a = prim->param.imagergba.b + size;
+    return INT_MAX;
+  }
+
+  return -1;
+}
+
+static size_t picPrimSize(tPrim type)
+{
+  switch (type)
+  {
+  case CDPIC_LINE: case CDPIC_RECT: case CDPIC_BOX: return PIC_PRIM_SIZE(tLBR);
+  case CDPIC_FLINE: case CDPIC_FRECT: case CDPIC_FBOX: return PIC_PRIM_SIZE(tfLBR);
+  case CDPIC_ARC: case CDPIC_SECTOR: case CDPIC_CHORD: return PIC_PRIM_SIZE(tASC);
+  case CDPIC_FARC: case CDPIC_FSECTOR: case CDPIC_FCHORD: return PIC_PRIM_SIZE(tfASC);
+  case CDPIC_TEXT: return PIC_PRIM_SIZE(tText);
+  case CDPIC_FTEXT: return PIC_PRIM_SIZE(tfText);
+  case CDPIC_POLY: return PIC_PRIM_SIZE(tPoly);
+  case CDPIC_FPOLY: return PIC_PRIM_SIZE(tfPoly);
+  case CDPIC_PATH: return PIC_PRIM_SIZE(tPath);
+  case CDPIC_FPATH: return PIC_PRIM_SIZE(tfPath);
+  case CDPIC_PIXEL: return PIC_PRIM_SIZE(tPixel);
+  case CDPIC_IMAGEMAP: return PIC_PRIM_SIZE(tImageMap);
+  case CDPIC_IMAGERGB: case CDPIC_IMAGERGBA: return PIC_PRIM_SIZE(tImageRGBA);
+  }
+  return 0;
+}
+
+static int picLoadAttribs(cdCtxCanvas *ctxcanvas, tPicReader* reader, int line_n, int fill_n, int text_n)
+{
+  int i;
+
+  for (i = 0; i < line_n; i++)
+  {
+    tLineAttrib *attrib;
+    sAttribGrow(ctxcanvas->line_attribs, ctxcanvas->line_attrib_n, ctxcanvas->line_attrib_max, tLineAttrib);
+    attrib = ctxcanvas->line_attribs + ctxcanvas->line_attrib_n;
+    memset(attrib, 0, sizeof(tLineAttrib));
+
+    attrib->foreground = picGetColor(reader);
+    attrib->background = picGetColor(reader);
+    attrib->back_opacity = picGetInt(reader);
+    attrib->line_style = picGetInt(reader);
+    attrib->line_width = picGetInt(reader);
+    attrib->line_cap = picGetInt(reader);
+    attrib->line_join = picGetInt(reader);
+    attrib->line_dashes_count = picGetInt(reader);
+    if (attrib->line_dashes_count)
+    {
+      attrib->line_dashes = picGetInts(ctxcanvas, reader, attrib->line_dashes_count);
+      if (!attrib->line_dashes) return 0;
+    }
+    if (reader->error) return 0;
+
+    attrib->hash = picLineHash(attrib->foreground, attrib->background, attrib->back_opacity, attrib->line_style, attrib->line_width, 
+                               attrib->line_cap, attrib->line_join, attrib->line_dashes, attrib->line_dashes_count);
+    attrib->next = ctxcanvas->line_hash[attrib->hash % PIC_ATTRIB_HASH];
+    ctxcanvas->line_attrib_n++;
+    ctxcanvas->line_hash[attrib->hash % PIC_ATTRIB_HASH] = ctxcanvas->line_attrib_n;
+  }
+
+  for (i = 0; i < fill_n; i++)
+  {
+    tFillAttrib *attrib;
+    int p, pattern_size, stipple_size;
+    sAttribGrow(ctxcanvas->fill_attribs, ctxcanvas->fill_attrib_n, ctxcanvas->fill_attrib_max, tFillAttrib);
+    attrib = ctxcanvas->fill_attribs + ctxcanvas->fill_attrib_n;
+    memset(attrib, 0, sizeof(tFillAttrib));
+
+    attrib->foreground = picGetColor(reader);
+    attrib->background = picGetColor(reader);
+    attrib->back_opacity = picGetInt(reader);
+    attrib->interior_style = picGetInt(reader);
+    attrib->hatch_style = picGetInt(reader);
+    attrib->fill_mode = picGetInt(reader);
+    attrib->pattern_w = picGetInt(reader);
+    attrib->pattern_h = picGetInt(reader);
+    pattern_size = picGetInt(reader);
+    if (pattern_size)
+    {
+      if (pattern_size != attrib->pattern_w*attrib->pattern_h || !picGetCount(reader, pattern_size, 4)) return 0;
+      attrib->pattern = (long*)picAlloc(ctxcanvas, pattern_size*sizeof(long));
+      for (p = 0; p < pattern_size; p++)
+        attrib->pattern[p] = picGetColor(reader);
+    }
+    attrib->stipple_w = picGetInt(reader);
+    attrib->stipple_h = picGetInt(reader);
+    stipple_size = picGetInt(reader);
+    if (stipple_size)
+    {
+      if (stipple_size != attrib->stipple_w*attrib->stipple_h || !picGetCount(reader, stipple_size, 1)) return 0;
+      attrib->stipple = picAllocCopy(ctxcanvas, picGetData(reader, stipple_size), stipple_size);
+    }
+    if (reader->error) return 0;
+
+    attrib->hash = picFillHash(attrib->foreground, attrib->background, attrib->back_opacity, attrib->interior_style, attrib->hatch_style, attrib->fill_mode,
+                               attrib->pattern_w, attrib->pattern_h, attrib->pattern, pattern_size,
+                               attrib->stipple_w, attrib->stipple_h, attrib->stipple, stipple_size);
+    attrib->next = ctxcanvas->fill_hash[attrib->hash % PIC_ATTRIB_HASH];
+    ctxcanvas->fill_attrib_n++;
+    ctxcanvas->fill_hash[attrib->hash % PIC_ATTRIB_HASH] = ctxcanvas->fill_attrib_n;
+  }
+
+  for (i = 0; i < text_n; i++)
+  {
+    tTextAttrib *attrib;
+    const char* font;
+    sAttribGrow(ctxcanvas->text_attribs, ctxcanvas->text_attrib_n, ctxcanvas->text_attrib_max, tTextAttrib);
+    attrib = ctxcanvas->text_attribs + ctxcanvas->text_attrib_n;
+    memset(attrib, 0, sizeof(tTextAttrib));
+
+    attrib->foreground = picGetColor(reader);
+    attrib->font_style = picGetInt(reader);
+    attrib->font_size = picGetInt(reader);
+    attrib->text_alignment = picGetInt(reader);
+    attrib->text_orientation = picGetDouble(reader);
+    attrib->font_type_face = picGetString(ctxcanvas, reader);
+    attrib->native_font = picGetString(ctxcanvas, reader);
+    font = attrib->native_font? attrib->native_font: attrib->font_type_face;
+    if (reader->error || !font) return 0;
+
+    attrib->hash = picTextHash(attrib->foreground, attrib->font_style, attrib->font_size, attrib->text_alignment, attrib->native_font? 1: 0, 
+                               attrib->text_orientation, font, (int)strlen(font));
+    attrib->next = ctxcanvas->text_hash[attrib->hash % PIC_ATTRIB_HASH];
+    ctxcanvas->text_attrib_n++;
+    ctxcanvas->text_hash[attrib->hash % PIC_ATTRIB_HASH] = ctxcanvas->text_attrib_n;
+  }
+
+  return 1;
+}
+
+static int picLoadPrims(cdCtxCanvas *ctxcanvas, tPicReader* reader, int prim_n)
+{
+  int i;
+
+  for (i = 0; i < prim_n; i++)
+  {
+    tPrimNode *prim;
+    tPicBlock *block;
+    int type, attrib, xmin, xmax, ymin, ymax, attrib_n;
+    size_t size;
+
+    type = picGetInt(reader);
+    attrib = picGetInt(reader);
+    xmin = picGetInt(reader);
+    xmax = picGetInt(reader);
+    ymin = picGetInt(reader);
+    ymax = picGetInt(reader);
+    if (reader->error || type < CDPIC_LINE || type > CDPIC_IMAGERGBA)
+      return 0;
+
+    size = picPrimSize((tPrim)type);
+    prim = primCreate(ctxcanvas, (tPrim)type, size);
+    prim->attrib = attrib;
+
+    attrib_n = picGetPrimParam(ctxcanvas, reader, prim);
+    if (reader->error || attrib_n < 0 || (attrib_n != INT_MAX && (attrib < 0 || attrib >= attrib_n)))
+      return 0;
+
+    picAddPrim(ctxcanvas, prim);
+    prim->xmin = xmin; prim->xmax = xmax;
+    prim->ymin = ymin; prim->ymax = ymax;
+
+    block = ctxcanvas->blocks + ctxcanvas->block_n-1;
+    if (xmin == INT_MIN && xmax == INT_MAX)
+      block->unbounded = 1;
+    else if (xmin <= xmax)
+    {
+      if (xmin < block->xmin) block->xmin = xmin;
+      if (xmax > block->xmax) block->xmax = xmax;
+      if (ymin < block->ymin) block->ymin = ymin;
+      if (ymax > block->ymax) block->ymax = ymax;
+    }
+  }
+
+  return 1;
+}
+
+int cdPictureLoadData(cdCanvas* canvas, const unsigned char* data, int size)
+{
+  cdCtxCanvas *ctxcanvas;
+  tPicReader reader;
+  int xmin, xmax, ymin, ymax, max_ew, line_n, fill_n, text_n, prim_n;
+  double res;
+
+  if (!canvas || cdCanvasGetContext(canvas) != CD_PICTURE || !data)
+    return CD_ERROR;
+
+  if (size < PIC_BLOB_HEADER_SIZE || memcmp(data, "CDPIC", 5) != 0 || data[5] != PIC_BLOB_VERSION)
+    return CD_ERROR;
+
+  ctxcanvas = canvas->ctxcanvas;
+
+  reader.data = data + PIC_BLOB_HEADER_SIZE;
+  reader.end = data + size;
+  reader.error = 0;
+
+  xmin = picGetInt(&reader);
+  xmax = picGetInt(&reader);
+  ymin = picGetInt(&reader);
+  ymax = picGetInt(&reader);
+  max_ew = picGetInt(&reader);
+  res = picGetDouble(&reader);
+  line_n = picGetInt(&reader);
+  fill_n = picGetInt(&reader);
+  text_n = picGetInt(&reader);
+  prim_n = picGetInt(&reader);
+  if (reader.error || res <= 0 || line_n < 0 || fill_n < 0 || text_n < 0 || prim_n < 0)
+    return CD_ERROR;
+
+  cdclear(ctxcanvas);
+
+  if (!picLoadAttribs(ctxcanvas, &reader, line_n, fill_n, text_n) ||
+      !picLoadPrims(ctxcanvas, &reader, prim_n))
+  {
+    cdclear(ctxcanvas);
+    return CD_ERROR;
+  }
+
+  ctxcanvas->xmin = xmin;
+  ctxcanvas->xmax = xmax;
+  ctxcanvas->ymin = ymin;
+  ctxcanvas->ymax = ymax;
+  ctxcanvas->max_ew = max_ew;
+  canvas->xres = res;
+  canvas->yres = res;
+  picUpdateSize(ctxcanvas);
+
+  return CD_OK;
+}
+
+int cdPictureSaveFile(cdCanvas* canvas, const char* filename)
+{
+  FILE* file;
+  int size, ret = CD_OK;
+  unsigned char* data = cdPictureSaveData(canvas, &size);
+  if (!data)
+    return CD_ERROR;
+
+  file = fopen(filename, "wb");
+  if (!file || fwrite(data, 1, size, file) != (size_t)size)
+    ret = CD_ERROR;
+
+  if (file) fclose(file);
+  free(data);
+  return ret;
+}
+
+int cdPictureLoadFile(cdCanvas* canvas, const char* filename)
+{
+  FILE* file;
+  long size;
+  int ret = CD_ERROR;
+  unsigned char* data;
+
+  file = fopen(filename, "rb");
+  if (!file)
+    return CD_ERROR;
+
+  fseek(file, 0, SEEK_END);
+  size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  if (size > 0 && size <= INT_MAX)
+  {
+    data = (unsigned char*)malloc(size);
+    if (fread(data, 1, size, file) == (size_t)size)
+      ret = cdPictureLoadData(canvas, data, (int)size);
+    free(data);
+  }
+
+  fclose(file);
+  return ret;
+}
+
 /*******************/
 /* Canvas Creation */
 /*******************/
@@ -1241,6 +2723,10 @@ static cdContext cdPictureContext =
   cdinittable,
   cdplay,
   cdregistercallback,
+  cdplaybegin,
+  cdplaystep,
+  cdplayprogress,
+  cdplayend
 };
 
 cdContext* cdContextPicture(void)
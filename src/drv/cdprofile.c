@@ -0,0 +1,961 @@
+/** \file
+ * \brief CD Profile driver
+ *
+ * See Copyright Notice in cd.h
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/time.h>
+#endif
+
+#include "cd.h"
+#include "cd_private.h"
+#include "cdprofile.h"
+
+
+/* counters are kept for each driver function,
+   polygons are counted separately for each mode */
+enum {
+  PROF_FLUSH, PROF_CLEAR, PROF_PIXEL,
+  PROF_LINE, PROF_FLINE, PROF_RECT, PROF_FRECT, PROF_BOX, PROF_FBOX,
+  PROF_ARC, PROF_FARC, PROF_SECTOR, PROF_FSECTOR, PROF_CHORD, PROF_FCHORD,
+  PROF_TEXT, PROF_FTEXT,
+  PROF_POLY,                  /* one for each mode from CD_FILL to CD_PATH */
+  PROF_FPOLY = PROF_POLY+7,
+  PROF_PUTIMAGERGB = PROF_FPOLY+7, PROF_PUTIMAGERGBA, PROF_PUTIMAGEMAP,
+  PROF_GETIMAGERGB, PROF_SCROLLAREA,
+  PROF_CREATEIMAGE, PROF_KILLIMAGE, PROF_GETIMAGE, PROF_PUTIMAGE,
+  PROF_NEWREGION, PROF_ISPOINTINREGION, PROF_OFFSETREGION, PROF_GETREGIONBOX,
+  PROF_GETFONTDIM, PROF_GETTEXTSIZE,
+  PROF_ACTIVATE, PROF_DEACTIVATE,
+  PROF_CLIP,                  /* attributes start here */
+  PROF_CLIPAREA, PROF_FCLIPAREA, PROF_TRANSFORM,
+  PROF_BACKOPACITY, PROF_WRITEMODE,
+  PROF_LINESTYLE, PROF_LINEWIDTH, PROF_LINECAP, PROF_LINEJOIN,
+  PROF_INTERIORSTYLE, PROF_HATCH, PROF_STIPPLE, PROF_PATTERN,
+  PROF_FONT, PROF_NATIVEFONT, PROF_TEXTALIGNMENT, PROF_TEXTORIENTATION,
+  PROF_PALETTE, PROF_BACKGROUND, PROF_FOREGROUND,
+  PROF_COUNT
+};
+
+#define PROF_ATTRIB_FIRST PROF_CLIP
+#define PROF_PRIM_LAST PROF_SCROLLAREA
+
+static const char* prof_names[PROF_COUNT] = {
+  "Flush", "Clear", "Pixel",
+  "Line", "fLine", "Rect", "fRect", "Box", "fBox",
+  "Arc", "fArc", "Sector", "fSector", "Chord", "fChord",
+  "Text", "fText",
+  "Poly(CD_FILL)", "Poly(CD_OPEN_LINES)", "Poly(CD_CLOSED_LINES)", "Poly(CD_CLIP)", "Poly(CD_BEZIER)", "Poly(CD_REGION)", "Poly(CD_PATH)",
+  "fPoly(CD_FILL)", "fPoly(CD_OPEN_LINES)", "fPoly(CD_CLOSED_LINES)", "fPoly(CD_CLIP)", "fPoly(CD_BEZIER)", "fPoly(CD_REGION)", "fPoly(CD_PATH)",
+  "PutImageRGB", "PutImageRGBA", "PutImageMap",
+  "GetImageRGB", "ScrollArea",
+  "CreateImage", "KillImage", "GetImage", "PutImage",
+  "NewRegion", "IsPointInRegion", "OffsetRegion", "GetRegionBox",
+  "GetFontDim", "GetTextSize",
+  "Activate", "Deactivate",
+  "Clip", "ClipArea", "fClipArea", "Transform",
+  "BackOpacity", "WriteMode",
+  "LineStyle", "LineWidth", "LineCap", "LineJoin",
+  "InteriorStyle", "Hatch", "Stipple", "Pattern",
+  "Font", "NativeFont", "TextAlignment", "TextOrientation",
+  "Palette", "Background", "Foreground"
+};
+
+typedef struct _tProfCounter
+{
+  double calls, vertices, pixels;
+  double time;                     /* in milliseconds */
+} tProfCounter;
+
+struct _cdCtxCanvas
+{
+  cdCanvas* canvas;
+  cdCanvas* canvas_target;
+
+  tProfCounter counters[PROF_COUNT];
+  int json;
+
+  char* report;
+  int report_size, report_len;
+};
+
+struct _cdCtxImage {
+  cdCtxCanvas *ctxcanvas;
+  cdImage* image;
+};
+
+static double profTime(void)
+{
+#ifdef WIN32
+  static double freq = 0;
+  LARGE_INTEGER count;
+  if (freq == 0)
+  {
+    LARGE_INTEGER f;
+    QueryPerformanceFrequency(&f);
+    freq = (double)f.QuadPart / 1000.;
+  }
+  QueryPerformanceCounter(&count);
+  return (double)count.QuadPart / freq;
+#else
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec*1000. + tv.tv_usec/1000.;
+#endif
+}
+
+static void profAdd(cdCtxCanvas *ctxcanvas, int func, double start, double vertices, double pixels)
+{
+  tProfCounter* counter = ctxcanvas->counters + func;
+  counter->time += profTime() - start;
+  counter->calls++;
+  counter->vertices += vertices;
+  counter->pixels += pixels;
+}
+
+/* updates the target with the state that has no driver function */
+static void profSync(cdCtxCanvas *ctxcanvas)
+{
+  cdCanvas* canvas = ctxcanvas->canvas;
+  cdCanvas* target = ctxcanvas->canvas_target;
+
+  if (target->new_region)
+  {
+    if (!canvas->new_region)
+      cdCanvasEnd(target);   /* region finished */
+    else if (target->combine_mode != canvas->combine_mode)
+      cdCanvasRegionCombineMode(target, canvas->combine_mode);
+  }
+
+  if (target->fill_mode != canvas->fill_mode)
+    cdCanvasFillMode(target, canvas->fill_mode);
+
+  if (canvas->line_style == CD_CUSTOM && canvas->line_dashes &&
+      (target->line_dashes_count != canvas->line_dashes_count || !target->line_dashes ||
+       memcmp(target->line_dashes, canvas->line_dashes, canvas->line_dashes_count*sizeof(int)) != 0))
+  {
+    cdCanvasLineStyleDashes(target, canvas->line_dashes, canvas->line_dashes_count);
+    cdCanvasLineStyle(target, CD_CUSTOM);
+  }
+}
+
+static void profUpdateSize(cdCtxCanvas *ctxcanvas)
+{
+  cdCanvas* canvas = ctxcanvas->canvas;
+  cdCanvas* target = ctxcanvas->canvas_target;
+  canvas->w = target->w;
+  canvas->h = target->h;
+  canvas->w_mm = target->w_mm;
+  canvas->h_mm = target->h_mm;
+  canvas->bpp = target->bpp;
+  canvas->xres = target->xres;
+  canvas->yres = target->yres;
+}
+
+static void cdflush(cdCtxCanvas *ctxcanvas)
+{
+  double start = profTime();
+  cdCanvasFlush(ctxcanvas->canvas_target);
+  profAdd(ctxcanvas, PROF_FLUSH, start, 0, 0);
+}
+
+static void cdclear(cdCtxCanvas *ctxcanvas)
+{
+  double start;
+  profSync(ctxcanvas);
+  start = profTime();
+  cdCanvasClear(ctxcanvas->canvas_target);
+  profAdd(ctxcanvas, PROF_CLEAR, start, 0, (double)ctxcanvas->canvas->w*ctxcanvas->canvas->h);
+}
+
+static void cdpixel(cdCtxCanvas *ctxcanvas, int x, int y, long int color)
+{
+  double start;
+  profSync(ctxcanvas);
+  start = profTime();
+  cdCanvasPixel(ctxcanvas->canvas_target, x, y, color);
+  profAdd(ctxcanvas, PROF_PIXEL, start, 0, 1);
+}
+
+static void cdline(cdCtxCanvas *ctxcanvas, int x1, int y1, int x2, int y2)
+{
+  double start;
+  profSync(ctxcanvas);
+  start = profTime();
+  cdCanvasLine(ctxcanvas->canvas_target, x1, y1, x2, y2);
+  profAdd(ctxcanvas, PROF_LINE, start, 2, 0);
+}
+
+static void cdfline(cdCtxCanvas *ctxcanvas, double x1, double y1, double x2, double y2)
+{
+  double start;
+  profSync(ctxcanvas);
+  start = profTime();
+  cdfCanvasLine(ctxcanvas->canvas_target, x1, y1, x2, y2);
+  profAdd(ctxcanvas, PROF_FLINE, start, 2, 0);
+}
+
+static void cdrect(cdCtxCanvas *ctxcanvas, int xmin, int xmax, int ymin, int ymax)
+{
+  double start;
+  profSync(ctxcanvas);
+  start = profTime();
+  cdCanvasRect(ctxcanvas->canvas_target, xmin, xmax, ymin, ymax);
+  profAdd(ctxcanvas, PROF_RECT, start, 4, 0);
+}
+
+static void cdfrect(cdCtxCanvas *ctxcanvas, double xmin, double xmax, double ymin, double ymax)
+{
+  double start;
+  profSync(ctxcanvas);
+  start = profTime();
+  cdfCanvasRect(ctxcanvas->canvas_target, xmin, xmax, ymin, ymax);
+  profAdd(ctxcanvas, PROF_FRECT, start, 4, 0);
+}
+
+static void cdbox(cdCtxCanvas *ctxcanvas, int xmin, int xmax, int ymin, int ymax)
+{
+  double start;
+  profSync(ctxcanvas);
+  start = profTime();
+  cdCanvasBox(ctxcanvas->canvas_target, xmin, xmax, ymin, ymax);
+  profAdd(ctxcanvas, PROF_BOX, start, 4, 0);
+}
+
+static void cdfbox(cdCtxCanvas *ctxcanvas, double xmin, double xmax, double ymin, double ymax)
+{
+  double start;
+  profSync(ctxcanvas);
+  start = profTime();
+  cdfCanvasBox(ctxcanvas->canvas_target, xmin, xmax, ymin, ymax);
+  profAdd(ctxcanvas, PROF_FBOX, start, 4, 0);
+}
+
+static void cdarc(cdCtxCanvas *ctxcanvas, int xc, int yc, int w, int h, double a1, double a2)
+{
+  double start;
+  profSync(ctxcanvas);
+  start = profTime();
+  cdCanvasArc(ctxcanvas->canvas_target, xc, yc, w, h, a1, a2);
+  profAdd(ctxcanvas, PROF_ARC, start, 0, 0);
+}
+
+static void cdfarc(cdCtxCanvas *ctxcanvas, double xc, double yc, double w, double h, double a1, double a2)
+{
+  double start;
+  profSync(ctxcanvas);
+  start = profTime();
+  cdfCanvasArc(ctxcanvas->canvas_target, xc, yc, w, h, a1, a2);
+  profAdd(ctxcanvas, PROF_FARC, start, 0, 0);
+}
+
+static void cdsector(cdCtxCanvas *ctxcanvas, int xc, int yc, int w, int h, double a1, double a2)
+{
+  double start;
+  profSync(ctxcanvas);
+  start = profTime();
+  cdCanvasSector(ctxcanvas->canvas_target, xc, yc, w, h, a1, a2);
+  profAdd(ctxcanvas, PROF_SECTOR, start, 0, 0);
+}
+
+static void cdfsector(cdCtxCanvas *ctxcanvas, double xc, double yc, double w, double h, double a1, double a2)
+{
+  double start;
+  profSync(ctxcanvas);
+  start = profTime();
+  cdfCanvasSector(ctxcanvas->canvas_target, xc, yc, w, h, a1, a2);
+  profAdd(ctxcanvas, PROF_FSECTOR, start, 0, 0);
+}
+
+static void cdchord(cdCtxCanvas *ctxcanvas, int xc, int yc, int w, int h, double a1, double a2)
+{
+  double start;
+  profSync(ctxcanvas);
+  start = profTime();
+  cdCanvasChord(ctxcanvas->canvas_target, xc, yc, w, h, a1, a2);
+  profAdd(ctxcanvas, PROF_CHORD, start, 0, 0);
+}
+
+static void cdfchord(cdCtxCanvas *ctxcanvas, double xc, double yc, double w, double h, double a1, double a2)
+{
+  double start;
+  profSync(ctxcanvas);
+  start = profTime();
+  cdfCanvasChord(ctxcanvas->canvas_target, xc, yc, w, h, a1, a2);
+  profAdd(ctxcanvas, PROF_FCHORD, start, 0, 0);
+}
+
+static void cdtext(cdCtxCanvas *ctxcanvas, int x, int y, const char *s, int len)
+{
+  double start;
+  char* str = (s[len] == 0)? (char*)s: cdStrDupN(s, len);
+  profSync(ctxcanvas);
+  start = profTime();
+  cdCanvasText(ctxcanvas->canvas_target, x, y, str);
+  profAdd(ctxcanvas, PROF_TEXT, start, 0, 0);
+  if (str != s) free(str);
+}
+
+static void cdftext(cdCtxCanvas *ctxcanvas, double x, double y, const char *s, int len)
+{
+  double start;
+  char* str = (s[len] == 0)? (char*)s: cdStrDupN(s, len);
+  profSync(ctxcanvas);
+  start = profTime();
+  cdfCanvasText(ctxcanvas->canvas_target, x, y, str);
+  profAdd(ctxcanvas, PROF_FTEXT, start, 0, 0);
+  if (str != s) free(str);
+}
+
+static void cdpoly(cdCtxCanvas *ctxcanvas, int mode, cdPoint* poly, int n)
+{
+  cdCanvas* target = ctxcanvas->canvas_target;
+  double start;
+  int i;
+
+  profSync(ctxcanvas);
+  start = profTime();
+
+  cdCanvasBegin(target, mode);
+
+  if (mode == CD_PATH)
+  {
+    int p, count;
+    cdCanvas* canvas = ctxcanvas->canvas;
+
+    i = 0;
+    for (p = 0; p < canvas->path_n; p++)
+    {
+      cdCanvasPathSet(target, canvas->path[p]);
+
+      count = (canvas->path[p] == CD_PATH_CURVETO || canvas->path[p] == CD_PATH_ARC)? 3:
+              (canvas->path[p] == CD_PATH_MOVETO || canvas->path[p] == CD_PATH_LINETO)? 1: 0;
+      for (; count > 0 && i < n; count--, i++)
+        cdCanvasVertex(target, poly[i].x, poly[i].y);
+    }
+  }
+  else
+  {
+    for (i = 0; i < n; i++)
+      cdCanvasVertex(target, poly[i].x, poly[i].y);
+  }
+
+  cdCanvasEnd(target);
+
+  profAdd(ctxcanvas, PROF_POLY + mode, start, n, 0);
+}
+
+static void cdfpoly(cdCtxCanvas *ctxcanvas, int mode, cdfPoint* poly, int n)
+{
+  cdCanvas* target = ctxcanvas->canvas_target;
+  double start;
+  int i;
+
+  profSync(ctxcanvas);
+  start = profTime();
+
+  cdCanvasBegin(target, mode);
+
+  if (mode == CD_PATH)
+  {
+    int p, count;
+    cdCanvas* canvas = ctxcanvas->canvas;
+
+    i = 0;
+    for (p = 0; p < canvas->path_n; p++)
+    {
+      cdCanvasPathSet(target, canvas->path[p]);
+
+      count = (canvas->path[p] == CD_PATH_CURVETO || canvas->path[p] == CD_PATH_ARC)? 3:
+              (canvas->path[p] == CD_PATH_MOVETO || canvas->path[p] == CD_PATH_LINETO)? 1: 0;
+      for (; count > 0 && i < n; count--, i++)
+        cdfCanvasVertex(target, poly[i].x, poly[i].y);
+    }
+  }
+  else
+  {
+    for (i = 0; i < n; i++)
+      cdfCanvasVertex(target, poly[i].x, poly[i].y);
+  }
+
+  cdCanvasEnd(target);
+
+  profAdd(ctxcanvas, PROF_FPOLY + mode, start, n, 0);
+}
+
+static void cdputimagerectrgb(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *r, const unsigned char *g, const unsigned char *b, int x, int y, int w, int h, int xmin, int xmax, int ymin, int ymax)
+{
+  double start;
+  profSync(ctxcanvas);
+  start = profTime();
+  cdCanvasPutImageRectRGB(ctxcanvas->canvas_target, iw, ih, r, g, b, x, y, w, h, xmin, xmax, ymin, ymax);
+  profAdd(ctxcanvas, PROF_PUTIMAGERGB, start, 0, (double)w*h);
+}
+
+static void cdputimagerectrgba(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *r, const unsigned char *g, const unsigned char *b, const unsigned char *a, int x, int y, int w, int h, int xmin, int xmax, int ymin, int ymax)
+{
+  double start;
+  profSync(ctxcanvas);
+  start = profTime();
+  cdCanvasPutImageRectRGBA(ctxcanvas->canvas_target, iw, ih, r, g, b, a, x, y, w, h, xmin, xmax, ymin, ymax);
+  profAdd(ctxcanvas, PROF_PUTIMAGERGBA, start, 0, (double)w*h);
+}
+
+static void cdputimagerectmap(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *index, const long int *colors, int x, int y, int w, int h, int xmin, int xmax, int ymin, int ymax)
+{
+  double start;
+  profSync(ctxcanvas);
+  start = profTime();
+  cdCanvasPutImageRectMap(ctxcanvas->canvas_target, iw, ih, index, colors, x, y, w, h, xmin, xmax, ymin, ymax);
+  profAdd(ctxcanvas, PROF_PUTIMAGEMAP, start, 0, (double)w*h);
+}
+
+static void cdgetimagergb(cdCtxCanvas* ctxcanvas, unsigned char *r, unsigned char *g, unsigned char *b, int x, int y, int w, int h)
+{
+  double start = profTime();
+  cdCanvasGetImageRGB(ctxcanvas->canvas_target, r, g, b, x, y, w, h);
+  profAdd(ctxcanvas, PROF_GETIMAGERGB, start, 0, (double)w*h);
+}
+
+static void cdscrollarea(cdCtxCanvas *ctxcanvas, int xmin, int xmax, int ymin, int ymax, int dx, int dy)
+{
+  double start;
+  profSync(ctxcanvas);
+  start = profTime();
+  cdCanvasScrollArea(ctxcanvas->canvas_target, xmin, xmax, ymin, ymax, dx, dy);
+  profAdd(ctxcanvas, PROF_SCROLLAREA, start, 0, (double)(xmax-xmin+1)*(ymax-ymin+1));
+}
+
+static cdCtxImage* cdcreateimage(cdCtxCanvas* ctxcanvas, int w, int h)
+{
+  cdCtxImage* ctximage;
+  double start = profTime();
+  cdImage* image = cdCanvasCreateImage(ctxcanvas->canvas_target, w, h);
+  profAdd(ctxcanvas, PROF_CREATEIMAGE, start, 0, (double)w*h);
+  if (!image)
+    return NULL;
+
+  ctximage = (cdCtxImage*)malloc(sizeof(cdCtxImage));
+  ctximage->ctxcanvas = ctxcanvas;
+  ctximage->image = image;
+  return ctximage;
+}
+
+static void cdkillimage(cdCtxImage* ctximage)
+{
+  double start = profTime();
+  cdKillImage(ctximage->image);
+  profAdd(ctximage->ctxcanvas, PROF_KILLIMAGE, start, 0, 0);
+  free(ctximage);
+}
+
+static void cdgetimage(cdCtxCanvas* ctxcanvas, cdCtxImage* ctximage, int x, int y)
+{
+  double start = profTime();
+  cdCanvasGetImage(ctxcanvas->canvas_target, ctximage->image, x, y);
+  profAdd(ctxcanvas, PROF_GETIMAGE, start, 0, (double)ctximage->image->w*ctximage->image->h);
+}
+
+static void cdputimagerect(cdCtxCanvas* ctxcanvas, cdCtxImage* ctximage, int x, int y, int xmin, int xmax, int ymin, int ymax)
+{
+  double start;
+  profSync(ctxcanvas);
+  start = profTime();
+  cdCanvasPutImageRect(ctxcanvas->canvas_target, ctximage->image, x, y, xmin, xmax, ymin, ymax);
+  profAdd(ctxcanvas, PROF_PUTIMAGE, start, 0, (double)(xmax-xmin+1)*(ymax-ymin+1));
+}
+
+static void cdnewregion(cdCtxCanvas* ctxcanvas)
+{
+  double start;
+  profSync(ctxcanvas);
+  start = profTime();
+  cdCanvasRegionCombineMode(ctxcanvas->canvas_target, ctxcanvas->canvas->combine_mode);
+  cdCanvasBegin(ctxcanvas->canvas_target, CD_REGION);
+  profAdd(ctxcanvas, PROF_NEWREGION, start, 0, 0);
+}
+
+static int cdispointinregion(cdCtxCanvas* ctxcanvas, int x, int y)
+{
+  double start;
+  int ret;
+  profSync(ctxcanvas);
+  start = profTime();
+  ret = cdCanvasIsPointInRegion(ctxcanvas->canvas_target, x, y);
+  profAdd(ctxcanvas, PROF_ISPOINTINREGION, start, 0, 0);
+  return ret;
+}
+
+static void cdoffsetregion(cdCtxCanvas* ctxcanvas, int x, int y)
+{
+  double start;
+  profSync(ctxcanvas);
+  start = profTime();
+  cdCanvasOffsetRegion(ctxcanvas->canvas_target, x, y);
+  profAdd(ctxcanvas, PROF_OFFSETREGION, start, 0, 0);
+}
+
+static void cdgetregionbox(cdCtxCanvas* ctxcanvas, int *xmin, int *xmax, int *ymin, int *ymax)
+{
+  double start;
+  profSync(ctxcanvas);
+  start = profTime();
+  cdCanvasGetRegionBox(ctxcanvas->canvas_target, xmin, xmax, ymin, ymax);
+  profAdd(ctxcanvas, PROF_GETREGIONBOX, start, 0, 0);
+}
+
+static void cdgetfontdim(cdCtxCanvas* ctxcanvas, int *max_width, int *height, int *ascent, int *descent)
+{
+  double start = profTime();
+  cdCanvasGetFontDim(ctxcanvas->canvas_target, max_width, height, ascent, descent);
+  profAdd(ctxcanvas, PROF_GETFONTDIM, start, 0, 0);
+}
+
+static void cdgettextsize(cdCtxCanvas* ctxcanvas, const char *s, int len, int *width, int *height)
+{
+  double start;
+  char* str = (s[len] == 0)? (char*)s: cdStrDupN(s, len);
+  start = profTime();
+  cdCanvasGetTextSize(ctxcanvas->canvas_target, str, width, height);
+  profAdd(ctxcanvas, PROF_GETTEXTSIZE, start, 0, 0);
+  if (str != s) free(str);
+}
+
+static int cdactivate(cdCtxCanvas* ctxcanvas)
+{
+  double start = profTime();
+  int ret = cdCanvasActivate(ctxcanvas->canvas_target);
+  profUpdateSize(ctxcanvas);
+  profAdd(ctxcanvas, PROF_ACTIVATE, start, 0, 0);
+  return ret;
+}
+
+static void cddeactivate(cdCtxCanvas* ctxcanvas)
+{
+  double start = profTime();
+  cdCanvasDeactivate(ctxcanvas->canvas_target);
+  profAdd(ctxcanvas, PROF_DEACTIVATE, start, 0, 0);
+}
+
+static int cdclip(cdCtxCanvas *ctxcanvas, int mode)
+{
+  double start;
+  profSync(ctxcanvas);
+  start = profTime();
+  cdCanvasClip(ctxcanvas->canvas_target, mode);
+  profAdd(ctxcanvas, PROF_CLIP, start, 0, 0);
+  return mode;
+}
+
+static void cdcliparea(cdCtxCanvas *ctxcanvas, int xmin, int xmax, int ymin, int ymax)
+{
+  double start = profTime();
+  cdCanvasClipArea(ctxcanvas->canvas_target, xmin, xmax, ymin, ymax);
+  profAdd(ctxcanvas, PROF_CLIPAREA, start, 0, 0);
+}
+
+static void cdfcliparea(cdCtxCanvas *ctxcanvas, double xmin, double xmax, double ymin, double ymax)
+{
+  double start = profTime();
+  cdfCanvasClipArea(ctxcanvas->canvas_target, xmin, xmax, ymin, ymax);
+  profAdd(ctxcanvas, PROF_FCLIPAREA, start, 0, 0);
+}
+
+static void cdtransform(cdCtxCanvas *ctxcanvas, const double* matrix)
+{
+  double start = profTime();
+  cdCanvasTransform(ctxcanvas->canvas_target, matrix);
+  profAdd(ctxcanvas, PROF_TRANSFORM, start, 0, 0);
+}
+
+static int cdbackopacity(cdCtxCanvas *ctxcanvas, int opacity)
+{
+  double start = profTime();
+  cdCanvasBackOpacity(ctxcanvas->canvas_target, opacity);
+  profAdd(ctxcanvas, PROF_BACKOPACITY, start, 0, 0);
+  return opacity;
+}
+
+static int cdwritemode(cdCtxCanvas *ctxcanvas, int mode)
+{
+  double start = profTime();
+  cdCanvasWriteMode(ctxcanvas->canvas_target, mode);
+  profAdd(ctxcanvas, PROF_WRITEMODE, start, 0, 0);
+  return mode;
+}
+
+static int cdlinestyle(cdCtxCanvas *ctxcanvas, int style)
+{
+  cdCanvas* canvas = ctxcanvas->canvas;
+  double start = profTime();
+  if (style == CD_CUSTOM && canvas->line_dashes)
+    cdCanvasLineStyleDashes(ctxcanvas->canvas_target, canvas->line_dashes, canvas->line_dashes_count);
+  cdCanvasLineStyle(ctxcanvas->canvas_target, style);
+  profAdd(ctxcanvas, PROF_LINESTYLE, start, 0, 0);
+  return style;
+}
+
+static int cdlinewidth(cdCtxCanvas *ctxcanvas, int width)
+{
+  double start = profTime();
+  cdCanvasLineWidth(ctxcanvas->canvas_target, width);
+  profAdd(ctxcanvas, PROF_LINEWIDTH, start, 0, 0);
+  return width;
+}
+
+static int cdlinecap(cdCtxCanvas *ctxcanvas, int cap)
+{
+  double start = profTime();
+  cdCanvasLineCap(ctxcanvas->canvas_target, cap);
+  profAdd(ctxcanvas, PROF_LINECAP, start, 0, 0);
+  return cap;
+}
+
+static int cdlinejoin(cdCtxCanvas *ctxcanvas, int join)
+{
+  double start = profTime();
+  cdCanvasLineJoin(ctxcanvas->canvas_target, join);
+  profAdd(ctxcanvas, PROF_LINEJOIN, start, 0, 0);
+  return join;
+}
+
+static int cdinteriorstyle(cdCtxCanvas *ctxcanvas, int style)
+{
+  double start = profTime();
+  cdCanvasInteriorStyle(ctxcanvas->canvas_target, style);
+  profAdd(ctxcanvas, PROF_INTERIORSTYLE, start, 0, 0);
+  return style;
+}
+
+static int cdhatch(cdCtxCanvas *ctxcanvas, int style)
+{
+  double start = profTime();
+  cdCanvasHatch(ctxcanvas->canvas_target, style);
+  profAdd(ctxcanvas, PROF_HATCH, start, 0, 0);
+  return style;
+}
+
+static void cdstipple(cdCtxCanvas *ctxcanvas, int w, int h, const unsigned char *stipple)
+{
+  double start = profTime();
+  cdCanvasStipple(ctxcanvas->canvas_target, w, h, stipple);
+  profAdd(ctxcanvas, PROF_STIPPLE, start, 0, (double)w*h);
+}
+
+static void cdpattern(cdCtxCanvas *ctxcanvas, int w, int h, const long int *pattern)
+{
+  double start = profTime();
+  cdCanvasPattern(ctxcanvas->canvas_target, w, h, pattern);
+  profAdd(ctxcanvas, PROF_PATTERN, start, 0, (double)w*h);
+}
+
+static int cdfont(cdCtxCanvas *ctxcanvas, const char *type_face, int style, int size)
+{
+  double start = profTime();
+  int ret = cdCanvasFont(ctxcanvas->canvas_target, type_face, style, size);
+  profAdd(ctxcanvas, PROF_FONT, start, 0, 0);
+  return ret;
+}
+
+static int cdnativefont(cdCtxCanvas *ctxcanvas, const char* font)
+{
+  double start = profTime();
+  cdCanvasNativeFont(ctxcanvas->canvas_target, font);
+  profAdd(ctxcanvas, PROF_NATIVEFONT, start, 0, 0);
+  return 1;
+}
+
+static int cdtextalignment(cdCtxCanvas *ctxcanvas, int alignment)
+{
+  double start = profTime();
+  cdCanvasTextAlignment(ctxcanvas->canvas_target, alignment);
+  profAdd(ctxcanvas, PROF_TEXTALIGNMENT, start, 0, 0);
+  return alignment;
+}
+
+static double cdtextorientation(cdCtxCanvas *ctxcanvas, double angle)
+{
+  double start = profTime();
+  cdCanvasTextOrientation(ctxcanvas->canvas_target, angle);
+  profAdd(ctxcanvas, PROF_TEXTORIENTATION, start, 0, 0);
+  return angle;
+}
+
+static void cdpalette(cdCtxCanvas *ctxcanvas, int n, const long int *palette, int mode)
+{
+  double start = profTime();
+  cdCanvasPalette(ctxcanvas->canvas_target, n, palette, mode);
+  profAdd(ctxcanvas, PROF_PALETTE, start, 0, 0);
+}
+
+static long cdbackground(cdCtxCanvas *ctxcanvas, long int color)
+{
+  double start = profTime();
+  cdCanvasSetBackground(ctxcanvas->canvas_target, color);
+  profAdd(ctxcanvas, PROF_BACKGROUND, start, 0, 0);
+  return color;
+}
+
+static long cdforeground(cdCtxCanvas *ctxcanvas, long int color)
+{
+  double start = profTime();
+  cdCanvasSetForeground(ctxcanvas->canvas_target, color);
+  profAdd(ctxcanvas, PROF_FOREGROUND, start, 0, 0);
+  return color;
+}
+
+/**********/
+/* Report */
+/**********/
+
+static void profPrintf(cdCtxCanvas *ctxcanvas, const char* format, ...)
+{
+  char line[512];
+  int len;
+  va_list arglist;
+
+  va_start(arglist, format);
+  vsprintf(line, format, arglist);
+  va_end(arglist);
+
+  len = (int)strlen(line);
+  if (ctxcanvas->report_len + len + 1 > ctxcanvas->report_size)
+  {
+    ctxcanvas->report_size = 2*ctxcanvas->report_size + len + 1;
+    ctxcanvas->report = (char*)realloc(ctxcanvas->report, ctxcanvas->report_size);
+  }
+
+  memcpy(ctxcanvas->report + ctxcanvas->report_len, line, len+1);
+  ctxcanvas->report_len += len;
+}
+
+static const tProfCounter* prof_sort_counters = NULL;
+
+static int profCompareTime(const void* elem1, const void* elem2)
+{
+  double t1 = prof_sort_counters[*(const int*)elem1].time,
+         t2 = prof_sort_counters[*(const int*)elem2].time;
+  if (t1 > t2) return -1;
+  if (t1 < t2) return 1;
+  return *(const int*)elem1 - *(const int*)elem2;
+}
+
+static void profSum(tProfCounter* sum, const tProfCounter* counter)
+{
+  sum->calls += counter->calls;
+  sum->vertices += counter->vertices;
+  sum->pixels += counter->pixels;
+  sum->time += counter->time;
+}
+
+static char* get_profile_attrib(cdCtxCanvas *ctxcanvas)
+{
+  int i, n = 0, order[PROF_COUNT];
+  tProfCounter prim, attrib, total;
+  const char* kind;
+
+  memset(&prim, 0, sizeof(tProfCounter));
+  memset(&attrib, 0, sizeof(tProfCounter));
+  memset(&total, 0, sizeof(tProfCounter));
+
+  for (i = 0; i < PROF_COUNT; i++)
+  {
+    const tProfCounter* counter = ctxcanvas->counters + i;
+    if (counter->calls == 0)
+      continue;
+
+    order[n++] = i;
+    profSum(&total, counter);
+    if (i <= PROF_PRIM_LAST)
+      profSum(&prim, counter);
+    else if (i >= PROF_ATTRIB_FIRST)
+      profSum(&attrib, counter);
+  }
+
+  /* the most expensive functions first */
+  prof_sort_counters = ctxcanvas->counters;
+  qsort(order, n, sizeof(int), profCompareTime);
+
+  ctxcanvas->report_len = 0;
+  profPrintf(ctxcanvas, "");
+
+  if (ctxcanvas->json)
+  {
+    profPrintf(ctxcanvas, "{\n  \"functions\": [");
+    for (i = 0; i < n; i++)
+    {
+      const tProfCounter* counter = ctxcanvas->counters + order[i];
+      kind = order[i] <= PROF_PRIM_LAST? "primitive": order[i] >= PROF_ATTRIB_FIRST? "attribute": "other";
+      profPrintf(ctxcanvas, "%s\n    {\"name\": \"%s\", \"kind\": \"%s\", \"calls\": %.0f, \"vertices\": %.0f, \"pixels\": %.0f, \"time_ms\": %.6f}",
+                 i? ",": "", prof_names[order[i]], kind, counter->calls, counter->vertices, counter->pixels, counter->time);
+    }
+    profPrintf(ctxcanvas, "\n  ],\n");
+    profPrintf(ctxcanvas, "  \"primitives\": {\"calls\": %.0f, \"vertices\": %.0f, \"pixels\": %.0f, \"time_ms\": %.6f},\n", prim.calls, prim.vertices, prim.pixels, prim.time);
+    profPrintf(ctxcanvas, "  \"attributes\": {\"calls\": %.0f, \"time_ms\": %.6f},\n", attrib.calls, attrib.time);
+    profPrintf(ctxcanvas, "  \"total\": {\"calls\": %.0f, \"vertices\": %.0f, \"pixels\": %.0f, \"time_ms\": %.6f}\n}\n", total.calls, total.vertices, total.pixels, total.time);
+  }
+  else
+  {
+    profPrintf(ctxcanvas, "%-24s %10s %12s %12s %12s %10s %6s\n", "Function", "Calls", "Vertices", "Pixels", "Time (ms)", "Avg (us)", "%");
+    for (i = 0; i < n; i++)
+    {
+      const tProfCounter* counter = ctxcanvas->counters + order[i];
+      profPrintf(ctxcanvas, "%-24s %10.0f %12.0f %12.0f %12.3f %10.3f %6.1f\n", prof_names[order[i]], counter->calls, counter->vertices, counter->pixels,
+                 counter->time, (counter->time*1000.)/counter->calls, total.time > 0? (100.*counter->time)/total.time: 0.);
+    }
+    profPrintf(ctxcanvas, "%-24s %10.0f %12.0f %12.0f %12.3f\n", "Primitives", prim.calls, prim.vertices, prim.pixels, prim.time);
+    profPrintf(ctxcanvas, "%-24s %10.0f %12s %12s %12.3f\n", "Attribute changes", attrib.calls, "", "", attrib.time);
+    profPrintf(ctxcanvas, "%-24s %10.0f %12.0f %12.0f %12.3f\n", "Total", total.calls, total.vertices, total.pixels, total.time);
+  }
+
+  return ctxcanvas->report;
+}
+
+static void set_profile_attrib(cdCtxCanvas *ctxcanvas, char* data)
+{
+  if (data && cdStrEqualNoCase(data, "RESET"))
+    memset(ctxcanvas->counters, 0, sizeof(ctxcanvas->counters));
+}
+
+static cdAttribute profile_attrib =
+{
+  "PROFILE",
+  set_profile_attrib,
+  get_profile_attrib
+};
+
+static void set_profileformat_attrib(cdCtxCanvas *ctxcanvas, char* data)
+{
+  if (data)
+    ctxcanvas->json = cdStrEqualNoCase(data, "JSON");
+}
+
+static char* get_profileformat_attrib(cdCtxCanvas *ctxcanvas)
+{
+  return ctxcanvas->json? "JSON": "TEXT";
+}
+
+static cdAttribute profileformat_attrib =
+{
+  "PROFILEFORMAT",
+  set_profileformat_attrib,
+  get_profileformat_attrib
+};
+
+static void cdkillcanvas(cdCtxCanvas *ctxcanvas)
+{
+  cdCanvas* target = ctxcanvas->canvas_target;
+
+  if (target->new_region)
+    cdCanvasEnd(target);
+
+  if (ctxcanvas->report) free(ctxcanvas->report);
+  memset(ctxcanvas, 0, sizeof(cdCtxCanvas));
+  free(ctxcanvas);
+}
+
+static void cdcreatecanvas(cdCanvas *canvas, void *data)
+{
+  cdCanvas* canvas_target = (cdCanvas*)data;
+  cdCtxCanvas* ctxcanvas;
+
+  if (!canvas_target || !_cdCheckCanvas(canvas_target))
+    return;
+
+  ctxcanvas = (cdCtxCanvas *)malloc(sizeof(cdCtxCanvas));
+  memset(ctxcanvas, 0, sizeof(cdCtxCanvas));
+
+  ctxcanvas->canvas = canvas;
+  ctxcanvas->canvas_target = canvas_target;
+  canvas->ctxcanvas = ctxcanvas;
+
+  profUpdateSize(ctxcanvas);
+
+  cdRegisterAttribute(canvas, &profile_attrib);
+  cdRegisterAttribute(canvas, &profileformat_attrib);
+}
+
+static void cdinittable(cdCanvas* canvas)
+{
+  canvas->cxFlush = cdflush;
+  canvas->cxClear = cdclear;
+  canvas->cxPixel = cdpixel;
+  canvas->cxLine = cdline;
+  canvas->cxPoly = cdpoly;
+  canvas->cxRect = cdrect;
+  canvas->cxBox = cdbox;
+  canvas->cxArc = cdarc;
+  canvas->cxSector = cdsector;
+  canvas->cxChord = cdchord;
+  canvas->cxText = cdtext;
+  canvas->cxPutImageRectRGB = cdputimagerectrgb;
+  canvas->cxPutImageRectRGBA = cdputimagerectrgba;
+  canvas->cxPutImageRectMap = cdputimagerectmap;
+  canvas->cxScrollArea = cdscrollarea;
+  canvas->cxFLine = cdfline;
+  canvas->cxFPoly = cdfpoly;
+  canvas->cxFRect = cdfrect;
+  canvas->cxFBox = cdfbox;
+  canvas->cxFArc = cdfarc;
+  canvas->cxFSector = cdfsector;
+  canvas->cxFChord = cdfchord;
+  canvas->cxFText = cdftext;
+  canvas->cxClip = cdclip;
+  canvas->cxClipArea = cdcliparea;
+  canvas->cxBackOpacity = cdbackopacity;
+  canvas->cxWriteMode = cdwritemode;
+  canvas->cxLineStyle = cdlinestyle;
+  canvas->cxLineWidth = cdlinewidth;
+  canvas->cxLineCap = cdlinecap;
+  canvas->cxLineJoin = cdlinejoin;
+  canvas->cxInteriorStyle = cdinteriorstyle;
+  canvas->cxHatch = cdhatch;
+  canvas->cxStipple = cdstipple;
+  canvas->cxPattern = cdpattern;
+  canvas->cxFont = cdfont;
+  canvas->cxNativeFont = cdnativefont;
+  canvas->cxTextAlignment = cdtextalignment;
+  canvas->cxTextOrientation = cdtextorientation;
+  canvas->cxPalette = cdpalette;
+  canvas->cxBackground = cdbackground;
+  canvas->cxForeground = cdforeground;
+  canvas->cxFClipArea = cdfcliparea;
+  canvas->cxTransform = cdtransform;
+  canvas->cxKillCanvas = cdkillcanvas;
+  canvas->cxGetImageRGB = cdgetimagergb;
+  canvas->cxCreateImage = cdcreateimage;
+  canvas->cxKillImage = cdkillimage;
+  canvas->cxGetImage = cdgetimage;
+  canvas->cxPutImageRect = cdputimagerect;
+  canvas->cxNewRegion = cdnewregion;
+  canvas->cxIsPointInRegion = cdispointinregion;
+  canvas->cxOffsetRegion = cdoffsetregion;
+  canvas->cxGetRegionBox = cdgetregionbox;
+  canvas->cxActivate = cdactivate;
+  canvas->cxDeactivate = cddeactivate;
+  canvas->cxGetFontDim = cdgetfontdim;
+  canvas->cxGetTextSize = cdgettextsize;
+}
+
+static cdContext cdProfileContext =
+{
+  CD_CAP_ALL & ~CD_CAP_PLAY,
+  CD_CTX_DEVICE,
+  cdcreatecanvas,
+  cdinittable,
+  NULL,
+  NULL,
+};
+
+cdContext* cdContextProfile(void)
+{
+  return &cdProfileContext;
+}
@@ -11,6 +11,8 @@
 #include <math.h>
 #include <locale.h>
 
+#include "zlib.h"
+
 #include "cd.h"
 #include "cd_private.h"
 #include "cdps.h"
@@ -50,7 +52,7 @@ struct _cdCtxCanvas
 {
   cdCanvas* canvas;
 
-  FILE *file;            /* Arquivo PS */
+  cdStream *stream;      /* Arquivo PS */
   int res;               /* Resolucao */
   int pages;             /* Numero total de paginas */
   double width_pt;       /* Largura do papel (points) */
@@ -63,6 +65,7 @@ struct _cdCtxCanvas
   double scale;          /* Fator de conversao de coordenadas (pixel2points) */
   int eps;               /* Postscrip encapsulado? */
   int level1;            /* if true generates level 1 only function calls */
+  int compress;          /* if true images are compressed with Flate (level 3) */
   int landscape;         /* page orientation */
   int debug;             /* print debug strings in the file */
   char* old_locale;
@@ -224,39 +227,39 @@ static void setcliprect(cdCtxCanvas* ctxcanvas, double xmin, double ymin, double
   if (ctxcanvas->eps) /* initclip not allowed in EPS */
     return;
 
-  fprintf(ctxcanvas->file, "initclip\n"); 
+  cdStreamPrintf(ctxcanvas->stream, "initclip\n"); 
 
   /* cliping geral para a margem */
   if (ctxcanvas->level1)
   {
-    fprintf(ctxcanvas->file, "N\n");
-    fprintf(ctxcanvas->file, "%g %g M\n", xmin, ymin);
-    fprintf(ctxcanvas->file, "%g %g L\n", xmin, ymax);
-    fprintf(ctxcanvas->file, "%g %g L\n", xmax, ymax);
-    fprintf(ctxcanvas->file, "%g %g L\n", xmax, ymin);
-    fprintf(ctxcanvas->file, "C\n");
-    fprintf(ctxcanvas->file, "clip\n");
-    fprintf(ctxcanvas->file, "N\n");
+    cdStreamPrintf(ctxcanvas->stream, "N\n");
+    cdStreamPrintf(ctxcanvas->stream, "%g %g M\n", xmin, ymin);
+    cdStreamPrintf(ctxcanvas->stream, "%g %g L\n", xmin, ymax);
+    cdStreamPrintf(ctxcanvas->stream, "%g %g L\n", xmax, ymax);
+    cdStreamPrintf(ctxcanvas->stream, "%g %g L\n", xmax, ymin);
+    cdStreamPrintf(ctxcanvas->stream, "C\n");
+    cdStreamPrintf(ctxcanvas->stream, "clip\n");
+    cdStreamPrintf(ctxcanvas->stream, "N\n");
   }
   else
-    fprintf(ctxcanvas->file, "%g %g %g %g rectclip\n", xmin, ymin, xmax-xmin, ymax-ymin);
+    cdStreamPrintf(ctxcanvas->stream, "%g %g %g %g rectclip\n", xmin, ymin, xmax-xmin, ymax-ymin);
 }
 
 static void set_default_matrix(cdCtxCanvas *ctxcanvas)
 {
   if (ctxcanvas->eps)
-    fprintf(ctxcanvas->file, "oldmatrix setmatrix\n");          /* reset to current */
+    cdStreamPrintf(ctxcanvas->stream, "oldmatrix setmatrix\n");          /* reset to current */
   else
   {
-    fprintf(ctxcanvas->file, "[0 0 0 0 0 0] defaultmatrix\n");  /* reset to default */
-    fprintf(ctxcanvas->file, "setmatrix\n");  
+    cdStreamPrintf(ctxcanvas->stream, "[0 0 0 0 0 0] defaultmatrix\n");  /* reset to default */
+    cdStreamPrintf(ctxcanvas->stream, "setmatrix\n");  
   }
 
   /* margin */
-  fprintf(ctxcanvas->file, "%g %g translate\n", ctxcanvas->xmin, ctxcanvas->ymin);
+  cdStreamPrintf(ctxcanvas->stream, "%g %g translate\n", ctxcanvas->xmin, ctxcanvas->ymin);
 
   /* default coordinate system is in points, change it to pixels. */
-  fprintf(ctxcanvas->file, "%g %g scale\n", ctxcanvas->scale, ctxcanvas->scale);
+  cdStreamPrintf(ctxcanvas->stream, "%g %g scale\n", ctxcanvas->scale, ctxcanvas->scale);
 }
 
 /*
@@ -275,57 +278,57 @@ static void init_ps(cdCtxCanvas *ctxcanvas)
   ctxcanvas->ymax = ctxcanvas->height_pt - mm2pt(ctxcanvas->ymax);
   ctxcanvas->bbmargin = mm2pt(ctxcanvas->bbmargin);
 
-  fprintf(ctxcanvas->file, "%%!PS-Adobe-3.0 %s\n", ctxcanvas->eps ? "EPSF-3.0":"");
-  fprintf(ctxcanvas->file, "%%%%Title: CanvasDraw\n");
-  fprintf(ctxcanvas->file, "%%%%Creator: CanvasDraw\n");
-  fprintf(ctxcanvas->file, "%%%%CreationDate: %s", asctime(localtime(&now)));
-  fprintf(ctxcanvas->file, "%%%%DocumentFonts: (atend)\n"); /* attend means at the end of the file, */
-  fprintf(ctxcanvas->file, "%%%%Pages: (atend)\n");         /* see killcanvas */ 
-  fprintf(ctxcanvas->file, "%%%%PageOrder: Ascend\n");         
-  fprintf(ctxcanvas->file, "%%%%LanguageLevel: %d\n", ctxcanvas->level1 ? 1: 2);
-  fprintf(ctxcanvas->file, "%%%%Orientation: %s\n", ctxcanvas->landscape ? "Landscape": "Portrait");
+  cdStreamPrintf(ctxcanvas->stream, "%%!PS-Adobe-3.0 %s\n", ctxcanvas->eps ? "EPSF-3.0":"");
+  cdStreamPrintf(ctxcanvas->stream, "%%%%Title: CanvasDraw\n");
+  cdStreamPrintf(ctxcanvas->stream, "%%%%Creator: CanvasDraw\n");
+  cdStreamPrintf(ctxcanvas->stream, "%%%%CreationDate: %s", asctime(localtime(&now)));
+  cdStreamPrintf(ctxcanvas->stream, "%%%%DocumentFonts: (atend)\n"); /* attend means at the end of the file, */
+  cdStreamPrintf(ctxcanvas->stream, "%%%%Pages: (atend)\n");         /* see killcanvas */ 
+  cdStreamPrintf(ctxcanvas->stream, "%%%%PageOrder: Ascend\n");         
+  cdStreamPrintf(ctxcanvas->stream, "%%%%LanguageLevel: %d\n", ctxcanvas->level1 ? 1: (ctxcanvas->compress ? 3: 2));
+  cdStreamPrintf(ctxcanvas->stream, "%%%%Orientation: %s\n", ctxcanvas->landscape ? "Landscape": "Portrait");
 
   if (ctxcanvas->eps)
   {
-    fprintf(ctxcanvas->file, "%%%%BoundingBox: (atend)\n");
+    cdStreamPrintf(ctxcanvas->stream, "%%%%BoundingBox: (atend)\n");
     ctxcanvas->bbxmin = ctxcanvas->bbxmax = ctxcanvas->bbymin = ctxcanvas->bbymax = 0;
     /* BoundingBox==Empty */
   }
 
-  fprintf(ctxcanvas->file, "%%%%EndComments\n");
-  fprintf(ctxcanvas->file, "%%%%BeginProlog\n");
+  cdStreamPrintf(ctxcanvas->stream, "%%%%EndComments\n");
+  cdStreamPrintf(ctxcanvas->stream, "%%%%BeginProlog\n");
   
-  fprintf(ctxcanvas->file, "/N {newpath} bind def\n");
-  fprintf(ctxcanvas->file, "/C {closepath} bind def\n");
-  fprintf(ctxcanvas->file, "/M {moveto} bind def\n");
-  fprintf(ctxcanvas->file, "/L {lineto} bind def\n");
-  fprintf(ctxcanvas->file, "/B {curveto} bind def\n");
-  fprintf(ctxcanvas->file, "/S {stroke} bind def\n");
-  fprintf(ctxcanvas->file, "/LL {moveto lineto stroke} bind def\n");
+  cdStreamPrintf(ctxcanvas->stream, "/N {newpath} bind def\n");
+  cdStreamPrintf(ctxcanvas->stream, "/C {closepath} bind def\n");
+  cdStreamPrintf(ctxcanvas->stream, "/M {moveto} bind def\n");
+  cdStreamPrintf(ctxcanvas->stream, "/L {lineto} bind def\n");
+  cdStreamPrintf(ctxcanvas->stream, "/B {curveto} bind def\n");
+  cdStreamPrintf(ctxcanvas->stream, "/S {stroke} bind def\n");
+  cdStreamPrintf(ctxcanvas->stream, "/LL {moveto lineto stroke} bind def\n");
   
   if (!ctxcanvas->level1)
   {
-    fprintf(ctxcanvas->file, "/RF {rectfill} bind def\n");
-    fprintf(ctxcanvas->file, "/RS {rectstroke} bind def\n");
+    cdStreamPrintf(ctxcanvas->stream, "/RF {rectfill} bind def\n");
+    cdStreamPrintf(ctxcanvas->stream, "/RS {rectstroke} bind def\n");
   }
 
-  fprintf(ctxcanvas->file, "%%%%EndProlog\n");
-  fprintf(ctxcanvas->file, "%%%%BeginSetup\n");
+  cdStreamPrintf(ctxcanvas->stream, "%%%%EndProlog\n");
+  cdStreamPrintf(ctxcanvas->stream, "%%%%BeginSetup\n");
   
   if (!ctxcanvas->eps && !ctxcanvas->level1)
   {
     /* setpagedevice not allowed in EPS */
-    fprintf(ctxcanvas->file, "%%%%IncludeFeature: *Resolution %d\n", ctxcanvas->res);
-    fprintf(ctxcanvas->file, "%%%%BeginFeature: *PageSize\n");
-    fprintf(ctxcanvas->file, "<< /PageSize [%g %g] >> setpagedevice\n", ctxcanvas->width_pt, ctxcanvas->height_pt); 
-    fprintf(ctxcanvas->file, "%%%%EndFeature\n");
+    cdStreamPrintf(ctxcanvas->stream, "%%%%IncludeFeature: *Resolution %d\n", ctxcanvas->res);
+    cdStreamPrintf(ctxcanvas->stream, "%%%%BeginFeature: *PageSize\n");
+    cdStreamPrintf(ctxcanvas->stream, "<< /PageSize [%g %g] >> setpagedevice\n", ctxcanvas->width_pt, ctxcanvas->height_pt); 
+    cdStreamPrintf(ctxcanvas->stream, "%%%%EndFeature\n");
   }
 
-  fprintf(ctxcanvas->file, "%%%%EndSetup\n");
+  cdStreamPrintf(ctxcanvas->stream, "%%%%EndSetup\n");
 
-  fputs(new_codes, ctxcanvas->file);
-  fputs(change_font, ctxcanvas->file);
-  fputs(re_encode, ctxcanvas->file);
+  cdStreamPutString(ctxcanvas->stream, new_codes);
+  cdStreamPutString(ctxcanvas->stream, change_font);
+  cdStreamPutString(ctxcanvas->stream, re_encode);
 
   ctxcanvas->scale = 72.0/ctxcanvas->res;
   ctxcanvas->canvas->xres = ctxcanvas->res/25.4;
@@ -342,20 +345,20 @@ static void init_ps(cdCtxCanvas *ctxcanvas)
 
   ctxcanvas->canvas->bpp = 24;
 
-  fprintf(ctxcanvas->file, "%%%%Page: 1 1\n");
+  cdStreamPrintf(ctxcanvas->stream, "%%%%Page: 1 1\n");
   ctxcanvas->pages = 1;
 
-  if (ctxcanvas->debug) fprintf(ctxcanvas->file, "\n%%cdCreateCanvas: Margin Begin\n");
+  if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "\n%%cdCreateCanvas: Margin Begin\n");
 
   if (ctxcanvas->eps)
-    fprintf(ctxcanvas->file, "/oldmatrix [0 0 0 0 0 0] currentmatrix def\n");  /* save current matrix */
+    cdStreamPrintf(ctxcanvas->stream, "/oldmatrix [0 0 0 0 0 0] currentmatrix def\n");  /* save current matrix */
 
   set_default_matrix(ctxcanvas);
 
   /* cliping geral para a margem */
   setcliprect(ctxcanvas, 0, 0, ctxcanvas->canvas->w, ctxcanvas->canvas->h);
 
-  if (ctxcanvas->debug) fprintf(ctxcanvas->file, "%%cdCreateCanvas: MarginEnd\n");
+  if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "%%cdCreateCanvas: MarginEnd\n");
 }
 
 
@@ -363,11 +366,11 @@ static void cdkillcanvas(cdCtxCanvas *ctxcanvas)
 {
   int i;
 
-  if (ctxcanvas->debug) fprintf(ctxcanvas->file, "\n%%cdKillCanvas\n");
+  if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "\n%%cdKillCanvas\n");
 
-  fprintf(ctxcanvas->file, "showpage\n");
-  fprintf(ctxcanvas->file, "%%%%Trailer\n");
-  fprintf(ctxcanvas->file, "%%%%Pages: %d 1\n", ctxcanvas->pages);
+  cdStreamPrintf(ctxcanvas->stream, "showpage\n");
+  cdStreamPrintf(ctxcanvas->stream, "%%%%Trailer\n");
+  cdStreamPrintf(ctxcanvas->stream, "%%%%Pages: %d 1\n", ctxcanvas->pages);
 
   if (ctxcanvas->eps)
   {
@@ -377,21 +380,21 @@ static void cdkillcanvas(cdCtxCanvas *ctxcanvas)
     int ymax = (int)ctxcanvas->bbymax;
     if (xmax < ctxcanvas->bbxmax) xmax++;
     if (ymax < ctxcanvas->bbymax) ymax++;
-    fprintf(ctxcanvas->file,"%%%%BoundingBox: %5d %5d %5d %5d\n",xmin,ymin,xmax,ymax);
+    cdStreamPrintf(ctxcanvas->stream,"%%%%BoundingBox: %5d %5d %5d %5d\n",xmin,ymin,xmax,ymax);
   }
 
-  fprintf(ctxcanvas->file, "%%%%DocumentFonts:");
+  cdStreamPrintf(ctxcanvas->stream, "%%%%DocumentFonts:");
 
   for (i = 0; i < ctxcanvas->num_native_font; i++)
   {
-    fprintf(ctxcanvas->file, " %s", ctxcanvas->nativefontname[i]);
+    cdStreamPrintf(ctxcanvas->stream, " %s", ctxcanvas->nativefontname[i]);
     free(ctxcanvas->nativefontname[i]);
   }
 
-  putc('\n', ctxcanvas->file);
-  fprintf(ctxcanvas->file,"%%%%EOF");
+  cdStreamPutChar(ctxcanvas->stream, '\n');
+  cdStreamPrintf(ctxcanvas->stream,"%%%%EOF");
 
-  fclose(ctxcanvas->file);
+  cdStreamClose(ctxcanvas->stream);
 
   if (ctxcanvas->old_locale)
   {
@@ -405,7 +408,7 @@ static void cdkillcanvas(cdCtxCanvas *ctxcanvas)
 
 static void cddeactivate(cdCtxCanvas *ctxcanvas)
 {
-  fflush(ctxcanvas->file);
+  cdStreamFlush(ctxcanvas->stream);
 }
 
 static int cdhatch(cdCtxCanvas *ctxcanvas, int style);
@@ -417,32 +420,32 @@ static void sUpdateFill(cdCtxCanvas *ctxcanvas, int fill)
   if (fill == 0)
   {
     /* called before a NON filled primitive */
-    if (ctxcanvas->debug) fprintf(ctxcanvas->file, "\n%%cdPsUpdateFill %d Begin\n", fill);
+    if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "\n%%cdPsUpdateFill %d Begin\n", fill);
 
-    fprintf(ctxcanvas->file, "%g %g %g setrgbcolor\n", get_red(ctxcanvas->canvas->foreground), 
+    cdStreamPrintf(ctxcanvas->stream, "%g %g %g setrgbcolor\n", get_red(ctxcanvas->canvas->foreground), 
                                                         get_green(ctxcanvas->canvas->foreground), 
                                                         get_blue(ctxcanvas->canvas->foreground));
 
-    if (ctxcanvas->debug) fprintf(ctxcanvas->file, "%%cdPsUpdateFill %dEnd\n", fill);
+    if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "%%cdPsUpdateFill %dEnd\n", fill);
   }
   else
   {
     /* called before a filled primitive */
-    if (ctxcanvas->debug) fprintf(ctxcanvas->file, "\n%%cdPsUpdateFill %d Begin\n", fill);
+    if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "\n%%cdPsUpdateFill %d Begin\n", fill);
 
     if (ctxcanvas->canvas->interior_style == CD_SOLID)
     {
-      fprintf(ctxcanvas->file, "%g %g %g setrgbcolor\n", get_red(ctxcanvas->canvas->foreground), 
+      cdStreamPrintf(ctxcanvas->stream, "%g %g %g setrgbcolor\n", get_red(ctxcanvas->canvas->foreground), 
                                                           get_green(ctxcanvas->canvas->foreground), 
                                                           get_blue(ctxcanvas->canvas->foreground));
     }
     else if (!ctxcanvas->level1)
     {
-      fprintf(ctxcanvas->file, "cd_pattern\n");
-      fprintf(ctxcanvas->file, "setpattern\n");
+      cdStreamPrintf(ctxcanvas->stream, "cd_pattern\n");
+      cdStreamPrintf(ctxcanvas->stream, "setpattern\n");
     }
 
-    if (ctxcanvas->debug) fprintf(ctxcanvas->file, "%%cdPsUpdateFill %dEnd\n", fill);
+    if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "%%cdPsUpdateFill %dEnd\n", fill);
   }
 }
 
@@ -451,22 +454,22 @@ static void sUpdateFill(cdCtxCanvas *ctxcanvas, int fill)
 */
 static void cdflush(cdCtxCanvas *ctxcanvas)
 {
-  if (ctxcanvas->debug) fprintf(ctxcanvas->file, "\n%%cdFlush Begin\n");
+  if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "\n%%cdFlush Begin\n");
 
-  fflush(ctxcanvas->file);
+  cdStreamFlush(ctxcanvas->stream);
 
   if (!ctxcanvas->eps)
   {
-    fprintf(ctxcanvas->file, "gsave\n");
+    cdStreamPrintf(ctxcanvas->stream, "gsave\n");
 
-    fprintf(ctxcanvas->file, "showpage\n");
+    cdStreamPrintf(ctxcanvas->stream, "showpage\n");
     ctxcanvas->pages++;
-    fprintf(ctxcanvas->file, "%%%%Page: %d %d\n", ctxcanvas->pages, ctxcanvas->pages);
+    cdStreamPrintf(ctxcanvas->stream, "%%%%Page: %d %d\n", ctxcanvas->pages, ctxcanvas->pages);
 
-    fprintf(ctxcanvas->file, "grestore\n");
+    cdStreamPrintf(ctxcanvas->stream, "grestore\n");
   }
 
-  if (ctxcanvas->debug) fprintf(ctxcanvas->file, "%%cdFlushEnd\n");
+  if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "%%cdFlushEnd\n");
 }
 
 
@@ -479,16 +482,16 @@ static void cdfcliparea(cdCtxCanvas *ctxcanvas, double xmin, double xmax, double
   if (ctxcanvas->canvas->clip_mode != CD_CLIPAREA)
     return;
 
-  if (ctxcanvas->debug) fprintf(ctxcanvas->file, "\n%%cdfClipArea Begin\n");
+  if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "\n%%cdfClipArea Begin\n");
 
   setcliprect(ctxcanvas, xmin, ymin, xmax, ymax);
 
-  if (ctxcanvas->debug) fprintf(ctxcanvas->file, "%%cdfClipAreaEnd\n");
+  if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "%%cdfClipAreaEnd\n");
 }
 
 static int cdclip(cdCtxCanvas *ctxcanvas, int mode)
 {
-  if (ctxcanvas->debug) fprintf(ctxcanvas->file, "\n%%cdClip %d Begin\n", mode);
+  if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "\n%%cdClip %d Begin\n", mode);
 
   if (mode == CD_CLIPAREA)
   {
@@ -501,7 +504,7 @@ static int cdclip(cdCtxCanvas *ctxcanvas, int mode)
   }
   else if (mode == CD_CLIPPOLYGON)
   {
-    fprintf(ctxcanvas->file, "clip_polygon\n");
+    cdStreamPrintf(ctxcanvas->stream, "clip_polygon\n");
   }
   else
   {
@@ -509,7 +512,7 @@ static int cdclip(cdCtxCanvas *ctxcanvas, int mode)
     setcliprect(ctxcanvas, 0, 0, ctxcanvas->canvas->w, ctxcanvas->canvas->h);
   }
 
-  if (ctxcanvas->debug) fprintf(ctxcanvas->file, "%%cdClip %dEnd\n", mode);
+  if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "%%cdClip %dEnd\n", mode);
 
   return mode;
 }
@@ -522,7 +525,7 @@ static void cdline(cdCtxCanvas *ctxcanvas, int x1, int y1, int x2, int y2)
 {
   sUpdateFill(ctxcanvas, 0);
 
-  fprintf(ctxcanvas->file, "N %d %d %d %d LL\n", x1, y1, x2, y2);
+  cdStreamPrintf(ctxcanvas->stream, "N %d %d %d %d LL\n", x1, y1, x2, y2);
 
   if (ctxcanvas->eps)
   {
@@ -535,7 +538,7 @@ static void cdfline(cdCtxCanvas *ctxcanvas, double x1, double y1, double x2, dou
 {
   sUpdateFill(ctxcanvas, 0);
 
-  fprintf(ctxcanvas->file, "N %g %g %g %g LL\n", x1, y1, x2, y2);
+  cdStreamPrintf(ctxcanvas->stream, "N %g %g %g %g LL\n", x1, y1, x2, y2);
 
   if (ctxcanvas->eps)
   {
@@ -550,15 +553,15 @@ static void cdrect(cdCtxCanvas *ctxcanvas, int xmin, int xmax, int ymin, int yma
 
   if (ctxcanvas->level1)
   {
-    fprintf(ctxcanvas->file, "N\n");
-    fprintf(ctxcanvas->file, "%d %d M\n", xmin, ymin);
-    fprintf(ctxcanvas->file, "%d %d L\n", xmin, ymax);
-    fprintf(ctxcanvas->file, "%d %d L\n", xmax, ymax);
-    fprintf(ctxcanvas->file, "%d %d L\n", xmax, ymin);
-    fprintf(ctxcanvas->file, "C S\n");
+    cdStreamPrintf(ctxcanvas->stream, "N\n");
+    cdStreamPrintf(ctxcanvas->stream, "%d %d M\n", xmin, ymin);
+    cdStreamPrintf(ctxcanvas->stream, "%d %d L\n", xmin, ymax);
+    cdStreamPrintf(ctxcanvas->stream, "%d %d L\n", xmax, ymax);
+    cdStreamPrintf(ctxcanvas->stream, "%d %d L\n", xmax, ymin);
+    cdStreamPrintf(ctxcanvas->stream, "C S\n");
   }
   else
-    fprintf(ctxcanvas->file, "%d %d %d %d RS\n", xmin, ymin, xmax - xmin, ymax - ymin);
+    cdStreamPrintf(ctxcanvas->stream, "%d %d %d %d RS\n", xmin, ymin, xmax - xmin, ymax - ymin);
 
   if (ctxcanvas->eps)
   {
@@ -573,15 +576,15 @@ static void cdfrect(cdCtxCanvas *ctxcanvas, double xmin, double xmax, double ymi
 
   if (ctxcanvas->level1)
   {
-    fprintf(ctxcanvas->file, "N\n");
-    fprintf(ctxcanvas->file, "%g %g M\n", xmin, ymin);
-    fprintf(ctxcanvas->file, "%g %g L\n", xmin, ymax);
-    fprintf(ctxcanvas->file, "%g %g L\n", xmax, ymax);
-    fprintf(ctxcanvas->file, "%g %g L\n", xmax, ymin);
-    fprintf(ctxcanvas->file, "C S\n");
+    cdStreamPrintf(ctxcanvas->stream, "N\n");
+    cdStreamPrintf(ctxcanvas->stream, "%g %g M\n", xmin, ymin);
+    cdStreamPrintf(ctxcanvas->stream, "%g %g L\n", xmin, ymax);
+    cdStreamPrintf(ctxcanvas->stream, "%g %g L\n", xmax, ymax);
+    cdStreamPrintf(ctxcanvas->stream, "%g %g L\n", xmax, ymin);
+    cdStreamPrintf(ctxcanvas->stream, "C S\n");
   }
   else
-    fprintf(ctxcanvas->file, "%g %g %g %g RS\n", xmin, ymin, xmax - xmin, ymax - ymin);
+    cdStreamPrintf(ctxcanvas->stream, "%g %g %g %g RS\n", xmin, ymin, xmax - xmin, ymax - ymin);
 
   if (ctxcanvas->eps)
   {
@@ -596,15 +599,15 @@ static void cdbox(cdCtxCanvas *ctxcanvas, int xmin, int xmax, int ymin, int ymax
 
   if (ctxcanvas->level1)
   {
-    fprintf(ctxcanvas->file, "N\n");
-    fprintf(ctxcanvas->file, "%d %d M\n", xmin, ymin);
-    fprintf(ctxcanvas->file, "%d %d L\n", xmin, ymax);
-    fprintf(ctxcanvas->file, "%d %d L\n", xmax, ymax);
-    fprintf(ctxcanvas->file, "%d %d L\n", xmax, ymin);
-    fprintf(ctxcanvas->file, "C fill\n");
+    cdStreamPrintf(ctxcanvas->stream, "N\n");
+    cdStreamPrintf(ctxcanvas->stream, "%d %d M\n", xmin, ymin);
+    cdStreamPrintf(ctxcanvas->stream, "%d %d L\n", xmin, ymax);
+    cdStreamPrintf(ctxcanvas->stream, "%d %d L\n", xmax, ymax);
+    cdStreamPrintf(ctxcanvas->stream, "%d %d L\n", xmax, ymin);
+    cdStreamPrintf(ctxcanvas->stream, "C fill\n");
   }
   else
-    fprintf(ctxcanvas->file, "%d %d %d %d RF\n", xmin, ymin, xmax - xmin, ymax - ymin);
+    cdStreamPrintf(ctxcanvas->stream, "%d %d %d %d RF\n", xmin, ymin, xmax - xmin, ymax - ymin);
 
   if (ctxcanvas->eps)
   {
@@ -619,15 +622,15 @@ static void cdfbox(cdCtxCanvas *ctxcanvas, double xmin, double xmax, double ymin
 
   if (ctxcanvas->level1)
   {
-    fprintf(ctxcanvas->file, "N\n");
-    fprintf(ctxcanvas->file, "%g %g M\n", xmin, ymin);
-    fprintf(ctxcanvas->file, "%g %g L\n", xmin, ymax);
-    fprintf(ctxcanvas->file, "%g %g L\n", xmax, ymax);
-    fprintf(ctxcanvas->file, "%g %g L\n", xmax, ymin);
-    fprintf(ctxcanvas->file, "C fill\n");
+    cdStreamPrintf(ctxcanvas->stream, "N\n");
+    cdStreamPrintf(ctxcanvas->stream, "%g %g M\n", xmin, ymin);
+    cdStreamPrintf(ctxcanvas->stream, "%g %g L\n", xmin, ymax);
+    cdStreamPrintf(ctxcanvas->stream, "%g %g L\n", xmax, ymax);
+    cdStreamPrintf(ctxcanvas->stream, "%g %g L\n", xmax, ymin);
+    cdStreamPrintf(ctxcanvas->stream, "C fill\n");
   }
   else
-    fprintf(ctxcanvas->file, "%g %g %g %g RF\n", xmin, ymin, xmax - xmin, ymax - ymin);
+    cdStreamPrintf(ctxcanvas->stream, "%g %g %g %g RF\n", xmin, ymin, xmax - xmin, ymax - ymin);
 
   if (ctxcanvas->eps)
   {
@@ -644,21 +647,21 @@ static void cdarc(cdCtxCanvas *ctxcanvas, int xc, int yc, int w, int h, double a
 
   if (w==h) /* Circulo: PS implementa direto */
   {
-    fprintf(ctxcanvas->file, "N %d %d %g %g %g arc S\n", xc, yc, 0.5*w, a1, a2);
+    cdStreamPrintf(ctxcanvas->stream, "N %d %d %g %g %g arc S\n", xc, yc, 0.5*w, a1, a2);
   }
   else /* Elipse: mudar a escala p/ criar a partir do circulo */
   {
-    if (ctxcanvas->debug) fprintf(ctxcanvas->file, "\n%%cdArc Ellipse Begin\n");
+    if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "\n%%cdArc Ellipse Begin\n");
 
-    fprintf(ctxcanvas->file, "[0 0 0 0 0 0] currentmatrix\n"); /* fill new matrix from CTM */
-    fprintf(ctxcanvas->file, "%d %d translate\n", xc, yc);
-    fprintf(ctxcanvas->file, "1 %g scale\n", ((double)h)/w);
-    fprintf(ctxcanvas->file, "N\n");
-    fprintf(ctxcanvas->file, "0 0 %g %g %g arc\n", 0.5*w, a1, a2);
-    fprintf(ctxcanvas->file, "S\n");
-    fprintf(ctxcanvas->file, "setmatrix\n"); /* back to CTM */
+    cdStreamPrintf(ctxcanvas->stream, "[0 0 0 0 0 0] currentmatrix\n"); /* fill new matrix from CTM */
+    cdStreamPrintf(ctxcanvas->stream, "%d %d translate\n", xc, yc);
+    cdStreamPrintf(ctxcanvas->stream, "1 %g scale\n", ((double)h)/w);
+    cdStreamPrintf(ctxcanvas->stream, "N\n");
+    cdStreamPrintf(ctxcanvas->stream, "0 0 %g %g %g arc\n", 0.5*w, a1, a2);
+    cdStreamPrintf(ctxcanvas->stream, "S\n");
+    cdStreamPrintf(ctxcanvas->stream, "setmatrix\n"); /* back to CTM */
 
-    if (ctxcanvas->debug) fprintf(ctxcanvas->file, "%%cdArc EllipseEnd\n");
+    if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "%%cdArc EllipseEnd\n");
   }
 
   if (ctxcanvas->eps)
@@ -676,21 +679,21 @@ static void cdfarc(cdCtxCanvas *ctxcanvas, double xc, double yc, double w, doubl
 
   if (w==h) /* Circulo: PS implementa direto */
   {
-    fprintf(ctxcanvas->file, "N %g %g %g %g %g arc S\n", xc, yc, 0.5*w, a1, a2);
+    cdStreamPrintf(ctxcanvas->stream, "N %g %g %g %g %g arc S\n", xc, yc, 0.5*w, a1, a2);
   }
   else /* Elipse: mudar a escala p/ criar a partir do circulo */
   {
-    if (ctxcanvas->debug) fprintf(ctxcanvas->file, "\n%%cdfArc Ellipse Begin\n");
+    if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "\n%%cdfArc Ellipse Begin\n");
 
-    fprintf(ctxcanvas->file, "[0 0 0 0 0 0] currentmatrix\n");
-    fprintf(ctxcanvas->file, "%g %g translate\n", xc, yc);
-    fprintf(ctxcanvas->file, "1 %g scale\n", h/w);
-    fprintf(ctxcanvas->file, "N\n");
-    fprintf(ctxcanvas->file, "0 0 %g %g %g arc\n", 0.5*w, a1, a2);
-    fprintf(ctxcanvas->file, "S\n");
-    fprintf(ctxcanvas->file, "setmatrix\n");
+    cdStreamPrintf(ctxcanvas->stream, "[0 0 0 0 0 0] currentmatrix\n");
+    cdStreamPrintf(ctxcanvas->stream, "%g %g translate\n", xc, yc);
+    cdStreamPrintf(ctxcanvas->stream, "1 %g scale\n", h/w);
+    cdStreamPrintf(ctxcanvas->stream, "N\n");
+    cdStreamPrintf(ctxcanvas->stream, "0 0 %g %g %g arc\n", 0.5*w, a1, a2);
+    cdStreamPrintf(ctxcanvas->stream, "S\n");
+    cdStreamPrintf(ctxcanvas->stream, "setmatrix\n");
 
-    if (ctxcanvas->debug) fprintf(ctxcanvas->file, "%%cdfArc EllipseEnd\n");
+    if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "%%cdfArc EllipseEnd\n");
   }
 
   if (ctxcanvas->eps)
@@ -708,29 +711,29 @@ static void cdsector(cdCtxCanvas *ctxcanvas, int xc, int yc, int w, int h, doubl
 
   if (w==h) /* Circulo: PS implementa direto */
   {
-    if (ctxcanvas->debug) fprintf(ctxcanvas->file, "\n%%cdSector Circle Begin\n");
+    if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "\n%%cdSector Circle Begin\n");
 
-    fprintf(ctxcanvas->file, "N\n");
-    fprintf(ctxcanvas->file, "%d %d M\n", xc, yc);
-    fprintf(ctxcanvas->file, "%d %d %g %g %g arc\n", xc, yc, 0.5*w, a1, a2);
-    fprintf(ctxcanvas->file, "C fill\n");
+    cdStreamPrintf(ctxcanvas->stream, "N\n");
+    cdStreamPrintf(ctxcanvas->stream, "%d %d M\n", xc, yc);
+    cdStreamPrintf(ctxcanvas->stream, "%d %d %g %g %g arc\n", xc, yc, 0.5*w, a1, a2);
+    cdStreamPrintf(ctxcanvas->stream, "C fill\n");
 
-    if (ctxcanvas->debug) fprintf(ctxcanvas->file, "%%cdSector CircleEnd\n");
+    if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "%%cdSector CircleEnd\n");
   }
   else /* Elipse: mudar a escala p/ criar a partir do circulo */
   {
-    if (ctxcanvas->debug) fprintf(ctxcanvas->file, "\n%%cdSector Ellipse Begin\n");
+    if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "\n%%cdSector Ellipse Begin\n");
 
-    fprintf(ctxcanvas->file, "[0 0 0 0 0 0] currentmatrix\n");
-    fprintf(ctxcanvas->file, "%d %d translate\n", xc, yc);
-    fprintf(ctxcanvas->file, "1 %g scale\n", ((double)h)/w);
-    fprintf(ctxcanvas->file, "N\n");
-    fprintf(ctxcanvas->file, "0 0 M\n");
-    fprintf(ctxcanvas->file, "0 0 %g %g %g arc\n", 0.5*w, a1, a2);
-    fprintf(ctxcanvas->file, "C fill\n");
-    fprintf(ctxcanvas->file, "setmatrix\n");
+    cdStreamPrintf(ctxcanvas->stream, "[0 0 0 0 0 0] currentmatrix\n");
+    cdStreamPrintf(ctxcanvas->stream, "%d %d translate\n", xc, yc);
+    cdStreamPrintf(ctxcanvas->stream, "1 %g scale\n", ((double)h)/w);
+    cdStreamPrintf(ctxcanvas->stream, "N\n");
+    cdStreamPrintf(ctxcanvas->stream, "0 0 M\n");
+    cdStreamPrintf(ctxcanvas->stream, "0 0 %g %g %g arc\n", 0.5*w, a1, a2);
+    cdStreamPrintf(ctxcanvas->stream, "C fill\n");
+    cdStreamPrintf(ctxcanvas->stream, "setmatrix\n");
 
-    if (ctxcanvas->debug) fprintf(ctxcanvas->file, "%%cdSector EllipseEnd\n");
+    if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "%%cdSector EllipseEnd\n");
   }
 
   if (ctxcanvas->eps)
@@ -749,29 +752,29 @@ static void cdfsector(cdCtxCanvas *ctxcanvas, double xc, double yc, double w, do
 
   if (w==h) /* Circulo: PS implementa direto */
   {
-    if (ctxcanvas->debug) fprintf(ctxcanvas->file, "\n%%cdfSector Circle Begin\n");
+    if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "\n%%cdfSector Circle Begin\n");
 
-    fprintf(ctxcanvas->file, "N\n");
-    fprintf(ctxcanvas->file, "%g %g M\n", xc, yc);
-    fprintf(ctxcanvas->file, "%g %g %g %g %g arc\n", xc, yc, 0.5*w, a1, a2);
-    fprintf(ctxcanvas->file, "C fill\n");
+    cdStreamPrintf(ctxcanvas->stream, "N\n");
+    cdStreamPrintf(ctxcanvas->stream, "%g %g M\n", xc, yc);
+    cdStreamPrintf(ctxcanvas->stream, "%g %g %g %g %g arc\n", xc, yc, 0.5*w, a1, a2);
+    cdStreamPrintf(ctxcanvas->stream, "C fill\n");
 
-    if (ctxcanvas->debug) fprintf(ctxcanvas->file, "%%cdfSector CircleEnd\n");
+    if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "%%cdfSector CircleEnd\n");
   }
   else /* Elipse: mudar a escala p/ criar a partir do circulo */
   {
-    if (ctxcanvas->debug) fprintf(ctxcanvas->file, "\n%%cdfSector Ellipse Begin\n");
+    if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "\n%%cdfSector Ellipse Begin\n");
 
-    fprintf(ctxcanvas->file, "[0 0 0 0 0 0] currentmatrix\n");
-    fprintf(ctxcanvas->file, "%g %g translate\n", xc, yc);
-    fprintf(ctxcanvas->file, "1 %g scale\n", h/w);
-    fprintf(ctxcanvas->file, "N\n");
-    fprintf(ctxcanvas->file, "0 0 M\n");
-    fprintf(ctxcanvas->file, "0 0 %g %g %g arc\n", 0.5*w, a1, a2);
-    fprintf(ctxcanvas->file, "C fill\n");
-    fprintf(ctxcanvas->file, "setmatrix\n");
+    cdStreamPrintf(ctxcanvas->stream, "[0 0 0 0 0 0] currentmatrix\n");
+    cdStreamPrintf(ctxcanvas->stream, "%g %g translate\n", xc, yc);
+    cdStreamPrintf(ctxcanvas->stream, "1 %g scale\n", h/w);
+    cdStreamPrintf(ctxcanvas->stream, "N\n");
+    cdStreamPrintf(ctxcanvas->stream, "0 0 M\n");
+    cdStreamPrintf(ctxcanvas->stream, "0 0 %g %g %g arc\n", 0.5*w, a1, a2);
+    cdStreamPrintf(ctxcanvas->stream, "C fill\n");
+    cdStreamPrintf(ctxcanvas->stream, "setmatrix\n");
 
-    if (ctxcanvas->debug) fprintf(ctxcanvas->file, "%%cdfSector EllipseEnd\n");
+    if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "%%cdfSector EllipseEnd\n");
   }
 
   if (ctxcanvas->eps)
@@ -790,27 +793,27 @@ static void cdchord(cdCtxCanvas *ctxcanvas, int xc, int yc, int w, int h, double
 
   if (w==h) /* Circulo: PS implementa direto */
   {
-    if (ctxcanvas->debug) fprintf(ctxcanvas->file, "\n%%cdChord Circle Begin\n");
+    if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "\n%%cdChord Circle Begin\n");
 
-    fprintf(ctxcanvas->file, "N\n");
-    fprintf(ctxcanvas->file, "%d %d %g %g %g arc\n", xc, yc, 0.5*w, a1, a2);
-    fprintf(ctxcanvas->file, "C fill\n");
+    cdStreamPrintf(ctxcanvas->stream, "N\n");
+    cdStreamPrintf(ctxcanvas->stream, "%d %d %g %g %g arc\n", xc, yc, 0.5*w, a1, a2);
+    cdStreamPrintf(ctxcanvas->stream, "C fill\n");
 
-    if (ctxcanvas->debug) fprintf(ctxcanvas->file, "%%cdChord CircleEnd\n");
+    if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "%%cdChord CircleEnd\n");
   }
   else /* Elipse: mudar a escala p/ criar a partir do circulo */
   {
-    if (ctxcanvas->debug) fprintf(ctxcanvas->file, "\n%%cdChord Ellipse Begin\n");
+    if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "\n%%cdChord Ellipse Begin\n");
 
-    fprintf(ctxcanvas->file, "[0 0 0 0 0 0] currentmatrix\n");
-    fprintf(ctxcanvas->file, "%d %d translate\n", xc, yc);
-    fprintf(ctxcanvas->file, "1 %g scale\n", ((double)h)/w);
-    fprintf(ctxcanvas->file, "N\n");
-    fprintf(ctxcanvas->file, "0 0 %g %g %g arc\n", 0.5*w, a1, a2);
-    fprintf(ctxcanvas->file, "C fill\n");
-    fprintf(ctxcanvas->file, "setmatrix\n");
+    cdStreamPrintf(ctxcanvas->stream, "[0 0 0 0 0 0] currentmatrix\n");
+    cdStreamPrintf(ctxcanvas->stream, "%d %d translate\n", xc, yc);
+    cdStreamPrintf(ctxcanvas->stream, "1 %g scale\n", ((double)h)/w);
+    cdStreamPrintf(ctxcanvas->stream, "N\n");
+    cdStreamPrintf(ctxcanvas->stream, "0 0 %g %g %g arc\n", 0.5*w, a1, a2);
+    cdStreamPrintf(ctxcanvas->stream, "C fill\n");
+    cdStreamPrintf(ctxcanvas->stream, "setmatrix\n");
 
-    if (ctxcanvas->debug) fprintf(ctxcanvas->file, "%%cdChord EllipseEnd\n");
+    if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "%%cdChord EllipseEnd\n");
   }
 
   if (ctxcanvas->eps)
@@ -828,27 +831,27 @@ static void cdfchord(cdCtxCanvas *ctxcanvas, double xc, double yc, double w, dou
 
   if (w==h) /* Circulo: PS implementa direto */
   {
-    if (ctxcanvas->debug) fprintf(ctxcanvas->file, "\n%%cdfChord Circle Begin\n");
+    if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "\n%%cdfChord Circle Begin\n");
 
-    fprintf(ctxcanvas->file, "N\n");
-    fprintf(ctxcanvas->file, "%g %g %g %g %g arc\n", xc, yc, 0.5*w, a1, a2);
-    fprintf(ctxcanvas->file, "C fill\n");
+    cdStreamPrintf(ctxcanvas->stream, "N\n");
+    cdStreamPrintf(ctxcanvas->stream, "%g %g %g %g %g arc\n", xc, yc, 0.5*w, a1, a2);
+    cdStreamPrintf(ctxcanvas->stream, "C fill\n");
 
-    if (ctxcanvas->debug) fprintf(ctxcanvas->file, "%%cdfChord CircleEnd\n");
+    if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "%%cdfChord CircleEnd\n");
   }
   else /* Elipse: mudar a escala p/ criar a partir do circulo */
   {
-    if (ctxcanvas->debug) fprintf(ctxcanvas->file, "\n%%cdfChord Ellipse Begin\n");
+    if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "\n%%cdfChord Ellipse Begin\n");
 
-    fprintf(ctxcanvas->file, "[0 0 0 0 0 0] currentmatrix\n");
-    fprintf(ctxcanvas->file, "%g %g translate\n", xc, yc);
-    fprintf(ctxcanvas->file, "1 %g scale\n", h/w);
-    fprintf(ctxcanvas->file, "N\n");
-    fprintf(ctxcanvas->file, "0 0 %g %g %g arc\n", 0.5*w, a1, a2);
-    fprintf(ctxcanvas->file, "C fill\n");
-    fprintf(ctxcanvas->file, "setmatrix\n");
+    cdStreamPrintf(ctxcanvas->stream, "[0 0 0 0 0 0] currentmatrix\n");
+    cdStreamPrintf(ctxcanvas->stream, "%g %g translate\n", xc, yc);
+    cdStreamPrintf(ctxcanvas->stream, "1 %g scale\n", h/w);
+    cdStreamPrintf(ctxcanvas->stream, "N\n");
+    cdStreamPrintf(ctxcanvas->stream, "0 0 %g %g %g arc\n", 0.5*w, a1, a2);
+    cdStreamPrintf(ctxcanvas->stream, "C fill\n");
+    cdStreamPrintf(ctxcanvas->stream, "setmatrix\n");
 
-    if (ctxcanvas->debug) fprintf(ctxcanvas->file, "%%cdfChord EllipseEnd\n");
+    if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "%%cdfChord EllipseEnd\n");
   }
 
   if (ctxcanvas->eps)
@@ -872,69 +875,69 @@ static void cdtext(cdCtxCanvas *ctxcanvas, int x, int y, const char *s, int len)
   cdCanvasGetFontDim(ctxcanvas->canvas, NULL, &height, &ascent, NULL);
   baseline = height - ascent;
 
-  if (ctxcanvas->debug) fprintf(ctxcanvas->file, "\n%%cdText Begin\n");
+  if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "\n%%cdText Begin\n");
 
   if (ctxcanvas->canvas->use_matrix || ctxcanvas->rotate_angle)
     set_default_matrix(ctxcanvas);
 
-  fprintf(ctxcanvas->file, "N 0 0 M\n");
-  putc('(', ctxcanvas->file);
+  cdStreamPrintf(ctxcanvas->stream, "N 0 0 M\n");
+  cdStreamPutChar(ctxcanvas->stream, '(');
 
   for (i=0; i<len; i++)
   {
     if (s[i]=='(' || s[i]==')')
-      putc('\\', ctxcanvas->file);
-    putc(s[i], ctxcanvas->file);
-  }
-
-  fprintf(ctxcanvas->file, ")\n");
-  fprintf(ctxcanvas->file, "dup true charpath\n");
-  fprintf(ctxcanvas->file, "flattenpath\n");
-  fprintf(ctxcanvas->file, "pathbbox\n");    /* bbox na pilha: llx lly urx ury */
-  fprintf(ctxcanvas->file, "exch\n");        /* troca o topo: llx lly ury urx */
-  fprintf(ctxcanvas->file, "4 1 roll\n");    /* roda: urx llx lly ury */
-  fprintf(ctxcanvas->file, "exch\n");        /* troca o topo: urx llx ury lly */
-  fprintf(ctxcanvas->file, "sub\n");         /* subtrai: urx llx h */
-  fprintf(ctxcanvas->file, "3 1 roll\n");    /* roda: h urx llx */
-  fprintf(ctxcanvas->file, "sub\n");         /* subtrai: h w */
-  fprintf(ctxcanvas->file, "0 0\n");         /* empilha: h w 0 0 */
-  fprintf(ctxcanvas->file, "4 -1 roll\n");   /* roda: w 0 0 h */
+      cdStreamPutChar(ctxcanvas->stream, '\\');
+    cdStreamPutChar(ctxcanvas->stream, s[i]);
+  }
+
+  cdStreamPrintf(ctxcanvas->stream, ")\n");
+  cdStreamPrintf(ctxcanvas->stream, "dup true charpath\n");
+  cdStreamPrintf(ctxcanvas->stream, "flattenpath\n");
+  cdStreamPrintf(ctxcanvas->stream, "pathbbox\n");    /* bbox na pilha: llx lly urx ury */
+  cdStreamPrintf(ctxcanvas->stream, "exch\n");        /* troca o topo: llx lly ury urx */
+  cdStreamPrintf(ctxcanvas->stream, "4 1 roll\n");    /* roda: urx llx lly ury */
+  cdStreamPrintf(ctxcanvas->stream, "exch\n");        /* troca o topo: urx llx ury lly */
+  cdStreamPrintf(ctxcanvas->stream, "sub\n");         /* subtrai: urx llx h */
+  cdStreamPrintf(ctxcanvas->stream, "3 1 roll\n");    /* roda: h urx llx */
+  cdStreamPrintf(ctxcanvas->stream, "sub\n");         /* subtrai: h w */
+  cdStreamPrintf(ctxcanvas->stream, "0 0\n");         /* empilha: h w 0 0 */
+  cdStreamPrintf(ctxcanvas->stream, "4 -1 roll\n");   /* roda: w 0 0 h */
 
   if (ctxcanvas->canvas->use_matrix || ctxcanvas->rotate_angle)
     cdtransform(ctxcanvas, ctxcanvas->canvas->use_matrix? ctxcanvas->canvas->matrix: NULL);
 
-  fprintf(ctxcanvas->file, "gsave\n");   /* save to use local transform */
-  fprintf(ctxcanvas->file, "%d %d translate\n", x, y);
+  cdStreamPrintf(ctxcanvas->stream, "gsave\n");   /* save to use local transform */
+  cdStreamPrintf(ctxcanvas->stream, "%d %d translate\n", x, y);
 
   if (ctxcanvas->canvas->text_orientation != 0)
-    fprintf(ctxcanvas->file, "%g rotate\n", ctxcanvas->canvas->text_orientation);
+    cdStreamPrintf(ctxcanvas->stream, "%g rotate\n", ctxcanvas->canvas->text_orientation);
 
   switch (ctxcanvas->canvas->text_alignment) /* Operacao em Y. topo da pilha: w x y h */
   {
   case CD_NORTH:
   case CD_NORTH_EAST:
   case CD_NORTH_WEST:
-    fprintf(ctxcanvas->file, "%d sub sub\n", baseline);       /* empilha, subtrai, subtrai: w x y-(h-baseline) */
+    cdStreamPrintf(ctxcanvas->stream, "%d sub sub\n", baseline);       /* empilha, subtrai, subtrai: w x y-(h-baseline) */
     break;
   case CD_EAST:
   case CD_WEST:
   case CD_CENTER:
-    fprintf(ctxcanvas->file, "2 div %d sub sub\n", baseline); /* empilha, divide, empilha, subtrai, subtrai: w x y-(h/2-baseline) */
+    cdStreamPrintf(ctxcanvas->stream, "2 div %d sub sub\n", baseline); /* empilha, divide, empilha, subtrai, subtrai: w x y-(h/2-baseline) */
     break;
   case CD_SOUTH_EAST:
   case CD_SOUTH:
   case CD_SOUTH_WEST:
-    fprintf(ctxcanvas->file, "pop %d add\n", baseline); /* desempilha, empilha, adiciona: w x y+baseline */
+    cdStreamPrintf(ctxcanvas->stream, "pop %d add\n", baseline); /* desempilha, empilha, adiciona: w x y+baseline */
     break;
   case CD_BASE_RIGHT:
   case CD_BASE_CENTER:
   case CD_BASE_LEFT:
-    fprintf(ctxcanvas->file, "pop\n");       /* desempilha h: w x y */
+    cdStreamPrintf(ctxcanvas->stream, "pop\n");       /* desempilha h: w x y */
     break;
   }
 
-  fprintf(ctxcanvas->file, "3 1 roll\n");    /* roda: y' w x */
-  fprintf(ctxcanvas->file, "exch\n");        /* inverte: y' x w */
+  cdStreamPrintf(ctxcanvas->stream, "3 1 roll\n");    /* roda: y' w x */
+  cdStreamPrintf(ctxcanvas->stream, "exch\n");        /* inverte: y' x w */
 
   switch (ctxcanvas->canvas->text_alignment) /* Operacao em X, topo da pilha: x w */
   {
@@ -942,26 +945,26 @@ static void cdtext(cdCtxCanvas *ctxcanvas, int x, int y, const char *s, int len)
   case CD_SOUTH:
   case CD_CENTER:
   case CD_BASE_CENTER:
-    fprintf(ctxcanvas->file, "2 div sub\n");  /* empilha, divide, subtrai: y' x-w/2 */
+    cdStreamPrintf(ctxcanvas->stream, "2 div sub\n");  /* empilha, divide, subtrai: y' x-w/2 */
     break;
   case CD_NORTH_EAST:
   case CD_EAST:
   case CD_SOUTH_EAST:
   case CD_BASE_RIGHT:
-    fprintf(ctxcanvas->file, "sub\n");        /* subtrai: y' x-w */
+    cdStreamPrintf(ctxcanvas->stream, "sub\n");        /* subtrai: y' x-w */
     break;
   case CD_SOUTH_WEST:
   case CD_WEST:
   case CD_NORTH_WEST:
   case CD_BASE_LEFT:
-    fprintf(ctxcanvas->file, "pop\n");        /* desempilha: y' x */
+    cdStreamPrintf(ctxcanvas->stream, "pop\n");        /* desempilha: y' x */
     break;
   }
 
-  fprintf(ctxcanvas->file, "exch\n");         /* inverte: x' y' */
-  fprintf(ctxcanvas->file, "M\n");            /* moveto */
+  cdStreamPrintf(ctxcanvas->stream, "exch\n");         /* inverte: x' y' */
+  cdStreamPrintf(ctxcanvas->stream, "M\n");            /* moveto */
 
-  fprintf(ctxcanvas->file, "show\n");
+  cdStreamPrintf(ctxcanvas->stream, "show\n");
 
   if (ctxcanvas->eps)
   {
@@ -973,9 +976,9 @@ static void cdtext(cdCtxCanvas *ctxcanvas, int x, int y, const char *s, int len)
     bbox(ctxcanvas, xmax, ymax);
   }
 
-  fprintf(ctxcanvas->file, "grestore\n");
+  cdStreamPrintf(ctxcanvas->stream, "grestore\n");
 
-  if (ctxcanvas->debug) fprintf(ctxcanvas->file, "%%cdTextEnd\n");
+  if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "%%cdTextEnd\n");
 }
 
 static void cdftext(cdCtxCanvas *ctxcanvas, double x, double y, const char *s, int len)
@@ -988,69 +991,69 @@ static void cdftext(cdCtxCanvas *ctxcanvas, double x, double y, const char *s, i
   cdCanvasGetFontDim(ctxcanvas->canvas, NULL, &height, &ascent, NULL);
   baseline = height - ascent;
 
-  if (ctxcanvas->debug) fprintf(ctxcanvas->file, "\n%%cdText Begin\n");
+  if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "\n%%cdText Begin\n");
 
   if (ctxcanvas->canvas->use_matrix || ctxcanvas->rotate_angle)
     set_default_matrix(ctxcanvas);
 
-  fprintf(ctxcanvas->file, "N 0 0 M\n");
-  putc('(', ctxcanvas->file);
+  cdStreamPrintf(ctxcanvas->stream, "N 0 0 M\n");
+  cdStreamPutChar(ctxcanvas->stream, '(');
 
   for (i=0; i<len; i++)
   {
     if (s[i]=='(' || s[i]==')')
-      putc('\\', ctxcanvas->file);
-    putc(s[i], ctxcanvas->file);
-  }
-
-  fprintf(ctxcanvas->file, ")\n");
-  fprintf(ctxcanvas->file, "dup true charpath\n");
-  fprintf(ctxcanvas->file, "flattenpath\n");
-  fprintf(ctxcanvas->file, "pathbbox\n");    /* bbox na pilha: llx lly urx ury */
-  fprintf(ctxcanvas->file, "exch\n");        /* troca o topo: llx lly ury urx */
-  fprintf(ctxcanvas->file, "4 1 roll\n");    /* roda: urx llx lly ury */
-  fprintf(ctxcanvas->file, "exch\n");        /* troca o topo: urx llx ury lly */
-  fprintf(ctxcanvas->file, "sub\n");         /* subtrai: urx llx h */
-  fprintf(ctxcanvas->file, "3 1 roll\n");    /* roda: h urx llx */
-  fprintf(ctxcanvas->file, "sub\n");         /* subtrai: h w */
-  fprintf(ctxcanvas->file, "0 0\n");         /* empilha: h w 0 0 */
-  fprintf(ctxcanvas->file, "4 -1 roll\n");   /* roda: w 0 0 h */
+      cdStreamPutChar(ctxcanvas->stream, '\\');
+    cdStreamPutChar(ctxcanvas->stream, s[i]);
+  }
+
+  cdStreamPrintf(ctxcanvas->stream, ")\n");
+  cdStreamPrintf(ctxcanvas->stream, "dup true charpath\n");
+  cdStreamPrintf(ctxcanvas->stream, "flattenpath\n");
+  cdStreamPrintf(ctxcanvas->stream, "pathbbox\n");    /* bbox na pilha: llx lly urx ury */
+  cdStreamPrintf(ctxcanvas->stream, "exch\n");        /* troca o topo: llx lly ury urx */
+  cdStreamPrintf(ctxcanvas->stream, "4 1 roll\n");    /* roda: urx llx lly ury */
+  cdStreamPrintf(ctxcanvas->stream, "exch\n");        /* troca o topo: urx llx ury lly */
+  cdStreamPrintf(ctxcanvas->stream, "sub\n");         /* subtrai: urx llx h */
+  cdStreamPrintf(ctxcanvas->stream, "3 1 roll\n");    /* roda: h urx llx */
+  cdStreamPrintf(ctxcanvas->stream, "sub\n");         /* subtrai: h w */
+  cdStreamPrintf(ctxcanvas->stream, "0 0\n");         /* empilha: h w 0 0 */
+  cdStreamPrintf(ctxcanvas->stream, "4 -1 roll\n");   /* roda: w 0 0 h */
 
   if (ctxcanvas->canvas->use_matrix || ctxcanvas->rotate_angle)
     cdtransform(ctxcanvas, ctxcanvas->canvas->use_matrix? ctxcanvas->canvas->matrix: NULL);
 
-  fprintf(ctxcanvas->file, "gsave\n");   /* save to use local transform */
-  fprintf(ctxcanvas->file, "%g %g translate\n", x, y);
+  cdStreamPrintf(ctxcanvas->stream, "gsave\n");   /* save to use local transform */
+  cdStreamPrintf(ctxcanvas->stream, "%g %g translate\n", x, y);
 
   if (ctxcanvas->canvas->text_orientation != 0)
-    fprintf(ctxcanvas->file, "%g rotate\n", ctxcanvas->canvas->text_orientation);
+    cdStreamPrintf(ctxcanvas->stream, "%g rotate\n", ctxcanvas->canvas->text_orientation);
 
   switch (ctxcanvas->canvas->text_alignment) /* Operacao em Y. topo da pilha: w x y h */
   {
   case CD_NORTH:
   case CD_NORTH_EAST:
   case CD_NORTH_WEST:
-    fprintf(ctxcanvas->file, "%d sub sub\n", baseline);       /* empilha, subtrai, subtrai: w x y-(h-baseline) */
+    cdStreamPrintf(ctxcanvas->stream, "%d sub sub\n", baseline);       /* empilha, subtrai, subtrai: w x y-(h-baseline) */
     break;
   case CD_EAST:
   case CD_WEST:
   case CD_CENTER:
-    fprintf(ctxcanvas->file, "2 div %d sub sub\n", baseline); /* empilha, divide, empilha, subtrai, subtrai: w x y-(h/2-baseline) */
+    cdStreamPrintf(ctxcanvas->stream, "2 div %d sub sub\n", baseline); /* empilha, divide, empilha, subtrai, subtrai: w x y-(h/2-baseline) */
     break;
   case CD_SOUTH_EAST:
   case CD_SOUTH:
   case CD_SOUTH_WEST:
-    fprintf(ctxcanvas->file, "pop %d add\n", baseline); /* desempilha, empilha, adiciona: w x y+baseline */
+    cdStreamPrintf(ctxcanvas->stream, "pop %d add\n", baseline); /* desempilha, empilha, adiciona: w x y+baseline */
     break;
   case CD_BASE_RIGHT:
   case CD_BASE_CENTER:
   case CD_BASE_LEFT:
-    fprintf(ctxcanvas->file, "pop\n");       /* desempilha h: w x y */
+    cdStreamPrintf(ctxcanvas->stream, "pop\n");       /* desempilha h: w x y */
     break;
   }
 
-  fprintf(ctxcanvas->file, "3 1 roll\n");    /* roda: y' w x */
-  fprintf(ctxcanvas->file, "exch\n");        /* inverte: y' x w */
+  cdStreamPrintf(ctxcanvas->stream, "3 1 roll\n");    /* roda: y' w x */
+  cdStreamPrintf(ctxcanvas->stream, "exch\n");        /* inverte: y' x w */
 
   switch (ctxcanvas->canvas->text_alignment) /* Operacao em X, topo da pilha: x w */
   {
@@ -1058,26 +1061,26 @@ static void cdftext(cdCtxCanvas *ctxcanvas, double x, double y, const char *s, i
   case CD_SOUTH:
   case CD_CENTER:
   case CD_BASE_CENTER:
-    fprintf(ctxcanvas->file, "2 div sub\n");  /* empilha, divide, subtrai: y' x-w/2 */
+    cdStreamPrintf(ctxcanvas->stream, "2 div sub\n");  /* empilha, divide, subtrai: y' x-w/2 */
     break;
   case CD_NORTH_EAST:
   case CD_EAST:
   case CD_SOUTH_EAST:
   case CD_BASE_RIGHT:
-    fprintf(ctxcanvas->file, "sub\n");        /* subtrai: y' x-w */
+    cdStreamPrintf(ctxcanvas->stream, "sub\n");        /* subtrai: y' x-w */
     break;
   case CD_SOUTH_WEST:
   case CD_WEST:
   case CD_NORTH_WEST:
   case CD_BASE_LEFT:
-    fprintf(ctxcanvas->file, "pop\n");        /* desempilha: y' x */
+    cdStreamPrintf(ctxcanvas->stream, "pop\n");        /* desempilha: y' x */
     break;
   }
 
-  fprintf(ctxcanvas->file, "exch\n");         /* inverte: x' y' */
-  fprintf(ctxcanvas->file, "M\n");            /* moveto */
+  cdStreamPrintf(ctxcanvas->stream, "exch\n");         /* inverte: x' y' */
+  cdStreamPrintf(ctxcanvas->stream, "M\n");            /* moveto */
 
-  fprintf(ctxcanvas->file, "show\n");
+  cdStreamPrintf(ctxcanvas->stream, "show\n");
 
   if (ctxcanvas->eps)
   {
@@ -1089,9 +1092,30 @@ static void cdftext(cdCtxCanvas *ctxcanvas, double x, double y, const char *s, i
     fbbox(ctxcanvas, (double)xmax, (double)ymax);
   }
 
-  fprintf(ctxcanvas->file, "grestore\n");
+  cdStreamPrintf(ctxcanvas->stream, "grestore\n");
+
+  if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "%%cdTextEnd\n");
+}
+
+/* writes "x y op", the polygon vertices do not use printf */
+static void ps_point(cdStream* stream, int x, int y, char op)
+{
+  cdStreamPutInt(stream, x);
+  cdStreamPutChar(stream, ' ');
+  cdStreamPutInt(stream, y);
+  cdStreamPutChar(stream, ' ');
+  cdStreamPutChar(stream, op);
+  cdStreamPutChar(stream, '\n');
+}
 
-  if (ctxcanvas->debug) fprintf(ctxcanvas->file, "%%cdTextEnd\n");
+static void ps_fpoint(cdStream* stream, double x, double y, char op)
+{
+  cdStreamPutReal(stream, x);
+  cdStreamPutChar(stream, ' ');
+  cdStreamPutReal(stream, y);
+  cdStreamPutChar(stream, ' ');
+  cdStreamPutChar(stream, op);
+  cdStreamPutChar(stream, '\n');
 }
 
 static void cdpoly(cdCtxCanvas *ctxcanvas, int mode, cdPoint* poly, int n)
@@ -1103,7 +1127,7 @@ static void cdpoly(cdCtxCanvas *ctxcanvas, int mode, cdPoint* poly, int n)
     int p;
 
     /* if there is any current path, remove it */
-    fprintf(ctxcanvas->file, "newpath\n");
+    cdStreamPrintf(ctxcanvas->stream, "newpath\n");
 
     i = 0;
     for (p=0; p<ctxcanvas->canvas->path_n; p++)
@@ -1111,16 +1135,16 @@ static void cdpoly(cdCtxCanvas *ctxcanvas, int mode, cdPoint* poly, int n)
       switch(ctxcanvas->canvas->path[p])
       {
       case CD_PATH_NEW:
-        fprintf(ctxcanvas->file, "newpath\n");
+        cdStreamPrintf(ctxcanvas->stream, "newpath\n");
         break;
       case CD_PATH_MOVETO:
         if (i+1 > n) return;
-        fprintf(ctxcanvas->file, "%d %d M\n", poly[i].x, poly[i].y);
+        ps_point(ctxcanvas->stream, poly[i].x, poly[i].y, 'M');
         i++;
         break;
       case CD_PATH_LINETO:
         if (i+1 > n) return;
-        fprintf(ctxcanvas->file, "%d %d L\n", poly[i].x, poly[i].y);
+        ps_point(ctxcanvas->stream, poly[i].x, poly[i].y, 'L');
         i++;
         break;
       case CD_PATH_ARC:
@@ -1139,15 +1163,15 @@ static void cdpoly(cdCtxCanvas *ctxcanvas, int mode, cdPoint* poly, int n)
 
           if (w==h) /* Circulo: PS implementa direto */
           {
-            fprintf(ctxcanvas->file, "%d %d %g %g %g %s\n", xc, yc, 0.5*w, a1, a2, arc);
+            cdStreamPrintf(ctxcanvas->stream, "%d %d %g %g %g %s\n", xc, yc, 0.5*w, a1, a2, arc);
           }
           else /* Elipse: mudar a escala p/ criar a partir do circulo */
           {
-            fprintf(ctxcanvas->file, "[0 0 0 0 0 0] currentmatrix\n"); /* fill new matrix from CTM */
-            fprintf(ctxcanvas->file, "%d %d translate\n", xc, yc);
-            fprintf(ctxcanvas->file, "1 %g scale\n", ((double)h)/w);
-            fprintf(ctxcanvas->file, "0 0 %g %g %g %s\n", 0.5*w, a1, a2, arc);
-            fprintf(ctxcanvas->file, "setmatrix\n"); /* back to CTM */
+            cdStreamPrintf(ctxcanvas->stream, "[0 0 0 0 0 0] currentmatrix\n"); /* fill new matrix from CTM */
+            cdStreamPrintf(ctxcanvas->stream, "%d %d translate\n", xc, yc);
+            cdStreamPrintf(ctxcanvas->stream, "1 %g scale\n", ((double)h)/w);
+            cdStreamPrintf(ctxcanvas->stream, "0 0 %g %g %g %s\n", 0.5*w, a1, a2, arc);
+            cdStreamPrintf(ctxcanvas->stream, "setmatrix\n"); /* back to CTM */
           }
 
           i += 3;
@@ -1155,41 +1179,41 @@ static void cdpoly(cdCtxCanvas *ctxcanvas, int mode, cdPoint* poly, int n)
         break;
       case CD_PATH_CURVETO:
         if (i+3 > n) return;
-        fprintf(ctxcanvas->file, "%d %d %d %d %d %d B\n", poly[i].x,   poly[i].y, 
+        cdStreamPrintf(ctxcanvas->stream, "%d %d %d %d %d %d B\n", poly[i].x,   poly[i].y, 
                                                           poly[i+1].x, poly[i+1].y, 
                                                           poly[i+2].x, poly[i+2].y);
         i += 3;
         break;
       case CD_PATH_CLOSE:
-        fprintf(ctxcanvas->file, "closepath\n");
+        cdStreamPrintf(ctxcanvas->stream, "closepath\n");
         break;
       case CD_PATH_FILL:
         sUpdateFill(ctxcanvas, 1);
         if (ctxcanvas->holes || ctxcanvas->canvas->fill_mode==CD_EVENODD)
-          fprintf(ctxcanvas->file, "eofill\n");
+          cdStreamPrintf(ctxcanvas->stream, "eofill\n");
         else
-          fprintf(ctxcanvas->file, "fill\n");
+          cdStreamPrintf(ctxcanvas->stream, "fill\n");
         break;
       case CD_PATH_STROKE:
         sUpdateFill(ctxcanvas, 0);
-        fprintf(ctxcanvas->file, "stroke\n");
+        cdStreamPrintf(ctxcanvas->stream, "stroke\n");
         break;
       case CD_PATH_FILLSTROKE:
         sUpdateFill(ctxcanvas, 1);
-        fprintf(ctxcanvas->file, "gsave\n");
+        cdStreamPrintf(ctxcanvas->stream, "gsave\n");
         if (ctxcanvas->holes || ctxcanvas->canvas->fill_mode==CD_EVENODD)
-          fprintf(ctxcanvas->file, "eofill\n");
+          cdStreamPrintf(ctxcanvas->stream, "eofill\n");
         else
-          fprintf(ctxcanvas->file, "fill\n");
-        fprintf(ctxcanvas->file, "grestore\n");
+          cdStreamPrintf(ctxcanvas->stream, "fill\n");
+        cdStreamPrintf(ctxcanvas->stream, "grestore\n");
         sUpdateFill(ctxcanvas, 0);
-        fprintf(ctxcanvas->file, "stroke\n");
+        cdStreamPrintf(ctxcanvas->stream, "stroke\n");
         break;
       case CD_PATH_CLIP:
         if (ctxcanvas->canvas->fill_mode==CD_EVENODD)
-          fprintf(ctxcanvas->file, "closepath eoclip\n");
+          cdStreamPrintf(ctxcanvas->stream, "closepath eoclip\n");
         else
-          fprintf(ctxcanvas->file, "closepath clip\n");
+          cdStreamPrintf(ctxcanvas->stream, "closepath clip\n");
         break;
       }
     }
@@ -1201,8 +1225,8 @@ static void cdpoly(cdCtxCanvas *ctxcanvas, int mode, cdPoint* poly, int n)
     if (ctxcanvas->eps) /* initclip not allowed in EPS */
       return;
 
-    fprintf(ctxcanvas->file, "/clip_polygon {\n");
-    fprintf(ctxcanvas->file, "initclip\n");
+    cdStreamPrintf(ctxcanvas->stream, "/clip_polygon {\n");
+    cdStreamPrintf(ctxcanvas->stream, "initclip\n");
   }
   else
   {
@@ -1212,10 +1236,10 @@ static void cdpoly(cdCtxCanvas *ctxcanvas, int mode, cdPoint* poly, int n)
       sUpdateFill(ctxcanvas, 0);
   }
 
-  if (ctxcanvas->debug) fprintf(ctxcanvas->file, "\n%%cdPoly %d Begin\n", mode);
+  if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "\n%%cdPoly %d Begin\n", mode);
 
-  fprintf(ctxcanvas->file, "N\n");
-  fprintf(ctxcanvas->file, "%d %d M\n", poly[0].x, poly[0].y);
+  cdStreamPrintf(ctxcanvas->stream, "N\n");
+  ps_point(ctxcanvas->stream, poly[0].x, poly[0].y, 'M');
 
   if (ctxcanvas->eps) 
     bbox(ctxcanvas, poly[0].x, poly[0].y);
@@ -1224,7 +1248,7 @@ static void cdpoly(cdCtxCanvas *ctxcanvas, int mode, cdPoint* poly, int n)
   {
     for (i=1; i<n; i+=3)
     {
-      fprintf(ctxcanvas->file, "%d %d %d %d %d %d B\n", poly[i].x,   poly[i].y, 
+      cdStreamPrintf(ctxcanvas->stream, "%d %d %d %d %d %d B\n", poly[i].x,   poly[i].y, 
                                                           poly[i+1].x, poly[i+1].y, 
                                                           poly[i+2].x, poly[i+2].y);
 
@@ -1244,11 +1268,11 @@ static void cdpoly(cdCtxCanvas *ctxcanvas, int mode, cdPoint* poly, int n)
     {
       if (ctxcanvas->holes && i == ctxcanvas->poly_holes[hole_index])
       {
-        fprintf(ctxcanvas->file, "%d %d M\n", poly[i].x, poly[i].y);
+        ps_point(ctxcanvas->stream, poly[i].x, poly[i].y, 'M');
         hole_index++;
       }
       else
-        fprintf(ctxcanvas->file, "%d %d L\n", poly[i].x, poly[i].y);
+        ps_point(ctxcanvas->stream, poly[i].x, poly[i].y, 'L');
 
       if (ctxcanvas->eps) 
         bbox(ctxcanvas, poly[i].x, poly[i].y);
@@ -1258,33 +1282,33 @@ static void cdpoly(cdCtxCanvas *ctxcanvas, int mode, cdPoint* poly, int n)
   switch (mode)
   {
   case CD_CLOSED_LINES :
-    fprintf(ctxcanvas->file, "C S\n");
+    cdStreamPrintf(ctxcanvas->stream, "C S\n");
     break;
   case CD_OPEN_LINES :
-    fprintf(ctxcanvas->file, "S\n");
+    cdStreamPrintf(ctxcanvas->stream, "S\n");
     break;
   case CD_BEZIER :
-    fprintf(ctxcanvas->file, "S\n");
+    cdStreamPrintf(ctxcanvas->stream, "S\n");
     break;
   case CD_FILL :
     if (ctxcanvas->holes || ctxcanvas->canvas->fill_mode==CD_EVENODD)
-      fprintf(ctxcanvas->file, "eofill\n");
+      cdStreamPrintf(ctxcanvas->stream, "eofill\n");
     else
-      fprintf(ctxcanvas->file, "fill\n");
+      cdStreamPrintf(ctxcanvas->stream, "fill\n");
     break;
   case CD_CLIP :
     if (ctxcanvas->canvas->fill_mode==CD_EVENODD)
-      fprintf(ctxcanvas->file, "C eoclip\n");
+      cdStreamPrintf(ctxcanvas->stream, "C eoclip\n");
     else
-      fprintf(ctxcanvas->file, "C clip\n");
-    fprintf(ctxcanvas->file, "N\n");
-    fprintf(ctxcanvas->file, "} bind def\n");
+      cdStreamPrintf(ctxcanvas->stream, "C clip\n");
+    cdStreamPrintf(ctxcanvas->stream, "N\n");
+    cdStreamPrintf(ctxcanvas->stream, "} bind def\n");
     if (ctxcanvas->canvas->clip_mode == CD_CLIPPOLYGON) 
-      fprintf(ctxcanvas->file, "clip_polygon\n");
+      cdStreamPrintf(ctxcanvas->stream, "clip_polygon\n");
     break;
   }
 
-  if (ctxcanvas->debug) fprintf(ctxcanvas->file, "%%cdPoly %dEnd\n", mode);
+  if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "%%cdPoly %dEnd\n", mode);
 }
 
 static void cdfpoly(cdCtxCanvas *ctxcanvas, int mode, cdfPoint* poly, int n)
@@ -1296,7 +1320,7 @@ static void cdfpoly(cdCtxCanvas *ctxcanvas, int mode, cdfPoint* poly, int n)
     int p;
 
     /* if there is any current path, remove it */
-    fprintf(ctxcanvas->file, "newpath\n");
+    cdStreamPrintf(ctxcanvas->stream, "newpath\n");
 
     i = 0;
     for (p=0; p<ctxcanvas->canvas->path_n; p++)
@@ -1304,16 +1328,16 @@ static void cdfpoly(cdCtxCanvas *ctxcanvas, int mode, cdfPoint* poly, int n)
       switch(ctxcanvas->canvas->path[p])
       {
       case CD_PATH_NEW:
-        fprintf(ctxcanvas->file, "newpath\n");
+        cdStreamPrintf(ctxcanvas->stream, "newpath\n");
         break;
       case CD_PATH_MOVETO:
         if (i+1 > n) return;
-        fprintf(ctxcanvas->file, "%g %g M\n", poly[i].x, poly[i].y);
+        ps_fpoint(ctxcanvas->stream, poly[i].x, poly[i].y, 'M');
         i++;
         break;
       case CD_PATH_LINETO:
         if (i+1 > n) return;
-        fprintf(ctxcanvas->file, "%g %g L\n", poly[i].x, poly[i].y);
+        ps_fpoint(ctxcanvas->stream, poly[i].x, poly[i].y, 'L');
         i++;
         break;
       case CD_PATH_ARC:
@@ -1331,15 +1355,15 @@ static void cdfpoly(cdCtxCanvas *ctxcanvas, int mode, cdfPoint* poly, int n)
 
           if (w==h) /* Circulo: PS implementa direto */
           {
-            fprintf(ctxcanvas->file, "%g %g %g %g %g %s\n", xc, yc, 0.5*w, a1, a2, arc);
+            cdStreamPrintf(ctxcanvas->stream, "%g %g %g %g %g %s\n", xc, yc, 0.5*w, a1, a2, arc);
           }
           else /* Elipse: mudar a escala p/ criar a partir do circulo */
           {
-            fprintf(ctxcanvas->file, "[0 0 0 0 0 0] currentmatrix\n"); /* fill new matrix from CTM */
-            fprintf(ctxcanvas->file, "%g %g translate\n", xc, yc);
-            fprintf(ctxcanvas->file, "1 %g scale\n", ((double)h)/w);
-            fprintf(ctxcanvas->file, "0 0 %g %g %g %s\n", 0.5*w, a1, a2, arc);
-            fprintf(ctxcanvas->file, "setmatrix\n"); /* back to CTM */
+            cdStreamPrintf(ctxcanvas->stream, "[0 0 0 0 0 0] currentmatrix\n"); /* fill new matrix from CTM */
+            cdStreamPrintf(ctxcanvas->stream, "%g %g translate\n", xc, yc);
+            cdStreamPrintf(ctxcanvas->stream, "1 %g scale\n", ((double)h)/w);
+            cdStreamPrintf(ctxcanvas->stream, "0 0 %g %g %g %s\n", 0.5*w, a1, a2, arc);
+            cdStreamPrintf(ctxcanvas->stream, "setmatrix\n"); /* back to CTM */
           }
 
           i += 3;
@@ -1347,41 +1371,41 @@ static void cdfpoly(cdCtxCanvas *ctxcanvas, int mode, cdfPoint* poly, int n)
         break;
       case CD_PATH_CURVETO:
         if (i+3 > n) return;
-        fprintf(ctxcanvas->file, "%g %g %g %g %g %g B\n", poly[i].x,   poly[i].y, 
+        cdStreamPrintf(ctxcanvas->stream, "%g %g %g %g %g %g B\n", poly[i].x,   poly[i].y, 
                                                           poly[i+1].x, poly[i+1].y, 
                                                           poly[i+2].x, poly[i+2].y);
         i += 3;
         break;
       case CD_PATH_CLOSE:
-        fprintf(ctxcanvas->file, "closepath\n");
+        cdStreamPrintf(ctxcanvas->stream, "closepath\n");
         break;
       case CD_PATH_FILL:
         sUpdateFill(ctxcanvas, 1);
         if (ctxcanvas->holes || ctxcanvas->canvas->fill_mode==CD_EVENODD)
-          fprintf(ctxcanvas->file, "eofill\n");
+          cdStreamPrintf(ctxcanvas->stream, "eofill\n");
         else
-          fprintf(ctxcanvas->file, "fill\n");
+          cdStreamPrintf(ctxcanvas->stream, "fill\n");
         break;
       case CD_PATH_STROKE:
         sUpdateFill(ctxcanvas, 0);
-        fprintf(ctxcanvas->file, "stroke\n");
+        cdStreamPrintf(ctxcanvas->stream, "stroke\n");
         break;
       case CD_PATH_FILLSTROKE:
         sUpdateFill(ctxcanvas, 1);
-        fprintf(ctxcanvas->file, "gsave\n");
+        cdStreamPrintf(ctxcanvas->stream, "gsave\n");
         if (ctxcanvas->holes || ctxcanvas->canvas->fill_mode==CD_EVENODD)
-          fprintf(ctxcanvas->file, "eofill\n");
+          cdStreamPrintf(ctxcanvas->stream, "eofill\n");
         else
-          fprintf(ctxcanvas->file, "fill\n");
-        fprintf(ctxcanvas->file, "grestore\n");
+          cdStreamPrintf(ctxcanvas->stream, "fill\n");
+        cdStreamPrintf(ctxcanvas->stream, "grestore\n");
         sUpdateFill(ctxcanvas, 0);
-        fprintf(ctxcanvas->file, "stroke\n");
+        cdStreamPrintf(ctxcanvas->stream, "stroke\n");
         break;
       case CD_PATH_CLIP:
         if (ctxcanvas->canvas->fill_mode==CD_EVENODD)
-          fprintf(ctxcanvas->file, "C eoclip\n");
+          cdStreamPrintf(ctxcanvas->stream, "C eoclip\n");
         else
-          fprintf(ctxcanvas->file, "C clip\n");
+          cdStreamPrintf(ctxcanvas->stream, "C clip\n");
         break;
       }
     }
@@ -1393,8 +1417,8 @@ static void cdfpoly(cdCtxCanvas *ctxcanvas, int mode, cdfPoint* poly, int n)
     if (ctxcanvas->eps) /* initclip not allowed in EPS */
       return;
 
-    fprintf(ctxcanvas->file, "/clip_polygon {\n");
-    fprintf(ctxcanvas->file, "initclip\n");
+    cdStreamPrintf(ctxcanvas->stream, "/clip_polygon {\n");
+    cdStreamPrintf(ctxcanvas->stream, "initclip\n");
   }
   else
   {
@@ -1404,10 +1428,10 @@ static void cdfpoly(cdCtxCanvas *ctxcanvas, int mode, cdfPoint* poly, int n)
       sUpdateFill(ctxcanvas, 0);
   }
 
-  if (ctxcanvas->debug) fprintf(ctxcanvas->file, "\n%%cdfPoly %d Begin\n", mode);
+  if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "\n%%cdfPoly %d Begin\n", mode);
 
-  fprintf(ctxcanvas->file, "N\n");
-  fprintf(ctxcanvas->file, "%g %g M\n", poly[0].x, poly[0].y);
+  cdStreamPrintf(ctxcanvas->stream, "N\n");
+  ps_fpoint(ctxcanvas->stream, poly[0].x, poly[0].y, 'M');
 
   if (ctxcanvas->eps) 
     fbbox(ctxcanvas, poly[0].x, poly[0].y);
@@ -1416,11 +1440,11 @@ static void cdfpoly(cdCtxCanvas *ctxcanvas, int mode, cdfPoint* poly, int n)
   {
     if (ctxcanvas->holes && i == ctxcanvas->poly_holes[hole_index])
     {
-      fprintf(ctxcanvas->file, "%g %g M\n", poly[i].x, poly[i].y);
+      ps_fpoint(ctxcanvas->stream, poly[i].x, poly[i].y, 'M');
       hole_index++;
     }
     else
-      fprintf(ctxcanvas->file, "%g %g L\n", poly[i].x, poly[i].y);
+      ps_fpoint(ctxcanvas->stream, poly[i].x, poly[i].y, 'L');
 
     if (ctxcanvas->eps) 
       fbbox(ctxcanvas, poly[i].x, poly[i].y);
@@ -1429,30 +1453,30 @@ static void cdfpoly(cdCtxCanvas *ctxcanvas, int mode, cdfPoint* poly, int n)
   switch (mode)
   {
   case CD_CLOSED_LINES :
-    fprintf(ctxcanvas->file, "C S\n");
+    cdStreamPrintf(ctxcanvas->stream, "C S\n");
     break;
   case CD_OPEN_LINES :
-    fprintf(ctxcanvas->file, "S\n");
+    cdStreamPrintf(ctxcanvas->stream, "S\n");
     break;
   case CD_FILL :
     if (ctxcanvas->holes || ctxcanvas->canvas->fill_mode==CD_EVENODD)
-      fprintf(ctxcanvas->file, "eofill\n");
+      cdStreamPrintf(ctxcanvas->stream, "eofill\n");
     else
-      fprintf(ctxcanvas->file, "fill\n");
+      cdStreamPrintf(ctxcanvas->stream, "fill\n");
     break;
   case CD_CLIP :
     if (ctxcanvas->canvas->fill_mode==CD_EVENODD)
-      fprintf(ctxcanvas->file, "C eoclip\n");
+      cdStreamPrintf(ctxcanvas->stream, "C eoclip\n");
     else
-      fprintf(ctxcanvas->file, "C clip\n");
-    fprintf(ctxcanvas->file, "N\n");
-    fprintf(ctxcanvas->file, "} bind def\n");
+      cdStreamPrintf(ctxcanvas->stream, "C clip\n");
+    cdStreamPrintf(ctxcanvas->stream, "N\n");
+    cdStreamPrintf(ctxcanvas->stream, "} bind def\n");
     if (ctxcanvas->canvas->clip_mode == CD_CLIPPOLYGON) 
-      fprintf(ctxcanvas->file, "clip_polygon\n");
+      cdStreamPrintf(ctxcanvas->stream, "clip_polygon\n");
     break;
   }
 
-  if (ctxcanvas->debug) fprintf(ctxcanvas->file, "%%cdfPoly %dEnd\n", mode);
+  if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "%%cdfPoly %dEnd\n", mode);
 }
 
 
@@ -1464,60 +1488,60 @@ static int cdlinestyle(cdCtxCanvas *ctxcanvas, int style)
 {
   double mm = ctxcanvas->canvas->xres;
 
-  if (ctxcanvas->debug) fprintf(ctxcanvas->file, "\n%%cdLineStyle %d Begin\n", style);
+  if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "\n%%cdLineStyle %d Begin\n", style);
 
-  fprintf(ctxcanvas->file, "[");
+  cdStreamPrintf(ctxcanvas->stream, "[");
 
   switch (style)
   {
   case CD_CONTINUOUS : /* empty dash */
-    fprintf(ctxcanvas->file, " ");
+    cdStreamPrintf(ctxcanvas->stream, " ");
     break;
   case CD_DASHED :
-    fprintf(ctxcanvas->file, "%g %g", 3*mm, mm);
+    cdStreamPrintf(ctxcanvas->stream, "%g %g", 3*mm, mm);
     break;
   case CD_DOTTED :
-    fprintf(ctxcanvas->file, "%g %g", mm, mm);
+    cdStreamPrintf(ctxcanvas->stream, "%g %g", mm, mm);
     break;
   case CD_DASH_DOT :
-    fprintf(ctxcanvas->file, "%g %g %g %g", 3*mm, mm, mm, mm);
+    cdStreamPrintf(ctxcanvas->stream, "%g %g %g %g", 3*mm, mm, mm, mm);
     break;
   case CD_DASH_DOT_DOT :
-    fprintf(ctxcanvas->file, "%g %g %g %g %g %g", 3*mm, mm, mm, mm, mm, mm);
+    cdStreamPrintf(ctxcanvas->stream, "%g %g %g %g %g %g", 3*mm, mm, mm, mm, mm, mm);
     break;
   case CD_CUSTOM :
     {
       int i;  /* size here is in pixels, do not use mm */
       for (i = 0; i < ctxcanvas->canvas->line_dashes_count; i++)
-        fprintf(ctxcanvas->file, "%g ", (double)ctxcanvas->canvas->line_dashes[i]);
+        cdStreamPrintf(ctxcanvas->stream, "%g ", (double)ctxcanvas->canvas->line_dashes[i]);
     }
     break;
   }
 
-  fprintf(ctxcanvas->file, "] 0 setdash\n");
+  cdStreamPrintf(ctxcanvas->stream, "] 0 setdash\n");
 
-  if (ctxcanvas->debug) fprintf(ctxcanvas->file, "%%cdLineStyle %dEnd\n", style);
+  if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "%%cdLineStyle %dEnd\n", style);
 
   return style;
 }
 
 static int cdlinewidth(cdCtxCanvas *ctxcanvas, int width)
 {
-  fprintf(ctxcanvas->file, "%d setlinewidth\n", width);
+  cdStreamPrintf(ctxcanvas->stream, "%d setlinewidth\n", width);
   return width;
 }
 
 static int cdlinejoin(cdCtxCanvas *ctxcanvas, int join)
 {
   int cd2ps_join[] = {0, 2, 1};
-  fprintf(ctxcanvas->file, "%d setlinejoin\n", cd2ps_join[join]);
+  cdStreamPrintf(ctxcanvas->stream, "%d setlinejoin\n", cd2ps_join[join]);
   return join;
 }
 
 static int cdlinecap(cdCtxCanvas *ctxcanvas, int cap)
 {
   int cd2ps_cap[] =  {0, 2, 1};
-  fprintf(ctxcanvas->file, "%d setlinecap\n", cd2ps_cap[cap]);
+  cdStreamPrintf(ctxcanvas->stream, "%d setlinecap\n", cd2ps_cap[cap]);
   return cap;
 }
 
@@ -1526,44 +1550,44 @@ static void make_pattern(cdCtxCanvas *ctxcanvas, int n, int m, void* data, void
   int i, j;
   unsigned char r, g, b;
 
-  if (ctxcanvas->debug) fprintf(ctxcanvas->file, "\n%%cdPsMakePattern Begin\n");
+  if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "\n%%cdPsMakePattern Begin\n");
 
-  fprintf(ctxcanvas->file, "/cd_pattern\n");
-  fprintf(ctxcanvas->file, "currentfile %d string readhexstring\n", n*m*3);
+  cdStreamPrintf(ctxcanvas->stream, "/cd_pattern\n");
+  cdStreamPrintf(ctxcanvas->stream, "currentfile %d string readhexstring\n", n*m*3);
 
   for (j=0; j<m; j++)
   {
     for (i=0; i<n; i++)
     {
       data2rgb(ctxcanvas, n, i, j, data, &r, &g, &b);
-      fprintf(ctxcanvas->file, "%02x%02x%02x", (int)r, (int)g, (int)b);
+      cdStreamPrintf(ctxcanvas->stream, "%02x%02x%02x", (int)r, (int)g, (int)b);
     }
 
-    fprintf(ctxcanvas->file, "\n");
-  }
-
-  fprintf(ctxcanvas->file, "pop\n");
-  fprintf(ctxcanvas->file, "/Pat exch def\n");
-  fprintf(ctxcanvas->file, "<<\n");
-  fprintf(ctxcanvas->file, "  /PatternType 1\n");
-  fprintf(ctxcanvas->file, "  /PaintType 1\n");
-  fprintf(ctxcanvas->file, "  /TilingType 1\n");
-  fprintf(ctxcanvas->file, "  /BBox [0 0 %d %d]\n", n, m);
-  fprintf(ctxcanvas->file, "  /XStep %d /YStep %d\n", n, m);
-  fprintf(ctxcanvas->file, "  /PaintProc {\n");
-  fprintf(ctxcanvas->file, "              pop\n");
-  fprintf(ctxcanvas->file, "              %d %d 8\n", n, m);
-  fprintf(ctxcanvas->file, "              matrix\n");
-  fprintf(ctxcanvas->file, "              Pat\n");
-  fprintf(ctxcanvas->file, "              false 3\n");
-  fprintf(ctxcanvas->file, "              colorimage\n");
-  fprintf(ctxcanvas->file, "             }\n");
-  fprintf(ctxcanvas->file, ">>\n");
-  fprintf(ctxcanvas->file, "matrix\n");
-  fprintf(ctxcanvas->file, "makepattern\n");
-  fprintf(ctxcanvas->file, "def\n");
-
-  if (ctxcanvas->debug) fprintf(ctxcanvas->file, "%%cdPsMakePatternEnd\n");
+    cdStreamPrintf(ctxcanvas->stream, "\n");
+  }
+
+  cdStreamPrintf(ctxcanvas->stream, "pop\n");
+  cdStreamPrintf(ctxcanvas->stream, "/Pat exch def\n");
+  cdStreamPrintf(ctxcanvas->stream, "<<\n");
+  cdStreamPrintf(ctxcanvas->stream, "  /PatternType 1\n");
+  cdStreamPrintf(ctxcanvas->stream, "  /PaintType 1\n");
+  cdStreamPrintf(ctxcanvas->stream, "  /TilingType 1\n");
+  cdStreamPrintf(ctxcanvas->stream, "  /BBox [0 0 %d %d]\n", n, m);
+  cdStreamPrintf(ctxcanvas->stream, "  /XStep %d /YStep %d\n", n, m);
+  cdStreamPrintf(ctxcanvas->stream, "  /PaintProc {\n");
+  cdStreamPrintf(ctxcanvas->stream, "              pop\n");
+  cdStreamPrintf(ctxcanvas->stream, "              %d %d 8\n", n, m);
+  cdStreamPrintf(ctxcanvas->stream, "              matrix\n");
+  cdStreamPrintf(ctxcanvas->stream, "              Pat\n");
+  cdStreamPrintf(ctxcanvas->stream, "              false 3\n");
+  cdStreamPrintf(ctxcanvas->stream, "              colorimage\n");
+  cdStreamPrintf(ctxcanvas->stream, "             }\n");
+  cdStreamPrintf(ctxcanvas->stream, ">>\n");
+  cdStreamPrintf(ctxcanvas->stream, "matrix\n");
+  cdStreamPrintf(ctxcanvas->stream, "makepattern\n");
+  cdStreamPrintf(ctxcanvas->stream, "def\n");
+
+  if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "%%cdPsMakePatternEnd\n");
 }
 
 static void long2rgb(cdCtxCanvas *ctxcanvas, int n, int i, int j, void* data, unsigned char*r, unsigned char*g, unsigned char*b)
@@ -1668,7 +1692,7 @@ static int cdfont(cdCtxCanvas *ctxcanvas, const char *type_face, int style, int
 {
   char *nativefontname = findfont(type_face, style&3); /* no underline or strikeout support */
   int size_pixel = cdGetFontSizePixels(ctxcanvas->canvas, size);
-  fprintf(ctxcanvas->file, "%d /%s /%s-Latin1 ChgFnt\n", size_pixel, nativefontname, nativefontname);
+  cdStreamPrintf(ctxcanvas->stream, "%d /%s /%s-Latin1 ChgFnt\n", size_pixel, nativefontname, nativefontname);
   add_font_name(ctxcanvas, nativefontname);
   return 1;
 }
@@ -1680,16 +1704,16 @@ static void cdtransform(cdCtxCanvas *ctxcanvas, const double* matrix)
 
   if (matrix)
   {
-    fprintf(ctxcanvas->file, "[%g %g %g %g %g %g] concat\n", matrix[0], matrix[1], matrix[2], matrix[3], matrix[4], matrix[5]);
+    cdStreamPrintf(ctxcanvas->stream, "[%g %g %g %g %g %g] concat\n", matrix[0], matrix[1], matrix[2], matrix[3], matrix[4], matrix[5]);
   }
   else
   {
     if (ctxcanvas->rotate_angle)
     {
       /* rotation = translate to point + rotation + translate back */
-      fprintf(ctxcanvas->file, "%d %d translate\n", ctxcanvas->rotate_center_x, ctxcanvas->rotate_center_y);
-      fprintf(ctxcanvas->file, "%g rotate\n", ctxcanvas->rotate_angle);
-      fprintf(ctxcanvas->file, "%d %d translate\n", -ctxcanvas->rotate_center_x, -ctxcanvas->rotate_center_y);
+      cdStreamPrintf(ctxcanvas->stream, "%d %d translate\n", ctxcanvas->rotate_center_x, ctxcanvas->rotate_center_y);
+      cdStreamPrintf(ctxcanvas->stream, "%g rotate\n", ctxcanvas->rotate_angle);
+      cdStreamPrintf(ctxcanvas->stream, "%d %d translate\n", -ctxcanvas->rotate_center_x, -ctxcanvas->rotate_center_y);
     }
   }
 }
@@ -1698,9 +1722,196 @@ static void cdtransform(cdCtxCanvas *ctxcanvas, const double* matrix)
 /* client images                                      */
 /******************************************************/
 
+/* Image data is written one row at a time. Level 1 uses hexadecimal text, 
+   level 2 uses ASCII85 text, and optionally Flate compression (level 3). */
+
+#define PS_LINE_SIZE 75
+
+typedef struct _psImageData 
+{
+  cdStream* stream;
+  int level1, compress;
+  z_stream zstream;
+  unsigned char zbuffer[4096];
+  unsigned char tuple[4];    /* ASCII85 group being encoded */
+  int tuple_count;
+  char buffer[4096];         /* text waiting to be written */
+  int buffer_used, line_col;
+} psImageData;
+
+static void ps_image_flushtext(psImageData* img)
+{
+  if (img->buffer_used)
+    cdStreamWrite(img->stream, img->buffer, img->buffer_used);
+  img->buffer_used = 0;
+}
+
+static void ps_image_puttext(psImageData* img, const char* text, int len)
+{
+  int i;
+
+  if (img->buffer_used + 2*len >= (int)sizeof(img->buffer))
+    ps_image_flushtext(img);
+
+  for (i = 0; i < len; i++)
+  {
+    img->buffer[img->buffer_used++] = text[i];
+
+    img->line_col++;
+    if (img->line_col == PS_LINE_SIZE)
+    {
+      img->buffer[img->buffer_used++] = '\n';
+      img->line_col = 0;
+    }
+  }
+}
+
+static void ps_image_a85tuple(psImageData* img, int count)
+{
+  unsigned long value = ((unsigned long)img->tuple[0] << 24) | ((unsigned long)img->tuple[1] << 16) | 
+                        ((unsigned long)img->tuple[2] << 8) | (unsigned long)img->tuple[3];
+  char text[5];
+  int i;
+
+  if (value == 0 && count == 4)
+  {
+    ps_image_puttext(img, "z", 1);
+    return;
+  }
+
+  for (i = 4; i >= 0; i--)
+  {
+    text[i] = (char)('!' + value % 85);
+    value /= 85;
+  }
+
+  /* a partial group writes only count+1 characters */
+  ps_image_puttext(img, text, count+1);
+}
+
+static void ps_image_a85(psImageData* img, const unsigned char* data, int size)
+{
+  int i;
+  for (i = 0; i < size; i++)
+  {
+    img->tuple[img->tuple_count++] = data[i];
+
+    if (img->tuple_count == 4)
+    {
+      ps_image_a85tuple(img, 4);
+      img->tuple_count = 0;
+    }
+  }
+}
+
+static void ps_image_deflate(psImageData* img, int flush)
+{
+  int ret;
+  do
+  {
+    img->zstream.next_out = img->zbuffer;
+    img->zstream.avail_out = sizeof(img->zbuffer);
+
+    ret = deflate(&img->zstream, flush);
+
+    ps_image_a85(img, img->zbuffer, sizeof(img->zbuffer) - img->zstream.avail_out);
+  } while (img->zstream.avail_out == 0 || (flush == Z_FINISH && ret == Z_OK));
+}
+
+static void ps_image_begin(cdCtxCanvas *ctxcanvas, psImageData* img, int rw, int rh, int ncomp)
+{
+  memset(img, 0, sizeof(psImageData));
+  img->stream = ctxcanvas->stream;
+  img->level1 = ctxcanvas->level1;
+  img->compress = ctxcanvas->compress;
+
+  if (img->compress && deflateInit(&img->zstream, Z_DEFAULT_COMPRESSION) != Z_OK)
+    img->compress = 0;
+
+  if (img->level1)
+  {
+    cdStreamPrintf(img->stream, "%d %d 8\n", rw, rh);
+    cdStreamPrintf(img->stream, "[%d 0 0 %d 0 0]\n", rw, rh);
+    cdStreamPrintf(img->stream, "{currentfile %d string readhexstring pop}\n", rw*ncomp);
+  }
+  else
+  {
+    /* image stops reading when it has all the data, 
+       so the filter is flushed to remove the rest of the data until EOD */
+    cdStreamPrintf(img->stream, "/cdImageData currentfile /ASCII85Decode filter def\n");
+    cdStreamPrintf(img->stream, "{%d %d 8\n", rw, rh);
+    cdStreamPrintf(img->stream, "[%d 0 0 %d 0 0]\n", rw, rh);
+    cdStreamPrintf(img->stream, "cdImageData%s\n", img->compress? " /FlateDecode filter": "");
+  }
+
+  if (ncomp == 3)
+  {
+    cdStreamPrintf(img->stream, "false 3\n");
+    cdStreamPrintf(img->stream, "colorimage\n");
+  }
+  else
+    cdStreamPrintf(img->stream, "image\n");
+
+  if (!img->level1)
+    cdStreamPrintf(img->stream, "cdImageData flushfile} exec\n");
+}
+
+static void ps_image_write(psImageData* img, const unsigned char* row, int size)
+{
+  if (img->level1)
+  {
+    static const char hex[] = "0123456789abcdef";
+    int i;
+
+    for (i = 0; i < size; i++)
+    {
+      char text[2];
+      text[0] = hex[row[i] >> 4];
+      text[1] = hex[row[i] & 0xF];
+      ps_image_puttext(img, text, 2);
+    }
+  }
+  else if (img->compress)
+  {
+    img->zstream.next_in = (unsigned char*)row;
+    img->zstream.avail_in = size;
+    ps_image_deflate(img, Z_NO_FLUSH);
+  }
+  else
+    ps_image_a85(img, row, size);
+}
+
+static void ps_image_end(psImageData* img)
+{
+  if (!img->level1)
+  {
+    if (img->compress)
+    {
+      ps_image_deflate(img, Z_FINISH);
+      deflateEnd(&img->zstream);
+    }
+
+    if (img->tuple_count)
+    {
+      memset(img->tuple + img->tuple_count, 0, 4 - img->tuple_count);
+      ps_image_a85tuple(img, img->tuple_count);
+    }
+  }
+
+  ps_image_flushtext(img);
+
+  /* the EOD marker must not be split by the line wrap */
+  if (!img->level1)
+    cdStreamWrite(img->stream, "~>", 2);
+
+  cdStreamPrintf(img->stream, "\n");
+}
+
 static void cdputimagerectrgb(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *r, const unsigned char *g, const unsigned char *b, int x, int y, int w, int h, int xmin, int xmax, int ymin, int ymax)
 {
   int i, j, rw, rh;
+  unsigned char* row;
+  psImageData img;
   rw = xmax-xmin+1;
   rh = ymax-ymin+1;
   (void)ih;
@@ -1708,30 +1919,36 @@ static void cdputimagerectrgb(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsi
   if (ctxcanvas->level1)
     return;
 
-  if (ctxcanvas->debug) fprintf(ctxcanvas->file, "%%cdPutImageRectRGB Start\n");
+  row = (unsigned char*)malloc(3*rw);
+  if (!row)
+    return;
+
+  if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "%%cdPutImageRectRGB Start\n");
 
-  fprintf(ctxcanvas->file, "[0 0 0 0 0 0] currentmatrix\n");
-  fprintf(ctxcanvas->file, "%d %d translate\n", x, y);
-  fprintf(ctxcanvas->file, "%d %d scale\n", w, h);
+  cdStreamPrintf(ctxcanvas->stream, "[0 0 0 0 0 0] currentmatrix\n");
+  cdStreamPrintf(ctxcanvas->stream, "%d %d translate\n", x, y);
+  cdStreamPrintf(ctxcanvas->stream, "%d %d scale\n", w, h);
 
-  fprintf(ctxcanvas->file, "%d %d 8\n", rw, rh);
-  fprintf(ctxcanvas->file, "[%d 0 0 %d 0 0]\n", rw, rh);
-  fprintf(ctxcanvas->file, "{currentfile %d string readhexstring pop}\n", rw);
-  fprintf(ctxcanvas->file, "false 3\n");
-  fprintf(ctxcanvas->file, "colorimage\n");
+  ps_image_begin(ctxcanvas, &img, rw, rh, 3);
 
   for (j=ymin; j<=ymax; j++)
   {
-    for (i=xmin; i<=xmax; i++)
+    int pos = j*iw+xmin;
+    unsigned char* prow = row;
+
+    for (i=0; i<rw; i++)
     {
-      int pos = j*iw+i;
-      fprintf(ctxcanvas->file, "%02x%02x%02x", (int)r[pos], (int)g[pos], (int)b[pos]);
+      *prow++ = r[pos+i];
+      *prow++ = g[pos+i];
+      *prow++ = b[pos+i];
     }
 
-    fprintf(ctxcanvas->file, "\n");
+    ps_image_write(&img, row, 3*rw);
   }
 
-  fprintf(ctxcanvas->file, "setmatrix\n");
+  ps_image_end(&img);
+
+  cdStreamPrintf(ctxcanvas->stream, "setmatrix\n");
 
   if (ctxcanvas->eps)
   {
@@ -1739,13 +1956,14 @@ static void cdputimagerectrgb(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsi
     bbox(ctxcanvas, x+rw-1, y+rh-1);
   }
 
-  if (ctxcanvas->debug) fprintf(ctxcanvas->file, "%%cdPutImageRectRGBEnd\n");
+  if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "%%cdPutImageRectRGBEnd\n");
+
+  free(row);
 }
 
-static int isgray(int size, const unsigned char *index, const long int *colors)
+static int mapsize(int size, const unsigned char *index)
 {
   int i, pal_size = 0;
-  unsigned char r, g, b;
 
   for (i = 0; i < size; i++)
   {
@@ -1753,7 +1971,13 @@ static int isgray(int size, const unsigned char *index, const long int *colors)
       pal_size = index[i];
   }
 
-  pal_size++;
+  return pal_size+1;
+}
+
+static int isgray(int pal_size, const long int *colors)
+{
+  int i;
+  unsigned char r, g, b;
 
   for (i = 0; i < pal_size; i++)
   {
@@ -1768,61 +1992,66 @@ static int isgray(int size, const unsigned char *index, const long int *colors)
 
 static void cdputimagerectmap(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *index, const long int *colors, int x, int y, int w, int h, int xmin, int xmax, int ymin, int ymax)
 {
-  int i, j, rw, rh, is_gray;
+  int i, j, rw, rh, is_gray, pal_size;
+  unsigned char* row = NULL;
+  psImageData img;
   rw = xmax-xmin+1;
   rh = ymax-ymin+1;
   (void)ih;
 
-  is_gray = isgray(iw*ih, index, colors);
+  pal_size = mapsize(iw*ih, index);
+  is_gray = isgray(pal_size, colors);
 
   if (!is_gray && ctxcanvas->level1)
     return;
 
-  if (ctxcanvas->debug) fprintf(ctxcanvas->file, "%%cdPutImageRectMap Start\n");
+  if (!is_gray)
+  {
+    row = (unsigned char*)malloc(3*rw);
+    if (!row)
+      return;
+  }
 
-  fprintf(ctxcanvas->file, "[0 0 0 0 0 0] currentmatrix\n");
-  fprintf(ctxcanvas->file, "%d %d translate\n", x, y);
-  fprintf(ctxcanvas->file, "%d %d scale\n", w, h);
+  if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "%%cdPutImageRectMap Start\n");
 
-  fprintf(ctxcanvas->file, "%d %d 8\n", rw, rh);
-  fprintf(ctxcanvas->file, "[%d 0 0 %d 0 0]\n", rw, rh);
-  fprintf(ctxcanvas->file, "{currentfile %d string readhexstring pop}\n", rw);
+  cdStreamPrintf(ctxcanvas->stream, "[0 0 0 0 0 0] currentmatrix\n");
+  cdStreamPrintf(ctxcanvas->stream, "%d %d translate\n", x, y);
+  cdStreamPrintf(ctxcanvas->stream, "%d %d scale\n", w, h);
+
+  ps_image_begin(ctxcanvas, &img, rw, rh, is_gray? 1: 3);
 
   if (is_gray)
   {
-    fprintf(ctxcanvas->file, "image\n");
-
     for (j=ymin; j<=ymax; j++)
-    {
-      for (i=xmin; i<=xmax; i++)
-      {
-        int pos = j*iw+i;
-        fprintf(ctxcanvas->file, "%02x", (int)index[pos]);
-      }
-
-      fprintf(ctxcanvas->file, "\n");
-    }
+      ps_image_write(&img, index + j*iw+xmin, rw);
   }
   else
   {
-    fprintf(ctxcanvas->file, "false 3\n");
-    fprintf(ctxcanvas->file, "colorimage\n");
+    unsigned char rgb_map[256*3];
+
+    for (i=0; i<pal_size; i++)
+      cdDecodeColor(colors[i], rgb_map + 3*i+0, rgb_map + 3*i+1, rgb_map + 3*i+2);
 
     for (j=ymin; j<=ymax; j++)
     {
-      for (i=xmin; i<=xmax; i++)
+      const unsigned char* pindex = index + j*iw+xmin;
+      unsigned char* prow = row;
+
+      for (i=0; i<rw; i++)
       {
-        int pos = j*iw+i;
-        unsigned char r, g, b;
-        cdDecodeColor(colors[index[pos]], &r, &g, &b);
-        fprintf(ctxcanvas->file, "%02x%02x%02x", (int)r, (int)g, (int)b);
+        const unsigned char* rgb = rgb_map + 3*pindex[i];
+        *prow++ = rgb[0];
+        *prow++ = rgb[1];
+        *prow++ = rgb[2];
       }
 
-      fprintf(ctxcanvas->file, "\n");
+      ps_image_write(&img, row, 3*rw);
     }
   }
 
-  fprintf(ctxcanvas->file, "setmatrix\n");
+  ps_image_end(&img);
+
+  cdStreamPrintf(ctxcanvas->stream, "setmatrix\n");
 
   if (ctxcanvas->eps)
   {
@@ -1830,7 +2059,9 @@ static void cdputimagerectmap(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsi
     bbox(ctxcanvas, x+rw-1, y+rh-1);
   }
 
-  if (ctxcanvas->debug) fprintf(ctxcanvas->file, "%%cdPutImageRectMapEnd\n");
+  if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "%%cdPutImageRectMapEnd\n");
+
+  if (row) free(row);
 }
 
 /******************************************************/
@@ -1839,24 +2070,24 @@ static void cdputimagerectmap(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsi
 
 static void cdpixel(cdCtxCanvas *ctxcanvas, int x, int y, long int color)
 {
-  if (ctxcanvas->debug) fprintf(ctxcanvas->file, "%%cdPixel Start\n");
+  if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "%%cdPixel Start\n");
 
-  fprintf(ctxcanvas->file, "%g %g %g setrgbcolor\n",
+  cdStreamPrintf(ctxcanvas->stream, "%g %g %g setrgbcolor\n",
           get_red(color), get_green(color), get_blue(color));
 
   if (ctxcanvas->level1)
   {
-    fprintf(ctxcanvas->file, "N\n");
-    fprintf(ctxcanvas->file, "%d %d 1 0 360 arc\n", x, y);
-    fprintf(ctxcanvas->file, "C fill\n");
+    cdStreamPrintf(ctxcanvas->stream, "N\n");
+    cdStreamPrintf(ctxcanvas->stream, "%d %d 1 0 360 arc\n", x, y);
+    cdStreamPrintf(ctxcanvas->stream, "C fill\n");
   }
   else
-    fprintf(ctxcanvas->file, "%d %d 1 1 RF\n", x, y);
+    cdStreamPrintf(ctxcanvas->stream, "%d %d 1 1 RF\n", x, y);
 
   if (ctxcanvas->eps) 
     bbox(ctxcanvas, x, y);
 
-  if (ctxcanvas->debug) fprintf(ctxcanvas->file, "%%cdPixelEnd\n");
+  if (ctxcanvas->debug) cdStreamPrintf(ctxcanvas->stream, "%%cdPixelEnd\n");
 }
 
 /******************************************************/
@@ -1909,7 +2140,7 @@ static cdAttribute rotate_attrib =
 
 static void set_cmd_attrib(cdCtxCanvas *ctxcanvas, char* data)
 {
-  fprintf(ctxcanvas->file, "%s", data);
+  cdStreamPrintf(ctxcanvas->stream, "%s", data);
 }
 
 static cdAttribute cmd_attrib =
@@ -1962,6 +2193,7 @@ nome       nome do arquivo de saida <= 255 caracteres
 -s[num]    resolucao em dpi
 -e         encapsulated postscript
 -1         level 1 operators only
+-z         images compressed with Flate (level 3)
 -d[num]    margem da bbox em milimetros para eps
 */
 static void cdcreatecanvas(cdCanvas* canvas, void *data)
@@ -1981,7 +2213,7 @@ static void cdcreatecanvas(cdCanvas* canvas, void *data)
   ctxcanvas->old_locale = cdStrDup(setlocale(LC_NUMERIC, NULL));
   setlocale(LC_NUMERIC, "C");
 
-  if ((ctxcanvas->file = fopen(filename, "w")) == NULL)
+  if ((ctxcanvas->stream = cdStreamOpenOutput(filename, 0)) == NULL)
   {
     free(ctxcanvas);
     return;
@@ -2048,6 +2280,9 @@ static void cdcreatecanvas(cdCanvas* canvas, void *data)
       case '1':
         ctxcanvas->level1 = 1;
         break;
+      case 'z':
+        ctxcanvas->compress = 1;
+        break;
       case 'g':
         ctxcanvas->debug = 1;
         break;
@@ -2062,6 +2297,9 @@ static void cdcreatecanvas(cdCanvas* canvas, void *data)
       line++;
   }
 
+  if (ctxcanvas->level1)
+    ctxcanvas->compress = 0;  /* filters are not available */
+
   /* store the base canvas */
   ctxcanvas->canvas = canvas;
 
@@ -13,6 +13,8 @@
 #include <float.h>    
 #include <limits.h>   
 
+#include "cd.h"
+#include "cd_private.h"
 #include "cgm.h"
 
 
@@ -496,15 +498,15 @@ static void cgmb_putc ( CGM *cgm, int b )
     {
       if ( cgm->bc[i] == 32766 - 2*i )
       {
-        long po = ftell(cgm->file);
+        long po = cdStreamTell(cgm->stream);
         int op  = cgm->op;
 
         cgm->op = -1;
-        fseek(cgm->file, cgm->po[i] , SEEK_SET);
+        cdStreamSeek(cgm->stream, cgm->po[i]);
         cgmb_putw ( cgm, (1 << 15) | (cgm->bc[i]) );
 
         cgm->op = i - 1;
-        fseek(cgm->file, po, SEEK_SET);
+        cdStreamSeek(cgm->stream, po);
         cgmb_putw ( cgm, 0 );
 
         cgm->op    = op;
@@ -515,7 +517,7 @@ static void cgmb_putc ( CGM *cgm, int b )
     }
   }
 
-  fputc ( b, cgm->file );
+  cdStreamPutChar ( cgm->stream, b );
 }
 
 
@@ -634,7 +636,7 @@ static void cgmb_wch ( CGM* cgm, int c, int id, int len )
 
   if ( len > 30 )
   {
-    cgm->po[cgm->op] = ftell(cgm->file);
+    cgm->po[cgm->op] = cdStreamTell(cgm->stream);
     cgmb_putw ( cgm, 0 );
   }
   else
@@ -850,14 +852,14 @@ static int cgmb_term ( CGM *cgm )
 
     if ( cgm->po[cgm->op] != 0L )
     {
-      long po = ftell(cgm->file);
+      long po = cdStreamTell(cgm->stream);
       int  op = cgm->op;
 
       cgm->op = -1;
-      fseek ( cgm->file, cgm->po[op], SEEK_SET);
+      cdStreamSeek ( cgm->stream, cgm->po[op] );
       cgmb_putw ( cgm, cgm->bc[op] );
 
-      fseek ( cgm->file, po, SEEK_SET );
+      cdStreamSeek ( cgm->stream, po );
       cgm->op = op;
     }
     cgm->op --;
@@ -872,10 +874,43 @@ static int cgmb_term ( CGM *cgm )
 *                                               *
 ************************************************/
 
+/* the returned value is the number of characters written, for the alignment */
+
+static int cgm_put_str ( CGM *cgm, const char *prefix, const char *s )
+{
+  long po = cdStreamTell ( cgm->stream );
+  cdStreamPutString ( cgm->stream, prefix );
+  cdStreamPutString ( cgm->stream, s );
+  return (int)(cdStreamTell ( cgm->stream ) - po);
+}
+
+static int cgm_put_int ( CGM *cgm, long i )
+{
+  long po = cdStreamTell ( cgm->stream );
+  cdStreamPutChar ( cgm->stream, ' ' );
+  cdStreamPutInt ( cgm->stream, i );
+  return (int)(cdStreamTell ( cgm->stream ) - po);
+}
+
+static int cgm_put_uint ( CGM *cgm, unsigned long i )
+{
+  long po = cdStreamTell ( cgm->stream );
+  cdStreamPrintf ( cgm->stream, " %lu", i );
+  return (int)(cdStreamTell ( cgm->stream ) - po);
+}
+
+static int cgm_put_real ( CGM *cgm, double r )
+{
+  long po = cdStreamTell ( cgm->stream );
+  cdStreamPutChar ( cgm->stream, ' ' );
+  cdStreamPutReal ( cgm->stream, r );
+  return (int)(cdStreamTell ( cgm->stream ) - po);
+}
+
 static void cgmt_wch ( CGM* cgm, int c, int id, int len )
 {
   (void)len;
-  cgm->cl += fprintf ( cgm->file, "%s", comandos[c+1][id]->ct );
+  cgm->cl += cgm_put_str ( cgm, "", comandos[c+1][id]->ct );
 }
 
 static void cgmt_ci ( CGM *cgm, unsigned long ci )
@@ -904,40 +939,40 @@ static void cgmt_ix ( CGM *cgm, long ix )
 
 static void cgmt_e ( CGM *cgm, int e, const char *el[] )
 {
-  cgm->cl += fprintf ( cgm->file, " %s", el[e] );
+  cgm->cl += cgm_put_str ( cgm, " ", el[e] );
 }
 
 static void cgmt_i ( CGM *cgm, long i )
 {
-  cgm->cl += fprintf ( cgm->file, " %ld", i );
+  cgm->cl += cgm_put_int ( cgm, i );
 }
 
 static void cgmt_u ( CGM *cgm, unsigned long i )
 {
-  cgm->cl += fprintf ( cgm->file, " %lu", i );
+  cgm->cl += cgm_put_uint ( cgm, i );
 }
 
 static void cgmt_r ( CGM *cgm, double func )
 {
-  cgm->cl += fprintf ( cgm->file, " %g", func );
+  cgm->cl += cgm_put_real ( cgm, func );
 }
 
 static void cgmt_s ( CGM *cgm, const char *s, int len )
 {
   register int i;
-  fputc ( 34, cgm->file );
+  cdStreamPutChar ( cgm->stream, 34 );
 
   for ( i=0; i<len; i++ )
   {
     if ( s[i] == 34 )
     {
-      fputc ( 34, cgm->file );
+      cdStreamPutChar ( cgm->stream, 34 );
       cgm->cl ++;
     }
-    fputc ( s[i], cgm->file );
+    cdStreamPutChar ( cgm->stream, s[i] );
   }
 
-  fputc ( 34, cgm->file );
+  cdStreamPutChar ( cgm->stream, 34 );
   cgm->cl += len + 2;
 }
 
@@ -980,7 +1015,7 @@ static void cgmt_co ( CGM *cgm, const void * co)
 
 static void cgmt_sep ( CGM *cgm, const char * sep )
 {
-  cgm->cl += fprintf ( cgm->file, " %s", sep );
+  cgm->cl += cgm_put_str ( cgm, " ", sep );
 }
 
 static int  cgmt_get_col ( CGM *cgm )
@@ -991,18 +1026,18 @@ static int  cgmt_get_col ( CGM *cgm )
 static void cgmt_align ( CGM *cgm, int n )
 {
   for ( ; cgm->cl < n ; cgm->cl ++ )
-    fputc ( ' ', cgm->file );
+    cdStreamPutChar ( cgm->stream, ' ' );
 }
 
 static void cgmt_nl    ( CGM *cgm )
 {
-  fputc ( '\n', cgm->file );
+  cdStreamPutChar ( cgm->stream, '\n' );
   cgm->cl = 1;
 }
 
 static int cgmt_term ( CGM *cgm )
 {
-  fputc ( ';', cgm->file );
+  cdStreamPutChar ( cgm->stream, ';' );
   cgm->func->nl(cgm);
   return 0;
 }
@@ -1016,7 +1051,7 @@ static int cgmt_term ( CGM *cgm )
 static void cgmc_wch ( CGM* cgm, int c, int id, int len )
 {
   (void)len;
-  cgm->cl += fprintf ( cgm->file, "%s", comandos[c+1][id]->ct );
+  cgm->cl += cgm_put_str ( cgm, "", comandos[c+1][id]->ct );
 }
 
 static void cgmc_ci ( CGM *cgm, unsigned long ci )
@@ -1045,40 +1080,40 @@ static void cgmc_ix ( CGM *cgm, long ix )
 
 static void cgmc_e ( CGM *cgm, int e, const char *el[] )
 {
-  cgm->cl += fprintf ( cgm->file, " %s", el[e] );
+  cgm->cl += cgm_put_str ( cgm, " ", el[e] );
 }
 
 static void cgmc_i ( CGM *cgm, long i )
 {
-  cgm->cl += fprintf ( cgm->file, " %ld", i );
+  cgm->cl += cgm_put_int ( cgm, i );
 }
 
 static void cgmc_u ( CGM *cgm, unsigned long i )
 {
-  cgm->cl += fprintf ( cgm->file, " %lu", i );
+  cgm->cl += cgm_put_uint ( cgm, i );
 }
 
 static void cgmc_r ( CGM *cgm, double func )
 {
-  cgm->cl += fprintf ( cgm->file, " %g", func );
+  cgm->cl += cgm_put_real ( cgm, func );
 }
 
 static void cgmc_s ( CGM *cgm, const char *s, int len )
 {
   register int i;
-  fputc ( 34, cgm->file );
+  cdStreamPutChar ( cgm->stream, 34 );
 
   for ( i=0; i<len; i++ )
   {
     if ( s[i] == 34 )
     {
-      fputc ( 34, cgm->file );
+      cdStreamPutChar ( cgm->stream, 34 );
       cgm->cl ++;
     }
-    fputc ( s[i], cgm->file );
+    cdStreamPutChar ( cgm->stream, s[i] );
   }
 
-  fputc ( 34, cgm->file );
+  cdStreamPutChar ( cgm->stream, 34 );
   cgm->cl += len + 2;
 }
 
@@ -1115,7 +1150,7 @@ static void cgmc_co ( CGM *cgm, const void * co)
 
 static void cgmc_sep ( CGM *cgm, const char * sep )
 {
-  cgm->cl += fprintf ( cgm->file, " %s", sep );
+  cgm->cl += cgm_put_str ( cgm, " ", sep );
 }
 
 static int  cgmc_get_col ( CGM *cgm )
@@ -1126,18 +1161,18 @@ static int  cgmc_get_col ( CGM *cgm )
 static void cgmc_align ( CGM *cgm, int n )
 {
   for ( ; cgm->cl < n ; cgm->cl ++ )
-    fputc ( ' ', cgm->file );
+    cdStreamPutChar ( cgm->stream, ' ' );
 }
 
 static void cgmc_nl    ( CGM *cgm )
 {
-  fputc ( '\n', cgm->file );
+  cdStreamPutChar ( cgm->stream, '\n' );
   cgm->cl = 1;
 }
 
 static int cgmc_term ( CGM *cgm )
 {
-  fputc ( ';', cgm->file );
+  cdStreamPutChar ( cgm->stream, ';' );
   cgm->func->nl(cgm);
   return 0;
 }
@@ -1187,19 +1222,13 @@ CGM *cgm_begin_metafile ( char *file, int mode, char *header )
   if ( (cgm = (CGM *)malloc ( sizeof (CGM) ) ) == NULL )
     return NULL;
 
-#ifdef __VAXC__
-  if ( mode == 2 )
-    cgm->file = fopen ( file , "w"  , "rfm=var", "rat=cr" );
-  else
-    cgm->file = fopen ( file , "w+b", "rfm=var", "ctx=stm" );
-#else
+  /* the binary encoding goes back to write the length of long elements */
   if ( mode == 2 )
-    cgm->file = fopen ( file , "w"  );
+    cgm->stream = cdStreamOpenOutput ( file, 0 );
   else
-    cgm->file = fopen ( file , "w+b" );
-#endif
+    cgm->stream = cdStreamOpenSeekable ( cdStreamOpenOutput ( file, 1 ) );
 
-  if ( cgm->file  == NULL )
+  if ( cgm->stream == NULL )
   {
     free ( cgm );
     return NULL;
@@ -1261,8 +1290,8 @@ int cgm_end_metafile ( CGM *cgm )
   cgm->func->wch  ( cgm, 0, 2, 0 );
   cgm->func->term ( cgm );
 
-  fclose ( cgm->file );
-  cgm->file = NULL;
+  cdStreamClose ( cgm->stream );
+  cgm->stream = NULL;
   free ( cgm );
 
   return 0;
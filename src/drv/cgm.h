@@ -11,7 +11,7 @@
 typedef struct _cgmFunc CGMFUNC;
 
 typedef struct {
-  FILE       *file;      /* file pointer */
+  cdStream   *stream;    /* output stream */
 
   const CGMFUNC *func;   /* functions */
 
@@ -748,7 +748,7 @@ static int cdcgm_Counter(double percent, cdCGM* cd_cgm)
   if (cdcgmcountercb)
   {
     int ret = cdcgmcountercb(cd_cgm->canvas, percent);
-    if (ret == CD_ABORT);
+    if (ret == CD_ABORT)
       return CGM_ABORT_COUNTER;
   }
 
@@ -758,53 +758,106 @@ static int cdcgm_Counter(double percent, cdCGM* cd_cgm)
   return CGM_OK; 
 }
 
-int cdplayCGM(cdCanvas* canvas, int xmin, int xmax, int ymin, int ymax, void *data)
+static void cdcgm_InitFuncs(cgmPlayFuncs* funcs)
+{
+  funcs->BeginMetafile = cdcgm_BeginMetafile; 
+  funcs->EndMetafile = NULL;
+  funcs->BeginPicture = cdcgm_BeginPicture; 
+  funcs->EndPicture = NULL;
+  funcs->BeginPictureBody = cdcgm_BeginPictureBody;
+  funcs->DeviceExtent = cdcgm_DeviceExtent; 
+  funcs->ScaleMode = cdcgm_ScaleMode; 
+  funcs->BackgroundColor = cdcgm_BackgroundColor; 
+  funcs->Transparency = cdcgm_Transparency; 
+  funcs->ClipRectangle = cdcgm_ClipRectangle; 
+  funcs->ClipIndicator = cdcgm_ClipIndicator; 
+  funcs->PolyLine = cdcgm_PolyLine; 
+  funcs->PolyMarker = cdcgm_PolyMarker; 
+  funcs->Polygon = cdcgm_Polygon; 
+  funcs->Text = cdcgm_Text;
+  funcs->CellArray = cdcgm_CellArray; 
+  funcs->Rectangle = cdcgm_Rectangle;
+  funcs->Circle = cdcgm_Circle; 
+  funcs->CircularArc = cdcgm_CircularArc; 
+  funcs->Ellipse = cdcgm_Ellipse; 
+  funcs->EllipticalArc = cdcgm_EllipticalArc; 
+  funcs->LineAttrib = cdcgm_LineAttrib; 
+  funcs->MarkerAttrib = cdcgm_MarkerAttrib; 
+  funcs->FillAttrib = cdcgm_FillAttrib; 
+  funcs->TextAttrib = cdcgm_TextAttrib; 
+  funcs->Counter = cdcgm_Counter;
+}
+
+static void cdcgm_Init(cdCGM* cd_cgm, cdCanvas* canvas, int xmin, int xmax, int ymin, int ymax)
+{
+  cd_cgm->canvas = canvas;
+  cd_cgm->xmin = xmin;
+  cd_cgm->xmax = xmax;
+  cd_cgm->ymin = ymin;
+  cd_cgm->ymax = ymax;
+  cd_cgm->abort = 0;
+  cd_cgm->first_pic = 1;
+  cd_cgm->drawing_metric = 0;
+}
+
+static int cdcgm_Status(int ret)
 {
-  cgmPlayFuncs funcs;
-  cdCGM cd_cgm;
-  int ret;
-
-  cd_cgm.canvas = canvas;
-  cd_cgm.xmin = xmin;
-  cd_cgm.xmax = xmax;
-  cd_cgm.ymin = ymin;
-  cd_cgm.ymax = ymax;
-  cd_cgm.abort = 0;
-  cd_cgm.first_pic = 1;
-  cd_cgm.drawing_metric = 0;
-
-  funcs.BeginMetafile = cdcgm_BeginMetafile; 
-  funcs.EndMetafile = NULL;
-  funcs.BeginPicture = cdcgm_BeginPicture; 
-  funcs.EndPicture = NULL;
-  funcs.BeginPictureBody = cdcgm_BeginPictureBody;
-  funcs.DeviceExtent = cdcgm_DeviceExtent; 
-  funcs.ScaleMode = cdcgm_ScaleMode; 
-  funcs.BackgroundColor = cdcgm_BackgroundColor; 
-  funcs.Transparency = cdcgm_Transparency; 
-  funcs.ClipRectangle = cdcgm_ClipRectangle; 
-  funcs.ClipIndicator = cdcgm_ClipIndicator; 
-  funcs.PolyLine = cdcgm_PolyLine; 
-  funcs.PolyMarker = cdcgm_PolyMarker; 
-  funcs.Polygon = cdcgm_Polygon; 
-  funcs.Text = cdcgm_Text;
-  funcs.CellArray = cdcgm_CellArray; 
-  funcs.Rectangle = cdcgm_Rectangle;
-  funcs.Circle = cdcgm_Circle; 
-  funcs.CircularArc = cdcgm_CircularArc; 
-  funcs.Ellipse = cdcgm_Ellipse; 
-  funcs.EllipticalArc = cdcgm_EllipticalArc; 
-  funcs.LineAttrib = cdcgm_LineAttrib; 
-  funcs.MarkerAttrib = cdcgm_MarkerAttrib; 
-  funcs.FillAttrib = cdcgm_FillAttrib; 
-  funcs.TextAttrib = cdcgm_TextAttrib; 
-  funcs.Counter = cdcgm_Counter;
-
-  ret = cgmPlay((char*)data, (void*)&cd_cgm, &funcs);
   if (ret == CGM_OK)
     return CD_OK;
+  else if (ret == CGM_CONT)
+    return CD_PLAYING;
   else if (ret == CGM_ABORT_COUNTER)
     return CD_ABORT;
   else
     return CD_ERROR;
 }
+
+int cdplayCGM(cdCanvas* canvas, int xmin, int xmax, int ymin, int ymax, void *data)
+{
+  cgmPlayFuncs funcs;
+  cdCGM cd_cgm;
+
+  cdcgm_Init(&cd_cgm, canvas, xmin, xmax, ymin, ymax);
+  cdcgm_InitFuncs(&funcs);
+
+  return cdcgm_Status(cgmPlay((char*)data, (void*)&cd_cgm, &funcs));
+}
+
+typedef struct {
+  cdCGM cd_cgm;
+  tCGM* cgm;
+} cdCGMPlayer;
+
+void* cdplayBeginCGM(cdCanvas* canvas, int xmin, int xmax, int ymin, int ymax, void *data)
+{
+  cgmPlayFuncs funcs;
+  cdCGMPlayer* player = (cdCGMPlayer*)malloc(sizeof(cdCGMPlayer));
+
+  cdcgm_Init(&player->cd_cgm, canvas, xmin, xmax, ymin, ymax);
+  cdcgm_InitFuncs(&funcs);
+
+  player->cgm = cgmPlayBegin((char*)data, (void*)&player->cd_cgm, &funcs);
+  if (!player->cgm)
+  {
+    free(player);
+    return NULL;
+  }
+
+  return player;
+}
+
+int cdplayStepCGM(void* player, int count)
+{
+  return cdcgm_Status(cgmPlayStep(((cdCGMPlayer*)player)->cgm, count));
+}
+
+double cdplayProgressCGM(void* player)
+{
+  return cgmPlayProgress(((cdCGMPlayer*)player)->cgm);
+}
+
+void cdplayEndCGM(void* player)
+{
+  cgmPlayEnd(((cdCGMPlayer*)player)->cgm);
+  free(player);
+}
@@ -1,339 +1,296 @@
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#endif
+
 #include "cgm_types.h"
 #include "cgm_bin_get.h"
 
 
-static int bin_get_bit(tCGM* cgm, unsigned char *b)
+/* The whole binary file is mapped in memory, or loaded when it can not be mapped,
+   so elements and their parameters are decoded directly from memory. */
+
+int cgm_bin_open(tCGM* cgm)
 {
-  if(cgm->buff.pc==0 || cgm->buff.pc==8)
-  {
-    *b = cgm->buff.data[cgm->buff.bc];
-    cgm->buff.bc++;
+  unsigned char* data;
 
-    if(cgm->buff.bc > cgm->buff.len)
-      return CGM_ERR_READ;
+  cgm->in_data = NULL;
+  cgm->in_pos = 0;
+  cgm->in_mapped = 0;
 
-    cgm->buff.pc=0;
+#ifdef WIN32
+  {
+    HANDLE hFile = (HANDLE)_get_osfhandle(_fileno(cgm->fp));
+    HANDLE hMap = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (hMap)
+    {
+      cgm->in_data = (const unsigned char*)MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0);
+      CloseHandle(hMap);  /* the view keeps a reference to the mapping */
+    }
   }
-  else
-    *b = cgm->buff.data[cgm->buff.bc-1];
+#else
+  {
+    void* map = mmap(NULL, cgm->file_size, PROT_READ, MAP_PRIVATE, fileno(cgm->fp), 0);
+    if (map != MAP_FAILED)
+      cgm->in_data = (const unsigned char*)map;
+  }
+#endif
 
-  switch(cgm->buff.pc)
+  if (cgm->in_data)
   {
-  case 0:
-    *b = (*b | 0x0080) >> 7;
-    break;
-  case 1:
-    *b = (*b | 0x0040) >> 6;
-    break;
-  case 2:
-    *b = (*b | 0x0020) >> 5;
-    break;
-  case 3:
-    *b = (*b | 0x0010) >> 4;
-    break;
-  case 4:
-    *b = (*b | 0x0008) >> 3;
-    break;
-  case 5:
-    *b = (*b | 0x0004) >> 2;
-    break;
-  case 6:
-    *b = (*b | 0x0002) >> 1;
-    break;
-  case 7:
-    *b = (*b | 0x0001);
-    break;
-  default:
-    return CGM_ERR_READ;
+    cgm->in_mapped = 1;
+    return CGM_OK;
   }
 
-  cgm->buff.pc++;
+  data = (unsigned char*)malloc(cgm->file_size);
+  if (!data)
+    return CGM_ERR_READ;
 
+  fseek(cgm->fp, 0, SEEK_SET);
+  if (fread(data, 1, cgm->file_size, cgm->fp) != (size_t)cgm->file_size)
+  {
+    free(data);
+    return CGM_ERR_READ;
+  }
+
+  cgm->in_data = data;
   return CGM_OK;
 }
 
-static int bin_get_2bit(tCGM* cgm, unsigned char *b)
+void cgm_bin_close(tCGM* cgm)
 {
-  if(cgm->buff.pc==0 || cgm->buff.pc==8)
-  {
-    *b = cgm->buff.data[cgm->buff.bc];
-    cgm->buff.bc++;
+  if (!cgm->in_data)
+    return;
 
-    if(cgm->buff.bc > cgm->buff.len) 
-      return CGM_ERR_READ;
-
-    cgm->buff.pc=0;
+  if (cgm->in_mapped)
+  {
+#ifdef WIN32
+    UnmapViewOfFile((LPCVOID)cgm->in_data);
+#else
+    munmap((void*)cgm->in_data, cgm->file_size);
+#endif
   }
   else
-    *b = cgm->buff.data[cgm->buff.bc-1];
+    free((void*)cgm->in_data);
+
+  cgm->in_data = NULL;
+}
+
+/* All values are big endian in the file.
+   Each reader checks the size of the value and then decodes it from memory. */
+
+#define BIN_CHECK(_cgm, _n) if ((_cgm)->buff.bc + (_n) > (_cgm)->buff.len) return CGM_ERR_READ
+#define BIN_PTR(_cgm) ((const unsigned char*)(_cgm)->buff.data + (_cgm)->buff.bc)
+
+static int bin_big_endian(void)
+{
+  int test = 1;
+  return (*(unsigned char*)&test) == 0;
+}
+
+static long bin_i8(const unsigned char* p)
+{
+  return (p[0] & 0x80)? (long)p[0] - 0x100: (long)p[0];
+}
+
+static unsigned long bin_u16(const unsigned char* p)
+{
+  return ((unsigned long)p[0] << 8) | p[1];
+}
+
+static long bin_i16(const unsigned char* p)
+{
+  long v = (long)bin_u16(p);
+  return (v & 0x8000)? v - 0x10000L: v;
+}
+
+static unsigned long bin_u24(const unsigned char* p)
+{
+  return ((unsigned long)p[0] << 16) | ((unsigned long)p[1] << 8) | p[2];
+}
+
+static long bin_i24(const unsigned char* p)
+{
+  long v = (long)bin_u24(p);
+  return (v & 0x800000L)? v - 0x1000000L: v;
+}
+
+static unsigned long bin_u32(const unsigned char* p)
+{
+  return ((unsigned long)p[0] << 24) | ((unsigned long)p[1] << 16) | 
+         ((unsigned long)p[2] << 8) | p[3];
+}
+
+static long bin_i32(const unsigned char* p)
+{
+  unsigned long v = bin_u32(p);
+  if (v & 0x80000000UL)
+    return -(long)(0xFFFFFFFFUL - v) - 1;
+  return (long)v;
+}
+
+static double bin_fl32(const unsigned char* p)
+{
+  unsigned int u = (unsigned int)bin_u32(p);
+  float f;
+  memcpy(&f, &u, 4);
+  return f;
+}
+
+static double bin_fl64(const unsigned char* p)
+{
+  unsigned char b[8];
+  double d;
 
-  switch(cgm->buff.pc)
+  if (bin_big_endian())
+    memcpy(b, p, 8);
+  else
   {
-  case 0:
-    *b = (*b | 0x00C0) >> 6;
-    break;
-  case 2:
-    *b = (*b | 0x0030) >> 4;
-    break;
-  case 4:
-    *b = (*b | 0x000C) >> 2;
-    break;
-  case 6:
-    *b = (*b | 0x0003);
-    break;
-  default:
-    return CGM_ERR_READ;
+    int i;
+    for (i = 0; i < 8; i++)
+      b[i] = p[7-i];
   }
 
-  cgm->buff.pc += 2;
+  memcpy(&d, b, 8);
+  return d;
+}
 
-  return CGM_OK;
+static double bin_fx32(const unsigned char* p)
+{
+  return bin_i16(p) + bin_u16(p+2) / 65536.0;
 }
 
+static double bin_fx64(const unsigned char* p)
+{
+  return bin_i32(p) + bin_u32(p+4) / (65536.0 * 65536.0);
+}
 
-static int bin_get_4bit(tCGM* cgm, unsigned char *b)
+static int bin_get_bits(tCGM* cgm, unsigned char *b, int bits)
 {
+  /* sub-byte values, pc is the bit position in the last byte read,
+     0 or 8 means that a new byte must be read */
   if(cgm->buff.pc==0 || cgm->buff.pc==8)
   {
-    *b = cgm->buff.data[cgm->buff.bc];
+    BIN_CHECK(cgm, 1);
     cgm->buff.bc++;
-
-    if(cgm->buff.bc > cgm->buff.len) 
-      return CGM_ERR_READ;
-
     cgm->buff.pc=0;
   }
-  else
-    *b = cgm->buff.data[cgm->buff.bc-1];
-
-  switch(cgm->buff.pc)
-  {
-  case 0:
-    *b =(*b | 0x00F0) >> 4;
-    break;
-  case 4:
-    *b =(*b | 0x000F);
-    break;
-  default:
+  else if (cgm->buff.pc + bits > 8)
     return CGM_ERR_READ;
-  }
 
-  cgm->buff.pc += 4;
+  *b = (unsigned char)((cgm->buff.data[cgm->buff.bc-1] >> (8 - bits - cgm->buff.pc)) & ((1 << bits) - 1));
+
+  cgm->buff.pc += bits;
 
   return CGM_OK;
 }
 
 int cgm_bin_get_c(tCGM* cgm, unsigned char *b)
 {
+  BIN_CHECK(cgm, 1);
+
   *b = cgm->buff.data[cgm->buff.bc];
   cgm->buff.bc++;
 
-  if(cgm->buff.bc > cgm->buff.len) 
-    return CGM_ERR_READ;
-
   return CGM_OK;   
 }
 
 static int cgm_bin_get_i8(tCGM* cgm, signed char *b)
 {
-  unsigned char b1;
-
-  if(cgm_bin_get_c(cgm, &b1)) 
-    return CGM_ERR_READ;
-
-  *b =(signed char) b1;
-
+  BIN_CHECK(cgm, 1);
+  *b = (signed char)bin_i8(BIN_PTR(cgm));
+  cgm->buff.bc++;
   return CGM_OK;
 }
 
 static int cgm_bin_get_i16(tCGM* cgm, short *b)
 {
-  unsigned char b1, b2;
-
-  if(cgm_bin_get_c(cgm, &b1)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b2)) 
-    return CGM_ERR_READ;
-
-  *b =(b1<<8) | b2;
-
+  BIN_CHECK(cgm, 2);
+  *b = (short)bin_i16(BIN_PTR(cgm));
+  cgm->buff.bc += 2;
   return CGM_OK;
 }
 
 static int cgm_bin_get_i24(tCGM* cgm, long *b)
 {
-  unsigned char b1, b2, b3;
-
-  if(cgm_bin_get_c(cgm, &b1)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b2)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b3)) 
-    return CGM_ERR_READ;
-
-  *b =(b1<<16) |(b2<<8) | b3;
-
+  BIN_CHECK(cgm, 3);
+  *b = bin_i24(BIN_PTR(cgm));
+  cgm->buff.bc += 3;
   return CGM_OK;
 }
 
 static int cgm_bin_get_i32(tCGM* cgm, long *b)
 {
-  unsigned char b1, b2, b3, b4;
-
-  if(cgm_bin_get_c(cgm, &b1)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b2)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b3)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b4)) 
-    return CGM_ERR_READ;
-
-  *b =(b1<<24) |(b2<<16) |(b3<<8) | b4;
-
+  BIN_CHECK(cgm, 4);
+  *b = bin_i32(BIN_PTR(cgm));
+  cgm->buff.bc += 4;
   return CGM_OK;
 }
 
 static int cgm_bin_get_u8(tCGM* cgm, unsigned char *b)
 {
-  if(cgm_bin_get_c(cgm, b)) 
-    return CGM_ERR_READ;
-
-  return CGM_OK;
+  return cgm_bin_get_c(cgm, b);
 }
 
 static int cgm_bin_get_u16(tCGM* cgm, unsigned short *b)
 {
-  unsigned char b1, b2;
-
-  if(cgm_bin_get_c(cgm, &b1)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b2)) 
-    return CGM_ERR_READ;
-
-  *b =(b1<<8) | b2;
-
+  BIN_CHECK(cgm, 2);
+  *b = (unsigned short)bin_u16(BIN_PTR(cgm));
+  cgm->buff.bc += 2;
   return CGM_OK;
 }
 
 static int cgm_bin_get_u24(tCGM* cgm, unsigned long *b)
 {
-  unsigned char b1, b2, b3;
-
-  if(cgm_bin_get_c(cgm, &b1)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b2)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b3)) 
-    return CGM_ERR_READ;
-
-  *b =(b1<<16) |(b2<<8) | b3;
-
+  BIN_CHECK(cgm, 3);
+  *b = bin_u24(BIN_PTR(cgm));
+  cgm->buff.bc += 3;
   return CGM_OK;
 }
 
 static int cgm_bin_get_u32(tCGM* cgm, unsigned long *b)
 {
-  unsigned char b1, b2, b3, b4;
-
-  if(cgm_bin_get_c(cgm, &b1)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b2)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b3)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b4)) 
-    return CGM_ERR_READ;
-
-  *b =(b1<<24) |(b2<<16) |(b3<<8) | b4;
-
+  BIN_CHECK(cgm, 4);
+  *b = bin_u32(BIN_PTR(cgm));
+  cgm->buff.bc += 4;
   return CGM_OK;
 }
 
 static int cgm_bin_get_fl32(tCGM* cgm, float *b)
 {
-  unsigned char b1, b2, b3, b4;
-  union {
-    float f;
-    long  l;
-  } r;
-
-  if(cgm_bin_get_c(cgm, &b1)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b2)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b3)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b4)) 
-    return CGM_ERR_READ;
-
-  r.l =(b1<<24) |(b2<<16) |(b3<<8) | b4;
-  *b = r.f;
-
+  BIN_CHECK(cgm, 4);
+  *b = (float)bin_fl32(BIN_PTR(cgm));
+  cgm->buff.bc += 4;
   return CGM_OK;
 }
 
 static int cgm_bin_get_fl64(tCGM* cgm, double *b)
 {
-  unsigned char b1, b2, b3, b4, b5, b6, b7, b8;
-  union {
-    double d;
-    long   l[2];
-  } r;
-
-  if(cgm_bin_get_c(cgm, &b1)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b2)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b3)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b4)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b5)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b6)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b7)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_c(cgm, &b8)) 
-    return CGM_ERR_READ;
-
-  r.l[1] =(b1<<24) |(b2<<16) |(b3<<8) | b4;
-  r.l[0] =(b5<<24) |(b6<<16) |(b7<<8) | b8;
-  *b = r.d;
-
+  BIN_CHECK(cgm, 8);
+  *b = bin_fl64(BIN_PTR(cgm));
+  cgm->buff.bc += 8;
   return CGM_OK;
 }
 
 static int cgm_bin_get_fx32(tCGM* cgm, float *b)
 {
-  short si;
-  unsigned short ui;
-
-  if(cgm_bin_get_i16(cgm, &si)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_u16(cgm, &ui)) 
-    return CGM_ERR_READ;
-
-  *b =(float)(si +(ui / 65536.0));
-
+  BIN_CHECK(cgm, 4);
+  *b = (float)bin_fx32(BIN_PTR(cgm));
+  cgm->buff.bc += 4;
   return CGM_OK;
 }
 
 static int cgm_bin_get_fx64(tCGM* cgm, double *b)
 {
-  long si, ui;
-
-  if(cgm_bin_get_i32(cgm, &si)) 
-    return CGM_ERR_READ;
-  if(cgm_bin_get_i32(cgm, &ui)) 
-    return CGM_ERR_READ;
-
-  *b = si +((unsigned short) ui /(65536.0 * 65536.0));
-
+  BIN_CHECK(cgm, 8);
+  *b = bin_fx64(BIN_PTR(cgm));
+  cgm->buff.bc += 8;
   return CGM_OK;
 }
 
@@ -719,6 +676,122 @@ int cgm_bin_get_p(tCGM* cgm, double *x, double *y)
   return CGM_OK;
 }
 
+static int bin_vdc_size(tCGM* cgm)
+{
+  static const int int_size[] = {1, 2, 3, 4};
+  static const int real_size[] = {4, 8, 4, 8};
+
+  if(cgm->vdc_type == CGM_INTEGER)
+  {
+    if (cgm->vdc_int.b_prec < 0 || cgm->vdc_int.b_prec > 3)
+      return 0;
+    return int_size[cgm->vdc_int.b_prec];
+  }
+  else
+  {
+    if (cgm->vdc_real.b_prec < 0 || cgm->vdc_real.b_prec > 3)
+      return 0;
+    return real_size[cgm->vdc_real.b_prec];
+  }
+}
+
+int cgm_bin_get_np(tCGM* cgm)
+{
+  int size = 2*bin_vdc_size(cgm);
+  int left = cgm->buff.len - cgm->buff.bc;
+
+  if (size == 0 || left % size)
+    return -1;
+
+  return left / size;
+}
+
+int cgm_bin_get_pl(tCGM* cgm, cgmPoint *pt, int n)
+{
+  const unsigned char* p;
+  int i, size = 2*bin_vdc_size(cgm);
+
+  if (size == 0)
+    return CGM_ERR_READ;
+
+  BIN_CHECK(cgm, size*n);
+  p = BIN_PTR(cgm);
+
+  /* the precision is tested once for the whole list */
+  if(cgm->vdc_type == CGM_INTEGER)
+  {
+    switch(cgm->vdc_int.b_prec)
+    {
+    case 0: 
+      for (i = 0; i < n; i++, p += 2)
+      {
+        pt[i].x = (double)bin_i8(p);
+        pt[i].y = (double)bin_i8(p+1);
+      }
+      break;
+    case 1: 
+      for (i = 0; i < n; i++, p += 4)
+      {
+        pt[i].x = (double)bin_i16(p);
+        pt[i].y = (double)bin_i16(p+2);
+      }
+      break;
+    case 2: 
+      for (i = 0; i < n; i++, p += 6)
+      {
+        pt[i].x = (double)bin_i24(p);
+        pt[i].y = (double)bin_i24(p+3);
+      }
+      break;
+    case 3: 
+      for (i = 0; i < n; i++, p += 8)
+      {
+        pt[i].x = (double)bin_i32(p);
+        pt[i].y = (double)bin_i32(p+4);
+      }
+      break;
+    }
+  }
+  else
+  {
+    switch(cgm->vdc_real.b_prec)
+    {
+    case 0: 
+      for (i = 0; i < n; i++, p += 8)
+      {
+        pt[i].x = bin_fl32(p);
+        pt[i].y = bin_fl32(p+4);
+      }
+      break;
+    case 1: 
+      for (i = 0; i < n; i++, p += 16)
+      {
+        pt[i].x = bin_fl64(p);
+        pt[i].y = bin_fl64(p+8);
+      }
+      break;
+    case 2: 
+      for (i = 0; i < n; i++, p += 8)
+      {
+        pt[i].x = bin_fx32(p);
+        pt[i].y = bin_fx32(p+4);
+      }
+      break;
+    case 3: 
+      for (i = 0; i < n; i++, p += 16)
+      {
+        pt[i].x = bin_fx64(p);
+        pt[i].y = bin_fx64(p+8);
+      }
+      break;
+    }
+  }
+
+  cgm->buff.bc += size*n;
+
+  return CGM_OK;
+}
+
 int cgm_bin_get_co(tCGM* cgm, tColor *co)
 {
   if(cgm->color_mode == CGM_INDEXED) /* indexed */
@@ -751,19 +824,11 @@ static int bin_get_pixeli(tCGM* cgm, unsigned long *ci, int localp)
   switch(localp)
   {
   case 1: 
-    if(bin_get_bit(cgm, &c)) 
-      return CGM_ERR_READ;
-    *ci =(unsigned long) c;
-    break;
   case 2: 
-    if(bin_get_2bit(cgm, &c))
-      *ci =(unsigned long) c;
-    return CGM_ERR_READ;
-    break;
   case 4: 
-    if(bin_get_4bit(cgm, &c))
-      *ci =(unsigned long) c;
-    return CGM_ERR_READ;
+    if(bin_get_bits(cgm, &c, localp)) 
+      return CGM_ERR_READ;
+    *ci =(unsigned long) c;
     break;
   case 8: 
     if(cgm_bin_get_u8 (cgm, &c)) 
@@ -806,21 +871,12 @@ static int bin_get_pixeld(tCGM* cgm, unsigned long *cd, int localp)
   switch(localp)
   {
   case  1: 
-    if(bin_get_bit (cgm, &c)) 
-      return CGM_ERR_READ;
-    *cd =(unsigned long) c;
-    break;
   case  2: 
-    if(bin_get_2bit(cgm, &c)) 
+  case  4: 
+    if(bin_get_bits(cgm, &c, localp)) 
       return CGM_ERR_READ;
     *cd =(unsigned long) c;
     break;
-  case  4: 
-    if(bin_get_4bit(cgm, &c))
-      *cd =(unsigned long) c;
-
-    return CGM_ERR_READ;
-    break;
   case  8: 
     if(cgm_bin_get_u8 (cgm, &c)) 
       return CGM_ERR_READ;
@@ -873,3 +929,114 @@ int cgm_bin_get_pixel(tCGM* cgm, tColor *co, int localp)
 
   return CGM_OK;
 }
+
+static int bin_pixel_prec(tCGM* cgm, int localp)
+{
+  if(localp==0)
+  {
+    int prec = (cgm->color_mode == CGM_INDEXED)? cgm->cix_prec: cgm->cd_prec;
+    if (prec < 0 || prec > 3)
+      return 0;
+    localp = 8*(prec+1);
+  }
+
+  return localp;
+}
+
+static unsigned long bin_pixel_value(const unsigned char* p, unsigned long pos, int bits)
+{
+  p += pos >> 3;
+
+  switch(bits)
+  {
+  case 8:
+    return p[0];
+  case 16:
+    return bin_u16(p);
+  case 24:
+    return bin_u24(p);
+  case 32:
+    return bin_u32(p);
+  default:  /* 1, 2 and 4 */
+    return (p[0] >> (8 - bits - (pos & 7))) & ((1 << bits) - 1);
+  }
+}
+
+int cgm_bin_pixelmap(tCGM* cgm, unsigned char *map, int localp)
+{
+  int i, n;
+  tColor co;
+
+  if (cgm->color_mode != CGM_INDEXED)
+    return 0;
+
+  localp = bin_pixel_prec(cgm, localp);
+  if (localp != 1 && localp != 2 && localp != 4 && localp != 8)
+    return 0;
+
+  n = 1 << localp;
+  for (i = 0; i < n; i++)
+  {
+    co.index = i;
+    cgm_getcolor_ar(cgm, co, map + 3*i+0, map + 3*i+1, map + 3*i+2);
+  }
+
+  return n;
+}
+
+int cgm_bin_get_pixels(tCGM* cgm, unsigned char *rgb, int n, int localp, const unsigned char *map)
+{
+  const unsigned char* p;
+  unsigned long pos;
+  int i, bits, count, nbytes;
+  tColor co;
+
+  bits = bin_pixel_prec(cgm, localp);
+  if (bits != 1 && bits != 2 && bits != 4 && bits != 8 && 
+      bits != 16 && bits != 24 && bits != 32)
+    return CGM_ERR_READ;
+
+  /* the row starts at a byte boundary */
+  count = (cgm->color_mode == CGM_INDEXED)? n: 3*n;
+  nbytes = (int)(((unsigned long)count*bits + 7) / 8);
+  BIN_CHECK(cgm, nbytes);
+  p = BIN_PTR(cgm);
+
+  if (map)
+  {
+    for (i = 0, pos = 0; i < n; i++, pos += bits)
+      memcpy(rgb + 3*i, map + 3*bin_pixel_value(p, pos, bits), 3);
+  }
+  else if (cgm->color_mode != CGM_INDEXED && bits == 8 &&
+           cgm->color_ext.black.red == 0 && cgm->color_ext.white.red == 255 &&
+           cgm->color_ext.black.green == 0 && cgm->color_ext.white.green == 255 &&
+           cgm->color_ext.black.blue == 0 && cgm->color_ext.white.blue == 255)
+  {
+    memcpy(rgb, p, 3*n);
+  }
+  else
+  {
+    for (i = 0, pos = 0; i < n; i++)
+    {
+      if (cgm->color_mode == CGM_INDEXED)
+      {
+        co.index = bin_pixel_value(p, pos, bits);
+        pos += bits;
+      }
+      else
+      {
+        co.rgb.red = bin_pixel_value(p, pos, bits);
+        co.rgb.green = bin_pixel_value(p, pos + bits, bits);
+        co.rgb.blue = bin_pixel_value(p, pos + 2*bits, bits);
+        pos += 3*bits;
+      }
+
+      cgm_getcolor_ar(cgm, co, rgb + 3*i+0, rgb + 3*i+1, rgb + 3*i+2);
+    }
+  }
+
+  cgm->buff.bc += nbytes;
+  cgm->buff.pc = 0;
+
+  return CGM_OK;
+}
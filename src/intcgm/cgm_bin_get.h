@@ -19,6 +19,10 @@ int cgm_bin_get_rf(tCGM* cgm, double *);  /* real as floating point always */
 int cgm_bin_get_ix(tCGM* cgm, long *);  /* index */
 int cgm_bin_get_pixel(tCGM* cgm, tColor *, int);  /* clist pixel, co using local precision */
 int cgm_bin_get_c(tCGM* cgm, unsigned char *);  /* single byte */
+int cgm_bin_get_np(tCGM* cgm);  /* number of points in the remaining parameters, -1 if not a list of points */
+int cgm_bin_get_pl(tCGM* cgm, cgmPoint *, int);  /* list of points */
+int cgm_bin_pixelmap(tCGM* cgm, unsigned char *, int);  /* rgb of all color indices up to 8 bits of local precision, returns the count or 0 */
+int cgm_bin_get_pixels(tCGM* cgm, unsigned char *, int, int, const unsigned char *);  /* packed row of pixels as rgb, using the map if not NULL */
 
 typedef int(*cgmGetData)(tCGM* cgm, void *);
 cgmGetData cgm_bin_get_samplefunc(long sample_type);
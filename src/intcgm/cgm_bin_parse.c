@@ -6,6 +6,94 @@
 
 static int cgm_bin_exec_command(tCGM* cgm, int, int);
 
+static void bin_buff_reserve(tCGM* cgm, int size)
+{
+  if (size > cgm->buff.size)
+  {
+    cgm->buff.size = 2*size;
+    cgm->buff.mem = (char *)realloc(cgm->buff.mem, cgm->buff.size);
+  }
+}
+
+/* Reads the element at the position pos of a memory block.
+   When the element has a single partition, its parameters are used in place,
+   else the partitions are gathered in buff.mem. */
+static int bin_get_element(tCGM* cgm, const unsigned char* in, long in_size, long *pos, int *c, int *id)
+{
+  int len, cont; 
+  unsigned short b;
+  long p = *pos;
+
+  if(p + 2 > in_size) 
+    return CGM_ERR_READ;
+
+  b =(in[p] << 8) + in[p+1];
+  p += 2;
+
+  len = b & 0x001F;
+  *id =(b & 0x0FE0) >> 5;
+  *c =(b & 0xF000) >> 12;
+
+  cont = 0;
+
+  if(len > 30)
+  {
+    if(p + 2 > in_size) 
+      return CGM_ERR_READ;
+
+    b =(in[p] << 8) + in[p+1];
+    p += 2;
+
+    len = b & 0x7FFF;
+    cont =(b & 0x8000);
+  }
+
+  if(p + len > in_size) 
+    return CGM_ERR_READ;
+
+  cgm->buff.data = (char *)(in + p);
+  cgm->buff.len = len;
+  p += len + (len & 1);
+
+  if (cont)
+  {
+    bin_buff_reserve(cgm, len);
+    memcpy(cgm->buff.mem, cgm->buff.data, len);
+    cgm->buff.data = cgm->buff.mem;
+  }
+
+  while(cont)
+  {
+    if(p + 2 > in_size) 
+      return CGM_ERR_READ;
+
+    b =(in[p] << 8) + in[p+1];
+    p += 2;
+
+    cont =(b & 0x8000);
+    len = b & 0x7fff;
+
+    if(p + len > in_size) 
+      return CGM_ERR_READ;
+
+    bin_buff_reserve(cgm, cgm->buff.len + len);
+    cgm->buff.data = cgm->buff.mem;
+
+    memcpy(cgm->buff.mem + cgm->buff.len, in + p, len);
+    cgm->buff.len += len;
+    p += len + (len & 1);
+  }
+
+  if (p > in_size)  /* pad byte missing at the end of file */
+    p = in_size;
+
+  cgm->buff.bc = 0;
+  cgm->buff.pc = 0;
+  *pos = p;
+
+  return CGM_OK;
+}
+
 /*******************************
 *     Delimiter Elements       *
 *******************************/
@@ -228,98 +316,33 @@ static int cgm_bin_bmtfdf(tCGM* cgm)
 {
   /* default state is the state to which the interpreter is returned 
      at the start of each picture. */
-  int c, id, len, cont, totbc; 
-  unsigned short b;
-  int count=0, ret;
-  int old_cgmlen;
-  char *buff;
-
-  buff =(char *) malloc(sizeof(char)*cgm->buff.len);
-
-  memcpy(buff, cgm->buff.data, cgm->buff.len);
+  int c, id, ret = CGM_OK;
+  long count = 0;
+  long old_cgmlen;
+  unsigned char *buff;
 
+  /* the elements are copied because buff.mem is reused by continued elements */
   old_cgmlen = cgm->buff.len;
-
-  totbc = 0;
+  buff =(unsigned char *) malloc(old_cgmlen);
+  memcpy(buff, cgm->buff.data, old_cgmlen);
 
   while(count<old_cgmlen)
   {
-    cgm->buff.bc = 0;
-
-    b =((unsigned char)buff[count] << 8) |(unsigned char)buff[count+1];
-    count += 2;
-
-    len = b & 0x001F;
-    id =(b & 0x0FE0) >> 5;
-    c =(b & 0xF000) >> 12;
-
-    cont = 0;
-
-    if(len > 30)
-    {
-      b =((unsigned char)buff[count] << 8) |(unsigned char)buff[count+1];
-      count += 2;
-
-      len = b & 0x7FFF;
-      cont =(b & 0x8000);
-    }
-
-    cgm->buff.len = len;
-
-    if(cgm->buff.len)
-    {
-      if (cgm->buff.len>cgm->buff.size)
-      {
-        cgm->buff.data = (char *)realloc(cgm->buff.data, cgm->buff.len);
-        cgm->buff.size = cgm->buff.len;
-      }
-
-      memcpy(cgm->buff.data, &buff[count], cgm->buff.len);
-      count += cgm->buff.len;
-
-      if(len & 1)
-        count++;
-
-      while(cont)
-      {
-        unsigned short b;
-        int old_len = cgm->buff.len;
-
-        b =((unsigned char)buff[count] << 8) |(unsigned char)buff[count+1];
-        count += 2;
-
-        cont =(b & 0x8000);
-
-        len = b & 0x7fff;
-
-        cgm->buff.len += len;
-
-        if (cgm->buff.len>cgm->buff.size)
-        {
-          cgm->buff.data = (char *)realloc(cgm->buff.data, cgm->buff.len);
-          cgm->buff.size = cgm->buff.len;
-        }
-
-        memcpy(&cgm->buff.data[old_len], &buff[count], len);
-        count += len;
-
-        if(len & 1)
-          count++;
-      }
-    }
+    ret = bin_get_element(cgm, buff, old_cgmlen, &count, &c, &id);
+    if(ret != CGM_OK) 
+      break;
 
     ret = cgm_bin_exec_command(cgm, c, id);
     if(ret != CGM_OK) 
-    {
-      free(buff);
-      return ret;
-    }
-
-    totbc += count;
+      break;
   }
 
+  cgm->buff.data = cgm->buff.mem;
+  cgm->buff.len = 0;
+  cgm->buff.bc = 0;
+
   free(buff);
-  return CGM_OK;
+  return ret;
 }
 
 static int cgm_bin_fntlst(tCGM* cgm)
@@ -593,22 +616,19 @@ static int cgm_bin_transpcellcolor(tCGM* cgm)
 
 static cgmPoint *get_points(tCGM* cgm, int *np)
 {
-  *np=0;
+  *np = cgm_bin_get_np(cgm);
+  if(*np < 0) 
+    return NULL;
 
-  while(cgm->buff.bc < cgm->buff.len)
+  if(*np >= cgm->point_list_n)
   {
-    if(cgm_bin_get_p(cgm, &(cgm->point_list[*np].x), &(cgm->point_list[*np].y))) 
-      return NULL;
-
-    ++(*np);
-
-    if(*np==cgm->point_list_n)
-    {
-      cgm->point_list_n *= 2;
-      cgm->point_list =(cgmPoint *) realloc(cgm->point_list, cgm->point_list_n*sizeof(cgmPoint));
-    }
+    cgm->point_list_n = 2*(*np);
+    cgm->point_list =(cgmPoint *) realloc(cgm->point_list, cgm->point_list_n*sizeof(cgmPoint));
   }
 
+  if(cgm_bin_get_pl(cgm, cgm->point_list, *np)) 
+    return NULL;
+
   return cgm->point_list;
 }
 
@@ -812,6 +832,8 @@ static int cgm_bin_cellar(tCGM* cgm)
   cgmPoint corner1, corner2, corner3;
   tColor cell;
   unsigned char* rgb;
+  unsigned char map[256*3];
+  int has_map;
 
   if(cgm_bin_get_p(cgm, &(corner1.x), &(corner1.y))) 
     return CGM_ERR_READ;
@@ -834,6 +856,9 @@ static int cgm_bin_cellar(tCGM* cgm)
 
   rgb = malloc(nx*ny*3);
 
+  /* indexed colors of up to 8 bits are converted only once */
+  has_map = cgm_bin_pixelmap(cgm, map, prec);
+
   if (mode)
   {
     /* Packed mode */
@@ -842,16 +867,10 @@ static int cgm_bin_cellar(tCGM* cgm)
       b=cgm->buff.bc;
       cgm->buff.pc=0;
 
-      for(i=0; i<nx; i++)
+      if(cgm_bin_get_pixels(cgm, rgb + 3*k*nx, nx, prec, has_map? map: NULL)) 
       {
-        if(cgm_bin_get_pixel(cgm, &cell, prec)) 
-        {
-          free(rgb);
-          return CGM_ERR_READ;
-        }
-
-        offset = 3*(k*nx+i);
-        cgm_getcolor_ar(cgm, cell, rgb + offset+0, rgb + offset+1, rgb + offset+2);
+        free(rgb);
+        return CGM_ERR_READ;
       }
 
       /* row starts on a word boundary */
@@ -890,7 +909,10 @@ static int cgm_bin_cellar(tCGM* cgm)
         for(j=0; j<run_count && i<nx; j++)
         {  
           offset = 3*(k*nx+i);
-          cgm_getcolor_ar(cgm, cell, rgb + offset+0, rgb + offset+1, rgb + offset+2);
+          if (has_map && cell.index < (unsigned long)has_map)
+            memcpy(rgb + offset, map + 3*cell.index, 3);
+          else
+            cgm_getcolor_ar(cgm, cell, rgb + offset+0, rgb + offset+1, rgb + offset+2);
           i++; /* only increment here */
         }
       }
@@ -2380,101 +2402,16 @@ static int cgm_bin_exec_command(tCGM* cgm, int classe, int id)
 
 int cgm_bin_rch(tCGM* cgm)
 {
-  int c, id, len, cont, i; 
-  unsigned char ch[2], dummy;
-  unsigned short b;
+  int c, id; 
   int ret;
 
-  if(cgm->buff.bc!=cgm->buff.len)
-    return CGM_ERR_READ;
-
-  cgm->buff.bc = 0;
-
-  ret = fread(ch, 1, 2, cgm->fp);
-  if(ret<2) 
-  {
-    if (feof(cgm->fp))
-      return CGM_OK;
-    else
-      return CGM_ERR_READ;
-  }
-
-  b =(ch[0] << 8) + ch[1];
-  len = b & 0x001F;
-  id =(b & 0x0FE0) >> 5;
-  c =(b & 0xF000) >> 12;
-
-  cont = 0;
-
-  if(len > 30)
-  {
-    ret = fread(ch, 1, 2, cgm->fp);
-    if(ret<2) 
-      return CGM_ERR_READ;
-
-    b =(ch[0] << 8) + ch[1];
-
-    len = b & 0x7FFF;
-    cont =(b & 0x8000);
-  }
-
-  cgm->buff.len = len;
-
-  if(cgm->buff.len)
-  {
-    if (cgm->buff.len>cgm->buff.size)
-    {
-      cgm->buff.data = (char *)realloc(cgm->buff.data, cgm->buff.len);
-      cgm->buff.size = cgm->buff.len;
-    }
-
-    ret = fread(cgm->buff.data, 1, cgm->buff.len, cgm->fp);
-    if(ret<cgm->buff.len) 
-      return CGM_ERR_READ;
-
-    if (len & 1)
-    {
-      ret = fread(&dummy, 1, 1, cgm->fp);
-      if(ret<1) 
-        return CGM_ERR_READ;
-    }
-
-    while(cont)
-    {
-      unsigned char ch[2];
-      unsigned short b;
-      int old_len = cgm->buff.len;
-
-      ret = fread(ch, 1, 2, cgm->fp);
-      if(ret<2) 
-        return CGM_ERR_READ;
-
-      b =(ch[0] << 8) + ch[1];
-
-      cont =(b & 0x8000);
-
-      len = b & 0x7fff;
-
-      cgm->buff.len += len;
-
-      if (cgm->buff.len>cgm->buff.size)
-      {
-        cgm->buff.data = (char *)realloc(cgm->buff.data, cgm->buff.len);
-        cgm->buff.size = cgm->buff.len;
-      }
-
-      ret = fread(&cgm->buff.data[old_len], 1, len, cgm->fp);
-      if(ret<len) 
-        return CGM_ERR_READ;
+  /* end of file, ignoring a trailing pad byte */
+  if(cgm->in_pos + 2 > cgm->file_size) 
+    return CGM_OK;
 
-      if(len & 1)
-      {
-        ret = fread(&dummy, 1, 1, cgm->fp);
-        if(ret<1) 
-          return CGM_ERR_READ;
-      }
-    }
-  }
+  ret = bin_get_element(cgm, cgm->in_data, cgm->file_size, &cgm->in_pos, &c, &id);
+  if (ret != CGM_OK) 
+    return ret;
 
   if (cgm_inccounter(cgm))
     return CGM_ABORT_COUNTER;
@@ -2483,15 +2420,8 @@ int cgm_bin_rch(tCGM* cgm)
   if (ret != CGM_OK) 
     return ret;
 
-  for(i=0; i<cgm->buff.len-cgm->buff.bc; i++)
-  {
-    unsigned char dummy;
-    if(cgm_bin_get_c(cgm, &dummy)) 
-      return CGM_ERR_READ;
-  }
+  /* skip parameters not used by the command */
+  cgm->buff.bc = cgm->buff.len;
 
-  if (feof(cgm->fp))
-    return CGM_OK;
-  else
-    return CGM_CONT;
+  return CGM_CONT;
 }
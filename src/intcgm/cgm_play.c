@@ -512,9 +512,16 @@ static void set_funcs(cgmPlayFuncs* dof, cgmPlayFuncs* funcs)
   if (funcs->Counter)          dof->Counter = funcs->Counter;
 }
 
+static long cgm_tell(tCGM* cgm)
+{
+  if (cgm->in_data)
+    return cgm->in_pos;
+  return ftell(cgm->fp);
+}
+
 int cgm_inccounter (tCGM* cgm)
 {
-  return cgm->dof.Counter((ftell(cgm->fp )*100.)/cgm->file_size, cgm->userdata);
+  return cgm->dof.Counter((cgm_tell(cgm)*100.)/cgm->file_size, cgm->userdata);
 }
 
 static FILE* open_cgm(const char *filename, int *mode, int *file_size)
@@ -554,15 +561,15 @@ static FILE* open_cgm(const char *filename, int *mode, int *file_size)
   return fp;
 }
 
-int cgmPlay(const char* filename, void* userdata, cgmPlayFuncs* funcs)
+tCGM* cgmPlayBegin(const char* filename, void* userdata, cgmPlayFuncs* funcs)
 {
   tCGM* cgm;
   FILE* fp;
-  int mode, file_size, ret;
+  int mode, file_size;
 
   fp = open_cgm(filename, &mode, &file_size);
   if (!fp)
-    return CGM_ERR_OPEN;
+    return NULL;
 
   cgm = calloc(1, sizeof(tCGM));
 
@@ -571,6 +578,14 @@ int cgmPlay(const char* filename, void* userdata, cgmPlayFuncs* funcs)
 
   cgm->fp = fp;
   cgm->file_size = file_size;
+  cgm->mode = mode;
+
+  if (mode == 1 && cgm_bin_open(cgm) != CGM_OK)
+  {
+    fclose(fp);
+    free(cgm);
+    return NULL;
+  }
 
   cgm->dof.Counter(0, cgm->userdata);
 
@@ -642,7 +657,8 @@ int cgmPlay(const char* filename, void* userdata, cgmPlayFuncs* funcs)
 
   cgm->buff.len = 0;
   cgm->buff.size = 1024;
-  cgm->buff.data =(char *) malloc(sizeof(char) * cgm->buff.size);
+  cgm->buff.mem =(char *) malloc(sizeof(char) * cgm->buff.size);
+  cgm->buff.data = cgm->buff.mem;
   cgm->buff.bc = 0;
   cgm->buff.pc = 0;
 
@@ -705,26 +721,41 @@ int cgmPlay(const char* filename, void* userdata, cgmPlayFuncs* funcs)
   cgm->color_table[1].green = 0;
   cgm->color_table[1].blue  = 0;
 
-  if(mode == 1)
+  return cgm;
+}
+
+int cgmPlayStep(tCGM* cgm, int count)
+{
+  int ret = CGM_CONT;
+
+  while(count > 0 && ret==CGM_CONT)
   {
-    do
-    {
+    if(cgm->mode == 1)
       ret = cgm_bin_rch(cgm);  /* binary */
-    } while(ret==CGM_CONT);  
-  }
-  else
-  {
-    do
-    {
+    else
       ret = cgm_txt_rch(cgm);  /* text */
-    } while(ret==CGM_CONT);  
+
+    count--;
   }
 
+  return ret;
+}
+
+double cgmPlayProgress(tCGM* cgm)
+{
+  if (cgm->file_size <= 0)
+    return 100.;
+
+  return (cgm_tell(cgm)*100.)/cgm->file_size;
+}
+
+void cgmPlayEnd(tCGM* cgm)
+{
   if(cgm->point_list)
     free(cgm->point_list);
 
-  if(cgm->buff.data)
-    free(cgm->buff.data);
+  if(cgm->buff.mem)
+    free(cgm->buff.mem);
 
   if(cgm->color_table)
     free(cgm->color_table);
@@ -751,8 +782,23 @@ int cgmPlay(const char* filename, void* userdata, cgmPlayFuncs* funcs)
 
   cgm->dof.Counter(100., cgm->userdata);
 
+  cgm_bin_close(cgm);
   fclose(cgm->fp);
   free(cgm);
+}
+
+int cgmPlay(const char* filename, void* userdata, cgmPlayFuncs* funcs)
+{
+  int ret;
+  tCGM* cgm = cgmPlayBegin(filename, userdata, funcs);
+  if (!cgm)
+    return CGM_ERR_OPEN;
+
+  do
+  {
+    ret = cgmPlayStep(cgm, 1);
+  } while(ret==CGM_CONT);  
 
+  cgmPlayEnd(cgm);
   return ret;
 }
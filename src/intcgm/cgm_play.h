@@ -161,9 +161,21 @@ typedef struct {
 #define CGM_ERR_OPEN 1
 #define CGM_ERR_READ 2
 #define CGM_ABORT_COUNTER -1
+#define CGM_CONT 3
 
 int cgmPlay(const char* filename, void* userdata, cgmPlayFuncs* funcs);
 
+/* Incremental play.
+   cgmPlayBegin opens the file and calls Counter(0), returns NULL if the file can not be opened.
+   cgmPlayStep interprets up to count elements, returns CGM_CONT while there are more elements,
+     or the same values returned by cgmPlay when the file ends, fails or is aborted.
+   cgmPlayProgress returns the percent of the file already interpreted.
+   cgmPlayEnd calls Counter(100) and releases the player, it can be called at any time. */
+tCGM* cgmPlayBegin(const char* filename, void* userdata, cgmPlayFuncs* funcs);
+int cgmPlayStep(tCGM* cgm, int count);
+double cgmPlayProgress(tCGM* cgm);
+void cgmPlayEnd(tCGM* cgm);
+
 
 #ifdef __cplusplus
 }
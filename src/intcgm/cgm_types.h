@@ -31,8 +31,9 @@ typedef union {
 } tColor;
 
 typedef struct {
-  char *data;
-  int size;  /* allocated size */
+  char *data;  /* element parameters, points to the input or to mem */
+  char *mem;   /* used when the element has more than one partition */
+  int size;  /* allocated size of mem */
   int len;   /* used size */
   int bc;    /* byte count */
   int pc;    /* pixel count */
@@ -120,6 +121,12 @@ typedef struct {
 struct _tCGM {
   FILE *fp;
   int file_size;
+  int mode;  /* 1=binary, 2=text */
+
+  /* binary input is mapped or loaded in memory */
+  const unsigned char* in_data;
+  long in_pos;
+  int in_mapped;
 
   tData buff;
 
@@ -212,8 +219,6 @@ struct _tCGM {
   void* userdata;
 };
 
-#define CGM_CONT 3
-
 enum { CGM_OFF, CGM_ON };
 enum { CGM_INTEGER, CGM_REAL };
 enum { CGM_STRING, CGM_CHAR, CGM_STROKE };
@@ -225,6 +230,8 @@ enum { CGM_INVISIBLE, CGM_VISIBLE, CGM_CLOSE_INVISIBLE, CGM_CLOSE_VISIBLE };
 enum { CGM_PATH_RIGHT, CGM_PATH_LEFT, CGM_PATH_UP, CGM_PATH_DOWN };
 
 int cgm_bin_rch(tCGM* cgm);
+int cgm_bin_open(tCGM* cgm);
+void cgm_bin_close(tCGM* cgm);
 int cgm_txt_rch(tCGM* cgm);
 
 void cgm_strupper(char *s);
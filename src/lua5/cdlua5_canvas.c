@@ -2157,6 +2157,15 @@ static int cdlua5_play(lua_State *L)
   return 1;
 }
 
+/***************************************************************************\
+* cd.PlayTolerance(tolerance: number) -> (old_tolerance: number)            *
+\***************************************************************************/
+static int cdlua5_playtolerance(lua_State *L)
+{
+  lua_pushnumber(L, cdCanvasPlayTolerance(cdlua_checkcanvas(L, 1), luaL_checknumber(L, 2)));
+  return 1;
+}
+
 /***************************************************************************\
 * cd.GetColorPlanes() -> (bpp: number)                                      *
 \***************************************************************************/
@@ -2503,6 +2512,7 @@ static const struct luaL_Reg cdlib_canvas_meta[] = {
 
   /* Other */
   {"Play"             , cdlua5_play},
+  {"PlayTolerance"    , cdlua5_playtolerance},
 
   /* Color Coding */
   {"GetColorPlanes" , cdlua5_getcolorplanes},
@@ -26,6 +26,7 @@
 #include "cdsvg.h"
 #include "cddbuf.h"
 #include "cddebug.h"
+#include "cdprofile.h"
 #include "cdpicture.h"
 
 
@@ -661,6 +662,24 @@ static cdluaContext cdluadebugctx =
   0
 };
 
+/***************************************************************************\
+* CD_PROFILE.                                                              *
+\***************************************************************************/
+static void *cdprofile_checkdata(lua_State *L,int param)
+{
+  return cdlua_checkcanvas(L,param);
+}
+
+static cdluaContext cdluaprofilectx = 
+{
+  0,
+  "PROFILE",
+  cdContextProfile,
+  cdprofile_checkdata,
+  NULL,
+  0
+};
+
 /***************************************************************************\
 * CD_METAFILE.                                                              *
 \***************************************************************************/
@@ -824,6 +843,7 @@ void cdlua_initdrivers(lua_State * L, cdluaLuaState* cdL)
   cdlua_addcontext(L, cdL, &cdluacgmctx);
   cdlua_addcontext(L, cdL, &cdluamfctx);
   cdlua_addcontext(L, cdL, &cdluadebugctx);
+  cdlua_addcontext(L, cdL, &cdluaprofilectx);
   cdlua_addcontext(L, cdL, &cdluapicturectx);
   cdlua_addcontext(L, cdL, &cdluapsctx);
   cdlua_addcontext(L, cdL, &cdluasvgctx);
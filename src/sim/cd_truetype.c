@@ -12,40 +12,224 @@
 #include "cd.h"
 #include "cd_private.h"
 #include "cd_truetype.h"
+#include FT_SIZES_H
+
+/*******************************************
+           Shared Faces
+********************************************/
+
+/* All canvases share the same FreeType library and the same face for each 
+   font file, each canvas has its own FT_Size. FreeType objects are not thread safe, 
+   so they are used only inside cdFontLock/cdFontUnlock. 
+   Faces not used by any canvas are kept open, up to CDTT_MAX_UNUSED_FACES, 
+   so switching between fonts does not parse the font file again. */
+
+typedef struct _cdTT_Face
+{
+  char* filename;
+  unsigned long hash;        /* of the filename, compared before the filename */
+  FT_Face face;
+  int ref_count;
+  struct _cdTT_Face* next;   /* most recently used first */
+} cdTT_Face;
+
+#define CDTT_MAX_UNUSED_FACES 16
+
+static FT_Library cdtt_library = NULL;
+static int cdtt_library_ref_count = 0;
+static cdTT_Face* cdtt_faces = NULL;
+
+static unsigned long cdTT_hashName(const char *filename)
+{
+  unsigned long hash = 5381;
+  while (*filename)
+    hash = hash * 33 + (unsigned char)*filename++;
+  return hash;
+}
+
+/* must be called inside cdFontLock */
+static void cdTT_trimFaces(int max_unused)
+{
+  cdTT_Face **link = &cdtt_faces, *face;
+  int unused = 0;
+
+  while (*link)
+  {
+    face = *link;
+    if (face->ref_count == 0 && ++unused > max_unused)
+    {
+      *link = face->next;
+      FT_Done_Face(face->face);
+      free(face->filename);
+      free(face);
+    }
+    else
+      link = &face->next;
+  }
+}
+
+/* must be called inside cdFontLock */
+static cdTT_Face* cdTT_getFace(const char *filename, unsigned long hash)
+{
+  cdTT_Face **link = &cdtt_faces, *face;
+  FT_Face ft_face;
+
+  while (*link)
+  {
+    face = *link;
+    if (face->hash == hash && strcmp(face->filename, filename) == 0)
+    {
+      /* move to the start of the list */
+      *link = face->next;
+      face->next = cdtt_faces;
+      cdtt_faces = face;
+      face->ref_count++;
+      return face;
+    }
+    link = &face->next;
+  }
+
+  if (FT_New_Face(cdtt_library, filename, 0, &ft_face))
+    return NULL;
+
+  if (!ft_face->charmap && ft_face->num_charmaps)
+    FT_Set_Charmap(ft_face, ft_face->charmaps[0]);
+
+  face = malloc(sizeof(cdTT_Face));
+  if (face)
+    face->filename = cdStrDup(filename);
+  if (!face || !face->filename)
+  {
+    if (face) free(face);
+    FT_Done_Face(ft_face);
+    return NULL;
+  }
+  face->hash = hash;
+  face->face = ft_face;
+  face->ref_count = 1;
+  face->next = cdtt_faces;
+  cdtt_faces = face;
+  return face;
+}
+
+/* must be called inside cdFontLock */
+static void cdTT_releaseFace(cdTT_Face* face)
+{
+  face->ref_count--;
+  cdTT_trimFaces(CDTT_MAX_UNUSED_FACES);
+}
 
 /*******************************************
         Inicializa o Rasterizador
 ********************************************/
 
+#define cdTT_matchFontId(_font_id, _filename, _hash, _size, _xres, _yres) \
+  ((_font_id)->hash == (_hash) && (_font_id)->size == (_size) &&       \
+   (_font_id)->xres == (_xres) && (_font_id)->yres == (_yres) &&       \
+   strcmp((_font_id)->filename, (_filename)) == 0)
+
+/* returns 0 if failed */
+static int cdTT_getFontId(cdTT_Text * tt_text, const char *filename, unsigned long hash, int size, double xres, double yres)
+{
+  cdTT_FontId* font_id = tt_text->font_id_last;
+  int id;
+
+  /* usually the same font is selected again */
+  if (font_id && cdTT_matchFontId(font_id, filename, hash, size, xres, yres))
+    return font_id->id;
+
+  font_id = tt_text->font_ids;
+  id = font_id? font_id->id + 1: 1;  /* the first has the highest id */
+
+  while (font_id)
+  {
+    if (cdTT_matchFontId(font_id, filename, hash, size, xres, yres))
+    {
+      tt_text->font_id_last = font_id;
+      return font_id->id;
+    }
+
+    font_id = font_id->next;
+  }
+
+  font_id = malloc(sizeof(cdTT_FontId));
+  if (font_id)
+    font_id->filename = cdStrDup(filename);
+  if (!font_id || !font_id->filename)
+  {
+    if (font_id) free(font_id);
+    return 0;
+  }
+  font_id->hash = hash;
+  font_id->size = size;
+  font_id->xres = xres;
+  font_id->yres = yres;
+  font_id->id = id;
+  font_id->next = tt_text->font_ids;
+  tt_text->font_ids = font_id;
+  tt_text->font_id_last = font_id;
+
+  return id;
+}
+
 int cdTT_load(cdTT_Text * tt_text, const char *filename, int size, double xres, double yres)
 {
   FT_Error error;
-  FT_Face face;          
+  FT_Size ft_size = NULL;
+  cdTT_Face* face;
+  unsigned long hash = cdTT_hashName(filename);
+  int font_id = cdTT_getFontId(tt_text, filename, hash, size, xres, yres);
 
-  error = FT_New_Face(tt_text->library, filename, 0, &face );
-  if (error) 
+  if (!font_id)
     return 0;
 
-  /* char_height is 1/64th of points */
-  error = FT_Set_Char_Size(face, 0, size*64, (int)(xres*25.4), (int)(yres*25.4));  
+  /* the same font is already loaded */
+  if (tt_text->face && tt_text->font_id == font_id)
+    return 1;
+
+  cdFontLock();
+
+  face = cdTT_getFace(filename, hash);
+  if (!face) 
+  {
+    cdFontUnlock();
+    return 0;
+  }
+
+  error = FT_New_Size(face->face, &ft_size);
+  if (!error)
+  {
+    FT_Activate_Size(ft_size);
+
+    /* char_height is 1/64th of points */
+    error = FT_Set_Char_Size(face->face, 0, size*64, (int)(xres*25.4), (int)(yres*25.4));  
+  }
+
   if (error) 
   {
-    FT_Done_Face(face);
+    if (ft_size) FT_Done_Size(ft_size);
+    cdTT_releaseFace(face);
+    cdFontUnlock();
     return 0;
   }
 
-  if (tt_text->face && tt_text->face != face)
-    FT_Done_Face(tt_text->face);
+  if (tt_text->ft_size)
+    FT_Done_Size(tt_text->ft_size);
+  if (tt_text->shared_face)
+    cdTT_releaseFace(tt_text->shared_face);
 
-  tt_text->face = face;
+  tt_text->shared_face = face;
+  tt_text->ft_size = ft_size;
+  tt_text->face = face->face;
 
-  tt_text->ascent     =  face->size->metrics.ascender >> 6;
-  tt_text->descent    =  abs(face->size->metrics.descender >> 6);
-  tt_text->max_height =  face->size->metrics.height >> 6;
-  tt_text->max_width  =  face->size->metrics.max_advance >> 6;
+  tt_text->ascent     =  ft_size->metrics.ascender >> 6;
+  tt_text->descent    =  abs(ft_size->metrics.descender >> 6);
+  tt_text->max_height =  ft_size->metrics.height >> 6;
+  tt_text->max_width  =  ft_size->metrics.max_advance >> 6;
 
-  if (!face->charmap)
-    FT_Set_Charmap(face, face->charmaps[0]);
+  cdFontUnlock();
+
+  tt_text->font_id = font_id;
 
   return 1;
 }
@@ -64,6 +248,243 @@ static void cdTT_checkversion(cdTT_Text* tt_text)
   }
 }
 
+/*******************************************
+               Glyph Cache
+********************************************/
+
+/* Rendered glyphs are cached by font, character, transformation and 
+   fractional pen position. The bitmap is stored relative to the integer 
+   pen position, so the same glyph drawn at another pixel is a cache hit. 
+   The FTC_SBitCache of FreeType is not used because its key has no 
+   transformation (FT_Set_Transform must not be called on its faces) 
+   and no pen position, and because FTC_SBitRec stores sizes and 
+   advances in 8 bits, so large or rotated text would not be cached. */
+
+static unsigned int cdTT_glyphHash(int font_id, unsigned long charcode, const FT_Matrix* matrix, int frac_x, int frac_y)
+{
+  unsigned int h = (unsigned int)font_id * 31u + (unsigned int)charcode;
+  h = h * 31u + (unsigned int)matrix->xx;
+  h = h * 31u + (unsigned int)matrix->xy;
+  h = h * 31u + (unsigned int)matrix->yx;
+  h = h * 31u + (unsigned int)matrix->yy;
+  h = h * 31u + (unsigned int)(frac_x * 64 + frac_y);
+  return h % CDTT_GLYPH_HASH_SIZE;
+}
+
+static void cdTT_lruRemove(cdTT_Text* tt_text, cdTT_Glyph* glyph)
+{
+  if (glyph->lru_prev) glyph->lru_prev->lru_next = glyph->lru_next;
+  else tt_text->lru_first = glyph->lru_next;
+  if (glyph->lru_next) glyph->lru_next->lru_prev = glyph->lru_prev;
+  else tt_text->lru_last = glyph->lru_prev;
+}
+
+static void cdTT_lruInsertFirst(cdTT_Text* tt_text, cdTT_Glyph* glyph)
+{
+  glyph->lru_prev = NULL;
+  glyph->lru_next = tt_text->lru_first;
+  if (tt_text->lru_first) tt_text->lru_first->lru_prev = glyph;
+  else tt_text->lru_last = glyph;
+  tt_text->lru_first = glyph;
+}
+
+static void cdTT_freeGlyph(cdTT_Text* tt_text, cdTT_Glyph* glyph)
+{
+  cdTT_Glyph** link = tt_text->glyph_hash + cdTT_glyphHash(glyph->font_id, glyph->charcode, &glyph->matrix, glyph->frac_x, glyph->frac_y);
+  while (*link != glyph)
+    link = &(*link)->hash_next;
+  *link = glyph->hash_next;
+
+  cdTT_lruRemove(tt_text, glyph);
+  tt_text->glyph_cache_used -= glyph->mem_size;
+  tt_text->glyph_count--;
+
+  if (glyph->bitmap.buffer) free(glyph->bitmap.buffer);
+  free(glyph);
+}
+
+/* removes the least recently used glyphs until the cache has room for size bytes */
+static void cdTT_trimGlyphCache(cdTT_Text* tt_text, int size)
+{
+  while (tt_text->lru_last && tt_text->glyph_cache_used + size > tt_text->glyph_cache_max)
+    cdTT_freeGlyph(tt_text, tt_text->lru_last);
+}
+
+void cdTT_setGlyphCacheSize(cdTT_Text* tt_text, int max_size)
+{
+  if (max_size < 0)
+    max_size = 0;
+  tt_text->glyph_cache_max = max_size;
+  cdTT_trimGlyphCache(tt_text, 0);
+}
+
+/* copies the bitmap of the glyph slot to the glyph, returns the allocated size */
+static int cdTT_copyBitmap(cdTT_Glyph* glyph, FT_GlyphSlot slot)
+{
+  FT_Bitmap* bitmap = &slot->bitmap;
+  int i, width = bitmap->width, rows = bitmap->rows, size = width*rows;
+  unsigned char* buffer = glyph->bitmap.buffer;
+
+  if (size)
+  {
+    unsigned char* new_buffer = realloc(buffer, size);
+    if (new_buffer)
+      buffer = new_buffer;
+    else
+    {
+      size = 0;
+      rows = 0;
+      width = 0;
+    }
+  }
+
+  for (i = 0; i < rows; i++)
+  {
+    if (bitmap->pitch < 0)  /* bottom up */
+      memcpy(buffer + i*width, bitmap->buffer + (rows-1-i)*(-bitmap->pitch), width);
+    else
+      memcpy(buffer + i*width, bitmap->buffer + i*bitmap->pitch, width);
+  }
+
+  glyph->bitmap = *bitmap;
+  glyph->bitmap.buffer = buffer;
+  glyph->bitmap.width = width;
+  glyph->bitmap.rows = rows;
+  glyph->bitmap.pitch = width;
+  glyph->left = slot->bitmap_left;
+  glyph->top = slot->bitmap_top;
+  return size;
+}
+
+/* Returns the glyph of the character in the current face, with the transformation (can be NULL)
+   and at the pen position (can be NULL). If render is 0 only the advance is valid.
+   The glyph is valid until the next call. Returns NULL if the glyph could not be loaded. */
+const cdTT_Glyph* cdTT_getGlyph(cdTT_Text* tt_text, unsigned long charcode, const FT_Matrix* matrix, const FT_Vector* pen, int render)
+{
+  static const FT_Matrix identity = {0x10000L, 0, 0, 0x10000L};
+  cdTT_Glyph* glyph;
+  FT_Vector delta;
+  FT_Matrix load_matrix;
+  unsigned int hash;
+  int frac_x = 0, frac_y = 0, bitmap_size;
+
+  if (!tt_text->face)
+    return NULL;
+
+  if (!matrix)
+    matrix = &identity;
+
+  if (pen)
+  {
+    /* same as pen % 64, but always positive */
+    frac_x = (int)(pen->x & 63);
+    frac_y = (int)(pen->y & 63);
+  }
+
+  hash = cdTT_glyphHash(tt_text->font_id, charcode, matrix, frac_x, frac_y);
+
+  for (glyph = tt_text->glyph_hash[hash]; glyph; glyph = glyph->hash_next)
+  {
+    if (glyph->font_id == tt_text->font_id && glyph->charcode == charcode && 
+        glyph->frac_x == frac_x && glyph->frac_y == frac_y && 
+        glyph->matrix.xx == matrix->xx && glyph->matrix.xy == matrix->xy && 
+        glyph->matrix.yx == matrix->yx && glyph->matrix.yy == matrix->yy)
+      break;
+  }
+
+  if (glyph && (glyph->rendered || !render))
+  {
+    tt_text->glyph_hits++;
+    cdTT_lruRemove(tt_text, glyph);
+    cdTT_lruInsertFirst(tt_text, glyph);
+    return glyph;
+  }
+
+  tt_text->glyph_misses++;
+
+  /* the face is shared, the size and the transformation must be always set */
+  cdFontLock();
+  FT_Activate_Size(tt_text->ft_size);
+
+  /* load the glyph at the fractional position, 
+     the integer part is added by the caller */
+  load_matrix = *matrix;
+  delta.x = frac_x;
+  delta.y = frac_y;
+  FT_Set_Transform(tt_text->face, &load_matrix, &delta);
+
+  if (FT_Load_Char(tt_text->face, charcode, render? FT_LOAD_RENDER: FT_LOAD_DEFAULT))
+  {
+    cdFontUnlock();
+    return NULL;
+  }
+
+  if (glyph)
+  {
+    /* only the advance was cached, now also the bitmap */
+    bitmap_size = tt_text->face->glyph->bitmap.width * tt_text->face->glyph->bitmap.rows;
+    cdTT_lruRemove(tt_text, glyph);
+    tt_text->glyph_cache_used -= glyph->mem_size;
+    cdTT_trimGlyphCache(tt_text, glyph->mem_size + bitmap_size);
+    bitmap_size = cdTT_copyBitmap(glyph, tt_text->face->glyph);
+    glyph->rendered = 1;
+    glyph->mem_size += bitmap_size;
+    tt_text->glyph_cache_used += glyph->mem_size;
+    cdTT_lruInsertFirst(tt_text, glyph);
+    cdFontUnlock();
+    return glyph;
+  }
+
+  bitmap_size = render? tt_text->face->glyph->bitmap.width * tt_text->face->glyph->bitmap.rows: 0;
+
+  if ((int)sizeof(cdTT_Glyph) + bitmap_size > tt_text->glyph_cache_max)
+  {
+    /* does not fit in the cache */
+    glyph = &tt_text->glyph_tmp;
+  }
+  else
+  {
+    cdTT_trimGlyphCache(tt_text, (int)sizeof(cdTT_Glyph) + bitmap_size);
+
+    glyph = calloc(1, sizeof(cdTT_Glyph));
+    if (!glyph)
+      glyph = &tt_text->glyph_tmp;
+  }
+
+  glyph->font_id = tt_text->font_id;
+  glyph->charcode = charcode;
+  glyph->matrix = *matrix;
+  glyph->frac_x = frac_x;
+  glyph->frac_y = frac_y;
+  glyph->rendered = render;
+  glyph->advance = tt_text->face->glyph->advance;
+
+  if (render)
+    bitmap_size = cdTT_copyBitmap(glyph, tt_text->face->glyph);
+  else
+  {
+    glyph->left = 0;
+    glyph->top = 0;
+    glyph->bitmap.width = 0;
+    glyph->bitmap.rows = 0;
+    glyph->bitmap.pitch = 0;
+  }
+
+  cdFontUnlock();
+
+  if (glyph != &tt_text->glyph_tmp)
+  {
+    glyph->mem_size = (int)sizeof(cdTT_Glyph) + bitmap_size;
+    glyph->hash_next = tt_text->glyph_hash[hash];
+    tt_text->glyph_hash[hash] = glyph;
+    cdTT_lruInsertFirst(tt_text, glyph);
+    tt_text->glyph_cache_used += glyph->mem_size;
+    tt_text->glyph_count++;
+  }
+
+  return glyph;
+}
+
 /*******************************************
               Inicializaccao 
 ********************************************/
@@ -73,13 +494,20 @@ cdTT_Text* cdTT_create(void)
   cdTT_Text * tt_text = malloc(sizeof(cdTT_Text));
   memset(tt_text, 0, sizeof(cdTT_Text));
   
-  FT_Init_FreeType(&tt_text->library);
+  cdFontLock();
+  if (!cdtt_library)
+    FT_Init_FreeType(&cdtt_library);
+  cdtt_library_ref_count++;
+  tt_text->library = cdtt_library;
 
   if (first)
   {
     cdTT_checkversion(tt_text);
     first = 0;
   }
+  cdFontUnlock();
+
+  tt_text->glyph_cache_max = CDTT_GLYPH_CACHE_SIZE;
 
   return tt_text;
 }
@@ -92,10 +520,35 @@ void cdTT_free(cdTT_Text * tt_text)
   if (tt_text->rgba_data)
     free(tt_text->rgba_data);
 
-  if (tt_text->face)
-    FT_Done_Face(tt_text->face);
+  while (tt_text->lru_first)
+    cdTT_freeGlyph(tt_text, tt_text->lru_first);
+  if (tt_text->glyph_tmp.bitmap.buffer)
+    free(tt_text->glyph_tmp.bitmap.buffer);
+
+  while (tt_text->font_ids)
+  {
+    cdTT_FontId* next = tt_text->font_ids->next;
+    free(tt_text->font_ids->filename);
+    free(tt_text->font_ids);
+    tt_text->font_ids = next;
+  }
+
+  cdFontLock();
+
+  if (tt_text->ft_size)
+    FT_Done_Size(tt_text->ft_size);
+  if (tt_text->shared_face)
+    cdTT_releaseFace(tt_text->shared_face);
+
+  cdtt_library_ref_count--;
+  if (cdtt_library_ref_count == 0)
+  {
+    cdTT_trimFaces(0);
+    FT_Done_FreeType(cdtt_library);
+    cdtt_library = NULL;
+  }
 
-  FT_Done_FreeType(tt_text->library);
+  cdFontUnlock();
 
   free(tt_text);
 }
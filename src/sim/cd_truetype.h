@@ -19,13 +19,64 @@ extern "C" {
    Only TrueType font support is enabled.
 */
 
+/* a glyph stored in the glyph cache of a cdTT_Text */
+typedef struct _cdTT_Glyph
+{
+  FT_Bitmap bitmap;      /* coverage map, top down, pitch equal to width, empty when not rendered */
+  int left, top;         /* bitmap_left and bitmap_top relative to the integer part of the pen position */
+  FT_Vector advance;     /* transformed advance, 26.6 */
+
+  /* cache key */
+  int font_id;
+  unsigned long charcode;
+  FT_Matrix matrix;
+  int frac_x, frac_y;    /* fractional part of the pen position, 26.6 */
+  int rendered;
+
+  struct _cdTT_Glyph *hash_next, *lru_prev, *lru_next;
+  int mem_size;
+} cdTT_Glyph;
+
+/* identifies a loaded face and size, used as the glyph cache key */
+typedef struct _cdTT_FontId
+{
+  char* filename;
+  unsigned long hash;    /* of the filename */
+  int size;
+  double xres, yres;
+  int id;
+  struct _cdTT_FontId* next;
+} cdTT_FontId;
+
+/* integer part of a 26.6 position, rounded down */
+#define CDTT_PIXEL(_pos) ((int)(((_pos) - ((_pos) & 63)) / 64))
+
+#define CDTT_GLYPH_HASH_SIZE 1024
+#define CDTT_GLYPH_CACHE_SIZE (2*1024*1024)   /* default memory budget, in bytes */
+
 typedef struct _cdTT_Text
 {
-  FT_Library library;
-  FT_Face face;          
+  FT_Library library;    /* shared by all canvases */
+  FT_Face face;          /* shared by all canvases that use the same font file */
+  FT_Size ft_size;       /* size of this canvas */
+  struct _cdTT_Face* shared_face;
+
+  int font_id;               /* id of the current face and size */
+  cdTT_FontId* font_ids;
+  cdTT_FontId* font_id_last; /* last one found, checked first */
+
+  /* glyph cache */
+  cdTT_Glyph* glyph_hash[CDTT_GLYPH_HASH_SIZE];
+  cdTT_Glyph *lru_first, *lru_last;  /* most recently used first */
+  cdTT_Glyph glyph_tmp;              /* used when the glyph does not fit the cache */
+  int glyph_cache_max, glyph_cache_used, glyph_count;
+  unsigned long glyph_hits, glyph_misses;
 
-  unsigned char* rgba_data;   /* the image where one character is drawn with the foreground color during text output */
+  unsigned char* rgba_data;   /* the image where one character is drawn with the foreground color during text output, 
+                                 4 planes of rgba_data_size/4 bytes */
   int rgba_data_size;
+  long rgba_color;            /* color of the RGB planes, valid if rgba_color_set */
+  int rgba_color_set;
 
   int max_height;
   int max_width;
@@ -37,6 +88,8 @@ typedef struct _cdTT_Text
 cdTT_Text* cdTT_create(void);
 void cdTT_free(cdTT_Text * tt_text);
 int cdTT_load(cdTT_Text * tt_text, const char *filename, int size, double xres, double yres);
+const cdTT_Glyph* cdTT_getGlyph(cdTT_Text* tt_text, unsigned long charcode, const FT_Matrix* matrix, const FT_Vector* pen, int render);
+void cdTT_setGlyphCacheSize(cdTT_Text* tt_text, int max_size);
 
 #ifdef __cplusplus
 }
@@ -111,7 +111,59 @@ void simFillHorizBox(cdSimulation* simulation, int xmin, int xmax, int ymin, int
 {
   int y;
   for(y=ymin;y<=ymax;y++)
-    simFillHorizLine(simulation, xmin, y, xmax);
+    simFillAddSpan(simulation, xmin, y, xmax, 255);
+  simFillFlushSpans(simulation);
+}
+
+void simFillSpans(cdSimulation* simulation, const cdSpan* spans, int n)
+{
+  /* default span drawing, one horizontal line or one pixel at a time */
+  int i, x;
+  for (i = 0; i < n; i++, spans++)
+  {
+    if (spans->coverage == 255)
+      simFillHorizLine(simulation, spans->xmin, spans->y, spans->xmax);
+    else
+    {
+      for (x = spans->xmin; x <= spans->xmax; x++)
+        simFillDrawAAPixel(simulation->canvas, x, spans->y, spans->coverage);
+    }
+  }
+}
+
+void simFillFlushSpans(cdSimulation* simulation)
+{
+  cdCanvas* canvas = simulation->canvas;
+
+  if (!simulation->spans_n)
+    return;
+
+  if (canvas->cxSpans)
+    canvas->cxSpans(canvas->ctxcanvas, simulation->spans, simulation->spans_n);
+  else
+    simFillSpans(simulation, simulation->spans, simulation->spans_n);
+
+  simulation->spans_n = 0;
+}
+
+void simFillAddSpan(cdSimulation* simulation, int xmin, int y, int xmax, unsigned char coverage)
+{
+  cdSpan* span;
+
+  if (!simulation->spans)
+    simulation->spans = (cdSpan*)malloc(SIM_SPANS_SIZE*sizeof(cdSpan));
+  else if (simulation->spans_n == SIM_SPANS_SIZE)
+    simFillFlushSpans(simulation);
+
+  if (xmin > xmax)
+    _cdSwapInt(xmin, xmax);
+
+  span = simulation->spans + simulation->spans_n;
+  span->y = y;
+  span->xmin = xmin;
+  span->xmax = xmax;
+  span->coverage = coverage;
+  simulation->spans_n++;
 }
 
 static void simSolidLine(cdCanvas* canvas, int xmin, int y, int xmax, long color)
@@ -317,6 +369,7 @@ cdSimulation* cdCreateSimulation(cdCanvas* canvas)
 void cdKillSimulation(cdSimulation* simulation)
 {
   if (simulation->tt_text) cdTT_free(simulation->tt_text);
+  if (simulation->spans) free(simulation->spans);
 
   memset(simulation, 0, sizeof(cdSimulation));
   free(simulation);
@@ -24,13 +24,22 @@ struct _cdSimulation
   void (*PatternLine)(cdCanvas* canvas, int xmin, int xmax, int y, int pw, const long *pattern);
   void (*StippleLine)(cdCanvas* canvas, int xmin, int xmax, int y, int pw, const unsigned char *stipple);
   void (*HatchLine)(cdCanvas* canvas, int xmin, int xmax, int y, unsigned char hatch);
+
+  /* spans of the current filled primitive, sent to the driver in batches */
+  cdSpan* spans;
+  int spans_n;
 };
 
+#define SIM_SPANS_SIZE 1024
+
 #define simRotateHatchN(_x,_n) ((_x) = ((_x) << (_n)) | ((_x) >> (8-(_n))))
 
 void simFillDrawAAPixel(cdCanvas *canvas, int x, int y, unsigned short alpha_weight);
 void simFillHorizLine(cdSimulation* simulation, int xmin, int y, int xmax);
 void simFillHorizBox(cdSimulation* simulation, int xmin, int xmax, int ymin, int ymax);
+void simFillSpans(cdSimulation* simulation, const cdSpan* spans, int n);
+void simFillAddSpan(cdSimulation* simulation, int xmin, int y, int xmax, unsigned char coverage);
+void simFillFlushSpans(cdSimulation* simulation);
 void simGetPenPos(cdCanvas* canvas, int x, int y, const char* s, int len, FT_Matrix *matrix, FT_Vector *pen);
 int simIsPointInPolyWind(cdPoint* poly, int n, int x, int y);
 
@@ -50,6 +59,30 @@ int simSegmentInc(simLineSegment* segment);
 int simPolyFindHorizontalIntervals(simLineSegment *segments, int n_seg, int* xx, int *hh, int y, int height);
 void simPolyMakeSegments(simLineSegment *segments, int *n_seg, cdPoint* poly, int n, int *max_hh, int *y_max, int *y_min);
 
+/* active edge table for the scanline polygon fill */
+typedef struct _simEdgeTable
+{
+  simLineSegment *segments;
+  int n_seg;
+  int* sorted;    /* segment indices sorted by decreasing y2 */
+  int next;       /* next segment in sorted to be included in the active list */
+  int* active;    /* segment indices that cross the current line, sorted by x */
+  int* active_x;  /* last intersection of each active segment */
+  int active_n;
+  int* horiz;     /* horizontal segments in the current line */
+  int* wind_x;    /* first x at the right of each crossing in the current line, sorted */
+  int* wind_dir;  /* direction of each crossing, +1 upward, -1 downward */
+  int wind_n;     /* number of crossings, -1 if not computed for the current line */
+  int wind_k;     /* crossings already at the left of the last point */
+  int wind_wn;    /* winding number of the last point */
+  int wind_last;  /* x of the last point */
+} simEdgeTable;
+
+void simEdgeTableInit(simEdgeTable* et, simLineSegment *segments, int n_seg);
+void simEdgeTableFree(simEdgeTable* et);
+int simEdgeTableFindHorizontalIntervals(simEdgeTable* et, int* xx, int *hh, int y, int height);
+int simEdgeTableIsPointInPolyWind(simEdgeTable* et, int x, int y);
+
 void simPolyFill(cdSimulation* simulation, cdPoint* poly, int n);
 void simLineThin(cdCanvas* canvas, int x1, int y1, int x2, int y2);
 void simLineThick(cdCanvas* canvas, int x1, int y1, int x2, int y2);
@@ -285,21 +285,21 @@ static void simPolyAAPixels(cdCanvas *canvas, simIntervalList* line_int_list, in
         if (Weighting < 128)
         {
           if (simFillCheckAAPixel(line_int_list+(y1-y_min), x1))
-            simFillDrawAAPixel(canvas, x1, y1, 255);
+            simFillAddSpan(canvas->simulation, x1, y1, x1, 255);
         }
         else
         {
           if (simFillCheckAAPixel(line_int_list+(y1-y_min), x1 + XDir))
-            simFillDrawAAPixel(canvas, x1 + XDir, y1, 255);
+            simFillAddSpan(canvas->simulation, x1 + XDir, y1, x1 + XDir, 255);
         }
       }
       else
       {
         if (simFillCheckAAPixel(line_int_list+(y1-y_min), x1))
-          simFillDrawAAPixel(canvas, x1, y1, 255-Weighting);
+          simFillAddSpan(canvas->simulation, x1, y1, x1, (unsigned char)(255-Weighting));
 
         if (simFillCheckAAPixel(line_int_list+(y1-y_min), x1 + XDir))
-          simFillDrawAAPixel(canvas, x1 + XDir, y1, Weighting);
+          simFillAddSpan(canvas->simulation, x1 + XDir, y1, x1 + XDir, (unsigned char)Weighting);
       }
     }
   }
@@ -326,25 +326,25 @@ static void simPolyAAPixels(cdCanvas *canvas, simIntervalList* line_int_list, in
         if (Weighting < 128)
         {
           if (simFillCheckAAPixel(line_int_list+(y1-y_min), x1))
-            simFillDrawAAPixel(canvas, x1, y1, 255);
+            simFillAddSpan(canvas->simulation, x1, y1, x1, 255);
         }
         else
         {
           if (y1+1 < y_min || y1+1 > y_max) continue;
 
           if (simFillCheckAAPixel(line_int_list+(y1+1-y_min), x1))
-            simFillDrawAAPixel(canvas, x1, y1+1, 255);
+            simFillAddSpan(canvas->simulation, x1, y1+1, x1, 255);
         }
       }
       else
       {
         if (simFillCheckAAPixel(line_int_list+(y1-y_min), x1))
-          simFillDrawAAPixel(canvas, x1, y1, 255-Weighting);
+          simFillAddSpan(canvas->simulation, x1, y1, x1, (unsigned char)(255-Weighting));
 
         if (y1+1 < y_min || y1+1 > y_max) continue;
 
         if (simFillCheckAAPixel(line_int_list+(y1+1-y_min), x1))
-          simFillDrawAAPixel(canvas, x1, y1+1, Weighting);
+          simFillAddSpan(canvas->simulation, x1, y1+1, x1, (unsigned char)Weighting);
       }
     }
   }
@@ -446,6 +446,118 @@ static void simMergeHxx(int *xx, int *xx_count, int *hh, int hh_count)
   }
 }
 
+static int simPolyAddHorizontalRun(simLineSegment *segments, int n_seg, int i, int* xx, int *xx_count, int *hh, int *hh_count, int y)
+{
+  /* Add the horizontal segment i, and the horizontal segments that follow it in a sequence.
+     Returns the index of the last segment of the sequence, or n_seg if the sequence reached the end. */
+  simLineSegment *seg_i = segments + i;
+  int prev_y, next_y;
+  int i_next = (i==n_seg-1)? 0: i+1;
+  int i_prev = (i==0)? n_seg-1: i-1;
+  simLineSegment *seg_i_next = segments + i_next;
+  simLineSegment *seg_i_prev = segments + i_prev;
+
+  simAddHxx(hh, hh_count, seg_i->x1, seg_i->x2);
+
+  /* include horizontal segments that are in a sequence */
+  while (seg_i_next->y1 == seg_i_next->y2 && i < n_seg)
+  {
+    simAddHxx(hh, hh_count, seg_i_next->x1, seg_i_next->x2);
+
+    i++;
+
+    if (i < n_seg)
+    {
+      i_next = (i==n_seg-1)? 0: i+1;
+      seg_i_next = segments + i_next;
+    }
+  }
+
+  if (i == n_seg)
+    return i;
+
+  if (i_prev == n_seg-1)
+  {
+    /* if at the first segment, find the previous segment that 
+       is not an horizontal line */
+    while (seg_i_prev->y1 == seg_i_prev->y2 && i_prev > 0)
+    {
+      i_prev--;
+      seg_i_prev = segments + i_prev;
+    }
+  }
+
+  /* save the previous y, not in current the horizontal line */
+  if (seg_i_prev->y1 == y)
+    prev_y = seg_i_prev->y2;
+  else
+    prev_y = seg_i_prev->y1;
+
+  /* save the next y, not in the current horizontal line */
+  if (seg_i_next->y1 == y)
+    next_y = seg_i_next->y2;
+  else
+    next_y = seg_i_next->y1;
+
+  /* if the horizontal line is part of a step  \_  then add one virtual intersection in the middle */
+  /*                                             \                                                  */
+  if ((next_y > y && prev_y < y) ||
+      (next_y < y && prev_y > y))
+  {
+    xx[(*xx_count)++] = (seg_i->x1+seg_i->x2)/2;     /* save the intersection point, any value inside the segment will be fine */
+  }
+
+  return i;
+}
+
+static int simPolyFindIntersection(simLineSegment *segments, int n_seg, int i, int y, int *x)
+{
+  /* Find the intersection of the non horizontal segment i with the horizontal line y.
+     Returns 0 if the intersection must not be added. */
+  simLineSegment *seg_i = segments + i;
+
+  if (y == seg_i->y1)  /* intersection at the lowest point (x1,y1) */
+  {
+    int i_next = (i==n_seg-1)? 0: i+1;
+    int i_prev = (i==0)? n_seg-1: i-1;
+    simLineSegment *seg_i_next = segments + i_next;
+    simLineSegment *seg_i_prev = segments + i_prev;
+
+    /* but add only if it does not belongs to an horizontal line */
+    if (!((seg_i_next->y1 == y && seg_i_next->y2 == y) ||   /* next is an horizontal line */
+          (seg_i_prev->y1 == y && seg_i_prev->y2 == y)))    /* previous is an horizontal line */
+    {
+      *x = seg_i->x1;     /* save the intersection point */
+      return 1;
+    }
+  }
+  else if (y == seg_i->y2)  /* intersection at the highest point (x2,y2) */
+  {
+    int i_next = (i==n_seg-1)? 0: i+1;
+    int i_prev = (i==0)? n_seg-1: i-1;
+    simLineSegment *seg_i_next = segments + i_next;
+    simLineSegment *seg_i_prev = segments + i_prev;
+
+    /* Normally do nothing, because this point is duplicated in another segment,    
+       i.e only save the intersection point for (y2) if not handled by (y1) of another segment.   
+       The exception is the top-corner points (^). */
+    /* first find if p2 is connected to next or previous */
+    if ((!seg_i->Swap && seg_i_next->Swap && seg_i_next->y2 == y && seg_i_next->x2 == seg_i->x2 && seg_i_next->y1 != y) || 
+        (seg_i->Swap && !seg_i_prev->Swap && seg_i_prev->y2 == y && seg_i_prev->x2 == seg_i->x2 && seg_i_prev->y1 != y))
+    {
+      *x = seg_i->x2;     /* save the intersection point */
+      return 1;
+    }
+  }
+  else /* if ((y > seg_i->y1) && (y < seg_i->y2))  intersection inside the segment  */
+  {                                             
+    *x = simSegmentInc(seg_i);  /* save the intersection point */
+    return 1;
+  }
+
+  return 0;
+}
+
 int simPolyFindHorizontalIntervals(simLineSegment *segments, int n_seg, int* xx, int *hh, int y, int height)
 {
   simLineSegment *seg_i;
@@ -468,96 +580,189 @@ int simPolyFindHorizontalIntervals(simLineSegment *segments, int n_seg, int* xx,
     /* if it is an horizontal line, then store the segment in a separate buffer. */
     if (seg_i->y1 == seg_i->y2)  /* because of the previous test, also implies "==y" */
     {
-      int prev_y, next_y;
-      int i_next = (i==n_seg-1)? 0: i+1;
-      int i_prev = (i==0)? n_seg-1: i-1;
-      simLineSegment *seg_i_next = segments + i_next;
-      simLineSegment *seg_i_prev = segments + i_prev;
+      i = simPolyAddHorizontalRun(segments, n_seg, i, xx, &xx_count, hh, &hh_count, y);
+      if (i == n_seg)
+        break;
+    }
+    else if (simPolyFindIntersection(segments, n_seg, i, y, xx + xx_count))
+      xx_count++;
+  }
 
-      simAddHxx(hh, &hh_count, seg_i->x1, seg_i->x2);
+  /* if outside the canvas, ignore the intervals and */
+  /* continue since the segments where updated in simSegmentInc. */
+  if (y > height-1)
+    return 0;
 
-      /* include horizontal segments that are in a sequence */
-      while (seg_i_next->y1 == seg_i_next->y2 && i < n_seg)
-      {
-        simAddHxx(hh, &hh_count, seg_i_next->x1, seg_i_next->x2);
+  /* sort the intervals */
+  if (xx_count)
+    qsort(xx, xx_count, sizeof(int), (int (*)(const void*,const void*))compare_int);
 
-        i++;
+  /* add the horizontal segments. */
+  if (hh_count)
+  {
+    simMergeHxx(xx, &xx_count, hh, hh_count);
 
-        if (i < n_seg)
-        {
-          i_next = (i==n_seg-1)? 0: i+1;
-          seg_i_next = segments + i_next;
-        }
-      }
+    /* sort again */
+    if (xx_count)
+      qsort(xx, xx_count, sizeof(int), (int (*)(const void*,const void*))compare_int);
+  }
 
-      if (i == n_seg)
-        break;
+  return xx_count;
+}
 
-      if (i_prev == n_seg-1)
-      {
-        /* if at the first segment, find the previous segment that 
-           is not an horizontal line */
-        while (seg_i_prev->y1 == seg_i_prev->y2 && i_prev > 0)
-        {
-          i_prev--;
-          seg_i_prev = segments + i_prev;
-        }
-      }
+/* Active Edge Table.
+   The segments are sorted by their highest Y coordinate (y2), since the polygon
+   is scanned from y_max to y_min. When the scan line reaches y2 the segment is
+   moved to the active list, and it is removed when the scan line passes y1.
+   So only the segments that cross the current line are visited. */
 
-      /* save the previous y, not in current the horizontal line */
-      if (seg_i_prev->y1 == y)
-        prev_y = seg_i_prev->y2;
-      else
-        prev_y = seg_i_prev->y1;
+static int simEdgeTableCompareY2(const void* elem1, const void* elem2)
+{
+  const simLineSegment *seg1 = *(const simLineSegment**)elem1;
+  const simLineSegment *seg2 = *(const simLineSegment**)elem2;
+  if (seg1->y2 != seg2->y2)
+    return seg2->y2 - seg1->y2;  /* decreasing y2 */
+  return (int)(seg1 - seg2);     /* keep the polygon order */
+}
 
-      /* save the next y, not in the current horizontal line */
-      if (seg_i_next->y1 == y)
-        next_y = seg_i_next->y2;
-      else
-        next_y = seg_i_next->y1;
+static void simSortInt(int* xx, int count)
+{
+  /* insertion sort, the intersections are almost sorted since 
+     the active list keeps the order of the previous line */
+  int i, j, x;
+  for (i = 1; i < count; i++)
+  {
+    x = xx[i];
+    for (j = i; j > 0 && xx[j-1] > x; j--)
+      xx[j] = xx[j-1];
+    xx[j] = x;
+  }
+}
 
-      /* if the horizontal line is part of a step  \_  then add one virtual intersection in the middle */
-      /*                                             \                                                  */
-      if ((next_y > y && prev_y < y) ||
-          (next_y < y && prev_y > y))
-      {
-        xx[xx_count++] = (seg_i->x1+seg_i->x2)/2;     /* save the intersection point, any value inside the segment will be fine */
-      }
+void simEdgeTableInit(simEdgeTable* et, simLineSegment *segments, int n_seg)
+{
+  int i;
+  simLineSegment** sorted;
+
+  et->segments = segments;
+  et->n_seg = n_seg;
+  et->next = 0;
+  et->active_n = 0;
+
+  et->sorted = (int*)malloc((n_seg+1)*sizeof(int));
+  et->active = (int*)malloc((n_seg+1)*sizeof(int));
+  et->active_x = (int*)malloc((n_seg+1)*sizeof(int));
+  et->horiz = (int*)malloc((n_seg+1)*sizeof(int));
+  et->wind_x = (int*)malloc((n_seg+1)*sizeof(int));
+  et->wind_dir = (int*)malloc((n_seg+1)*sizeof(int));
+  et->wind_n = -1;
+
+  sorted = (simLineSegment**)malloc((n_seg+1)*sizeof(simLineSegment*));
+  for (i = 0; i < n_seg; i++)
+    sorted[i] = segments + i;
+
+  qsort(sorted, n_seg, sizeof(simLineSegment*), simEdgeTableCompareY2);
+
+  for (i = 0; i < n_seg; i++)
+    et->sorted[i] = (int)(sorted[i] - segments);
+
+  free(sorted);
+}
+
+void simEdgeTableFree(simEdgeTable* et)
+{
+  free(et->sorted);
+  free(et->active);
+  free(et->active_x);
+  free(et->horiz);
+  free(et->wind_x);
+  free(et->wind_dir);
+  memset(et, 0, sizeof(simEdgeTable));
+}
+
+int simEdgeTableFindHorizontalIntervals(simEdgeTable* et, int* xx, int *hh, int y, int height)
+{
+  /* Same result as simPolyFindHorizontalIntervals,
+     but must be called for all lines from y_max to y_min in sequence. */
+  simLineSegment *segments = et->segments, *seg_i;
+  int n_seg = et->n_seg;
+  int i, j, k, x, last_i, active_n, horiz_n = 0, hh_count = 0;
+  int xx_count = 0;
+
+  /* remove the segments that are below the current line */
+  active_n = 0;
+  for (k = 0; k < et->active_n; k++)
+  {
+    if (y >= segments[et->active[k]].y1)
+    {
+      et->active[active_n] = et->active[k];
+      et->active_x[active_n] = et->active_x[k];
+      active_n++;
+    }
+  }
+
+  /* add the segments that start at the current line */
+  while (et->next < n_seg && segments[et->sorted[et->next]].y2 >= y)
+  {
+    i = et->sorted[et->next];
+    et->active[active_n] = i;
+    et->active_x[active_n] = segments[i].x2;
+    active_n++;
+    et->next++;
+  }
+
+  et->active_n = active_n;
+  et->wind_n = -1;  /* crossings must be computed again */
+
+  /* calculates the intersections of the active segments, 
+     in the order of the previous line */
+  for (k = 0; k < active_n; k++)
+  {
+    i = et->active[k];
+    seg_i = segments + i;
+
+    if (seg_i->y1 == seg_i->y2)
+    {
+      /* horizontal lines are processed later in the polygon order */
+      et->horiz[horiz_n++] = i;
+      continue;
     }
-    else if (y == seg_i->y1)  /* intersection at the lowest point (x1,y1) */
+
+    if (simPolyFindIntersection(segments, n_seg, i, y, &x))
     {
-      int i_next = (i==n_seg-1)? 0: i+1;
-      int i_prev = (i==0)? n_seg-1: i-1;
-      simLineSegment *seg_i_next = segments + i_next;
-      simLineSegment *seg_i_prev = segments + i_prev;
-
-      /* but add only if it does not belongs to an horizontal line */
-      if (!((seg_i_next->y1 == y && seg_i_next->y2 == y) ||   /* next is an horizontal line */
-            (seg_i_prev->y1 == y && seg_i_prev->y2 == y)))    /* previous is an horizontal line */
-      {
-        xx[xx_count++] = seg_i->x1;     /* save the intersection point */
-      }
+      xx[xx_count++] = x;
+      et->active_x[k] = x;
     }
-    else if (y == seg_i->y2)  /* intersection at the highest point (x2,y2) */
+  }
+
+  /* keep the active list sorted by x */
+  for (k = 1; k < active_n; k++)
+  {
+    i = et->active[k];
+    x = et->active_x[k];
+    for (j = k; j > 0 && et->active_x[j-1] > x; j--)
     {
-      int i_next = (i==n_seg-1)? 0: i+1;
-      int i_prev = (i==0)? n_seg-1: i-1;
-      simLineSegment *seg_i_next = segments + i_next;
-      simLineSegment *seg_i_prev = segments + i_prev;
-
-      /* Normally do nothing, because this point is duplicated in another segment,    
-         i.e only save the intersection point for (y2) if not handled by (y1) of another segment.   
-         The exception is the top-corner points (^). */
-      /* first find if p2 is connected to next or previous */
-      if ((!seg_i->Swap && seg_i_next->Swap && seg_i_next->y2 == y && seg_i_next->x2 == seg_i->x2 && seg_i_next->y1 != y) || 
-          (seg_i->Swap && !seg_i_prev->Swap && seg_i_prev->y2 == y && seg_i_prev->x2 == seg_i->x2 && seg_i_prev->y1 != y))
-      {
-        xx[xx_count++] = seg_i->x2;     /* save the intersection point */
-      }
+      et->active[j] = et->active[j-1];
+      et->active_x[j] = et->active_x[j-1];
     }
-    else /* if ((y > seg_i->y1) && (y < seg_i->y2))  intersection inside the segment  */
-    {                                             
-      xx[xx_count++] = simSegmentInc(seg_i);  /* save the intersection point */
+    et->active[j] = i;
+    et->active_x[j] = x;
+  }
+
+  if (horiz_n)
+  {
+    simSortInt(et->horiz, horiz_n);
+
+    last_i = -1;
+    for (k = 0; k < horiz_n; k++)
+    {
+      i = et->horiz[k];
+      if (i <= last_i)  /* already included in a sequence */
+        continue;
+
+      last_i = simPolyAddHorizontalRun(segments, n_seg, i, xx, &xx_count, hh, &hh_count, y);
+      if (last_i == n_seg)
+        break;
     }
   }
 
@@ -566,35 +771,93 @@ int simPolyFindHorizontalIntervals(simLineSegment *segments, int n_seg, int* xx,
   if (y > height-1)
     return 0;
 
-  /* sort the intervals */
-  if (xx_count)
-    qsort(xx, xx_count, sizeof(int), (int (*)(const void*,const void*))compare_int);
+  simSortInt(xx, xx_count);
 
   /* add the horizontal segments. */
   if (hh_count)
   {
     simMergeHxx(xx, &xx_count, hh, hh_count);
-
-    /* sort again */
-    if (xx_count)
-      qsort(xx, xx_count, sizeof(int), (int (*)(const void*,const void*))compare_int);
+    simSortInt(xx, xx_count);
   }
 
   return xx_count;
 }
 
+static void simEdgeTableWindInit(simEdgeTable* et, int y)
+{
+  /* For each active segment that crosses the line, compute the first x where
+     the point is not at the left of the segment, so the test used by
+     simIsPointInPolyWind becomes a comparison of integers. */
+  simLineSegment *seg_i;
+  int k, j, num, den, cx, dir, n = 0, wn = 0;
+
+  for (k = 0; k < et->active_n; k++)
+  {
+    seg_i = et->segments + et->active[k];
+
+    /* half open segment, horizontal segments are also excluded */
+    if (seg_i->y1 <= y && y < seg_i->y2)
+    {
+      /* P left of edge when (x - x1)*(y2 - y1) < (x2 - x1)*(y - y1) */
+      num = (seg_i->x2 - seg_i->x1)*(y - seg_i->y1);
+      den = seg_i->y2 - seg_i->y1;
+      if (num >= 0)
+        cx = seg_i->x1 + (num + den - 1)/den;
+      else
+        cx = seg_i->x1 - (-num)/den;
+
+      dir = seg_i->Swap? -1: 1;  /* downward or upward crossing */
+      wn += dir;
+
+      /* insertion sort, the active list is already almost sorted by x */
+      for (j = n; j > 0 && et->wind_x[j-1] > cx; j--)
+      {
+        et->wind_x[j] = et->wind_x[j-1];
+        et->wind_dir[j] = et->wind_dir[j-1];
+      }
+      et->wind_x[j] = cx;
+      et->wind_dir[j] = dir;
+      n++;
+    }
+  }
+
+  et->wind_n = n;
+  et->wind_k = 0;
+  et->wind_wn = wn;  /* all crossings are at the right of -infinity */
+}
+
+int simEdgeTableIsPointInPolyWind(simEdgeTable* et, int x, int y)
+{
+  /* Same result as simIsPointInPolyWind,
+     but only the active segments can cross the line.
+     The points of the same line are usually tested from left to right,
+     so the winding number is updated only with the crossings between the
+     last point and the current point. */
+  if (et->wind_n < 0 || x < et->wind_last)
+    simEdgeTableWindInit(et, y);
+
+  while (et->wind_k < et->wind_n && et->wind_x[et->wind_k] <= x)
+  {
+    et->wind_wn -= et->wind_dir[et->wind_k];
+    et->wind_k++;
+  }
+
+  et->wind_last = x;
+  return et->wind_wn;
+}
+
 void simPolyFill(cdSimulation* simulation, cdPoint* poly, int n) 
 {
   /***********IMPORTANT: this function is used as a reference for irgbClipPoly in "cdirgb.c",
      if a change is made here, must be reflected there, and vice-versa */
   simIntervalList* line_int_list, *line_il;
+  simEdgeTable edge_table;
   int y_max, y_min, i, y, i1, fill_mode, num_lines,
-      xx_count, width, height, *xx, *hh, max_hh, n_seg;
+      xx_count, height, *xx, *hh, max_hh, n_seg;
 
   /* alloc maximum number of segments */
   simLineSegment *segments = (simLineSegment *)malloc(n*sizeof(simLineSegment));
 
-  width = simulation->canvas->w;
   height = simulation->canvas->h;
   fill_mode = simulation->canvas->fill_mode;
   
@@ -624,10 +887,12 @@ void simPolyFill(cdSimulation* simulation, cdPoint* poly, int n)
   xx = (int*)malloc((n+1)*sizeof(int));    /* allocated to the maximum number of possible intervals in one line */
   hh = (int*)malloc((2*max_hh)*sizeof(int));
 
+  simEdgeTableInit(&edge_table, segments, n_seg);
+
   /* for all horizontal lines between y_max and y_min */
   for(y = y_max; y >= y_min; y--)
   {
-    xx_count = simPolyFindHorizontalIntervals(segments, n_seg, xx, hh, y, height);
+    xx_count = simEdgeTableFindHorizontalIntervals(&edge_table, xx, hh, y, height);
     if (xx_count < 2)
       continue;
 
@@ -638,19 +903,20 @@ void simPolyFill(cdSimulation* simulation, cdPoint* poly, int n)
     for(i = 0; i < xx_count; i += 2)  /* process only pairs */
     {
       /* fills only pairs of intervals, */          
-      simFillHorizLine(simulation, xx[i], y, xx[i+1]);
+      simFillAddSpan(simulation, xx[i], y, xx[i+1], 255);
       simLineIntervallAdd(line_il, xx[i], xx[i+1]);
 
       if ((fill_mode == CD_WINDING) &&                     /* NOT EVENODD */
           ((i+2 < xx_count) && (xx[i+1] < xx[i+2])) && /* avoid single point intervals */
-           simIsPointInPolyWind(poly, n, (xx[i+1]+xx[i+2])/2, y)) /* the next interval is inside the polygon */
+           simEdgeTableIsPointInPolyWind(&edge_table, (xx[i+1]+xx[i+2])/2, y)) /* the next interval is inside the polygon */
       {
-        simFillHorizLine(simulation, xx[i+1], y, xx[i+2]);
+        simFillAddSpan(simulation, xx[i+1], y, xx[i+2], 255);
         simLineIntervallAdd(line_il, xx[i+1], xx[i+2]);
       }
     }
   }
 
+  simEdgeTableFree(&edge_table);
   free(xx);
   free(hh);
   free(segments);
@@ -668,6 +934,8 @@ void simPolyFill(cdSimulation* simulation, cdPoint* poly, int n)
     simPolyAAPixels(simulation->canvas, line_int_list, y_min, y_max, poly[i].x, poly[i].y, poly[i1].x, poly[i1].y);
   }
 
+  simFillFlushSpans(simulation);
+
   for (i = 0; i < num_lines; i++)
   {
     if (line_int_list[i].xx) 
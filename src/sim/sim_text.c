@@ -86,6 +86,69 @@ static cdAttribute version_attrib =
   get_version_attrib
 }; 
 
+static void set_glyphcachesize_attrib(cdCtxCanvas* ctxcanvas, char* data)
+{
+  cdCanvas* canvas = ((cdCtxCanvasBase*)ctxcanvas)->canvas;
+  int size = CDTT_GLYPH_CACHE_SIZE;
+  if (data) 
+    sscanf(data, "%d", &size);
+  cdTT_setGlyphCacheSize(canvas->simulation->tt_text, size);
+}
+
+static char* get_glyphcachesize_attrib(cdCtxCanvas* ctxcanvas)
+{
+  static char size[50];
+  cdCanvas* canvas = ((cdCtxCanvasBase*)ctxcanvas)->canvas;
+  sprintf(size, "%d", canvas->simulation->tt_text->glyph_cache_max);
+  return size;
+}
+
+static cdAttribute glyphcachesize_attrib =
+{
+  "GLYPHCACHESIZE",
+  set_glyphcachesize_attrib,
+  get_glyphcachesize_attrib
+}; 
+
+static void set_glyphcachehits_attrib(cdCtxCanvas* ctxcanvas, char* data)
+{
+  /* any value resets the counters */
+  cdCanvas* canvas = ((cdCtxCanvasBase*)ctxcanvas)->canvas;
+  (void)data;
+  canvas->simulation->tt_text->glyph_hits = 0;
+  canvas->simulation->tt_text->glyph_misses = 0;
+}
+
+static char* get_glyphcachehits_attrib(cdCtxCanvas* ctxcanvas)
+{
+  static char hits[50];
+  cdCanvas* canvas = ((cdCtxCanvasBase*)ctxcanvas)->canvas;
+  sprintf(hits, "%lu", canvas->simulation->tt_text->glyph_hits);
+  return hits;
+}
+
+static cdAttribute glyphcachehits_attrib =
+{
+  "GLYPHCACHEHITS",
+  set_glyphcachehits_attrib,
+  get_glyphcachehits_attrib
+}; 
+
+static char* get_glyphcachemisses_attrib(cdCtxCanvas* ctxcanvas)
+{
+  static char misses[50];
+  cdCanvas* canvas = ((cdCtxCanvasBase*)ctxcanvas)->canvas;
+  sprintf(misses, "%lu", canvas->simulation->tt_text->glyph_misses);
+  return misses;
+}
+
+static cdAttribute glyphcachemisses_attrib =
+{
+  "GLYPHCACHEMISSES",
+  set_glyphcachehits_attrib,
+  get_glyphcachemisses_attrib
+}; 
+
 void cdSimInitText(cdSimulation* simulation)
 {
   if (!simulation->tt_text)
@@ -93,6 +156,9 @@ void cdSimInitText(cdSimulation* simulation)
 
   cdRegisterAttribute(simulation->canvas, &addfontmap_attrib);
   cdRegisterAttribute(simulation->canvas, &version_attrib);
+  cdRegisterAttribute(simulation->canvas, &glyphcachesize_attrib);
+  cdRegisterAttribute(simulation->canvas, &glyphcachehits_attrib);
+  cdRegisterAttribute(simulation->canvas, &glyphcachemisses_attrib);
 }
 
 static const char* sFindFontMap(cdSimulation* simulation, const char* name)
@@ -150,26 +216,18 @@ void cdSimGetTextSizeFT(cdCtxCanvas* ctxcanvas, const char *s, int len, int *wid
   cdCanvas* canvas = ((cdCtxCanvasBase*)ctxcanvas)->canvas;
   cdSimulation* simulation = canvas->simulation;
   int i = 0, w = 0;
-  FT_Face       face;
-  FT_GlyphSlot  slot;
-  FT_Error      error;
+  const cdTT_Glyph* glyph;
 
   if (!simulation->tt_text->face)
     return;
 
-  face = simulation->tt_text->face;
-  slot = face->glyph;
-
-  /* set transformation */
-  FT_Set_Transform( face, NULL, NULL );
-
   while(i < len)
   {
-    /* load glyph image into the slot (erase previous one) */
-    error = FT_Load_Char( face, (unsigned char)s[i], FT_LOAD_DEFAULT );
-    if (error) {i++; continue;}  /* ignore errors */
+    /* only the advance is necessary, no transformation */
+    glyph = cdTT_getGlyph(simulation->tt_text, (unsigned char)s[i], NULL, NULL, 0);
+    if (!glyph) {i++; continue;}  /* ignore errors */
 
-    w += slot->advance.x; 
+    w += glyph->advance.x; 
 
     i++;
   }
@@ -178,27 +236,64 @@ void cdSimGetTextSizeFT(cdCtxCanvas* ctxcanvas, const char *s, int len, int *wid
   if (width)  *width  = w >> 6;
 }
 
-static void simDrawTextBitmap(cdSimulation* simulation, FT_Bitmap* bitmap, int x, int y)
+/* makes room for 4 planes of size bytes */
+static int simTextReserveImage(cdTT_Text* tt_text, int size)
+{
+  if (4*size > tt_text->rgba_data_size)
+  {
+    unsigned char* rgba_data = realloc(tt_text->rgba_data, 4*size);
+    if (!rgba_data)
+      return 0;
+
+    tt_text->rgba_data = rgba_data;
+    tt_text->rgba_data_size = 4*size;
+    tt_text->rgba_color_set = 0;
+  }
+
+  return 1;
+}
+
+static void simDrawTextBitmap(cdSimulation* simulation, const FT_Bitmap* bitmap, int x, int y)
 {
   unsigned char *red, *green, *blue, *alpha, *bitmap_data;
   int width = bitmap->width;
   int height = bitmap->rows;
   int size = width*height;
-  int rgba_data_size = size*4;
+  int plane_size;
   int old_use_matrix = simulation->canvas->use_matrix;
 
   /* avoid spaces */
   if (width == 0 || height == 0)
     return;
 
-  if (!simulation->tt_text->rgba_data)
-    simulation->tt_text->rgba_data = malloc(rgba_data_size);
-  else if (rgba_data_size > simulation->tt_text->rgba_data_size)
+  if (simulation->canvas->cxPutMask)
   {
-    simulation->tt_text->rgba_data = realloc(simulation->tt_text->rgba_data, rgba_data_size);
-    simulation->tt_text->rgba_data_size = rgba_data_size;
+    /* the glyph coverage is composed directly, no image is necessary */
+    const unsigned char* mask = bitmap->buffer;
+
+    if (!simulation->txt_antialias)
+    {
+      int i;
+      unsigned char* bilevel;
+
+      if (!simTextReserveImage(simulation->tt_text, size))
+        return;
+
+      bilevel = simulation->tt_text->rgba_data;
+      for (i = 0; i < size; i++)
+        bilevel[i] = bitmap->buffer[i] > 128? 255: 0;  /* behave as 255 */
+
+      simulation->tt_text->rgba_color_set = 0;
+      mask = bilevel;
+    }
+
+    simulation->canvas->cxPutMask(simulation->canvas->ctxcanvas, width, height, mask, x, y, simulation->canvas->foreground);
+    return;
   }
 
+  if (!simTextReserveImage(simulation->tt_text, size))
+    return;
+
   /* disable image transformation */
   simulation->canvas->use_matrix = 0;
 
@@ -206,11 +301,13 @@ static void simDrawTextBitmap(cdSimulation* simulation, FT_Bitmap* bitmap, int x
      to be combined with the foreground color */
   bitmap_data = bitmap->buffer + (height-1)*width;  /* bitmap is top down. */
 
-  /* this is the image used to draw the char with the foreground color */ 
+  /* this is the image used to draw the char with the foreground color, 
+     the planes have a fixed size so the color planes can be reused by the next chars */ 
+  plane_size = simulation->tt_text->rgba_data_size / 4;
   red   = simulation->tt_text->rgba_data;
-  green = red   + size;
-  blue  = green + size;
-  alpha = blue  + size;
+  green = red   + plane_size;
+  blue  = green + plane_size;
+  alpha = blue  + plane_size;
 
   if (!simulation->canvas->cxPutImageRectRGBA && !simulation->canvas->cxGetImageRGB)
   {
@@ -260,8 +357,9 @@ static void simDrawTextBitmap(cdSimulation* simulation, FT_Bitmap* bitmap, int x
 
     /* reset pointers */
     red   = simulation->tt_text->rgba_data;
-    green = red   + size;
-    blue  = green + size;
+    green = red   + plane_size;
+    blue  = green + plane_size;
+    simulation->tt_text->rgba_color_set = 0;
 
     /* draw the char */
     simulation->canvas->cxPutImageRectRGB(simulation->canvas->ctxcanvas, width,height,red,green,blue,x,y,width,height,0,width-1,0,height-1);
@@ -271,9 +369,16 @@ static void simDrawTextBitmap(cdSimulation* simulation, FT_Bitmap* bitmap, int x
     int i, j;
     long int fg = simulation->canvas->foreground;
     unsigned char fg_alpha = cdAlpha(fg);
-    memset(red,   cdRed(fg), size);
-    memset(green, cdGreen(fg), size);
-    memset(blue,  cdBlue(fg), size);
+
+    if (!simulation->tt_text->rgba_color_set || 
+        cdEncodeAlpha(simulation->tt_text->rgba_color, 255) != cdEncodeAlpha(fg, 255))
+    {
+      memset(red,   cdRed(fg), plane_size);
+      memset(green, cdGreen(fg), plane_size);
+      memset(blue,  cdBlue(fg), plane_size);
+      simulation->tt_text->rgba_color = fg;
+      simulation->tt_text->rgba_color_set = 1;
+    }
 
     /* alpha is the bitmap_data itself 
        if the foreground color does not contains alpha.
@@ -311,7 +416,7 @@ static void simDrawTextBitmap(cdSimulation* simulation, FT_Bitmap* bitmap, int x
     }
 
     /* reset alpha pointer */
-    alpha = blue + size;
+    alpha = blue + plane_size;
 
     /* draw the char */
     simulation->canvas->cxPutImageRectRGBA(simulation->canvas->ctxcanvas, width,height,red,green,blue,alpha,x,y,width,height,0,width-1,0,height-1);
@@ -389,19 +494,14 @@ void cdSimTextFT(cdCtxCanvas* ctxcanvas, int x, int y, const char* s, int len)
 {
   cdCanvas* canvas = ((cdCtxCanvasBase*)ctxcanvas)->canvas;
   cdSimulation* simulation = canvas->simulation;
-  FT_Face       face;
-  FT_GlyphSlot  slot;
   FT_Matrix     matrix;                 /* transformation matrix */
   FT_Vector     pen;                    /* untransformed origin  */
-  FT_Error      error;
+  const cdTT_Glyph* glyph;
   int i = 0;
 
   if (!simulation->tt_text->face)
     return;
 
-  face = simulation->tt_text->face;
-  slot = face->glyph;
-
   /* the pen position is in cartesian space coordinates */
   if (simulation->canvas->invert_yaxis)
     y = _cdInvertYAxis(canvas, y);   /* y is already inverted, invert back to cartesian space */
@@ -411,25 +511,22 @@ void cdSimTextFT(cdCtxCanvas* ctxcanvas, int x, int y, const char* s, int len)
 
   while(i<len)
   {
-    /* set transformation */
-    FT_Set_Transform(face, &matrix, &pen);
-
-    /* load glyph image into the slot (erase previous one) */
-    error = FT_Load_Char(face, (unsigned char)s[i], FT_LOAD_RENDER);
-    if (error) {i++; continue;}  /* ignore errors */
+    /* rendered glyph, from the cache if possible */
+    glyph = cdTT_getGlyph(simulation->tt_text, (unsigned char)s[i], &matrix, &pen, 1);
+    if (!glyph) {i++; continue;}  /* ignore errors */
 
-    x = slot->bitmap_left;
-    y = slot->bitmap_top-slot->bitmap.rows; /* CD image reference point is at bottom-left */
+    x = CDTT_PIXEL(pen.x) + glyph->left;
+    y = CDTT_PIXEL(pen.y) + glyph->top - glyph->bitmap.rows; /* CD image reference point is at bottom-left */
 
     if (canvas->invert_yaxis)
       y = _cdInvertYAxis(canvas, y);
 
     /* now, draw to our target surface (convert position) */
-    simDrawTextBitmap(simulation, &slot->bitmap, x, y);
+    simDrawTextBitmap(simulation, &glyph->bitmap, x, y);
 
     /* increment pen position */
-    pen.x += slot->advance.x;
-    pen.y += slot->advance.y;
+    pen.x += glyph->advance.x;
+    pen.y += glyph->advance.y;
 
     i++;
   }
@@ -16,10 +16,31 @@
 #include "cd_private.h"
 #include "cdsvg.h"
 
-#include "lodepng.h"
-#include "base64.h"
+#include "zlib.h"
 
 
+#define SVG_PNG_NONE     0
+#define SVG_PNG_SUB      1
+#define SVG_PNG_UP       2
+#define SVG_PNG_AVERAGE  3
+#define SVG_PNG_PAETH    4
+#define SVG_PNG_ADAPTIVE 5  /* the best filter for each row */
+
+typedef struct _svgImage
+{
+  unsigned long crc, adler;  /* of the pixels, and of the palette */
+  int width, height;
+  int bpp;  /* 1 (palette), 3 (RGB) or 4 (RGBA) */
+  int id;
+} svgImage;
+
+typedef struct _svgStyleClass
+{
+  char* style;
+  unsigned long hash;
+  int id;
+} svgStyleClass;
+
 struct _cdCtxCanvas 
 {
   cdCanvas* canvas;
@@ -40,18 +61,39 @@ struct _cdCtxCanvas
 
   double opacity;
   int hatchboxsize;
+  int precision;       /* decimals of the coordinates, -1 uses "%g" */
+  int relative_path;   /* polygons and paths are written with relative commands */
+  int style_class;     /* each distinct style is written once as a CSS class */
+  int image_level;     /* zlib compression level of the images */
+  int image_filter;    /* PNG filter of the images */
 
   /* private */
   int last_fill_mode;
   
   int last_clip_poly;
   int last_clip_rect;
+  int last_image;
   int clip_control;
   int clip_polygon;
 
   int transform_control;
 
-  FILE* file;
+  double path_x, path_y;    /* current point of the relative path */
+  double path_x0, path_y0;  /* start point of the current sub-path */
+  int path_cmd;             /* last command of the relative path */
+  int path_sep;             /* next number must be separated from the previous */
+
+  char style[512];
+  char style_attrib[600];
+  svgStyleClass* style_table;
+  int style_table_size;
+  int style_count;
+
+  svgImage* image_list;
+  int image_count;
+  int image_size;
+
+  cdStream* stream;
 };
 
 static void cdtransform(cdCtxCanvas *ctxcanvas, const double* matrix);
@@ -59,15 +101,29 @@ static void cdtransform(cdCtxCanvas *ctxcanvas, const double* matrix);
 static void cdkillcanvas(cdCtxCanvas* ctxcanvas)
 {
   if (ctxcanvas->clip_control)
-    fprintf(ctxcanvas->file, "</g>\n");  /* close clipping container */
+    cdStreamPrintf(ctxcanvas->stream, "</g>\n");  /* close clipping container */
 
   if (ctxcanvas->transform_control)
-    fprintf(ctxcanvas->file, "</g>\n");  /* close transform container */
+    cdStreamPrintf(ctxcanvas->stream, "</g>\n");  /* close transform container */
+
+  cdStreamPrintf(ctxcanvas->stream, "</g>\n");  /* close global container */
+  cdStreamPrintf(ctxcanvas->stream, "</svg>\n");
 
-  fprintf(ctxcanvas->file, "</g>\n");  /* close global container */
-  fprintf(ctxcanvas->file, "</svg>\n");
+  cdStreamClose(ctxcanvas->stream);
+
+  if (ctxcanvas->style_table)
+  {
+    int i;
+    for (i = 0; i < ctxcanvas->style_table_size; i++)
+    {
+      if (ctxcanvas->style_table[i].style)
+        free(ctxcanvas->style_table[i].style);
+    }
+    free(ctxcanvas->style_table);
+  }
 
-  fclose(ctxcanvas->file);
+  if (ctxcanvas->image_list)
+    free(ctxcanvas->image_list);
 
   if (ctxcanvas->old_locale)
   {
@@ -79,6 +135,286 @@ static void cdkillcanvas(cdCtxCanvas* ctxcanvas)
   free(ctxcanvas);
 }
 
+static double sRound(cdCtxCanvas *ctxcanvas, double v)
+{
+  static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9};
+  double p;
+
+  if (ctxcanvas->precision < 0)
+    return v;
+
+  p = pow10[ctxcanvas->precision];
+  v = floor(v*p + 0.5)/p;
+  if (v == 0)
+    v = 0;  /* no negative zero */
+  return v;
+}
+
+static void sPutReal(cdCtxCanvas *ctxcanvas, double v)
+{
+  if (ctxcanvas->precision < 0)
+    cdStreamPutReal(ctxcanvas->stream, v);
+  else
+    cdStreamPutDecimal(ctxcanvas->stream, v, ctxcanvas->precision);
+}
+
+static void sPutAttrib(cdCtxCanvas *ctxcanvas, const char* name, double v)
+{
+  cdStreamPutChar(ctxcanvas->stream, ' ');
+  cdStreamPutString(ctxcanvas->stream, name);
+  cdStreamPutString(ctxcanvas->stream, "=\"");
+  sPutReal(ctxcanvas, v);
+  cdStreamPutChar(ctxcanvas->stream, '"');
+}
+
+static void sPutPair(cdCtxCanvas *ctxcanvas, double x, double y)
+{
+  sPutReal(ctxcanvas, x);
+  cdStreamPutChar(ctxcanvas->stream, ',');
+  sPutReal(ctxcanvas, y);
+}
+
+/* Relative paths. 
+   Each coordinate is written as the difference to the current point,
+   the current point is kept as the reader will compute it so errors are not accumulated. */
+
+static void sPathBegin(cdCtxCanvas *ctxcanvas)
+{
+  /* a path that starts with a relative moveto is relative to 0,0 */
+  ctxcanvas->path_x = 0;
+  ctxcanvas->path_y = 0;
+  ctxcanvas->path_x0 = 0;
+  ctxcanvas->path_y0 = 0;
+  ctxcanvas->path_cmd = 0;
+  ctxcanvas->path_sep = 0;
+}
+
+static void sPathCommand(cdCtxCanvas *ctxcanvas, int cmd)
+{
+  /* a repeated command can be omitted */
+  if (ctxcanvas->path_cmd != cmd)
+  {
+    cdStreamPutChar(ctxcanvas->stream, cmd);
+    ctxcanvas->path_cmd = cmd;
+    ctxcanvas->path_sep = 0;
+  }
+}
+
+static void sPathNumber(cdCtxCanvas *ctxcanvas, double v)
+{
+  v = sRound(ctxcanvas, v);
+
+  /* the minus sign is also a separator */
+  if (ctxcanvas->path_sep && !(v < 0))
+    cdStreamPutChar(ctxcanvas->stream, ' ');
+
+  sPutReal(ctxcanvas, v);
+  ctxcanvas->path_sep = 1;
+}
+
+static double sRoundSignificant(double v)
+{
+  /* the value written by "%g", 6 significant digits */
+  double p;
+  if (v == 0)
+    return 0;
+  p = pow(10.0, 5 - (int)floor(log10(fabs(v))));
+  return floor(v*p + 0.5)/p;
+}
+
+static void sPathPoint(cdCtxCanvas *ctxcanvas, double x, double y)
+{
+  double dx, dy;
+
+  if (ctxcanvas->precision < 0)
+  {
+    /* the current point is the one the reader will compute, 
+       so the next difference compensates the error of this one */
+    dx = sRoundSignificant(x - ctxcanvas->path_x);
+    dy = sRoundSignificant(y - ctxcanvas->path_y);
+    sPathNumber(ctxcanvas, x - ctxcanvas->path_x);
+    sPathNumber(ctxcanvas, y - ctxcanvas->path_y);
+    ctxcanvas->path_x += dx;
+    ctxcanvas->path_y += dy;
+    return;
+  }
+
+  x = sRound(ctxcanvas, x);
+  y = sRound(ctxcanvas, y);
+  sPathNumber(ctxcanvas, x - ctxcanvas->path_x);
+  sPathNumber(ctxcanvas, y - ctxcanvas->path_y);
+  ctxcanvas->path_x = x;
+  ctxcanvas->path_y = y;
+}
+
+static void sPathMoveTo(cdCtxCanvas *ctxcanvas, double x, double y)
+{
+  sPathCommand(ctxcanvas, 'm');
+  sPathPoint(ctxcanvas, x, y);
+  ctxcanvas->path_x0 = ctxcanvas->path_x;
+  ctxcanvas->path_y0 = ctxcanvas->path_y;
+
+  /* the next pairs would be implicit linetos */
+  ctxcanvas->path_cmd = 0;
+}
+
+static void sPathLineTo(cdCtxCanvas *ctxcanvas, double x, double y)
+{
+  sPathCommand(ctxcanvas, 'l');
+  sPathPoint(ctxcanvas, x, y);
+}
+
+static void sPathCurveTo(cdCtxCanvas *ctxcanvas, double x1, double y1, double x2, double y2, double x3, double y3)
+{
+  double x = ctxcanvas->path_x, 
+         y = ctxcanvas->path_y;
+
+  /* all the control points are relative to the start of the segment */
+  sPathCommand(ctxcanvas, 'c');
+  sPathNumber(ctxcanvas, sRound(ctxcanvas, x1) - x);
+  sPathNumber(ctxcanvas, sRound(ctxcanvas, y1) - y);
+  sPathNumber(ctxcanvas, sRound(ctxcanvas, x2) - x);
+  sPathNumber(ctxcanvas, sRound(ctxcanvas, y2) - y);
+  sPathPoint(ctxcanvas, x3, y3);
+}
+
+static void sPathArcTo(cdCtxCanvas *ctxcanvas, double rx, double ry, int largeArc, int sweep, double x, double y)
+{
+  sPathCommand(ctxcanvas, 'a');
+  sPathNumber(ctxcanvas, rx);
+  sPathNumber(ctxcanvas, ry);
+  sPathNumber(ctxcanvas, 0);
+  sPathNumber(ctxcanvas, largeArc);
+  sPathNumber(ctxcanvas, sweep);
+  sPathPoint(ctxcanvas, x, y);
+}
+
+static void sPathClose(cdCtxCanvas *ctxcanvas)
+{
+  cdStreamPutChar(ctxcanvas->stream, 'z');
+  ctxcanvas->path_cmd = 'z';
+  ctxcanvas->path_sep = 0;
+  ctxcanvas->path_x = ctxcanvas->path_x0;
+  ctxcanvas->path_y = ctxcanvas->path_y0;
+}
+
+/* Styles. 
+   When STYLECLASS is enabled each distinct style is written once in a <style> element,
+   and the primitives refer to it by the class name. */
+
+static unsigned long sStyleHash(const char* style)
+{
+  unsigned long hash = 5381;
+  while (*style)
+    hash = hash*33 + (unsigned char)*style++;
+  return hash;
+}
+
+static int sStyleTableGrow(cdCtxCanvas *ctxcanvas)
+{
+  int i, size = ctxcanvas->style_table_size? 2*ctxcanvas->style_table_size: 64;
+  svgStyleClass* table = (svgStyleClass*)calloc(size, sizeof(svgStyleClass));
+  if (!table)
+    return 0;
+
+  for (i = 0; i < ctxcanvas->style_table_size; i++)
+  {
+    svgStyleClass* entry = ctxcanvas->style_table + i;
+    if (entry->style)
+    {
+      int j = (int)(entry->hash & (size-1));
+      while (table[j].style)
+        j = (j+1) & (size-1);
+      table[j] = *entry;
+    }
+  }
+
+  if (ctxcanvas->style_table)
+    free(ctxcanvas->style_table);
+
+  ctxcanvas->style_table = table;
+  ctxcanvas->style_table_size = size;
+  return 1;
+}
+
+static int sStyleClass(cdCtxCanvas *ctxcanvas, const char* style)
+{
+  unsigned long hash = sStyleHash(style);
+  svgStyleClass* entry;
+  int i, mask;
+
+  if (2*ctxcanvas->style_count >= ctxcanvas->style_table_size && !sStyleTableGrow(ctxcanvas))
+    return -1;
+
+  mask = ctxcanvas->style_table_size-1;
+  i = (int)(hash & mask);
+  while (ctxcanvas->style_table[i].style)
+  {
+    entry = ctxcanvas->style_table + i;
+    if (entry->hash == hash && strcmp(entry->style, style) == 0)
+      return entry->id;
+    i = (i+1) & mask;
+  }
+
+  entry = ctxcanvas->style_table + i;
+  entry->style = cdStrDup(style);
+  if (!entry->style)
+    return -1;
+  entry->hash = hash;
+  entry->id = ctxcanvas->style_count++;
+
+  /* must be called before the element that uses it is started */
+  cdStreamPrintf(ctxcanvas->stream, "<style type=\"text/css\">.s%d{%s}</style>\n", entry->id, style);
+  return entry->id;
+}
+
+static const char* sStyleAttribStr(cdCtxCanvas *ctxcanvas, const char* style)
+{
+  if (ctxcanvas->style_class)
+  {
+    int id = sStyleClass(ctxcanvas, style);
+    if (id >= 0)
+    {
+      sprintf(ctxcanvas->style_attrib, "class=\"s%d\"", id);
+      return ctxcanvas->style_attrib;
+    }
+  }
+
+  sprintf(ctxcanvas->style_attrib, "style=\"%s\"", style);
+  return ctxcanvas->style_attrib;
+}
+
+static const char* sStyleAttrib(cdCtxCanvas *ctxcanvas, int fill, int stroke, const char* rule)
+{
+  char* style = ctxcanvas->style;
+
+  if (fill)
+  {
+    style += sprintf(style, "fill:%s; ", (ctxcanvas->canvas->interior_style == CD_SOLID) ? ctxcanvas->fgColor: ctxcanvas->pattern);
+    if (rule)
+      style += sprintf(style, "fill-rule:%s; ", rule);
+  }
+  else
+    style += sprintf(style, "fill:none; ");
+
+  if (stroke)
+    style += sprintf(style, "stroke:%s; stroke-width:%d; stroke-linecap:%s; stroke-linejoin:%s; stroke-dasharray:%s; ",
+                     ctxcanvas->fgColor, ctxcanvas->canvas->line_width, ctxcanvas->linecap, ctxcanvas->linejoin, ctxcanvas->linestyle);
+  else
+    style += sprintf(style, "stroke:none; ");
+
+  sprintf(style, "opacity:%g", ctxcanvas->opacity);
+
+  return sStyleAttribStr(ctxcanvas, ctxcanvas->style);
+}
+
+static void sEndElement(cdCtxCanvas *ctxcanvas, const char* style)
+{
+  cdStreamPutChar(ctxcanvas->stream, ' ');
+  cdStreamPutString(ctxcanvas->stream, style);
+  cdStreamPutString(ctxcanvas->stream, " />\n");
+}
+
 static int cdclip(cdCtxCanvas *ctxcanvas, int clip_mode)
 {
   if (ctxcanvas->clip_control)
@@ -86,11 +422,11 @@ static int cdclip(cdCtxCanvas *ctxcanvas, int clip_mode)
     int old_transform_control = ctxcanvas->transform_control;
     if (ctxcanvas->transform_control)
     {
-      fprintf(ctxcanvas->file, "</g>\n");  /* close transform container */
+      cdStreamPrintf(ctxcanvas->stream, "</g>\n");  /* close transform container */
       ctxcanvas->transform_control = 0;
     }
 
-    fprintf(ctxcanvas->file, "</g>\n");  /* close clipping container */
+    cdStreamPrintf(ctxcanvas->stream, "</g>\n");  /* close clipping container */
     ctxcanvas->clip_control = 0;
 
     if (old_transform_control)
@@ -101,14 +437,14 @@ static int cdclip(cdCtxCanvas *ctxcanvas, int clip_mode)
   {
     case CD_CLIPAREA:
       /* open clipping container */
-      fprintf(ctxcanvas->file, "<g clip-path=\"url(#cliprect%d)\">\n", ctxcanvas->last_clip_rect);
+      cdStreamPrintf(ctxcanvas->stream, "<g clip-path=\"url(#cliprect%d)\">\n", ctxcanvas->last_clip_rect);
       ctxcanvas->clip_control = 1;
       break;
     case CD_CLIPPOLYGON:
       if (ctxcanvas->clip_polygon)
       {
         /* open clipping container */
-        fprintf(ctxcanvas->file, "<g clip-path=\"url(#clippoly%d)\" clip-rule:%s >\n", ctxcanvas->last_clip_poly, (ctxcanvas->canvas->fill_mode==CD_EVENODD)? "evenodd": "nonzero");
+        cdStreamPrintf(ctxcanvas->stream, "<g clip-path=\"url(#clippoly%d)\" clip-rule:%s >\n", ctxcanvas->last_clip_poly, (ctxcanvas->canvas->fill_mode==CD_EVENODD)? "evenodd": "nonzero");
         ctxcanvas->clip_control = 1;
       }
       break;
@@ -131,11 +467,16 @@ static void cdfcliparea(cdCtxCanvas *ctxcanvas, double xmin, double xmax, double
   w = xmax - xmin + 1;
   h = ymax - ymin + 1;
 
-  fprintf(ctxcanvas->file, "<clipPath id=\"cliprect%d\">\n", ++ctxcanvas->last_clip_rect);
+  cdStreamPrintf(ctxcanvas->stream, "<clipPath id=\"cliprect%d\">\n", ++ctxcanvas->last_clip_rect);
 
-  fprintf(ctxcanvas->file, "<rect x=\"%g\" y=\"%g\" width=\"%g\" height=\"%g\" />\n", x, y, w, h);
+  cdStreamPutString(ctxcanvas->stream, "<rect");
+  sPutAttrib(ctxcanvas, "x", x);
+  sPutAttrib(ctxcanvas, "y", y);
+  sPutAttrib(ctxcanvas, "width", w);
+  sPutAttrib(ctxcanvas, "height", h);
+  cdStreamPutString(ctxcanvas->stream, " />\n");
 
-  fprintf(ctxcanvas->file, "</clipPath>\n");
+  cdStreamPrintf(ctxcanvas->stream, "</clipPath>\n");
 
   if (ctxcanvas->canvas->clip_mode == CD_CLIPAREA) 
     cdclip(ctxcanvas, CD_CLIPAREA);
@@ -153,11 +494,11 @@ static void cdtransform(cdCtxCanvas *ctxcanvas, const double* matrix)
     int old_clip_control = ctxcanvas->clip_control;
     if (ctxcanvas->clip_control)
     {
-      fprintf(ctxcanvas->file, "</g>\n");  /* close clipping container */
+      cdStreamPrintf(ctxcanvas->stream, "</g>\n");  /* close clipping container */
       ctxcanvas->clip_control = 0;
     }
 
-    fprintf(ctxcanvas->file, "</g>\n");  /* close transform container */
+    cdStreamPrintf(ctxcanvas->stream, "</g>\n");  /* close transform container */
     ctxcanvas->transform_control = 0;
 
     if (old_clip_control)
@@ -180,7 +521,7 @@ static void cdtransform(cdCtxCanvas *ctxcanvas, const double* matrix)
     cdMatrixMultiply(matrix, xmatrix);
 
     /* open transform container */
-    fprintf(ctxcanvas->file, "<g transform=\"matrix(%g %g %g %g %g %g)\">\n", xmatrix[0], xmatrix[1], xmatrix[2], xmatrix[3], xmatrix[4], xmatrix[5]);
+    cdStreamPrintf(ctxcanvas->stream, "<g transform=\"matrix(%g %g %g %g %g %g)\">\n", xmatrix[0], xmatrix[1], xmatrix[2], xmatrix[3], xmatrix[4], xmatrix[5]);
     ctxcanvas->transform_control = 1;
 
     ctxcanvas->canvas->invert_yaxis = 0;  /* let the transformation do the axis invertion */
@@ -191,8 +532,14 @@ static void cdtransform(cdCtxCanvas *ctxcanvas, const double* matrix)
 
 static void cdfline(cdCtxCanvas *ctxcanvas, double x1, double y1, double x2, double y2)
 {
-  fprintf(ctxcanvas->file, "<line x1=\"%g\" y1=\"%g\" x2=\"%g\" y2=\"%g\" style=\"fill:none; stroke:%s; stroke-width:%d; stroke-linecap:%s; stroke-linejoin:%s; stroke-dasharray:%s; opacity:%g\" />\n",
-          x1, y1, x2, y2, ctxcanvas->fgColor, ctxcanvas->canvas->line_width, ctxcanvas->linecap, ctxcanvas->linejoin, ctxcanvas->linestyle, ctxcanvas->opacity);
+  const char* style = sStyleAttrib(ctxcanvas, 0, 1, NULL);
+
+  cdStreamPutString(ctxcanvas->stream, "<line");
+  sPutAttrib(ctxcanvas, "x1", x1);
+  sPutAttrib(ctxcanvas, "y1", y1);
+  sPutAttrib(ctxcanvas, "x2", x2);
+  sPutAttrib(ctxcanvas, "y2", y2);
+  sEndElement(ctxcanvas, style);
 }
 
 static void cdline(cdCtxCanvas *ctxcanvas, int x1, int y1, int x2, int y2)
@@ -200,10 +547,19 @@ static void cdline(cdCtxCanvas *ctxcanvas, int x1, int y1, int x2, int y2)
   cdfline(ctxcanvas, (double)x1, (double)y1, (double)x2, (double)y2);
 }
 
+static void sWriteRect(cdCtxCanvas *ctxcanvas, double xmin, double xmax, double ymin, double ymax, const char* style)
+{
+  cdStreamPutString(ctxcanvas->stream, "<rect");
+  sPutAttrib(ctxcanvas, "x", xmin);
+  sPutAttrib(ctxcanvas, "y", ymin);
+  sPutAttrib(ctxcanvas, "width", xmax-xmin);
+  sPutAttrib(ctxcanvas, "height", ymax-ymin);
+  sEndElement(ctxcanvas, style);
+}
+
 static void cdfrect(cdCtxCanvas *ctxcanvas, double xmin, double xmax, double ymin, double ymax)
 {
-  fprintf(ctxcanvas->file, "<rect x=\"%g\" y=\"%g\" width=\"%g\" height=\"%g\" style=\"fill:none; stroke:%s; stroke-width:%d; stroke-linecap:%s; stroke-linejoin:%s; stroke-dasharray:%s; opacity:%g\" />\n",
-          xmin, ymin, xmax-xmin, ymax-ymin, ctxcanvas->fgColor, ctxcanvas->canvas->line_width, ctxcanvas->linecap, ctxcanvas->linejoin, ctxcanvas->linestyle, ctxcanvas->opacity);
+  sWriteRect(ctxcanvas, xmin, xmax, ymin, ymax, sStyleAttrib(ctxcanvas, 0, 1, NULL));
 }
 
 static void cdrect(cdCtxCanvas *ctxcanvas, int xmin, int xmax, int ymin, int ymax)
@@ -213,8 +569,7 @@ static void cdrect(cdCtxCanvas *ctxcanvas, int xmin, int xmax, int ymin, int yma
 
 static void cdfbox(cdCtxCanvas *ctxcanvas, double xmin, double xmax, double ymin, double ymax)
 {
-  fprintf(ctxcanvas->file, "<rect x=\"%g\" y=\"%g\" width=\"%g\" height=\"%g\" style=\"fill:%s; stroke:none; opacity:%g\" />\n",
-          xmin, ymin, xmax-xmin, ymax-ymin, (ctxcanvas->canvas->interior_style == CD_SOLID) ? ctxcanvas->fgColor: ctxcanvas->pattern, ctxcanvas->opacity);
+  sWriteRect(ctxcanvas, xmin, xmax, ymin, ymax, sStyleAttrib(ctxcanvas, 1, 0, NULL));
 }
 
 static void cdbox(cdCtxCanvas *ctxcanvas, int xmin, int xmax, int ymin, int ymax)
@@ -252,6 +607,38 @@ static void sCalcArc(cdCanvas* canvas, double xc, double yc, double w, double h,
     *largeArc = 0;
 }
 
+static void sWriteEllipse(cdCtxCanvas *ctxcanvas, double xc, double yc, double w, double h, const char* style)
+{
+  cdStreamPutString(ctxcanvas->stream, "<ellipse");
+  sPutAttrib(ctxcanvas, "cx", xc);
+  sPutAttrib(ctxcanvas, "cy", yc);
+  sPutAttrib(ctxcanvas, "rx", w/2);
+  sPutAttrib(ctxcanvas, "ry", h/2);
+  sEndElement(ctxcanvas, style);
+}
+
+static void sWriteArc(cdCtxCanvas *ctxcanvas, const double* center, double arcStartX, double arcStartY, double w, double h, int largeArc, 
+                      double arcEndX, double arcEndY, int close, const char* style)
+{
+  cdStream* stream = ctxcanvas->stream;
+
+  cdStreamPutString(stream, "<path d=\"M");
+  if (center)
+  {
+    sPutPair(ctxcanvas, center[0], center[1]);
+    cdStreamPutString(stream, " L");
+  }
+  sPutPair(ctxcanvas, arcStartX, arcStartY);
+  cdStreamPutString(stream, " A");
+  sPutPair(ctxcanvas, w/2, h/2);
+  cdStreamPutString(stream, largeArc? " 0 1,0 ": " 0 0,0 ");
+  sPutPair(ctxcanvas, arcEndX, arcEndY);
+  if (close)
+    cdStreamPutString(stream, " Z");
+  cdStreamPutChar(stream, '"');
+  sEndElement(ctxcanvas, style);
+}
+
 static void cdfarc(cdCtxCanvas *ctxcanvas, double xc, double yc, double w, double h, double a1, double a2)
 {
   double arcStartX, arcStartY, arcEndX, arcEndY;
@@ -259,15 +646,13 @@ static void cdfarc(cdCtxCanvas *ctxcanvas, double xc, double yc, double w, doubl
 
   if((a1 == 0.0) && (a2 == 360.0)) /* an ellipse/circle */
   {
-    fprintf(ctxcanvas->file, "<ellipse cx=\"%g\" cy=\"%g\" rx=\"%g\" ry=\"%g\" style=\"fill:none; stroke:%s; stroke-width:%d; stroke-linecap:%s; stroke-linejoin:%s; stroke-dasharray:%s; opacity:%g\" />\n",
-      xc, yc, w/2, h/2, ctxcanvas->fgColor, ctxcanvas->canvas->line_width, ctxcanvas->linecap, ctxcanvas->linejoin, ctxcanvas->linestyle, ctxcanvas->opacity);
+    sWriteEllipse(ctxcanvas, xc, yc, w, h, sStyleAttrib(ctxcanvas, 0, 1, NULL));
     return;
   }
 
   sCalcArc(ctxcanvas->canvas, xc, yc, w, h, a1, a2, &arcStartX, &arcStartY, &arcEndX, &arcEndY, &largeArc, 1);
 
-  fprintf(ctxcanvas->file, "<path d=\"M%g,%g A%g,%g 0 %d,0 %g,%g\" style=\"fill:none; stroke:%s; stroke-width:%d; stroke-linecap:%s; stroke-linejoin:%s; stroke-dasharray:%s; opacity:%g\" />\n",
-    arcStartX, arcStartY, w/2, h/2, largeArc, arcEndX, arcEndY, ctxcanvas->fgColor, ctxcanvas->canvas->line_width, ctxcanvas->linecap, ctxcanvas->linejoin, ctxcanvas->linestyle, ctxcanvas->opacity);
+  sWriteArc(ctxcanvas, NULL, arcStartX, arcStartY, w, h, largeArc, arcEndX, arcEndY, 0, sStyleAttrib(ctxcanvas, 0, 1, NULL));
 }
 
 static void cdarc(cdCtxCanvas *ctxcanvas, int xc, int yc, int w, int h, double a1, double a2)
@@ -277,20 +662,20 @@ static void cdarc(cdCtxCanvas *ctxcanvas, int xc, int yc, int w, int h, double a
 
 static void cdfsector(cdCtxCanvas *ctxcanvas, double xc, double yc, double w, double h, double a1, double a2)
 {
-  double arcStartX, arcStartY, arcEndX, arcEndY;
+  double arcStartX, arcStartY, arcEndX, arcEndY, center[2];
   int largeArc;
 
   if((a1 == 0.0) && (a2 == 360.0)) /* an ellipse/circle */
   {
-    fprintf(ctxcanvas->file, "<ellipse cx=\"%g\" cy=\"%g\" rx=\"%g\" ry=\"%g\" style=\"fill:%s; stroke:none; opacity:%g\" />\n",
-            xc, yc, w/2, h/2, (ctxcanvas->canvas->interior_style == CD_SOLID) ? ctxcanvas->fgColor: ctxcanvas->pattern, ctxcanvas->opacity);
+    sWriteEllipse(ctxcanvas, xc, yc, w, h, sStyleAttrib(ctxcanvas, 1, 0, NULL));
     return;
   }
 
   sCalcArc(ctxcanvas->canvas, xc, yc, w, h, a1, a2, &arcStartX, &arcStartY, &arcEndX, &arcEndY, &largeArc, 1);
 
-  fprintf(ctxcanvas->file, "<path d=\"M%g,%g L%g,%g A%g,%g 0 %d,0 %g,%g Z\" style=\"fill:%s; stroke:none; opacity:%g\" />\n",
-          xc, yc, arcStartX, arcStartY, w/2, h/2, largeArc, arcEndX, arcEndY, (ctxcanvas->canvas->interior_style == CD_SOLID) ? ctxcanvas->fgColor: ctxcanvas->pattern, ctxcanvas->opacity);
+  center[0] = xc;
+  center[1] = yc;
+  sWriteArc(ctxcanvas, center, arcStartX, arcStartY, w, h, largeArc, arcEndX, arcEndY, 1, sStyleAttrib(ctxcanvas, 1, 0, NULL));
 }
 
 static void cdsector(cdCtxCanvas *ctxcanvas, int xc, int yc, int w, int h, double a1, double a2)
@@ -305,8 +690,7 @@ static void cdfchord(cdCtxCanvas *ctxcanvas, double xc, double yc, double w, dou
 
   sCalcArc(ctxcanvas->canvas, xc, yc, w, h, a1, a2, &arcStartX, &arcStartY, &arcEndX, &arcEndY, &largeArc, 1);
 
-  fprintf(ctxcanvas->file, "<path d=\"M%g,%g A%g,%g 0 %d,0 %g,%g Z\" style=\"fill:%s; stroke:none; opacity:%g\" />\n",
-          arcStartX, arcStartY, w/2, h/2, largeArc, arcEndX, arcEndY, (ctxcanvas->canvas->interior_style == CD_SOLID) ? ctxcanvas->fgColor: ctxcanvas->pattern, ctxcanvas->opacity);
+  sWriteArc(ctxcanvas, NULL, arcStartX, arcStartY, w, h, largeArc, arcEndX, arcEndY, 1, sStyleAttrib(ctxcanvas, 1, 0, NULL));
 }
 
 static void cdchord(cdCtxCanvas *ctxcanvas, int xc, int yc, int w, int h, double a1, double a2)
@@ -378,26 +762,29 @@ static void cdftext(cdCtxCanvas *ctxcanvas, double x, double y, const char *text
     double text_sin = sin(ctxcanvas->canvas->text_orientation*CD_DEG2RAD);
 
     if (ctxcanvas->canvas->use_matrix)  /* Transformation active */
-      fprintf(ctxcanvas->file, "<text transform=\"matrix(%g %g %g %g %g %g)\" font-family=\"%s\" font-size=\"%s\" font-style=\"%s\" font-weight=\"%s\" text-decoration=\"%s\" text-anchor=\"%s\" dominant-baseline=\"%s\" fill=\"%s\">\n", 
+      cdStreamPrintf(ctxcanvas->stream, "<text transform=\"matrix(%g %g %g %g %g %g)\" font-family=\"%s\" font-size=\"%s\" font-style=\"%s\" font-weight=\"%s\" text-decoration=\"%s\" text-anchor=\"%s\" dominant-baseline=\"%s\" fill=\"%s\">\n", 
          text_cos, text_sin, text_sin, -text_cos, x, y, ctxcanvas->font_family, ctxcanvas->font_size, ctxcanvas->font_style, ctxcanvas->font_weight, ctxcanvas->font_decoration, anchor, alignment, ctxcanvas->fgColor);
     else
-      fprintf(ctxcanvas->file, "<text transform=\"matrix(%g %g %g %g %g %g)\" font-family=\"%s\" font-size=\"%s\" font-style=\"%s\" font-weight=\"%s\" text-decoration=\"%s\" text-anchor=\"%s\" dominant-baseline=\"%s\" fill=\"%s\">\n", 
+      cdStreamPrintf(ctxcanvas->stream, "<text transform=\"matrix(%g %g %g %g %g %g)\" font-family=\"%s\" font-size=\"%s\" font-style=\"%s\" font-weight=\"%s\" text-decoration=\"%s\" text-anchor=\"%s\" dominant-baseline=\"%s\" fill=\"%s\">\n", 
          text_cos, -text_sin, text_sin, text_cos, x, y, ctxcanvas->font_family, ctxcanvas->font_size, ctxcanvas->font_style, ctxcanvas->font_weight, ctxcanvas->font_decoration, anchor, alignment, ctxcanvas->fgColor);
     
     for(i = 0; i < len; i++)
-      fprintf(ctxcanvas->file, "&#x%02X;", (unsigned char)text[i]);
+      cdStreamPrintf(ctxcanvas->stream, "&#x%02X;", (unsigned char)text[i]);
 
-    fprintf(ctxcanvas->file, "\n</text>\n");
+    cdStreamPrintf(ctxcanvas->stream, "\n</text>\n");
   }
   else
   {
-    fprintf(ctxcanvas->file, "<text x=\"%g\" y=\"%g\" font-family=\"%s\" font-size=\"%s\" font-style=\"%s\" font-weight=\"%s\" text-decoration=\"%s\" text-anchor=\"%s\" dominant-baseline=\"%s\" fill=\"%s\">\n", 
-      x, y, ctxcanvas->font_family, ctxcanvas->font_size, ctxcanvas->font_style, ctxcanvas->font_weight, ctxcanvas->font_decoration, anchor, alignment, ctxcanvas->fgColor);
+    cdStreamPutString(ctxcanvas->stream, "<text");
+    sPutAttrib(ctxcanvas, "x", x);
+    sPutAttrib(ctxcanvas, "y", y);
+    cdStreamPrintf(ctxcanvas->stream, " font-family=\"%s\" font-size=\"%s\" font-style=\"%s\" font-weight=\"%s\" text-decoration=\"%s\" text-anchor=\"%s\" dominant-baseline=\"%s\" fill=\"%s\">\n", 
+      ctxcanvas->font_family, ctxcanvas->font_size, ctxcanvas->font_style, ctxcanvas->font_weight, ctxcanvas->font_decoration, anchor, alignment, ctxcanvas->fgColor);
 
     for(i = 0; i < len; i++)
-      fprintf(ctxcanvas->file, "&#x%02X;", (unsigned char)text[i]);
+      cdStreamPrintf(ctxcanvas->stream, "&#x%02X;", (unsigned char)text[i]);
 
-    fprintf(ctxcanvas->file, "\n</text>\n");
+    cdStreamPrintf(ctxcanvas->stream, "\n</text>\n");
   }
 }
 
@@ -406,26 +793,122 @@ static void cdtext(cdCtxCanvas *ctxcanvas, int x, int y, const char *text, int l
   cdftext(ctxcanvas, (double)x, (double)y, text, len);
 }
 
+static void sWritePointF(cdCtxCanvas *ctxcanvas, double x, double y)
+{
+  sPutPair(ctxcanvas, x, y);
+  cdStreamPutChar(ctxcanvas->stream, ' ');
+}
+
+static void sWritePoint(cdStream* stream, int x, int y)
+{
+  cdStreamPutInt(stream, x);
+  cdStreamPutChar(stream, ',');
+  cdStreamPutInt(stream, y);
+  cdStreamPutChar(stream, ' ');
+}
+
 static void sWritePointsF(cdCtxCanvas *ctxcanvas, cdfPoint* poly, int n, int close)
 {
   int i;
   for(i = 0; i<n; i++)
-    fprintf(ctxcanvas->file, "%g,%g ", poly[i].x, poly[i].y);
+    sWritePointF(ctxcanvas, poly[i].x, poly[i].y);
   if (close)
-    fprintf(ctxcanvas->file, "%g,%g ", poly[0].x, poly[0].y);
+    sWritePointF(ctxcanvas, poly[0].x, poly[0].y);
 }
 
 static void sWritePoints(cdCtxCanvas *ctxcanvas, cdPoint* poly, int n, int close)
 {
   int i;
   for(i = 0; i<n; i++)
-    fprintf(ctxcanvas->file, "%d,%d ", poly[i].x, poly[i].y);
+    sWritePoint(ctxcanvas->stream, poly[i].x, poly[i].y);
   if (close)
-    fprintf(ctxcanvas->file, "%d,%d ", poly[0].x, poly[0].y);
+    sWritePoint(ctxcanvas->stream, poly[0].x, poly[0].y);
+}
+
+static void sWritePathF(cdCtxCanvas *ctxcanvas, cdfPoint* poly, int n, int mode, const char* style)
+{
+  int i;
+
+  cdStreamPutString(ctxcanvas->stream, "<path d=\"");
+  sPathBegin(ctxcanvas);
+  sPathMoveTo(ctxcanvas, poly[0].x, poly[0].y);
+
+  if (mode == CD_BEZIER)
+  {
+    for (i = 1; i+2 < n; i += 3)
+      sPathCurveTo(ctxcanvas, poly[i].x, poly[i].y, poly[i+1].x, poly[i+1].y, poly[i+2].x, poly[i+2].y);
+  }
+  else
+  {
+    for (i = 1; i < n; i++)
+      sPathLineTo(ctxcanvas, poly[i].x, poly[i].y);
+  }
+
+  if (mode == CD_CLOSED_LINES)
+    sPathClose(ctxcanvas);
+
+  cdStreamPutChar(ctxcanvas->stream, '"');
+  if (style)
+    sEndElement(ctxcanvas, style);
+  else
+    cdStreamPutString(ctxcanvas->stream, " />\n");
+}
+
+static void sWritePath(cdCtxCanvas *ctxcanvas, cdPoint* poly, int n, int mode, const char* style)
+{
+  int i;
+
+  cdStreamPutString(ctxcanvas->stream, "<path d=\"");
+  sPathBegin(ctxcanvas);
+  sPathMoveTo(ctxcanvas, poly[0].x, poly[0].y);
+
+  if (mode == CD_BEZIER)
+  {
+    for (i = 1; i+2 < n; i += 3)
+      sPathCurveTo(ctxcanvas, poly[i].x, poly[i].y, poly[i+1].x, poly[i+1].y, poly[i+2].x, poly[i+2].y);
+  }
+  else
+  {
+    for (i = 1; i < n; i++)
+      sPathLineTo(ctxcanvas, poly[i].x, poly[i].y);
+  }
+
+  if (mode == CD_CLOSED_LINES)
+    sPathClose(ctxcanvas);
+
+  cdStreamPutChar(ctxcanvas->stream, '"');
+  if (style)
+    sEndElement(ctxcanvas, style);
+  else
+    cdStreamPutString(ctxcanvas->stream, " />\n");
+}
+
+static void sPathStyles(cdCtxCanvas *ctxcanvas)
+{
+  /* the style classes must be defined before the path is started */
+  int p;
+  char* rule = (ctxcanvas->canvas->fill_mode==CD_EVENODD)? "evenodd": "nonzero";
+
+  for (p=0; p<ctxcanvas->canvas->path_n; p++)
+  {
+    switch(ctxcanvas->canvas->path[p])
+    {
+    case CD_PATH_FILL:
+      sStyleAttrib(ctxcanvas, 1, 0, rule);
+      break;
+    case CD_PATH_STROKE:
+      sStyleAttrib(ctxcanvas, 0, 1, NULL);
+      break;
+    case CD_PATH_FILLSTROKE:
+      sStyleAttrib(ctxcanvas, 1, 1, rule);
+      break;
+    }
+  }
 }
 
 static void cdfpoly(cdCtxCanvas *ctxcanvas, int mode, cdfPoint* poly, int n)
 {
+  const char* style;
   char* rule;
 
   if (mode == CD_PATH)
@@ -441,11 +924,15 @@ static void cdfpoly(cdCtxCanvas *ctxcanvas, int mode, cdfPoint* poly, int n)
       }
     }
 
+    if (ctxcanvas->style_class)
+      sPathStyles(ctxcanvas);
+
     if (clip_path)
-      fprintf(ctxcanvas->file, "<clipPath id=\"clippoly%d\">\n", ++ctxcanvas->last_clip_poly);
+      cdStreamPrintf(ctxcanvas->stream, "<clipPath id=\"clippoly%d\">\n", ++ctxcanvas->last_clip_poly);
 
     /* starts a new path */
-    fprintf(ctxcanvas->file, "<path d=\"");
+    cdStreamPrintf(ctxcanvas->stream, "<path d=\"");
+    sPathBegin(ctxcanvas);
     end_path = 0;
     current_set = 0;
 
@@ -456,21 +943,28 @@ static void cdfpoly(cdCtxCanvas *ctxcanvas, int mode, cdfPoint* poly, int n)
       {
       case CD_PATH_NEW:
         if (!end_path)
-          fprintf(ctxcanvas->file, "\" />\n");
+          cdStreamPrintf(ctxcanvas->stream, "\" />\n");
 
-        fprintf(ctxcanvas->file, "<path d=\"");
+        cdStreamPrintf(ctxcanvas->stream, "<path d=\"");
+        sPathBegin(ctxcanvas);
         end_path = 0;
         current_set = 0;
         break;
       case CD_PATH_MOVETO:
         if (i+1 > n) return;
-        fprintf(ctxcanvas->file, "M %g %g ", poly[i].x, poly[i].y);
+        if (ctxcanvas->relative_path)
+          sPathMoveTo(ctxcanvas, poly[i].x, poly[i].y);
+        else
+          cdStreamPrintf(ctxcanvas->stream, "M %g %g ", poly[i].x, poly[i].y);
         current_set = 1;
         i++;
         break;
       case CD_PATH_LINETO:
         if (i+1 > n) return;
-        fprintf(ctxcanvas->file, "L %g %g ", poly[i].x, poly[i].y);
+        if (ctxcanvas->relative_path)
+          sPathLineTo(ctxcanvas, poly[i].x, poly[i].y);
+        else
+          cdStreamPrintf(ctxcanvas->stream, "L %g %g ", poly[i].x, poly[i].y);
         current_set = 1;
         i++;
         break;
@@ -490,11 +984,19 @@ static void cdfpoly(cdCtxCanvas *ctxcanvas, int mode, cdfPoint* poly, int n)
           if (ctxcanvas->canvas->invert_yaxis && (a2-a1)<0) /* can be clockwise */
             sweep = 1;
 
-          if (current_set)
-            fprintf(ctxcanvas->file, "L %g %g A %g %g 0 %d %d %g %g ",
+          if (ctxcanvas->relative_path)
+          {
+            if (current_set)
+              sPathLineTo(ctxcanvas, arcStartX, arcStartY);
+            else
+              sPathMoveTo(ctxcanvas, arcStartX, arcStartY);
+            sPathArcTo(ctxcanvas, w/2.0, h/2.0, largeArc, sweep, arcEndX, arcEndY);
+          }
+          else if (current_set)
+            cdStreamPrintf(ctxcanvas->stream, "L %g %g A %g %g 0 %d %d %g %g ",
                     arcStartX, arcStartY, w/2, h/2, largeArc, sweep, arcEndX, arcEndY);
           else
-            fprintf(ctxcanvas->file, "M %g %g A %g %g 0 %d %d %g %g ",
+            cdStreamPrintf(ctxcanvas->stream, "M %g %g A %g %g 0 %d %d %g %g ",
                     arcStartX, arcStartY, w/2, h/2, largeArc, sweep, arcEndX, arcEndY);
 
           current_set = 1;
@@ -503,35 +1005,38 @@ static void cdfpoly(cdCtxCanvas *ctxcanvas, int mode, cdfPoint* poly, int n)
         break;
       case CD_PATH_CURVETO:
         if (i+3 > n) return;
-        fprintf(ctxcanvas->file, "C %g %g %g %g %g %g ", poly[i].x,   poly[i].y, 
-                                                         poly[i+1].x, poly[i+1].y, 
-                                                         poly[i+2].x, poly[i+2].y);
+        if (ctxcanvas->relative_path)
+          sPathCurveTo(ctxcanvas, poly[i].x, poly[i].y, poly[i+1].x, poly[i+1].y, poly[i+2].x, poly[i+2].y);
+        else
+          cdStreamPrintf(ctxcanvas->stream, "C %g %g %g %g %g %g ", poly[i].x,   poly[i].y, 
+                                                           poly[i+1].x, poly[i+1].y, 
+                                                           poly[i+2].x, poly[i+2].y);
         current_set = 1;
         i += 3;
         break;
       case CD_PATH_CLOSE:
-        fprintf(ctxcanvas->file, "Z ");
+        if (ctxcanvas->relative_path)
+          sPathClose(ctxcanvas);
+        else
+          cdStreamPrintf(ctxcanvas->stream, "Z ");
         break;
       case CD_PATH_FILL:
         rule = (ctxcanvas->canvas->fill_mode==CD_EVENODD)? "evenodd": "nonzero";
-        fprintf(ctxcanvas->file, "\" style=\"fill:%s; fill-rule:%s; stroke:none; opacity:%g\" />\n",
-                (ctxcanvas->canvas->interior_style == CD_SOLID) ? ctxcanvas->fgColor: ctxcanvas->pattern, rule, ctxcanvas->opacity);
+        cdStreamPrintf(ctxcanvas->stream, "\" %s />\n", sStyleAttrib(ctxcanvas, 1, 0, rule));
         end_path = 1;
         break;
       case CD_PATH_STROKE:
-        fprintf(ctxcanvas->file, "\" style=\"fill:none; stroke:%s; stroke-width:%d; stroke-linecap:%s; stroke-linejoin:%s; stroke-dasharray:%s; opacity:%g\" />\n",
-                ctxcanvas->fgColor, ctxcanvas->canvas->line_width, ctxcanvas->linecap, ctxcanvas->linejoin, ctxcanvas->linestyle, ctxcanvas->opacity);
+        cdStreamPrintf(ctxcanvas->stream, "\" %s />\n", sStyleAttrib(ctxcanvas, 0, 1, NULL));
         end_path = 1;
         break;
       case CD_PATH_FILLSTROKE:
         rule = (ctxcanvas->canvas->fill_mode==CD_EVENODD)? "evenodd": "nonzero";
-        fprintf(ctxcanvas->file, "\" style=\"fill:%s; fill-rule:%s; stroke:%s; stroke-width:%d; stroke-linecap:%s; stroke-linejoin:%s; stroke-dasharray:%s; opacity:%g\" />\n",
-                (ctxcanvas->canvas->interior_style == CD_SOLID) ? ctxcanvas->fgColor: ctxcanvas->pattern, rule, ctxcanvas->fgColor, ctxcanvas->canvas->line_width, ctxcanvas->linecap, ctxcanvas->linejoin, ctxcanvas->linestyle, ctxcanvas->opacity);
+        cdStreamPrintf(ctxcanvas->stream, "\" %s />\n", sStyleAttrib(ctxcanvas, 1, 1, rule));
         end_path = 1;
         break;
       case CD_PATH_CLIP:
-        fprintf(ctxcanvas->file, "\" />\n");
-        fprintf(ctxcanvas->file, "</clipPath>\n");
+        cdStreamPrintf(ctxcanvas->stream, "\" />\n");
+        cdStreamPrintf(ctxcanvas->stream, "</clipPath>\n");
         ctxcanvas->clip_polygon = 1;
         cdclip(ctxcanvas, CD_CLIPPOLYGON);
         end_path = 1;
@@ -544,22 +1049,39 @@ static void cdfpoly(cdCtxCanvas *ctxcanvas, int mode, cdfPoint* poly, int n)
   switch (mode)
   {
   case CD_CLOSED_LINES:
-    fprintf(ctxcanvas->file, "<polygon style=\"fill:none; stroke:%s; stroke-width:%d; stroke-linecap:%s; stroke-linejoin:%s; stroke-dasharray:%s; opacity:%g\" points=\"",
-            ctxcanvas->fgColor, ctxcanvas->canvas->line_width, ctxcanvas->linecap, ctxcanvas->linejoin, ctxcanvas->linestyle, ctxcanvas->opacity);
+    style = sStyleAttrib(ctxcanvas, 0, 1, NULL);
+    if (ctxcanvas->relative_path)
+    {
+      sWritePathF(ctxcanvas, poly, n, mode, style);
+      break;
+    }
+    cdStreamPrintf(ctxcanvas->stream, "<polygon %s points=\"", style);
     sWritePointsF(ctxcanvas, poly, n, 1);
-    fprintf(ctxcanvas->file, "\" />\n");
+    cdStreamPrintf(ctxcanvas->stream, "\" />\n");
     break;
   case CD_OPEN_LINES:
-    fprintf(ctxcanvas->file, "<polyline style=\"fill:none; stroke:%s; stroke-width:%d; stroke-linecap:%s; stroke-linejoin:%s; stroke-dasharray:%s; opacity:%g\" points=\"",
-            ctxcanvas->fgColor, ctxcanvas->canvas->line_width, ctxcanvas->linecap, ctxcanvas->linejoin, ctxcanvas->linestyle, ctxcanvas->opacity);
+    style = sStyleAttrib(ctxcanvas, 0, 1, NULL);
+    if (ctxcanvas->relative_path)
+    {
+      sWritePathF(ctxcanvas, poly, n, mode, style);
+      break;
+    }
+    cdStreamPrintf(ctxcanvas->stream, "<polyline %s points=\"", style);
     sWritePointsF(ctxcanvas, poly, n, 0);
-    fprintf(ctxcanvas->file, "\" />\n");
+    cdStreamPrintf(ctxcanvas->stream, "\" />\n");
     break;
   case CD_BEZIER:
-    fprintf(ctxcanvas->file, "<path d=\"M%g,%g C", poly[0].x, poly[0].y);
+    style = sStyleAttrib(ctxcanvas, 0, 1, NULL);
+    if (ctxcanvas->relative_path)
+    {
+      sWritePathF(ctxcanvas, poly, n, mode, style);
+      break;
+    }
+    cdStreamPutString(ctxcanvas->stream, "<path d=\"M");
+    sPutPair(ctxcanvas, poly[0].x, poly[0].y);
+    cdStreamPutString(ctxcanvas->stream, " C");
     sWritePointsF(ctxcanvas, poly+1, n-1, 0);
-    fprintf(ctxcanvas->file, "\" style=\"fill:none; stroke:%s; stroke-width:%d; stroke-linecap:%s; stroke-linejoin:%s; stroke-dasharray:%s; opacity:%g\" />\n",
-            ctxcanvas->fgColor, ctxcanvas->canvas->line_width, ctxcanvas->linecap, ctxcanvas->linejoin, ctxcanvas->linestyle, ctxcanvas->opacity);
+    cdStreamPrintf(ctxcanvas->stream, "\" %s />\n", style);
     break;
   case CD_FILL:
     if(ctxcanvas->canvas->fill_mode==CD_EVENODD)
@@ -567,19 +1089,29 @@ static void cdfpoly(cdCtxCanvas *ctxcanvas, int mode, cdfPoint* poly, int n)
     else
       rule = "nonzero";
 
-    fprintf(ctxcanvas->file, "<polygon style=\"fill:%s; fill-rule:%s; stroke:none; opacity:%g\" points=\"",
-            (ctxcanvas->canvas->interior_style == CD_SOLID) ? ctxcanvas->fgColor: ctxcanvas->pattern, rule, ctxcanvas->opacity);
+    style = sStyleAttrib(ctxcanvas, 1, 0, rule);
+    if (ctxcanvas->relative_path)
+    {
+      sWritePathF(ctxcanvas, poly, n, mode, style);
+      break;
+    }
+    cdStreamPrintf(ctxcanvas->stream, "<polygon %s points=\"", style);
     sWritePointsF(ctxcanvas, poly, n, 0);
-    fprintf(ctxcanvas->file, "\" />\n");
+    cdStreamPrintf(ctxcanvas->stream, "\" />\n");
     break;
   case CD_CLIP:
-    fprintf(ctxcanvas->file, "<clipPath id=\"clippoly%d\">\n", ++ctxcanvas->last_clip_poly);
+    cdStreamPrintf(ctxcanvas->stream, "<clipPath id=\"clippoly%d\">\n", ++ctxcanvas->last_clip_poly);
 
-    fprintf(ctxcanvas->file, "<polygon points=\"");
-    sWritePointsF(ctxcanvas, poly, n, 0);
-    fprintf(ctxcanvas->file, "\" />\n");
+    if (ctxcanvas->relative_path)
+      sWritePathF(ctxcanvas, poly, n, mode, NULL);
+    else
+    {
+      cdStreamPrintf(ctxcanvas->stream, "<polygon points=\"");
+      sWritePointsF(ctxcanvas, poly, n, 0);
+      cdStreamPrintf(ctxcanvas->stream, "\" />\n");
+    }
 
-    fprintf(ctxcanvas->file, "</clipPath>\n");
+    cdStreamPrintf(ctxcanvas->stream, "</clipPath>\n");
     
     ctxcanvas->clip_polygon = 1;
 
@@ -593,6 +1125,7 @@ static void cdfpoly(cdCtxCanvas *ctxcanvas, int mode, cdfPoint* poly, int n)
 
 static void cdpoly(cdCtxCanvas *ctxcanvas, int mode, cdPoint* poly, int n)
 {
+  const char* style;
   char* rule;
 
   if (mode == CD_PATH)
@@ -608,11 +1141,15 @@ static void cdpoly(cdCtxCanvas *ctxcanvas, int mode, cdPoint* poly, int n)
       }
     }
 
+    if (ctxcanvas->style_class)
+      sPathStyles(ctxcanvas);
+
     if (clip_path)
-      fprintf(ctxcanvas->file, "<clipPath id=\"clippoly%d\">\n", ++ctxcanvas->last_clip_poly);
+      cdStreamPrintf(ctxcanvas->stream, "<clipPath id=\"clippoly%d\">\n", ++ctxcanvas->last_clip_poly);
 
     /* starts a new path */
-    fprintf(ctxcanvas->file, "<path d=\"");
+    cdStreamPrintf(ctxcanvas->stream, "<path d=\"");
+    sPathBegin(ctxcanvas);
     end_path = 0;
     current_set = 0;
 
@@ -623,21 +1160,28 @@ static void cdpoly(cdCtxCanvas *ctxcanvas, int mode, cdPoint* poly, int n)
       {
       case CD_PATH_NEW:
         if (!end_path)
-          fprintf(ctxcanvas->file, "\" />\n");
+          cdStreamPrintf(ctxcanvas->stream, "\" />\n");
 
-        fprintf(ctxcanvas->file, "<path d=\"");
+        cdStreamPrintf(ctxcanvas->stream, "<path d=\"");
+        sPathBegin(ctxcanvas);
         end_path = 0;
         current_set = 0;
         break;
       case CD_PATH_MOVETO:
         if (i+1 > n) return;
-        fprintf(ctxcanvas->file, "M %d %d ", poly[i].x, poly[i].y);
+        if (ctxcanvas->relative_path)
+          sPathMoveTo(ctxcanvas, poly[i].x, poly[i].y);
+        else
+          cdStreamPrintf(ctxcanvas->stream, "M %d %d ", poly[i].x, poly[i].y);
         current_set = 1;
         i++;
         break;
       case CD_PATH_LINETO:
         if (i+1 > n) return;
-        fprintf(ctxcanvas->file, "L %d %d ", poly[i].x, poly[i].y);
+        if (ctxcanvas->relative_path)
+          sPathLineTo(ctxcanvas, poly[i].x, poly[i].y);
+        else
+          cdStreamPrintf(ctxcanvas->stream, "L %d %d ", poly[i].x, poly[i].y);
         current_set = 1;
         i++;
         break;
@@ -658,11 +1202,19 @@ static void cdpoly(cdCtxCanvas *ctxcanvas, int mode, cdPoint* poly, int n)
           if (ctxcanvas->canvas->invert_yaxis && (a2-a1)<0) /* can be clockwise */
             sweep = 1;
 
-          if (current_set)
-            fprintf(ctxcanvas->file, "L %g %g A %d %d 0 %d %d %g %g ",
+          if (ctxcanvas->relative_path)
+          {
+            if (current_set)
+              sPathLineTo(ctxcanvas, arcStartX, arcStartY);
+            else
+              sPathMoveTo(ctxcanvas, arcStartX, arcStartY);
+            sPathArcTo(ctxcanvas, w/2.0, h/2.0, largeArc, sweep, arcEndX, arcEndY);
+          }
+          else if (current_set)
+            cdStreamPrintf(ctxcanvas->stream, "L %g %g A %d %d 0 %d %d %g %g ",
                     arcStartX, arcStartY, w/2, h/2, largeArc, sweep, arcEndX, arcEndY);
           else
-            fprintf(ctxcanvas->file, "M %g %g A %d %d 0 %d %d %g %g ",
+            cdStreamPrintf(ctxcanvas->stream, "M %g %g A %d %d 0 %d %d %g %g ",
                     arcStartX, arcStartY, w/2, h/2, largeArc, sweep, arcEndX, arcEndY);
 
           current_set = 1;
@@ -671,35 +1223,38 @@ static void cdpoly(cdCtxCanvas *ctxcanvas, int mode, cdPoint* poly, int n)
         break;
       case CD_PATH_CURVETO:
         if (i+3 > n) return;
-        fprintf(ctxcanvas->file, "C %d %d %d %d %d %d ", poly[i].x,   poly[i].y, 
-                                                         poly[i+1].x, poly[i+1].y, 
-                                                         poly[i+2].x, poly[i+2].y);
+        if (ctxcanvas->relative_path)
+          sPathCurveTo(ctxcanvas, poly[i].x, poly[i].y, poly[i+1].x, poly[i+1].y, poly[i+2].x, poly[i+2].y);
+        else
+          cdStreamPrintf(ctxcanvas->stream, "C %d %d %d %d %d %d ", poly[i].x,   poly[i].y, 
+                                                           poly[i+1].x, poly[i+1].y, 
+                                                           poly[i+2].x, poly[i+2].y);
         current_set = 1;
         i += 3;
         break;
       case CD_PATH_CLOSE:
-        fprintf(ctxcanvas->file, "Z ");
+        if (ctxcanvas->relative_path)
+          sPathClose(ctxcanvas);
+        else
+          cdStreamPrintf(ctxcanvas->stream, "Z ");
         break;
       case CD_PATH_FILL:
         rule = (ctxcanvas->canvas->fill_mode==CD_EVENODD)? "evenodd": "nonzero";
-        fprintf(ctxcanvas->file, "\" style=\"fill:%s; fill-rule:%s; stroke:none; opacity:%g\" />\n",
-                (ctxcanvas->canvas->interior_style == CD_SOLID) ? ctxcanvas->fgColor: ctxcanvas->pattern, rule, ctxcanvas->opacity);
+        cdStreamPrintf(ctxcanvas->stream, "\" %s />\n", sStyleAttrib(ctxcanvas, 1, 0, rule));
         end_path = 1;
         break;
       case CD_PATH_STROKE:
-        fprintf(ctxcanvas->file, "\" style=\"fill:none; stroke:%s; stroke-width:%d; stroke-linecap:%s; stroke-linejoin:%s; stroke-dasharray:%s; opacity:%g\" />\n",
-                ctxcanvas->fgColor, ctxcanvas->canvas->line_width, ctxcanvas->linecap, ctxcanvas->linejoin, ctxcanvas->linestyle, ctxcanvas->opacity);
+        cdStreamPrintf(ctxcanvas->stream, "\" %s />\n", sStyleAttrib(ctxcanvas, 0, 1, NULL));
         end_path = 1;
         break;
       case CD_PATH_FILLSTROKE:
         rule = (ctxcanvas->canvas->fill_mode==CD_EVENODD)? "evenodd": "nonzero";
-        fprintf(ctxcanvas->file, "\" style=\"fill:%s; fill-rule:%s; stroke:%s; stroke-width:%d; stroke-linecap:%s; stroke-linejoin:%s; stroke-dasharray:%s; opacity:%g\" />\n",
-                (ctxcanvas->canvas->interior_style == CD_SOLID) ? ctxcanvas->fgColor: ctxcanvas->pattern, rule, ctxcanvas->fgColor, ctxcanvas->canvas->line_width, ctxcanvas->linecap, ctxcanvas->linejoin, ctxcanvas->linestyle, ctxcanvas->opacity);
+        cdStreamPrintf(ctxcanvas->stream, "\" %s />\n", sStyleAttrib(ctxcanvas, 1, 1, rule));
         end_path = 1;
         break;
       case CD_PATH_CLIP:
-        fprintf(ctxcanvas->file, "\" />\n");
-        fprintf(ctxcanvas->file, "</clipPath>\n");
+        cdStreamPrintf(ctxcanvas->stream, "\" />\n");
+        cdStreamPrintf(ctxcanvas->stream, "</clipPath>\n");
         ctxcanvas->clip_polygon = 1;
         cdclip(ctxcanvas, CD_CLIPPOLYGON);
         end_path = 1;
@@ -712,22 +1267,37 @@ static void cdpoly(cdCtxCanvas *ctxcanvas, int mode, cdPoint* poly, int n)
   switch (mode)
   {
   case CD_CLOSED_LINES:
-    fprintf(ctxcanvas->file, "<polygon style=\"fill:none; stroke:%s; stroke-width:%d; stroke-linecap:%s; stroke-linejoin:%s; stroke-dasharray:%s; opacity:%g\" points=\"",
-            ctxcanvas->fgColor, ctxcanvas->canvas->line_width, ctxcanvas->linecap, ctxcanvas->linejoin, ctxcanvas->linestyle, ctxcanvas->opacity);
+    style = sStyleAttrib(ctxcanvas, 0, 1, NULL);
+    if (ctxcanvas->relative_path)
+    {
+      sWritePath(ctxcanvas, poly, n, mode, style);
+      break;
+    }
+    cdStreamPrintf(ctxcanvas->stream, "<polygon %s points=\"", style);
     sWritePoints(ctxcanvas, poly, n, 1);
-    fprintf(ctxcanvas->file, "\" />\n");
+    cdStreamPrintf(ctxcanvas->stream, "\" />\n");
     break;
   case CD_OPEN_LINES:
-    fprintf(ctxcanvas->file, "<polyline style=\"fill:none; stroke:%s; stroke-width:%d; stroke-linecap:%s; stroke-linejoin:%s; stroke-dasharray:%s; opacity:%g\" points=\"",
-            ctxcanvas->fgColor, ctxcanvas->canvas->line_width, ctxcanvas->linecap, ctxcanvas->linejoin, ctxcanvas->linestyle, ctxcanvas->opacity);
+    style = sStyleAttrib(ctxcanvas, 0, 1, NULL);
+    if (ctxcanvas->relative_path)
+    {
+      sWritePath(ctxcanvas, poly, n, mode, style);
+      break;
+    }
+    cdStreamPrintf(ctxcanvas->stream, "<polyline %s points=\"", style);
     sWritePoints(ctxcanvas, poly, n, 0);
-    fprintf(ctxcanvas->file, "\" />\n");
+    cdStreamPrintf(ctxcanvas->stream, "\" />\n");
     break;
   case CD_BEZIER:
-    fprintf(ctxcanvas->file, "<path d=\"M%d,%d C", poly[0].x, poly[0].y);
+    style = sStyleAttrib(ctxcanvas, 0, 1, NULL);
+    if (ctxcanvas->relative_path)
+    {
+      sWritePath(ctxcanvas, poly, n, mode, style);
+      break;
+    }
+    cdStreamPrintf(ctxcanvas->stream, "<path d=\"M%d,%d C", poly[0].x, poly[0].y);
     sWritePoints(ctxcanvas, poly+1, n-1, 0);
-    fprintf(ctxcanvas->file, "\" style=\"fill:none; stroke:%s; stroke-width:%d; stroke-linecap:%s; stroke-linejoin:%s; stroke-dasharray:%s; opacity:%g\" />\n",
-            ctxcanvas->fgColor, ctxcanvas->canvas->line_width, ctxcanvas->linecap, ctxcanvas->linejoin, ctxcanvas->linestyle, ctxcanvas->opacity);
+    cdStreamPrintf(ctxcanvas->stream, "\" %s />\n", style);
     break;
   case CD_FILL:
     if(ctxcanvas->canvas->fill_mode==CD_EVENODD)
@@ -735,19 +1305,29 @@ static void cdpoly(cdCtxCanvas *ctxcanvas, int mode, cdPoint* poly, int n)
     else
       rule = "nonzero";
 
-    fprintf(ctxcanvas->file, "<polygon style=\"fill:%s; fill-rule:%s; stroke:none; opacity:%g\" points=\"",
-            (ctxcanvas->canvas->interior_style == CD_SOLID) ? ctxcanvas->fgColor: ctxcanvas->pattern, rule, ctxcanvas->opacity);
+    style = sStyleAttrib(ctxcanvas, 1, 0, rule);
+    if (ctxcanvas->relative_path)
+    {
+      sWritePath(ctxcanvas, poly, n, mode, style);
+      break;
+    }
+    cdStreamPrintf(ctxcanvas->stream, "<polygon %s points=\"", style);
     sWritePoints(ctxcanvas, poly, n, 0);
-    fprintf(ctxcanvas->file, "\" />\n");
+    cdStreamPrintf(ctxcanvas->stream, "\" />\n");
     break;
   case CD_CLIP:
-    fprintf(ctxcanvas->file, "<clipPath id=\"clippoly%d\">\n", ++ctxcanvas->last_clip_poly);
+    cdStreamPrintf(ctxcanvas->stream, "<clipPath id=\"clippoly%d\">\n", ++ctxcanvas->last_clip_poly);
 
-    fprintf(ctxcanvas->file, "<polygon points=\"");
-    sWritePoints(ctxcanvas, poly, n, 0);
-    fprintf(ctxcanvas->file, "\" />\n");
+    if (ctxcanvas->relative_path)
+      sWritePath(ctxcanvas, poly, n, mode, NULL);
+    else
+    {
+      cdStreamPrintf(ctxcanvas->stream, "<polygon points=\"");
+      sWritePoints(ctxcanvas, poly, n, 0);
+      cdStreamPrintf(ctxcanvas->stream, "\" />\n");
+    }
 
-    fprintf(ctxcanvas->file, "</clipPath>\n");
+    cdStreamPrintf(ctxcanvas->stream, "</clipPath>\n");
     
     ctxcanvas->clip_polygon = 1;
 
@@ -821,47 +1401,47 @@ static int cdhatch(cdCtxCanvas *ctxcanvas, int style)
   int hhalf = hsize / 2;
 
   sprintf(ctxcanvas->pattern, "url(#pattern%d)", ++ctxcanvas->last_fill_mode);
-  fprintf(ctxcanvas->file, "<pattern id=\"pattern%d\" patternUnits=\"userSpaceOnUse\" x=\"0\" y=\"0\" width=\"%d\" height=\"%d\">\n", ctxcanvas->last_fill_mode, hsize, hsize);
+  cdStreamPrintf(ctxcanvas->stream, "<pattern id=\"pattern%d\" patternUnits=\"userSpaceOnUse\" x=\"0\" y=\"0\" width=\"%d\" height=\"%d\">\n", ctxcanvas->last_fill_mode, hsize, hsize);
 
   if (ctxcanvas->canvas->back_opacity==CD_OPAQUE)
   {
-    fprintf(ctxcanvas->file, "<rect x=\"0\" y=\"0\" width=\"%d\" height=\"%d\" style=\"fill:%s; stroke:none; opacity:%g\" />\n",
+    cdStreamPrintf(ctxcanvas->stream, "<rect x=\"0\" y=\"0\" width=\"%d\" height=\"%d\" style=\"fill:%s; stroke:none; opacity:%g\" />\n",
             hsize, hsize, ctxcanvas->bgColor, ctxcanvas->opacity);
   }
 
   switch(style)
   {
   case CD_HORIZONTAL:
-    fprintf(ctxcanvas->file, "<line x1=\"%d\" y1=\"%d\" x2=\"%d\" y2=\"%d\" style=\"fill:none; stroke:%s; opacity:%g\" />\n",
+    cdStreamPrintf(ctxcanvas->stream, "<line x1=\"%d\" y1=\"%d\" x2=\"%d\" y2=\"%d\" style=\"fill:none; stroke:%s; opacity:%g\" />\n",
       0, hhalf, hsize, hhalf, ctxcanvas->fgColor, ctxcanvas->opacity);
     break;
   case CD_VERTICAL:
-    fprintf(ctxcanvas->file, "<line x1=\"%d\" y1=\"%d\" x2=\"%d\" y2=\"%d\" style=\"fill:none; stroke:%s; opacity:%g\" />\n",
+    cdStreamPrintf(ctxcanvas->stream, "<line x1=\"%d\" y1=\"%d\" x2=\"%d\" y2=\"%d\" style=\"fill:none; stroke:%s; opacity:%g\" />\n",
       hhalf, 0, hhalf, hsize, ctxcanvas->fgColor, ctxcanvas->opacity);
     break;
   case CD_BDIAGONAL:
-    fprintf(ctxcanvas->file, "<line x1=\"%d\" y1=\"%d\" x2=\"%d\" y2=\"%d\" style=\"fill:none; stroke:%s; opacity:%g\" />\n",
+    cdStreamPrintf(ctxcanvas->stream, "<line x1=\"%d\" y1=\"%d\" x2=\"%d\" y2=\"%d\" style=\"fill:none; stroke:%s; opacity:%g\" />\n",
       0, hsize, hsize, 0, ctxcanvas->fgColor, ctxcanvas->opacity);
     break;
   case CD_FDIAGONAL:
-    fprintf(ctxcanvas->file, "<line x1=\"%d\" y1=\"%d\" x2=\"%d\" y2=\"%d\" style=\"fill:none; stroke:%s; opacity:%g\" />\n",
+    cdStreamPrintf(ctxcanvas->stream, "<line x1=\"%d\" y1=\"%d\" x2=\"%d\" y2=\"%d\" style=\"fill:none; stroke:%s; opacity:%g\" />\n",
       0, 0, hsize, hsize, ctxcanvas->fgColor, ctxcanvas->opacity);
     break;
   case CD_CROSS:
-    fprintf(ctxcanvas->file, "<line x1=\"%d\" y1=\"%d\" x2=\"%d\" y2=\"%d\" style=\"fill:none; stroke:%s; opacity:%g\" />\n",
+    cdStreamPrintf(ctxcanvas->stream, "<line x1=\"%d\" y1=\"%d\" x2=\"%d\" y2=\"%d\" style=\"fill:none; stroke:%s; opacity:%g\" />\n",
       hsize, 0, hsize, hsize, ctxcanvas->fgColor, ctxcanvas->opacity);
-    fprintf(ctxcanvas->file, "<line x1=\"%d\" y1=\"%d\" x2=\"%d\" y2=\"%d\" style=\"fill:none; stroke:%s; opacity:%g\" />\n",
+    cdStreamPrintf(ctxcanvas->stream, "<line x1=\"%d\" y1=\"%d\" x2=\"%d\" y2=\"%d\" style=\"fill:none; stroke:%s; opacity:%g\" />\n",
       0, hhalf, hsize, hhalf, ctxcanvas->fgColor, ctxcanvas->opacity);
     break;
   case CD_DIAGCROSS:
-    fprintf(ctxcanvas->file, "<line x1=\"%d\" y1=\"%d\" x2=\"%d\" y2=\"%d\" style=\"fill:none; stroke:%s; opacity:%g\" />\n",
+    cdStreamPrintf(ctxcanvas->stream, "<line x1=\"%d\" y1=\"%d\" x2=\"%d\" y2=\"%d\" style=\"fill:none; stroke:%s; opacity:%g\" />\n",
       0, 0, hsize, hsize, ctxcanvas->fgColor, ctxcanvas->opacity);
-    fprintf(ctxcanvas->file, "<line x1=\"%d\" y1=\"%d\" x2=\"%d\" y2=\"%d\" style=\"fill:none; stroke:%s; opacity:%g\" />\n",
+    cdStreamPrintf(ctxcanvas->stream, "<line x1=\"%d\" y1=\"%d\" x2=\"%d\" y2=\"%d\" style=\"fill:none; stroke:%s; opacity:%g\" />\n",
       hsize, 0, 0, hsize, ctxcanvas->fgColor, ctxcanvas->opacity);
     break;
   }
 
-  fprintf(ctxcanvas->file, "</pattern>\n");
+  cdStreamPrintf(ctxcanvas->stream, "</pattern>\n");
 
   return style;
 }
@@ -873,7 +1453,7 @@ static void make_pattern(cdCtxCanvas *ctxcanvas, int n, int m, void* data, int (
   char color[20];
 
   sprintf(ctxcanvas->pattern, "url(#pattern%d)", ++ctxcanvas->last_fill_mode);
-  fprintf(ctxcanvas->file, "<pattern id=\"pattern%d\" patternUnits=\"userSpaceOnUse\" x=\"0\" y=\"0\" width=\"%d\" height=\"%d\">\n", ctxcanvas->last_fill_mode, n, m);
+  cdStreamPrintf(ctxcanvas->stream, "<pattern id=\"pattern%d\" patternUnits=\"userSpaceOnUse\" x=\"0\" y=\"0\" width=\"%d\" height=\"%d\">\n", ctxcanvas->last_fill_mode, n, m);
 
   for (j = 0; j < m; j++)
   {
@@ -889,12 +1469,12 @@ static void make_pattern(cdCtxCanvas *ctxcanvas, int n, int m, void* data, int (
 
       sprintf(color, "rgb(%d,%d,%d)", (int)r, (int)g, (int)b);
 
-      fprintf(ctxcanvas->file, "<rect x=\"%g\" y=\"%g\" width=\"%g\" height=\"%g\" style=\"fill:%s; opacity:%g\" />\n",
+      cdStreamPrintf(ctxcanvas->stream, "<rect x=\"%g\" y=\"%g\" width=\"%g\" height=\"%g\" style=\"fill:%s; opacity:%g\" />\n",
         (double)i, (double)j, 1.0, 1.0, color, ctxcanvas->opacity);
     }
   }
 
-  fprintf(ctxcanvas->file, "</pattern>\n");
+  cdStreamPrintf(ctxcanvas->stream, "</pattern>\n");
 }
 
 static int long2rgb(cdCtxCanvas *ctxcanvas, int n, int i, int j, void* data, unsigned char*r, unsigned char*g, unsigned char*b)
@@ -991,172 +1571,507 @@ static long cdforeground(cdCtxCanvas *ctxcanvas, long int color)
   return color;
 }
 
-static void cdputimagerectrgb(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *r, const unsigned char *g, const unsigned char *b, int x, int y, int w, int h, int xmin, int xmax, int ymin, int ymax)
+/* PNG images.
+   The PNG is compressed with zlib and written in base64 directly in the stream,
+   one row at a time. Each distinct image is written once inside <defs>
+   and drawn with <use>, so the same image drawn many times is encoded only once. */
+
+static const char* svg_png_filters[] = {"NONE", "SUB", "UP", "AVERAGE", "PAETH", "ADAPTIVE"};
+
+typedef struct _svgPNG
+{
+  cdStream* stream;
+  z_stream zstream;
+  int filter;
+  int bpp;        /* bytes per pixel */
+  int row_size;   /* bytes per row, without the filter type */
+  unsigned char *row, *prev_row, *filtered, *best;
+  unsigned char idat[16384];
+  unsigned char b64_rest[3];
+  int b64_count;
+  char b64_buffer[4096];
+} svgPNG;
+
+static const char svg_base64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static void sBase64Triple(const unsigned char* data, char* out)
 {
-  int i, j, d, rw, rh, rgb_size, target_size;
-  unsigned char* rgb_data, *rgb_buffer;
-  size_t buffer_size;
-  LodePNG_Encoder encoder;
-  char* rgb_target;
+  out[0] = svg_base64[data[0] >> 2];
+  out[1] = svg_base64[((data[0] & 0x03) << 4) | (data[1] >> 4)];
+  out[2] = svg_base64[((data[1] & 0x0F) << 2) | (data[2] >> 6)];
+  out[3] = svg_base64[data[2] & 0x3F];
+}
 
-  if (xmin<0 || ymin<0 || xmax-xmin+1>iw || ymax-ymin+1>ih) return;
+static void sBase64Write(svgPNG* png, const unsigned char* data, int size)
+{
+  char* out = png->b64_buffer;
+  int n = 0;
 
-  rw = xmax-xmin+1;
-  rh = ymax-ymin+1;
+  /* complete the bytes left from the previous call */
+  if (png->b64_count)
+  {
+    while (png->b64_count < 3 && size > 0)
+    {
+      png->b64_rest[png->b64_count++] = *data++;
+      size--;
+    }
 
-  rgb_size = 4*rw*rh;
-  rgb_data = (unsigned char*)malloc(rgb_size);
-  if (!rgb_data) return;
+    if (png->b64_count < 3)
+      return;
 
-  d = 0;
-  for (i=ymax; i>=ymin; i--)
+    sBase64Triple(png->b64_rest, out);
+    n = 4;
+    png->b64_count = 0;
+  }
+
+  while (size >= 3)
   {
-    for (j=xmin; j<=xmax; j++)
+    sBase64Triple(data, out + n);
+    n += 4;
+    data += 3;
+    size -= 3;
+
+    if (n == (int)sizeof(png->b64_buffer))
     {
-      rgb_data[d] = r[i*iw+j]; d++;
-      rgb_data[d] = g[i*iw+j]; d++;
-      rgb_data[d] = b[i*iw+j]; d++;
-      rgb_data[d] = (unsigned char)0xFF; d++;
+      cdStreamWrite(png->stream, out, n);
+      n = 0;
     }
   }
 
-  LodePNG_Encoder_init(&encoder);
-  LodePNG_encode(&encoder, &rgb_buffer, &buffer_size, rgb_data, rw, rh);
+  if (n)
+    cdStreamWrite(png->stream, out, n);
 
-  target_size = (buffer_size+2)/3*4+1;
-  rgb_target = (char*)malloc(target_size);
-  base64_encode(rgb_buffer, buffer_size, rgb_target, target_size);
- 
-  if (ctxcanvas->canvas->use_matrix)  /* Transformation active */
-    fprintf(ctxcanvas->file, "<image transform=\"matrix(%d %d %d %d %d %d)\" width=\"%d\" height=\"%d\" xlink:href=\"data:image/png;base64,%s\"/>\n", 
-            1, 0, 0, -1, x, y+h, w, h, rgb_target);
-  else
-    fprintf(ctxcanvas->file, "<image transform=\"matrix(%d %d %d %d %d %d)\" width=\"%d\" height=\"%d\" xlink:href=\"data:image/png;base64,%s\"/>\n", 
-            1, 0, 0, 1, x, y-h, w, h, rgb_target);
+  while (size > 0)
+  {
+    png->b64_rest[png->b64_count++] = *data++;
+    size--;
+  }
+}
 
-  free(rgb_data);
-  free(rgb_buffer);
-  free(rgb_target);
-  LodePNG_Encoder_cleanup(&encoder);
+static void sBase64End(svgPNG* png)
+{
+  char out[4];
+
+  if (!png->b64_count)
+    return;
+
+  memset(png->b64_rest + png->b64_count, 0, 3 - png->b64_count);
+  sBase64Triple(png->b64_rest, out);
+  out[3] = '=';
+  if (png->b64_count == 1)
+    out[2] = '=';
+
+  cdStreamWrite(png->stream, out, 4);
+  png->b64_count = 0;
 }
 
-static void cdputimagerectrgba(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *r, const unsigned char *g, const unsigned char *b, const unsigned char *a, int x, int y, int w, int h, int xmin, int xmax, int ymin, int ymax)
+static void sPutUInt32(unsigned char* data, unsigned long v)
+{
+  /* PNG uses big endian */
+  data[0] = (unsigned char)((v >> 24) & 0xFF);
+  data[1] = (unsigned char)((v >> 16) & 0xFF);
+  data[2] = (unsigned char)((v >> 8) & 0xFF);
+  data[3] = (unsigned char)(v & 0xFF);
+}
+
+static void sPNGChunk(svgPNG* png, const char* type, const unsigned char* data, int size)
 {
-  int i, j, d, rw, rh, rgb_size, target_size;
-  size_t buffer_size;
-  unsigned char* rgb_data, *rgb_buffer;
-  LodePNG_Encoder encoder;
-  char* rgb_target;
+  unsigned char header[8], crc_data[4];
+  unsigned long crc;
 
-  if (xmin<0 || ymin<0 || xmax-xmin+1>iw || ymax-ymin+1>ih) return;
+  sPutUInt32(header, size);
+  memcpy(header + 4, type, 4);
 
-  rw = xmax-xmin+1;
-  rh = ymax-ymin+1;
+  crc = crc32(0L, header + 4, 4);
+  if (size)
+    crc = crc32(crc, data, size);
+  sPutUInt32(crc_data, crc);
 
-  rgb_size = 4*rw*rh;
-  rgb_data = (unsigned char*)malloc(rgb_size);
-  if (!rgb_data) return;
+  sBase64Write(png, header, 8);
+  if (size)
+    sBase64Write(png, data, size);
+  sBase64Write(png, crc_data, 4);
+}
 
-  d = 0;
-  for (i=ymax; i>=ymin; i--)
+static void sPNGDeflate(svgPNG* png, const unsigned char* data, int size, int flush)
+{
+  png->zstream.next_in = (Bytef*)data;
+  png->zstream.avail_in = size;
+
+  for (;;)
   {
-    for (j=xmin; j<=xmax; j++)
+    int ret = deflate(&png->zstream, flush);
+    int idat_size = (int)sizeof(png->idat) - (int)png->zstream.avail_out;
+
+    /* each time the buffer is full an IDAT chunk is written */
+    if (png->zstream.avail_out == 0 || (ret == Z_STREAM_END && idat_size > 0))
     {
-      rgb_data[d] = r[i*iw+j]; d++;
-      rgb_data[d] = g[i*iw+j]; d++;
-      rgb_data[d] = b[i*iw+j]; d++;
-      rgb_data[d] = a[i*iw+j]; d++;
+      sPNGChunk(png, "IDAT", png->idat, idat_size);
+      png->zstream.next_out = png->idat;
+      png->zstream.avail_out = sizeof(png->idat);
     }
+
+    if (ret == Z_STREAM_END || (ret != Z_OK && ret != Z_BUF_ERROR))
+      break;
+
+    if (flush != Z_FINISH && png->zstream.avail_in == 0 && png->zstream.avail_out != 0)
+      break;
   }
+}
 
-  LodePNG_Encoder_init(&encoder);
-  LodePNG_encode(&encoder, &rgb_buffer, &buffer_size, rgb_data, rw, rh);
+static svgPNG* sPNGCreate(cdCtxCanvas *ctxcanvas, int width, int bpp)
+{
+  int filter = ctxcanvas->image_filter;
+  svgPNG* png = (svgPNG*)calloc(1, sizeof(svgPNG));
+  if (!png)
+    return NULL;
+
+  png->stream = ctxcanvas->stream;
+  png->bpp = bpp;
+  png->row_size = width*bpp;
+
+  /* PNG recommends no filter for palette images */
+  if (bpp == 1 && filter == SVG_PNG_ADAPTIVE)
+    filter = SVG_PNG_NONE;
+  png->filter = filter;
+
+  /* current and previous rows, and two filtered rows */
+  png->row = (unsigned char*)calloc(2*png->row_size + 2*(png->row_size+1), 1);
+  if (!png->row)
+  {
+    free(png);
+    return NULL;
+  }
+  png->prev_row = png->row + png->row_size;
+  png->filtered = png->prev_row + png->row_size;
+  png->best = png->filtered + png->row_size+1;
 
-  target_size = (buffer_size+2)/3*4+1;
-  rgb_target = (char*)malloc(target_size);
-  base64_encode(rgb_buffer, buffer_size, rgb_target, target_size);
+  if (deflateInit2(&png->zstream, ctxcanvas->image_level, Z_DEFLATED, 15, 8, 
+                   filter == SVG_PNG_NONE? Z_DEFAULT_STRATEGY: Z_FILTERED) != Z_OK)
+  {
+    free(png->row);
+    free(png);
+    return NULL;
+  }
 
-  if (ctxcanvas->canvas->use_matrix)  /* Transformation active */
-    fprintf(ctxcanvas->file, "<image transform=\"matrix(%d %d %d %d %d %d)\" width=\"%d\" height=\"%d\" xlink:href=\"data:image/png;base64,%s\"/>\n", 
-            1, 0, 0, -1, x, y+h, w, h, rgb_target);
+  png->zstream.next_out = png->idat;
+  png->zstream.avail_out = sizeof(png->idat);
+  return png;
+}
+
+static void sPNGBegin(svgPNG* png, int width, int height, const unsigned char* palette, int palette_count)
+{
+  static const unsigned char signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+  unsigned char ihdr[13];
+
+  sPutUInt32(ihdr, width);
+  sPutUInt32(ihdr + 4, height);
+  ihdr[8] = 8;  /* bit depth */
+  ihdr[9] = (unsigned char)(png->bpp == 1? 3: (png->bpp == 3? 2: 6));  /* color type: palette, RGB or RGBA */
+  ihdr[10] = 0;  /* compression */
+  ihdr[11] = 0;  /* filter method */
+  ihdr[12] = 0;  /* no interlace */
+
+  sBase64Write(png, signature, 8);
+  sPNGChunk(png, "IHDR", ihdr, 13);
+
+  if (palette)
+    sPNGChunk(png, "PLTE", palette, 3*palette_count);
+}
+
+static void sPNGFilter(int filter, int bpp, const unsigned char* row, const unsigned char* prev_row, unsigned char* out, int size)
+{
+  int i;
+
+  *out++ = (unsigned char)filter;
+
+  switch (filter)
+  {
+  case SVG_PNG_NONE:
+    memcpy(out, row, size);
+    break;
+  case SVG_PNG_SUB:
+    for (i = 0; i < bpp; i++)
+      out[i] = row[i];
+    for (; i < size; i++)
+      out[i] = (unsigned char)(row[i] - row[i-bpp]);
+    break;
+  case SVG_PNG_UP:
+    for (i = 0; i < size; i++)
+      out[i] = (unsigned char)(row[i] - prev_row[i]);
+    break;
+  case SVG_PNG_AVERAGE:
+    for (i = 0; i < bpp; i++)
+      out[i] = (unsigned char)(row[i] - (prev_row[i] >> 1));
+    for (; i < size; i++)
+      out[i] = (unsigned char)(row[i] - ((row[i-bpp] + prev_row[i]) >> 1));
+    break;
+  case SVG_PNG_PAETH:
+    for (i = 0; i < bpp; i++)
+      out[i] = (unsigned char)(row[i] - prev_row[i]);
+    for (; i < size; i++)
+    {
+      int a = row[i-bpp], b = prev_row[i], c = prev_row[i-bpp];
+      int pa = abs(b - c), pb = abs(a - c), pc = abs(a + b - 2*c);
+      int pred = (pa <= pb && pa <= pc)? a: (pb <= pc)? b: c;
+      out[i] = (unsigned char)(row[i] - pred);
+    }
+    break;
+  }
+}
+
+static void sPNGRow(svgPNG* png)
+{
+  unsigned char* out;
+  int size = png->row_size;
+
+  if (png->filter == SVG_PNG_ADAPTIVE)
+  {
+    /* the filter with the minimum sum of absolute differences */
+    long best_sum = -1;
+    int filter;
+
+    for (filter = SVG_PNG_NONE; filter <= SVG_PNG_PAETH; filter++)
+    {
+      long sum = 0;
+      int i;
+
+      sPNGFilter(filter, png->bpp, png->row, png->prev_row, png->filtered, size);
+
+      for (i = 1; i <= size; i++)
+        sum += abs((int)(signed char)png->filtered[i]);
+
+      if (best_sum < 0 || sum < best_sum)
+      {
+        unsigned char* tmp = png->best;
+        png->best = png->filtered;
+        png->filtered = tmp;
+        best_sum = sum;
+      }
+    }
+
+    out = png->best;
+  }
   else
-    fprintf(ctxcanvas->file, "<image transform=\"matrix(%d %d %d %d %d %d)\" width=\"%d\" height=\"%d\" xlink:href=\"data:image/png;base64,%s\"/>\n", 
-            1, 0, 0, 1, x, y-h, w, h, rgb_target);
+  {
+    sPNGFilter(png->filter, png->bpp, png->row, png->prev_row, png->filtered, size);
+    out = png->filtered;
+  }
+
+  sPNGDeflate(png, out, size+1, Z_NO_FLUSH);
 
-  free(rgb_data);
-  free(rgb_buffer);
-  free(rgb_target);
-  LodePNG_Encoder_cleanup(&encoder);
+  /* the current row will be the previous row */
+  out = png->prev_row;
+  png->prev_row = png->row;
+  png->row = out;
 }
 
-static void cdputimagerectmap(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *index, const long int *colors, int x, int y, int w, int h, int xmin, int xmax, int ymin, int ymax)
+static void sPNGEnd(svgPNG* png)
 {
-  int i, j, d, rw, rh, rgb_size, target_size;
-  unsigned char* rgb_data, *rgb_buffer;
-  size_t buffer_size;
-  LodePNG_Encoder encoder;
-  char* rgb_target;
+  sPNGDeflate(png, NULL, 0, Z_FINISH);
+  sPNGChunk(png, "IEND", NULL, 0);
+  sBase64End(png);
 
-  if (xmin<0 || ymin<0 || xmax-xmin+1>iw || ymax-ymin+1>ih) return;
+  deflateEnd(&png->zstream);
+  free(png->row < png->prev_row? png->row: png->prev_row);
+  free(png);
+}
+
+static int sImageFind(cdCtxCanvas *ctxcanvas, const svgImage* image)
+{
+  int i;
+  for (i = 0; i < ctxcanvas->image_count; i++)
+  {
+    const svgImage* list = ctxcanvas->image_list + i;
+    if (list->crc == image->crc && list->adler == image->adler && 
+        list->width == image->width && list->height == image->height && list->bpp == image->bpp)
+      return i;
+  }
+  return -1;
+}
 
-  rw = xmax-xmin+1;
-  rh = ymax-ymin+1;
+static void sImageAdd(cdCtxCanvas *ctxcanvas, const svgImage* image)
+{
+  if (ctxcanvas->image_count == ctxcanvas->image_size)
+  {
+    int size = ctxcanvas->image_size? 2*ctxcanvas->image_size: 32;
+    svgImage* list = (svgImage*)realloc(ctxcanvas->image_list, size*sizeof(svgImage));
+    if (!list)
+      return;  /* the image will not be reused */
+    ctxcanvas->image_list = list;
+    ctxcanvas->image_size = size;
+  }
 
-  rgb_size = 4*rw*rh;
-  rgb_data = (unsigned char*)malloc(rgb_size);
-  if (!rgb_data) return;
+  ctxcanvas->image_list[ctxcanvas->image_count++] = *image;
+}
 
-  d = 0;
-  for (i=ymax; i>=ymin; i--)
+static void sImageHash(svgImage* image, const unsigned char* data, int size)
+{
+  image->crc = crc32(image->crc, data, size);
+  image->adler = adler32(image->adler, data, size);
+}
+
+static void sPutImage(cdCtxCanvas *ctxcanvas, int iw, const unsigned char *r, const unsigned char *g, const unsigned char *b, const unsigned char *a, 
+                      const unsigned char *index, const long int *colors, int x, int y, int w, int h, int xmin, int xmax, int ymin, int ymax)
+{
+  unsigned char palette[3*256];
+  int i, j, id, palette_count = 0;
+  svgImage image;
+
+  image.width = xmax-xmin+1;
+  image.height = ymax-ymin+1;
+  image.crc = crc32(0L, NULL, 0);
+  image.adler = adler32(0L, NULL, 0);
+
+  if (index)
   {
-    for (j=xmin; j<=xmax; j++)
+    image.bpp = 1;
+
+    for (i = ymin; i <= ymax; i++)
     {
-      unsigned char r, g, b;
-      cdDecodeColor(colors[index[i*iw+j]], &r, &g, &b);
-      rgb_data[d] = r; d++;
-      rgb_data[d] = g; d++;
-      rgb_data[d] = b; d++;
-      rgb_data[d] = (unsigned char)0xFF; d++;
+      for (j = xmin; j <= xmax; j++)
+      {
+        if (index[i*iw+j] >= palette_count)
+          palette_count = index[i*iw+j]+1;
+      }
     }
+
+    for (i = 0; i < palette_count; i++)
+      cdDecodeColor(colors[i], palette + 3*i, palette + 3*i+1, palette + 3*i+2);
+
+    sImageHash(&image, palette, 3*palette_count);
   }
+  else
+  {
+    image.bpp = 3;
+
+    /* RGBA only if there is a pixel not opaque */
+    if (a)
+    {
+      for (i = ymin; i <= ymax && image.bpp == 3; i++)
+      {
+        for (j = xmin; j <= xmax; j++)
+        {
+          if (a[i*iw+j] != 255)
+          {
+            image.bpp = 4;
+            break;
+          }
+        }
+      }
+    }
+  }
+
+  for (i = ymin; i <= ymax; i++)
+  {
+    int offset = i*iw+xmin;
+    if (index)
+      sImageHash(&image, index + offset, image.width);
+    else
+    {
+      sImageHash(&image, r + offset, image.width);
+      sImageHash(&image, g + offset, image.width);
+      sImageHash(&image, b + offset, image.width);
+      if (image.bpp == 4)
+        sImageHash(&image, a + offset, image.width);
+    }
+  }
+
+  id = sImageFind(ctxcanvas, &image);
+  if (id < 0)
+  {
+    svgPNG* png = sPNGCreate(ctxcanvas, image.width, image.bpp);
+    if (!png)
+      return;
 
-  LodePNG_Encoder_init(&encoder);
-  LodePNG_encode(&encoder, &rgb_buffer, &buffer_size, rgb_data, rw, rh);
+    id = ++ctxcanvas->last_image;
+    image.id = id;
 
-  target_size = (buffer_size+2)/3*4+1;
-  rgb_target = (char*)malloc(target_size);
-  base64_encode(rgb_buffer, buffer_size, rgb_target, target_size);
+    cdStreamPrintf(ctxcanvas->stream, "<defs><image id=\"image%d\" width=\"%d\" height=\"%d\" xlink:href=\"data:image/png;base64,", id, image.width, image.height);
+
+    sPNGBegin(png, image.width, image.height, index? palette: NULL, palette_count);
+
+    /* the image is bottom-up */
+    for (i = ymax; i >= ymin; i--)
+    {
+      int offset = i*iw+xmin;
+      unsigned char* row = png->row;
+
+      if (index)
+        memcpy(row, index + offset, image.width);
+      else
+      {
+        for (j = 0; j < image.width; j++)
+        {
+          *row++ = r[offset+j];
+          *row++ = g[offset+j];
+          *row++ = b[offset+j];
+          if (image.bpp == 4)
+            *row++ = a[offset+j];
+        }
+      }
+
+      sPNGRow(png);
+    }
+
+    sPNGEnd(png);
+
+    cdStreamPrintf(ctxcanvas->stream, "\"/></defs>\n");
+
+    sImageAdd(ctxcanvas, &image);
+  }
+  else
+    id = ctxcanvas->image_list[id].id;
 
   if (ctxcanvas->canvas->use_matrix)  /* Transformation active */
-    fprintf(ctxcanvas->file, "<image transform=\"matrix(%d %d %d %d %d %d)\" width=\"%d\" height=\"%d\" xlink:href=\"data:image/png;base64,%s\"/>\n", 
-            1, 0, 0, -1, x, y+h, w, h, rgb_target);
+    cdStreamPrintf(ctxcanvas->stream, "<use xlink:href=\"#image%d\" transform=\"matrix(%g %d %d %g %d %d)\"/>\n", 
+            id, (double)w/image.width, 0, 0, -(double)h/image.height, x, y+h);
   else
-    fprintf(ctxcanvas->file, "<image transform=\"matrix(%d %d %d %d %d %d)\" width=\"%d\" height=\"%d\" xlink:href=\"data:image/png;base64,%s\"/>\n", 
-            1, 0, 0, 1, x, y-h, w, h, rgb_target);
+    cdStreamPrintf(ctxcanvas->stream, "<use xlink:href=\"#image%d\" transform=\"matrix(%g %d %d %g %d %d)\"/>\n", 
+            id, (double)w/image.width, 0, 0, (double)h/image.height, x, y-h);
+}
+
+static void cdputimagerectrgb(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *r, const unsigned char *g, const unsigned char *b, int x, int y, int w, int h, int xmin, int xmax, int ymin, int ymax)
+{
+  if (xmin<0 || ymin<0 || xmax-xmin+1>iw || ymax-ymin+1>ih) return;
 
-  free(rgb_data);
-  free(rgb_buffer);
-  free(rgb_target);
-  LodePNG_Encoder_cleanup(&encoder);
+  sPutImage(ctxcanvas, iw, r, g, b, NULL, NULL, NULL, x, y, w, h, xmin, xmax, ymin, ymax);
+}
+
+static void cdputimagerectrgba(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *r, const unsigned char *g, const unsigned char *b, const unsigned char *a, int x, int y, int w, int h, int xmin, int xmax, int ymin, int ymax)
+{
+  if (xmin<0 || ymin<0 || xmax-xmin+1>iw || ymax-ymin+1>ih) return;
+
+  sPutImage(ctxcanvas, iw, r, g, b, a, NULL, NULL, x, y, w, h, xmin, xmax, ymin, ymax);
+}
+
+static void cdputimagerectmap(cdCtxCanvas *ctxcanvas, int iw, int ih, const unsigned char *index, const long int *colors, int x, int y, int w, int h, int xmin, int xmax, int ymin, int ymax)
+{
+  if (xmin<0 || ymin<0 || xmax-xmin+1>iw || ymax-ymin+1>ih) return;
+
+  sPutImage(ctxcanvas, iw, NULL, NULL, NULL, NULL, index, colors, x, y, w, h, xmin, xmax, ymin, ymax);
 }
 
 static void cdpixel(cdCtxCanvas *ctxcanvas, int x, int y, long int color)
 {
+  const char* style;
   unsigned char r, g, b;
   cdDecodeColor(color, &r, &g, &b);
 
-  fprintf(ctxcanvas->file, "<circle cx=\"%d\" cy=\"%d\" r=\"0.5\" style=\"fill:rgb(%d,%d,%d); stroke:none; opacity:%g\" />\n",
-          x, y, r, g, b, ctxcanvas->opacity);
+  sprintf(ctxcanvas->style, "fill:rgb(%d,%d,%d); stroke:none; opacity:%g", r, g, b, ctxcanvas->opacity);
+  style = sStyleAttribStr(ctxcanvas, ctxcanvas->style);
+
+  cdStreamPrintf(ctxcanvas->stream, "<circle cx=\"%d\" cy=\"%d\" r=\"0.5\" %s />\n", x, y, style);
 }
 
 static void cddeactivate (cdCtxCanvas* ctxcanvas)
 {
-  fflush(ctxcanvas->file);
+  cdStreamFlush(ctxcanvas->stream);
 }
 
 static void cdflush (cdCtxCanvas* ctxcanvas)
 {
-  fflush(ctxcanvas->file);
+  cdStreamFlush(ctxcanvas->stream);
 }
 
 static void set_hatchboxsize_attrib(cdCtxCanvas *ctxcanvas, char* data)
@@ -1215,9 +2130,139 @@ static cdAttribute opacity_attrib =
   get_opacity_attrib
 }; 
 
+static void set_precision_attrib(cdCtxCanvas *ctxcanvas, char* data)
+{
+  int precision = -1;
+
+  if (data)
+    sscanf(data, "%d", &precision);
+
+  if (precision > 9) precision = 9;
+  if (precision < 0) precision = -1;
+  ctxcanvas->precision = precision;
+}
+
+static char* get_precision_attrib(cdCtxCanvas *ctxcanvas)
+{
+  static char data[50];
+  if (ctxcanvas->precision < 0)
+    return NULL;
+  sprintf(data, "%d", ctxcanvas->precision);
+  return data;
+}
+
+static cdAttribute precision_attrib =
+{
+  "PRECISION",
+  set_precision_attrib,
+  get_precision_attrib
+}; 
+
+static void set_relativepath_attrib(cdCtxCanvas *ctxcanvas, char* data)
+{
+  if (data && data[0] == '1')
+    ctxcanvas->relative_path = 1;
+  else
+    ctxcanvas->relative_path = 0;
+}
+
+static char* get_relativepath_attrib(cdCtxCanvas *ctxcanvas)
+{
+  if (ctxcanvas->relative_path)
+    return "1";
+  else
+    return "0";
+}
+
+static cdAttribute relativepath_attrib =
+{
+  "RELATIVEPATH",
+  set_relativepath_attrib,
+  get_relativepath_attrib
+}; 
+
+static void set_styleclass_attrib(cdCtxCanvas *ctxcanvas, char* data)
+{
+  if (data && data[0] == '1')
+    ctxcanvas->style_class = 1;
+  else
+    ctxcanvas->style_class = 0;
+}
+
+static char* get_styleclass_attrib(cdCtxCanvas *ctxcanvas)
+{
+  if (ctxcanvas->style_class)
+    return "1";
+  else
+    return "0";
+}
+
+static cdAttribute styleclass_attrib =
+{
+  "STYLECLASS",
+  set_styleclass_attrib,
+  get_styleclass_attrib
+}; 
+
+static void set_imagecompression_attrib(cdCtxCanvas *ctxcanvas, char* data)
+{
+  int level = 6;
+
+  if (data)
+    sscanf(data, "%d", &level);
+
+  if (level < 0) level = 0;
+  if (level > 9) level = 9;
+  ctxcanvas->image_level = level;
+}
+
+static char* get_imagecompression_attrib(cdCtxCanvas *ctxcanvas)
+{
+  static char data[50];
+  sprintf(data, "%d", ctxcanvas->image_level);
+  return data;
+}
+
+static cdAttribute imagecompression_attrib =
+{
+  "IMAGECOMPRESSION",
+  set_imagecompression_attrib,
+  get_imagecompression_attrib
+}; 
+
+static void set_imagefilter_attrib(cdCtxCanvas *ctxcanvas, char* data)
+{
+  int filter;
+
+  ctxcanvas->image_filter = SVG_PNG_ADAPTIVE;
+  if (!data)
+    return;
+
+  for (filter = SVG_PNG_NONE; filter <= SVG_PNG_ADAPTIVE; filter++)
+  {
+    if (cdStrEqualNoCase(data, svg_png_filters[filter]))
+    {
+      ctxcanvas->image_filter = filter;
+      break;
+    }
+  }
+}
+
+static char* get_imagefilter_attrib(cdCtxCanvas *ctxcanvas)
+{
+  return (char*)svg_png_filters[ctxcanvas->image_filter];
+}
+
+static cdAttribute imagefilter_attrib =
+{
+  "IMAGEFILTER",
+  set_imagefilter_attrib,
+  get_imagefilter_attrib
+}; 
+
 static void set_cmd_attrib(cdCtxCanvas *ctxcanvas, char* data)
 {
-  fprintf(ctxcanvas->file, "%s", data);
+  cdStreamPrintf(ctxcanvas->stream, "%s", data);
 }
 
 static cdAttribute cmd_attrib =
@@ -1231,20 +2276,43 @@ static void cdcreatecanvas(cdCanvas *canvas, void *data)
 {
   char filename[10240] = "";
   char* strdata = (char*)data;
+  char* line;
   double res = 3.78;
   double w_mm = INT_MAX*res, 
          h_mm = INT_MAX*res;
+  int gzip = 0;
   cdCtxCanvas* ctxcanvas;
 
   strdata += cdGetFileName(strdata, filename);
   if (filename[0] == 0)
     return;
 
+  /* get options */
+  line = strdata;
+  while (*line != '\0')
+  {
+    while (*line != '\0' && *line != '-') 
+      line++;
+
+    if (*line != '\0')
+    {
+      line++;
+      if (*line++ == 'z')
+        gzip = 1;
+    }
+
+    while (*line != '\0' && *line != ' ') 
+      line++;
+  }
+
   ctxcanvas = (cdCtxCanvas *)malloc(sizeof(cdCtxCanvas));
   memset(ctxcanvas, 0, sizeof(cdCtxCanvas));
 
-  ctxcanvas->file = fopen(filename, "w");
-  if (!ctxcanvas->file)
+  ctxcanvas->stream = cdStreamOpenOutput(filename, gzip);
+  if (ctxcanvas->stream && gzip)
+    ctxcanvas->stream = cdStreamOpenZip(ctxcanvas->stream, 1);  /* SVGZ */
+
+  if (!ctxcanvas->stream)
   {
     free(ctxcanvas);
     return;
@@ -1276,6 +2344,7 @@ static void cdcreatecanvas(cdCanvas *canvas, void *data)
   ctxcanvas->last_fill_mode = -1;
   ctxcanvas->last_clip_poly = -1;
   ctxcanvas->last_clip_rect = -1;
+  ctxcanvas->last_image = -1;
   
   ctxcanvas->clip_control  = 0;
   ctxcanvas->transform_control = 0;
@@ -1283,16 +2352,24 @@ static void cdcreatecanvas(cdCanvas *canvas, void *data)
   ctxcanvas->clip_polygon = 0;
   ctxcanvas->hatchboxsize = 8;
   ctxcanvas->opacity = 1.0;
+  ctxcanvas->precision = -1;
+  ctxcanvas->image_level = 6;
+  ctxcanvas->image_filter = SVG_PNG_ADAPTIVE;
 
   /* custom attributes */
   cdRegisterAttribute(canvas, &cmd_attrib);
   cdRegisterAttribute(canvas, &hatchboxsize_attrib);
   cdRegisterAttribute(canvas, &opacity_attrib);
+  cdRegisterAttribute(canvas, &precision_attrib);
+  cdRegisterAttribute(canvas, &relativepath_attrib);
+  cdRegisterAttribute(canvas, &styleclass_attrib);
+  cdRegisterAttribute(canvas, &imagecompression_attrib);
+  cdRegisterAttribute(canvas, &imagefilter_attrib);
 
   /* header */
-  fprintf(ctxcanvas->file, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
-  fprintf(ctxcanvas->file, "<svg xmlns=\"http://www.w3.org/2000/svg\" xmlns:xlink=\"http://www.w3.org/1999/xlink\" width=\"%gpt\" height=\"%gpt\" viewBox=\"0 0 %d %d\" version=\"1.1\">\n", CD_MM2PT*canvas->w_mm, CD_MM2PT*canvas->h_mm, canvas->w, canvas->h);
-  fprintf(ctxcanvas->file, "<g>\n"); /* open global container */
+  cdStreamPrintf(ctxcanvas->stream, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+  cdStreamPrintf(ctxcanvas->stream, "<svg xmlns=\"http://www.w3.org/2000/svg\" xmlns:xlink=\"http://www.w3.org/1999/xlink\" width=\"%gpt\" height=\"%gpt\" viewBox=\"0 0 %d %d\" version=\"1.1\">\n", CD_MM2PT*canvas->w_mm, CD_MM2PT*canvas->h_mm, canvas->w, canvas->h);
+  cdStreamPrintf(ctxcanvas->stream, "<g>\n"); /* open global container */
 }
 
 static void cdinittable(cdCanvas* canvas)
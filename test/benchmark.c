@@ -0,0 +1,516 @@
+/* CD Benchmark
+
+   Plays CD Metafiles and synthetic stress scenes into several drivers and
+   reports one JSON record per line for each scene and driver, with the
+   number of primitives, vertices and pixels, the elapsed time, the
+   throughput, the bytes produced and the peak memory of the process.
+
+   Usage: benchmark [-d driver] [-s scene] [-n repeat] [-f factor] [-o dir] [-k] [file.mf ...]
+
+   -d  runs only the given driver (IMAGERGB, PICTURE, SVG, PS, CGM or METAFILE).
+   -s  runs only the given scene (LINES, TEXT, POLYGONS, IMAGES or the file name).
+   -n  plays each scene "repeat" times and reports the fastest (default 1).
+   -f  multiplies the size of the synthetic scenes, use for instance 0.01 for a quick run (default 1).
+   -o  directory of the output files (default ".").
+   -k  keeps the output files.
+
+   The primitives and pixels are counted once for each scene using CD_PROFILE.
+   Only images have pixels, so the pixels throughput is reported only for
+   scenes with images.
+   The time includes the creation and the destruction of the canvas, so the
+   files are completely written. The peak memory is the maximum of the process
+   up to that record, to measure a single scene and driver use -d and -s.
+   When a scene fails, for instance when its font is not found, an error is
+   printed in stderr and the program returns 1.
+
+   Example: benchmark -n 3 mf/lines.mf mf/poly.mf > cd-5.8.jsonl
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <sys/stat.h>
+
+#ifdef WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#include <cd.h>
+#include <cdirgb.h>
+#include <cdpicture.h>
+#include <cdsvg.h>
+#include <cdps.h>
+#include <cdcgm.h>
+#include <cdmf.h>
+#include <cdprofile.h>
+
+
+#define BENCH_WIDTH  1024
+#define BENCH_HEIGHT 768
+#define BENCH_RES    3.78   /* pixels/mm, 96 DPI */
+
+typedef struct _benchDriver {
+  const char* name;
+  cdContext* (*context)(void);
+  const char* ext;         /* NULL for drivers that do not write a file */
+} benchDriver;
+
+static benchDriver bench_drivers[] = {
+  {"IMAGERGB", cdContextImageRGB, NULL},
+  {"PICTURE",  cdContextPicture,  NULL},
+  {"SVG",      cdContextSVG,      "svg"},
+  {"PS",       cdContextPS,       "ps"},
+  {"CGM",      cdContextCGM,      "cgm"},
+  {"METAFILE", cdContextMetafile, "mf"}
+};
+
+#define BENCH_NUM_DRIVERS (int)(sizeof(bench_drivers)/sizeof(benchDriver))
+
+typedef struct _benchScene {
+  const char* name;
+  int (*draw)(cdCanvas* canvas, const char* filename);  /* returns 0 if failed */
+  const char* filename;    /* for metafiles */
+  int w, h;
+} benchScene;
+
+static double bench_factor = 1;
+static unsigned int bench_seed = 1;
+
+static double benchTime(void)
+{
+#ifdef WIN32
+  static double freq = 0;
+  LARGE_INTEGER count;
+  if (freq == 0)
+  {
+    LARGE_INTEGER f;
+    QueryPerformanceFrequency(&f);
+    freq = (double)f.QuadPart / 1000.;
+  }
+  QueryPerformanceCounter(&count);
+  return (double)count.QuadPart / freq;
+#else
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec*1000. + tv.tv_usec/1000.;
+#endif
+}
+
+/* peak memory of the process in Kb */
+static long benchPeakMemory(void)
+{
+#ifdef WIN32
+  PROCESS_MEMORY_COUNTERS pmc;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+    return (long)(pmc.PeakWorkingSetSize / 1024);
+  return 0;
+#else
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return (long)(usage.ru_maxrss / 1024);  /* in bytes */
+#else
+  return (long)usage.ru_maxrss;
+#endif
+#endif
+}
+
+/* same sequence in every platform */
+static int benchRandom(int max)
+{
+  bench_seed = bench_seed * 1103515245 + 12345;
+  return (int)((bench_seed >> 8) % (unsigned int)max);
+}
+
+static int benchCount(int count)
+{
+  count = (int)(count * bench_factor);
+  return count < 1? 1: count;
+}
+
+static int benchEqualNoCase(const char* str1, const char* str2)
+{
+  while (*str1 && *str2 && toupper((unsigned char)*str1) == toupper((unsigned char)*str2))
+  {
+    str1++;
+    str2++;
+  }
+  return *str1 == 0 && *str2 == 0;
+}
+
+static const char* benchFileTitle(const char* name)
+{
+  const char* p = strrchr(name, '/');
+  if (!p) p = strrchr(name, '\\');
+  return p? p+1: name;
+}
+
+static int benchMatch(const char* filter, const char* name)
+{
+  if (!filter)
+    return 1;
+
+  return benchEqualNoCase(filter, name) || benchEqualNoCase(filter, benchFileTitle(name));
+}
+
+/********************************************************************/
+/* Scenes                                                           */
+/********************************************************************/
+
+static int benchDrawLines(cdCanvas* canvas, const char* filename)
+{
+  int i, n = benchCount(1000000);
+  (void)filename;
+
+  for (i = 0; i < n; i++)
+  {
+    if (i % 1000 == 0)
+      cdCanvasForeground(canvas, cdEncodeColor((unsigned char)benchRandom(256), (unsigned char)benchRandom(256), (unsigned char)benchRandom(256)));
+
+    cdCanvasLine(canvas, benchRandom(BENCH_WIDTH), benchRandom(BENCH_HEIGHT),
+                         benchRandom(BENCH_WIDTH), benchRandom(BENCH_HEIGHT));
+  }
+
+  return 1;
+}
+
+static int benchDrawText(cdCanvas* canvas, const char* filename)
+{
+  int i, n = benchCount(100000), w = 0, h = 0;
+  char label[50];
+  (void)filename;
+
+  /* if the font is not found the scene would measure nothing */
+  if (!cdCanvasFont(canvas, "Helvetica", CD_PLAIN, 10))
+  {
+    fprintf(stderr, "benchmark: font Helvetica not found\n");
+    return 0;
+  }
+
+  cdCanvasGetTextSize(canvas, "Label 0", &w, &h);
+  if (w <= 0 || h <= 0)
+  {
+    fprintf(stderr, "benchmark: font Helvetica has an empty text size\n");
+    return 0;
+  }
+
+  for (i = 0; i < n; i++)
+  {
+    if (i % 1000 == 0)
+      cdCanvasForeground(canvas, cdEncodeColor((unsigned char)benchRandom(256), (unsigned char)benchRandom(256), (unsigned char)benchRandom(256)));
+
+    sprintf(label, "Label %d", i);
+    cdCanvasText(canvas, benchRandom(BENCH_WIDTH), benchRandom(BENCH_HEIGHT), label);
+  }
+
+  return 1;
+}
+
+static int benchDrawPolygons(cdCanvas* canvas, const char* filename)
+{
+  int i, j, n = benchCount(100), nv = 10000;
+  (void)filename;
+
+  cdCanvasSetAttribute(canvas, "ANTIALIAS", "1");
+
+  for (i = 0; i < n; i++)
+  {
+    /* star shaped polygons that cover most of the canvas */
+    int xc = BENCH_WIDTH/2 + benchRandom(BENCH_WIDTH/4) - BENCH_WIDTH/8,
+        yc = BENCH_HEIGHT/2 + benchRandom(BENCH_HEIGHT/4) - BENCH_HEIGHT/8;
+
+    cdCanvasForeground(canvas, cdEncodeAlpha(cdEncodeColor((unsigned char)benchRandom(256), (unsigned char)benchRandom(256), (unsigned char)benchRandom(256)), 128));
+
+    cdCanvasBegin(canvas, CD_FILL);
+    for (j = 0; j < nv; j++)
+    {
+      double angle = (j * 2 * 3.14159265358979) / nv;
+      double radius = BENCH_HEIGHT/4 + benchRandom(BENCH_HEIGHT/4);
+      cdfCanvasVertex(canvas, xc + radius*cos(angle), yc + radius*sin(angle));
+    }
+    cdCanvasEnd(canvas);
+  }
+
+  return 1;
+}
+
+static int benchDrawImages(cdCanvas* canvas, const char* filename)
+{
+  int i, n = benchCount(100), iw = 256, ih = 256;
+  unsigned char *r, *g, *b, *a;
+  (void)filename;
+
+  r = (unsigned char*)malloc(iw*ih*4);
+  g = r + iw*ih;
+  b = g + iw*ih;
+  a = b + iw*ih;
+
+  for (i = 0; i < iw*ih; i++)
+  {
+    int x = i % iw, y = i / iw;
+    r[i] = (unsigned char)x;
+    g[i] = (unsigned char)y;
+    b[i] = (unsigned char)(x ^ y);
+    a[i] = (unsigned char)((x + y) / 2);
+  }
+
+  for (i = 0; i < n; i++)
+    cdCanvasPutImageRectRGBA(canvas, iw, ih, r, g, b, a,
+                             benchRandom(BENCH_WIDTH - iw), benchRandom(BENCH_HEIGHT - ih),
+                             0, 0, 0, 0, 0, 0);
+
+  free(r);
+  return 1;
+}
+
+static int bench_mf_w = 0, bench_mf_h = 0;
+
+static int benchSizeCB(cdCanvas* canvas, int w, int h, double w_mm, double h_mm)
+{
+  (void)canvas; (void)w_mm; (void)h_mm;
+  bench_mf_w = w;
+  bench_mf_h = h;
+  return CD_CONTINUE;
+}
+
+static int benchDrawMetafile(cdCanvas* canvas, const char* filename)
+{
+  return cdCanvasPlay(canvas, CD_METAFILE, 0, 0, 0, 0, (void*)filename) == CD_OK;
+}
+
+/********************************************************************/
+/* Measure                                                          */
+/********************************************************************/
+
+static cdCanvas* benchCreateCanvas(benchDriver* driver, const char* filename, int w, int h)
+{
+  double w_mm = w / BENCH_RES, h_mm = h / BENCH_RES;
+  cdContext* context = driver->context();
+
+  if (context == CD_IMAGERGB)
+    return cdCreateCanvasf(context, "%dx%d -a", w, h);
+  else if (context == CD_PICTURE)
+    return cdCreateCanvasf(context, "%g", BENCH_RES);
+  else if (context == CD_PS)
+    return cdCreateCanvasf(context, "\"%s\" -w%g -h%g -s96 -l0 -r0 -b0 -t0", filename, w_mm, h_mm);
+  else
+    return cdCreateCanvasf(context, "\"%s\" %gx%g %g", filename, w_mm, h_mm, BENCH_RES);
+}
+
+static double benchFileSize(const char* filename)
+{
+  struct stat st;
+  if (stat(filename, &st) != 0)
+    return 0;
+  return (double)st.st_size;
+}
+
+/* counts the primitives of the scene drawing it in a picture, returns 0 if failed */
+static int benchCountScene(benchScene* scene, double *primitives, double *vertices, double *pixels)
+{
+  cdCanvas* picture = cdCreateCanvas(CD_PICTURE, NULL);
+  cdCanvas* canvas = cdCreateCanvas(CD_PROFILE, picture);
+  char* report;
+  int ret;
+
+  bench_seed = 1;
+  bench_mf_w = 0;
+  bench_mf_h = 0;
+  ret = scene->draw(canvas, scene->filename);
+
+  *primitives = 0;
+  *vertices = 0;
+  *pixels = 0;
+
+  cdCanvasSetAttribute(canvas, "PROFILEFORMAT", "JSON");
+  report = cdCanvasGetAttribute(canvas, "PROFILE");
+  report = report? strstr(report, "\"primitives\":"): NULL;
+  if (report)
+    sscanf(report, "\"primitives\": {\"calls\": %lf, \"vertices\": %lf, \"pixels\": %lf", primitives, vertices, pixels);
+
+  cdKillCanvas(canvas);
+  cdKillCanvas(picture);
+
+  if (scene->filename)
+  {
+    /* some files have an invalid size */
+    if (bench_mf_w > 0 && bench_mf_w <= 16384 && bench_mf_h > 0 && bench_mf_h <= 16384)
+    {
+      scene->w = bench_mf_w;
+      scene->h = bench_mf_h;
+    }
+    else
+    {
+      scene->w = BENCH_WIDTH;
+      scene->h = BENCH_HEIGHT;
+    }
+  }
+
+  return ret;
+}
+
+/* returns 0 if failed */
+static int benchRun(benchScene* scene, benchDriver* driver, int repeat, const char* dir, int keep)
+{
+  char filename[10240] = "";
+  double primitives, vertices, pixels, time = -1, bytes = 0;
+  int i, ret = 1;
+
+  if (!benchCountScene(scene, &primitives, &vertices, &pixels))
+  {
+    fprintf(stderr, "benchmark: scene %s FAILED\n", scene->name);
+    return 0;
+  }
+
+  if (driver->ext)
+  {
+    sprintf(filename, "%s/bench_%s.%s", dir, benchFileTitle(scene->name), driver->ext);
+  }
+
+  for (i = 0; i < repeat; i++)
+  {
+    cdCanvas* canvas;
+    double start = benchTime(), end;
+
+    canvas = benchCreateCanvas(driver, filename, scene->w, scene->h);
+    if (!canvas)
+    {
+      fprintf(stderr, "benchmark: failed to create the %s canvas for %s\n", driver->name, scene->name);
+      return 0;
+    }
+
+    bench_seed = 1;
+    if (!scene->draw(canvas, scene->filename))
+      ret = 0;
+
+    if (cdCanvasGetContext(canvas) == CD_PICTURE)
+    {
+      /* the serialization is not part of the drawing */
+      int size = 0;
+      unsigned char* data;
+      end = benchTime();
+      data = cdPictureSaveData(canvas, &size);
+      bytes = size;
+      if (data) free(data);
+      cdKillCanvas(canvas);
+    }
+    else
+    {
+      if (cdCanvasGetContext(canvas) == CD_IMAGERGB)
+        bytes = (double)scene->w * scene->h * 4;
+      cdKillCanvas(canvas);
+      end = benchTime();
+    }
+
+    if (time < 0 || end - start < time)
+      time = end - start;
+  }
+
+  if (driver->ext)
+  {
+    bytes = benchFileSize(filename);
+    if (!keep)
+      remove(filename);
+  }
+
+  if (!ret)
+  {
+    fprintf(stderr, "benchmark: scene %s FAILED in the %s driver\n", scene->name, driver->name);
+    return 0;
+  }
+
+  if (time <= 0)
+    time = 0.001;  /* timer resolution */
+
+  printf("{\"version\": \"%s\", \"scene\": \"%s\", \"driver\": \"%s\", \"width\": %d, \"height\": %d, "
+         "\"primitives\": %.0f, \"vertices\": %.0f, \"pixels\": %.0f, \"time_ms\": %.3f, "
+         "\"primitives_per_sec\": %.0f, ",
+         cdVersion(), scene->name, driver->name, scene->w, scene->h,
+         primitives, vertices, pixels, time,
+         (primitives * 1000.) / time);
+  if (pixels > 0)  /* vector only scenes have no pixels */
+    printf("\"pixels_per_sec\": %.0f, ", (pixels * 1000.) / time);
+  printf("\"bytes\": %.0f, \"peak_memory_kb\": %ld}\n", bytes, benchPeakMemory());
+  fflush(stdout);
+  return 1;
+}
+
+int main(int argc, char* argv[])
+{
+  benchScene scenes[] = {
+    {"LINES",    benchDrawLines,    NULL, BENCH_WIDTH, BENCH_HEIGHT},
+    {"TEXT",     benchDrawText,     NULL, BENCH_WIDTH, BENCH_HEIGHT},
+    {"POLYGONS", benchDrawPolygons, NULL, BENCH_WIDTH, BENCH_HEIGHT},
+    {"IMAGES",   benchDrawImages,   NULL, BENCH_WIDTH, BENCH_HEIGHT}
+  };
+  int num_scenes = sizeof(scenes)/sizeof(benchScene);
+  const char *driver_filter = NULL, *scene_filter = NULL, *dir = ".";
+  int i, d, repeat = 1, keep = 0, ok = 1;
+
+  for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != 0; i++)
+  {
+    char opt = argv[i][1];
+    if (opt == 'k')
+      keep = 1;
+    else if (i+1 < argc && (opt == 'd' || opt == 's' || opt == 'n' || opt == 'f' || opt == 'o'))
+    {
+      i++;
+      switch (opt)
+      {
+      case 'd': driver_filter = argv[i]; break;
+      case 's': scene_filter = argv[i]; break;
+      case 'n': repeat = atoi(argv[i]); if (repeat < 1) repeat = 1; break;
+      case 'f': bench_factor = atof(argv[i]); break;
+      case 'o': dir = argv[i]; break;
+      }
+    }
+    else
+    {
+      fprintf(stderr, "Usage: benchmark [-d driver] [-s scene] [-n repeat] [-f factor] [-o dir] [-k] [file.mf ...]\n");
+      return 1;
+    }
+  }
+
+  cdContextRegisterCallback(CD_METAFILE, CD_SIZECB, (cdCallback)benchSizeCB);
+
+  /* the metafiles first, then the synthetic scenes */
+  for (; i < argc; i++)
+  {
+    benchScene mf_scene;
+    mf_scene.name = argv[i];
+    mf_scene.draw = benchDrawMetafile;
+    mf_scene.filename = argv[i];
+    mf_scene.w = 0;
+    mf_scene.h = 0;
+
+    if (!benchMatch(scene_filter, mf_scene.name))
+      continue;
+
+    for (d = 0; d < BENCH_NUM_DRIVERS; d++)
+    {
+      if (benchMatch(driver_filter, bench_drivers[d].name))
+        ok &= benchRun(&mf_scene, bench_drivers + d, repeat, dir, keep);
+    }
+  }
+
+  for (i = 0; i < num_scenes; i++)
+  {
+    if (!benchMatch(scene_filter, scenes[i].name))
+      continue;
+
+    for (d = 0; d < BENCH_NUM_DRIVERS; d++)
+    {
+      if (benchMatch(driver_filter, bench_drivers[d].name))
+        ok &= benchRun(scenes + i, bench_drivers + d, repeat, dir, keep);
+    }
+  }
+
+  return ok? 0: 1;
+}
@@ -0,0 +1,10 @@
+APPNAME = benchmark
+APPTYPE = console
+               
+USE_CD = Yes
+
+SRC = benchmark.c
+
+ifneq ($(findstring Win, $(TEC_SYSNAME)), )
+  LIBS = psapi
+endif
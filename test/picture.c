@@ -0,0 +1,186 @@
+/* CD Picture blob test
+
+   Saves a picture with an integer and a float path, loads it back,
+   then corrupts the path actions so they do not use exactly the stored
+   points and checks that cdPictureLoadData rejects the blob.
+
+   Also plays a picture one primitive at a time, changing the attributes
+   of the target canvas between the steps, and checks that the picture
+   attributes are set again.
+
+   Usage: picture
+   Returns 0 if all the checks pass.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cd.h>
+#include <cdirgb.h>
+#include <cdpicture.h>
+
+static int path_actions[] = {CD_PATH_NEW, CD_PATH_MOVETO, CD_PATH_LINETO, CD_PATH_LINETO, CD_PATH_CLOSE, CD_PATH_FILL};
+#define PATH_N (int)(sizeof(path_actions)/sizeof(int))
+
+static void drawPaths(cdCanvas* canvas)
+{
+  cdCanvasBegin(canvas, CD_PATH);
+  cdCanvasPathSet(canvas, CD_PATH_NEW);
+  cdCanvasPathSet(canvas, CD_PATH_MOVETO);
+  cdCanvasVertex(canvas, 10, 10);
+  cdCanvasPathSet(canvas, CD_PATH_LINETO);
+  cdCanvasVertex(canvas, 90, 10);
+  cdCanvasPathSet(canvas, CD_PATH_LINETO);
+  cdCanvasVertex(canvas, 50, 90);
+  cdCanvasPathSet(canvas, CD_PATH_CLOSE);
+  cdCanvasPathSet(canvas, CD_PATH_FILL);
+  cdCanvasEnd(canvas);
+
+  cdCanvasBegin(canvas, CD_PATH);
+  cdCanvasPathSet(canvas, CD_PATH_NEW);
+  cdCanvasPathSet(canvas, CD_PATH_MOVETO);
+  cdfCanvasVertex(canvas, 10.5, 10.5);
+  cdCanvasPathSet(canvas, CD_PATH_LINETO);
+  cdfCanvasVertex(canvas, 90.5, 10.5);
+  cdCanvasPathSet(canvas, CD_PATH_LINETO);
+  cdfCanvasVertex(canvas, 50.5, 90.5);
+  cdCanvasPathSet(canvas, CD_PATH_CLOSE);
+  cdCanvasPathSet(canvas, CD_PATH_FILL);
+  cdCanvasEnd(canvas);
+}
+
+static void putInt(unsigned char* p, int v)
+{
+  /* the blob is little endian */
+  p[0] = (unsigned char)(v & 0xFF);
+  p[1] = (unsigned char)((v >> 8) & 0xFF);
+  p[2] = (unsigned char)((v >> 16) & 0xFF);
+  p[3] = (unsigned char)((v >> 24) & 0xFF);
+}
+
+/* returns the offset of the n-th stored path actions, or -1 */
+static int findPath(const unsigned char* data, int size, int n)
+{
+  unsigned char pattern[4*(PATH_N+1)];
+  int i, found = 0;
+
+  putInt(pattern, PATH_N);
+  for (i = 0; i < PATH_N; i++)
+    putInt(pattern + 4*(i+1), path_actions[i]);
+
+  for (i = 0; i + (int)sizeof(pattern) <= size; i++)
+  {
+    if (memcmp(data + i, pattern, sizeof(pattern)) == 0)
+    {
+      if (found == n)
+        return i + 4;
+      found++;
+    }
+  }
+
+  return -1;
+}
+
+static int checkLoad(const char* name, const unsigned char* data, int size, int expected)
+{
+  cdCanvas* canvas = cdCreateCanvas(CD_PICTURE, "");
+  int ret = cdPictureLoadData(canvas, data, size);
+  cdKillCanvas(canvas);
+
+  printf("%s: %s\n", name, ret == expected? "ok": "FAILED");
+  return ret == expected;
+}
+
+static int checkCorrupted(const char* name, const unsigned char* data, int size, int path, int action_index, int action)
+{
+  unsigned char* copy;
+  int offset, ok;
+
+  offset = findPath(data, size, path);
+  if (offset < 0)
+  {
+    printf("%s: path not found in the blob, FAILED\n", name);
+    return 0;
+  }
+
+  copy = (unsigned char*)malloc(size);
+  memcpy(copy, data, size);
+  putInt(copy + offset + 4*action_index, action);
+
+  ok = checkLoad(name, copy, size, CD_ERROR);
+  free(copy);
+  return ok;
+}
+
+static int checkStepAttributes(void)
+{
+  static unsigned char r[100*100], g[100*100], b[100*100];
+  cdCanvas *pic, *canvas;
+  cdPlayer* player;
+  char data[100];
+  int ok;
+
+  pic = cdCreateCanvas(CD_PICTURE, "");
+  cdCanvasForeground(pic, CD_RED);
+  cdCanvasLineWidth(pic, 3);
+  cdCanvasLine(pic, 10, 10, 90, 10);
+  cdCanvasLine(pic, 10, 50, 90, 50);
+
+  sprintf(data, "100x100 %p %p %p", r, g, b);
+  canvas = cdCreateCanvas(CD_IMAGERGB, data);
+
+  player = cdCanvasPlayBegin(canvas, CD_PICTURE, 0, 0, 0, 0, pic);
+  cdPlayerStep(player, 1, 0);
+  cdCanvasForeground(canvas, CD_BLUE);
+  cdCanvasLineWidth(canvas, 1);
+  cdPlayerStep(player, 1, 0);
+  cdPlayerEnd(player);
+
+  cdKillCanvas(canvas);
+  cdKillCanvas(pic);
+
+  /* the second line must be red and 3 pixels wide */
+  ok = r[50*100+50] == 255 && b[50*100+50] == 0 && r[51*100+50] == 255;
+  printf("attributes changed between steps: %s\n", ok? "ok": "FAILED");
+  return ok;
+}
+
+int main(void)
+{
+  cdCanvas* canvas;
+  unsigned char* data;
+  int size, ok = 1, path;
+
+  canvas = cdCreateCanvas(CD_PICTURE, "");
+  drawPaths(canvas);
+  data = cdPictureSaveData(canvas, &size);
+  cdKillCanvas(canvas);
+
+  if (!data)
+  {
+    printf("cdPictureSaveData: FAILED\n");
+    return 1;
+  }
+
+  ok &= checkLoad("valid blob", data, size, CD_OK);
+
+  for (path = 0; path < 2; path++)
+  {
+    char name[100];
+
+    /* 5 points instead of 3, would read past the points */
+    sprintf(name, "%s path with more points", path == 0? "integer": "float");
+    ok &= checkCorrupted(name, data, size, path, 2, CD_PATH_CURVETO);
+
+    /* 2 points instead of 3 */
+    sprintf(name, "%s path with less points", path == 0? "integer": "float");
+    ok &= checkCorrupted(name, data, size, path, 3, CD_PATH_CLOSE);
+  }
+
+  free(data);
+
+  ok &= checkStepAttributes();
+
+  return ok? 0: 1;
+}
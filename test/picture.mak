@@ -0,0 +1,6 @@
+APPNAME = picture
+APPTYPE = console
+               
+USE_CD = Yes
+
+SRC = picture.c